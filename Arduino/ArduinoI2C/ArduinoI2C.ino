@@ -193,5 +193,34 @@ void loop() {
     return;
   }
   Serial.println(vbus);
+
+  // read position, velocity, Iq and the axis error in one transaction
+  const uint16_t offset = axis_num * odrive::per_axis_offset;
+  const uint16_t map[] = {
+    odrive::AXIS__ENCODER__POS_ESTIMATE + offset,
+    odrive::AXIS__ENCODER__PLL_VEL + offset,
+    odrive::AXIS__MOTOR__CURRENT_CONTROL__IQ_MEASURED + offset,
+    odrive::AXIS__ERROR + offset
+  };
+  uint8_t buffer[14];
+  success = odrive::set_register_map(odrive_num, map, 4)
+         && odrive::read_register_map(odrive_num, buffer, sizeof(buffer));
+  if (!success) {
+    Serial.println("error");
+    return;
+  }
+  float pos, vel, iq;
+  odrive::endpoint_type_t<odrive::AXIS__ERROR> error;
+  size_t pos_in_buffer = odrive::decode_register<odrive::AXIS__ENCODER__POS_ESTIMATE>(buffer, 0, &pos);
+  pos_in_buffer = odrive::decode_register<odrive::AXIS__ENCODER__PLL_VEL>(buffer, pos_in_buffer, &vel);
+  pos_in_buffer = odrive::decode_register<odrive::AXIS__MOTOR__CURRENT_CONTROL__IQ_MEASURED>(buffer, pos_in_buffer, &iq);
+  odrive::decode_register<odrive::AXIS__ERROR>(buffer, pos_in_buffer, &error);
+  Serial.print(pos);
+  Serial.print(" ");
+  Serial.print(vel);
+  Serial.print(" ");
+  Serial.print(iq);
+  Serial.print(" ");
+  Serial.println(error);
 }
 
@@ -6,6 +6,8 @@
 *   - Use read_property<PropertyId>() to read properties from the ODrive.
 *   - Use write_property<PropertyId>() to modify properties on the ODrive.
 *   - Use trigger<PropertyId>() to trigger a function (such as reboot or save_configuration)
+*   - Use set_register_map() and read_register_map() to read several
+*     properties in one I2C transaction.
 *   - Use endpoint_type_t<PropertyId> to retrieve the underlying type
 *     of a given property.
 *   - Refer to PropertyId for a list of available properties.
@@ -56,6 +58,8 @@ bool I2C_transaction(uint8_t slave_addr, const uint8_t * tx_buffer, size_t tx_le
 
 namespace odrive {
     static constexpr const uint8_t i2c_addr = (0xD << 3); // write: 1101xxx0, read: 1101xxx1
+    static constexpr const uint16_t register_map_address = 0x7ffe;
+    static constexpr const size_t register_map_max_entries = 16;
 
     template<typename T>
     using bit_width = std::integral_constant<unsigned int, CHAR_BIT * sizeof(T)>;
@@ -175,6 +179,63 @@ namespace odrive {
     }
 
 
+    /* @brief Selects the properties that read_register_map() returns.
+    * The ODrive answers every following read with their current values until
+    * another property is accessed, set_register_map(num, nullptr, 0) selects
+    * the same map again. The map is lost when the ODrive reboots.
+    *
+    * Usage example:
+    *   const uint16_t map[] = {
+    *       odrive::AXIS__ENCODER__POS_ESTIMATE,
+    *       odrive::AXIS__ENCODER__PLL_VEL,
+    *       odrive::AXIS__ENCODER__POS_ESTIMATE + odrive::per_axis_offset};
+    *   success = odrive::set_register_map(0, map, 3);
+    *
+    * Note that the Arduino Wire library transfers at most 32 bytes, which
+    * limits the map to 14 entries and a read to 32 bytes.
+    *
+    * @param num Selects the ODrive. For instance the value 4 selects
+    * the ODrive that has [A2, A1, A0] connected to [VCC, GND, GND].
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    bool set_register_map(uint8_t num, const uint16_t* addresses, size_t count) {
+        uint8_t i2c_tx_buffer[4 + 2 * register_map_max_entries];
+        if (count > register_map_max_entries)
+            return false;
+        write_le<uint16_t>(i2c_tx_buffer, register_map_address);
+        for (size_t i = 0; i < count; ++i)
+            write_le<uint16_t>(i2c_tx_buffer + 2 + 2 * i, addresses[i]);
+        write_le<uint16_t>(i2c_tx_buffer + 2 + 2 * count, json_crc);
+        return I2C_transaction(i2c_addr + num, i2c_tx_buffer, 4 + 2 * count, nullptr, 0);
+    }
+
+    /* @brief Reads the values of the properties selected with
+    * set_register_map() in one transaction. They are concatenated in their
+    * native sizes, use decode_register() to extract them.
+    *
+    * Usage example:
+    *   uint8_t buffer[12];
+    *   float pos0, vel0, pos1;
+    *   success = odrive::read_register_map(0, buffer, sizeof(buffer));
+    *   size_t offset = odrive::decode_register<odrive::AXIS__ENCODER__POS_ESTIMATE>(buffer, 0, &pos0);
+    *   offset = odrive::decode_register<odrive::AXIS__ENCODER__PLL_VEL>(buffer, offset, &vel0);
+    *   offset = odrive::decode_register<odrive::AXIS__ENCODER__POS_ESTIMATE>(buffer, offset, &pos1);
+    *
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    bool read_register_map(uint8_t num, uint8_t* buffer, size_t length) {
+        return I2C_transaction(i2c_addr + num, nullptr, 0, buffer, length);
+    }
+
+    /* @brief Decodes the value at the offset of a register map read
+    * @return the offset of the next value
+    */
+    template<int IPropertyId>
+    size_t decode_register(const uint8_t* buffer, size_t offset, endpoint_type_t<IPropertyId>* value) {
+        *value = read_le<endpoint_type_t<IPropertyId>>(buffer + offset);
+        return offset + byte_width<endpoint_type_t<IPropertyId>>::value;
+    }
+
     /* @brief Checks if the axis is in the requested state and the error register is clear */
     bool check_axis_state(uint8_t num, uint8_t axis, uint8_t state) {
         endpoint_type_t<odrive::AXIS__CURRENT_STATE> observed_state = 0;
@@ -11,9 +11,81 @@ static const int kMotorStrideBool = 4;
 static const int kMotorOffsetUint16 = 0;
 static const int kMotorStrideUint16 = 2;
 
-// Print with stream operator
-template<class T> inline Print& operator <<(Print &obj,     T arg) { obj.print(arg);    return obj; }
-template<>        inline Print& operator <<(Print &obj, float arg) { obj.print(arg, 4); return obj; }
+// Binary protocol, see docs/ascii-protocol.md
+static const uint8_t kBinarySync = 0xA5;
+static const uint8_t kBinarySetPosition = 0x01;
+static const uint8_t kBinarySetVelocity = 0x02;
+static const uint8_t kBinarySetTorque = 0x03;
+static const uint8_t kBinaryGetFeedback = 0x04;
+static const uint8_t kBinaryFeedWatchdog = 0x05;
+static const uint8_t kBinaryResponseFlag = 0x80;
+
+static uint8_t crc8(uint8_t crc, const uint8_t* data, size_t length) {
+    while (length--) {
+        crc ^= *(data++);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x37) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+// Commands are formatted into a buffer and written at once instead of
+// through one Stream print per token.
+class CommandBuffer {
+public:
+    CommandBuffer& operator <<(const char* str) {
+        while (*str && length_ < sizeof(buffer_))
+            buffer_[length_++] = *(str++);
+        return *this;
+    }
+    CommandBuffer& operator <<(char c) {
+        if (length_ < sizeof(buffer_))
+            buffer_[length_++] = c;
+        return *this;
+    }
+    CommandBuffer& operator <<(long value) {
+        return (value < 0) ? (*this << '-').appendUint(-(unsigned long)value) : appendUint((unsigned long)value);
+    }
+    CommandBuffer& operator <<(int value) { return *this << (long)value; }
+    // 4 decimals, like Print::print(value, 4)
+    CommandBuffer& operator <<(float value) {
+        if (isnan(value))
+            return *this << "nan";
+        if (value < 0.0f) {
+            *this << '-';
+            value = -value;
+        }
+        if (value > 4294967040.0f)
+            return *this << "ovf";
+        uint32_t integer = (uint32_t)value;
+        uint32_t fraction = (uint32_t)((value - (float)integer) * 10000.0f + 0.5f);
+        if (fraction >= 10000) {
+            integer++;
+            fraction -= 10000;
+        }
+        appendUint(integer) << '.';
+        for (uint32_t digit = 1000; digit; digit /= 10)
+            *this << (char)('0' + (fraction / digit) % 10);
+        return *this;
+    }
+    void send(Stream& stream) { stream.write((const uint8_t*)buffer_, length_); }
+
+private:
+    CommandBuffer& appendUint(unsigned long value) {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[n++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+        while (n)
+            *this << digits[--n];
+        return *this;
+    }
+
+    char buffer_[64];
+    size_t length_ = 0;
+};
 
 ODriveArduino::ODriveArduino(Stream& serial)
     : serial_(serial) {}
@@ -27,7 +99,7 @@ void ODriveArduino::SetPosition(int motor_number, float position, float velocity
 }
 
 void ODriveArduino::SetPosition(int motor_number, float position, float velocity_feedforward, float current_feedforward) {
-    serial_ << "p " << motor_number  << " " << position << " " << velocity_feedforward << " " << current_feedforward << "\n";
+    (CommandBuffer() << "p " << motor_number << ' ' << position << ' ' << velocity_feedforward << ' ' << current_feedforward << '\n').send(serial_);
 }
 
 void ODriveArduino::SetVelocity(int motor_number, float velocity) {
@@ -35,15 +107,15 @@ void ODriveArduino::SetVelocity(int motor_number, float velocity) {
 }
 
 void ODriveArduino::SetVelocity(int motor_number, float velocity, float current_feedforward) {
-    serial_ << "v " << motor_number  << " " << velocity << " " << current_feedforward << "\n";
+    (CommandBuffer() << "v " << motor_number << ' ' << velocity << ' ' << current_feedforward << '\n').send(serial_);
 }
 
 void ODriveArduino::SetCurrent(int motor_number, float current) {
-    serial_ << "c " << motor_number << " " << current << "\n";
+    (CommandBuffer() << "c " << motor_number << ' ' << current << '\n').send(serial_);
 }
 
 void ODriveArduino::TrapezoidalMove(int motor_number, float position){
-    serial_ << "t " << motor_number << " " << position << "\n";
+    (CommandBuffer() << "t " << motor_number << ' ' << position << '\n').send(serial_);
 }
 
 float ODriveArduino::readFloat() {
@@ -51,7 +123,7 @@ float ODriveArduino::readFloat() {
 }
 
 float ODriveArduino::GetVelocity(int motor_number){
-	serial_<< "r axis" << motor_number << ".encoder.vel_estimate\n";
+	(CommandBuffer() << "r axis" << motor_number << ".encoder.vel_estimate\n").send(serial_);
 	return ODriveArduino::readFloat();
 }
 
@@ -61,17 +133,170 @@ int32_t ODriveArduino::readInt() {
 
 bool ODriveArduino::run_state(int axis, int requested_state, bool wait_for_idle, float timeout) {
     int timeout_ctr = (int)(timeout * 10.0f);
-    serial_ << "w axis" << axis << ".requested_state " << requested_state << '\n';
+    (CommandBuffer() << "w axis" << axis << ".requested_state " << requested_state << '\n').send(serial_);
     if (wait_for_idle) {
         do {
             delay(100);
-            serial_ << "r axis" << axis << ".current_state\n";
+            (CommandBuffer() << "r axis" << axis << ".current_state\n").send(serial_);
         } while (readInt() != AXIS_STATE_IDLE && --timeout_ctr > 0);
     }
 
     return timeout_ctr > 0;
 }
 
+void ODriveArduino::SetPositionBinary(int motor_number, float position, float velocity_feedforward, float current_feedforward) {
+    float values[] = {position, velocity_feedforward, current_feedforward};
+    writeBinaryFrame(kBinarySetPosition, motor_number, values, 3);
+}
+
+void ODriveArduino::SetVelocityBinary(int motor_number, float velocity, float current_feedforward) {
+    float values[] = {velocity, current_feedforward};
+    writeBinaryFrame(kBinarySetVelocity, motor_number, values, 2);
+}
+
+void ODriveArduino::SetCurrentBinary(int motor_number, float current) {
+    writeBinaryFrame(kBinarySetTorque, motor_number, &current, 1);
+}
+
+void ODriveArduino::FeedWatchdogBinary(int motor_number) {
+    writeBinaryFrame(kBinaryFeedWatchdog, motor_number, nullptr, 0);
+}
+
+bool ODriveArduino::GetFeedbackBinary(int motor_number, float& position, float& velocity) {
+    writeBinaryFrame(kBinaryGetFeedback, motor_number, nullptr, 0);
+
+    // Response: sync, command, motor, pos, vel, crc
+    uint8_t frame[12];
+    serial_.setTimeout(1000);
+    do {
+        if (serial_.readBytes(frame, 1) != 1)
+            return false;
+    } while (frame[0] != kBinarySync);
+    if (serial_.readBytes(frame + 1, sizeof(frame) - 1) != sizeof(frame) - 1)
+        return false;
+    if (frame[1] != (kBinaryGetFeedback | kBinaryResponseFlag) || frame[2] != motor_number
+            || crc8(0x42, frame + 1, 10) != frame[11])
+        return false;
+    memcpy(&position, frame + 3, sizeof(float));
+    memcpy(&velocity, frame + 7, sizeof(float));
+    return true;
+}
+
+void ODriveArduino::writeBinaryFrame(uint8_t command, int motor_number, const float* values, size_t num_values) {
+    uint8_t frame[2 + 1 + 3 * sizeof(float) + 1];
+    size_t length = 0;
+    frame[length++] = kBinarySync;
+    frame[length++] = command;
+    frame[length++] = (uint8_t)motor_number;
+    for (size_t i = 0; i < num_values; ++i) {
+        memcpy(frame + length, &values[i], sizeof(float)); // all Arduino targets are little endian
+        length += sizeof(float);
+    }
+    frame[length] = crc8(0x42, frame + 1, length - 1);
+    serial_.write(frame, length + 1);
+}
+
+bool ODriveArduino::RequestProperty(const char* property, uint8_t tag) {
+    if (pending_count_ >= kMaxPending)
+        return false;
+    (CommandBuffer() << "r " << property << '\n').send(serial_);
+    return addPending(tag, kResponseAscii, 0);
+}
+
+bool ODriveArduino::RequestVelocity(int motor_number, uint8_t tag) {
+    if (pending_count_ >= kMaxPending)
+        return false;
+    (CommandBuffer() << "r axis" << motor_number << ".encoder.vel_estimate\n").send(serial_);
+    return addPending(tag, kResponseAscii, motor_number);
+}
+
+bool ODriveArduino::RequestState(int axis, uint8_t tag) {
+    if (pending_count_ >= kMaxPending)
+        return false;
+    (CommandBuffer() << "r axis" << axis << ".current_state\n").send(serial_);
+    return addPending(tag, kResponseAscii, axis);
+}
+
+bool ODriveArduino::RequestFeedbackBinary(int motor_number, uint8_t tag) {
+    if (pending_count_ >= kMaxPending)
+        return false;
+    writeBinaryFrame(kBinaryGetFeedback, motor_number, nullptr, 0);
+    return addPending(tag, kResponseFeedbackBinary, motor_number);
+}
+
+void ODriveArduino::Poll() {
+    while (pending_count_) {
+        const Pending& request = pending_[pending_head_];
+        if (millis() - request.sent_ms >= response_timeout_ms_) {
+            completePending(false);
+            continue;
+        }
+        if (!serial_.available())
+            return;
+        uint8_t c = (uint8_t)serial_.read();
+
+        if (request.kind == kResponseAscii) {
+            if (c == '\n') {
+                line_[line_length_] = 0;
+                responses_[(responses_head_ + responses_count_) % kMaxPending].value = (float)atof(line_);
+                completePending(line_length_ > 0);
+            } else if (c != '\r' && line_length_ < sizeof(line_) - 1) {
+                line_[line_length_++] = (char)c;
+            }
+        } else {
+            // Response: sync, command, motor, pos, vel, crc
+            if (frame_length_ == 0 && c != kBinarySync)
+                continue;
+            frame_[frame_length_++] = c;
+            if (frame_length_ == sizeof(frame_)) {
+                Response& response = responses_[(responses_head_ + responses_count_) % kMaxPending];
+                memcpy(&response.position, frame_ + 3, sizeof(float));
+                memcpy(&response.velocity, frame_ + 7, sizeof(float));
+                completePending(frame_[1] == (kBinaryGetFeedback | kBinaryResponseFlag)
+                        && frame_[2] == request.motor_number
+                        && crc8(0x42, frame_ + 1, 10) == frame_[11]);
+            }
+        }
+    }
+}
+
+bool ODriveArduino::GetResponse(Response& response) {
+    if (!responses_count_)
+        return false;
+    response = responses_[responses_head_];
+    responses_head_ = (responses_head_ + 1) % kMaxPending;
+    responses_count_--;
+    return true;
+}
+
+bool ODriveArduino::addPending(uint8_t tag, ResponseKind_t kind, int motor_number) {
+    Pending& request = pending_[(pending_head_ + pending_count_) % kMaxPending];
+    request.tag = tag;
+    request.kind = (uint8_t)kind;
+    request.motor_number = (uint8_t)motor_number;
+    request.sent_ms = millis();
+    pending_count_++;
+    return true;
+}
+
+// Moves the oldest pending request to the responses. The value fields of the
+// response are filled in by the caller before.
+void ODriveArduino::completePending(bool valid) {
+    if (responses_count_ == kMaxPending) {
+        // Nobody collected the oldest response, drop it
+        responses_head_ = (responses_head_ + 1) % kMaxPending;
+        responses_count_--;
+    }
+    Response& response = responses_[(responses_head_ + responses_count_) % kMaxPending];
+    response.tag = pending_[pending_head_].tag;
+    response.valid = valid;
+    responses_count_++;
+    pending_head_ = (pending_head_ + 1) % kMaxPending;
+    pending_count_--;
+    line_length_ = 0;
+    frame_length_ = 0;
+}
+
 String ODriveArduino::readString() {
     String str = "";
     static const unsigned long timeout = 1000;
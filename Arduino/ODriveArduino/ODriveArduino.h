@@ -36,10 +36,64 @@ public:
 
     // State helper
     bool run_state(int axis, int requested_state, bool wait_for_idle, float timeout = 10.0f);
+
+    // Binary protocol, requires odrv0.config.uart0_protocol = STREAM_PROTOCOL_BINARY
+    void SetPositionBinary(int motor_number, float position, float velocity_feedforward = 0.0f, float current_feedforward = 0.0f);
+    void SetVelocityBinary(int motor_number, float velocity, float current_feedforward = 0.0f);
+    void SetCurrentBinary(int motor_number, float current);
+    void FeedWatchdogBinary(int motor_number);
+    bool GetFeedbackBinary(int motor_number, float& position, float& velocity);
+
+    // Non-blocking requests
+    // The request is sent right away and Poll() parses the response as far as
+    // it has arrived, so several ODrives can be served from one loop. The
+    // ODrive answers in order, up to kMaxPending requests can be outstanding.
+    // Don't mix these with the blocking getters while requests are pending.
+    struct Response {
+        uint8_t tag;        //<! as passed to the request
+        bool valid;         //<! false if the response timed out or was corrupt
+        float value;        //<! RequestProperty, RequestVelocity, RequestState
+        float position;     //<! RequestFeedbackBinary
+        float velocity;     //<! RequestFeedbackBinary
+    };
+    static const size_t kMaxPending = 8;
+
+    bool RequestProperty(const char* property, uint8_t tag);
+    bool RequestVelocity(int motor_number, uint8_t tag);
+    bool RequestState(int axis, uint8_t tag);
+    bool RequestFeedbackBinary(int motor_number, uint8_t tag);
+    void Poll();
+    bool GetResponse(Response& response);
+    size_t PendingRequests() const { return pending_count_; }
+    void SetResponseTimeout(unsigned long timeout_ms) { response_timeout_ms_ = timeout_ms; }
+
 private:
+    enum ResponseKind_t { kResponseAscii, kResponseFeedbackBinary };
+    struct Pending {
+        uint8_t tag;
+        uint8_t kind;
+        uint8_t motor_number;
+        unsigned long sent_ms;
+    };
+
     String readString();
+    void writeBinaryFrame(uint8_t command, int motor_number, const float* values, size_t num_values);
+    bool addPending(uint8_t tag, ResponseKind_t kind, int motor_number);
+    void completePending(bool valid);
 
     Stream& serial_;
+
+    Pending pending_[kMaxPending];
+    size_t pending_head_ = 0;
+    size_t pending_count_ = 0;
+    Response responses_[kMaxPending];
+    size_t responses_head_ = 0;
+    size_t responses_count_ = 0;
+    unsigned long response_timeout_ms_ = 1000;
+    char line_[32];         //<! ASCII response being received
+    size_t line_length_ = 0;
+    uint8_t frame_[12];     //<! binary response being received
+    size_t frame_length_ = 0;
 };
 
 #endif //ODriveArduino_h
@@ -63,6 +63,7 @@ void setup() {
   Serial.println("Send the character 's' to exectue test move");
   Serial.println("Send the character 'b' to read bus voltage");
   Serial.println("Send the character 'p' to read motor positions in a 10s loop");
+  Serial.println("Send the character 'B' to exectue the test move with the binary protocol (requires uart0_protocol = STREAM_PROTOCOL_BINARY)");
 }
 
 void loop() {
@@ -100,6 +101,19 @@ void loop() {
       }
     }
 
+    // Sinusoidal test move with the binary protocol
+    if (c == 'B') {
+      Serial.println("Executing test move");
+      for (float ph = 0.0f; ph < 6.28318530718f; ph += 0.01f) {
+        odrive.SetPositionBinary(0, 2.0f * cos(ph));
+        odrive.SetPositionBinary(1, 2.0f * sin(ph));
+        float pos, vel;
+        if (odrive.GetFeedbackBinary(0, pos, vel))
+          Serial << pos << '\t' << vel << '\n';
+        delay(5);
+      }
+    }
+
     // Read bus voltage
     if (c == 'b') {
       odrive_serial << "r vbus_voltage\n";
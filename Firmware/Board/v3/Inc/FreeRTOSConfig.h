@@ -93,7 +93,7 @@
 #endif
 
 #define configUSE_PREEMPTION                     1
-#define configSUPPORT_STATIC_ALLOCATION          0
+#define configSUPPORT_STATIC_ALLOCATION          1
 #define configSUPPORT_DYNAMIC_ALLOCATION         1
 #define configUSE_IDLE_HOOK                      1
 #define configUSE_TICK_HOOK                      0
@@ -101,13 +101,35 @@
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 7 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)65536)
+/* Threads and semaphores are allocated statically. The heap holds (see
+main.cpp and Controller::edit_cogging_map()):
+ - an editable copy of the cogging map per axis, 8 kB each, until a
+   calibrated or restored map is saved
+ - either the snapshot of a background save or a configuration image, never
+   both. Each is at most the full configuration: about 1000 fields of 12 bytes
+   plus the encoder error maps and both cogging maps, about 30 kB (compare
+   user_config_loaded).
+The worst case of 2 * 8 kB + 30 kB plus the block headers of heap_4 leaves
+about 6 kB of margin. */
+#define configTOTAL_HEAP_SIZE                    ((size_t)53248)
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_16_BIT_TICKS                   0
 #define configUSE_MUTEXES                        1
+#define configUSE_COUNTING_SEMAPHORES            1
 #define configQUEUE_REGISTRY_SIZE                8
 #define configCHECK_FOR_STACK_OVERFLOW           1
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION  1
+#define configUSE_TRACE_FACILITY                 1
+#define configGENERATE_RUN_TIME_STATS            1
+
+/* The run time stats count CPU cycles with the DWT cycle counter, see
+update_thread_stats() in main.cpp. The counter wraps after 25s at 168MHz, so
+only differences over shorter periods are meaningful. */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() do { \
+        *(volatile uint32_t*)0xE000EDFC |= (1UL << 24); /* CoreDebug->DEMCR |= TRCENA */ \
+        *(volatile uint32_t*)0xE0001000 |= 1UL;         /* DWT->CTRL |= CYCCNTENA */ \
+    } while (0)
+#define portGET_RUN_TIME_COUNTER_VALUE()         (*(volatile uint32_t*)0xE0001004) /* DWT->CYCCNT */
 
 /* Co-routine definitions. */
 #define configUSE_CO_ROUTINES                    0
@@ -124,6 +146,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskDelay                  1
 #define INCLUDE_xTaskGetSchedulerState      1
 #define INCLUDE_uxTaskGetStackHighWaterMark 1
+#define INCLUDE_xTaskGetIdleTaskHandle      1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
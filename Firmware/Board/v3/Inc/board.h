@@ -30,6 +30,28 @@
 
 #define AXIS_COUNT (2)
 
+#ifdef __cplusplus
+#include <MotorControl/axis_schedule.hpp>
+
+// M0 is on TIM1, which triggers the injected conversion of ADC2 and ADC3, M1
+// on TIM8, which triggers the regular one. The slots are half a PWM period
+// apart (timing diagram: Firmware/timing_diagram_v3.png).
+constexpr AxisSchedule_t axis_schedule[AXIS_COUNT] = {
+    {.injected = true, .slot_counting_down = false, .timings_axis = 1},
+    {.injected = false, .slot_counting_down = true, .timings_axis = 0},
+};
+static_assert(is_valid_axis_schedule(axis_schedule), "invalid axis schedule");
+
+#include <MotorControl/gpio_sampler.hpp>
+
+// All GPIO inputs of the board are on GPIOA, GPIOB and GPIOC
+using TGpioSampler = GpioSampler<3>;
+#endif
+
+// ODrive v3 only has current shunts on phase B and C, phase A is derived from
+// those. Boards that also sample phase A define CURRENT_SENSE_PHASE_A and write
+// Motor::current_meas_.phA in the current measurement callback before phase C.
+
 // Total count of GPIOs, including encoder pins, CAN pins and a dummy GPIO0.
 // ODrive v3.4 and earlier don't have GPIOs 6, 7 and 8 but to keep the numbering
 // consistent we just leave a gap in the counting scheme.
@@ -94,15 +116,29 @@ extern UART_HandleTypeDef* uart1;
 extern UART_HandleTypeDef* uart2;
 
 extern PwmInput pwm0_input;
+
+TIM_HandleTypeDef* start_pulse_counter(size_t gpio_num);
 #endif
 
 // Period in [s]
 #define CURRENT_MEAS_PERIOD ( (float)2*TIM_1_8_PERIOD_CLOCKS*(TIM_1_8_RCR+1) / (float)TIM_1_8_CLOCK_HZ )
-static const float current_meas_period = CURRENT_MEAS_PERIOD;
 
 // Frequency in [Hz]
 #define CURRENT_MEAS_HZ ( (float)(TIM_1_8_CLOCK_HZ) / (float)(2*TIM_1_8_PERIOD_CLOCKS*(TIM_1_8_RCR+1)) )
+
+// The loop frequency is selected at build time (see CONFIG_CURRENT_LOOP_FREQ),
+// so these fold into immediate operands at every use in the control loop.
+#ifdef __cplusplus
+constexpr float current_meas_period = CURRENT_MEAS_PERIOD;
+constexpr int current_meas_hz = CURRENT_MEAS_HZ;
+static_assert(TIM_1_8_CLOCK_HZ % (2 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1)) == 0,
+              "current loop frequency must be an integer number of Hz");
+// [s] from the current measurement of an axis until its PWM timings are loaded
+constexpr float axis_cpu_budget = current_meas_period / AXIS_COUNT;
+#else
+static const float current_meas_period = CURRENT_MEAS_PERIOD;
 static const int current_meas_hz = CURRENT_MEAS_HZ;
+#endif
 
 #if HW_VERSION_VOLTAGE >= 48
 #define VBUS_S_DIVIDER_RATIO 19.0f
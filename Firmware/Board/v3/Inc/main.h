@@ -67,12 +67,10 @@
 
 /* Private define ------------------------------------------------------------*/
 #define TIM_1_8_CLOCK_HZ 168000000
-#define TIM_1_8_PERIOD_CLOCKS 3500
 #define TIM_1_8_DEADTIME_CLOCKS 20
 #define TIM_APB1_CLOCK_HZ 84000000
 #define TIM_APB1_PERIOD_CLOCKS 4096
 #define TIM_APB1_DEADTIME_CLOCKS 40
-#define TIM_1_8_RCR 2
 
 #define M0_nCS_Pin GPIO_PIN_13
 #define M0_nCS_GPIO_Port GPIOC
@@ -164,6 +162,31 @@
 
 /* USER CODE BEGIN Private defines */
 #endif
+
+/* Current control loop frequency, selected with CONFIG_CURRENT_LOOP_FREQ.
+ * The ADC callback alternates between a current measurement and a DC
+ * calibration measurement on each timer update event, so there must be an
+ * odd number of half PWM periods between two updates (TIM_1_8_RCR even).
+ *   8 kHz: 24 kHz PWM, update every 3rd half period (default)
+ *  16 kHz: 48 kHz PWM, update every 3rd half period
+ *  24 kHz: 24 kHz PWM, update every half period
+ */
+#if !defined(CURRENT_LOOP_FREQ_KHZ) || CURRENT_LOOP_FREQ_KHZ == 8
+#define TIM_1_8_PERIOD_CLOCKS 3500
+#define TIM_1_8_RCR 2
+#elif CURRENT_LOOP_FREQ_KHZ == 16
+#define TIM_1_8_PERIOD_CLOCKS 1750
+#define TIM_1_8_RCR 2
+#elif CURRENT_LOOP_FREQ_KHZ == 24
+#define TIM_1_8_PERIOD_CLOCKS 3500
+#define TIM_1_8_RCR 0
+#else
+#error "unsupported CURRENT_LOOP_FREQ_KHZ (must be 8, 16 or 24)"
+#endif
+
+#if (TIM_1_8_RCR % 2) != 0
+#error "TIM_1_8_RCR must be even for the current/DC-cal measurement alternation"
+#endif
 /* USER CODE END Private defines */
 
 #ifdef __cplusplus
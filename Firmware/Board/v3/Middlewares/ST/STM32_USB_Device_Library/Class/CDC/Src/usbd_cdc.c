@@ -575,8 +575,7 @@ static uint8_t  USBD_CDC_DataIn (USBD_HandleTypeDef *pdev, uint8_t epnum)
       hcdc->CDC_Tx.State = 0;
     if (epnum == ODRIVE_OUT_EP)
       hcdc->ODRIVE_Tx.State = 0;
-    //Note: We could use independent semaphores for simoultainous USB transmission.
-    osSemaphoreRelease(sem_usb_tx);
+    ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(epnum);
     return USBD_OK;
   }
   else
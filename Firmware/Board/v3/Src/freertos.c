@@ -77,7 +77,21 @@
 /* USER CODE BEGIN Variables */
 /* USER CODE END Variables */
 osThreadId defaultTaskHandle;
-const uint32_t stack_size_default_task = 2048; // Bytes
+// Statically allocated in core coupled memory, see freertos_vars.h
+__attribute__((section(".ccmram"))) StackType_t default_task_stack[2048 / sizeof(StackType_t)];
+__attribute__((section(".ccmram"))) StaticTask_t default_task_tcb;
+const uint32_t stack_size_default_task = sizeof(default_task_stack); // Bytes
+
+// Stack and control block of the idle task, required by
+// configSUPPORT_STATIC_ALLOCATION
+__attribute__((section(".ccmram"))) static StackType_t idle_task_stack[configMINIMAL_STACK_SIZE];
+__attribute__((section(".ccmram"))) static StaticTask_t idle_task_tcb;
+
+void vApplicationGetIdleTaskMemory(StaticTask_t** ppxIdleTaskTCBBuffer, StackType_t** ppxIdleTaskStackBuffer, uint32_t* pulIdleTaskStackSize) {
+  *ppxIdleTaskTCBBuffer = &idle_task_tcb;
+  *ppxIdleTaskStackBuffer = idle_task_stack;
+  *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN FunctionPrototypes */
@@ -140,7 +154,7 @@ void MX_FREERTOS_Init(void) {
 
   /* Create the thread(s) */
   /* definition and creation of defaultTask */
-  osThreadDef(defaultTask, StartDefaultTask, osPriorityNormal, 0, stack_size_default_task / sizeof(StackType_t));
+  osThreadStaticDef(defaultTask, StartDefaultTask, osPriorityNormal, 0, stack_size_default_task / sizeof(StackType_t), default_task_stack, &default_task_tcb);
   defaultTaskHandle = osThreadCreate(osThread(defaultTask), NULL);
 
   /* USER CODE BEGIN RTOS_THREADS */
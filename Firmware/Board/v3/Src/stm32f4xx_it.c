@@ -39,6 +39,9 @@
 
 /* USER CODE BEGIN 0 */
 #include <Drivers/STM32/stm32_system.h>
+
+void crash_snapshot_capture_hard_fault(uint32_t pc, uint32_t lr, uint32_t cfsr);
+void uart_rx_idle_callback(void);
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
@@ -49,6 +52,7 @@ extern ADC_HandleTypeDef hadc3;
 extern CAN_HandleTypeDef hcan1;
 extern DMA_HandleTypeDef hdma_spi3_tx;
 extern DMA_HandleTypeDef hdma_spi3_rx;
+extern DMA_HandleTypeDef hdma_i2c1_tx;
 extern SPI_HandleTypeDef hspi3;
 extern TIM_HandleTypeDef htim5;
 extern TIM_HandleTypeDef htim8;
@@ -94,6 +98,13 @@ void get_regs(void** stack_ptr) {
   volatile bool preciserr __attribute__((unused)) = (uint32_t)cfsr & 0x200;
   volatile bool ibuserr __attribute__((unused)) = (uint32_t)cfsr & 0x100;
 
+  crash_snapshot_capture_hard_fault((uint32_t)pc, (uint32_t)lr, (uint32_t)cfsr);
+
+  // Without a debugger to look at the registers, reset so that the snapshot
+  // can be read out and the PWM outputs go back to their reset state.
+  if (!(CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk))
+    NVIC_SystemReset();
+
   volatile int stay_looping = 1;
   while(stay_looping);
 }
@@ -257,6 +268,20 @@ void DMA1_Stream5_IRQHandler(void)
   /* USER CODE END DMA1_Stream5_IRQn 1 */
 }
 
+/**
+* @brief This function handles DMA1 stream6 global interrupt.
+*/
+void DMA1_Stream6_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Stream6_IRQn 0 */
+  COUNT_IRQ(DMA1_Stream6_IRQn);
+  /* USER CODE END DMA1_Stream6_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_i2c1_tx);
+  /* USER CODE BEGIN DMA1_Stream6_IRQn 1 */
+
+  /* USER CODE END DMA1_Stream6_IRQn 1 */
+}
+
 /**
 * @brief This function handles CAN1 TX interrupts.
 */
@@ -349,6 +374,10 @@ void UART4_IRQHandler(void)
 {
   /* USER CODE BEGIN UART4_IRQn 0 */
   COUNT_IRQ(UART4_IRQn);
+  if (__HAL_UART_GET_FLAG(&huart4, UART_FLAG_IDLE) && __HAL_UART_GET_IT_SOURCE(&huart4, UART_IT_IDLE)) {
+    __HAL_UART_CLEAR_IDLEFLAG(&huart4);
+    uart_rx_idle_callback();
+  }
   /* USER CODE END UART4_IRQn 0 */
   HAL_UART_IRQHandler(&huart4);
   /* USER CODE BEGIN UART4_IRQn 1 */
@@ -120,11 +120,20 @@
 uint8_t CDCRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t ODRIVERxBufferFS[APP_RX_DATA_SIZE];
 
-/** Data to send over USB CDC are stored in this buffer   */
-uint8_t CDCTxBufferFS[APP_TX_DATA_SIZE];
-uint8_t ODRIVETxBufferFS[APP_TX_DATA_SIZE];
-
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+/** Data to send over USB CDC are stored in these buffers. Each endpoint pair
+  * has two, so the next packet can be queued while one is in flight. */
+typedef struct
+{
+  uint8_t Buffer[2][APP_TX_DATA_SIZE];
+  uint16_t Length[2];
+  uint8_t Active;   /* buffer in flight */
+  uint8_t Queued;   /* the other buffer holds the next packet */
+  osSemaphoreId* Semaphore; /* one token per free buffer */
+} CDC_TxQueueTypeDef;
+
+static CDC_TxQueueTypeDef CDCTxQueueFS = { .Semaphore = &sem_usb_tx_cdc };
+static CDC_TxQueueTypeDef ODRIVETxQueueFS = { .Semaphore = &sem_usb_tx_native };
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -154,8 +163,10 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len, uint8_t endpoint_pair);
+static int8_t CDC_TransmitCplt_FS(uint8_t endpoint_pair);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static CDC_TxQueueTypeDef* CDC_GetTxQueue(uint8_t endpoint_pair);
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
 /**
@@ -167,7 +178,8 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -179,9 +191,9 @@ static int8_t CDC_Init_FS(void)
 {
   /* USER CODE BEGIN 3 */
   /* Set Application Buffers */
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, CDCTxBufferFS, 0, CDC_OUT_EP);
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, CDCTxQueueFS.Buffer[CDCTxQueueFS.Active], 0, CDC_OUT_EP);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, CDCRxBufferFS, CDC_OUT_EP);
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, ODRIVETxBufferFS, 0, ODRIVE_OUT_EP);
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, ODRIVETxQueueFS.Buffer[ODRIVETxQueueFS.Active], 0, ODRIVE_OUT_EP);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, ODRIVERxBufferFS, ODRIVE_OUT_EP);
   return (USBD_OK);
   /* USER CODE END 3 */
@@ -323,30 +335,72 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len, uint8_t endpoint_pair)
 
   // Select EP
   USBD_CDC_EP_HandleTypeDef* hEP_Tx;
-  uint8_t* TxBuff;
   if (endpoint_pair == CDC_OUT_EP) {
     hEP_Tx = &hcdc->CDC_Tx;
-    TxBuff = CDCTxBufferFS;
   } else if (endpoint_pair == ODRIVE_OUT_EP) {
     hEP_Tx = &hcdc->ODRIVE_Tx;
-    TxBuff = ODRIVETxBufferFS;
   } else {
     return USBD_FAIL;
   }
-
-  // Check for ongoing transmission
-  if (hEP_Tx->State != 0)
-      return USBD_BUSY;
-  // memcpy Buf into UserTxBufferFS
-  memcpy(TxBuff, Buf, Len);
-  // Update Len
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, TxBuff, Len, endpoint_pair);
-  result = USBD_CDC_TransmitPacket(&hUsbDeviceFS, endpoint_pair);
+  CDC_TxQueueTypeDef* queue = CDC_GetTxQueue(endpoint_pair);
+
+  // The USB interrupt is handled in a higher priority thread, which sends
+  // the queued packet in CDC_TransmitCplt_FS
+  taskENTER_CRITICAL();
+  if (hEP_Tx->State == 0) {
+    // Endpoint idle: send right away
+    memcpy(queue->Buffer[queue->Active], Buf, Len);
+    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, queue->Buffer[queue->Active], Len, endpoint_pair);
+    result = USBD_CDC_TransmitPacket(&hUsbDeviceFS, endpoint_pair);
+  } else if (!queue->Queued) {
+    // Transmission ongoing: queue the packet in the other buffer
+    uint8_t next = queue->Active ^ 1;
+    memcpy(queue->Buffer[next], Buf, Len);
+    queue->Length[next] = Len;
+    queue->Queued = 1;
+  } else {
+    result = USBD_BUSY;
+  }
+  taskEXIT_CRITICAL();
   /* USER CODE END 7 */
   return result;
 }
 
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         Called when the IN endpoint of the endpoint pair finished a
+  *         transmission, starts the queued packet if there is one.
+  *
+  * @param  endpoint_pair: CDC_OUT_EP or ODRIVE_OUT_EP
+  * @retval USBD_OK
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t endpoint_pair)
+{
+  /* USER CODE BEGIN 8 */
+  CDC_TxQueueTypeDef* queue = CDC_GetTxQueue(endpoint_pair);
+  if (!queue)
+    return (USBD_OK);
+
+  if (queue->Queued) {
+    queue->Active ^= 1;
+    queue->Queued = 0;
+    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, queue->Buffer[queue->Active], queue->Length[queue->Active], endpoint_pair);
+    USBD_CDC_TransmitPacket(&hUsbDeviceFS, endpoint_pair);
+  }
+  osSemaphoreRelease(*queue->Semaphore);
+  return (USBD_OK);
+  /* USER CODE END 8 */
+}
+
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+static CDC_TxQueueTypeDef* CDC_GetTxQueue(uint8_t endpoint_pair)
+{
+  if (endpoint_pair == CDC_OUT_EP)
+    return &CDCTxQueueFS;
+  if (endpoint_pair == ODRIVE_OUT_EP)
+    return &ODRIVETxQueueFS;
+  return NULL;
+}
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
@@ -243,11 +243,54 @@ std::array<GpioFunction, 3> alternate_functions[GPIO_COUNT] = {
 };
 
 #if HW_VERSION_MINOR <= 2
-PwmInput pwm0_input{&htim5, {0, 0, 0, 4}}; // 0 means not in use
+PwmInput pwm0_input{&htim5, TIM_APB1_CLOCK_HZ, {0, 0, 0, 4}}; // 0 means not in use
 #else
-PwmInput pwm0_input{&htim5, {1, 2, 3, 4}};
+PwmInput pwm0_input{&htim5, TIM_APB1_CLOCK_HZ, {1, 2, 3, 4}};
 #endif
 
+// @brief Sets up a timer to count the rising edges on a GPIO in hardware,
+// used by the step/dir input. TIM5 can only do this if it isn't used for
+// the PWM inputs.
+// @returns the timer or nullptr if the GPIO can't clock a timer
+TIM_HandleTypeDef* start_pulse_counter(size_t gpio_num) {
+#if HW_VERSION_MINOR >= 3
+    uint32_t trigger;
+    if (gpio_num == 1) {
+        trigger = TIM_TS_TI1FP1; // PA0, TIM5_CH1
+    } else if (gpio_num == 2) {
+        trigger = TIM_TS_TI2FP2; // PA1, TIM5_CH2
+    } else {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < GPIO_COUNT; ++i) {
+        if (odrv.config_.gpio_modes[i] == ODriveIntf::GPIO_MODE_PWM0)
+            return nullptr;
+    }
+
+    GPIO_InitTypeDef GPIO_InitStruct;
+    GPIO_InitStruct.Pin = get_gpio(gpio_num).pin_mask_;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Alternate = GPIO_AF2_TIM5;
+    HAL_GPIO_Init(get_gpio(gpio_num).port_, &GPIO_InitStruct);
+
+    TIM_SlaveConfigTypeDef sSlaveConfig;
+    sSlaveConfig.SlaveMode = TIM_SLAVEMODE_EXTERNAL1;
+    sSlaveConfig.InputTrigger = trigger;
+    sSlaveConfig.TriggerPolarity = TIM_TRIGGERPOLARITY_RISING;
+    sSlaveConfig.TriggerPrescaler = TIM_TRIGGERPRESCALER_DIV1;
+    sSlaveConfig.TriggerFilter = 2; // 4 samples at 84MHz, the step pulses must be longer than 50ns
+    if (HAL_TIM_SlaveConfigSynchronization(&htim5, &sSlaveConfig) != HAL_OK)
+        return nullptr;
+    HAL_TIM_Base_Start(&htim5);
+    return &htim5;
+#else
+    return nullptr;
+#endif
+}
+
 extern PCD_HandleTypeDef hpcd_USB_OTG_FS; // defined in usbd_conf.c
 PCD_HandleTypeDef& usb_pcd_handle = hpcd_USB_OTG_FS;
 extern USBD_HandleTypeDef hUsbDeviceFS;
@@ -312,6 +355,8 @@ bool board_init() {
     __HAL_DBGMCU_FREEZE_TIM8();
     __HAL_DBGMCU_FREEZE_TIM13();
 
+    task_timer_init();
+
     /*
     * Initial intention of the synchronization:
     * Synchronize TIM1, TIM8 and TIM13 such that:
@@ -371,7 +416,7 @@ void TIM5_IRQHandler(void) {
     pwm0_input.on_capture();
 }
 
-void ADC_IRQ_Dispatch(ADC_HandleTypeDef* hadc, void(*callback)(ADC_HandleTypeDef* hadc, bool injected)) {
+HOT_FUNCTION void ADC_IRQ_Dispatch(ADC_HandleTypeDef* hadc, void(*callback)(ADC_HandleTypeDef* hadc, bool injected)) {
     // Injected measurements
     uint32_t JEOC = __HAL_ADC_GET_FLAG(hadc, ADC_FLAG_JEOC);
     uint32_t JEOC_IT_EN = __HAL_ADC_GET_IT_SOURCE(hadc, ADC_IT_JEOC);
@@ -388,7 +433,7 @@ void ADC_IRQ_Dispatch(ADC_HandleTypeDef* hadc, void(*callback)(ADC_HandleTypeDef
     }
 }
 
-void ADC_IRQHandler(void) {
+HOT_FUNCTION void ADC_IRQHandler(void) {
     COUNT_IRQ(ADC_IRQn);
     
     // The HAL's ADC handling mechanism adds many clock cycles of overhead
@@ -59,11 +59,22 @@ const SPI_InitTypeDef Drv8301::spi_config_ = {
     .CRCPolynomial = 10,
 };
 
+void Drv8301::enable() {
+    if (!enabled_) {
+        enable_gpio_.write(true);
+        enable_time_ = osKernelSysTick();
+        enabled_ = true;
+    }
+}
+
 bool Drv8301::init() {
-    enable_gpio_.write(true);
-    
+    enable();
+
     // Wait for driver to come online
-    osDelay(10);
+    constexpr uint32_t power_up_time = 10; // [ms]
+    uint32_t elapsed = osKernelSysTick() - enable_time_;
+    if (elapsed < power_up_time)
+        osDelay(power_up_time - elapsed);
 
     // Make sure the Fault bit is not set during startup
     uint16_t reg;
@@ -79,6 +90,7 @@ bool Drv8301::init() {
     // Wait for the DRV8301 registers to update
     osDelay(1);
 
+    polling_enabled_ = true;
     return true;
 }
 
@@ -165,6 +177,74 @@ bool Drv8301::check_fault() {
     }
 }
 
+void Drv8301::poll_status() {
+    if (!polling_enabled_ || !Stm32SpiArbiter::acquire_task(&poll_task_)) {
+        return; // previous frame still in progress
+    }
+
+    // Evaluate the response of the previous frame
+    uint16_t response = poll_rx_buf_;
+    if (poll_frames_ && poll_success_ && !(response & DRV8301_FRAME_FAULT_MASK)) {
+        size_t reg = (response & DRV8301_ADDR_MASK) >> 11;
+        if (reg < 2) {
+            status_regs_[reg] = response & DRV8301_DATA_MASK;
+            // Only take the register for the fault if it was also requested
+            // after the fault was seen.
+            if ((fault_pending_ & (1 << reg)) && (poll_frames_ >= fault_frame_ + 2)) {
+                fault_status_[reg] = status_regs_[reg];
+                fault_pending_ &= ~(1 << reg);
+                fault_status_ready_ = !fault_pending_;
+            }
+        }
+    }
+
+    bool fault = !check_fault();
+    if (fault && !fault_seen_) {
+        fault_frame_ = poll_frames_;
+        fault_pending_ = 0x3;
+    }
+    fault_seen_ = fault;
+
+    constexpr uint32_t poll_interval = 1; // [ms]
+    uint32_t now = osKernelSysTick();
+    if (!fault_pending_ && (now - poll_time_ < poll_interval)) {
+        Stm32SpiArbiter::release_task(&poll_task_);
+        return;
+    }
+    poll_time_ = now;
+
+    RegName_e reg = (poll_frames_ & 1) ? RegName_Status_2 : RegName_Status_1;
+    poll_tx_buf_ = build_ctrl_word(DRV8301_CtrlMode_Read, reg, 0);
+    poll_rx_buf_ = 0xbeef;
+    poll_success_ = false;
+    poll_frames_++;
+
+    poll_task_.config = spi_config_;
+    poll_task_.ncs_gpio = ncs_gpio_;
+    poll_task_.tx_buf = (uint8_t*)&poll_tx_buf_;
+    poll_task_.rx_buf = (uint8_t*)&poll_rx_buf_;
+    poll_task_.length = 1;
+    poll_task_.on_complete = [](void* ctx, bool success) {
+        Drv8301* drv = (Drv8301*)ctx;
+        drv->poll_success_ = success;
+        Stm32SpiArbiter::release_task(&drv->poll_task_);
+    };
+    poll_task_.on_complete_ctx = this;
+    poll_task_.next = nullptr;
+
+    spi_arbiter_->transfer_async(&poll_task_);
+}
+
+bool Drv8301::get_fault_status(uint16_t* status_reg_1, uint16_t* status_reg_2) {
+    if (!fault_status_ready_) {
+        return false;
+    }
+    fault_status_ready_ = false;
+    *status_reg_1 = fault_status_[0];
+    *status_reg_2 = fault_status_[1];
+    return true;
+}
+
 bool Drv8301::read_spi(const RegName_e regName, uint16_t* data) {
     tx_buf_ = build_ctrl_word(DRV8301_CtrlMode_Read, regName, 0);
     if (!spi_arbiter_->transfer(spi_config_, ncs_gpio_, (uint8_t *)(&tx_buf_), nullptr, 1, 1000)) {
@@ -184,7 +264,9 @@ bool Drv8301::read_spi(const RegName_e regName, uint16_t* data) {
 
     delay_us(1);
 
-    if (rx_buf_ == 0xbeef) {
+    // The response must belong to the register we requested. This fails if
+    // a frame of poll_status() went in between.
+    if (rx_buf_ == 0xbeef || (rx_buf_ & DRV8301_ADDR_MASK) != regName) {
         return false;
     }
 
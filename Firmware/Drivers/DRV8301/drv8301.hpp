@@ -77,6 +77,11 @@ extern "C" {
 #define DRV8301_RW_MASK                 (0x8000)
 
 
+//! \brief Defines the frame fault mask of the response word
+//!
+#define DRV8301_FRAME_FAULT_MASK        (0x8000)
+
+
 //! \brief Defines the R/W mask
 //!
 #define DRV8301_FAULT_TYPE_MASK         (0x07FF)
@@ -205,6 +210,13 @@ public:
         : spi_arbiter_(spi_arbiter), ncs_gpio_(ncs_gpio),
           enable_gpio_(enable_gpio), nfault_gpio_(nfault_gpio) {}
     
+    /**
+     * @brief Powers up the gate driver. init() only waits for the rest of the
+     * power-up time, so enabling all gate drivers first lets them power up
+     * in parallel.
+     */
+    void enable();
+
     /**
      * @brief Initializes the gate driver to a hardcoded default configuration.
      * Returns true on success or false otherwise (e.g. if the gate driver is
@@ -217,6 +229,25 @@ public:
     bool set_enabled(bool enabled) final { return true; }
     FaultType_e get_error();
 
+    /**
+     * @brief Advances the non-blocking readout of the status registers.
+     *
+     * Meant to be called periodically from the control loop once init()
+     * succeeded. Each call that finds the previous transfer done queues the
+     * next one with transfer_async(), so on a time-slotted bus the reads
+     * only use the slack of the encoder slots. The two status registers are
+     * read alternately, one per millisecond, or on every call while a fault
+     * is being latched.
+     */
+    void poll_status();
+
+    /**
+     * @brief Returns true once per fault (nFAULT low) as soon as both status
+     * registers were read after the fault was seen, together with their
+     * content.
+     */
+    bool get_fault_status(uint16_t* status_reg_1, uint16_t* status_reg_2);
+
     float get_midpoint() final {
         return 0.5f; // [V]
     }
@@ -428,11 +459,33 @@ private:
     Stm32Gpio enable_gpio_;
     Stm32Gpio nfault_gpio_;
 
+    bool enabled_ = false;
+    uint32_t enable_time_ = 0; // [ms] RTOS tick of enable()
+
     // We don't put these buffers on the stack because we place the stack in
     // a RAM section which cannot be used by DMA.
     uint16_t tx_buf_;
     uint16_t rx_buf_;
 
+    // Non-blocking status readout, see poll_status(). The DRV8301 returns
+    // the register requested by one frame in the next frame, so each frame
+    // requests one status register and receives the one requested before.
+    // The address in the response tells which register it holds.
+    bool polling_enabled_ = false;
+    Stm32SpiArbiter::SpiTask poll_task_;
+    uint16_t poll_tx_buf_;
+    uint16_t poll_rx_buf_;
+    volatile bool poll_success_ = false;
+    uint32_t poll_frames_ = 0; // frames started so far
+    uint32_t poll_time_ = 0; // [ms] RTOS tick of the last frame
+    uint16_t status_regs_[2] = {0, 0}; // last read Status 1 and Status 2 registers
+
+    bool fault_seen_ = false; // nFAULT was low at the last poll
+    uint32_t fault_frame_ = 0; // poll_frames_ when the fault was seen
+    uint8_t fault_pending_ = 0; // status registers not yet read since the fault, one bit per register
+    bool fault_status_ready_ = false;
+    uint16_t fault_status_[2] = {0, 0};
+
     static const SPI_InitTypeDef spi_config_;
 };
 
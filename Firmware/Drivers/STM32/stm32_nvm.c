@@ -111,16 +111,16 @@ static void HAL_FLASH_ClearError() {
 }
 
 
-// @brief Erases a flash sector. This sets all bits in the sector to 1.
-// The sector's current index is reset to the minimum value (n_reserved).
+// @brief Erases a flash sector by its HAL ID. This sets all bits in the
+// sector to 1.
 // @returns 0 on success or a non-zero error code otherwise
-int erase(sector_t *sector) {
+static int erase_sector_id(uint32_t sector_id) {
     FLASH_EraseInitTypeDef erase_struct = {
         .TypeErase = FLASH_TYPEERASE_SECTORS,
 #if defined(FLASH_OPTCR_nDBANK)
         .Banks = 0, // only used for mass erase
 #endif
-        .Sector = sector->sector_id,
+        .Sector = sector_id,
         .NbSectors = 1,
         .VoltageRange = FLASH_VOLTAGE_RANGE_3
     };
@@ -129,7 +129,6 @@ int erase(sector_t *sector) {
     uint32_t sector_error;
     if (HAL_FLASHEx_Erase(&erase_struct, &sector_error) != HAL_OK)
         goto fail;
-    sector->index = sector->n_reserved;
 
     HAL_FLASH_Lock();
     return 0;
@@ -139,6 +138,73 @@ fail:
     return HAL_FLASH_GetError(); // non-zero
 }
 
+// @brief Erases a flash sector. This sets all bits in the sector to 1.
+// The sector's current index is reset to the minimum value (n_reserved).
+// @returns 0 on success or a non-zero error code otherwise
+int erase(sector_t *sector) {
+    int status = erase_sector_id(sector->sector_id);
+    if (!status)
+        sector->index = sector->n_reserved;
+    return status;
+}
+
+
+// @brief Programs 32-bit words to an erased flash area. The flash must be
+// unlocked and idle.
+// This runs from RAM (see .RamFunc in the linker script): while the flash is
+// busy programming, any instruction fetch from the flash stalls, so the loop
+// itself doesn't add to the stall and only an interrupt that fires meanwhile
+// waits for the current word.
+// @returns 0 on success or the flash error flags otherwise
+__RAM_FUNC __attribute__((noinline, long_call))
+static uint32_t program_words(uintptr_t address, const uint8_t *data, size_t n_words) {
+    const uint32_t error_flags = FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR;
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_WORD | FLASH_CR_PG;
+    for (; n_words; --n_words, data += 4, address += 4) {
+        *(volatile uint32_t*)address = *(const uint32_t*)data;
+        __DSB();
+        while (FLASH->SR & FLASH_SR_BSY);
+        if (FLASH->SR & error_flags)
+            break;
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+    return FLASH->SR & error_flags;
+}
+
+// @brief Programs data to an erased flash area.
+// @returns 0 on success or a non-zero error code otherwise
+static int program(uintptr_t address, const uint8_t *data, size_t length) {
+    HAL_FLASH_Unlock();
+    HAL_FLASH_ClearError();
+
+    // handle unaligned start
+    for (; (address & 0x3) && length; ++data, ++address, --length)
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, address, *data) != HAL_OK)
+            goto fail;
+
+    // write 32-bit values (64-bit doesn't work)
+    if (length >= 4) {
+        uint32_t error = program_words(address, data, length >> 2);
+        if (error) {
+            HAL_FLASH_Lock();
+            return (int)error;
+        }
+        data += length & ~0x3;
+        address += length & ~0x3;
+        length &= 0x3;
+    }
+
+    // handle unaligned end
+    for (; length; ++data, ++address, --length)
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, address, *data) != HAL_OK)
+            goto fail;
+
+    HAL_FLASH_Lock();
+    return 0;
+fail:
+    HAL_FLASH_Lock();
+    return HAL_FLASH_GetError(); // non-zero
+}
 
 // @brief Writes states into the allocation table.
 // The write operation goes in the direction of increasing indices.
@@ -348,33 +414,7 @@ int NVM_write(size_t offset, uint8_t *data, size_t length) {
     if (offset + length > (n_staging_area_ << 3))
         return -1;
     sector_t *target = &sectors[1 - read_sector_];
-
-    HAL_FLASH_Unlock();
-    HAL_FLASH_ClearError();
-
-    // handle unaligned start
-    for (; (offset & 0x3) && length; ++data, ++offset, --length)
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE,
-                ((uintptr_t)&target->data[target->index]) + offset, *data) != HAL_OK)
-            goto fail;
-
-    // write 32-bit values (64-bit doesn't work)
-    for (; length >= 4; data += 4, offset += 4, length -=4)
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
-                ((uintptr_t)&target->data[target->index]) + offset, *(uint32_t*)data) != HAL_OK)
-            goto fail;
-
-    // handle unaligned end
-    for (; length; ++data, ++offset, --length)
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE,
-                ((uintptr_t)&target->data[target->index]) + offset, *data) != HAL_OK)
-            goto fail;
-
-    HAL_FLASH_Lock();
-    return 0;
-fail:
-    HAL_FLASH_Lock();
-    return HAL_FLASH_GetError(); // non-zero
+    return program(((uintptr_t)&target->data[target->index]) + offset, data, length);
 }
 
 // @brief Commits the new data to NVM atomically.
@@ -404,6 +444,155 @@ int NVM_commit(void) {
 }
 
 
+// @brief Returns the size in bytes of each of the two NVM sectors.
+// The sector functions below bypass the allocation table and can be used
+// instead of the block functions to implement a different storage format.
+size_t NVM_get_sector_size(void) {
+    return sectors[0].n_data << 3;
+}
+
+// @brief Returns the memory mapped content of a sector (0 or 1)
+const uint8_t *NVM_get_sector(unsigned sector) {
+    return (const uint8_t *)sectors[sector & 1].data;
+}
+
+// @brief Erases a sector (0 or 1). This sets all bytes to 0xff.
+// Caution: this function may take a long time (like 1 second)
+// @returns 0 on success or a non-zero error code otherwise
+int NVM_erase_sector(unsigned sector) {
+    if (sector > 1)
+        return -1;
+    return erase(&sectors[sector]);
+}
+
+// @brief Programs data to an erased area of a sector (0 or 1).
+// Bits can only be cleared, so programming the same area twice results in
+// the AND of both writes.
+// @returns 0 on success or a non-zero error code otherwise
+int NVM_program(unsigned sector, size_t offset, const uint8_t *data, size_t length) {
+    if (sector > 1 || offset + length > NVM_get_sector_size())
+        return -1;
+    return program((uintptr_t)sectors[sector].data + offset, data, length);
+}
+
+
+/*
+* Firmware staging
+*
+* A new firmware image is written to the upper half of the 768kB application
+* area (sectors 7 to 9, 384kB) while the present firmware keeps running from
+* the lower half (sectors 0 to 6), so a transfer that fails or is aborted
+* leaves the present firmware intact. Once the staged image is verified,
+* FW_STAGING_apply() copies it over the lower half from RAM and resets the
+* chip. Both images must fit into 384kB.
+*/
+
+#define FW_APP_BASE 0x08000000UL
+#define FW_STAGING_BASE 0x08060000UL
+#define FW_STAGING_SIZE 0x60000UL
+#define FW_STAGING_FIRST_SECTOR 7
+
+// End of the running image in flash, see the linker script
+extern const uint8_t _sidata[], _sdata[], _edata[];
+
+// Sizes of the flash sectors 0 to 9
+static const uint32_t fw_sector_sizes[] = {
+    0x4000, 0x4000, 0x4000, 0x4000, 0x10000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000
+};
+
+// @brief Returns the largest image that can be staged, 0 if the running
+// image itself extends into the staging area
+size_t FW_STAGING_get_max_size(void) {
+    uintptr_t image_end = (uintptr_t)_sidata + (size_t)(_edata - _sdata);
+    return image_end <= FW_STAGING_BASE ? FW_STAGING_SIZE : 0;
+}
+
+// @brief Erases the staging sectors that an image of the given size needs.
+// Caution: this takes about 1 second per 128kB sector and stalls the CPU.
+// @returns 0 on success or a non-zero error code otherwise
+int FW_STAGING_erase(size_t size) {
+    if (!size || size > FW_STAGING_get_max_size())
+        return -1;
+    uint32_t offset = 0;
+    for (unsigned sector = FW_STAGING_FIRST_SECTOR; offset < size; offset += fw_sector_sizes[sector++]) {
+        int status = erase_sector_id(sector);
+        if (status)
+            return status;
+    }
+    return 0;
+}
+
+// @brief Programs data to the erased staging area
+// @returns 0 on success or a non-zero error code otherwise
+int FW_STAGING_program(size_t offset, const uint8_t *data, size_t length) {
+    if (offset + length > FW_STAGING_get_max_size())
+        return -1;
+    return program(FW_STAGING_BASE + offset, data, length);
+}
+
+// @brief Returns the memory mapped staging area
+const uint8_t *FW_STAGING_get_data(void) {
+    return (const uint8_t *)FW_STAGING_BASE;
+}
+
+// @brief CRC-32/MPEG-2 of the staged image with the CRC peripheral. The
+// image is processed as little endian 32-bit words, a partial last word is
+// padded with 0xff (erased flash) by the host as well.
+uint32_t FW_STAGING_crc32(size_t size) {
+    __HAL_RCC_CRC_CLK_ENABLE();
+    CRC->CR = CRC_CR_RESET;
+    const volatile uint32_t *words = (const volatile uint32_t *)FW_STAGING_BASE;
+    for (size_t i = 0; i < (size + 3) / 4; ++i)
+        CRC->DR = words[i];
+    return CRC->DR;
+}
+
+// @brief Copies the staged image to the application area and resets the
+// chip. This runs from RAM with the interrupts disabled, the application
+// area is erased underneath it. It refreshes the IWDG after every step, a
+// power loss during the copy needs a USB DFU update to recover.
+__RAM_FUNC __attribute__((noinline, long_call, noreturn))
+void FW_STAGING_apply(size_t size) {
+    __disable_irq();
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_OPERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR;
+
+    // Erase the sectors of the new image. The sector sizes are computed in
+    // place, fw_sector_sizes is in the flash being erased.
+    uint32_t offset = 0;
+    for (uint32_t sector = 0; offset < size; offset += sector < 4 ? 0x4000 : sector == 4 ? 0x10000 : 0x20000, ++sector) {
+        IWDG->KR = 0xAAAA;
+        while (FLASH->SR & FLASH_SR_BSY);
+        FLASH->CR = FLASH_PSIZE_WORD | FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+        FLASH->CR |= FLASH_CR_STRT;
+        __DSB();
+        while (FLASH->SR & FLASH_SR_BSY);
+    }
+
+    // Program word by word, volatile so that it doesn't become a memcpy()
+    // in flash
+    FLASH->CR = FLASH_PSIZE_WORD | FLASH_CR_PG;
+    volatile uint32_t *dst = (volatile uint32_t *)FW_APP_BASE;
+    const volatile uint32_t *src = (const volatile uint32_t *)FW_STAGING_BASE;
+    for (size_t i = 0; i < (size + 3) / 4; ++i) {
+        if (!(i & 0x3ff))
+            IWDG->KR = 0xAAAA;
+        dst[i] = src[i];
+        __DSB();
+        while (FLASH->SR & FLASH_SR_BSY);
+    }
+    FLASH->CR = FLASH_CR_LOCK;
+
+    // Same as NVIC_SystemReset(), which may not be inlined into RAM
+    SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    for (;;);
+}
+
+
 #include <cmsis_os.h>
 #include <stdio.h>
 /** @brief Call this at startup to test/demo the NVM driver
@@ -24,6 +24,18 @@ int NVM_read(size_t offset, uint8_t *data, size_t length);
 int NVM_start_write(size_t length);
 int NVM_write(size_t offset, uint8_t *data, size_t length);
 int NVM_commit(void);
+size_t NVM_get_sector_size(void);
+const uint8_t *NVM_get_sector(unsigned sector);
+int NVM_erase_sector(unsigned sector);
+int NVM_program(unsigned sector, size_t offset, const uint8_t *data, size_t length);
+
+size_t FW_STAGING_get_max_size(void);
+int FW_STAGING_erase(size_t size);
+int FW_STAGING_program(size_t offset, const uint8_t *data, size_t length);
+const uint8_t *FW_STAGING_get_data(void);
+uint32_t FW_STAGING_crc32(size_t size);
+void FW_STAGING_apply(size_t size) __attribute__((noreturn));
+
 void NVM_demo(void);
 
 #ifdef __cplusplus
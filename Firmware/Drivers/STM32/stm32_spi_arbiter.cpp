@@ -55,6 +55,16 @@ bool Stm32SpiArbiter::start() {
     return status == HAL_OK;
 }
 
+void Stm32SpiArbiter::fail(SpiTask* task) {
+    CRITICAL_SECTION() {
+        if (task_list_ == task)
+            task_list_ = task->next;
+    }
+    if (task->on_complete) {
+        (*task->on_complete)(task->on_complete_ctx, false);
+    }
+}
+
 void Stm32SpiArbiter::transfer_async(SpiTask* task) {
     task->next = nullptr;
     
@@ -62,6 +72,15 @@ void Stm32SpiArbiter::transfer_async(SpiTask* task) {
     // We could try to do this lock free but we could also use our time for useful things.
     SpiTask** ptr = &task_list_;
     CRITICAL_SECTION() {
+        if (slotted_) {
+            // Defer the task to the slack of a slot
+            ptr = &deferred_list_;
+            if (!task_list_ && slack_available_) {
+                // The bus is idle in the slack of the current slot
+                slack_available_ = false;
+                ptr = &task_list_;
+            }
+        }
         while (*ptr)
             ptr = &(*ptr)->next;
         *ptr = task;
@@ -70,11 +89,48 @@ void Stm32SpiArbiter::transfer_async(SpiTask* task) {
     // If the list was empty before, kick off the SPI arbiter now
     if (ptr == &task_list_) {
         if (!start()) {
-            if (task->on_complete) {
-                (*task->on_complete)(task->on_complete_ctx, false);
+            fail(task);
+        }
+    }
+}
+
+bool Stm32SpiArbiter::transfer_in_slot(SpiTask* task) {
+    bool was_busy = false;
+    bool start_now = false;
+
+    CRITICAL_SECTION() {
+        slotted_ = true;
+        was_busy = task_list_ != nullptr;
+        slot_task_ = task;
+
+        if (!task) {
+            // Unused slot: the whole slot is slack
+            task = deferred_list_;
+            if (task && !was_busy) {
+                deferred_list_ = task->next;
+                task->next = nullptr;
+                task_list_ = task;
+                start_now = true;
+            }
+            slack_available_ = !start_now;
+        } else {
+            // Run the slot transfer next, ahead of all other waiting tasks
+            slack_available_ = false;
+            if (was_busy) {
+                task->next = task_list_->next;
+                task_list_->next = task;
+            } else {
+                task->next = nullptr;
+                task_list_ = task;
+                start_now = true;
             }
         }
     }
+
+    if (start_now && !start()) {
+        fail(task);
+    }
+    return !was_busy;
 }
 
 // TODO: this currently only works when called in a CMSIS thread.
@@ -116,9 +172,20 @@ void Stm32SpiArbiter::on_complete() {
     // Start next task if any
     SpiTask* next = nullptr;
     CRITICAL_SECTION() {
-        next = task_list_ = task_list_->next;
+        SpiTask* done = task_list_;
+        next = task_list_ = done->next;
+        if (!next && slotted_ && (done == slot_task_ || slack_available_)) {
+            // The bus became free within the slot: use the slack for one deferred task
+            next = deferred_list_;
+            if (next) {
+                deferred_list_ = next->next;
+                next->next = nullptr;
+                task_list_ = next;
+            }
+            slack_available_ = !next;
+        }
     }
-    if (next) {
-        start();
+    if (next && !start()) {
+        fail(next);
     }
 }
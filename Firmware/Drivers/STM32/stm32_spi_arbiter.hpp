@@ -58,6 +58,26 @@ public:
      */
     void transfer_async(SpiTask* task);
 
+    /**
+     * @brief Starts the transfer that is reserved for a time slot.
+     *
+     * The caller invokes this at fixed points in time (e.g. the PWM interrupt
+     * once per slot). After the first call the bus is time-slotted: tasks
+     * enqueued with transfer_async() are held back and only started in the
+     * slack of a slot, that is once the slot's own transfer is done, or right
+     * away if the slot has no transfer. At most one such task is started per
+     * slot so that it finishes before the next slot begins.
+     *
+     * Must not be called concurrently with itself.
+     *
+     * @param task: The transfer of this slot or nullptr if the slot is unused.
+     *        Same requirements as for transfer_async().
+     * @returns false if the slot overran, i.e. the bus was still busy with
+     *          another transfer when the slot began. The task is then started
+     *          as soon as the bus becomes free.
+     */
+    bool transfer_in_slot(SpiTask* task);
+
     /**
      * @brief Executes a blocking transfer.
      * 
@@ -86,10 +106,17 @@ public:
 
 private:
     bool start();
+    void fail(SpiTask* task);
     
     SPI_HandleTypeDef* hspi_;
     SpiTask* task_list_ = nullptr;
     SpiTask* current_task_ = nullptr;
+
+    // Time slotting, see transfer_in_slot()
+    bool slotted_ = false;
+    SpiTask* deferred_list_ = nullptr; // tasks waiting for slack
+    SpiTask* slot_task_ = nullptr; // transfer of the current slot
+    bool slack_available_ = false; // a deferred task may start once the bus is free
 };
 
 #endif // __STM32_SPI_ARBITER_HPP
\ No newline at end of file
@@ -26,6 +26,24 @@ extern uint32_t irq_counters[];
 #define GET_IRQ_COUNTER(irqn) 0
 #endif
 
+// Marks a function on the current control path (ADC interrupt, FOC, SVM,
+// encoder update). With CONFIG_HOT_CODE_IN_RAM these are linked into SRAM and
+// copied there at startup (see .RamFunc in the linker script), which avoids
+// the flash wait states on ART accelerator cache misses and keeps them
+// running at full speed while the flash is busy. long_call makes calls
+// between flash and SRAM use an absolute address instead of a veneer.
+#ifdef HOT_CODE_IN_RAM
+#define HOT_FUNCTION __attribute__((section(".RamFunc.hot"), long_call))
+#else
+#define HOT_FUNCTION
+#endif
+
+// Places a variable in the 64kB core coupled memory. Only the CPU can access
+// it, not the DMA controllers, so it suits thread stacks and control blocks
+// but no buffer that is handed to a peripheral. The section is not
+// initialized at startup.
+#define CCM_RAM __attribute__((section(".ccmram")))
+
 static inline uint32_t cpu_enter_critical() {
     uint32_t primask = __get_PRIMASK();
     __disable_irq();
@@ -0,0 +1,120 @@
+
+#include "spi_flash.hpp"
+
+#include <cmsis_os.h>
+#include <string.h>
+#include <algorithm>
+
+static constexpr uint8_t kCmdReadId = 0x9f;
+static constexpr uint8_t kCmdReadStatus = 0x05;
+static constexpr uint8_t kCmdWriteEnable = 0x06;
+static constexpr uint8_t kCmdRead = 0x03;
+static constexpr uint8_t kCmdPageProgram = 0x02;
+static constexpr uint8_t kCmdSectorErase = 0x20;
+static constexpr uint8_t kStatusBusy = 0x01;
+
+static constexpr uint32_t kTransferTimeout = 10; // [ms]
+static constexpr uint32_t kProgramTimeout = 10; // [ms] typ. 0.7ms, max 3ms for most chips
+static constexpr uint32_t kEraseTimeout = 500; // [ms] typ. 50ms, max 400ms for most chips
+
+// @brief Reads the JEDEC ID and takes the size from it
+// @returns false if there is no chip that answers like a serial NOR flash
+bool SpiFlash::init(Stm32Gpio ncs_gpio) {
+    ncs_gpio_ = ncs_gpio;
+    size_ = 0;
+    spi_config_ = {
+        .Mode = SPI_MODE_MASTER,
+        .Direction = SPI_DIRECTION_2LINES,
+        .DataSize = SPI_DATASIZE_8BIT,
+        .CLKPolarity = SPI_POLARITY_LOW,
+        .CLKPhase = SPI_PHASE_1EDGE,
+        .NSS = SPI_NSS_SOFT,
+        .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_8,
+        .FirstBit = SPI_FIRSTBIT_MSB,
+        .TIMode = SPI_TIMODE_DISABLE,
+        .CRCCalculation = SPI_CRCCALCULATION_DISABLE,
+        .CRCPolynomial = 10,
+    };
+
+    tx_buf_[0] = kCmdReadId;
+    if (!transfer(4))
+        return false;
+    uint8_t manufacturer = rx_buf_[1];
+    uint8_t capacity = rx_buf_[3]; // log2 of the size in bytes
+    if (manufacturer == 0x00 || manufacturer == 0xff || capacity < 16 || capacity > 24)
+        return false; // no chip on the bus, or one that needs 32 bit addresses
+
+    size_ = (size_t)1 << capacity;
+    return true;
+}
+
+bool SpiFlash::read(uint32_t addr, uint8_t* data, size_t length) {
+    while (length) {
+        size_t chunk = std::min(length, page_size);
+        tx_buf_[0] = kCmdRead;
+        tx_buf_[1] = (uint8_t)(addr >> 16);
+        tx_buf_[2] = (uint8_t)(addr >> 8);
+        tx_buf_[3] = (uint8_t)addr;
+        if (!transfer(4 + chunk))
+            return false;
+        memcpy(data, rx_buf_ + 4, chunk);
+        addr += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// @brief Programs the bytes, which must be erased. The data is split at the
+// page boundaries.
+bool SpiFlash::program(uint32_t addr, const uint8_t* data, size_t length) {
+    while (length) {
+        size_t chunk = std::min(length, page_size - (addr % page_size));
+        if (!command(kCmdWriteEnable))
+            return false;
+        tx_buf_[0] = kCmdPageProgram;
+        tx_buf_[1] = (uint8_t)(addr >> 16);
+        tx_buf_[2] = (uint8_t)(addr >> 8);
+        tx_buf_[3] = (uint8_t)addr;
+        memcpy(tx_buf_ + 4, data, chunk);
+        if (!transfer(4 + chunk) || !wait_ready(kProgramTimeout))
+            return false;
+        addr += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// @brief Erases the sector that contains addr to all 0xff
+bool SpiFlash::erase_sector(uint32_t addr) {
+    if (!command(kCmdWriteEnable))
+        return false;
+    tx_buf_[0] = kCmdSectorErase;
+    tx_buf_[1] = (uint8_t)(addr >> 16);
+    tx_buf_[2] = (uint8_t)(addr >> 8);
+    tx_buf_[3] = (uint8_t)addr;
+    return transfer(4) && wait_ready(kEraseTimeout);
+}
+
+bool SpiFlash::transfer(size_t length) {
+    return spi_arbiter_ && spi_arbiter_->transfer(spi_config_, ncs_gpio_, tx_buf_, rx_buf_, length, kTransferTimeout);
+}
+
+bool SpiFlash::command(uint8_t cmd) {
+    tx_buf_[0] = cmd;
+    return transfer(1);
+}
+
+// @brief Polls the busy bit until the last program or erase is done
+bool SpiFlash::wait_ready(uint32_t timeout_ms) {
+    for (uint32_t t = 0; t <= timeout_ms; ++t) {
+        tx_buf_[0] = kCmdReadStatus;
+        if (!transfer(2))
+            return false;
+        if (!(rx_buf_[1] & kStatusBusy))
+            return true;
+        osDelay(1);
+    }
+    return false;
+}
@@ -0,0 +1,45 @@
+#ifndef __SPI_FLASH_HPP
+#define __SPI_FLASH_HPP
+
+#include <Drivers/STM32/stm32_spi_arbiter.hpp>
+
+// Driver for serial NOR flash chips with the common JEDEC command set
+// (W25Qxx, MX25Lxx, AT25SFxx, ...) and 24 bit addresses, so up to 16 MiB.
+// The size is taken from the JEDEC ID.
+//
+// All functions block the calling thread and must not be called from an
+// interrupt. The transfers go through the SPI arbiter, so the chip can
+// share the bus with other SPI devices.
+class SpiFlash {
+public:
+    static constexpr size_t sector_size = 4096; // [bytes] smallest erasable unit
+    static constexpr size_t page_size = 256; // [bytes] largest programmable unit
+
+    SpiFlash(Stm32SpiArbiter* spi_arbiter) : spi_arbiter_(spi_arbiter) {}
+
+    bool init(Stm32Gpio ncs_gpio);
+
+    // @brief [bytes] size of the chip, 0 if no chip was found by init()
+    size_t size() const { return size_; }
+
+    bool read(uint32_t addr, uint8_t* data, size_t length);
+    bool program(uint32_t addr, const uint8_t* data, size_t length);
+    bool erase_sector(uint32_t addr);
+
+private:
+    bool transfer(size_t length);
+    bool command(uint8_t cmd);
+    bool wait_ready(uint32_t timeout_ms);
+
+    Stm32SpiArbiter* spi_arbiter_;
+    Stm32Gpio ncs_gpio_;
+    SPI_InitTypeDef spi_config_;
+    size_t size_ = 0;
+
+    // The arbiter transfers with DMA, so the buffers must not be on a
+    // (CCM RAM) thread stack.
+    uint8_t tx_buf_[4 + page_size];
+    uint8_t rx_buf_[4 + page_size];
+};
+
+#endif // __SPI_FLASH_HPP
@@ -0,0 +1,77 @@
+#ifndef __ABS_SPI_FRAME_HPP
+#define __ABS_SPI_FRAME_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frame layout of a generic SPI/SSI/BiSS-style absolute encoder read.
+// The frame is clocked in MSB first as 16-bit words. Bits are counted from
+// the last bit of the frame (bit 0), so leading start/acknowledge bits don't
+// need to be described and trailing padding bits of the last word are cut.
+struct AbsSpiFrameFormat {
+    uint8_t frame_bits;     // Number of bits clocked per read, at most 64
+    uint8_t pos_shift;      // Position of the LSB of the position field
+    uint8_t pos_bits;       // Width of the position field, at most 32
+    uint8_t status_shift;   // Position of the LSB of the status field
+    uint8_t status_mask;    // Status bits that are checked, 0 to ignore status
+    uint8_t status_ok;      // Expected value of the masked status bits
+    uint8_t crc_bits;       // Width of the CRC field at bit 0, 0 to disable
+    uint8_t crc_poly;       // CRC polynomial without the leading x^crc_bits term
+    uint8_t crc_data_bits;  // Number of bits right above the CRC that it covers
+    bool crc_inverted;      // The CRC is transmitted inverted (BiSS)
+};
+
+constexpr size_t abs_spi_max_words = 4;
+
+inline size_t abs_spi_frame_words(const AbsSpiFrameFormat& fmt) {
+    return (fmt.frame_bits + 15) / 16;
+}
+
+inline bool abs_spi_frame_valid(const AbsSpiFrameFormat& fmt) {
+    return fmt.frame_bits > 0 && fmt.frame_bits <= 16 * abs_spi_max_words
+        && fmt.pos_bits > 0 && fmt.pos_bits <= 32
+        && fmt.pos_shift + fmt.pos_bits <= fmt.frame_bits
+        && fmt.status_shift + 8 <= 64
+        && fmt.crc_bits <= 8
+        && fmt.crc_bits + fmt.crc_data_bits <= fmt.frame_bits;
+}
+
+// @brief Bitwise CRC of the lowest num_bits bits of data, MSB first, zero init.
+inline uint8_t abs_spi_crc(uint64_t data, size_t num_bits, uint8_t poly, size_t crc_bits) {
+    const uint32_t mask = (1u << crc_bits) - 1;
+    uint32_t crc = 0;
+    for (size_t i = num_bits; i-- > 0;) {
+        uint32_t feedback = ((crc >> (crc_bits - 1)) ^ (uint32_t)(data >> i)) & 1;
+        crc = (crc << 1) & mask;
+        if (feedback)
+            crc ^= poly;
+    }
+    return (uint8_t)crc;
+}
+
+// @brief Decodes one frame received into rx (abs_spi_frame_words(fmt) words).
+// @param pos: set to the position field if the frame passes all checks
+// @returns false on a CRC mismatch or unexpected status bits
+inline bool abs_spi_decode_frame(const AbsSpiFrameFormat& fmt, const uint16_t* rx, uint32_t* pos) {
+    size_t words = abs_spi_frame_words(fmt);
+    uint64_t frame = 0;
+    for (size_t i = 0; i < words; ++i)
+        frame = (frame << 16) | rx[i];
+    frame >>= (16 * words - fmt.frame_bits);
+
+    if (fmt.crc_bits) {
+        uint8_t crc = abs_spi_crc(frame >> fmt.crc_bits, fmt.crc_data_bits, fmt.crc_poly, fmt.crc_bits);
+        if (fmt.crc_inverted)
+            crc = ~crc & ((1u << fmt.crc_bits) - 1);
+        if (crc != (frame & ((1u << fmt.crc_bits) - 1)))
+            return false;
+    }
+
+    if (((frame >> fmt.status_shift) & fmt.status_mask) != (fmt.status_ok & fmt.status_mask))
+        return false;
+
+    *pos = (uint32_t)(frame >> fmt.pos_shift) & (uint32_t)((1ull << fmt.pos_bits) - 1);
+    return true;
+}
+
+#endif // __ABS_SPI_FRAME_HPP
@@ -0,0 +1,79 @@
+#ifndef __ACIM_FLUX_OBSERVER_HPP
+#define __ACIM_FLUX_OBSERVER_HPP
+
+#include <algorithm>
+#include <cmath>
+
+// Current model rotor flux observer for induction motors (indirect field
+// orientation). The rotor flux is normalized to the d axis current that
+// produces it in steady state [A], so the rotor inductance need not be known.
+// In the rotor flux frame:
+//   d(flux)/dt = (Id - flux) / Tr
+//   slip velocity = Iq / (Tr * flux)
+//
+// 1/Tr is proportional to the rotor resistance, which rises with the
+// temperature of the rotor bars. set_params() adapts it to the temperature
+// and precomputes everything that only changes with the config or the
+// temperature, it is meant to be called at the outer loop rate. update()
+// then costs a single division per control period, and the reciprocal flux
+// it yields is shared by the torque to current conversion and the velocity
+// gain scheduling.
+class AcimFluxObserver {
+public:
+    struct Params_t {
+        float slip_velocity; // [rad/s electrical] 1/Tr at ref_temp
+        float rotor_tempco;  // [1/K] of the rotor resistance
+        float ref_temp;      // [°C]
+        float min_flux;      // [A] the flux is clamped to this in the reciprocal
+        float max_slip;      // [rad/s electrical]
+    };
+
+    void reset() {
+        flux_ = 0.0f;
+        inv_flux_ = 1.0f / min_flux_;
+    }
+
+    // @param temperature: [°C] of the rotor or the best proxy available, NaN
+    //        if unknown, which leaves 1/Tr at its nominal value
+    // @param dt: [s] period of update()
+    void set_params(const Params_t& params, float temperature, float dt) {
+        float scale = 1.0f;
+        if (!__builtin_isnan(temperature)) // same as is_nan() in utils.hpp
+            scale = std::max(1.0f + params.rotor_tempco * (temperature - params.ref_temp), 0.1f);
+        slip_velocity_ = params.slip_velocity * scale;
+        flux_k_ = 1.0f - std::exp(-slip_velocity_ * dt);
+        min_flux_ = std::max(params.min_flux, 1e-3f);
+        max_slip_ = params.max_slip;
+    }
+
+    // @brief Advances the flux by one period with the given current command
+    // @returns [rad/s electrical] the slip velocity, within +-max_slip
+    float update(float Id, float Iq) {
+        flux_ += (Id - flux_) * flux_k_;
+        float abs_flux = std::max(std::abs(flux_), min_flux_);
+        inv_flux_ = 1.0f / std::copysign(abs_flux, flux_);
+        return std::clamp(slip_velocity_ * Iq * inv_flux_, -max_slip_, max_slip_);
+    }
+
+    float flux() const { return flux_; } // [A]
+    float inv_flux() const { return inv_flux_; } // [1/A] of the flux clamped to min_flux
+    float slip_velocity() const { return slip_velocity_; } // [rad/s electrical] 1/Tr at the current temperature
+
+private:
+    float flux_ = 0.0f;
+    float min_flux_ = 1.0f;
+    float inv_flux_ = 1.0f;
+    float slip_velocity_ = 0.0f;
+    float flux_k_ = 0.0f;
+    float max_slip_ = 0.0f;
+};
+
+// @brief The d axis current with the least copper loss for the torque. With
+// the flux settled at Id, torque = torque_constant * Id * Iq, and Id^2 + Iq^2
+// is smallest at Id = |Iq| = sqrt(|torque| / torque_constant).
+// @param torque_constant: [Nm/A^2]
+inline float acim_loss_optimal_Id(float torque, float torque_constant) {
+    return std::sqrt(std::abs(torque) / torque_constant);
+}
+
+#endif // __ACIM_FLUX_OBSERVER_HPP
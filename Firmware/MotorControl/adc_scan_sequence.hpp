@@ -0,0 +1,93 @@
+#ifndef __ADC_SCAN_SEQUENCE_HPP
+#define __ADC_SCAN_SEQUENCE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <iterator>
+
+// Regular conversion sequence of the general purpose ADC, built from the
+// channels that are actually in use. Each channel appears once, in ascending
+// order, with the longest sampling time any of its users asked for (the STM32
+// has only one sampling time setting per channel).
+//
+// After the DMA has copied one conversion per rank into a buffer,
+// rank_of(channel) tells where a channel ended up.
+class AdcScanSequence {
+public:
+    static constexpr size_t kMaxChannels = 16;
+    static constexpr uint32_t kConversionCycles = 12; // [ADC clocks] at 12 bit resolution
+
+    // Sampling times the STM32F4 ADC supports, indexed by their SMPx code
+    static constexpr uint32_t kSampleCycles[] = {3, 15, 28, 56, 84, 112, 144, 480};
+
+    void clear() {
+        std::fill(std::begin(sample_code_), std::end(sample_code_), -1);
+        size_ = 0;
+        update_ranks();
+    }
+
+    // @brief Adds a channel to the sequence. Channels outside of 0...15 (such
+    // as UINT16_MAX from channel_from_gpio()) are ignored.
+    // @param sample_cycles: minimum sampling time in ADC clocks, rounded up
+    // to the next supported value
+    void add(uint32_t channel, uint32_t sample_cycles) {
+        if (channel >= kMaxChannels)
+            return;
+        int8_t code = sample_code(sample_cycles);
+        if (sample_code_[channel] < 0)
+            size_++;
+        sample_code_[channel] = std::max(sample_code_[channel], code);
+        update_ranks();
+    }
+
+    // @brief SMPx code of the shortest supported sampling time that is at
+    // least sample_cycles long
+    static int8_t sample_code(uint32_t sample_cycles) {
+        int8_t code = 0;
+        while ((size_t)code + 1 < std::size(kSampleCycles) && kSampleCycles[code] < sample_cycles)
+            code++;
+        return code;
+    }
+
+    size_t size() const { return size_; }
+
+    // @returns the channel at the given rank (0 based)
+    uint32_t channel(size_t rank) const { return channels_[rank]; }
+
+    // @returns the SMPx code of the channel, or -1 if it isn't in the sequence
+    int8_t sample_code_of(uint32_t channel) const {
+        return channel < kMaxChannels ? sample_code_[channel] : -1;
+    }
+
+    // @returns the rank (0 based) of the channel, or -1 if it isn't in the
+    // sequence
+    int rank_of(uint32_t channel) const {
+        return channel < kMaxChannels ? rank_[channel] : -1;
+    }
+
+    // @brief ADC clocks it takes to convert the whole sequence once
+    uint32_t scan_cycles() const {
+        uint32_t cycles = 0;
+        for (size_t i = 0; i < size_; ++i)
+            cycles += kSampleCycles[sample_code_[channels_[i]]] + kConversionCycles;
+        return cycles;
+    }
+
+private:
+    void update_ranks() {
+        size_t rank = 0;
+        for (uint32_t ch = 0; ch < kMaxChannels; ++ch) {
+            rank_[ch] = sample_code_[ch] < 0 ? -1 : (int8_t)rank;
+            if (sample_code_[ch] >= 0)
+                channels_[rank++] = ch;
+        }
+    }
+
+    int8_t sample_code_[kMaxChannels] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+    int8_t rank_[kMaxChannels] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+    uint8_t channels_[kMaxChannels] = {};
+    size_t size_ = 0;
+};
+
+#endif // __ADC_SCAN_SEQUENCE_HPP
@@ -0,0 +1,65 @@
+/*
+ * Fused sine/cosine evaluation based on our_arm_sin_f32 and our_arm_cos_f32.
+ *
+ * The sine table spans one full period, so the cosine lookup is the sine
+ * lookup shifted by a quarter of the table. Both results therefore share the
+ * range reduction, index and interpolation fraction, which makes this
+ * considerably cheaper than calling our_arm_sin_f32 and our_arm_cos_f32
+ * separately. The results are equivalent to the separate functions within
+ * the table interpolation error. our_arm_cos_f32 adds the quarter period
+ * before the range reduction, so its float rounding of the interpolation
+ * fraction can differ slightly.
+ */
+
+#include <board.h>
+#include "arm_math.h"
+#include "arm_common_tables.h"
+
+/**
+ * @brief  Fast approximation of sin(x) and cos(x) for floating-point data.
+ * @param[in]  x        input value in radians.
+ * @param[out] sin_val  sin(x)
+ * @param[out] cos_val  cos(x)
+ */
+HOT_FUNCTION void our_arm_sincos_f32(float32_t x, float32_t* sin_val, float32_t* cos_val)
+{
+  float32_t fract, in;
+  uint16_t index, index_cos;
+  int32_t n;
+  float32_t findex;
+
+  /* Scale the input to [0 1] range from [0 2*PI] , divide input by 2*pi */
+  in = x * 0.159154943092f;
+
+  /* Calculation of floor value of input */
+  n = (int32_t) in;
+
+  /* Make negative values towards -infinity */
+  if (x < 0.0f)
+  {
+    n--;
+  }
+
+  /* Map input value to [0 1] */
+  in = in - (float32_t) n;
+
+  /* Calculation of index of the table */
+  findex = (float32_t)FAST_MATH_TABLE_SIZE * in;
+  index = (uint16_t)findex;
+
+  /* when "in" is exactly 1, we need to rotate the index down to 0 */
+  if (index >= FAST_MATH_TABLE_SIZE) {
+    index = 0;
+    findex -= (float32_t)FAST_MATH_TABLE_SIZE;
+  }
+
+  /* fractional value calculation (shared by sin and cos) */
+  fract = findex - (float32_t) index;
+
+  /* cos(x) = sin(x + pi/2): a quarter table further along */
+  index_cos = (index + (FAST_MATH_TABLE_SIZE / 4)) & (FAST_MATH_TABLE_SIZE - 1);
+
+  /* Linear interpolation between the two nearest table values */
+  *sin_val = (1.0f-fract)*sinTable_f32[index] + fract*sinTable_f32[index+1];
+  *cos_val = (1.0f-fract)*sinTable_f32[index_cos] + fract*sinTable_f32[index_cos+1];
+}
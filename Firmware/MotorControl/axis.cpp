@@ -74,15 +74,44 @@ static void step_cb_wrapper(void* ctx) {
     reinterpret_cast<Axis*>(ctx)->step_cb();
 }
 
+static void dir_cb_wrapper(void* ctx) {
+    reinterpret_cast<Axis*>(ctx)->dir_cb();
+}
+
 bool Axis::apply_config() {
     config_.parent = this;
     decode_step_dir_pins();
+    update_derived_constants();
     watchdog_feed();
     return true;
 }
 
+// @brief Selects the GPIOs that are sampled at the PWM update: the hall
+// inputs first, so that their slots don't move when an endstop config
+// changes, then the endstops. Called whenever one of them is reconfigured.
+void Axis::update_sampled_gpios() {
+    gpio_sampler_.clear();
+    encoder_.add_sampled_gpios(gpio_sampler_);
+    min_endstop_.add_sampled_gpios(gpio_sampler_);
+    max_endstop_.add_sampled_gpios(gpio_sampler_);
+}
+
+// @brief Recomputes the scale factors in derived_ from the current config.
+// This should be invoked whenever one of the involved config values changes.
+void Axis::update_derived_constants() {
+    float cpr = (float)encoder_.config_.cpr;
+    float pole_pairs = (float)motor_.config_.pole_pairs;
+    derived_.inv_cpr = 1.0f / cpr;
+    derived_.elec_rad_per_enc = pole_pairs * 2 * M_PI * derived_.inv_cpr;
+    derived_.elec_rad_per_turn = pole_pairs * 2 * M_PI;
+    derived_.turns_per_elec_rad = 1.0f / (std::max(pole_pairs, 1.0f) * 2.0f * M_PI);
+    derived_.inv_torque_constant = 1.0f / motor_.config_.torque_constant;
+    derived_.bemf_ff_gain = (2.0f / 3.0f) * (motor_.config_.torque_constant / pole_pairs);
+}
+
 void Axis::clear_config() {
     config_ = {};
+    profiles_ = {};
     config_.step_gpio_pin = default_step_gpio_pin_;
     config_.dir_gpio_pin = default_dir_gpio_pin_;
     config_.can.node_id = axis_num_;
@@ -99,9 +128,13 @@ static void run_state_machine_loop_wrapper(void* ctx) {
     reinterpret_cast<Axis*>(ctx)->thread_id_valid_ = false;
 }
 
+CCM_RAM static StackType_t axis_thread_stacks[AXIS_COUNT][Axis::stack_size_ / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t axis_thread_tcbs[AXIS_COUNT];
+
 // @brief Starts run_state_machine_loop in a new thread
 void Axis::start_thread() {
-    osThreadDef(thread_def, run_state_machine_loop_wrapper, thread_priority_, 0, stack_size_ / sizeof(StackType_t));
+    osThreadStaticDef(thread_def, run_state_machine_loop_wrapper, thread_priority_, 0, stack_size_ / sizeof(StackType_t),
+                      axis_thread_stacks[axis_num_], &axis_thread_tcbs[axis_num_]);
     thread_id_ = osThreadCreate(osThread(thread_def), this);
     thread_id_valid_ = true;
 }
@@ -109,22 +142,78 @@ void Axis::start_thread() {
 // @brief Unblocks the control loop thread.
 // This is called from the current sense interrupt handler.
 void Axis::signal_current_meas() {
+#ifdef BOARD_CONTROL_LOOP
+    // The board-level loop runs once both axes have sampled their currents
+    if (axis_num_ == AXIS_COUNT - 1)
+        signal_board_control_loop();
+    // Don't wake up the axis thread while its control loop is handed over
+    if (control_loop_fn_)
+        return;
+#endif
     if (thread_id_valid_)
         osSignalSet(thread_id_, M_SIGNAL_PH_CURRENT_MEAS);
 }
 
 // @brief Blocks until a current measurement is completed
+// @param interruptible: also return early when a new state is requested
 // @returns True on success, false otherwise
-bool Axis::wait_for_current_meas() {
-    return osSignalWait(M_SIGNAL_PH_CURRENT_MEAS, PH_CURRENT_MEAS_TIMEOUT).status == osEventSignal;
+bool Axis::wait_for_current_meas(bool interruptible) {
+    for (;;) {
+        osEvent evt = osSignalWait(M_SIGNAL_PH_CURRENT_MEAS | M_SIGNAL_STATE_REQUEST, PH_CURRENT_MEAS_TIMEOUT);
+        if (evt.status != osEventSignal)
+            return false;
+        if (evt.value.signals & M_SIGNAL_PH_CURRENT_MEAS)
+            return true;
+        if (interruptible && requested_state_ != AXIS_STATE_UNDEFINED)
+            return true;
+    }
 }
 
 // step/direction interface
+// The interrupts only count the steps, update_step_dir() converts the count
+// to input_pos_ once per control loop iteration.
 void Axis::step_cb() {
-    if (step_dir_active_) {
-        const bool dir_pin = dir_gpio_.read();
-        const float dir = dir_pin ? 1.0f : -1.0f;
-        controller_.input_pos_ += dir * config_.turns_per_step;
+    if (step_dir_active_)
+        step_counter_.on_step(dir_gpio_.read());
+}
+
+// @brief Timer mode: books the steps counted by the timer before the direction changed
+void Axis::dir_cb() {
+    if (step_dir_active_ && step_timer_)
+        step_counter_.on_dir_change(step_timer_->Instance->CNT, dir_gpio_.read());
+}
+
+// @brief Sets input_pos_ from the step count. The position is computed from
+// the integer count, so it doesn't drift from the steps.
+void Axis::update_step_dir() {
+    if (!step_dir_active_)
+        return;
+
+    if (step_timer_) {
+        uint32_t mask = cpu_enter_critical();
+        step_counter_.sync(step_timer_->Instance->CNT);
+        cpu_exit_critical(mask);
+    }
+
+    int32_t count = step_counter_.count();
+    float pos = step_dir_base_pos_ + (float)count * config_.turns_per_step;
+
+    if (config_.step_dir_filter_pos || config_.step_dir_vel_ff || config_.step_dir_torque_ff) {
+        step_rate_estimator_.update(pos, current_meas_period, config_.step_dir_filter_bandwidth);
+        if (config_.step_dir_vel_ff)
+            controller_.input_vel_ = step_rate_estimator_.vel();
+        if (config_.step_dir_torque_ff)
+            controller_.input_torque_ = step_rate_estimator_.accel() * controller_.config_.inertia;
+        if (config_.step_dir_filter_pos) {
+            controller_.input_pos_ = step_rate_estimator_.pos();
+            controller_.input_pos_updated();
+            return;
+        }
+    }
+
+    if (count != step_dir_last_count_) {
+        step_dir_last_count_ = count;
+        controller_.input_pos_ = pos;
         controller_.input_pos_updated();
     }
 }
@@ -137,22 +226,52 @@ void Axis::decode_step_dir_pins() {
 // @brief (de)activates step/dir input
 void Axis::set_step_dir_active(bool active) {
     if (active) {
-        // Subscribe to rising edges of the step GPIO
-        if (!step_gpio_.subscribe(true, false, step_cb_wrapper, this)) {
-            odrv.misconfigured_ = true;
+        step_dir_active_ = false;
+        step_dir_base_pos_ = controller_.input_pos_;
+        step_dir_last_count_ = 0;
+        step_rate_estimator_.reset(step_dir_base_pos_);
+
+        if (config_.step_dir_use_timer) {
+            // The timer counts the rising edges of the step GPIO, an
+            // interrupt on both edges of the dir GPIO splits the count
+            step_timer_ = start_pulse_counter(config_.step_gpio_pin);
+            if (!step_timer_ || !dir_gpio_.subscribe(true, true, dir_cb_wrapper, this)) {
+                odrv.misconfigured_ = true;
+                return;
+            }
+            step_counter_.reset(step_timer_->Instance->CNT, dir_gpio_.read());
+        } else {
+            // Subscribe to rising edges of the step GPIO
+            step_timer_ = nullptr;
+            step_counter_.reset(0, true);
+            if (!step_gpio_.subscribe(true, false, step_cb_wrapper, this)) {
+                odrv.misconfigured_ = true;
+            }
         }
 
         step_dir_active_ = true;
     } else {
         step_dir_active_ = false;
 
-        // Unsubscribe from step GPIO
+        // Unsubscribe from step (or dir) GPIO
         // TODO: if we change the GPIO while the subscription is active and then
         // unsubscribe then the unsubscribe is for the wrong pin.
-        step_gpio_.unsubscribe();
+        if (step_timer_)
+            dir_gpio_.unsubscribe();
+        else
+            step_gpio_.unsubscribe();
     }
 }
 
+// @brief True while the DC bus is below the undervoltage trip level. The
+// state is reported to the board, which saves the multi-turn positions of the
+// absolute encoders while the bus capacitors still hold up the logic supply.
+bool Axis::check_PSU_brownout() {
+    bool brownout = !(vbus_voltage >= odrv.config_.dc_bus_undervoltage_trip_level);
+    odrv.report_brownout(brownout);
+    return brownout;
+}
+
 // @brief Do axis level checks and call subcomponent do_checks
 // Returns true if everything is ok.
 bool Axis::do_checks() {
@@ -161,7 +280,7 @@ bool Axis::do_checks() {
     if ((current_state_ != AXIS_STATE_IDLE) && (motor_.armed_state_ == Motor::ARMED_STATE_DISARMED))
         // motor got disarmed in something other than the idle loop
         error_ |= ERROR_MOTOR_DISARMED;
-    if (!(vbus_voltage >= odrv.config_.dc_bus_undervoltage_trip_level))
+    if (check_PSU_brownout())
         error_ |= ERROR_DC_BUS_UNDER_VOLTAGE;
     if (!(vbus_voltage <= odrv.config_.dc_bus_overvoltage_trip_level))
         error_ |= ERROR_DC_BUS_OVER_VOLTAGE;
@@ -174,46 +293,187 @@ bool Axis::do_checks() {
     // controller_.do_checks();
 
     // Check for endstop presses
-    if (min_endstop_.config_.enabled && min_endstop_.rose() && !(current_state_ == AXIS_STATE_HOMING)) {
+    if (kFeatureEndstops && min_endstop_.config_.enabled && min_endstop_.rose() && !(current_state_ == AXIS_STATE_HOMING)) {
         error_ |= ERROR_MIN_ENDSTOP_PRESSED;
-    } else if (max_endstop_.config_.enabled && max_endstop_.rose() && !(current_state_ == AXIS_STATE_HOMING)) {
+    } else if (kFeatureEndstops && max_endstop_.config_.enabled && max_endstop_.rose() && !(current_state_ == AXIS_STATE_HOMING)) {
         error_ |= ERROR_MAX_ENDSTOP_PRESSED;
     }
 
     return check_for_errors();
 }
 
-// @brief Update all esitmators
+// @brief Called when the current measurement interrupt didn't fire in time.
+void Axis::on_current_meas_timeout() {
+    // maybe the interrupt handler is dead, let's be
+    // safe and float the phases
+    safety_critical_disarm_motor_pwm(motor_);
+    update_brake_current();
+    error_ |= ERROR_CURRENT_MEASUREMENT_TIMEOUT;
+    ++motor_.deadline_monitor_.current_meas_timeouts;
+}
+
+#ifdef BOARD_CONTROL_LOOP
+osThreadId board_control_loop_thread_id;
+static volatile bool board_control_loop_thread_id_valid = false;
+const uint32_t stack_size_board_control_loop_thread = 2048; // Bytes
+CCM_RAM static StackType_t board_control_loop_thread_stack[stack_size_board_control_loop_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t board_control_loop_thread_tcb;
+
+// @brief Hands the control loop back to the axis thread.
+void Axis::release_control_loop() {
+    control_loop_fn_ = nullptr;
+    osSignalSet(thread_id_, M_SIGNAL_CONTROL_LOOP_DONE);
+}
+
+// @brief Runs one iteration of the control loop that this axis handed over
+// to the board-level control loop, if any.
+void Axis::board_control_loop_step() {
+    auto control_loop_fn = control_loop_fn_;
+    if (!control_loop_fn)
+        return;
+
+    // the previous iteration may have requested to exit after the wait
+    if ((requested_state_ != AXIS_STATE_UNDEFINED && !defer_state_requests_) || !control_loop_continue_) {
+        release_control_loop();
+        return;
+    }
+
+    task_times_.total.beginTimer();
+    if (!control_loop_fn(*this, control_loop_handler_, &control_loop_continue_))
+        release_control_loop();
+}
+
+// @brief Services the control loops of all axes in a single thread.
+// The thread is woken up once per current measurement period, after the
+// last axis sampled its currents. The axes are serviced in order of their
+// timing deadlines, M0 first, followed by the communication pumps which
+// used to be piggybacked on the control loop of axis0.
+static void board_control_loop_thread(void* ctx) {
+    (void) ctx;
+    for (;;) {
+        if (osSignalWait(Axis::M_SIGNAL_PH_CURRENT_MEAS, PH_CURRENT_MEAS_TIMEOUT).status != osEventSignal) {
+            for (Axis& axis : axes) {
+                if (axis.control_loop_fn_) {
+                    axis.on_current_meas_timeout();
+                    axis.release_control_loop();
+                }
+            }
+            continue;
+        }
+
+        odrv.timebase_.tick(current_meas_period, DWT->CYCCNT - sample_TIM13());
+        odCAN->begin_sync_tick();
+        update_analog_mappings(current_meas_period);
+        for (Axis& axis : axes) {
+            axis.board_control_loop_step();
+        }
+
+        for (Axis& axis : axes) {
+            odCAN->send_cyclic(axis);
+        }
+    }
+}
+
+void start_board_control_loop_thread() {
+    osThreadStaticDef(thread_def, board_control_loop_thread, osPriorityRealtime, 0, stack_size_board_control_loop_thread / sizeof(StackType_t),
+                      board_control_loop_thread_stack, &board_control_loop_thread_tcb);
+    board_control_loop_thread_id = osThreadCreate(osThread(thread_def), nullptr);
+    board_control_loop_thread_id_valid = true;
+}
+
+// @brief Unblocks the board-level control loop thread.
+// This is called from the current sense interrupt handler.
+void signal_board_control_loop() {
+    if (board_control_loop_thread_id_valid)
+        osSignalSet(board_control_loop_thread_id, Axis::M_SIGNAL_PH_CURRENT_MEAS);
+}
+#endif
+
+// @brief Latches the outer loop decimation from the config and derives the
+// outer loop timing from it. Called whenever a control loop is entered.
+void Axis::update_outer_loop_timing() {
+    outer_loop_decimation_ = std::max<uint32_t>(in_idle_loop_ ? config_.idle_loop_decimation : config_.outer_loop_decimation, 1);
+    outer_loop_countdown_ = 0; // run the outer loop on the first cycle
+    outer_loop_period_ = current_meas_period * (float)outer_loop_decimation_;
+    outer_loop_hz_ = (float)current_meas_hz / (float)outer_loop_decimation_;
+    controller_.update_filter_gains();
+}
+
 bool Axis::do_updates() {
     // Sub-components should use set_error which will propegate to this error_
 
+    odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_AXIS0 + axis_num_, HAL_GetTick());
+
+    update_step_dir();
 
     task_times_.encoder_update.beginTimer();
     encoder_.update();
     task_times_.encoder_update.stopTimer();
+    update_position_compare();
+
+    // The sensorless estimator integrates over current_meas_period, so with a
+    // decimated idle loop it is paused. Without current its estimate is
+    // meaningless anyway and it converges again during the lock-in spin.
+    if (kFeatureSensorless && (!in_idle_loop_ || outer_loop_decimation_ == 1)) {
+        task_times_.sensorless_update.beginTimer();
+        sensorless_estimator_.update();
+        task_times_.sensorless_update.stopTimer();
+    }
 
-    task_times_.sensorless_update.beginTimer();
-    sensorless_estimator_.update();
-    task_times_.sensorless_update.stopTimer();
-
-    task_times_.thermistor_update.beginTimer();
-    motor_.fet_thermistor_.update();
-    motor_.motor_thermistor_.update();
-    task_times_.thermistor_update.stopTimer();
-
-    task_times_.min_endstop_update.beginTimer();
-    min_endstop_.update();
-    task_times_.min_endstop_update.stopTimer();
-
-    task_times_.max_endstop_update.beginTimer();
-    max_endstop_.update();
-    task_times_.max_endstop_update.stopTimer();
+    if (outer_loop_tick_) {
+        // The thermistors themselves are sampled in the analog thread
+        task_times_.thermistor_update.beginTimer();
+        motor_.motor_thermal_model_.update(outer_loop_period_);
+        motor_.fet_thermal_model_.update(outer_loop_period_);
+        if (motor_.is_acim())
+            motor_.update_acim_flux_observer();
+        task_times_.thermistor_update.stopTimer();
+
+        if (kFeatureEndstops) {
+            task_times_.min_endstop_update.beginTimer();
+            min_endstop_.update();
+            task_times_.min_endstop_update.stopTimer();
+
+            task_times_.max_endstop_update.beginTimer();
+            max_endstop_.update();
+            task_times_.max_endstop_update.stopTimer();
+        }
+    }
 
     bool ret = check_for_errors();
-    odCAN->send_cyclic(*this);
+#ifndef BOARD_CONTROL_LOOP
+    odCAN->send_cyclic(*this); // sent by the board-level control loop if enabled
+    if (axis_num_ == 0)
+        update_analog_mappings(current_meas_period); // done by the board-level control loop if enabled
+#endif
     return ret;
 }
 
+// @brief Arms the position compare output at the first target of
+// config_.position_compare, counting from the current encoder count.
+void Axis::arm_position_compare() {
+    CRITICAL_SECTION() {
+        position_compare_.reset_counters();
+        position_compare_.arm(encoder_.shadow_count_);
+    }
+}
+
+// @brief Drives the position compare GPIO, right after the encoder update so
+// the pulse goes out in the same control period as the crossing is seen.
+void Axis::update_position_compare() {
+    const PositionCompare::Config_t& config = config_.position_compare;
+    bool active = false;
+    if (config.enable) {
+        active = position_compare_.update(config, encoder_.shadow_count_, current_meas_period);
+        if (position_compare_.fired())
+            position_compare_loop_ = loop_counter_;
+    } else {
+        position_compare_.disarm();
+    }
+    if (config.gpio_num < GPIO_COUNT && odrv.config_.gpio_modes[config.gpio_num] == ODriveIntf::GPIO_MODE_POSITION_COMPARE)
+        get_gpio(config.gpio_num).write(active != config.is_active_low);
+}
+
 // @brief Feed the watchdog to prevent watchdog timeouts.
 void Axis::watchdog_feed() {
     watchdog_current_value_ = get_watchdog_reset();
@@ -228,11 +488,180 @@ bool Axis::watchdog_check() {
         watchdog_current_value_--;
         return true;
     } else {
+        if (!(error_ & ERROR_WATCHDOG_TIMER_EXPIRED))
+            odrv.crash_snapshot_.capture(CrashSnapshot::CAUSE_WATCHDOG_EXPIRED, axis_num_);
         error_ |= ERROR_WATCHDOG_TIMER_EXPIRED;
         return false;
     }
 }
 
+// @brief Records a telemetry frame, timestamped with this loop iteration or
+// the board time
+void Axis::sample_telemetry() {
+    odrv.telemetry_.sample(odrv.config_.board_time_timestamps ? odrv.timebase_.now() : loop_counter_);
+}
+
+// @brief Applies the CAN setpoints buffered for the last sync message, if any
+void Axis::latch_can_sync() {
+#ifndef BOARD_CONTROL_LOOP
+    if (axis_num_ == 0) {
+        // done by the board-level control loop if enabled
+        odrv.timebase_.tick(current_meas_period, DWT->CYCCNT - sample_TIM13());
+        odCAN->begin_sync_tick();
+    }
+#endif
+    odCAN->latch_sync(*this);
+}
+
+// @brief Copies the current payload dependent settings into a profile slot
+bool Axis::store_profile(uint8_t index) {
+    if (index >= profiles_.size())
+        return false;
+    const Controller::Config_t& c = controller_.config_;
+    Profile_t& p = profiles_[index];
+    p.control_mode = c.control_mode;
+    p.input_mode = c.input_mode;
+    p.pos_gain = c.pos_gain;
+    p.vel_gain = c.vel_gain;
+    p.vel_integrator_gain = c.vel_integrator_gain;
+    p.vel_limit = c.vel_limit;
+    p.vel_ramp_rate = c.vel_ramp_rate;
+    p.torque_ramp_rate = c.torque_ramp_rate;
+    p.inertia = c.inertia;
+    p.input_filter_bandwidth = c.input_filter_bandwidth;
+    p.current_lim = motor_.config_.current_lim;
+    p.torque_lim = motor_.config_.torque_lim;
+    p.trap_traj = trap_traj_.config_;
+    p.valid = true;
+    return true;
+}
+
+// @brief Requests a switch to a stored profile. The control loop applies all
+// of its settings at once before the next controller update.
+bool Axis::select_profile(uint8_t index) {
+    if (index >= profiles_.size() || !profiles_[index].valid)
+        return false;
+    requested_profile_ = index;
+    return true;
+}
+
+// @brief Applies the profile requested by select_profile(), if any
+void Axis::apply_requested_profile() {
+    uint8_t index = requested_profile_;
+    if (index >= profiles_.size())
+        return;
+    requested_profile_ = 0xff;
+
+    const Profile_t& p = profiles_[index];
+    Controller::Config_t& c = controller_.config_;
+    // The controller update right after this takes over the current state
+    // in the new modes
+    c.set_control_mode(p.control_mode);
+    c.set_input_mode(p.input_mode);
+    c.pos_gain = p.pos_gain;
+    c.vel_gain = p.vel_gain;
+    c.vel_integrator_gain = p.vel_integrator_gain;
+    c.vel_limit = p.vel_limit;
+    c.vel_ramp_rate = p.vel_ramp_rate;
+    c.torque_ramp_rate = p.torque_ramp_rate;
+    c.inertia = p.inertia;
+    c.input_filter_bandwidth = p.input_filter_bandwidth;
+    motor_.config_.set_current_lim(p.current_lim);
+    motor_.config_.torque_lim = p.torque_lim;
+    trap_traj_.config_ = p.trap_traj;
+    controller_.update_filter_gains();
+    active_profile_ = index;
+}
+
+// @brief Records the error bits that were set since the last call in the event
+// trace and starts a burst of the data logger on them
+void Axis::trace_errors() {
+    bool new_error = false;
+    auto trace = [&](auto error, auto& traced, EventTrace::EventType type) {
+        if (error & ~traced) {
+            odrv.event_trace_.record(type, axis_num_, 0, error & ~traced);
+            new_error = true;
+        }
+        traced = error;
+    };
+    trace(error_, traced_errors_.axis, EventTrace::EVENT_TYPE_AXIS_ERROR);
+    trace(motor_.error_, traced_errors_.motor, EventTrace::EVENT_TYPE_MOTOR_ERROR);
+    trace(encoder_.error_, traced_errors_.encoder, EventTrace::EVENT_TYPE_ENCODER_ERROR);
+    trace(controller_.error_, traced_errors_.controller, EventTrace::EVENT_TYPE_CONTROLLER_ERROR);
+    trace(sensorless_estimator_.error_, traced_errors_.sensorless_estimator, EventTrace::EVENT_TYPE_SENSORLESS_ESTIMATOR_ERROR);
+    if (new_error)
+        odrv.data_logger_.trigger_burst(axis_num_);
+}
+
+// @brief Records the samples and burst frames of this loop iteration
+void Axis::sample_data_logger() {
+    odrv.data_logger_.sample(*this);
+}
+
+// @brief Hands the feedback of this loop iteration to the thread that streams it
+void Axis::publish_feedback() {
+    feedback_snapshot_.write({
+        .loop_counter = loop_counter_,
+        .pos_estimate = encoder_.pos_estimate_,
+        .vel_estimate = encoder_.vel_estimate_,
+        .Iq_measured = motor_.current_control_.Iq_measured,
+        .Iq_setpoint = motor_.current_control_.Iq_setpoint,
+        .vbus_voltage = vbus_voltage,
+    });
+}
+
+// @brief Copies the state of this loop iteration for read_snapshot()
+void Axis::publish_snapshot() {
+    state_snapshot_.write({
+        .loop_counter = loop_counter_,
+        .current_state = (uint32_t)current_state_,
+        .axis_error = (uint32_t)error_,
+        .motor_error = (uint32_t)motor_.error_,
+        .encoder_error = (uint32_t)encoder_.error_,
+        .controller_error = (uint32_t)controller_.error_,
+        .pos_estimate = encoder_.pos_estimate_,
+        .vel_estimate = encoder_.vel_estimate_,
+        .torque_setpoint = controller_.torque_setpoint_,
+        .Iq_setpoint = motor_.current_control_.Iq_setpoint,
+        .Iq_measured = motor_.current_control_.Iq_measured,
+        .Id_measured = motor_.current_control_.Id_measured,
+        .vbus_voltage = vbus_voltage,
+        .ibus = motor_.current_control_.Ibus,
+        .fet_temperature = motor_.fet_thermistor_.temperature_,
+        .motor_temperature = motor_.motor_thermistor_.temperature_,
+    });
+    state_snapshot_requested_ = false;
+}
+
+// Returns as much of a StateSnapshot_t as fits into the response, starting at
+// the byte offset in the request. The snapshot is taken by the next control
+// loop iteration on the request for offset 0, the following requests read
+// the rest of the same snapshot.
+bool Axis::read_snapshot(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    static_assert(sizeof(StateSnapshot_t) == 16 * 4, "the snapshot must not have padding");
+    static constexpr uint32_t kSnapshotTimeout = 10; // [ms]
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    if (offset.value() == 0) {
+        uint32_t seq_before = 0;
+        state_snapshot_.read(&state_snapshot_readout_, &seq_before);
+        state_snapshot_readout_valid_ = false;
+        state_snapshot_requested_ = true;
+        for (uint32_t i = 0; i < kSnapshotTimeout && !state_snapshot_readout_valid_; ++i) {
+            osDelay(1);
+            uint32_t seq = 0;
+            state_snapshot_readout_valid_ = state_snapshot_.read(&state_snapshot_readout_, &seq) && seq != seq_before;
+        }
+    }
+    if (!state_snapshot_readout_valid_ || offset.value() >= sizeof(state_snapshot_readout_))
+        return true; // empty response marks the end of the snapshot
+    size_t n_copy = std::min(output_buffer->size(), sizeof(state_snapshot_readout_) - (size_t)offset.value());
+    memcpy(output_buffer->begin(), (const uint8_t*)&state_snapshot_readout_ + offset.value(), n_copy);
+    *output_buffer = output_buffer->skip(n_copy);
+    return true;
+}
+
 bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config) {
     // Spiral up current for softer rotor lock-in
     lockin_state_ = LOCKIN_STATE_RAMP;
@@ -296,18 +725,83 @@ bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config) {
     return check_for_errors();
 }
 
+// @brief Locks the high frequency injection estimator onto the rotor at
+// standstill and resolves the magnet polarity, as a replacement for the
+// sensorless lock-in spin.
+// Driving current along the magnet flux saturates the d axis, which lowers
+// Ld and increases the injection response. So a positive and a negative
+// d axis current pulse are compared and the estimate is flipped if the
+// negative one responds more.
+bool Axis::run_hfi_startup() {
+    const float converge_duration = 0.2f; // [s]
+    const float pulse_duration = 0.05f; // [s]
+    const int converge_steps = (int)(converge_duration * (float)current_meas_hz);
+    const int pulse_steps = (int)(pulse_duration * (float)current_meas_hz);
+
+    if (!sensorless_estimator_.start_hfi())
+        return error_ |= ERROR_SENSORLESS_ESTIMATOR_FAILED, false;
+    float Id_setpoint = motor_.current_control_.Id_setpoint;
+    float d_response[2] = {0.0f, 0.0f};
+    int i = 0;
+    run_control_loop([&]() {
+        int pulse = (i - converge_steps) / pulse_steps; // 0: positive, 1: negative
+        if (i < converge_steps) {
+            motor_.current_control_.Id_setpoint = Id_setpoint;
+        } else {
+            float current = sensorless_estimator_.config_.hfi_polarity_current;
+            motor_.current_control_.Id_setpoint = pulse ? -current : current;
+            // Only the second half of each pulse, when the response filter has settled
+            if ((i - converge_steps) % pulse_steps >= pulse_steps / 2)
+                d_response[pulse] += sensorless_estimator_.hfi_d_response_;
+        }
+        if (!motor_.update(0.0f, sensorless_estimator_.phase_, 0.0f))
+            return false; // set_error should update axis.error_
+        return ++i < converge_steps + 2 * pulse_steps;
+    });
+    motor_.current_control_.Id_setpoint = Id_setpoint;
+    if (!check_for_errors())
+        return false;
+
+    if (d_response[1] > d_response[0])
+        sensorless_estimator_.flip_hfi_polarity();
+    return true;
+}
+
+// @brief Catches an already spinning motor for sensorless control.
+// With zero current commanded the current controller applies just the
+// back-EMF, which the flux observer of the sensorless estimator needs to lock
+// onto the rotor. After flying_start_duration the motor counts as caught if
+// the estimated speed is above flying_start_min_vel.
+// @param caught: set to true if the sensorless control can take over directly
+bool Axis::run_sensorless_flying_start(bool* caught) {
+    const int steps = (int)(config_.flying_start_duration * (float)current_meas_hz);
+    int i = 0;
+    *caught = false;
+    run_control_loop([&]() {
+        if (!motor_.update(0.0f, sensorless_estimator_.phase_, sensorless_estimator_.vel_estimate_erad_))
+            return false; // set_error should update axis.error_
+        return ++i < steps;
+    });
+    if (!check_for_errors())
+        return false;
+    *caught = sensorless_estimator_.vel_estimate_valid_
+            && std::abs(sensorless_estimator_.vel_estimate_erad_) >= config_.flying_start_min_vel;
+    return true;
+}
+
 // Note run_sensorless_control_loop and run_closed_loop_control_loop are very similar and differ only in where we get the estimate from.
 bool Axis::run_sensorless_control_loop() {
+    controller_.pos_estimate_turns_src_ = nullptr;
     controller_.pos_estimate_linear_src_ = nullptr;
     controller_.pos_estimate_circular_src_ = nullptr;
     controller_.pos_estimate_valid_src_ = nullptr;
     controller_.vel_estimate_src_ = &sensorless_estimator_.vel_estimate_;
     controller_.vel_estimate_valid_src_ = &sensorless_estimator_.vel_estimate_valid_;
 
-    run_control_loop([this](){
+    float torque_setpoint = 0.0f;
+    run_control_loop([this, &torque_setpoint](){
         // Note that all estimators are updated in the loop prefix in run_control_loop
-        float torque_setpoint;
-        if (!controller_.update(&torque_setpoint))
+        if (outer_loop_tick_ && !controller_.update(&torque_setpoint))
             return error_ |= ERROR_CONTROLLER_FAILED, false;
         if (!motor_.update(torque_setpoint, sensorless_estimator_.phase_, sensorless_estimator_.vel_estimate_))
             return false; // set_error should update axis.error_
@@ -321,6 +815,10 @@ bool Axis::run_closed_loop_control_loop() {
         return error_ |= ERROR_CONTROLLER_FAILED, false;
     }
 
+    // Setpoints sent while idle apply as if they had been written directly,
+    // input_pos is overwritten below like before
+    controller_.apply_input_setpoints();
+
     // To avoid any transient on startup, we intialize the setpoint to be the current position
     if (controller_.config_.circular_setpoints) {
         if (!controller_.pos_estimate_circular_src_) {
@@ -336,8 +834,8 @@ bool Axis::run_closed_loop_control_loop() {
             return error_ |= ERROR_CONTROLLER_FAILED, false;
         }
         else {
-            controller_.pos_setpoint_ = *controller_.pos_estimate_linear_src_;
-            controller_.input_pos_ = *controller_.pos_estimate_linear_src_;
+            controller_.pos_setpoint_ = controller_.pos_estimate_linear();
+            controller_.input_pos_ = controller_.pos_setpoint_;
         }
     }
     controller_.input_pos_updated();
@@ -345,47 +843,83 @@ bool Axis::run_closed_loop_control_loop() {
     // Avoid integrator windup issues
     controller_.vel_integrator_torque_ = 0.0f;
 
+    // With a mechanical brake the load is handed over between the brake and
+    // the motor, and a state request first engages the brake
+    BrakeHandoff& handoff = mechanical_brake_.handoff_;
+    bool brake_present = mechanical_brake_.is_present();
+    bool brake_released = !brake_present;
+    if (brake_present) {
+        handoff.start();
+        defer_state_requests_ = true;
+    }
+
     set_step_dir_active(config_.enable_step_dir);
-    run_control_loop([this](){
+    float torque_setpoint = 0.0f;
+    run_control_loop([this, &torque_setpoint, &handoff, brake_present, &brake_released](){
         // Note that all estimators are updated in the loop prefix in run_control_loop
         
-        task_times_.controller_update.beginTimer();
-        float torque_setpoint;
-        if (!controller_.update(&torque_setpoint))
-            return error_ |= ERROR_CONTROLLER_FAILED, false;
-        task_times_.controller_update.stopTimer();
+        if (outer_loop_tick_) {
+            if (brake_present) {
+                if (requested_state_ != AXIS_STATE_UNDEFINED)
+                    handoff.stop();
+                handoff.update(mechanical_brake_.config_.handoff, torque_setpoint, outer_loop_period_);
+                if (handoff.done())
+                    return false;
+                if (handoff.brake_released() != brake_released) {
+                    brake_released = handoff.brake_released();
+                    brake_released ? mechanical_brake_.release() : mechanical_brake_.engage();
+                }
+                if (handoff.phase() == BrakeHandoff::PHASE_LOAD)
+                    controller_.vel_integrator_torque_ = handoff.load_torque();
+                controller_.set_hold(handoff.hold());
+            }
+
+            task_times_.controller_update.beginTimer();
+            if (!controller_.update(&torque_setpoint))
+                return error_ |= ERROR_CONTROLLER_FAILED, false;
+            task_times_.controller_update.stopTimer();
+        }
 
         task_times_.motor_update.beginTimer();
-        float phase_vel = (2*M_PI) * encoder_.vel_estimate_ * motor_.config_.pole_pairs;
-        if (!motor_.update(torque_setpoint, encoder_.phase_, phase_vel))
+        float phase_vel = derived_.elec_rad_per_turn * encoder_.vel_estimate_;
+        if (!motor_.update(torque_setpoint * handoff.torque_scale(), encoder_.phase_, phase_vel))
             return false; // set_error should update axis.error_
         task_times_.motor_update.stopTimer();
 
         return true;
     });
+    defer_state_requests_ = false;
+    handoff.reset();
+    controller_.set_hold(false);
     set_step_dir_active(config_.enable_step_dir && config_.step_dir_always_on);
     return check_for_errors();
 }
 
 
-// Slowly drive in the negative direction at homing_speed until the min endstop is pressed
-// When pressed, set the linear count to the offset (default 0), and then go to position 0
+// Drives into the min endstop or a hard stop in the stages given by
+// config.homing, see HomingSequence. The count at the reference (the switch
+// edge, the stop or the index pulse after them) is set to the offset of the
+// min endstop, and then the axis goes to position 0.
 bool Axis::run_homing() {
     Controller::ControlMode stored_control_mode = controller_.config_.control_mode;
     Controller::InputMode stored_input_mode = controller_.config_.input_mode;
 
     // TODO: theoretically this check should be inside the update loop,
     // otherwise someone could disable the endstop while homing is in progress.
-    if (!min_endstop_.config_.enabled) {
+    if (!(kFeatureEndstops && min_endstop_.config_.enabled) && !config_.homing.use_hard_stop) {
         return error_ |= ERROR_HOMING_WITHOUT_ENDSTOP, false;
     }
 
+    HomingSequence sequence;
+    sequence.build(config_.homing, controller_.config_.homing_speed);
+
     controller_.config_.control_mode = Controller::CONTROL_MODE_VELOCITY_CONTROL;
     controller_.config_.input_mode = Controller::INPUT_MODE_VEL_RAMP;
 
+    controller_.apply_input_setpoints(); // so that they don't override the homing inputs later
     controller_.input_pos_ = 0.0f;
     controller_.input_pos_updated();
-    controller_.input_vel_ = -controller_.config_.homing_speed;
+    controller_.input_vel_ = sequence[0].vel;
     controller_.input_torque_ = 0.0f;
 
     homing_.is_homed = false;
@@ -409,35 +943,94 @@ bool Axis::run_homing() {
             return error_ |= ERROR_CONTROLLER_FAILED, false;
         }
         else {
-            controller_.pos_setpoint_ = *controller_.pos_estimate_linear_src_;
+            controller_.pos_setpoint_ = controller_.pos_estimate_linear();
         }
     }
 
     // Avoid integrator windup issues
     controller_.vel_integrator_torque_ = 0.0f;
 
-    // Driving toward the endstop
-    run_control_loop([this](){
-        // Note that all estimators are updated in the loop prefix in run_control_loop
-        float torque_setpoint;
-        if (!controller_.update(&torque_setpoint))
-            return error_ |= ERROR_CONTROLLER_FAILED, false;
+    // The encoder count at the switch edge or at the index pulse is latched
+    // in the GPIO interrupt. For the switch this is optional (if the EXTI line
+    // is taken, the position where the debounced state changed is used), for
+    // the index it is required.
+    int32_t offset_counts = (int32_t)(min_endstop_.config_.offset * encoder_.config_.cpr);
+    float torque_setpoint = 0.0f;
+    StallDetector stall_detector;
+    for (size_t i = 0; i < sequence.size(); ++i) {
+        const HomingSequence::Stage_t& stage = sequence[i];
+        if (stage.type == HomingSequence::SEEK_ENDSTOP) {
+            min_endstop_.arm_latch();
+        } else if (stage.type == HomingSequence::SEEK_INDEX && !encoder_.arm_index_latch()) {
+            controller_.config_.control_mode = stored_control_mode;
+            controller_.config_.input_mode = stored_input_mode;
+            return error_ |= ERROR_HOMING_INDEX_NOT_FOUND, false;
+        }
 
-        float phase_vel = (2*M_PI) * encoder_.vel_estimate_ * motor_.config_.pole_pairs;
-        if (!motor_.update(torque_setpoint, encoder_.phase_, phase_vel))
-            return false; // set_error should update axis.error_
+        // Change directions without stopping, the velocity ramp takes care of it
+        controller_.input_vel_ = stage.vel;
+        int32_t start_count = encoder_.shadow_count_;
+        bool done = false;
+        stall_detector.reset();
+        run_control_loop([this, &torque_setpoint, &stage, start_count, &done, &stall_detector](){
+            // Note that all estimators are updated in the loop prefix in run_control_loop
+            if (outer_loop_tick_ && !controller_.update(&torque_setpoint))
+                return error_ |= ERROR_CONTROLLER_FAILED, false;
+            // Limit the push against a hard stop, the integrator included so
+            // that it doesn't wind up while stalled
+            if (std::isfinite(stage.torque_limit)) {
+                torque_setpoint = std::clamp(torque_setpoint, -stage.torque_limit, stage.torque_limit);
+                controller_.vel_integrator_torque_ = std::clamp(controller_.vel_integrator_torque_, -stage.torque_limit, stage.torque_limit);
+            }
 
-        return !min_endstop_.get_state();
-    });
-    error_ &= ~ERROR_MIN_ENDSTOP_PRESSED; // clear this error since we deliberately drove into the endstop
+            float phase_vel = derived_.elec_rad_per_turn * encoder_.vel_estimate_;
+            if (!motor_.update(torque_setpoint, encoder_.phase_, phase_vel))
+                return false; // set_error should update axis.error_
+
+            float stage_travel = (float)(encoder_.shadow_count_ - start_count) / (float)encoder_.config_.cpr;
+            bool stalled = false;
+            if (stage.type == HomingSequence::SEEK_HARD_STOP) {
+                float torque = motor_.current_control_.Iq_measured * motor_.config_.torque_constant;
+                stalled = stall_detector.update(stage, *controller_.vel_estimate_src_, torque, current_meas_period);
+            }
+            HomingSequence::Result result = HomingSequence::check(stage,
+                    min_endstop_.get_state(), encoder_.index_latched(), stage_travel, stalled);
+            if (result == HomingSequence::FAILED)
+                return error_ |= ERROR_HOMING_INDEX_NOT_FOUND, false;
+            done = (result == HomingSequence::DONE);
+            return !done;
+        });
+        min_endstop_.disarm_latch();
+        encoder_.disarm_index_latch();
+        error_ &= ~ERROR_MIN_ENDSTOP_PRESSED; // clear this error since we deliberately drove into the endstop
+
+        if (!done) {
+            // Aborted by an error or by a state request
+            controller_.config_.control_mode = stored_control_mode;
+            controller_.config_.input_mode = stored_input_mode;
+            return check_for_errors();
+        }
+
+        if (stage.reference) {
+            // Set our current position in encoder counts to make control more logical.
+            // The stall has no latched count, the axis stands at the stop.
+            uint32_t mask = cpu_enter_critical();
+            int32_t travel = 0;
+            if (stage.type == HomingSequence::SEEK_INDEX)
+                travel = encoder_.count_now() - encoder_.index_latched_count_;
+            else if (stage.type == HomingSequence::SEEK_ENDSTOP && min_endstop_.latched())
+                travel = encoder_.count_now() - min_endstop_.latched_count_;
+            encoder_.set_linear_count(offset_counts + travel);
+            cpu_exit_critical(mask);
+        }
+        if (std::isfinite(stage.torque_limit))
+            controller_.vel_integrator_torque_ = 0.0f; // release the push before backing off
+    }
 
     // pos_setpoint is the starting position for the trap_traj so we need to set it.
-    controller_.pos_setpoint_ = min_endstop_.config_.offset;
+    controller_.pos_setpoint_ = (float)encoder_.count_now() / (float)encoder_.config_.cpr;
     controller_.vel_setpoint_ = 0.0f;  // Change directions without decelerating
 
-    // Set our current position in encoder counts to make control more logical
-    encoder_.set_linear_count((int32_t)(controller_.pos_setpoint_ * encoder_.config_.cpr));
-
     controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
     controller_.config_.input_mode = Controller::INPUT_MODE_TRAP_TRAJ;
 
@@ -446,13 +1039,12 @@ bool Axis::run_homing() {
     controller_.input_vel_ = 0.0f;
     controller_.input_torque_ = 0.0f;
 
-    run_control_loop([this](){
+    run_control_loop([this, &torque_setpoint](){
         // Note that all estimators are updated in the loop prefix in run_control_loop
-        float torque_setpoint;
-        if (!controller_.update(&torque_setpoint))
+        if (outer_loop_tick_ && !controller_.update(&torque_setpoint))
             return error_ |= ERROR_CONTROLLER_FAILED, false;
 
-        float phase_vel = (2*M_PI) * encoder_.vel_estimate_ * motor_.config_.pole_pairs;
+        float phase_vel = derived_.elec_rad_per_turn * encoder_.vel_estimate_;
         if (!motor_.update(torque_setpoint, encoder_.phase_, phase_vel))
             return false; // set_error should update axis.error_
 
@@ -466,133 +1058,318 @@ bool Axis::run_homing() {
     return check_for_errors();
 }
 
+// @brief Identifies the load and computes the controller gains.
+// The axis holds its position with the present gains while a logarithmic
+// torque chirp is added as feedforward. Inertia and friction are fitted to
+// the torque and velocity as in the online identification. The velocity loop
+// gain then places the crossover at the target bandwidth, and the integrator
+// zero is placed to leave the target phase margin after the lag of the
+// control loop delay.
+bool Axis::run_autotune() {
+    const Controller::Autotune_t& cfg = controller_.config_.autotune;
+    Controller::ControlMode stored_control_mode = controller_.config_.control_mode;
+    Controller::InputMode stored_input_mode = controller_.config_.input_mode;
+
+    if (!(cfg.freq_start > 0.0f) || !(cfg.freq_end > cfg.freq_start) || !(cfg.duration > 0.0f))
+        return controller_.set_error(Controller::ERROR_AUTOTUNE_FAILED), false;
+
+    if (!controller_.select_encoder(controller_.config_.load_encoder_axis)) {
+        return error_ |= ERROR_CONTROLLER_FAILED, false;
+    }
+    if (!controller_.pos_estimate_linear_src_) {
+        return error_ |= ERROR_CONTROLLER_FAILED, false;
+    }
+
+    controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
+    controller_.config_.input_mode = Controller::INPUT_MODE_PASSTHROUGH;
+    controller_.pos_setpoint_ = controller_.pos_estimate_linear();
+    controller_.input_pos_ = controller_.pos_setpoint_;
+    controller_.input_pos_updated();
+    controller_.input_vel_ = 0.0f;
+    controller_.input_torque_ = 0.0f;
+    controller_.vel_integrator_torque_ = 0.0f;
+
+    update_outer_loop_timing();
+    const float dt = outer_loop_period_;
+    const uint32_t num_ticks = (uint32_t)(cfg.duration / dt);
+    const float freq_growth = std::exp(std::log(cfg.freq_end / cfg.freq_start) * dt / cfg.duration);
+    const float bandwidth = std::min(2.0f * cfg.freq_end, 0.25f * outer_loop_hz_);
+    const float filter_k = std::min(2.0f * (float)M_PI * bandwidth * dt, 1.0f);
+    const uint32_t decimation = 4;
+    const float vel_band = std::max(controller_.config_.friction_vel_band, 1e-6f);
+
+    MechIdentifier identifier;
+    float freq = cfg.freq_start;
+    float phase = 0.0f;
+    uint32_t tick = 0;
+    float torque_setpoint = 0.0f;
+    run_control_loop([&](){
+        if (outer_loop_tick_) {
+            controller_.input_torque_ = cfg.excitation_torque * our_arm_sin_f32(phase);
+            phase = wrap_pm_pi(phase + 2.0f * (float)M_PI * freq * dt);
+            freq *= freq_growth;
+
+            if (!controller_.update(&torque_setpoint))
+                return error_ |= ERROR_CONTROLLER_FAILED, false;
+            identifier.filter(controller_.feedback_torque_, *controller_.vel_estimate_src_, filter_k);
+            if (++tick % decimation == 0)
+                identifier.update(decimation * dt, 1.0f, vel_band);
+        }
+
+        float phase_vel = derived_.elec_rad_per_turn * encoder_.vel_estimate_;
+        if (!motor_.update(torque_setpoint, encoder_.phase_, phase_vel))
+            return false; // set_error should update axis.error_
+
+        return tick < num_ticks;
+    });
+
+    controller_.input_torque_ = 0.0f;
+    controller_.config_.control_mode = stored_control_mode;
+    controller_.config_.input_mode = stored_input_mode;
+    if (tick < num_ticks)
+        return false; // aborted
+
+    float inertia = identifier.inertia();
+    controller_.identified_inertia_ = inertia;
+    controller_.identified_viscous_friction_ = identifier.viscous();
+    controller_.identified_coulomb_friction_ = identifier.coulomb();
+
+    // The torque reaches the motor about 1.5 control periods after the
+    // velocity was sampled
+    const float wc = 2.0f * (float)M_PI * cfg.bandwidth;
+    const float pi_lag = (float)M_PI * (0.5f - cfg.phase_margin / 180.0f) - 1.5f * wc * dt;
+    if (!(inertia > 0.0f) || !(wc > 0.0f) || !(cfg.pos_bandwidth_ratio > 0.0f) || pi_lag <= 0.0f)
+        return controller_.set_error(Controller::ERROR_AUTOTUNE_FAILED), false;
+
+    controller_.config_.vel_gain = inertia * wc;
+    controller_.config_.vel_integrator_gain = controller_.config_.vel_gain * wc * std::tan(pi_lag);
+    controller_.config_.pos_gain = wc / cfg.pos_bandwidth_ratio;
+    controller_.analyze_tuning(); // the encoder and current loop bandwidths may not fit the new gains
+    return check_for_errors();
+}
+
 bool Axis::run_idle_loop() {
     // run_control_loop ignores missed modulation timing updates
     // if and only if we're in AXIS_STATE_IDLE
     safety_critical_disarm_motor_pwm(motor_);
     mechanical_brake_.engage();
     set_step_dir_active(config_.enable_step_dir && config_.step_dir_always_on);
+    in_idle_loop_ = true;
     run_control_loop([this]() {
         return true;
     });
+    in_idle_loop_ = false;
     return check_for_errors();
 }
 
+// @brief Starts the sensorless estimator with HFI, a flying start or a
+// lock-in spin, then runs the sensorless control loop
+bool Axis::run_sensorless_control() {
+    if (sensorless_estimator_.config_.enable_hfi) {
+        // No lock-in needed, the injection estimator works from standstill
+        return run_hfi_startup() && run_sensorless_control_loop();
+    }
+    bool caught = false;
+    if (config_.enable_sensorless_flying_start && !run_sensorless_flying_start(&caught))
+        return false;
+    if (caught) {
+        // Continue at the speed the motor is already spinning at
+        controller_.vel_setpoint_ = sensorless_estimator_.vel_estimate_;
+        return run_sensorless_control_loop();
+    }
+    if (!run_lockin_spin(config_.sensorless_ramp)) // TODO: restart if desired
+        return false;
+    // call to controller.reset() that happend when arming means that vel_setpoint
+    // is zeroed. So we make the setpoint the spinup target for smooth transition.
+    controller_.vel_setpoint_ = config_.sensorless_ramp.vel / (2.0f * M_PI * motor_.config_.pole_pairs);
+    return run_sensorless_control_loop();
+}
+
+// Entry requirements of the states in the state table
+enum : uint32_t {
+    REQUIRE_MOTOR_CALIBRATED = 1u << 0,
+    REQUIRE_DIRECTION = 1u << 1,     // motor.config.direction is known
+    REQUIRE_ENCODER_READY = 1u << 2,
+};
+
+// The states the state machine can run. Handlers return false on failure,
+// which ends the task chain in idle, and must exit when a new state is
+// requested. The exit action runs after the handler in either case.
+struct AxisStateDescriptor_t {
+    Axis::AxisState state;
+    uint32_t requirements;
+    bool release_brake; // before the handler, closed loop control hands the load over itself
+    bool (*check)(Axis& axis); // additional entry check, nullptr for none
+    bool (*run)(Axis& axis);
+    void (*exit)(Axis& axis);  // nullptr for none
+};
+
+static const AxisStateDescriptor_t state_table[] = {
+    {Axis::AXIS_STATE_IDLE, 0, false, nullptr,
+        [](Axis& axis) {
+            axis.run_idle_loop();
+            return axis.motor_.arm(); // done with idling - try to arm the motor
+        }, nullptr},
+    {Axis::AXIS_STATE_MOTOR_CALIBRATION, 0, true, nullptr,
+        [](Axis& axis) { return axis.motor_.run_calibration(); }, nullptr},
+    {Axis::AXIS_STATE_ENCODER_INDEX_SEARCH, REQUIRE_MOTOR_CALIBRATED, true,
+        [](Axis& axis) { return !(axis.encoder_.config_.idx_search_unidirectional && axis.motor_.config_.direction == 0); },
+        [](Axis& axis) { return axis.encoder_.run_index_search(); }, nullptr},
+    {Axis::AXIS_STATE_ENCODER_DIR_FIND, REQUIRE_MOTOR_CALIBRATED, true, nullptr,
+        [](Axis& axis) { return axis.encoder_.run_direction_find(); }, nullptr},
+    {Axis::AXIS_STATE_HOMING, 0, true, nullptr,
+        [](Axis& axis) { return axis.run_homing(); }, nullptr},
+    {Axis::AXIS_STATE_ENCODER_OFFSET_CALIBRATION, REQUIRE_MOTOR_CALIBRATED, true, nullptr,
+        [](Axis& axis) { return axis.encoder_.run_offset_calibration(); }, nullptr},
+    {Axis::AXIS_STATE_ENCODER_ERROR_CALIBRATION, REQUIRE_MOTOR_CALIBRATED | REQUIRE_DIRECTION | REQUIRE_ENCODER_READY, true, nullptr,
+        [](Axis& axis) { return axis.encoder_.run_error_calibration(); }, nullptr},
+    {Axis::AXIS_STATE_LOCKIN_SPIN, REQUIRE_MOTOR_CALIBRATED | REQUIRE_DIRECTION, true, nullptr,
+        [](Axis& axis) { return axis.run_lockin_spin(axis.config_.general_lockin); }, nullptr},
+    {Axis::AXIS_STATE_SENSORLESS_CONTROL, REQUIRE_MOTOR_CALIBRATED | REQUIRE_DIRECTION, true,
+        [](Axis&) { return kFeatureSensorless; },
+        [](Axis& axis) { return kFeatureSensorless && axis.run_sensorless_control(); },
+        [](Axis& axis) { axis.sensorless_estimator_.stop_hfi(); }},
+    {Axis::AXIS_STATE_CLOSED_LOOP_CONTROL, REQUIRE_MOTOR_CALIBRATED | REQUIRE_DIRECTION | REQUIRE_ENCODER_READY, false, nullptr,
+        [](Axis& axis) {
+            axis.watchdog_feed();
+            BootTimings_t& boot_timings = odrv.system_stats_.boot_timings;
+            uint32_t& closed_loop_time = axis.axis_num_ ? boot_timings.closed_loop_axis1 : boot_timings.closed_loop_axis0;
+            if (!closed_loop_time)
+                closed_loop_time = micros();
+            return axis.run_closed_loop_control_loop();
+        }, nullptr},
+    {Axis::AXIS_STATE_AUTOTUNE, REQUIRE_MOTOR_CALIBRATED | REQUIRE_DIRECTION | REQUIRE_ENCODER_READY, true, nullptr,
+        [](Axis& axis) { return axis.run_autotune(); }, nullptr},
+};
+
+static const AxisStateDescriptor_t* find_state(Axis::AxisState state) {
+    for (const AxisStateDescriptor_t& descriptor : state_table) {
+        if (descriptor.state == state)
+            return &descriptor;
+    }
+    return nullptr;
+}
+
+// @brief Requests a state or a sequence of states. The state machine thread
+// is woken up right away, the running state exits at the latest after the
+// current control loop iteration.
+void Axis::request_state(AxisState state) {
+    state_request_time_ = std::max(micros(), (uint32_t)1); // 0 for none
+    requested_state_ = state;
+    if (thread_id_valid_)
+        osSignalSet(thread_id_, M_SIGNAL_STATE_REQUEST);
+}
+
+// @brief Appends a state or the states of a sequence to the task chain
+// @param pos: next free entry in task_chain_
+// @param nested: a sequence within a sequence, which can't contain another
+// @returns false if the chain would overflow or the sequence is invalid
+bool Axis::append_task_chain(AxisState state, size_t* pos, bool nested) {
+    // The last entry is the terminating AXIS_STATE_UNDEFINED
+    auto push = [&](AxisState s) {
+        if (*pos >= task_chain_.size() - 1)
+            return false;
+        task_chain_[(*pos)++] = s;
+        return true;
+    };
+    switch (state) {
+        case AXIS_STATE_STARTUP_SEQUENCE: {
+            if (nested)
+                return false;
+            if (config_.startup_user_sequence)
+                return append_task_chain(AXIS_STATE_USER_SEQUENCE, pos, false);
+            bool ok = true;
+            if (config_.startup_motor_calibration)
+                ok = ok && push(AXIS_STATE_MOTOR_CALIBRATION);
+            if (config_.startup_encoder_index_search && encoder_.config_.use_index)
+                ok = ok && push(AXIS_STATE_ENCODER_INDEX_SEARCH);
+            if (config_.startup_encoder_offset_calibration)
+                ok = ok && push(AXIS_STATE_ENCODER_OFFSET_CALIBRATION);
+            if (config_.startup_homing && !homing_.is_homed) // e.g. restored by encoder.config.retain_multiturn
+                ok = ok && push(AXIS_STATE_HOMING);
+            if (config_.startup_closed_loop_control)
+                ok = ok && push(AXIS_STATE_CLOSED_LOOP_CONTROL);
+            else if (config_.startup_sensorless_control)
+                ok = ok && push(AXIS_STATE_SENSORLESS_CONTROL);
+            return ok;
+        }
+        case AXIS_STATE_FULL_CALIBRATION_SEQUENCE: {
+            bool ok = push(AXIS_STATE_MOTOR_CALIBRATION);
+            if (encoder_.config_.use_index)
+                ok = ok && push(AXIS_STATE_ENCODER_INDEX_SEARCH);
+            return ok && push(AXIS_STATE_ENCODER_OFFSET_CALIBRATION);
+        }
+        case AXIS_STATE_USER_SEQUENCE: {
+            if (nested)
+                return false;
+            for (AxisState s : config_.user_sequence) {
+                if (s == AXIS_STATE_UNDEFINED)
+                    break;
+                if (!append_task_chain(s, pos, true))
+                    return false;
+            }
+            return true;
+        }
+        default: {
+            return push(state);
+        }
+    }
+}
+
 // Infinite loop that does calibration and enters main control loop as appropriate
 void Axis::run_state_machine_loop() {
 
     // arm!
     motor_.arm();
-    mechanical_brake_.release();
 
     for (;;) {
         // Load the task chain if a specific request is pending
-        if (requested_state_ != AXIS_STATE_UNDEFINED) {
+        bool requested = requested_state_ != AXIS_STATE_UNDEFINED;
+        if (requested) {
             size_t pos = 0;
-            if (requested_state_ == AXIS_STATE_STARTUP_SEQUENCE) {
-                if (config_.startup_motor_calibration)
-                    task_chain_[pos++] = AXIS_STATE_MOTOR_CALIBRATION;
-                if (config_.startup_encoder_index_search && encoder_.config_.use_index)
-                    task_chain_[pos++] = AXIS_STATE_ENCODER_INDEX_SEARCH;
-                if (config_.startup_encoder_offset_calibration)
-                    task_chain_[pos++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
-                if (config_.startup_homing)
-                    task_chain_[pos++] = AXIS_STATE_HOMING;
-                if (config_.startup_closed_loop_control)
-                    task_chain_[pos++] = AXIS_STATE_CLOSED_LOOP_CONTROL;
-                else if (config_.startup_sensorless_control)
-                    task_chain_[pos++] = AXIS_STATE_SENSORLESS_CONTROL;
-                task_chain_[pos++] = AXIS_STATE_IDLE;
-            } else if (requested_state_ == AXIS_STATE_FULL_CALIBRATION_SEQUENCE) {
-                task_chain_[pos++] = AXIS_STATE_MOTOR_CALIBRATION;
-                if (encoder_.config_.use_index)
-                    task_chain_[pos++] = AXIS_STATE_ENCODER_INDEX_SEARCH;
-                task_chain_[pos++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
-                task_chain_[pos++] = AXIS_STATE_IDLE;
-            } else if (requested_state_ != AXIS_STATE_UNDEFINED) {
-                task_chain_[pos++] = requested_state_;
+            bool ok = append_task_chain(requested_state_, &pos, false);
+            ok = ok && pos < task_chain_.size() - 1;
+            if (ok)
                 task_chain_[pos++] = AXIS_STATE_IDLE;
-            }
-            task_chain_[pos++] = AXIS_STATE_UNDEFINED;  // TODO: bounds checking
+            else
+                pos = 0; // runs idle with ERROR_INVALID_STATE below
+            std::fill(task_chain_.begin() + pos, task_chain_.end(), AXIS_STATE_UNDEFINED);
             requested_state_ = AXIS_STATE_UNDEFINED;
             // Auto-clear any invalid state error
             error_ &= ~ERROR_INVALID_STATE;
         }
 
         // Note that current_state is a reference to task_chain_[0]
+        if (current_state_ != traced_state_) {
+            trace_errors(); // the errors that ended the last state come first
+            odrv.event_trace_.record(EventTrace::EVENT_TYPE_STATE_CHANGE, axis_num_, current_state_, traced_state_);
+            traced_state_ = current_state_;
+            ++state_transition_count_;
+        }
+        if (requested && state_request_time_) {
+            // From the request to the entry of the new state
+            last_transition_latency_ = micros() - state_request_time_;
+            max_transition_latency_ = std::max(max_transition_latency_, last_transition_latency_);
+            state_request_time_ = 0;
+        }
 
         // Run the specified state
         // Handlers should exit if requested_state != AXIS_STATE_UNDEFINED
-        bool status;
-        switch (current_state_) {
-            case AXIS_STATE_MOTOR_CALIBRATION: {
-                status = motor_.run_calibration();
-            } break;
-
-            case AXIS_STATE_ENCODER_INDEX_SEARCH: {
-                if (!motor_.is_calibrated_)
-                    goto invalid_state_label;
-                if (encoder_.config_.idx_search_unidirectional && motor_.config_.direction==0)
-                    goto invalid_state_label;
-
-                status = encoder_.run_index_search();
-            } break;
-
-            case AXIS_STATE_ENCODER_DIR_FIND: {
-                if (!motor_.is_calibrated_)
-                    goto invalid_state_label;
-
-                status = encoder_.run_direction_find();
-            } break;
-
-            case AXIS_STATE_HOMING: {
-                status = run_homing();
-            } break;
-
-            case AXIS_STATE_ENCODER_OFFSET_CALIBRATION: {
-                if (!motor_.is_calibrated_)
-                    goto invalid_state_label;
-                status = encoder_.run_offset_calibration();
-            } break;
-
-            case AXIS_STATE_LOCKIN_SPIN: {
-                if (!motor_.is_calibrated_ || motor_.config_.direction==0)
-                    goto invalid_state_label;
-                status = run_lockin_spin(config_.general_lockin);
-            } break;
-
-            case AXIS_STATE_SENSORLESS_CONTROL: {
-                if (!motor_.is_calibrated_ || motor_.config_.direction==0)
-                        goto invalid_state_label;
-                status = run_lockin_spin(config_.sensorless_ramp); // TODO: restart if desired
-                if (status) {
-                    // call to controller.reset() that happend when arming means that vel_setpoint
-                    // is zeroed. So we make the setpoint the spinup target for smooth transition.
-                    controller_.vel_setpoint_ = config_.sensorless_ramp.vel / (2.0f * M_PI * motor_.config_.pole_pairs);
-                    status = run_sensorless_control_loop();
-                }
-            } break;
-
-            case AXIS_STATE_CLOSED_LOOP_CONTROL: {
-                if (!motor_.is_calibrated_ || motor_.config_.direction==0)
-                    goto invalid_state_label;
-                if (!encoder_.is_ready_)
-                    goto invalid_state_label;
-                watchdog_feed();
-                status = run_closed_loop_control_loop();
-            } break;
-
-            case AXIS_STATE_IDLE: {
-                run_idle_loop();
-                status = motor_.arm(); // done with idling - try to arm the motor
+        const AxisStateDescriptor_t* descriptor = find_state(current_state_);
+        uint32_t requirements = descriptor ? descriptor->requirements : 0;
+        bool status = descriptor
+                && (!(requirements & REQUIRE_MOTOR_CALIBRATED) || motor_.is_calibrated_)
+                && (!(requirements & REQUIRE_DIRECTION) || motor_.config_.direction != 0)
+                && (!(requirements & REQUIRE_ENCODER_READY) || encoder_.is_ready_)
+                && (!descriptor->check || descriptor->check(*this));
+        if (status) {
+            if (descriptor->release_brake)
                 mechanical_brake_.release();
-            } break;
-
-            default:
-            invalid_state_label:
-                error_ |= ERROR_INVALID_STATE;
-                status = false;  // this will set the state to idle
-                break;
+            status = descriptor->run(*this);
+            if (descriptor->exit)
+                descriptor->exit(*this);
+        } else {
+            error_ |= ERROR_INVALID_STATE;
         }
 
         // If the state failed, go to idle, else advance task chain
@@ -9,10 +9,14 @@ class Axis;
 #include "trapTraj.hpp"
 #include "endstop.hpp"
 #include "mechanical_brake.hpp"
+#include "step_counter.hpp"
+#include "position_compare.hpp"
+#include "step_rate_estimator.hpp"
+#include "homing_sequence.hpp"
 #include "low_level.h"
 #include "utils.hpp"
-#include "communication/interface_uart.h" // TODO: remove once uart_poll() is gone
 #include "taskTimer.hpp"
+#include "snapshot_mailbox.hpp"
 
 #include <array>
 
@@ -30,6 +34,19 @@ public:
         bool finish_on_enc_idx = false;
     };
 
+    // Scale factors derived from the configuration of the axis and its
+    // components. They are recomputed on apply_config() and by the setters of
+    // the config values they depend on, so that the control loop doesn't have
+    // to divide on every cycle.
+    struct DerivedConstants_t {
+        float inv_cpr = 0.0f;             // [turn/count]
+        float elec_rad_per_enc = 0.0f;    // [rad/count] electrical
+        float elec_rad_per_turn = 0.0f;   // [rad/turn] electrical
+        float turns_per_elec_rad = 0.0f;  // [turn/rad] electrical
+        float inv_torque_constant = 0.0f; // [A/Nm] for PM motors
+        float bemf_ff_gain = 0.0f;        // [V/(rad/s)] electrical
+    };
+
     struct TaskTimes_t {
         TaskTimer thermistor_update;
         TaskTimer encoder_update;
@@ -48,19 +65,55 @@ public:
         TaskTimer control_loop;
         TaskTimer total;
 
-        TaskTimer uart_poll;
         TaskTimer FOC_Current;
     };
 
+    // A set of payload dependent settings that can be switched at runtime,
+    // see store_profile() and select_profile(). Profiles are saved with the
+    // configuration.
+    struct Profile_t {
+        static constexpr size_t count = 4;
+
+        bool valid = false; // false until stored
+        Controller::ControlMode control_mode;
+        Controller::InputMode input_mode;
+        float pos_gain;
+        float vel_gain;
+        float vel_integrator_gain;
+        float vel_limit;
+        float vel_ramp_rate;
+        float torque_ramp_rate;
+        float inertia;
+        float input_filter_bandwidth;
+        float current_lim;
+        float torque_lim;
+        TrapezoidalTrajectory::Config_t trap_traj;
+    };
+
     static LockinConfig_t default_calibration();
     static LockinConfig_t default_sensorless();
     static LockinConfig_t default_lockin();
 
+    // One signal of the configurable CAN feedback message, see CANSimple::send_feedback()
+    struct CANFeedbackSignal_t {
+        endpoint_ref_t endpoint;
+        uint32_t length = 0; // [bits], 0 disables the signal
+        float factor = 1.0f; // value = raw * factor + offset
+        float offset = 0.0f;
+        bool is_signed = false;
+    };
+
     struct CANConfig_t {
+        static constexpr size_t num_feedback_signals = 8;
+
         uint32_t node_id = 0;
         bool is_extended = false;
         uint32_t heartbeat_rate_ms = 100;
         uint32_t encoder_rate_ms = 10;
+        bool sync_mode = false; // latch setpoints and sample feedback on the sync message, see ODriveCAN::latch_sync()
+        bool timed_setpoints = false; // Set Input Pos carries the board time to apply it at, see TimedSetpoints
+        uint32_t feedback_rate_ms = 0; // 0 disables the feedback message
+        CANFeedbackSignal_t feedback_signals[num_feedback_signals];
     };
 
     struct Config_t {
@@ -71,6 +124,10 @@ public:
         bool startup_closed_loop_control = false; //<! enable closed loop control after calibration/startup
         bool startup_sensorless_control = false; //<! enable sensorless control after calibration/startup
         bool startup_homing = false; //<! enable homing after calibration/startup
+        bool startup_user_sequence = false; //<! run user_sequence at startup instead of the flags above
+        static constexpr size_t user_sequence_size = 8;
+        AxisState user_sequence[user_sequence_size] = { AXIS_STATE_UNDEFINED }; //<! states of AXIS_STATE_USER_SEQUENCE,
+                                                // terminated by AXIS_STATE_UNDEFINED
 
         bool enable_step_dir = false; //<! enable step/dir input after calibration
                                     //   For M0 this has no effect if enable_uart is true
@@ -80,16 +137,34 @@ public:
                                          //<! into idle or out of closed loop control.
 
         float turns_per_step = 1.0f / 1024.0f;
+        bool step_dir_use_timer = false; //<! Count the steps with a hardware timer instead of an interrupt
+                                         //<! per step. Only some step pins support this.
+        // Tracking filter on the step position, see StepRateEstimator
+        bool step_dir_filter_pos = false; //<! Write the interpolated position to input_pos instead of the staircase
+        bool step_dir_vel_ff = false; //<! Write the estimated step rate to input_vel
+        bool step_dir_torque_ff = false; //<! Write the estimated acceleration times controller.config.inertia to input_torque
+        float step_dir_filter_bandwidth = 500.0f; // [rad/s]
 
         float watchdog_timeout = 0.0f; // [s]
         bool enable_watchdog = false;
 
+        uint32_t outer_loop_decimation = 1; //<! Number of current control cycles per controller update.
+                                            //<! Takes effect on the next state transition.
+        uint32_t idle_loop_decimation = 1;  //<! Same as outer_loop_decimation while in AXIS_STATE_IDLE,
+                                            //<! the checks and the sensorless estimator are decimated too.
+
         // Defaults loaded from hw_config in load_configuration in main.cpp
         uint16_t step_gpio_pin = 0;
         uint16_t dir_gpio_pin = 0;
 
+        HomingSequence::Config_t homing;
+        PositionCompare::Config_t position_compare; // armed by arm_position_compare()
+
         LockinConfig_t calibration_lockin = default_calibration();
         LockinConfig_t sensorless_ramp = default_sensorless();
+        bool enable_sensorless_flying_start = false; //<! Catch a spinning motor before falling back to sensorless_ramp
+        float flying_start_duration = 0.1f; // [s] settling time of the sensorless estimator at zero current
+        float flying_start_min_vel = 200.0f; // [rad/s electrical] slower motors are started by sensorless_ramp
         LockinConfig_t general_lockin;
 
         CANConfig_t can;
@@ -107,10 +182,57 @@ public:
     struct CAN_t {
         uint32_t last_heartbeat = 0;
         uint32_t last_encoder = 0;
+        uint32_t last_feedback = 0;
+
+        // Sync mode: setpoints received since the last sync message, only
+        // accessed in critical sections
+        struct {
+            float input_pos, input_vel, input_torque;
+            bool pos_valid, vel_valid, torque_valid;
+        } pending = {};
+        uint32_t sync_seq = 0; // last sync message latched by this axis
+        bool feedback_pending = false; // encoder feedback sampled on sync, not sent yet
+        float feedback_pos = 0.0f;
+        float feedback_vel = 0.0f;
+    };
+
+    // Copied by the control loop for feedback that is streamed by a lower
+    // priority thread
+    struct FeedbackSnapshot_t {
+        uint32_t loop_counter;
+        float pos_estimate; // [turn]
+        float vel_estimate; // [turn/s]
+        float Iq_measured; // [A]
+        float Iq_setpoint; // [A]
+        float vbus_voltage; // [V]
+    };
+
+    // State of the axis at one control loop iteration, copied by the control
+    // loop on request of read_snapshot(). All fields are 32 bits, so the
+    // struct has no padding and goes out as it is, little endian.
+    struct StateSnapshot_t {
+        uint32_t loop_counter;
+        uint32_t current_state;
+        uint32_t axis_error;
+        uint32_t motor_error;
+        uint32_t encoder_error;
+        uint32_t controller_error;
+        float pos_estimate;      // [turn]
+        float vel_estimate;      // [turn/s]
+        float torque_setpoint;   // [Nm]
+        float Iq_setpoint;       // [A]
+        float Iq_measured;       // [A]
+        float Id_measured;       // [A]
+        float vbus_voltage;      // [V]
+        float ibus;              // [A]
+        float fet_temperature;   // [°C]
+        float motor_temperature; // [°C]
     };
 
     enum thread_signals {
-        M_SIGNAL_PH_CURRENT_MEAS = 1u << 0
+        M_SIGNAL_PH_CURRENT_MEAS = 1u << 0,
+        M_SIGNAL_CONTROL_LOOP_DONE = 1u << 1,
+        M_SIGNAL_STATE_REQUEST = 1u << 2
     };
 
     Axis(int axis_num,
@@ -132,11 +254,15 @@ public:
     bool setup();
     void start_thread();
     void signal_current_meas();
-    bool wait_for_current_meas();
+    bool wait_for_current_meas(bool interruptible = false);
 
     void step_cb();
+    void dir_cb();
+    void update_step_dir();
     void set_step_dir_active(bool enable);
     void decode_step_dir_pins();
+    void update_sampled_gpios();
+    void update_derived_constants();
 
     bool check_DRV_fault();
     bool check_PSU_brownout();
@@ -144,8 +270,18 @@ public:
     bool do_updates();
 
     void watchdog_feed();
+    void arm_position_compare();
+    void update_position_compare();
     bool watchdog_check();
 
+    void sample_telemetry();
+    void trace_errors();
+    void sample_data_logger();
+    void publish_feedback();
+    void publish_snapshot();
+    bool read_snapshot(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    void latch_can_sync();
+
     void clear_errors() {
         motor_.error_ = Motor::ERROR_NONE;
         controller_.error_ = Controller::ERROR_NONE;
@@ -156,6 +292,17 @@ public:
         error_ = ERROR_NONE;
     }
 
+    bool store_profile(uint8_t index);
+    bool select_profile(uint8_t index);
+    void apply_requested_profile();
+
+    void update_outer_loop_timing();
+    void on_current_meas_timeout();
+#ifdef BOARD_CONTROL_LOOP
+    void board_control_loop_step();
+    void release_control_loop();
+#endif
+
     // True if there are no errors
     bool inline check_for_errors() {
         return error_ == ERROR_NONE;
@@ -183,76 +330,115 @@ public:
     // @tparam T Must be a callable type that takes no arguments and returns a bool
     template<typename T>
     void run_control_loop(const T& update_handler) {
-        while (requested_state_ == AXIS_STATE_UNDEFINED) {
-            task_times_.control_loop.beginTimer();
-
-            // look for errors at axis level and also all subcomponents
-            task_times_.axis_error_check.beginTimer();
-            bool checks_ok = do_checks();
-            task_times_.axis_error_check.stopTimer();
-
-            // Update all estimators
-            // Note: updates run even if checks fail
-            task_times_.axis_update.beginTimer();
-            bool updates_ok = do_updates();
-            task_times_.axis_update.stopTimer();
-
-            // make sure the watchdog is being fed. 
-            bool watchdog_ok = watchdog_check();
-            
-            if (!checks_ok || !updates_ok || !watchdog_ok) {
-                // It's not useful to quit idle since that is the safe action
-                // Also leaving idle would rearm the motors
-                if (current_state_ != AXIS_STATE_IDLE)
-                    break;
-            }
-
-            // Run main loop function, defer quitting for after wait
-            // TODO: change arming logic to arm after waiting
-            task_times_.update_handler.beginTimer();
-            bool main_continue = update_handler();
-            task_times_.update_handler.stopTimer();
-
-            if (axis_num_ == 0) {
-                task_times_.uart_poll.beginTimer();
-                uart_poll(); // TODO: move to board-level control loop once it exists
-                task_times_.uart_poll.stopTimer();
-            }
-
-            // Check we meet deadlines after queueing
-            ++loop_counter_;
-
-            task_times_.control_loop.stopTimer();
-            task_times_.total.stopTimer();
-            if(axis_num_ == 1)
-                TaskTimer::sample_next = false;
+        update_outer_loop_timing();
+
+#ifdef BOARD_CONTROL_LOOP
+        // The board-level control loop thread runs the iterations of all
+        // axes. This thread just sleeps until it hands the loop back.
+        control_loop_handler_ = &update_handler;
+        control_loop_continue_ = true;
+        control_loop_fn_ = [](Axis& axis, const void* handler, bool* main_continue) {
+            return axis.control_loop_iteration(*static_cast<const T*>(handler), main_continue);
+        };
+        while (control_loop_fn_) {
+            osSignalWait(M_SIGNAL_CONTROL_LOOP_DONE, osWaitForever);
+        }
+#else
+        bool main_continue = true;
+        while ((requested_state_ == AXIS_STATE_UNDEFINED || defer_state_requests_) && main_continue) {
+            if (!control_loop_iteration(update_handler, &main_continue))
+                break;
 
             // Wait until the current measurement interrupt fires
-            if (!wait_for_current_meas()) {
-                // maybe the interrupt handler is dead, let's be
-                // safe and float the phases
-                safety_critical_disarm_motor_pwm(motor_);
-                update_brake_current();
-                error_ |= ERROR_CURRENT_MEASUREMENT_TIMEOUT;
+            if (!wait_for_current_meas(!defer_state_requests_)) {
+                on_current_meas_timeout();
                 break;
             }
             task_times_.total.beginTimer();
+        }
+#endif
+    }
 
-            if (!main_continue)
-                break;
+    // @brief Runs one iteration of the control loop (see run_control_loop).
+    // @param main_continue: Set to false if the loop should exit after this
+    //        iteration, after waiting for the next current measurement.
+    // @returns false if the loop must exit immediately.
+    template<typename T>
+    bool control_loop_iteration(const T& update_handler, bool* main_continue) {
+        task_times_.control_loop.beginTimer();
+
+        // The controller and slow estimators only run on every
+        // outer_loop_decimation_'th cycle, FOC runs on every cycle.
+        outer_loop_tick_ = (outer_loop_countdown_ <= 1);
+        outer_loop_countdown_ = outer_loop_tick_ ? outer_loop_decimation_ : outer_loop_countdown_ - 1;
+
+        // look for errors at axis level and also all subcomponents
+        // In idle the checks only run on outer loop cycles, see idle_loop_decimation
+        task_times_.axis_error_check.beginTimer();
+        bool checks_ok = (in_idle_loop_ && !outer_loop_tick_) || do_checks();
+        task_times_.axis_error_check.stopTimer();
+
+        // Update all estimators
+        // Note: updates run even if checks fail
+        task_times_.axis_update.beginTimer();
+        bool updates_ok = do_updates();
+        task_times_.axis_update.stopTimer();
+
+        // make sure the watchdog is being fed. 
+        bool watchdog_ok = watchdog_check();
+        
+        if (!checks_ok || !updates_ok || !watchdog_ok) {
+            // It's not useful to quit idle since that is the safe action
+            // Also leaving idle would rearm the motors
+            if (current_state_ != AXIS_STATE_IDLE)
+                return false;
         }
+
+        latch_can_sync();
+        apply_requested_profile();
+
+        // Run main loop function, defer quitting for after wait
+        // TODO: change arming logic to arm after waiting
+        task_times_.update_handler.beginTimer();
+        *main_continue = update_handler();
+        task_times_.update_handler.stopTimer();
+
+        trace_errors();
+        sample_data_logger();
+        if (feedback_stream_enabled_)
+            publish_feedback();
+        if (state_snapshot_requested_)
+            publish_snapshot();
+        if (axis_num_ == 0)
+            sample_telemetry();
+
+        // Check we meet deadlines after queueing
+        ++loop_counter_;
+
+        task_times_.control_loop.stopTimer();
+        task_times_.total.stopTimer();
+        if (axis_num_ == AXIS_COUNT - 1)
+            TaskTimer::sample_next = false;
+
+        return true;
     }
 
     bool run_lockin_spin(const LockinConfig_t &lockin_config);
+    bool run_hfi_startup();
+    bool run_sensorless_flying_start(bool* caught);
     bool run_sensorless_control_loop();
     bool run_closed_loop_control_loop();
     bool run_homing();
+    bool run_autotune();
     bool run_idle_loop();
+    bool run_sensorless_control();
 
     constexpr uint32_t get_watchdog_reset() {
         return static_cast<uint32_t>(std::clamp<float>(config_.watchdog_timeout, 0, UINT32_MAX / (current_meas_hz + 1)) * current_meas_hz);
     }
 
+    void request_state(AxisState state);
+    bool append_task_chain(AxisState state, size_t* pos, bool nested);
     void run_state_machine_loop();
 
     // hardware config
@@ -261,6 +447,7 @@ public:
     uint16_t default_dir_gpio_pin_;
     osPriority thread_priority_;
     Config_t config_;
+    DerivedConstants_t derived_;
 
     Encoder& encoder_;
     SensorlessEstimator& sensorless_estimator_;
@@ -271,31 +458,87 @@ public:
     Endstop& max_endstop_;
     MechanicalBrake& mechanical_brake_;
     TaskTimes_t task_times_;
+    TGpioSampler gpio_sampler_; // GPIO inputs sampled at the PWM update, see update_sampled_gpios()
 
     osThreadId thread_id_;
-    const uint32_t stack_size_ = 2048; // Bytes
+    static constexpr uint32_t stack_size_ = 2048; // Bytes
     volatile bool thread_id_valid_ = false;
 
     // variables exposed on protocol
     Error error_ = ERROR_NONE;
     bool step_dir_active_ = false; // auto enabled after calibration, based on config.enable_step_dir
+    StepCounter step_counter_;
+    TIM_HandleTypeDef* step_timer_ = nullptr; // counts the steps if config.step_dir_use_timer is set
+    float step_dir_base_pos_ = 0.0f; // [turns] input_pos_ when step/dir was activated
+    int32_t step_dir_last_count_ = 0;
+    StepRateEstimator step_rate_estimator_;
 
     // updated from config in constructor, and on protocol hook
     Stm32Gpio step_gpio_;
     Stm32Gpio dir_gpio_;
 
     AxisState requested_state_ = AXIS_STATE_STARTUP_SEQUENCE;
-    std::array<AxisState, 10> task_chain_ = { AXIS_STATE_UNDEFINED };
+    std::array<AxisState, 16> task_chain_ = { AXIS_STATE_UNDEFINED };
     AxisState& current_state_ = task_chain_.front();
+    bool defer_state_requests_ = false; // the control loop exits on its own, e.g. after engaging the brake
+    uint32_t state_request_time_ = 0; // [us] of the last request_state(), 0 once served
+    uint32_t state_transition_count_ = 0;
+    uint32_t last_transition_latency_ = 0; // [us] from the request to the entry of the state
+    uint32_t max_transition_latency_ = 0;  // [us]
     uint32_t loop_counter_ = 0;
+
+    // error codes at the last trace_errors(), to trace only newly set bits
+    struct {
+        Error axis = ERROR_NONE;
+        Motor::Error motor = Motor::ERROR_NONE;
+        Encoder::Error encoder = Encoder::ERROR_NONE;
+        Controller::Error controller = Controller::ERROR_NONE;
+        SensorlessEstimator::Error sensorless_estimator = SensorlessEstimator::ERROR_NONE;
+    } traced_errors_;
+    AxisState traced_state_ = AXIS_STATE_UNDEFINED;
+
+    // outer loop decimation, latched from config_ when a control loop starts
+    uint32_t outer_loop_decimation_ = 1;
+    uint32_t outer_loop_countdown_ = 0;
+    bool in_idle_loop_ = false; // the decimation is latched from idle_loop_decimation
+    bool outer_loop_tick_ = true; // true on cycles where the outer loop runs
+    float outer_loop_period_ = current_meas_period; // [s]
+    float outer_loop_hz_ = (float)current_meas_hz; // [Hz]
+
+    std::array<Profile_t, Profile_t::count> profiles_;
+    uint8_t active_profile_ = 0xff; // 0xff if none was selected since startup
+    volatile uint8_t requested_profile_ = 0xff; // applied by the control loop
+
     LockinState lockin_state_ = LOCKIN_STATE_INACTIVE;
     Homing_t homing_;    
+    PositionCompare position_compare_;
+    uint32_t position_compare_loop_ = 0; // loop_counter_ of the last pulse
+    SnapshotMailbox<FeedbackSnapshot_t> feedback_snapshot_;
+    volatile bool feedback_stream_enabled_ = false; // set while a protocol streams the feedback of this axis
+    SnapshotMailbox<StateSnapshot_t> state_snapshot_;
+    volatile bool state_snapshot_requested_ = false; // set by read_snapshot(), cleared by the control loop
+    StateSnapshot_t state_snapshot_readout_ = {}; // taken by read_snapshot() for offset 0
+    bool state_snapshot_readout_valid_ = false;
     CAN_t can_;
 
 
     // watchdog
     uint32_t watchdog_current_value_= 0;
+
+#ifdef BOARD_CONTROL_LOOP
+    // Control loop handed over to the board-level control loop thread by
+    // run_control_loop. control_loop_fn_ is null while no loop is handed over.
+    bool (* volatile control_loop_fn_)(Axis& axis, const void* handler, bool* main_continue) = nullptr;
+    const void* control_loop_handler_ = nullptr;
+    bool control_loop_continue_ = true;
+#endif
 };
 
+#ifdef BOARD_CONTROL_LOOP
+extern osThreadId board_control_loop_thread_id;
+void start_board_control_loop_thread();
+void signal_board_control_loop();
+#endif
+
 
 #endif /* __AXIS_HPP */
@@ -0,0 +1,50 @@
+#ifndef __AXIS_SCHEDULE_HPP
+#define __AXIS_SCHEDULE_HPP
+
+#include <stddef.h>
+
+// Describes how the control loops of the axes of a board share the PWM
+// period, so that the current measurement interrupt (pwm_trig_adc_cb) is the
+// same code for any number of axes. The board defines one entry per axis in
+// axis_schedule (see board.h).
+//
+// Each axis samples its currents on its own ADC trigger and owns one time
+// slot per PWM period. The slot starts at the ADC event when the timer of
+// the axis is counting up (current measurement) or down (DC calibration).
+// At the start of its slot an axis starts its SPI encoder read and loads the
+// PWM timings that the control loop of timings_axis queued meanwhile. The
+// control loop of an axis therefore has from its current measurement until
+// the slot that loads its timings, which is the CPU budget of the axis.
+struct AxisSchedule_t {
+    bool injected;           // the axis timer triggers the injected conversion, else the regular one
+    bool slot_counting_down; // the slot starts at the DC calibration event
+    size_t timings_axis;     // the axis whose PWM timings are loaded at the start of the slot
+};
+
+// @brief The axis that samples on the given ADC trigger, N if there is none
+template<size_t N>
+constexpr size_t axis_for_adc_trigger(const AxisSchedule_t (&schedule)[N], bool injected) {
+    for (size_t i = 0; i < N; ++i) {
+        if (schedule[i].injected == injected)
+            return i;
+    }
+    return N;
+}
+
+// @brief True if each axis has its own ADC trigger and the PWM timings of
+// each axis are loaded in exactly one slot
+template<size_t N>
+constexpr bool is_valid_axis_schedule(const AxisSchedule_t (&schedule)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+        if (schedule[i].timings_axis >= N || axis_for_adc_trigger(schedule, schedule[i].injected) != i)
+            return false;
+        size_t loads = 0;
+        for (size_t j = 0; j < N; ++j)
+            loads += schedule[j].timings_axis == i;
+        if (loads != 1)
+            return false;
+    }
+    return true;
+}
+
+#endif // __AXIS_SCHEDULE_HPP
@@ -0,0 +1,181 @@
+#ifndef __BACKLASH_COMP_HPP
+#define __BACKLASH_COMP_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+// Compensation of the backlash of a gearbox when the position loop closes on
+// the motor encoder. The motor has to travel through the backlash at every
+// reversal before the load follows, so the position setpoint is offset by
+// half the backlash in the direction of the commanded motion. On a reversal
+// the offset moves to the other side within transition_time along a smooth
+// step, and its velocity is added to the velocity feedforward, so the motor
+// crosses the gap without a step of the setpoint and without slowing down
+// the move.
+//
+// Reversals are detected on the commanded position with a hysteresis of
+// reversal_threshold, so that setpoint noise doesn't toggle the offset.
+// Until the first motion the offset is zero, i.e. the middle of the gap.
+class BacklashCompensator {
+public:
+    struct Config_t {
+        bool enable = false;
+        float backlash = 0.0f;              // [turn] lost motion of the motor between both directions
+        float transition_time = 0.01f;      // [s] of the offset change on a reversal
+        float reversal_threshold = 0.0005f; // [turn] commanded travel back from a turning point
+        // Calibration with a load encoder, see BacklashCalibration
+        float calib_vel = 0.05f;            // [turn/s] of the load
+        float calib_distance = 0.1f;        // [turn] of the load per stroke
+        uint32_t calib_cycles = 3;          // forward and backward strokes
+    };
+
+    struct Output_t {
+        float pos; // [turn] to add to the position setpoint
+        float vel; // [turn/s] to add to the velocity setpoint
+    };
+
+    void reset() {
+        initialized_ = false;
+        dir_ = 0;
+        offset_ = 0.0f;
+        start_ = 0.0f;
+        target_ = 0.0f;
+        progress_ = 1.0f;
+    }
+
+    // @brief Once per control loop iteration
+    // @param pos: [turn] commanded position
+    Output_t update(const Config_t& config, float pos, float dt) {
+        if (!initialized_) {
+            initialized_ = true;
+            turning_point_ = pos;
+        }
+        int32_t dir = dir_;
+        if (dir_ > 0) {
+            turning_point_ = std::max(turning_point_, pos);
+            if (pos < turning_point_ - config.reversal_threshold)
+                dir = -1;
+        } else if (dir_ < 0) {
+            turning_point_ = std::min(turning_point_, pos);
+            if (pos > turning_point_ + config.reversal_threshold)
+                dir = 1;
+        } else if (pos > turning_point_ + config.reversal_threshold) {
+            dir = 1;
+        } else if (pos < turning_point_ - config.reversal_threshold) {
+            dir = -1;
+        }
+        if (dir != dir_) {
+            dir_ = dir;
+            turning_point_ = pos;
+            ++reversals_;
+            start_ = offset_;
+            target_ = 0.5f * config.backlash * (float)dir;
+            progress_ = 0.0f;
+        }
+
+        float vel = 0.0f;
+        if (progress_ < 1.0f && config.transition_time > dt) {
+            progress_ = std::min(progress_ + dt / config.transition_time, 1.0f);
+            float p = progress_;
+            offset_ = start_ + (target_ - start_) * p * p * (3.0f - 2.0f * p);
+            vel = (target_ - start_) * 6.0f * p * (1.0f - p) / config.transition_time;
+        } else {
+            progress_ = 1.0f;
+            target_ = 0.5f * config.backlash * (float)dir_; // follows changes of the config
+            offset_ = target_;
+        }
+        return {offset_, vel};
+    }
+
+    float offset() const { return offset_; } // [turn]
+    int32_t dir() const { return dir_; }     // -1, 0 before the first motion, 1
+    uint32_t reversals() const { return reversals_; }
+
+private:
+    bool initialized_ = false;
+    int32_t dir_ = 0;
+    float turning_point_ = 0.0f; // [turn] extreme of the commanded position in dir_
+    float offset_ = 0.0f;        // [turn]
+    float start_ = 0.0f;         // [turn] offset at the reversal
+    float target_ = 0.0f;        // [turn]
+    float progress_ = 1.0f;      // of the transition, 0 to 1
+    uint32_t reversals_ = 0;
+};
+
+// Measurement of the backlash with an encoder on each side of the gearbox,
+// i.e. the dual loop setup with the position loop on the load encoder. The
+// load moves back and forth by calib_distance at calib_vel. During the second half of each stroke the gap is closed on
+// the leading side, so the mean difference of the motor and the load
+// position is taken there. The difference between the forward and the
+// backward strokes is the backlash, which includes the wind-up of the
+// transmission by the friction of the load.
+class BacklashCalibration {
+public:
+    // @param pos: [turn] position setpoint to start from
+    void start(float pos) {
+        active_ = true;
+        stroke_ = 0;
+        stroke_pos_ = 0.0f;
+        origin_ = pos;
+        sum_ = 0.0f;
+        count_ = 0;
+        sum_fwd_ = 0.0f;
+        sum_bwd_ = 0.0f;
+    }
+
+    void abort() { active_ = false; }
+
+    // @param motor_pos: [turn] of the motor, scaled to the load by the ratio
+    // @param load_pos: [turn] of the load
+    // @param pos, vel: [turn], [turn/s] setpoints of the load for the next period
+    // @returns true when the measurement is complete, see backlash()
+    bool update(const BacklashCompensator::Config_t& config, float motor_pos, float load_pos, float dt,
+                float* pos, float* vel) {
+        uint32_t strokes = 2 * std::max(config.calib_cycles, (uint32_t)1);
+        float dir = (stroke_ & 1) ? -1.0f : 1.0f;
+        if (stroke_pos_ > 0.5f * config.calib_distance) {
+            sum_ += motor_pos - load_pos;
+            ++count_;
+        }
+        stroke_pos_ += config.calib_vel * dt;
+        if (stroke_pos_ >= config.calib_distance) {
+            float mean = count_ ? sum_ / (float)count_ : 0.0f;
+            if (dir > 0.0f)
+                sum_fwd_ += mean;
+            else
+                sum_bwd_ += mean;
+            sum_ = 0.0f;
+            count_ = 0;
+            stroke_pos_ = 0.0f;
+            origin_ += dir * config.calib_distance;
+            if (++stroke_ >= strokes) {
+                backlash_ = (sum_fwd_ - sum_bwd_) / (float)(strokes / 2);
+                active_ = false;
+                *pos = origin_;
+                *vel = 0.0f;
+                return true;
+            }
+            dir = -dir;
+        }
+        *pos = origin_ + dir * stroke_pos_;
+        *vel = dir * config.calib_vel;
+        return false;
+    }
+
+    bool active() const { return active_; }
+    float backlash() const { return backlash_; } // [turn] of the load, of the last measurement
+
+private:
+    bool active_ = false;
+    uint32_t stroke_ = 0;     // even forward, odd backward
+    float stroke_pos_ = 0.0f; // [turn] travelled in the current stroke
+    float origin_ = 0.0f;     // [turn] start of the current stroke
+    float sum_ = 0.0f;        // [turn] of motor minus load in the current stroke
+    uint32_t count_ = 0;
+    float sum_fwd_ = 0.0f;    // [turn] of the stroke means
+    float sum_bwd_ = 0.0f;
+    float backlash_ = 0.0f;
+};
+
+#endif // __BACKLASH_COMP_HPP
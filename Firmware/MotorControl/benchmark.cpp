@@ -0,0 +1,88 @@
+
+#include "odrive_main.h"
+
+#include <fibre/crc.hpp>
+
+#include <algorithm>
+
+// Cycle counts of the stateless hot path kernels on synthetic inputs, for
+// comparing implementations on the target. The host side counterpart is
+// Tests/bench/benchmark.cpp.
+
+static constexpr size_t benchmark_runs = 64;
+
+// Keeps the compiler from dropping the kernel calls
+static volatile float benchmark_sink;
+
+template<typename T>
+static uint32_t benchmark_min_cycles(T&& kernel) {
+    // Left running, the counter is shared with the task timers and the
+    // FreeRTOS run time stats
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    uint32_t overhead = UINT32_MAX;
+    for (size_t i = 0; i < benchmark_runs; ++i) {
+        uint32_t start = DWT->CYCCNT;
+        overhead = std::min(overhead, DWT->CYCCNT - start);
+    }
+
+    // The shortest run is the one that was not preempted by an interrupt
+    uint32_t best = UINT32_MAX;
+    for (size_t i = 0; i < benchmark_runs; ++i) {
+        uint32_t start = DWT->CYCCNT;
+        kernel(i);
+        best = std::min(best, DWT->CYCCNT - start);
+    }
+    return best > overhead ? best - overhead : 0;
+}
+
+static float benchmark_angle(size_t i) {
+    return (float)i * (2.0f * M_PI / benchmark_runs) - M_PI;
+}
+
+uint32_t ODrive::benchmark_kernel(uint32_t kernel) {
+    switch (kernel) {
+        case BENCHMARK_KERNEL_SVM: return benchmark_min_cycles([](size_t i) {
+            float angle = benchmark_angle(i);
+            auto [tA, tB, tC, success] = SVM(0.5f * our_arm_cos_f32(angle), 0.5f * our_arm_sin_f32(angle));
+            benchmark_sink = success ? tA + tB + tC : 0.0f;
+        });
+        case BENCHMARK_KERNEL_MINMAX_SVM: return benchmark_min_cycles([](size_t i) {
+            float angle = benchmark_angle(i);
+            float timings[3];
+            bool success = minmax_svm(0.5f * our_arm_cos_f32(angle), 0.5f * our_arm_sin_f32(angle), timings);
+            benchmark_sink = success ? timings[0] + timings[1] + timings[2] : 0.0f;
+        });
+        case BENCHMARK_KERNEL_FAST_ATAN2: return benchmark_min_cycles([](size_t i) {
+            float angle = benchmark_angle(i);
+            benchmark_sink = fast_atan2(our_arm_sin_f32(angle), our_arm_cos_f32(angle));
+        });
+        case BENCHMARK_KERNEL_SIN: return benchmark_min_cycles([](size_t i) {
+            benchmark_sink = our_arm_sin_f32(benchmark_angle(i));
+        });
+        case BENCHMARK_KERNEL_SINCOS: return benchmark_min_cycles([](size_t i) {
+            float s, c;
+            our_arm_sincos_f32(benchmark_angle(i), &s, &c);
+            benchmark_sink = s + c;
+        });
+        case BENCHMARK_KERNEL_CRC16: {
+            static uint8_t packet[64];
+            for (size_t i = 0; i < sizeof(packet); ++i)
+                packet[i] = (uint8_t)(i * 37);
+            return benchmark_min_cycles([](size_t i) {
+                packet[0] = (uint8_t)i;
+                benchmark_sink = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, packet, sizeof(packet));
+            });
+        }
+        case BENCHMARK_KERNEL_TRAP_TRAJ_EVAL: {
+            // A private instance, the axes may be running their own
+            static TrapezoidalTrajectory traj;
+            traj.planTrapezoidal(10.0f, 0.0f, 0.0f, 2.0f, 0.5f, 0.5f);
+            return benchmark_min_cycles([](size_t i) {
+                benchmark_sink = traj.eval((float)i * (traj.Tf_ / benchmark_runs)).Y;
+            });
+        }
+        default: return 0;
+    }
+}
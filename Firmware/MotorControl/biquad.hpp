@@ -0,0 +1,77 @@
+#ifndef __BIQUAD_HPP
+#define __BIQUAD_HPP
+
+#include <cmath>
+
+// Second order IIR filter in transposed direct form II.
+// The coefficients are computed once by the design functions (RBJ audio EQ
+// cookbook), so filtering a sample costs five multiplications.
+class Biquad {
+public:
+    // @brief Notch filter at f0 [Hz] with quality factor Q at sample rate fs [Hz].
+    // Disables the filter if f0 is not in (0, fs/2).
+    void design_notch(float f0, float Q, float fs) {
+        if (!design_valid(f0, Q, fs))
+            return disable();
+        float w0 = 2.0f * (float)M_PI * f0 / fs;
+        float cos_w0 = std::cos(w0);
+        float alpha = std::sin(w0) / (2.0f * Q);
+        set(1.0f, -2.0f * cos_w0, 1.0f, 1.0f + alpha, -2.0f * cos_w0, 1.0f - alpha);
+    }
+
+    // @brief Low-pass filter with cutoff f0 [Hz] and quality factor Q (0.707 for Butterworth)
+    // at sample rate fs [Hz]. Disables the filter if f0 is not in (0, fs/2).
+    void design_lowpass(float f0, float Q, float fs) {
+        if (!design_valid(f0, Q, fs))
+            return disable();
+        float w0 = 2.0f * (float)M_PI * f0 / fs;
+        float cos_w0 = std::cos(w0);
+        float alpha = std::sin(w0) / (2.0f * Q);
+        float b = 0.5f * (1.0f - cos_w0);
+        set(b, 2.0f * b, b, 1.0f + alpha, -2.0f * cos_w0, 1.0f - alpha);
+    }
+
+    void disable() {
+        enabled_ = false;
+        reset();
+    }
+
+    void reset() {
+        z1_ = 0.0f;
+        z2_ = 0.0f;
+    }
+
+    float filter(float x) {
+        if (!enabled_)
+            return x;
+        float y = b0_ * x + z1_;
+        z1_ = b1_ * x - a1_ * y + z2_;
+        z2_ = b2_ * x - a2_ * y;
+        return y;
+    }
+
+    bool enabled() const { return enabled_; }
+
+private:
+    static bool design_valid(float f0, float Q, float fs) {
+        return f0 > 0.0f && f0 < 0.5f * fs && Q > 0.0f;
+    }
+
+    void set(float b0, float b1, float b2, float a0, float a1, float a2) {
+        float inv_a0 = 1.0f / a0;
+        b0_ = b0 * inv_a0;
+        b1_ = b1 * inv_a0;
+        b2_ = b2 * inv_a0;
+        a1_ = a1 * inv_a0;
+        a2_ = a2 * inv_a0;
+        enabled_ = true;
+        reset();
+    }
+
+    bool enabled_ = false;
+    float b0_ = 1.0f, b1_ = 0.0f, b2_ = 0.0f; // normalized to a0 = 1
+    float a1_ = 0.0f, a2_ = 0.0f;
+    float z1_ = 0.0f, z2_ = 0.0f;
+};
+
+#endif // __BIQUAD_HPP
@@ -0,0 +1,123 @@
+#ifndef __BRAKE_HANDOFF_HPP
+#define __BRAKE_HANDOFF_HPP
+
+#include <algorithm>
+
+// Hand-off of the load between a mechanical brake and the motor in closed
+// loop control, e.g. on a vertical axis.
+//
+// On entry the brake is still engaged. The velocity integrator of the
+// controller is ramped up to the torque that held the load when the brake
+// was engaged last, within torque_ramp_time, so the motor carries the load
+// when the brake opens. The axis then holds its position at zero velocity
+// for release_delay while the brake releases, before the inputs of the
+// controller apply.
+//
+// On a state request the axis holds its position at zero velocity, engages
+// the brake and keeps holding for engage_delay while the brake closes. The
+// torque at the end of it is remembered as the holding torque, then the
+// motor torque is ramped down to zero within torque_ramp_time, after
+// which the control loop exits.
+class BrakeHandoff {
+public:
+    struct Config_t {
+        float release_delay = 0.0f;    // [s] from releasing the brake until the inputs apply
+        float engage_delay = 0.0f;     // [s] from engaging the brake until the torque ramps down
+        float torque_ramp_time = 0.0f; // [s] of the torque ramps between the brake and the motor
+    };
+
+    enum Phase_t {
+        PHASE_OFF,     // not in closed loop control
+        PHASE_LOAD,    // brake engaged, the motor takes over the holding torque
+        PHASE_RELEASE, // brake released, holding position
+        PHASE_RUN,     // brake released, following the inputs
+        PHASE_ENGAGE,  // brake engaged, holding position
+        PHASE_UNLOAD,  // brake engaged, the torque ramps down
+        PHASE_DONE,    // the control loop may exit
+    };
+
+    // @brief At the entry of closed loop control, with the brake engaged
+    void start() {
+        phase_ = PHASE_LOAD;
+        time_ = 0.0f;
+    }
+
+    // @brief Hands the load back to the brake, e.g. on a state request
+    void stop() {
+        if (phase_ == PHASE_LOAD) {
+            phase_ = PHASE_DONE; // the brake was never released
+        } else if (phase_ == PHASE_RELEASE || phase_ == PHASE_RUN) {
+            phase_ = PHASE_ENGAGE;
+            time_ = 0.0f;
+        }
+    }
+
+    // @brief After the control loop exited, for any reason
+    void reset() {
+        phase_ = PHASE_OFF;
+    }
+
+    // @brief Once per control loop iteration
+    // @param torque: [Nm] present torque command of the motor
+    // @param dt: [s] since the last update
+    Phase_t update(const Config_t& config, float torque, float dt) {
+        time_ += dt;
+        for (;;) {
+            float duration;
+            Phase_t next;
+            switch (phase_) {
+                case PHASE_LOAD:
+                    duration = holding_torque_ != 0.0f ? config.torque_ramp_time : 0.0f;
+                    next = PHASE_RELEASE;
+                    break;
+                case PHASE_RELEASE:
+                    duration = config.release_delay;
+                    next = PHASE_RUN;
+                    break;
+                case PHASE_ENGAGE:
+                    duration = config.engage_delay;
+                    next = PHASE_UNLOAD;
+                    break;
+                case PHASE_UNLOAD:
+                    duration = config.torque_ramp_time;
+                    next = PHASE_DONE;
+                    break;
+                default:
+                    return phase_;
+            }
+            if (time_ < duration) {
+                ramp_ = duration > 0.0f ? time_ / duration : 1.0f;
+                return phase_;
+            }
+            if (phase_ == PHASE_ENGAGE)
+                holding_torque_ = torque;
+            phase_ = next;
+            time_ = 0.0f;
+            ramp_ = 0.0f;
+        }
+    }
+
+    Phase_t phase() const { return phase_; }
+    bool brake_released() const { return phase_ == PHASE_RELEASE || phase_ == PHASE_RUN; }
+    // The axis holds its position at zero velocity
+    bool hold() const { return phase_ != PHASE_OFF && phase_ != PHASE_RUN; }
+    bool done() const { return phase_ == PHASE_DONE; }
+
+    // @brief [Nm] velocity integrator torque in PHASE_LOAD
+    float load_torque() const { return holding_torque_ * ramp_; }
+
+    // @brief Factor of the motor torque
+    float torque_scale() const {
+        return phase_ == PHASE_UNLOAD ? 1.0f - ramp_ : phase_ == PHASE_DONE ? 0.0f : 1.0f;
+    }
+
+    float holding_torque() const { return holding_torque_; } // [Nm] when the brake was engaged last
+
+private:
+    Phase_t phase_ = PHASE_OFF;
+    float time_ = 0.0f;           // [s] in the present phase
+    float ramp_ = 0.0f;           // progress of the present phase, 0 to 1
+    float holding_torque_ = 0.0f; // [Nm]
+};
+
+#endif // __BRAKE_HANDOFF_HPP
@@ -0,0 +1,127 @@
+#ifndef __CONTROL_LAW_HPP
+#define __CONTROL_LAW_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+#include "utils.hpp"
+
+// The arithmetic of the control cascade: the modulation stage of
+// Motor::FOC_current(), the phase detector and turn bookkeeping of the
+// Encoder::update() PLL and the velocity loop steps of Controller::update().
+// The firmware and the host tests (Tests/control_loop_model.hpp) both call
+// these, so the golden traces cover the same code that runs on the board.
+
+// Modulation vector of the current controller, see foc_modulation()
+struct FocModulation_t {
+    float mod_d, mod_q;
+    float mod_alpha, mod_beta;
+    float modulation; // magnitude relative to the limit, before limiting
+    bool saturated;
+};
+
+// @brief Limits the dq modulation to max_modulation and transforms it to the
+// stationary frame at pwm_phase. Without overmodulation the limit is the
+// circle inscribed in the SVM hexagon, with overmodulation it may extend up
+// to the hexagon vertices, and the vector is then clipped onto the hexagon
+// boundary, keeping its angle, so that SVM stays valid.
+// @param c_I, s_I: cosine and sine of I_phase. pwm_phase is only slightly
+//        advanced with respect to I_phase, so its sin/cos is usually found by
+//        rotating this pair.
+// @param sincos: sincos(angle, &sin, &cos), for the other cases
+template<typename TSinCos>
+inline FocModulation_t foc_modulation(float mod_d, float mod_q, float c_I, float s_I, float I_phase, float pwm_phase,
+        float max_modulation, bool overmodulation_enable, bool small_angle_pwm_phase_enable, TSinCos&& sincos) {
+    FocModulation_t out;
+    float max_mod = std::min(max_modulation, overmodulation_enable ? two_by_sqrt3 : 1.0f) * sqrt3_by_2;
+    float mod_magnitude = std::sqrt(mod_d * mod_d + mod_q * mod_q);
+    float mod_scalefactor = max_mod / mod_magnitude;
+    out.modulation = mod_magnitude / max_mod;
+    out.saturated = mod_scalefactor < 1.0f;
+    if (out.saturated) {
+        mod_d *= mod_scalefactor;
+        mod_q *= mod_scalefactor;
+    }
+
+    // Inverse park transform
+    float c_p = c_I;
+    float s_p = s_I;
+    if (!small_angle_pwm_phase_enable || !rotate_by_small_angle(pwm_phase - I_phase, &c_p, &s_p)) {
+        sincos(pwm_phase, &s_p, &c_p);
+    }
+    out.mod_alpha = c_p * mod_d - s_p * mod_q;
+    out.mod_beta = c_p * mod_q + s_p * mod_d;
+
+    if (overmodulation_enable) {
+        float hex_norm = svm_hexagon_norm(out.mod_alpha, out.mod_beta);
+        if (hex_norm > 1.0f) {
+            float hex_scalefactor = 0.9999f / hex_norm; // margin for rounding errors in SVM
+            out.mod_alpha *= hex_scalefactor;
+            out.mod_beta *= hex_scalefactor;
+            mod_d *= hex_scalefactor;
+            mod_q *= hex_scalefactor;
+            out.saturated = true;
+        }
+    }
+    out.mod_d = mod_d;
+    out.mod_q = mod_q;
+    return out;
+}
+
+// @brief Phase detector of the linear PLL estimate, which is split into whole
+// turns and the position within the turn in counts, so its resolution does
+// not degrade with distance travelled. The counts are compared modulo 2^32
+// like the shadow count itself.
+// @returns [count] the shadow count minus the estimate
+inline float pll_linear_phase_error(int32_t shadow_count, int32_t pos_turns, float pos_counts, int32_t cpr) {
+    uint32_t pos_floor = (uint32_t)pos_turns * (uint32_t)cpr + (uint32_t)(int32_t)std::floor(pos_counts);
+    return (float)(int32_t)((uint32_t)shadow_count - pos_floor);
+}
+
+// @brief Moves the whole turns of pos_counts into pos_turns, so pos_counts
+// stays in [0, cpr)
+inline void pll_wrap_turns(int32_t* pos_turns, float* pos_counts, int32_t cpr, float inv_cpr) {
+    int32_t turn_wraps = (int32_t)std::floor(*pos_counts * inv_cpr);
+    *pos_counts -= (float)(turn_wraps * cpr);
+    *pos_turns += turn_wraps;
+}
+
+// @brief V-shaped gain schedule of the velocity loop by position error
+// @returns the factor on the velocity gains, 1 outside the width
+inline float pos_error_gain_schedule(float pos_err, float width) {
+    float abs_pos_err = std::abs(pos_err);
+    return abs_pos_err <= width ? abs_pos_err / width : 1.0f;
+}
+
+// @brief Coulomb and viscous friction feedforward, the Coulomb part ramps in
+// over vel_band around zero velocity
+inline float friction_feedforward(float coulomb, float viscous, float vel_band, float vel_setpoint) {
+    return coulomb * std::clamp(vel_setpoint / vel_band, -1.0f, 1.0f) + viscous * vel_setpoint;
+}
+
+// @brief Clamps the torque to [-lim_neg, lim_pos]
+// @returns true if it was limited
+inline bool limit_torque(float* torque, float lim_neg, float lim_pos) {
+    bool limited = false;
+    if (*torque > lim_pos) {
+        limited = true;
+        *torque = lim_pos;
+    }
+    if (*torque < -lim_neg) {
+        limited = true;
+        *torque = -lim_neg;
+    }
+    return limited;
+}
+
+// @brief Velocity integrator without explicit anti-windup: it decays while
+// the torque is limited and integrates the step otherwise
+inline void vel_integrator_decay_update(float* integrator, float step, bool limited, float decay) {
+    if (limited)
+        *integrator *= decay;
+    else
+        *integrator += step;
+}
+
+#endif // __CONTROL_LAW_HPP
@@ -1,18 +1,139 @@
 
 #include "odrive_main.h"
+#include "control_law.hpp"
 #include <algorithm>
 
 bool Controller::apply_config() {
     config_.parent = this;
     update_filter_gains();
+    gain_schedule_.build(config_.gain_schedule);
     return true;
 }
 
+// @brief Publishes a set of input setpoints for the control loop.
+// Can be called from any thread. The critical section only serializes the
+// protocols among each other, it takes as long as copying the setpoints.
+// @param fields: SetpointMailbox::Field bits of the setpoints to update
+void Controller::set_input_setpoints(uint32_t fields, float pos, float vel, float torque) {
+    CRITICAL_SECTION() {
+        input_setpoints_.publish(fields, pos, vel, torque);
+        if ((fields & SetpointMailbox::TORQUE) && config_.fast_torque_input)
+            axis_->motor_.post_fast_torque(torque);
+    }
+}
+
+// @brief Latches the encoder estimates broadcast by the gearing master on CAN.
+// Called from the CAN thread.
+void Controller::set_gear_can_master(float pos, float vel) {
+    CRITICAL_SECTION() {
+        gear_can_pos_ = pos;
+        gear_can_vel_ = vel;
+        gear_can_new_ = true;
+    }
+}
+
+// @brief Applies the setpoints published since the last call, if any.
+// Must only be called from the control loop.
+void Controller::apply_input_setpoints() {
+    SetpointMailbox::Setpoints_t sp;
+    if (!input_setpoints_.take(&sp))
+        return;
+    if (sp.fields & SetpointMailbox::TORQUE)
+        input_torque_ = sp.input_torque;
+    if (sp.fields & SetpointMailbox::VEL)
+        input_vel_ = sp.input_vel;
+    if (sp.fields & SetpointMailbox::POS) {
+        input_pos_ = sp.input_pos;
+        input_pos_updated();
+    }
+}
+
+// @brief Applies the timed setpoints that are due at the current board time,
+// interpolated in between them. Must only be called from the control loop.
+void Controller::apply_timed_setpoints() {
+    TimedSetpoints::Output_t sp;
+    if (!timed_setpoints_.update(odrv.timebase_.now(), &sp))
+        return;
+    input_pos_ = sp.pos;
+    input_vel_ = sp.vel;
+    input_torque_ = sp.torque;
+    input_pos_updated();
+}
+
+void Controller::set_hold(bool hold) {
+    if (hold && !hold_)
+        hold_pos_ = pos_setpoint_;
+    hold_ = hold;
+}
+
 void Controller::reset() {
     pos_setpoint_ = 0.0f;
     vel_setpoint_ = 0.0f;
     vel_integrator_torque_ = 0.0f;
+    acim_integrator_inv_flux_ = 0.0f;
     torque_setpoint_ = 0.0f;
+    spline_active_ = false;
+    torque_notch1_.reset();
+    torque_notch2_.reset();
+    torque_lpf_.reset();
+    dual_loop_.reset();
+    gain_schedule_.build(config_.gain_schedule);
+    disturbance_observer_.reset();
+    input_shaper_.configure((InputShaper::Type)config_.input_shaper.type, config_.input_shaper.freq,
+                            config_.input_shaper.damping, axis_->outer_loop_period_);
+    electronic_gear_.disengage();
+    soft_limits_.reset();
+    backlash_comp_.reset();
+    fast_torque_window_ = {};
+    hold_ = false;
+    if (backlash_calib_.active()) {
+        backlash_calib_.abort();
+        config_.input_mode = backlash_calib_saved_input_mode_;
+    }
+    load_torque_estimate_ = 0.0f;
+    last_torque_ = 0.0f;
+    frequency_response_.stop();
+    mode_transfer_pending_ = false;
+    active_control_mode_ = config_.control_mode;
+    active_input_mode_ = config_.input_mode;
+}
+
+// @brief Continues in the configured modes from the state of the last update.
+// The loops that the old control mode didn't close start at the estimates
+// and the velocity integrator takes over the torque, so that neither the
+// motion nor the torque jumps. The inputs are set to hold this state until
+// new inputs arrive.
+void Controller::transfer_mode() {
+    ControlMode from = active_control_mode_;
+    ControlMode to = config_.control_mode;
+    if (from == to && active_input_mode_ == config_.input_mode)
+        return;
+
+    if (from < CONTROL_MODE_POSITION_CONTROL && pos_estimate_valid_src_ && *pos_estimate_valid_src_) {
+        // dual_loop_offset_ is still the one of the last update
+        pos_setpoint_ = (config_.circular_setpoints ? *pos_estimate_circular_src_ : pos_estimate_linear())
+                      + dual_loop_offset_;
+    }
+    if (from < CONTROL_MODE_VELOCITY_CONTROL) {
+        if (vel_estimate_valid_src_ && *vel_estimate_valid_src_)
+            vel_setpoint_ = *vel_estimate_src_;
+        // The velocity error is zero, so the feedforward terms and the
+        // integrator make up the torque of the last update
+        float friction = config_.friction_coulomb * std::clamp(vel_setpoint_ / config_.friction_vel_band, -1.0f, 1.0f)
+                       + config_.friction_viscous * vel_setpoint_;
+        vel_integrator_torque_ = feedback_torque_ - friction
+                               + config_.disturbance_observer.feedforward_gain * load_torque_estimate_;
+        acim_integrator_inv_flux_ = 0.0f;
+    }
+
+    input_pos_ = pos_setpoint_;
+    input_vel_ = to == CONTROL_MODE_VELOCITY_CONTROL ? vel_setpoint_ : 0.0f;
+    input_torque_ = to < CONTROL_MODE_VELOCITY_CONTROL ? feedback_torque_ : 0.0f;
+    torque_setpoint_ = input_torque_;
+    input_pos_updated_ = false;
+    trajectory_done_ = true;
+    move_from_queue_ = false;
+    spline_active_ = false;
 }
 
 void Controller::set_error(Error error) {
@@ -30,10 +151,25 @@ bool Controller::select_encoder(size_t encoder_num) {
         Axis* ax = &axes[encoder_num];
         pos_estimate_circular_src_ = &ax->encoder_.pos_circular_;
         pos_wrap_src_ = &config_.circular_setpoint_range;
-        pos_estimate_linear_src_ = &ax->encoder_.pos_estimate_;
+        pos_estimate_turns_src_ = &ax->encoder_.pos_estimate_turns_;
+        pos_estimate_linear_src_ = &ax->encoder_.pos_estimate_in_turn_;
         pos_estimate_valid_src_ = &ax->encoder_.pos_estimate_valid_;
         vel_estimate_src_ = &ax->encoder_.vel_estimate_;
         vel_estimate_valid_src_ = &ax->encoder_.vel_estimate_valid_;
+        vel_encoder_ = nullptr;
+        dual_loop_.reset();
+
+        // Dual loop: the velocity loop closes on another encoder, scaled to
+        // the load by dual_loop.ratio
+        size_t vel_encoder_num = config_.vel_encoder_axis;
+        if (vel_encoder_num < AXIS_COUNT && vel_encoder_num != encoder_num) {
+            vel_encoder_ = &axes[vel_encoder_num].encoder_;
+            dual_loop_vel_estimate_ = config_.dual_loop.ratio * vel_encoder_->vel_estimate_;
+            vel_estimate_src_ = &dual_loop_vel_estimate_;
+            vel_estimate_valid_src_ = &vel_encoder_->vel_estimate_valid_;
+        } else if (vel_encoder_num < 0xff && vel_encoder_num >= AXIS_COUNT) {
+            return set_error(Controller::ERROR_INVALID_LOAD_ENCODER), false;
+        }
         return true;
     } else {
         return set_error(Controller::ERROR_INVALID_LOAD_ENCODER), false;
@@ -41,14 +177,47 @@ bool Controller::select_encoder(size_t encoder_num) {
 }
 
 void Controller::move_to_pos(float goal_point) {
-    axis_->trap_traj_.planTrapezoidal(goal_point, pos_setpoint_, vel_setpoint_,
-                                 axis_->trap_traj_.config_.vel_limit,
-                                 axis_->trap_traj_.config_.accel_limit,
-                                 axis_->trap_traj_.config_.decel_limit);
-    axis_->trap_traj_.t_ = 0.0f;
+    move_from_queue_ = false;
+    plan_move(goal_point, axis_->trap_traj_.config_.vel_limit,
+              axis_->trap_traj_.config_.accel_limit,
+              axis_->trap_traj_.config_.decel_limit);
+}
+
+void Controller::plan_move(float goal_point, float vel_limit, float accel_limit, float decel_limit) {
+    if (config_.input_mode == INPUT_MODE_SCURVE_TRAJ) {
+        if (!axis_->trap_traj_.planSCurve(goal_point, pos_setpoint_, vel_setpoint_,
+                                          vel_limit, accel_limit, decel_limit,
+                                          axis_->trap_traj_.config_.jerk_limit)) {
+            set_error(ERROR_INVALID_INPUT_MODE);
+            return;
+        }
+    } else {
+        axis_->trap_traj_.planTrapezoidal(goal_point, pos_setpoint_, vel_setpoint_,
+                                          vel_limit, accel_limit, decel_limit);
+    }
+    axis_->trap_traj_.start(axis_->outer_loop_period_);
     trajectory_done_ = false;
 }
 
+bool Controller::stage_move(float goal, float duration, float accel_time, float decel_time) {
+    if (!(accel_time > 0.0f && decel_time > 0.0f && accel_time + decel_time <= duration))
+        return false;
+    move_staged_ = false;
+    std::atomic_signal_fence(std::memory_order_release);
+    staged_move_ = {goal, duration, accel_time, decel_time};
+    std::atomic_signal_fence(std::memory_order_release);
+    move_staged_ = true;
+    return true;
+}
+
+float Controller::get_min_move_time(float goal, float accel_time, float decel_time) {
+    return TrapezoidalTrajectory::minTimedDuration(goal - pos_setpoint_,
+            axis_->trap_traj_.config_.vel_limit,
+            axis_->trap_traj_.config_.accel_limit,
+            axis_->trap_traj_.config_.decel_limit,
+            accel_time, decel_time);
+}
+
 void Controller::move_incremental(float displacement, bool from_input_pos = true){
     if(from_input_pos){
         input_pos_ += displacement;
@@ -59,10 +228,68 @@ void Controller::move_incremental(float displacement, bool from_input_pos = true
     input_pos_updated();
 }
 
+// @brief Makes the cogging map writable: copies it from NVM into a buffer on
+// the FreeRTOS heap, unless there is a copy already. Called from the protocol
+// threads, not from the control loop.
+// @returns false if the heap has no room for the copy
+bool Controller::edit_cogging_map() {
+    constexpr size_t size = sizeof(int16_t) * max_cogging_map_size;
+    ++cogging_map_version_;
+    if (cogging_map_copy_)
+        return true;
+    int16_t* copy = (int16_t*)pvPortMalloc(size);
+    if (!copy)
+        return false;
+    const int16_t* stored = cogging_map_;
+    if (stored)
+        memcpy(copy, stored, size);
+    else
+        memset(copy, 0, size);
+    CRITICAL_SECTION() {
+        cogging_map_copy_ = copy;
+        cogging_map_ = copy;
+    }
+    return true;
+}
+
+// @brief Replaces the cogging map with one from a configuration image, which
+// is released afterwards. Only called with the motor disarmed, after
+// edit_cogging_map() made room for the copy.
+bool Controller::restore_cogging_map(const int16_t* map) {
+    if (!edit_cogging_map())
+        return false;
+    memcpy(cogging_map_copy_, map, sizeof(int16_t) * max_cogging_map_size);
+    return true;
+}
+
+// @brief Points the cogging map at its record in NVM after a load or a save,
+// see ConfigManager::read_in_place(). A copy is released once the same
+// version of it was saved and no calibration writes to it.
+// @param version: cogging_map_version_ when the saved map was serialized
+void Controller::set_stored_cogging_map(const int16_t* map, uint32_t version) {
+    int16_t* released = nullptr;
+    CRITICAL_SECTION() {
+        if (!cogging_map_copy_) {
+            cogging_map_ = map;
+        } else if (map && version == cogging_map_version_ && !config_.anticogging.calib_anticogging) {
+            released = cogging_map_copy_;
+            cogging_map_copy_ = nullptr;
+            cogging_map_ = map;
+        }
+    }
+    if (released)
+        vPortFree(released);
+}
+
 void Controller::start_anticogging_calibration() {
-    // Ensure the cogging map was correctly allocated earlier and that the motor is capable of calibrating
-    if (axis_->error_ == Axis::ERROR_NONE) {
-        config_.anticogging.calib_anticogging = true;
+    // Ensure the cogging map can be written and that the motor is capable of calibrating
+    if (kFeatureAnticogging && axis_->error_ == Axis::ERROR_NONE && edit_cogging_map()) {
+        // The map is stored in 16 bit fixed point covering the torque range of the motor
+        config_.anticogging.map_scale = axis_->motor_.max_available_torque() / 32767.0f;
+        config_.anticogging.map_size = cogging_map_size();
+        anticogging_valid_ = false;
+        sweep_.active = false;
+        config_.anticogging.calib_anticogging = config_.anticogging.map_scale > 0.0f;
     }
 }
 
@@ -78,11 +305,13 @@ bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate)
     float pos_err = input_pos_ - pos_estimate;
     if (std::abs(pos_err) <= config_.anticogging.calib_pos_threshold / (float)axis_->encoder_.config_.cpr &&
         std::abs(vel_estimate) < config_.anticogging.calib_vel_threshold / (float)axis_->encoder_.config_.cpr) {
-        config_.anticogging.cogging_map[std::clamp<uint32_t>(config_.anticogging.index++, 0, 3600)] = vel_integrator_torque_;
+        float value = std::round(vel_integrator_torque_ / config_.anticogging.map_scale);
+        cogging_map_copy_[std::min(config_.anticogging.index++, max_cogging_map_size - 1)] =
+                (int16_t)std::clamp(value, -32767.0f, 32767.0f);
     }
-    if (config_.anticogging.index < 3600) {
+    if (config_.anticogging.index < config_.anticogging.map_size) {
         config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
-        input_pos_ = config_.anticogging.index * axis_->encoder_.getCoggingRatio();
+        input_pos_ = (float)config_.anticogging.index / (float)config_.anticogging.map_size;
         input_vel_ = 0.0f;
         input_torque_ = 0.0f;
         input_pos_updated();
@@ -95,24 +324,265 @@ bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate)
         input_torque_ = 0.0f;
         input_pos_updated();
         anticogging_valid_ = true;
+        ++cogging_map_version_; // a save that started meanwhile has a partial map
         config_.anticogging.calib_anticogging = false;
         return true;
     }
 }
 
+void Controller::start_anticogging_sweep() {
+    start_anticogging_calibration();
+    if (!config_.anticogging.calib_anticogging || !(config_.anticogging.calib_sweep_vel > 0.0f)) {
+        config_.anticogging.calib_anticogging = false;
+        return;
+    }
+    sweep_.saved_input_mode = config_.input_mode;
+    sweep_.phase = SWEEP_FORWARD;
+    sweep_.t = 0.0f;
+    sweep_.bin = -1;
+    sweep_.bins_done = 0;
+    sweep_.friction_sum = 0.0f;
+    sweep_.ripple_sum = sweep_.ripple_sum_sqr = 0.0;
+    config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+    config_.input_mode = INPUT_MODE_PASSTHROUGH;
+    input_pos_ = pos_setpoint_;
+    input_torque_ = 0.0f;
+    sweep_.active = true;
+}
+
+/*
+ * Continuous anti-cogging calibration: sweeps one turn forward and one turn
+ * backward at constant velocity and averages the torque command over each map
+ * entry. The mean of both directions is the cogging torque, half their
+ * difference the friction, which cancels. A third sweep with the new map
+ * measures the remaining torque ripple.
+ */
+bool Controller::anticogging_sweep(float dt) {
+    const float settle_time = 0.5f; // [s] after each start or reversal
+    const uint32_t map_size = config_.anticogging.map_size;
+    const float scale = config_.anticogging.map_scale;
+    float vel = sweep_.phase == SWEEP_BACKWARD ? -config_.anticogging.calib_sweep_vel
+                                               : config_.anticogging.calib_sweep_vel;
+    input_pos_ += vel * dt;
+    input_vel_ = vel;
+    sweep_.t += dt;
+    if (sweep_.t < settle_time)
+        return false;
+
+    // feedback_torque_ is from the previous tick, i.e. the previous input_pos_
+    int32_t bin = mod((int)std::floor((input_pos_ - vel * dt) * map_size), map_size);
+    if (bin == sweep_.bin) {
+        sweep_.sum += feedback_torque_;
+        ++sweep_.count;
+        return false;
+    }
+
+    if (sweep_.bin >= 0) {
+        float avg = sweep_.sum / (float)sweep_.count;
+        int16_t& entry = cogging_map_copy_[sweep_.bin];
+        if (sweep_.phase == SWEEP_FORWARD) {
+            entry = (int16_t)std::clamp(std::round(avg / scale), -32767.0f, 32767.0f);
+        } else if (sweep_.phase == SWEEP_BACKWARD) {
+            float fwd = scale * entry;
+            entry = (int16_t)std::clamp(std::round(0.5f * (fwd + avg) / scale), -32767.0f, 32767.0f);
+            sweep_.friction_sum += 0.5f * (fwd - avg);
+        } else {
+            sweep_.ripple_sum += avg;
+            sweep_.ripple_sum_sqr += (double)avg * avg;
+        }
+        ++sweep_.bins_done;
+    }
+    sweep_.bin = bin;
+    sweep_.sum = feedback_torque_;
+    sweep_.count = 1;
+
+    if (sweep_.bins_done < map_size)
+        return false;
+
+    // Phase complete
+    sweep_.t = 0.0f;
+    sweep_.bin = -1;
+    sweep_.bins_done = 0;
+    if (sweep_.phase == SWEEP_FORWARD) {
+        sweep_.phase = SWEEP_BACKWARD;
+        return false;
+    } else if (sweep_.phase == SWEEP_BACKWARD) {
+        anticogging_friction_ = sweep_.friction_sum / (float)map_size;
+        anticogging_valid_ = true;
+        sweep_.phase = SWEEP_VERIFY;
+        return false;
+    }
+    double mean = sweep_.ripple_sum / map_size;
+    anticogging_residual_ripple_ = (float)std::sqrt(std::max(sweep_.ripple_sum_sqr / map_size - mean * mean, 0.0));
+    input_vel_ = 0.0f;
+    config_.input_mode = sweep_.saved_input_mode;
+    input_pos_updated();
+    sweep_.active = false;
+    ++cogging_map_version_;
+    config_.anticogging.calib_anticogging = false;
+    return true;
+}
+
+void Controller::start_backlash_calibration() {
+    if (!vel_encoder_ || !(config_.backlash_comp.calib_vel > 0.0f) || !(config_.backlash_comp.calib_distance > 0.0f)
+            || !(config_.dual_loop.ratio != 0.0f))
+        return;
+    backlash_calib_saved_input_mode_ = config_.input_mode;
+    config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+    config_.input_mode = INPUT_MODE_PASSTHROUGH;
+    input_pos_ = pos_setpoint_;
+    input_torque_ = 0.0f;
+    backlash_calib_.start(pos_setpoint_);
+}
+
 void Controller::update_filter_gains() {
-    float bandwidth = std::min(config_.input_filter_bandwidth, 0.25f * current_meas_hz);
+    float bandwidth = std::min(config_.input_filter_bandwidth, 0.25f * axis_->outer_loop_hz_);
     input_filter_ki_ = 2.0f * bandwidth;  // basic conversion to discrete time
     input_filter_kp_ = 0.25f * (input_filter_ki_ * input_filter_ki_); // Critically damped
+
+    torque_notch1_.design_notch(config_.torque_notch1_freq, config_.torque_notch1_q, axis_->outer_loop_hz_);
+    torque_notch2_.design_notch(config_.torque_notch2_freq, config_.torque_notch2_q, axis_->outer_loop_hz_);
+    torque_lpf_.design_lowpass(config_.torque_lpf_freq, 0.7071f, axis_->outer_loop_hz_);
 }
 
-static float limitVel(const float vel_limit, const float vel_estimate, const float vel_gain, const float torque) {
-    float Tmax = (vel_limit - vel_estimate) * vel_gain;
-    float Tmin = (-vel_limit - vel_estimate) * vel_gain;
-    return std::clamp(torque, Tmin, Tmax);
+void Controller::update_mech_identification(float torque, float vel_estimate) {
+    const float dt = axis_->outer_loop_period_;
+    mech_identifier_.filter(torque, vel_estimate, std::min(2.0f * (float)M_PI * config_.mech_ident_bandwidth * dt, 1.0f));
+    uint32_t decimation = std::max<uint32_t>(config_.mech_ident_decimation, 1);
+    if (++mech_ident_ticks_ < decimation)
+        return;
+    mech_ident_ticks_ = 0;
+
+    mech_identifier_.update(decimation * dt, std::clamp(config_.mech_ident_forgetting, 0.9f, 1.0f),
+                            std::max(config_.friction_vel_band, 1e-6f));
+    identified_inertia_ = mech_identifier_.inertia();
+    identified_viscous_friction_ = mech_identifier_.viscous();
+    identified_coulomb_friction_ = mech_identifier_.coulomb();
+
+    if (config_.mech_ident_apply) {
+        config_.inertia = std::max(identified_inertia_, 0.0f);
+        config_.friction_viscous = std::max(identified_viscous_friction_, 0.0f);
+        config_.friction_coulomb = std::max(identified_coulomb_friction_, 0.0f);
+    }
+}
+
+void Controller::reset_mech_identification() {
+    mech_identifier_.reset();
+    mech_ident_ticks_ = 0;
+    identified_inertia_ = 0.0f;
+    identified_viscous_friction_ = 0.0f;
+    identified_coulomb_friction_ = 0.0f;
+}
+
+static_assert(LOOP_ANALYSIS_UNSTABLE == Controller::TUNING_WARNING_UNSTABLE
+        && LOOP_ANALYSIS_ENCODER_UNSTABLE_GAIN == Controller::TUNING_WARNING_ENCODER_UNSTABLE_GAIN,
+        "LoopAnalyzer and TuningWarning bits must match");
+
+// @brief Checks the configured gains, inertia and bandwidths of the cascaded
+// loops against each other, see LoopAnalyzer. The result goes to
+// loop_analysis_ and tuning_warning_.
+// @returns true if there were no warnings
+bool Controller::analyze_tuning() {
+    // The encoder that the velocity loop closes on
+    size_t encoder_num = config_.vel_encoder_axis < AXIS_COUNT ? config_.vel_encoder_axis
+                       : config_.load_encoder_axis < AXIS_COUNT ? config_.load_encoder_axis
+                       : axis_->axis_num_;
+    const Encoder& encoder = axes[encoder_num].encoder_;
+    LoopAnalysisInput_t in = {
+        .inertia = config_.inertia,
+        .vel_gain = config_.vel_gain,
+        .vel_integrator_gain = config_.vel_integrator_gain,
+        .pos_gain = config_.control_mode >= CONTROL_MODE_POSITION_CONTROL ? config_.pos_gain : 0.0f,
+        .encoder_bandwidth = encoder.config_.bandwidth,
+        .tracking_observer = encoder.config_.vel_estimator_mode == Encoder::VEL_ESTIMATOR_MODE_TRACKING_OBSERVER,
+        .current_bandwidth = axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_GIMBAL
+                           ? 0.0f : axis_->motor_.config_.current_control_bandwidth,
+        .control_period = axis_->outer_loop_period_,
+        .current_meas_period = current_meas_period,
+    };
+    loop_analysis_ = LoopAnalyzer(in).analyze();
+    tuning_warning_ = (TuningWarning)loop_analysis_.warnings;
+    return !loop_analysis_.warnings;
+}
+
+// @brief Starts a stepped sine measurement of the frequency response in
+// closed loop control, on top of the current inputs. The sine is added to
+// the torque command, the velocity setpoint or the position setpoint by
+// config_.frequency_response.injection. The response is the velocity
+// estimate, or the position estimate for position injection.
+// @returns false if the axis is not in a control mode that closes the loop
+// behind the injection point or the parameters are out of range
+bool Controller::start_frequency_response() {
+    const FrequencyResponse_t& cfg = config_.frequency_response;
+    ControlMode required = cfg.injection == FREQUENCY_RESPONSE_INJECTION_POSITION ? CONTROL_MODE_POSITION_CONTROL
+                         : cfg.injection == FREQUENCY_RESPONSE_INJECTION_VELOCITY ? CONTROL_MODE_VELOCITY_CONTROL
+                         : CONTROL_MODE_TORQUE_CONTROL;
+    if (axis_->current_state_ != Axis::AXIS_STATE_CLOSED_LOOP_CONTROL || config_.control_mode < required)
+        return false;
+    CRITICAL_SECTION() {
+        frequency_response_injection_ = cfg.injection;
+        return frequency_response_.start(cfg.amplitude, cfg.freq_start, cfg.freq_end, cfg.num_points,
+                                         cfg.settle_cycles, cfg.measure_cycles, axis_->outer_loop_period_);
+    }
+    return false;
+}
+
+// Returns the completed rows of the bode table as little endian float32
+// values (freq, gain, phase, torque_gain, torque_phase) from the byte offset
+// in the request. Gain and phase are computed here, in the protocol thread.
+bool Controller::read_frequency_response(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    using Bode_t = FrequencyResponseAnalyzer::Bode_t;
+    size_t pos = offset.value();
+    size_t size = frequency_response_.num_points() * sizeof(Bode_t);
+    while (pos < size && output_buffer->size()) {
+        Bode_t row = frequency_response_.bode(pos / sizeof(Bode_t));
+        size_t in_row = pos % sizeof(Bode_t);
+        size_t n_copy = std::min(output_buffer->size(), sizeof(Bode_t) - in_row);
+        memcpy(output_buffer->begin(), (const uint8_t*)&row + in_row, n_copy);
+        *output_buffer = output_buffer->skip(n_copy);
+        pos += n_copy;
+    }
+    return true; // an empty response marks the end of the table
+}
+
+static float limitVel(const float vel_min, const float vel_max, const float vel_estimate, const float vel_gain, const float torque,
+                      FastTorqueWindow& window) {
+    float Tmax = (vel_max - vel_estimate) * vel_gain;
+    float Tmin = (vel_min - vel_estimate) * vel_gain;
+    return window.clamp(torque, Tmin, Tmax);
 }
 
 bool Controller::update(float* torque_setpoint_output) {
+    const float dt = axis_->outer_loop_period_;
+
+    // Before the new inputs so that inputs sent along with a mode change
+    // apply in the new mode
+    if (mode_transfer_pending_) {
+        mode_transfer_pending_ = false;
+        transfer_mode();
+    }
+    active_control_mode_ = config_.control_mode;
+    active_input_mode_ = config_.input_mode;
+
+    apply_input_setpoints();
+    apply_timed_setpoints();
+
+    dual_loop_offset_ = 0.0f;
+    if (vel_encoder_) {
+        dual_loop_vel_estimate_ = config_.dual_loop.ratio * vel_encoder_->vel_estimate_;
+        if (pos_estimate_valid_src_ && *pos_estimate_valid_src_ && vel_encoder_->pos_estimate_valid_) {
+            dual_loop_offset_ = dual_loop_.update(config_.dual_loop,
+                    *pos_estimate_turns_src_, *pos_estimate_linear_src_,
+                    vel_encoder_->pos_estimate_turns_, vel_encoder_->pos_estimate_in_turn_,
+                    feedback_torque_, vel_setpoint_, dt);
+        } else {
+            dual_loop_.reset();
+        }
+    }
+
     float* pos_estimate_linear = (pos_estimate_valid_src_ && *pos_estimate_valid_src_)
             ? pos_estimate_linear_src_ : nullptr;
     float* pos_estimate_circular = (pos_estimate_valid_src_ && *pos_estimate_valid_src_)
@@ -121,24 +591,58 @@ bool Controller::update(float* torque_setpoint_output) {
             ? vel_estimate_src_ : nullptr;
 
     // Calib_anticogging is only true when calibration is occurring, so we can't block anticogging_pos
-    float anticogging_pos = axis_->encoder_.pos_estimate_ / axis_->encoder_.getCoggingRatio();
-    if (config_.anticogging.calib_anticogging) {
+    float anticogging_pos = axis_->encoder_.pos_estimate_; // [turn]
+    float anticogging_vel = vel_estimate_src ? *vel_estimate_src : 0.0f; // [turn/s] of anticogging_pos
+    if (kFeatureAnticogging && config_.anticogging.calib_anticogging) {
         if (!axis_->encoder_.pos_estimate_valid_ || !axis_->encoder_.vel_estimate_valid_) {
             set_error(ERROR_INVALID_ESTIMATE);
             return false;
         }
         // non-blocking
-        anticogging_calibration(axis_->encoder_.pos_estimate_, axis_->encoder_.vel_estimate_);
+        if (sweep_.active)
+            anticogging_sweep(dt);
+        else
+            anticogging_calibration(axis_->encoder_.pos_estimate_, axis_->encoder_.vel_estimate_);
+    }
+
+    // Backlash measurement between the load encoder and the velocity encoder
+    // of a dual loop, non-blocking
+    if (backlash_calib_.active()) {
+        if (!vel_encoder_ || !pos_estimate_linear || !vel_encoder_->pos_estimate_valid_) {
+            backlash_calib_.abort();
+            config_.input_mode = backlash_calib_saved_input_mode_;
+            set_error(ERROR_INVALID_ESTIMATE);
+            return false;
+        }
+        float load_pos = (float)*pos_estimate_turns_src_ + *pos_estimate_linear;
+        float motor_pos = config_.dual_loop.ratio
+                        * ((float)vel_encoder_->pos_estimate_turns_ + vel_encoder_->pos_estimate_in_turn_);
+        if (backlash_calib_.update(config_.backlash_comp, motor_pos, load_pos, dt, &input_pos_, &input_vel_)) {
+            // In turns of the motor, for the position loop on the motor encoder
+            config_.backlash_comp.backlash = backlash_calib_.backlash() / config_.dual_loop.ratio;
+            config_.input_mode = backlash_calib_saved_input_mode_;
+        }
+        input_pos_updated();
     }
 
     // TODO also enable circular deltas for 2nd order filter, etc.
     if (config_.circular_setpoints) {
         // Keep pos setpoint from drifting
-        input_pos_ = fmodf_pos(input_pos_, config_.circular_setpoint_range);
+        input_pos_ = fmodf_pos_fast(input_pos_, config_.circular_setpoint_range);
     }
 
-    // Update inputs
-    switch (config_.input_mode) {
+    // A spline stream is only continued while INPUT_MODE_SPLINE stays active
+    if (config_.input_mode != INPUT_MODE_SPLINE)
+        spline_active_ = false;
+    // The gear engages anew whenever INPUT_MODE_ELECTRONIC_GEAR is entered
+    if (config_.input_mode != INPUT_MODE_ELECTRONIC_GEAR)
+        electronic_gear_.disengage();
+    // The control loop isn't interrupted by the CAN thread, so this is consistent
+    gear_can_age_ = gear_can_new_ ? 0.0f : gear_can_age_ + dt;
+    gear_can_new_ = false;
+
+    // Update inputs, they keep their state during a hold
+    switch (hold_ ? INPUT_MODE_INACTIVE : config_.input_mode) {
         case INPUT_MODE_INACTIVE: {
             // do nothing
         } break;
@@ -148,15 +652,15 @@ bool Controller::update(float* torque_setpoint_output) {
             torque_setpoint_ = input_torque_; 
         } break;
         case INPUT_MODE_VEL_RAMP: {
-            float max_step_size = std::abs(current_meas_period * config_.vel_ramp_rate);
+            float max_step_size = std::abs(dt * config_.vel_ramp_rate);
             float full_step = input_vel_ - vel_setpoint_;
             float step = std::clamp(full_step, -max_step_size, max_step_size);
 
             vel_setpoint_ += step;
-            torque_setpoint_ = (step / current_meas_period) * config_.inertia;
+            torque_setpoint_ = (step * axis_->outer_loop_hz_) * config_.inertia;
         } break;
         case INPUT_MODE_TORQUE_RAMP: {
-            float max_step_size = std::abs(current_meas_period * config_.torque_ramp_rate);
+            float max_step_size = std::abs(dt * config_.torque_ramp_rate);
             float full_step = input_torque_ - torque_setpoint_;
             float step = std::clamp(full_step, -max_step_size, max_step_size);
 
@@ -168,8 +672,8 @@ bool Controller::update(float* torque_setpoint_output) {
             float delta_vel = input_vel_ - vel_setpoint_; // Vel error
             float accel = input_filter_kp_*delta_pos + input_filter_ki_*delta_vel; // Feedback
             torque_setpoint_ = accel * config_.inertia; // Accel
-            vel_setpoint_ += current_meas_period * accel; // delta vel
-            pos_setpoint_ += current_meas_period * vel_setpoint_; // Delta pos
+            vel_setpoint_ += dt * accel; // delta vel
+            pos_setpoint_ += dt * vel_setpoint_; // Delta pos
         } break;
         case INPUT_MODE_MIRROR: {
             if (config_.axis_to_mirror < AXIS_COUNT) {
@@ -180,33 +684,129 @@ bool Controller::update(float* torque_setpoint_output) {
                 return false;
             }
         } break;
+        case INPUT_MODE_ELECTRONIC_GEAR: {
+            float master_pos, master_vel;
+            if (config_.gear_master_source == GEAR_MASTER_SOURCE_CAN) {
+                if (gear_can_age_ > config_.gear_master_timeout) {
+                    set_error(ERROR_GEAR_MASTER_LOST);
+                    return false;
+                }
+                // Extrapolated between the messages
+                master_pos = gear_can_pos_ + gear_can_vel_ * gear_can_age_;
+                master_vel = gear_can_vel_;
+            } else if (config_.gear_master_axis < AXIS_COUNT) {
+                Axis& master = axes[config_.gear_master_axis];
+                if (config_.gear_master_source == GEAR_MASTER_SOURCE_SETPOINT) {
+                    master_pos = master.controller_.pos_setpoint_;
+                    master_vel = master.controller_.vel_setpoint_;
+                } else {
+                    master_pos = master.encoder_.pos_estimate_;
+                    master_vel = master.encoder_.vel_estimate_;
+                }
+            } else {
+                set_error(ERROR_INVALID_MIRROR_AXIS);
+                return false;
+            }
+            gear_master_pos_ = master_pos;
+            ElectronicGear::Setpoint_t sp = electronic_gear_.update(config_.electronic_gear,
+                    master_pos, master_vel, pos_setpoint_, dt);
+            pos_setpoint_ = sp.pos;
+            vel_setpoint_ = sp.vel;
+            torque_setpoint_ = 0.0f;
+        } break;
         // case INPUT_MODE_MIX_CHANNELS: {
         //     // NOT YET IMPLEMENTED
         // } break;
-        case INPUT_MODE_TRAP_TRAJ: {
-            if(input_pos_updated_){
+        case INPUT_MODE_TRAP_TRAJ:
+        case INPUT_MODE_SCURVE_TRAJ: {
+            if (staged_move_triggered_) {
+                // Coordinated move, planned from where the axis is at the trigger.
+                // The axis is expected to be at rest.
+                staged_move_triggered_ = false;
+                move_staged_ = false;
+                if (axis_->trap_traj_.planTimed(staged_move_.goal, pos_setpoint_, staged_move_.duration,
+                                                staged_move_.accel_time, staged_move_.decel_time)) {
+                    input_pos_ = staged_move_.goal;
+                    axis_->trap_traj_.start(dt);
+                    trajectory_done_ = false;
+                    move_from_queue_ = false;
+                }
+            } else if(input_pos_updated_){
                 move_to_pos(input_pos_);
                 input_pos_updated_ = false;
+            } else if (const MoveSegment_t* segment = move_queue_.peek()) {
+                // The next queued move starts when the current one is done, or
+                // already when it starts to decelerate if the next goal lies
+                // further in the direction of motion. The trajectory is then
+                // replanned from the current state, so it passes the
+                // intermediate goal without stopping.
+                TrapezoidalTrajectory& traj = axis_->trap_traj_;
+                bool blend = !trajectory_done_ && traj.decelerating()
+                          && (traj.Xf_ - pos_setpoint_) * vel_setpoint_ >= 0.0f
+                          && (segment->pos - traj.Xf_) * vel_setpoint_ > 0.0f;
+                if (trajectory_done_ || blend) {
+                    input_pos_ = segment->pos;
+                    plan_move(segment->pos,
+                              segment->vel_limit > 0.0f ? segment->vel_limit : traj.config_.vel_limit,
+                              segment->accel_limit > 0.0f ? segment->accel_limit : traj.config_.accel_limit,
+                              segment->decel_limit > 0.0f ? segment->decel_limit : traj.config_.decel_limit);
+                    move_queue_.pop();
+                    move_from_queue_ = true;
+                }
             }
+            move_queue_depth_ = move_queue_.depth();
             // Avoid updating uninitialized trajectory
             if (trajectory_done_)
                 break;
             
-            if (axis_->trap_traj_.t_ > axis_->trap_traj_.Tf_) {
+            if (axis_->trap_traj_.done()) {
                 // Drop into position control mode when done to avoid problems on loop counter delta overflow
                 config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
                 pos_setpoint_ = input_pos_;
                 vel_setpoint_ = 0.0f;
                 torque_setpoint_ = 0.0f;
                 trajectory_done_ = true;
+                // A queued move came to a stop because the next one was late
+                // (this includes the last move of a sequence)
+                if (move_from_queue_ && !move_queue_depth_)
+                    ++move_queue_underruns_;
+                move_from_queue_ = false;
             } else {
-                TrapezoidalTrajectory::Step_t traj_step = axis_->trap_traj_.eval(axis_->trap_traj_.t_);
+                TrapezoidalTrajectory::Step_t traj_step = axis_->trap_traj_.next();
                 pos_setpoint_ = traj_step.Y;
                 vel_setpoint_ = traj_step.Yd;
                 torque_setpoint_ = traj_step.Ydd * config_.inertia;
-                axis_->trap_traj_.t_ += current_meas_period;
             }
-            anticogging_pos = pos_setpoint_; // FF the position setpoint instead of the pos_estimate
+        } break;
+        case INPUT_MODE_SPLINE: {
+            if (spline_active_)
+                spline_t_ += dt;
+            if (!spline_active_ || spline_t_ >= spline_.T_) {
+                if (const Waypoint_t* waypoint = waypoints_.peek()) {
+                    // Start the next segment where the previous one ended,
+                    // carrying over the time past its end
+                    float p0 = spline_active_ ? spline_.p1_ : pos_setpoint_;
+                    float v0 = spline_active_ ? spline_.v1_ : vel_setpoint_;
+                    spline_t_ = spline_active_ ? spline_t_ - spline_.T_ : 0.0f;
+                    spline_.plan(p0, v0, waypoint->pos, waypoint->vel, waypoint->dt);
+                    waypoints_.pop();
+                    spline_active_ = true;
+                } else if (spline_active_) {
+                    // Ran out of waypoints, stop at the last one
+                    pos_setpoint_ = spline_.p1_;
+                    vel_setpoint_ = 0.0f;
+                    torque_setpoint_ = 0.0f;
+                    spline_active_ = false;
+                    ++waypoint_underruns_;
+                }
+            }
+            waypoint_buffer_depth_ = waypoints_.depth();
+            if (spline_active_) {
+                CubicHermiteSegment::Step_t step = spline_.eval(spline_t_);
+                pos_setpoint_ = step.Y;
+                vel_setpoint_ = step.Yd;
+                torque_setpoint_ = step.Ydd * config_.inertia;
+            }
         } break;
         default: {
             set_error(ERROR_INVALID_INPUT_MODE);
@@ -214,11 +814,92 @@ bool Controller::update(float* torque_setpoint_output) {
         }
         
     }
+    if (hold_) {
+        pos_setpoint_ = hold_pos_;
+        vel_setpoint_ = 0.0f;
+        torque_setpoint_ = 0.0f;
+    }
+
+    // Input shaping, the loops below follow the shaped setpoints. The input
+    // modes keep working on the unshaped ones. Circular setpoints would be
+    // averaged across the wrap, so they are not shaped.
+    float pos_setpoint = pos_setpoint_;
+    float vel_setpoint = vel_setpoint_;
+    float torque_setpoint = torque_setpoint_;
+    if (config_.input_shaper.enable && !config_.circular_setpoints) {
+        InputShaper::Sample_t shaped = input_shaper_.update({pos_setpoint_, vel_setpoint_, torque_setpoint_});
+        pos_setpoint = shaped.pos;
+        vel_setpoint = shaped.vel;
+        torque_setpoint = shaped.torque;
+    } else {
+        input_shaper_.reset();
+    }
+
+    // Soft position limits on the shaped setpoints, the velocity toward a
+    // limit is restricted below with the velocity limit. Not applied with
+    // circular_setpoints.
+    if (config_.soft_limits.enable && !config_.circular_setpoints) {
+        if (!pos_estimate_linear) {
+            set_error(ERROR_INVALID_ESTIMATE);
+            return false;
+        }
+        float decel = config_.soft_limits.decel_limit > 0.0f
+                    ? config_.soft_limits.decel_limit : axis_->trap_traj_.config_.decel_limit;
+        float pos = (float)*pos_estimate_turns_src_ + *pos_estimate_linear;
+        if (!soft_limits_.update(config_.soft_limits, pos, decel, dt) && config_.soft_limits.error_on_violation) {
+            set_error(ERROR_SOFT_LIMIT_VIOLATION);
+            return false;
+        }
+        pos_setpoint = soft_limits_.clamp_pos(config_.soft_limits, pos_setpoint);
+    } else {
+        soft_limits_.reset();
+    }
+
+    // Backlash compensation, the offset follows the direction of the
+    // commanded motion
+    if (config_.backlash_comp.enable && config_.control_mode >= CONTROL_MODE_POSITION_CONTROL
+            && !config_.circular_setpoints && !backlash_calib_.active()) {
+        BacklashCompensator::Output_t comp = backlash_comp_.update(config_.backlash_comp, pos_setpoint, dt);
+        pos_setpoint += comp.pos;
+        vel_setpoint += comp.vel;
+    } else {
+        backlash_comp_.reset();
+    }
+
+    bool trajectory_active = (config_.input_mode == INPUT_MODE_TRAP_TRAJ || config_.input_mode == INPUT_MODE_SCURVE_TRAJ)
+                          && !trajectory_done_;
+    if (trajectory_active || config_.input_mode == INPUT_MODE_SPLINE) {
+        // FF the position setpoint instead of the pos_estimate
+        anticogging_pos = pos_setpoint;
+        anticogging_vel = vel_setpoint;
+    }
+
+    // Gains by velocity and load
+    GainSchedule::Scales_t gain_scales = {1.0f, 1.0f, 1.0f};
+    if (config_.gain_schedule.enable && vel_estimate_src)
+        gain_scales = gain_schedule_.eval(*vel_estimate_src, gain_schedule_load_index_);
+
+    // Excitation of the frequency response measurement, 0 if none is running
+    float pos_excitation = 0.0f, vel_excitation = 0.0f, torque_excitation = 0.0f;
+    if (frequency_response_.active()) {
+        // Stops if the loop behind the injection point is no longer closed
+        if (frequency_response_injection_ == FREQUENCY_RESPONSE_INJECTION_POSITION) {
+            if (config_.control_mode < CONTROL_MODE_POSITION_CONTROL)
+                frequency_response_.stop();
+            pos_excitation = frequency_response_.excitation();
+        } else if (frequency_response_injection_ == FREQUENCY_RESPONSE_INJECTION_VELOCITY) {
+            if (config_.control_mode < CONTROL_MODE_VELOCITY_CONTROL)
+                frequency_response_.stop();
+            vel_excitation = frequency_response_.excitation();
+        } else {
+            torque_excitation = frequency_response_.excitation();
+        }
+    }
 
     // Position control
     // TODO Decide if we want to use encoder or pll position here
     float gain_scheduling_multiplier = 1.0f;
-    float vel_des = vel_setpoint_;
+    float vel_des = vel_setpoint;
     if (config_.control_mode >= CONTROL_MODE_POSITION_CONTROL) {
         float pos_err;
 
@@ -228,31 +909,36 @@ bool Controller::update(float* torque_setpoint_output) {
                 return false;
             }
             // Keep pos setpoint from drifting
-            pos_setpoint_ = fmodf_pos(pos_setpoint_, *pos_wrap_src_);
+            pos_setpoint_ = fmodf_pos_fast(pos_setpoint_, *pos_wrap_src_);
+            pos_setpoint = pos_setpoint_;
             // Circular delta
-            pos_err = pos_setpoint_ - *pos_estimate_circular;
-            pos_err = wrap_pm(pos_err, *pos_wrap_src_);
+            pos_err = pos_setpoint_ - *pos_estimate_circular - dual_loop_offset_;
+            pos_err = wrap_pm_fast(pos_err, *pos_wrap_src_);
         } else {
             if(!pos_estimate_linear) {
                 set_error(ERROR_INVALID_ESTIMATE);
                 return false;
             }
-            pos_err = pos_setpoint_ - *pos_estimate_linear;
+            // Subtracting the whole turns first is exact when the setpoint is
+            // close to the estimate, so the error keeps full resolution.
+            pos_err = (pos_setpoint - (float)*pos_estimate_turns_src_) - *pos_estimate_linear - dual_loop_offset_;
         }
 
-        vel_des += config_.pos_gain * pos_err;
+        pos_err += pos_excitation;
+        vel_des += (config_.pos_gain * gain_scales.pos_gain) * pos_err;
         // V-shaped gain shedule based on position error
-        float abs_pos_err = std::abs(pos_err);
-        if (config_.enable_gain_scheduling && abs_pos_err <= config_.gain_scheduling_width) {
-            gain_scheduling_multiplier = abs_pos_err / config_.gain_scheduling_width;
+        if (config_.enable_gain_scheduling) {
+            gain_scheduling_multiplier = pos_error_gain_schedule(pos_err, config_.gain_scheduling_width);
         }
     }
+    vel_des += vel_excitation;
 
     // Velocity limiting
     float vel_lim = config_.vel_limit;
     if (config_.enable_vel_limit) {
         vel_des = std::clamp(vel_des, -vel_lim, vel_lim);
     }
+    vel_des = soft_limits_.clamp_vel(vel_des);
 
     // Check for overspeed fault (done in this module (controller) for cohesion with vel_lim)
     if (config_.enable_overspeed_error) {  // 0.0f to disable
@@ -268,27 +954,61 @@ bool Controller::update(float* torque_setpoint_output) {
 
     // TODO: Change to controller working in torque units
     // Torque per amp gain scheduling (ACIM)
-    float vel_gain = config_.vel_gain;
-    float vel_integrator_gain = config_.vel_integrator_gain;
+    float vel_gain = config_.vel_gain * gain_scales.vel_gain;
+    float vel_integrator_gain = config_.vel_integrator_gain * gain_scales.vel_integrator_gain;
     if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_ACIM) {
-        float effective_flux = axis_->motor_.current_control_.acim_rotor_flux;
-        float minflux = axis_->motor_.config_.acim_gain_min_flux;
-        if (std::abs(effective_flux) < minflux)
-            effective_flux = std::copysignf(minflux, effective_flux);
-        vel_gain /= effective_flux;
-        vel_integrator_gain /= effective_flux;
-        // TODO: also scale the integral value which is also changing units.
-        // (or again just do control in torque units)
+        float inv_effective_flux = axis_->motor_.acim_flux_observer_.inv_flux();
+        vel_gain *= inv_effective_flux;
+        vel_integrator_gain *= inv_effective_flux;
+        // The integral is in the same units as the gains, so it follows the
+        // flux like the gains do
+        if (acim_integrator_inv_flux_ != 0.0f)
+            vel_integrator_torque_ *= inv_effective_flux / acim_integrator_inv_flux_;
+        acim_integrator_inv_flux_ = inv_effective_flux;
     }
 
     // Velocity control
-    float torque = torque_setpoint_;
+    float torque = torque_setpoint;
+
+    // Torque inputs that arrive until the next update are applied by the
+    // current loop through this window. The input must reach the chain below
+    // unchanged. The threads that post them don't interrupt the control loop,
+    // so the input and its sequence number are consistent.
+    {
+        const Motor& motor = axis_->motor_;
+        bool passthrough = config_.fast_torque_input && config_.control_mode == CONTROL_MODE_TORQUE_CONTROL
+                && config_.input_mode == INPUT_MODE_PASSTHROUGH && !hold_ && torque_setpoint == motor.fast_torque_;
+        fast_torque_window_.begin(passthrough, torque_setpoint, motor.fast_torque_seq_);
+    }
 
     // Anti-cogging is enabled after calibration
     // We get the current position and apply a current feed-forward
     // ensuring that we handle negative encoder positions properly (-1 == motor->encoder.encoder_cpr - 1)
-    if (anticogging_valid_ && config_.anticogging.anticogging_enabled) {
-        torque += config_.anticogging.cogging_map[std::clamp(mod((int)anticogging_pos, 3600), 0, 3600)];
+    float anticogging_torque = 0.0f;
+    const int16_t* cogging_map = cogging_map_;
+    if (kFeatureAnticogging && anticogging_valid_ && config_.anticogging.anticogging_enabled && cogging_map) {
+        if (config_.anticogging.predict_pos && !config_.anticogging.calib_anticogging) {
+            // The torque is applied from the middle of the PWM period after
+            // the next current measurement, 1.5 current measurement periods
+            // from now, and held for the rest of the outer loop period
+            float delay = current_meas_period + 0.5f * axis_->outer_loop_period_;
+            anticogging_pos += anticogging_vel * delay;
+        }
+        int map_size = (int)cogging_map_size();
+        int index = std::clamp(mod((int)std::floor(anticogging_pos * map_size), map_size), 0, map_size - 1);
+        anticogging_torque = config_.anticogging.map_scale * cogging_map[index];
+        torque += anticogging_torque;
+    }
+
+    // External load torque, rejected by feedforward in velocity control
+    if (config_.disturbance_observer.enable && config_.inertia > 0.0f && vel_estimate_src) {
+        load_torque_estimate_ = disturbance_observer_.update(config_.disturbance_observer, config_.inertia,
+                last_torque_, *vel_estimate_src, dt);
+        if (config_.control_mode >= CONTROL_MODE_VELOCITY_CONTROL)
+            torque -= config_.disturbance_observer.feedforward_gain * load_torque_estimate_;
+    } else {
+        disturbance_observer_.reset();
+        load_torque_estimate_ = 0.0f;
     }
 
     float v_err = 0.0f;
@@ -303,7 +1023,11 @@ bool Controller::update(float* torque_setpoint_output) {
 
         // Velocity integral action before limiting
         torque += vel_integrator_torque_;
+
+        // Friction feedforward
+        torque += friction_feedforward(config_.friction_coulomb, config_.friction_viscous, config_.friction_vel_band, vel_setpoint);
     }
+    torque += torque_excitation;
 
     // Velocity limiting in current mode
     if (config_.control_mode < CONTROL_MODE_VELOCITY_CONTROL && config_.enable_current_mode_vel_limit) {
@@ -311,34 +1035,98 @@ bool Controller::update(float* torque_setpoint_output) {
             set_error(ERROR_INVALID_ESTIMATE);
             return false;
         }
-        torque = limitVel(config_.vel_limit, *vel_estimate_src, vel_gain, torque);
+        float vel_min = std::max(-config_.vel_limit, soft_limits_.vel_min());
+        float vel_max = std::min(config_.vel_limit, soft_limits_.vel_max());
+        torque = limitVel(vel_min, vel_max, *vel_estimate_src, vel_gain, torque, fast_torque_window_);
     }
 
+    // Filter chain against mechanical resonances
+    torque = torque_lpf_.filter(torque_notch2_.filter(torque_notch1_.filter(torque)));
+    if (torque_notch1_.enabled() || torque_notch2_.enabled() || torque_lpf_.enabled())
+        fast_torque_window_.invalidate();
+
     // Torque limiting
-    bool limited = false;
+    float torque_unlimited = torque;
     float Tlim = axis_->motor_.max_available_torque();
-    if (torque > Tlim) {
-        limited = true;
-        torque = Tlim;
+    float Tlim_pos = Tlim;
+    float Tlim_neg = Tlim;
+    // Separate limits along the direction of rotation (motoring) and against
+    // it (regenerating). Less regenerative torque while the brake resistor
+    // can't hold the DC bus voltage, see enable_dc_bus_voltage_regulator
+    if (vel_estimate_src) {
+        const Motor::Config_t& motor_config = axis_->motor_.config_;
+        float Tlim_motoring = std::min(Tlim, motor_config.motoring_torque_lim);
+        float Tlim_regen = std::min(Tlim, motor_config.regen_torque_lim) * dc_bus_regen_scale;
+        if (*vel_estimate_src > 0.0f) {
+            Tlim_pos = Tlim_motoring;
+            Tlim_neg = Tlim_regen;
+        } else if (*vel_estimate_src < 0.0f) {
+            Tlim_pos = Tlim_regen;
+            Tlim_neg = Tlim_motoring;
+        } else {
+            Tlim_pos = Tlim_motoring;
+            Tlim_neg = Tlim_motoring;
+        }
     }
-    if (torque < -Tlim) {
-        limited = true;
-        torque = -Tlim;
+    // DC bus current and power limits, from the change of the bus current of
+    // this motor with its torque, Ibus = mod_q * Iq + mod_d * Id
+    const Motor& motor = axis_->motor_;
+    float torque_per_amp = motor.config_.torque_constant;
+    if (motor.config_.motor_type == Motor::MOTOR_TYPE_ACIM)
+        torque_per_amp *= std::max(motor.current_control_.acim_rotor_flux, motor.config_.acim_gain_min_flux);
+    if (motor.config_.motor_type != Motor::MOTOR_TYPE_GIMBAL && torque_per_amp > 0.0f) {
+        float ibus_per_torque = (float)motor.config_.direction * motor.current_control_.mod_q / torque_per_amp;
+        float Tmin, Tmax;
+        odrv.dc_bus_limiter_.torque_range(last_torque_, ibus_per_torque, &Tmin, &Tmax);
+        Tlim_pos = std::min(Tlim_pos, Tmax);
+        Tlim_neg = std::min(Tlim_neg, -Tmin);
     }
+    fast_torque_window_.narrow(torque, -Tlim_neg, Tlim_pos);
+    bool limited = limit_torque(&torque, Tlim_neg, Tlim_pos);
 
     // Velocity integrator (behaviour dependent on limiting)
     if (config_.control_mode < CONTROL_MODE_VELOCITY_CONTROL) {
         // reset integral if not in use
         vel_integrator_torque_ = 0.0f;
     } else {
-        if (limited) {
-            // TODO make decayfactor configurable
-            vel_integrator_torque_ *= 0.99f;
-        } else {
-            vel_integrator_torque_ += ((vel_integrator_gain * gain_scheduling_multiplier) * current_meas_period) * v_err;
+        float integrator_step = ((vel_integrator_gain * gain_scheduling_multiplier) * dt) * v_err;
+        switch (config_.anti_windup_mode) {
+            case ANTI_WINDUP_MODE_BACK_CALCULATION: {
+                // Pulls the integrator back by the excess of the torque over the limit
+                float tracking_gain = config_.anti_windup_tracking_gain > 0.0f
+                        ? config_.anti_windup_tracking_gain
+                        : vel_integrator_gain / std::max(vel_gain, 1e-9f);
+                vel_integrator_torque_ += integrator_step + (tracking_gain * dt) * (torque - torque_unlimited);
+            } break;
+            case ANTI_WINDUP_MODE_CONDITIONAL: {
+                // Only integrate errors that lead out of the saturation
+                if (!limited || v_err * (torque_unlimited - torque) < 0.0f)
+                    vel_integrator_torque_ += integrator_step;
+            } break;
+            default: {
+                vel_integrator_decay_update(&vel_integrator_torque_, integrator_step, limited, config_.vel_integrator_decay);
+            } break;
         }
     }
 
+    fast_torque_window_.end(torque);
+    last_torque_ = torque;
+    feedback_torque_ = torque - anticogging_torque;
+    // The anticogging feedforward cancels the cogging torque, so it doesn't
+    // accelerate the load
+    if (config_.mech_ident_enable && vel_estimate_src)
+        update_mech_identification(feedback_torque_, *vel_estimate_src);
+
+    // The response to the excitation of the previous updates
+    if (frequency_response_.active()) {
+        if (frequency_response_injection_ == FREQUENCY_RESPONSE_INJECTION_POSITION)
+            frequency_response_.update(config_.circular_setpoints ? *pos_estimate_circular : pos_estimate_linear(),
+                                       feedback_torque_);
+        else if (vel_estimate_src)
+            frequency_response_.update(*vel_estimate_src, feedback_torque_);
+        else
+            frequency_response_.stop();
+    }
     if (torque_setpoint_output) *torque_setpoint_output = torque;
     return true;
 }
@@ -1,19 +1,83 @@
 #ifndef __CONTROLLER_HPP
 #define __CONTROLLER_HPP
 
+#include "spsc_queue.hpp"
+#include "spline_traj.hpp"
+#include "biquad.hpp"
+#include "mech_identifier.hpp"
+#include "setpoint_mailbox.hpp"
+#include "dual_loop.hpp"
+#include "gain_schedule.hpp"
+#include "disturbance_observer.hpp"
+#include "input_shaper.hpp"
+#include "electronic_gear.hpp"
+#include "timed_setpoints.hpp"
+#include "soft_limits.hpp"
+#include "backlash_comp.hpp"
+#include "fast_torque_window.hpp"
+#include "loop_analysis.hpp"
+#include "frequency_response.hpp"
+
 class Controller : public ODriveIntf::ControllerIntf {
 public:
+    struct MoveSegment_t {
+        float pos;          // [turn] goal of the move
+        float vel_limit;    // [turn/s] 0 to use trap_traj.config.vel_limit
+        float accel_limit;  // [turn/s^2] 0 to use trap_traj.config.accel_limit
+        float decel_limit;  // [turn/s^2] 0 to use trap_traj.config.decel_limit
+    };
+    typedef SpscQueue<MoveSegment_t, 16> MoveQueue;
+
+    struct Waypoint_t {
+        float pos;  // [turn]
+        float vel;  // [turn/s]
+        float dt;   // [s] time from the previous waypoint
+    };
+    typedef SpscQueue<Waypoint_t, 32> WaypointBuffer;
+
+    static constexpr uint32_t max_cogging_map_size = 4096;
+
     typedef struct {
         uint32_t index = 0;
-        float cogging_map[3600];
+        uint32_t map_size = 3600;  // entries per turn, at most max_cogging_map_size
+        float map_scale = 0.0f;    // [Nm] per LSB of the cogging map, set by the calibration
         bool pre_calibrated = false;
         bool calib_anticogging = false;
         float calib_pos_threshold = 1.0f;
         float calib_vel_threshold = 1.0f;
         float cogging_ratio = 1.0f;
         bool anticogging_enabled = true;
+        float calib_sweep_vel = 0.1f; // [turn/s] used by start_anticogging_sweep()
+        bool predict_pos = false;     // look up the map where the rotor is when the torque takes effect
     } Anticogging_t;
 
+    typedef struct {
+        float excitation_torque = 0.1f; // [Nm] amplitude of the chirp
+        float freq_start = 1.0f;        // [Hz]
+        float freq_end = 50.0f;         // [Hz]
+        float duration = 5.0f;          // [s]
+        float bandwidth = 20.0f;        // [Hz] target velocity loop crossover
+        float phase_margin = 60.0f;     // [deg] target velocity loop phase margin
+        float pos_bandwidth_ratio = 4.0f; // velocity loop over position loop crossover
+    } Autotune_t;
+
+    typedef struct {
+        bool enable = false;
+        InputShaperType type = INPUT_SHAPER_TYPE_ZVD;
+        float freq = 10.0f;    // [Hz] damped frequency of the resonance
+        float damping = 0.05f; // damping ratio of the resonance
+    } InputShaper_t;
+
+    typedef struct {
+        FrequencyResponseInjection injection = FREQUENCY_RESPONSE_INJECTION_TORQUE;
+        float amplitude = 0.05f;    // [Nm], [turn/s] or [turn] by injection
+        float freq_start = 1.0f;    // [Hz]
+        float freq_end = 200.0f;    // [Hz]
+        uint32_t num_points = 32;   // logarithmically spaced
+        float settle_cycles = 2.0f; // periods before each measurement
+        uint32_t measure_cycles = 4; // periods per measurement
+    } FrequencyResponse_t;
+
     struct Config_t {
         ControlMode control_mode = CONTROL_MODE_POSITION_CONTROL;  //see: ControlMode_t
         InputMode input_mode = INPUT_MODE_PASSTHROUGH;             //see: InputMode_t
@@ -31,18 +95,60 @@ public:
         float input_filter_bandwidth = 2.0f;  // [1/s]
         float homing_speed = 0.25f;           // [turn/s]
         Anticogging_t anticogging;
+        Autotune_t autotune;
+        FrequencyResponse_t frequency_response; // see start_frequency_response()
         float gain_scheduling_width = 10.0f;
         bool enable_gain_scheduling = false;
+        GainSchedule::Config_t gain_schedule; // by velocity and load, takes effect on the next reset()
+        DisturbanceObserver::Config_t disturbance_observer; // needs inertia
+        InputShaper_t input_shaper; // takes effect on the next reset()
+        SoftLimits::Config_t soft_limits;
+        BacklashCompensator::Config_t backlash_comp; // on the position loop of the motor encoder
+        AntiWindupMode anti_windup_mode = ANTI_WINDUP_MODE_DECAY; // of the velocity integrator while the torque is limited
+        float vel_integrator_decay = 0.99f;    // per control period, ANTI_WINDUP_MODE_DECAY
+        float anti_windup_tracking_gain = 0.0f; // [1/s] ANTI_WINDUP_MODE_BACK_CALCULATION, 0 for vel_integrator_gain / vel_gain
         bool enable_vel_limit = true;
         bool enable_overspeed_error = true;
         bool enable_current_mode_vel_limit = true;  // enable velocity limit in current control mode (requires a valid velocity estimator)
+        bool fast_torque_input = false; // torque inputs bypass the control loop period, see FastTorqueWindow
         uint8_t axis_to_mirror = -1;
         float mirror_ratio = 1.0f;
+        ElectronicGear::Config_t electronic_gear; // INPUT_MODE_ELECTRONIC_GEAR
+        GearMasterSource gear_master_source = GEAR_MASTER_SOURCE_ENCODER;
+        uint8_t gear_master_axis = 0;           // GEAR_MASTER_SOURCE_ENCODER and _SETPOINT
+        uint32_t gear_master_can_node_id = 0x3f; // GEAR_MASTER_SOURCE_CAN
+        float gear_master_timeout = 0.1f;       // [s] GEAR_MASTER_SOURCE_CAN
         uint8_t load_encoder_axis = -1;  // default depends on Axis number and is set in load_configuration()
+        uint8_t vel_encoder_axis = -1;   // velocity feedback of a dual loop, -1 for load_encoder_axis
+        DualLoopEstimator::Config_t dual_loop;
+
+        // Torque command filters, applied before the torque limit
+        float torque_notch1_freq = 0.0f;  // [Hz] 0 to disable
+        float torque_notch1_q = 2.0f;
+        float torque_notch2_freq = 0.0f;  // [Hz] 0 to disable
+        float torque_notch2_q = 2.0f;
+        float torque_lpf_freq = 0.0f;     // [Hz] 0 to disable
+        // Friction feedforward from vel_setpoint in velocity and position control
+        float friction_coulomb = 0.0f;    // [Nm]
+        float friction_viscous = 0.0f;    // [Nm/(turn/s)]
+        float friction_vel_band = 0.01f;  // [turn/s] the Coulomb term ramps in over this velocity
+        // Online identification of inertia and friction in closed loop
+        bool mech_ident_enable = false;
+        bool mech_ident_apply = false;      // copy the estimates to inertia and friction_*
+        float mech_ident_bandwidth = 20.0f; // [Hz] input filter
+        uint32_t mech_ident_decimation = 8; // control periods per least squares update
+        float mech_ident_forgetting = 0.9995f;
 
         // custom setters
         Controller* parent;
         void set_input_filter_bandwidth(float value) { input_filter_bandwidth = value; parent->update_filter_gains(); }
+        void set_torque_notch1_freq(float value) { torque_notch1_freq = value; parent->update_filter_gains(); }
+        void set_torque_notch1_q(float value) { torque_notch1_q = value; parent->update_filter_gains(); }
+        void set_torque_notch2_freq(float value) { torque_notch2_freq = value; parent->update_filter_gains(); }
+        void set_torque_notch2_q(float value) { torque_notch2_q = value; parent->update_filter_gains(); }
+        void set_torque_lpf_freq(float value) { torque_lpf_freq = value; parent->update_filter_gains(); }
+        void set_control_mode(ControlMode value) { control_mode = value; parent->request_mode_transfer(); }
+        void set_input_mode(InputMode value) { input_mode = value; parent->request_mode_transfer(); }
     };
 
     Controller() {}
@@ -56,17 +162,72 @@ public:
         input_pos_updated_ = true;
     }
 
+    // Setpoints from the protocol threads, applied at the start of the next
+    // control loop iteration. See SetpointMailbox.
+    void set_input_setpoints(uint32_t fields, float pos, float vel, float torque);
+    void set_gear_can_master(float pos, float vel);
+    void apply_input_setpoints();
+    void apply_timed_setpoints();
+
     bool select_encoder(size_t encoder_num);
 
+    // Mode changes from the protocols and profiles take over the current
+    // state at the start of the next update, see transfer_mode()
+    void request_mode_transfer() { mode_transfer_pending_ = true; }
+    void transfer_mode();
+
+    // Holds the position setpoint at zero velocity, the inputs apply again
+    // after it. See BrakeHandoff.
+    void set_hold(bool hold);
+
     // Trajectory-Planned control
     void move_to_pos(float goal_point);
+    void plan_move(float goal_point, float vel_limit, float accel_limit, float decel_limit);
+    bool queue_move(float pos, float vel_limit, float accel_limit, float decel_limit) {
+        return move_queue_.push({pos, vel_limit, accel_limit, decel_limit});
+    }
+    void clear_move_queue() { move_queue_.clear(); }
+    // Coordinated moves: a move is staged on each participating axis and
+    // started on all of them by a common trigger
+    bool stage_move(float goal, float duration, float accel_time, float decel_time);
+    void trigger_staged_move() {
+        if (move_staged_ && (config_.input_mode == INPUT_MODE_TRAP_TRAJ || config_.input_mode == INPUT_MODE_SCURVE_TRAJ))
+            staged_move_triggered_ = true;
+    }
+    float get_min_move_time(float goal, float accel_time, float decel_time);
+    bool push_waypoint(float pos, float vel, float dt) {
+        return dt > 0.0f && waypoints_.push({pos, vel, dt});
+    }
+    void clear_waypoints() { waypoints_.clear(); }
+    bool push_timed_setpoint(uint32_t time, float pos, float vel, float torque) {
+        return timed_setpoints_.push({time, pos, vel, torque, true});
+    }
+    void clear_timed_setpoints() { timed_setpoints_.clear(); }
     void move_incremental(float displacement, bool from_goal_point);
     
     // TODO: make this more similar to other calibration loops
     void start_anticogging_calibration();
     bool anticogging_calibration(float pos_estimate, float vel_estimate);
+    void start_anticogging_sweep();
+    void start_backlash_calibration();
+    bool anticogging_sweep(float dt);
 
+    uint32_t cogging_map_size() const { return std::clamp<uint32_t>(config_.anticogging.map_size, 1, max_cogging_map_size); }
+    float get_anticogging_value(uint32_t index) {
+        const int16_t* map = cogging_map_;
+        return map && index < cogging_map_size() ? config_.anticogging.map_scale * map[index] : 0.0f;
+    }
+    bool edit_cogging_map();
+    bool restore_cogging_map(const int16_t* map);
+    void set_stored_cogging_map(const int16_t* map, uint32_t version);
+    void update_mech_identification(float torque, float vel_estimate);
+    void reset_mech_identification();
+    bool analyze_tuning();
+    bool start_frequency_response();
+    void stop_frequency_response() { frequency_response_.stop(); }
+    bool read_frequency_response(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
     void update_filter_gains();
+    float pos_estimate_linear() const { return (float)*pos_estimate_turns_src_ + *pos_estimate_linear_src_; }
     bool update(float* torque_setpoint);
 
     Config_t config_;
@@ -74,13 +235,40 @@ public:
 
     Error error_ = ERROR_NONE;
 
-    float* pos_estimate_linear_src_ = nullptr;
+    // The linear position estimate is split into whole turns and the position
+    // within the turn so that it doesn't lose resolution over long travel.
+    int32_t* pos_estimate_turns_src_ = nullptr;
+    float* pos_estimate_linear_src_ = nullptr; // in-turn part, in [0, 1)
     float* pos_estimate_circular_src_ = nullptr;
     bool* pos_estimate_valid_src_ = nullptr;
     float* vel_estimate_src_ = nullptr;
     bool* vel_estimate_valid_src_ = nullptr;
     float* pos_wrap_src_ = nullptr; 
 
+    // Dual loop, see config_.vel_encoder_axis
+    Encoder* vel_encoder_ = nullptr; // nullptr if the velocity comes from the load encoder
+    DualLoopEstimator dual_loop_;
+    float dual_loop_vel_estimate_ = 0.0f; // [turn/s] of the load, from vel_encoder_
+    float dual_loop_offset_ = 0.0f; // [turn] of the position feedback from the load encoder
+    GainSchedule gain_schedule_;
+    float gain_schedule_load_index_ = 0.0f; // 0 to 1, set by the application
+    DisturbanceObserver disturbance_observer_;
+    InputShaper input_shaper_;
+    SoftLimits soft_limits_;
+    BacklashCompensator backlash_comp_;
+    BacklashCalibration backlash_calib_;
+    InputMode backlash_calib_saved_input_mode_ = INPUT_MODE_PASSTHROUGH;
+    ElectronicGear electronic_gear_;
+    float gear_master_pos_ = 0.0f; // [turn]
+    // Latest encoder estimates of the CAN master, written by the CAN thread
+    float gear_can_pos_ = 0.0f;    // [turn]
+    float gear_can_vel_ = 0.0f;    // [turn/s]
+    bool gear_can_new_ = false;
+    float gear_can_age_ = INFINITY; // [s] since the last message
+    float load_torque_estimate_ = 0.0f; // [Nm]
+    float last_torque_ = 0.0f; // [Nm] torque output of the previous update
+    float acim_integrator_inv_flux_ = 0.0f; // the flux scaling of vel_integrator_torque_, 0 until the first update
+
 
     float pos_setpoint_ = 0.0f; // [turns]
     float vel_setpoint_ = 0.0f; // [turn/s]
@@ -93,12 +281,90 @@ public:
     float input_torque_ = 0.0f;  // [Nm]
     float input_filter_kp_ = 0.0f;
     float input_filter_ki_ = 0.0f;
+    Biquad torque_notch1_;
+    Biquad torque_notch2_;
+    Biquad torque_lpf_;
 
     bool input_pos_updated_ = false;
+    bool mode_transfer_pending_ = false;
+    ControlMode active_control_mode_ = CONTROL_MODE_POSITION_CONTROL; // of the last update
+    InputMode active_input_mode_ = INPUT_MODE_PASSTHROUGH;           // of the last update
+    SetpointMailbox input_setpoints_;
+    FastTorqueWindow fast_torque_window_; // of the last update, read by Motor::update
+    bool hold_ = false;
+    float hold_pos_ = 0.0f; // [turns]
     
     bool trajectory_done_ = true;
 
+    // Moves queued for INPUT_MODE_TRAP_TRAJ and INPUT_MODE_SCURVE_TRAJ
+    MoveQueue move_queue_;
+    bool move_from_queue_ = false; // the current trajectory was taken from move_queue_
+    uint32_t move_queue_depth_ = 0; // updated by the control loop
+    uint32_t move_queue_underruns_ = 0;
+
+    // Staged by stage_move(), started by trigger_staged_move()
+    struct {
+        float goal;        // [turn]
+        float duration;    // [s]
+        float accel_time;  // [s]
+        float decel_time;  // [s]
+    } staged_move_ = {};
+    bool move_staged_ = false; // written with compiler fences around staged_move_
+    volatile bool staged_move_triggered_ = false;
+
+    // Waypoints streamed for INPUT_MODE_SPLINE
+    WaypointBuffer waypoints_;
+    CubicHermiteSegment spline_;
+    float spline_t_ = 0.0f;      // [s] time within spline_
+    bool spline_active_ = false; // spline_ is being followed
+    uint32_t waypoint_buffer_depth_ = 0; // updated by the control loop
+    uint32_t waypoint_underruns_ = 0;
+
+    // Setpoints applied at their board time, in any input mode
+    TimedSetpoints timed_setpoints_;
+
+    // The cogging map, max_cogging_map_size entries [map_scale]. Once saved it
+    // is read in place from its record in the config log in NVM, see
+    // set_stored_cogging_map(). While a calibration writes it or after a
+    // configuration restore it is a copy on the FreeRTOS heap until it is
+    // saved. nullptr before the first calibration.
+    const int16_t* volatile cogging_map_ = nullptr;
+    int16_t* cogging_map_copy_ = nullptr;
+    volatile uint32_t cogging_map_version_ = 0; // incremented whenever the copy may have changed
+
     bool anticogging_valid_ = false;
+    float anticogging_friction_ = 0.0f;         // [Nm] measured by start_anticogging_sweep()
+    float anticogging_residual_ripple_ = 0.0f;  // [Nm] rms, measured by start_anticogging_sweep()
+    float feedback_torque_ = 0.0f; // [Nm] last torque output without the anticogging feedforward
+
+    MechIdentifier mech_identifier_;
+    uint32_t mech_ident_ticks_ = 0;
+    float identified_inertia_ = 0.0f;          // [Nm/(turn/s^2)]
+    float identified_viscous_friction_ = 0.0f; // [Nm/(turn/s)]
+    float identified_coulomb_friction_ = 0.0f; // [Nm]
+
+    // Result of the last analyze_tuning()
+    LoopAnalysis_t loop_analysis_;
+    TuningWarning tuning_warning_ = TUNING_WARNING_NONE;
+
+    FrequencyResponseAnalyzer frequency_response_;
+    FrequencyResponseInjection frequency_response_injection_ = FREQUENCY_RESPONSE_INJECTION_TORQUE; // of the running measurement
+
+    // State of the continuous anticogging calibration
+    enum SweepPhase_t { SWEEP_FORWARD, SWEEP_BACKWARD, SWEEP_VERIFY };
+    struct {
+        bool active = false;
+        SweepPhase_t phase = SWEEP_FORWARD;
+        InputMode saved_input_mode = INPUT_MODE_PASSTHROUGH;
+        float t = 0.0f;         // [s] time in the current phase
+        int32_t bin = -1;       // map entry being averaged, -1 before the first
+        uint32_t bins_done = 0; // map entries completed in the current phase
+        float sum = 0.0f;       // torque samples of the current bin
+        uint32_t count = 0;
+        float friction_sum = 0.0f;
+        double ripple_sum = 0.0;
+        double ripple_sum_sqr = 0.0;
+    } sweep_;
 
     // custom setters
     void set_input_pos(float value) { input_pos_ = value; input_pos_updated(); }
@@ -0,0 +1,63 @@
+#ifndef __COUNT_TIMING_ESTIMATOR_HPP
+#define __COUNT_TIMING_ESTIMATOR_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+// Position within the current encoder count from the timing of the count
+// edges, for VEL_ESTIMATOR_MODE_LOW_SPEED.
+//
+// At an edge the position is exactly on the boundary of the counts. From
+// there it is extrapolated with the velocity of the last interval between
+// two edges, but never beyond the far boundary of the count. This gives the
+// PLL a measurement that is continuous in time instead of a staircase, so
+// its velocity follows down to fractions of a count per second and doesn't
+// need to be snapped to zero at standstill.
+//
+// An edge against the direction of the last one is either a reversal or a
+// count that dithers at standstill. Either way the velocity crossed zero, so
+// the position is held at the boundary that was crossed. A dithering count
+// then gives the same position on both sides of the boundary.
+class CountTimingEstimator {
+public:
+    void reset() {
+        dir_ = 0;
+        vel_ = 0.0f;
+        progress_ = 0.5f;
+        periods_since_edge_ = 0;
+    }
+
+    // @param delta: counts since the last sample
+    // @param dt: [s] sample period
+    // @returns the position within the current count [0, 1]
+    float update(int32_t delta, float dt) {
+        if (delta != 0) {
+            int32_t dir = delta > 0 ? 1 : -1;
+            float interval = (float)(periods_since_edge_ + 1) * dt;
+            vel_ = dir == dir_ ? (float)delta / interval : 0.0f;
+            dir_ = dir;
+            periods_since_edge_ = 0;
+            // The edge happened at some point in the last period. Once there
+            // are several counts per period the position within the count is
+            // anywhere, so this saturates at the middle.
+            progress_ = std::min(0.5f * dt * std::abs(vel_), 0.5f);
+        } else {
+            ++periods_since_edge_;
+            progress_ = std::min(progress_ + dt * std::abs(vel_), 1.0f);
+        }
+        return fraction();
+    }
+
+    // @brief Position within the current count [0, 1]
+    float fraction() const { return dir_ < 0 ? 1.0f - progress_ : progress_; }
+    float vel() const { return vel_; } // [count/s] of the last interval between edges
+
+private:
+    int32_t dir_ = 0; // of the last edge, 0 before the first one
+    float vel_ = 0.0f;
+    float progress_ = 0.5f; // from the boundary that was crossed towards the other one
+    uint32_t periods_since_edge_ = 0;
+};
+
+#endif // __COUNT_TIMING_ESTIMATOR_HPP
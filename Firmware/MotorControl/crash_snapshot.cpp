@@ -0,0 +1,94 @@
+
+#include "odrive_main.h"
+
+#include <algorithm>
+#include <cstddef>
+
+CrashSnapshot::Data_t crash_snapshot_data __attribute__ ((section (".noinit")));
+
+// CRC-32 from the hardware CRC unit, a few microseconds for the whole
+// snapshot, so it can be taken from an interrupt.
+uint32_t CrashSnapshot::calc_crc(const Data_t& data) {
+    static_assert(offsetof(Data_t, crc) % 4 == 0, "the CRC unit takes words");
+    RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+    CRC->CR = CRC_CR_RESET;
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(&data);
+    for (size_t i = 0; i < offsetof(Data_t, crc) / 4; ++i)
+        CRC->DR = words[i];
+    return CRC->DR;
+}
+
+// @brief Checks the snapshot left by the last run, call once at startup
+void CrashSnapshot::init() {
+    reset_flags_ = RCC->CSR;
+    RCC->CSR |= RCC_CSR_RMVF;
+    valid_ = data_.magic == magic && data_.crc == calc_crc(data_);
+    if (!valid_)
+        memset(&data_, 0, sizeof(data_)); // power-on garbage
+}
+
+// @brief Takes the snapshot unless a valid one is held already.
+// Can be called from any thread or interrupt.
+void CrashSnapshot::capture(Cause cause, uint32_t fault_arg, uint32_t pc, uint32_t lr, uint32_t cfsr) {
+    uint32_t mask = cpu_enter_critical();
+    if (valid_) {
+        cpu_exit_critical(mask);
+        return;
+    }
+
+    memset(&data_, 0, sizeof(data_)); // also the padding, it goes into the CRC
+    data_.cause = cause;
+    data_.fault_arg = fault_arg;
+    data_.pc = pc;
+    data_.lr = lr;
+    data_.cfsr = cfsr;
+    data_.uptime = HAL_GetTick();
+    data_.event_count = odrv.event_trace_.copy(data_.buffers.events);
+    data_.num_scope_values = odrv.oscilloscope_.copy_last_values(data_.buffers.scope, num_scope_values, &data_.scope_num_channels);
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Axis& axis = axes[i];
+        data_.axes[i] = {
+            axis.error_,
+            axis.motor_.error_,
+            axis.encoder_.error_,
+            axis.controller_.error_,
+            axis.sensorless_estimator_.error_,
+            axis.current_state_,
+            axis.loop_counter_
+        };
+        const TaskTimer* timers = reinterpret_cast<const TaskTimer*>(&axis.task_times_);
+        for (size_t j = 0; j < num_task_timers; ++j)
+            data_.buffers.task_timings[i][j] = {timers[j].length, timers[j].maxLength};
+    }
+
+    data_.magic = magic;
+    data_.crc = calc_crc(data_);
+    valid_ = true;
+    cpu_exit_critical(mask);
+}
+
+// Returns as much of the bulk data as fits into the response, starting at
+// the byte offset in the request. Same format as read_oscilloscope_buffer().
+bool CrashSnapshot::read_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    if (!valid_ || offset.value() >= sizeof(data_.buffers))
+        return true; // empty response marks the end of the buffer
+    size_t n_copy = std::min(output_buffer->size(), sizeof(data_.buffers) - (size_t)offset.value());
+    memcpy(output_buffer->begin(), (const uint8_t*)&data_.buffers + offset.value(), n_copy);
+    *output_buffer = output_buffer->skip(n_copy);
+    return true;
+}
+
+void CrashSnapshot::clear() {
+    uint32_t mask = cpu_enter_critical();
+    valid_ = false;
+    memset(&data_, 0, sizeof(data_));
+    cpu_exit_critical(mask);
+}
+
+extern "C" void crash_snapshot_capture_hard_fault(uint32_t pc, uint32_t lr, uint32_t cfsr) {
+    odrv.crash_snapshot_.capture(CrashSnapshot::CAUSE_HARD_FAULT, 0, pc, lr, cfsr);
+}
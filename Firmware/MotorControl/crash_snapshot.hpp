@@ -0,0 +1,82 @@
+#ifndef __CRASH_SNAPSHOT_HPP
+#define __CRASH_SNAPSHOT_HPP
+
+#include <fibre/protocol.hpp>
+#include <autogen/interfaces.hpp>
+
+// Post-mortem snapshot of the control state, taken on the first low level
+// fault, hard fault or watchdog expiry. It is stored in RAM that the startup
+// code doesn't initialize, so it survives a reset but not a power cycle, and
+// it is protected by a CRC so a snapshot is only reported valid if it was
+// fully written. The first snapshot is kept until clear() so that the errors
+// that follow from it don't hide the original cause.
+//
+// The bulk data is read with read_buffer(), little endian:
+//     events: EventTrace::size times 12 bytes, same format as EventTrace
+//     scope: num_scope_values times float32, the last oscilloscope values,
+//            whole frames of scope_num_channels values, oldest first,
+//            only data_.num_scope_values of them are valid
+//     task_timings: AXIS_COUNT times num_task_timers times
+//            {uint32 length, uint32 max_length}, in the order of Axis::TaskTimes_t
+class CrashSnapshot : public ODriveIntf::CrashSnapshotIntf {
+public:
+    static constexpr uint32_t magic = 0x43525348; // "CRSH"
+    static constexpr size_t num_scope_values = 256;
+    static constexpr size_t num_task_timers = sizeof(Axis::TaskTimes_t) / sizeof(TaskTimer);
+    static_assert(sizeof(Axis::TaskTimes_t) == num_task_timers * sizeof(TaskTimer), "TaskTimes_t must only hold task timers");
+
+    struct AxisSnapshot_t {
+        Axis::Error error;
+        Motor::Error motor_error;
+        Encoder::Error encoder_error;
+        Controller::Error controller_error;
+        SensorlessEstimator::Error sensorless_estimator_error;
+        Axis::AxisState current_state;
+        uint32_t loop_counter;
+    };
+
+    struct TaskTiming_t {
+        uint32_t length;
+        uint32_t max_length;
+    };
+
+    struct Buffers_t {
+        EventTrace::Event_t events[EventTrace::size];
+        float scope[num_scope_values];
+        TaskTiming_t task_timings[AXIS_COUNT][num_task_timers];
+    };
+
+    struct Data_t {
+        uint32_t magic;
+        Cause cause;
+        uint32_t fault_arg;
+        uint32_t pc;
+        uint32_t lr;
+        uint32_t cfsr;
+        uint32_t uptime; // [ms]
+        uint32_t event_count;
+        uint32_t num_scope_values;
+        uint32_t scope_num_channels;
+        AxisSnapshot_t axes[AXIS_COUNT];
+        Buffers_t buffers;
+        uint32_t crc; // over all bytes before crc
+    };
+
+    void init();
+    void capture(Cause cause, uint32_t fault_arg, uint32_t pc = 0, uint32_t lr = 0, uint32_t cfsr = 0);
+    bool read_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    void clear() override;
+
+    Data_t& data_;
+    bool valid_ = false;
+    uint32_t reset_flags_ = 0; // RCC_CSR at startup, tells watchdog, brownout and software resets apart
+
+    CrashSnapshot(Data_t& data) : data_(data) {}
+
+private:
+    static uint32_t calc_crc(const Data_t& data);
+};
+
+extern CrashSnapshot::Data_t crash_snapshot_data;
+
+#endif // __CRASH_SNAPSHOT_HPP
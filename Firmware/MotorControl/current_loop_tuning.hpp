@@ -0,0 +1,115 @@
+#ifndef __CURRENT_LOOP_TUNING_HPP
+#define __CURRENT_LOOP_TUNING_HPP
+
+#include <algorithm>
+#include <cmath>
+
+// Gain design and verification of the current controller.
+//
+// The PI zero cancels the pole of the R-L plant, so the open loop is
+// wc / s * exp(-s * delay) with wc = p_gain / L. Without the delay the closed
+// loop is first order with bandwidth wc. The delay (1.5 current measurement
+// periods from the sampling to the middle of the next PWM period) adds phase
+// lag that raises the closed loop gain near wc, so the actual bandwidth is
+// higher than requested and the step response overshoots. The delay aware
+// design picks wc such that the closed loop gain is -3dB at the requested
+// bandwidth, and caps it at a phase margin of 45 degrees.
+struct CurrentPiGains_t {
+    float p_gain; // [V/A]
+    float i_gain; // [V/As]
+};
+
+// @brief Closed loop gain of wc / s * exp(-s * delay) at the frequency w.
+inline float current_loop_closed_loop_gain(float wc, float delay, float w) {
+    // |T|^2 = wc^2 / ((wc - w sin(w delay))^2 + (w cos(w delay))^2)
+    float re = wc - w * std::sin(w * delay);
+    float im = w * std::cos(w * delay);
+    return wc / std::sqrt(re * re + im * im);
+}
+
+// @param bandwidth: [rad/s] requested closed loop bandwidth
+// @param delay: [s] total loop delay, 0 for the ideal design
+inline CurrentPiGains_t current_pi_gains(float L, float R, float bandwidth, float delay) {
+    float wc = bandwidth;
+    if (delay > 0.0f) {
+        constexpr float min_phase_margin = 0.25f * 3.14159265f; // [rad]
+        float wc_max = (0.5f * 3.14159265f - min_phase_margin) / delay;
+        float lo = 0.0f, hi = std::min(bandwidth, wc_max);
+        if (current_loop_closed_loop_gain(hi, delay, bandwidth) < 0.70710678f) {
+            wc = hi; // not reachable within the phase margin
+        } else {
+            for (int i = 0; i < 24; ++i) {
+                float mid = 0.5f * (lo + hi);
+                (current_loop_closed_loop_gain(mid, delay, bandwidth) < 0.70710678f ? lo : hi) = mid;
+            }
+            wc = 0.5f * (lo + hi);
+        }
+    }
+    float p_gain = wc * L;
+    return {p_gain, p_gain * R / L};
+}
+
+// @brief Integrator step of the current controller.
+// The plain PI integrates each axis separately. In the rotating frame the
+// plant couples the axes (the pole of R + jwL sits at -R/L - jw), which at
+// high electrical speeds cross-couples the axes and lowers the damping. The
+// complex vector PI moves its zero to the same complex pole,
+//   C(s) = p_gain * (s + R/L + jw) / s,
+// so that the cancellation and with it the first order closed loop holds at
+// any speed. The extra term is jw * p_gain on the error.
+// @param phase_vel: [rad/s electrical] 0 gives the plain PI
+inline void current_pi_integrate(float* integral_d, float* integral_q, float err_d, float err_q,
+        float p_gain, float i_gain, float phase_vel, float dt) {
+    float k_cross = phase_vel * p_gain;
+    *integral_d += (i_gain * err_d - k_cross * err_q) * dt;
+    *integral_q += (i_gain * err_q + k_cross * err_d) * dt;
+}
+
+// Evaluates the response to a current step: feed the samples from the
+// moment of the step on. The rise time from 10% to 90% gives the bandwidth
+// of the equivalent first order system (tr = 2.2 / w), the overshoot is
+// relative to the step size.
+class StepResponse {
+public:
+    void reset(float initial, float final) {
+        initial_ = initial;
+        inv_step_ = 1.0f / (final - initial);
+        t_ = 0.0f;
+        y_ = 0.0f;
+        t10_ = -1.0f;
+        t90_ = -1.0f;
+        peak_ = 0.0f;
+    }
+
+    // @param value: sample at the end of dt
+    void add(float value, float dt) {
+        float y = (value - initial_) * inv_step_; // 0 before, 1 after the step
+        float t = t_ + dt;
+        if (t10_ < 0.0f && y >= 0.1f)
+            t10_ = t_ + dt * (0.1f - y_) / (y - y_);
+        if (t90_ < 0.0f && y >= 0.9f)
+            t90_ = t_ + dt * (0.9f - y_) / (y - y_);
+        peak_ = std::max(peak_, y);
+        y_ = y;
+        t_ = t;
+    }
+
+    bool complete() const { return t90_ >= 0.0f; }
+
+    // @returns [rad/s] 0 until the response reached 90%
+    float bandwidth() const { return complete() && t90_ > t10_ ? 2.2f / (t90_ - t10_) : 0.0f; }
+
+    // @returns overshoot as a fraction of the step size
+    float overshoot() const { return std::max(peak_ - 1.0f, 0.0f); }
+
+private:
+    float initial_ = 0.0f;
+    float inv_step_ = 1.0f;
+    float t_ = 0.0f;  // [s] since the step
+    float y_ = 0.0f;  // previous normalized sample
+    float t10_ = -1.0f; // [s]
+    float t90_ = -1.0f; // [s]
+    float peak_ = 0.0f;
+};
+
+#endif // __CURRENT_LOOP_TUNING_HPP
@@ -0,0 +1,234 @@
+
+#include "data_logger.hpp"
+
+#include <odrive_main.h>
+#include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+const uint32_t stack_size_data_logger_thread = 1024; // Bytes
+CCM_RAM static StackType_t data_logger_thread_stack[stack_size_data_logger_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t data_logger_thread_tcb;
+static StaticSemaphore_t data_logger_lock_cb;
+static constexpr uint32_t kFlushPeriod = 10; // [ms]
+static constexpr uint32_t kLockTimeout = 1000; // [ms] longer than a sector erase
+
+// @brief Copies a sample and a burst frame of the axis, called by the
+// control loop of the axis
+void DataLogger::sample(Axis& axis) {
+    if (!ready_)
+        return;
+    AxisLog_t& log = axes_[axis.axis_num_];
+    Motor& motor = axis.motor_;
+
+    if (log.sample_countdown <= 1) {
+        log.sample_countdown = std::max<uint32_t>(config_.interval_ms * (current_meas_hz / 1000), 1);
+        SampleRecord_t record = {
+            .timestamp = HAL_GetTick(),
+            .sample = {
+                .vbus_voltage = vbus_voltage,
+                .ibus = motor.current_control_.Ibus,
+                .Iq_setpoint = motor.current_control_.Iq_setpoint,
+                .Iq_measured = motor.current_control_.Iq_measured,
+                .pos_estimate = axis.encoder_.pos_estimate_,
+                .vel_estimate = axis.encoder_.vel_estimate_,
+                .fet_temperature = motor.fet_thermistor_.temperature_,
+                .motor_temperature = motor.motor_thermistor_.temperature_,
+                .axis_error = (uint32_t)axis.error_,
+                .motor_error = (uint32_t)motor.error_,
+                .encoder_error = (uint32_t)axis.encoder_.error_,
+                .controller_error = (uint32_t)axis.controller_.error_,
+                .current_state = (uint32_t)axis.current_state_,
+            },
+        };
+        if (!log.samples.push(record))
+            ++log.dropped_samples;
+    } else {
+        --log.sample_countdown;
+    }
+
+    if (!config_.burst_on_error || log.burst_state == BURST_FROZEN)
+        return;
+    if (++log.burst_decimation_count < config_.burst_decimation)
+        return;
+    log.burst_decimation_count = 0;
+    log.burst.frames[log.burst_count % burst_length] = {
+        .pos_estimate = axis.encoder_.pos_estimate_,
+        .vel_estimate = axis.encoder_.vel_estimate_,
+        .Iq_setpoint = motor.current_control_.Iq_setpoint,
+        .Iq_measured = motor.current_control_.Iq_measured,
+        .vbus_voltage = vbus_voltage,
+    };
+    ++log.burst_count;
+    if (log.burst_state == BURST_TRIGGERED && --log.burst_post_count == 0) {
+        std::atomic_signal_fence(std::memory_order_release); // the frames are written before the logger thread sees them
+        log.burst_state = BURST_FROZEN;
+    }
+}
+
+// @brief Starts the frames after the trigger of a burst, called by the
+// control loop of the axis when an error bit is set. Ignored while the last
+// burst wasn't written yet.
+void DataLogger::trigger_burst(size_t axis_num) {
+    if (!ready_ || !config_.burst_on_error || axis_num >= AXIS_COUNT)
+        return;
+    AxisLog_t& log = axes_[axis_num];
+    if (log.burst_state != BURST_RECORDING)
+        return;
+    log.burst_timestamp = HAL_GetTick();
+    log.burst_post_count = burst_length - burst_pretrigger;
+    log.burst_state = BURST_TRIGGERED;
+}
+
+// Returns as much of the log as fits into the response, starting at the byte
+// offset in the request. The log is the readable sectors of LogStorage,
+// oldest first, up to the end of the last record.
+bool DataLogger::read_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    if (!ready_ || osSemaphoreWait(lock_, kLockTimeout) != osOK)
+        return !ready_; // empty response marks the end of the log
+    bool success = true;
+    size_t size = storage_.readable_size();
+    if (offset.value() < size) {
+        size_t n_copy = std::min(output_buffer->size(), size - (size_t)offset.value());
+        success = storage_.read(offset.value(), output_buffer->begin(), n_copy);
+        if (success)
+            *output_buffer = output_buffer->skip(n_copy);
+    }
+    osSemaphoreRelease(lock_);
+    return success;
+}
+
+uint32_t DataLogger::get_dropped_records() {
+    uint32_t dropped = dropped_records_;
+    for (AxisLog_t& log : axes_)
+        dropped += log.dropped_samples;
+    return dropped;
+}
+
+bool DataLogger::mount() {
+    Stm32Gpio ncs_gpio = get_gpio(config_.cs_gpio_pin);
+    if (!ncs_gpio)
+        return false;
+    ncs_gpio.config(GPIO_MODE_OUTPUT_PP, GPIO_PULLUP);
+    ncs_gpio.write(true);
+
+    if (!flash_.init(ncs_gpio))
+        return false;
+    flash_size_ = flash_.size();
+    if (!storage_.mount()) // reads the header of every sector, this takes a few seconds on a large chip
+        return false;
+
+    Boot_t boot = {
+        .fw_version_major = odrv.fw_version_major_,
+        .fw_version_minor = odrv.fw_version_minor_,
+        .fw_version_revision = odrv.fw_version_revision_,
+        .fw_version_unreleased = odrv.fw_version_unreleased_,
+        .reset_flags = odrv.crash_snapshot_.reset_flags_,
+    };
+    write(RECORD_TYPE_BOOT, EventTrace::source_board, HAL_GetTick(), &boot, sizeof(boot));
+    return true;
+}
+
+void DataLogger::write(RecordType type, uint8_t source, uint32_t timestamp, const void* payload, size_t length) {
+    if (storage_.append((uint8_t)type, source, timestamp, (const uint8_t*)payload, length))
+        ++written_records_;
+    else
+        ++dropped_records_;
+}
+
+// @brief Appends everything that was queued since the last call
+void DataLogger::flush() {
+    if (clear_requested_) {
+        storage_.clear();
+        clear_requested_ = false;
+    }
+
+    // Events, in batches. Events that were overwritten in the ring are lost.
+    uint32_t count = odrv.event_trace_.count_;
+    if (count < next_event_)
+        next_event_ = 0; // the trace was cleared
+    if (count - next_event_ > EventTrace::size) {
+        dropped_records_ += count - next_event_ - EventTrace::size;
+        next_event_ = count - EventTrace::size;
+    }
+    while (next_event_ < count) {
+        size_t n = 0;
+        while (n < std::size(events_) && next_event_ < count && odrv.event_trace_.get(next_event_, &events_[n])) {
+            ++next_event_;
+            ++n;
+        }
+        if (!n) {
+            ++next_event_; // overwritten meanwhile
+            ++dropped_records_;
+            continue;
+        }
+        write(RECORD_TYPE_EVENTS, EventTrace::source_board, HAL_GetTick(), events_, n * sizeof(events_[0]));
+    }
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        AxisLog_t& log = axes_[i];
+        while (const SampleRecord_t* record = log.samples.peek()) {
+            write(RECORD_TYPE_SAMPLE, (uint8_t)i, record->timestamp, &record->sample, sizeof(record->sample));
+            log.samples.pop();
+        }
+
+        if (log.burst_state == BURST_FROZEN) {
+            std::atomic_signal_fence(std::memory_order_acquire);
+            Burst_t& burst = log.burst;
+            size_t num_frames = std::min<size_t>(log.burst_count, burst_length);
+            if (log.burst_count > burst_length)
+                std::rotate(std::begin(burst.frames), burst.frames + log.burst_count % burst_length, std::end(burst.frames));
+            burst.num_frames = (uint16_t)num_frames;
+            burst.trigger_frame = (uint16_t)(num_frames - (burst_length - burst_pretrigger));
+            burst.dt = current_meas_period * (float)std::max<uint32_t>(config_.burst_decimation, 1);
+            write(RECORD_TYPE_BURST, (uint8_t)i, log.burst_timestamp, &burst,
+                  offsetof(Burst_t, frames) + num_frames * sizeof(burst.frames[0]));
+
+            log.burst_count = 0;
+            log.burst_decimation_count = 0;
+            std::atomic_signal_fence(std::memory_order_release); // done with the frames before the control loop overwrites them
+            log.burst_state = BURST_RECORDING;
+        }
+    }
+
+    used_bytes_ = storage_.readable_size();
+}
+
+void DataLogger::run_logger() {
+    osSemaphoreWait(lock_, osWaitForever);
+    bool mounted = mount();
+    used_bytes_ = storage_.readable_size();
+    osSemaphoreRelease(lock_);
+    if (!mounted) {
+        thread_id_ = nullptr;
+        vTaskDelete(nullptr); // no flash, nothing left to do
+        return;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    ready_ = true;
+
+    for (;;) {
+        osDelay(kFlushPeriod);
+        if (osSemaphoreWait(lock_, osWaitForever) != osOK)
+            continue;
+        flush();
+        osSemaphoreRelease(lock_);
+    }
+}
+
+// @brief Starts the logger thread if the logger is enabled
+void DataLogger::start_thread() {
+    if (!config_.enabled)
+        return;
+    osSemaphoreStaticDef(data_logger_lock, &data_logger_lock_cb);
+    lock_ = osSemaphoreCreate(osSemaphore(data_logger_lock), 1);
+    osSemaphoreRelease(lock_); // make sure the lock is free
+    osThreadStaticDef(data_logger_thread_def, thread_entry, osPriorityLow, 0, stack_size_data_logger_thread / sizeof(StackType_t), data_logger_thread_stack, &data_logger_thread_tcb);
+    thread_id_ = osThreadCreate(osThread(data_logger_thread_def), this);
+}
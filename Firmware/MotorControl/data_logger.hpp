@@ -0,0 +1,139 @@
+#ifndef __DATA_LOGGER_HPP
+#define __DATA_LOGGER_HPP
+
+#include <Drivers/SpiFlash/spi_flash.hpp>
+#include <log_storage.hpp>
+#include <spsc_queue.hpp>
+#include <event_trace.hpp>
+
+class Axis;
+
+// Logs to an external SPI flash, so that the history of a machine in the
+// field can be read out later without a host connected while it ran. The
+// log holds (see LogStorage for the record format):
+//  - a boot record at every startup
+//  - a sample of each axis every config.interval_ms
+//  - the events of the EventTrace
+//  - a burst of burst_length control loop frames of an axis around each
+//    new error, burst_pretrigger of them before the error
+//
+// The control loop only copies the samples into a queue per axis and the
+// burst frames into a ring per axis. A low priority thread appends them to
+// the log, so the control loop never waits on the flash. Samples that don't
+// fit into the queue are dropped and counted. Once the flash is full the
+// oldest records are overwritten.
+class DataLogger : public ODriveIntf::DataLoggerIntf {
+public:
+    static constexpr size_t burst_length = 128; // [frames]
+    static constexpr size_t burst_pretrigger = 64; // [frames]
+    static constexpr uint32_t queue_size = 8; // [samples] per axis
+
+    struct Config_t {
+        bool enabled = false; // takes effect after a reboot
+        uint16_t cs_gpio_pin = 0; // takes effect after a reboot
+        uint32_t interval_ms = 1000; // [ms] between two samples of an axis
+        bool burst_on_error = true;
+        uint32_t burst_decimation = 1; // control loop iterations per burst frame
+    };
+
+    // Payload of RECORD_TYPE_BOOT
+    struct Boot_t {
+        uint8_t fw_version_major;
+        uint8_t fw_version_minor;
+        uint8_t fw_version_revision;
+        uint8_t fw_version_unreleased;
+        uint32_t reset_flags;
+    };
+
+    // Payload of RECORD_TYPE_SAMPLE
+    struct Sample_t {
+        float vbus_voltage; // [V]
+        float ibus; // [A]
+        float Iq_setpoint; // [A]
+        float Iq_measured; // [A]
+        float pos_estimate; // [turn]
+        float vel_estimate; // [turn/s]
+        float fet_temperature; // [°C]
+        float motor_temperature; // [°C]
+        uint32_t axis_error;
+        uint32_t motor_error;
+        uint32_t encoder_error;
+        uint32_t controller_error;
+        uint32_t current_state;
+    };
+
+    struct BurstFrame_t {
+        float pos_estimate; // [turn]
+        float vel_estimate; // [turn/s]
+        float Iq_setpoint; // [A]
+        float Iq_measured; // [A]
+        float vbus_voltage; // [V]
+    };
+
+    // Payload of RECORD_TYPE_BURST, truncated to num_frames
+    struct Burst_t {
+        uint16_t num_frames;
+        uint16_t trigger_frame; // index of the first frame after the error
+        float dt; // [s] between two frames
+        BurstFrame_t frames[burst_length]; // oldest first
+    };
+    static_assert(sizeof(Burst_t) <= LogStorage<SpiFlash>::max_payload, "burst must fit into a record");
+
+    DataLogger(Stm32SpiArbiter* spi_arbiter) : flash_(spi_arbiter) {}
+
+    void sample(Axis& axis);
+    void trigger_burst(size_t axis_num);
+    void start_thread();
+    bool read_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    void clear() override { clear_requested_ = true; }
+    uint32_t get_dropped_records();
+
+    Config_t config_;
+    osThreadId thread_id_ = nullptr;
+    bool ready_ = false; // the flash is mounted and records are written
+    uint32_t flash_size_ = 0; // [bytes] 0 if no flash was found
+    uint32_t used_bytes_ = 0; // [bytes] of the readout
+    uint32_t written_records_ = 0;
+
+private:
+    enum BurstState {
+        BURST_RECORDING, // the control loop writes frames
+        BURST_TRIGGERED, // the control loop writes the frames after the trigger
+        BURST_FROZEN,    // the logger thread writes the frames to the flash
+    };
+
+    struct SampleRecord_t {
+        uint32_t timestamp;
+        Sample_t sample;
+    };
+
+    struct AxisLog_t {
+        SpscQueue<SampleRecord_t, queue_size> samples; // producer: control loop, consumer: logger thread
+        uint32_t sample_countdown = 0; // [control loop iterations]
+        uint32_t dropped_samples = 0;
+
+        Burst_t burst = {};
+        uint32_t burst_count = 0; // frames written since the ring was rearmed
+        uint32_t burst_decimation_count = 0;
+        uint32_t burst_post_count = 0; // frames left to write after the trigger
+        uint32_t burst_timestamp = 0;
+        volatile BurstState burst_state = BURST_RECORDING;
+    };
+
+    static void thread_entry(void* ctx) { reinterpret_cast<DataLogger*>(ctx)->run_logger(); }
+    void run_logger();
+    bool mount();
+    void flush();
+    void write(RecordType type, uint8_t source, uint32_t timestamp, const void* payload, size_t length);
+
+    SpiFlash flash_;
+    LogStorage<SpiFlash> storage_{flash_};
+    osSemaphoreId lock_ = nullptr; // storage_ is used by the logger thread and read_buffer()
+    volatile bool clear_requested_ = false;
+    uint32_t dropped_records_ = 0; // by the logger thread
+    uint32_t next_event_ = 0; // EventTrace event that is logged next
+    EventTrace::Event_t events_[16];
+    AxisLog_t axes_[AXIS_COUNT];
+};
+
+#endif // __DATA_LOGGER_HPP
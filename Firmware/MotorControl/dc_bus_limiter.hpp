@@ -0,0 +1,83 @@
+#ifndef __DC_BUS_LIMITER_HPP
+#define __DC_BUS_LIMITER_HPP
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+// Graceful limits of the DC bus current and power, e.g. of a battery. They
+// reduce the torque of the motors as the bus current approaches a limit,
+// where dc_max_positive_current and dc_max_negative_current disarm them.
+//
+// update() runs with the summed bus current of the board and splits the
+// headroom to the limits evenly among the armed motors. The controller of
+// each motor linearizes the bus current of the motor in its torque, with the
+// q axis modulation of the last current control cycle, and restricts the
+// torque to the range that keeps it within its share. Only a part of the
+// headroom is given out per update, so the bus current settles at the limit
+// even though the linearization ignores the losses. The limits only reduce
+// the torque toward zero, they never reverse it.
+class DcBusLimiter {
+public:
+    static constexpr float gain = 0.5f;         // fraction of the headroom given out per update
+    static constexpr float active_level = 0.95f; // of a limit, reported by active()
+
+    struct Config_t {
+        float current_limit;       // [A] drawn from the supply
+        float regen_current_limit; // [A] fed back into the supply, positive
+        float power_limit;         // [W] drawn from the supply
+        float regen_power_limit;   // [W] fed back into the supply, positive
+    };
+
+    void reset() {
+        headroom_ = INFINITY;
+        regen_headroom_ = INFINITY;
+        active_ = false;
+    }
+
+    // @param ibus: [A] summed bus current of the board, positive when drawn
+    // from the supply
+    // @param vbus: [V] DC bus voltage
+    // @param num_motors: number of armed motors
+    void update(const Config_t& config, float ibus, float vbus, size_t num_motors) {
+        float limit = config.current_limit;
+        float regen_limit = config.regen_current_limit;
+        if (vbus > 0.0f) {
+            limit = std::min(limit, config.power_limit / vbus);
+            regen_limit = std::min(regen_limit, config.regen_power_limit / vbus);
+        }
+        float share = gain / (float)std::max(num_motors, (size_t)1);
+        headroom_ = share * (limit - ibus);
+        regen_headroom_ = share * (regen_limit + ibus);
+        active_ = ibus > active_level * limit || -ibus > active_level * regen_limit;
+    }
+
+    // @brief Torque range of one motor that keeps the bus current within
+    // its share of the limits
+    // @param torque: [Nm] of the motor in the last control period
+    // @param ibus_per_torque: [A/Nm] change of the bus current of the motor
+    // with its torque
+    void torque_range(float torque, float ibus_per_torque, float* torque_min, float* torque_max) const {
+        *torque_min = -INFINITY;
+        *torque_max = INFINITY;
+        if (!(std::abs(ibus_per_torque) > 0.0f))
+            return;
+        float upper = torque + headroom_ / ibus_per_torque;
+        float lower = torque - regen_headroom_ / ibus_per_torque;
+        if (ibus_per_torque < 0.0f)
+            std::swap(upper, lower);
+        *torque_max = std::max(upper, 0.0f);
+        *torque_min = std::min(lower, 0.0f);
+    }
+
+    float headroom() const { return headroom_; }             // [A] per motor, toward the current and power limit
+    float regen_headroom() const { return regen_headroom_; } // [A] per motor, toward the regen limits
+    bool active() const { return active_; }
+
+private:
+    float headroom_ = INFINITY;
+    float regen_headroom_ = INFINITY;
+    bool active_ = false;
+};
+
+#endif // __DC_BUS_LIMITER_HPP
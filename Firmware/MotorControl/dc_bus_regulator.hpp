@@ -0,0 +1,66 @@
+#ifndef __DC_BUS_REGULATOR_HPP
+#define __DC_BUS_REGULATOR_HPP
+
+#include <algorithm>
+
+// PI controller on the DC bus voltage that adds to the brake resistor duty
+// cycle. It only brakes: below the setpoint the integrator winds down to zero
+// and the feedforward from the bus current does all the work.
+//
+// When the duty cycle saturates, the resistor cannot absorb the regenerated
+// power and the bus voltage rises above the setpoint. regen_scale() then
+// ramps down linearly towards the overvoltage trip level, the controller
+// scales the regenerative torque limit with it.
+class DcBusVoltageRegulator {
+public:
+    struct Config_t {
+        float setpoint;  // [V]
+        float p_gain;    // [1/V]
+        float i_gain;    // [1/(V*s)]
+        float trip_level; // [V] overvoltage trip level
+        float max_duty;
+    };
+
+    void reset() {
+        integrator_ = 0.0f;
+        regen_scale_ = 1.0f;
+    }
+
+    // @brief Brake duty cycle that the controller adds to the feedforward,
+    // without advancing its state
+    float correction(const Config_t& config, float vbus_voltage) const {
+        return std::max(config.p_gain * (vbus_voltage - config.setpoint) + integrator_, 0.0f);
+    }
+
+    // @param feedforward_duty: brake duty cycle from the bus current
+    // @returns the total brake duty cycle, clamped to [0, max_duty]
+    float update(const Config_t& config, float vbus_voltage, float feedforward_duty, float dt) {
+        float err = vbus_voltage - config.setpoint;
+        float duty = feedforward_duty + correction(config, vbus_voltage);
+        bool saturated = duty >= config.max_duty;
+        // Anti-windup: the integrator only moves towards the range where
+        // it isn't clamped
+        if (!saturated || err < 0.0f)
+            integrator_ = std::max(integrator_ + config.i_gain * dt * err, 0.0f);
+        duty = std::clamp(duty, 0.0f, config.max_duty);
+
+        float target = 1.0f;
+        if (saturated && config.trip_level > config.setpoint)
+            target = std::clamp((config.trip_level - vbus_voltage) / (config.trip_level - config.setpoint), 0.0f, 1.0f);
+        // A light filter, so that the torque limit doesn't toggle with the
+        // saturation
+        regen_scale_ += std::min(dt / regen_scale_tau, 1.0f) * (target - regen_scale_);
+        return duty;
+    }
+
+    float integrator() const { return integrator_; }
+    float regen_scale() const { return regen_scale_; }
+
+    static constexpr float regen_scale_tau = 0.001f; // [s]
+
+private:
+    float integrator_ = 0.0f;
+    float regen_scale_ = 1.0f;
+};
+
+#endif // __DC_BUS_REGULATOR_HPP
@@ -0,0 +1,56 @@
+#ifndef __DISTURBANCE_OBSERVER_HPP
+#define __DISTURBANCE_OBSERVER_HPP
+
+#include <algorithm>
+
+// Estimation of the external load torque from the motor torque and the
+// velocity, for monitoring and as a feedforward that rejects sudden loads
+// faster than the velocity integrator can.
+//
+// With inertia J the axis accelerates by J * dv/dt = T + T_load, so the load
+// torque is the low pass of J * dv/dt - T. Differentiating the velocity
+// estimate would amplify its noise, so the observer works on
+//   z = T_load_est - bandwidth * J * v
+// which follows dz/dt = bandwidth * (-bandwidth * J * v - T - z), and only
+// needs the velocity itself. The torque is the one commanded in the previous
+// control period, including the feedforward, i.e. what the motor produced
+// while the velocity changed.
+class DisturbanceObserver {
+public:
+    struct Config_t {
+        bool enable = false;
+        float bandwidth = 50.0f;      // [Hz]
+        float feedforward_gain = 0.0f; // 0 to only estimate, 1 to cancel the full estimate
+    };
+
+    void reset() {
+        initialized_ = false;
+        load_torque_ = 0.0f;
+    }
+
+    // @param inertia: [Nm/(turn/s^2)] must be > 0
+    // @param torque: [Nm] motor torque for the period that just ended
+    // @param vel: [turn/s] velocity estimate at its end
+    // @returns [Nm] estimated load torque, positive accelerates in the positive direction
+    float update(const Config_t& config, float inertia, float torque, float vel, float dt) {
+        float w = 2.0f * 3.14159265f * config.bandwidth; // [rad/s]
+        float p = w * inertia * vel;
+        if (!initialized_) {
+            initialized_ = true;
+            z_ = load_torque_ - p;
+        }
+        float alpha = std::min(w * dt, 1.0f);
+        z_ += alpha * (-p - torque - z_);
+        load_torque_ = z_ + p;
+        return load_torque_;
+    }
+
+    float load_torque() const { return load_torque_; } // [Nm]
+
+private:
+    bool initialized_ = false;
+    float z_ = 0.0f;           // [Nm]
+    float load_torque_ = 0.0f; // [Nm]
+};
+
+#endif // __DISTURBANCE_OBSERVER_HPP
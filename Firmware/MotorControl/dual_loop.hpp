@@ -0,0 +1,82 @@
+#ifndef __DUAL_LOOP_HPP
+#define __DUAL_LOOP_HPP
+
+#include <stdint.h>
+#include <algorithm>
+
+// Position feedback for a dual loop: the position loop closes on the load
+// encoder and the velocity loop on the motor encoder. Through a belt or a
+// gearbox the load encoder is accurate but lags the motor by the backlash
+// and the compliance of the transmission, closing a stiff position loop on
+// it alone rings or limit cycles.
+//
+// Above the crossover bandwidth the position feedback follows the motor
+// encoder (scaled by the ratio and corrected for the expected backlash and
+// wind-up), below it the load encoder, so the static accuracy comes from the
+// load and the stiffness from the motor. update() returns the offset to add
+// to the load position.
+//
+// The motor prediction is the complementary high pass of the difference
+// between both encoders. It is integrated from the per-step deltas, so the
+// absolute offset between the encoders and the distance travelled don't cost
+// float resolution.
+class DualLoopEstimator {
+public:
+    struct Config_t {
+        float ratio = 1.0f;      // [turn/turn] load turns per turn of the velocity encoder
+        float bandwidth = 0.0f;  // [Hz] crossover, 0 for the load encoder only
+        float backlash = 0.0f;   // [turn] of the load, between both directions
+        float compliance = 0.0f; // [turn/Nm] wind-up of the transmission on the motor side
+    };
+
+    void reset() {
+        initialized_ = false;
+        dir_ = 0.0f;
+        offset_ = 0.0f;
+    }
+
+    // @param load_turns, load_in_turn: [turn] load position (whole turns and the part within the turn)
+    // @param motor_turns, motor_in_turn: [turn] position of the velocity encoder
+    // @param torque: [Nm] motor torque, for the compliance
+    // @param vel_setpoint: [turn/s] of the load, its sign selects the side of the backlash
+    // @returns [turn] offset of the position feedback from the load position
+    float update(const Config_t& config, int32_t load_turns, float load_in_turn,
+                 int32_t motor_turns, float motor_in_turn, float torque, float vel_setpoint, float dt) {
+        if (vel_setpoint > 0.0f)
+            dir_ = 1.0f;
+        else if (vel_setpoint < 0.0f)
+            dir_ = -1.0f;
+        // Where the load lags the scaled motor position
+        float comp = -config.ratio * config.compliance * torque - 0.5f * config.backlash * dir_;
+
+        float alpha = config.bandwidth > 0.0f ? std::min(2.0f * 3.14159265f * config.bandwidth * dt, 1.0f) : 1.0f;
+        if (!initialized_) {
+            initialized_ = true;
+            state_ = -comp; // no offset at the start
+        } else {
+            float delta_motor = (float)(motor_turns - motor_turns_) + (motor_in_turn - motor_in_turn_);
+            float delta_load = (float)(load_turns - load_turns_) + (load_in_turn - load_in_turn_);
+            state_ = (1.0f - alpha) * (state_ + config.ratio * delta_motor - delta_load) - alpha * comp;
+        }
+        load_turns_ = load_turns;
+        load_in_turn_ = load_in_turn;
+        motor_turns_ = motor_turns;
+        motor_in_turn_ = motor_in_turn;
+        offset_ = state_ + comp;
+        return offset_;
+    }
+
+    float offset() const { return offset_; } // [turn]
+
+private:
+    bool initialized_ = false;
+    int32_t load_turns_ = 0;
+    float load_in_turn_ = 0.0f;
+    int32_t motor_turns_ = 0;
+    float motor_in_turn_ = 0.0f;
+    float dir_ = 0.0f;    // last direction of the setpoint
+    float state_ = 0.0f;  // [turn] high passed motor prediction minus load, without comp
+    float offset_ = 0.0f; // [turn]
+};
+
+#endif // __DUAL_LOOP_HPP
@@ -0,0 +1,112 @@
+#ifndef __ELECTRONIC_GEAR_HPP
+#define __ELECTRONIC_GEAR_HPP
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+// Electronic gearing and camming: the slave position setpoint follows a
+// master position through a gear ratio and optionally a cam table.
+//
+// Without the cam the slave moves ratio turns per master turn. The cam table
+// holds the slave position at evenly spaced master positions over one cam
+// period, interpolated linearly, and repeats every period. cam_rise is the
+// slave travel per period, so that rotary cams (e.g. a flying knife) advance
+// continuously while 0 gives a reciprocating cam. The ratio scales the cam.
+//
+// On engagement the slave keeps its position and takes up the motion of the
+// master over engage_time, the ratio ramps from 0 to its full value. Once
+// fully engaged the offset between slave and master is fixed, so the slave
+// follows the master position without drift. A new ratio continues from the
+// current position. The velocity feedforward comes from the master velocity,
+// which is noisy for an encoder master, so it can be low pass filtered.
+class ElectronicGear {
+public:
+    static constexpr size_t cam_table_size = 32;
+
+    struct Config_t {
+        float ratio = 1.0f;             // slave turns per master turn, or per unit of the cam
+        float engage_time = 0.5f;       // [s] ramp of the ratio on engagement
+        float vel_filter_bandwidth = 0.0f; // [Hz] of the velocity feedforward, 0 to not filter
+        bool cam_enable = false;
+        float cam_period = 1.0f;        // [turn] of the master per cam cycle
+        float cam_rise = 0.0f;          // slave travel per cam cycle, before ratio
+        float cam_table[cam_table_size] = {}; // slave position at i/cam_table_size of the period, before ratio
+    };
+
+    struct Setpoint_t {
+        float pos; // [turn]
+        float vel; // [turn/s]
+    };
+
+    void disengage() { engaged_ = false; }
+    bool engaged() const { return engaged_; }
+    float engagement() const { return engagement_; } // 0 to 1, ramp of the ratio
+
+    // @param master_pos: [turn]
+    // @param master_vel: [turn/s]
+    // @param slave_pos: [turn] current slave setpoint, used on engagement
+    Setpoint_t update(const Config_t& config, float master_pos, float master_vel, float slave_pos, float dt) {
+        float slope;
+        float q = profile(config, master_pos, &slope);
+        if (!engaged_) {
+            engaged_ = true;
+            engagement_ = config.engage_time > 0.0f ? 0.0f : 1.0f;
+            pos_ = slave_pos;
+            offset_ = slave_pos - config.ratio * q;
+            ratio_ = config.ratio;
+            q_prev_ = q;
+            vel_filtered_ = master_vel;
+        }
+
+        float alpha = config.vel_filter_bandwidth > 0.0f
+                    ? std::min(2.0f * 3.14159265f * config.vel_filter_bandwidth * dt, 1.0f) : 1.0f;
+        vel_filtered_ += alpha * (master_vel - vel_filtered_);
+
+        if (engagement_ < 1.0f) {
+            // Follows the increments of the master with the ramped ratio
+            engagement_ = std::min(engagement_ + dt / config.engage_time, 1.0f);
+            pos_ += engagement_ * config.ratio * (q - q_prev_);
+            offset_ = pos_ - config.ratio * q;
+            ratio_ = config.ratio;
+        } else {
+            if (config.ratio != ratio_) {
+                // Continue from the current position with the new ratio
+                offset_ = pos_ - config.ratio * q_prev_;
+                ratio_ = config.ratio;
+            }
+            pos_ = offset_ + config.ratio * q;
+        }
+        q_prev_ = q;
+        return {pos_, engagement_ * config.ratio * slope * vel_filtered_};
+    }
+
+private:
+    // @brief Gear or cam profile before the ratio
+    // @param slope: derivative of the result by master_pos
+    static float profile(const Config_t& config, float master_pos, float* slope) {
+        if (!config.cam_enable || !(config.cam_period > 0.0f)) {
+            *slope = 1.0f;
+            return master_pos;
+        }
+        float cycles = master_pos / config.cam_period;
+        float cycle = std::floor(cycles);
+        float x = (cycles - cycle) * (float)cam_table_size;
+        size_t i = std::min((size_t)x, cam_table_size - 1);
+        float y0 = config.cam_table[i];
+        // The entry after the last one is the first of the next cycle
+        float y1 = i + 1 < cam_table_size ? config.cam_table[i + 1] : config.cam_table[0] + config.cam_rise;
+        *slope = (y1 - y0) * (float)cam_table_size / config.cam_period;
+        return cycle * config.cam_rise + y0 + (x - (float)i) * (y1 - y0);
+    }
+
+    bool engaged_ = false;
+    float engagement_ = 0.0f;
+    float pos_ = 0.0f;          // [turn]
+    float offset_ = 0.0f;       // [turn] of the slave over the profile, fixed once engaged
+    float q_prev_ = 0.0f;       // profile in the previous update
+    float ratio_ = 0.0f;        // that offset_ belongs to
+    float vel_filtered_ = 0.0f; // [turn/s] of the master
+};
+
+#endif // __ELECTRONIC_GEAR_HPP
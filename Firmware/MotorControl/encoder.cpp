@@ -1,6 +1,8 @@
 
 #include "odrive_main.h"
 #include <Drivers/STM32/stm32_system.h>
+#include "linear_fit.hpp"
+#include "control_law.hpp"
 
 
 Encoder::Encoder(TIM_HandleTypeDef* timer, Stm32Gpio index_gpio,
@@ -20,6 +22,7 @@ bool Encoder::apply_config(ODriveIntf::MotorIntf::MotorType motor_type) {
     config_.parent = this;
 
     update_pll_gains();
+    sincos_phase_sin_ = our_arm_sin_f32(config_.sincos_phase);
 
     if (config_.pre_calibrated) {
         if (config_.mode == Encoder::MODE_HALL || config_.mode == Encoder::MODE_SINCOS)
@@ -36,12 +39,14 @@ void Encoder::setup() {
     set_idx_subscribe();
 
     mode_ = config_.mode;
+    axis_->update_sampled_gpios();
 
     spi_task_.config = {
         .Mode = SPI_MODE_MASTER,
         .Direction = SPI_DIRECTION_2LINES,
         .DataSize = SPI_DATASIZE_16BIT,
-        .CLKPolarity = mode_ == MODE_SPI_ABS_AEAT ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW,
+        .CLKPolarity = (mode_ == MODE_SPI_ABS_AEAT || (mode_ == MODE_SPI_ABS_GENERIC && config_.abs_spi_clk_idle_high))
+                       ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW,
         .CLKPhase = SPI_PHASE_2EDGE,
         .NSS = SPI_NSS_SOFT,
         .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_32,
@@ -52,6 +57,9 @@ void Encoder::setup() {
     };
 
     if(mode_ & MODE_FLAG_ABS){
+        if (mode_ == MODE_SPI_ABS_GENERIC && !abs_spi_frame_valid(config_.abs_spi_frame)) {
+            set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
+        }
         abs_spi_cs_pin_init();
 
         if (axis_->controller_.config_.anticogging.pre_calibrated) {
@@ -111,14 +119,64 @@ void Encoder::set_idx_subscribe(bool override_enable) {
     }
 }
 
+static void index_latch_cb_wrapper(void* ctx) {
+    reinterpret_cast<Encoder*>(ctx)->index_latch_cb();
+}
+
+bool Encoder::arm_index_latch() {
+    disarm_index_latch();
+    index_latched_ = false;
+    index_latch_armed_ = index_gpio_.subscribe(true, false, index_latch_cb_wrapper, this);
+    return index_latch_armed_;
+}
+
+void Encoder::disarm_index_latch() {
+    if (index_latch_armed_)
+        index_gpio_.unsubscribe();
+    index_latch_armed_ = false;
+}
+
+void Encoder::index_latch_cb() {
+    if (!index_latched_) {
+        index_latched_count_ = count_now();
+        index_latched_ = true;
+    }
+}
+
+void Encoder::Config_t::set_cpr(int32_t value) {
+    cpr = value;
+    parent->axis_->update_derived_constants();
+}
+
 void Encoder::update_pll_gains() {
-    pll_kp_ = 2.0f * config_.bandwidth;  // basic conversion to discrete time
-    pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
+    float bw_max = config_.bandwidth;
+    if (config_.adaptive_bandwidth_enable) {
+        bw_max = std::max(config_.bandwidth_max, config_.bandwidth);
+        pll_bandwidth_schedule_.build(config_.bandwidth, bw_max);
+        pll_bandwidth_schedule_.reset();
+    }
 
-    // Check that we don't get problems with discrete time approximation
+    // Check that we don't get problems with discrete time approximation at
+    // the highest bandwidth that can be scheduled
+    set_pll_bandwidth(bw_max);
     if (!(current_meas_period * pll_kp_ < 1.0f)) {
         set_error(ERROR_UNSTABLE_GAIN);
     }
+    set_pll_bandwidth(config_.bandwidth);
+}
+
+void Encoder::set_pll_bandwidth(float bandwidth) {
+    pll_bandwidth_ = bandwidth;
+    if (config_.vel_estimator_mode == VEL_ESTIMATOR_MODE_TRACKING_OBSERVER) {
+        // Triple pole at -bandwidth
+        pll_kp_ = 3.0f * bandwidth;
+        pll_ki_ = 3.0f * bandwidth * bandwidth;
+        pll_ka_ = bandwidth * bandwidth * bandwidth;
+    } else {
+        pll_kp_ = 2.0f * bandwidth;  // basic conversion to discrete time
+        pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
+        pll_ka_ = 0.0f;
+    }
 }
 
 void Encoder::check_pre_calibrated() {
@@ -136,7 +194,12 @@ void Encoder::set_linear_count(int32_t count) {
 
     // Update states
     shadow_count_ = count;
-    pos_estimate_counts_ = (float)count;
+    pos_estimate_turns_ = count / config_.cpr;
+    pos_estimate_counts_ = (float)(count % config_.cpr);
+    if (pos_estimate_counts_ < 0.0f) {
+        pos_estimate_turns_ -= 1;
+        pos_estimate_counts_ += (float)config_.cpr;
+    }
     tim_cnt_sample_ = count;
 
     //Write hardware last
@@ -145,6 +208,17 @@ void Encoder::set_linear_count(int32_t count) {
     cpu_exit_critical(prim);
 }
 
+// @brief Linear count at this instant, for latching it from an interrupt.
+// In incremental mode this includes the counts since the last sample, the
+// other modes return the last sample.
+int32_t Encoder::count_now() {
+    if (mode_ == MODE_INCREMENTAL) {
+        int16_t delta = (int16_t)timer_->Instance->CNT - (int16_t)shadow_count_;
+        return shadow_count_ + (int32_t)delta;
+    }
+    return shadow_count_;
+}
+
 // Function that sets the CPR circular tracking encoder count to a desired 32-bit value.
 // Note that this will get mod'ed down to [0, cpr)
 void Encoder::set_circular_count(int32_t count, bool update_offset) {
@@ -206,6 +280,17 @@ bool Encoder::run_direction_find() {
 // direction in order to find the offset between the electrical phase 0
 // and the encoder state 0.
 // TODO: Do the scan with current, not voltage!
+// @brief Voltage that drives the calibration current through the motor
+bool Encoder::get_calib_voltage(float* voltage_magnitude) {
+    if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_HIGH_CURRENT)
+        *voltage_magnitude = axis_->motor_.config_.calibration_current * axis_->motor_.config_.phase_resistance;
+    else if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_GIMBAL)
+        *voltage_magnitude = axis_->motor_.config_.calibration_current;
+    else
+        return false;
+    return true;
+}
+
 bool Encoder::run_offset_calibration() {
     const float start_lock_duration = 1.0f;
     const int num_steps = (int)(config_.calib_scan_distance / config_.calib_scan_omega * (float)current_meas_hz);
@@ -221,13 +306,18 @@ bool Encoder::run_offset_calibration() {
     shadow_count_ = count_in_cpr_;
 
     float voltage_magnitude;
-    if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_HIGH_CURRENT)
-        voltage_magnitude = axis_->motor_.config_.calibration_current * axis_->motor_.config_.phase_resistance;
-    else if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_GIMBAL)
-        voltage_magnitude = axis_->motor_.config_.calibration_current;
-    else
+    if (!get_calib_voltage(&voltage_magnitude))
         return false;
 
+    if (mode_ == MODE_SINCOS) {
+        if (!run_sincos_calibration(voltage_magnitude))
+            return false;
+        shadow_count_ = count_in_cpr_;
+    }
+
+    if (config_.calib_fast_enable && mode_ != MODE_HALL)
+        return run_fast_offset_calibration(voltage_magnitude);
+
     // go to start position of forward scan for start_lock_duration to get ready to scan
     int i = 0;
     axis_->run_control_loop([&](){
@@ -245,6 +335,25 @@ bool Encoder::run_offset_calibration() {
     int32_t init_enc_val = shadow_count_;
     int64_t encvaluesum = 0;
 
+    // In MODE_HALL the commanded phase at each hall transition is recorded to
+    // learn the actual hall edge positions. Transitions are indexed by the
+    // hall state above the edge. Averaging over both scan directions cancels
+    // the lag of the rotor behind the commanded phase.
+    float hall_edge_c[6] = {};
+    float hall_edge_s[6] = {};
+    int32_t hall_edge_n[6] = {};
+    int32_t last_shadow_count = shadow_count_;
+    auto record_hall_edge = [&](float phase) {
+        int32_t delta = shadow_count_ - last_shadow_count;
+        if (delta == 1 || delta == -1) {
+            int32_t edge = mod(std::max(shadow_count_, last_shadow_count), 6);
+            hall_edge_c[edge] += our_arm_cos_f32(phase);
+            hall_edge_s[edge] += our_arm_sin_f32(phase);
+            ++hall_edge_n[edge];
+        }
+        last_shadow_count = shadow_count_;
+    };
+
     // scan forward
     i = 0;
     axis_->run_control_loop([&]() {
@@ -256,6 +365,8 @@ bool Encoder::run_offset_calibration() {
         axis_->motor_.log_timing(TIMING_LOG_ENC_CALIB);
 
         encvaluesum += shadow_count_;
+        if (mode_ == MODE_HALL)
+            record_hall_edge(phase);
         
         return ++i < num_steps;
     });
@@ -296,6 +407,8 @@ bool Encoder::run_offset_calibration() {
         axis_->motor_.log_timing(TIMING_LOG_ENC_CALIB);
 
         encvaluesum += shadow_count_;
+        if (mode_ == MODE_HALL)
+            record_hall_edge(phase);
         
         return ++i < num_steps;
     });
@@ -306,10 +419,279 @@ bool Encoder::run_offset_calibration() {
     int32_t residual = encvaluesum - ((int64_t)config_.offset * (int64_t)(num_steps * 2));
     config_.offset_float = (float)residual / (float)(num_steps * 2) + 0.5f;  // add 0.5 to center-align state to phase
 
+    if (mode_ == MODE_HALL)
+        learn_hall_edges(hall_edge_c, hall_edge_s, hall_edge_n);
+
+    is_ready_ = true;
+    return true;
+}
+
+// @brief Offset calibration by a line fit of the encoder count over the
+// commanded phase, for each direction of a shorter and faster scan. The slope
+// gives the direction and the CPR check, the mean of the two intercepts the
+// offset. The lag of the rotor behind the commanded phase shifts the two
+// lines in opposite directions and cancels. The RMS deviation from the lines
+// is reported as calib_scan_residual.
+bool Encoder::run_fast_offset_calibration(float voltage_magnitude) {
+    const float start_lock_duration = 0.5f;
+    const float distance = config_.calib_fast_scan_distance;
+    const int num_steps = (int)(distance / config_.calib_fast_scan_omega * (float)current_meas_hz);
+
+    int i = 0;
+    axis_->run_control_loop([&](){
+        float phase = wrap_pm_pi(-distance / 2.0f);
+        float v_alpha = voltage_magnitude * our_arm_cos_f32(phase);
+        float v_beta = voltage_magnitude * our_arm_sin_f32(phase);
+        if (!axis_->motor_.enqueue_voltage_timings(v_alpha, v_beta))
+            return false; // error set inside enqueue_voltage_timings
+        axis_->motor_.log_timing(TIMING_LOG_ENC_CALIB);
+        return ++i < start_lock_duration * current_meas_hz;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    // The counts are taken relative to the start to keep them small
+    int32_t init_enc_val = shadow_count_;
+    LinearFit fit[2]; // forward, backward
+    for (int dir = 0; dir < 2; ++dir) {
+        i = 0;
+        axis_->run_control_loop([&]() {
+            float phase = distance * ((float)i / (float)num_steps - 0.5f);
+            if (dir)
+                phase = -phase;
+            float v_alpha = voltage_magnitude * our_arm_cos_f32(wrap_pm_pi(phase));
+            float v_beta = voltage_magnitude * our_arm_sin_f32(wrap_pm_pi(phase));
+            if (!axis_->motor_.enqueue_voltage_timings(v_alpha, v_beta))
+                return false; // error set inside enqueue_voltage_timings
+            axis_->motor_.log_timing(TIMING_LOG_ENC_CALIB);
+
+            fit[dir].add(phase, (float)(shadow_count_ - init_enc_val));
+            return ++i < num_steps;
+        });
+        if (axis_->error_ != Axis::ERROR_NONE)
+            return false;
+    }
+
+    float slope[2], intercept[2];
+    if (!fit[0].solve(&slope[0], &intercept[0]) || !fit[1].solve(&slope[1], &intercept[1]))
+        return set_error(ERROR_NO_RESPONSE), false;
+
+    // Check response and direction, the same threshold as the full scan
+    float response[2] = {slope[0] * distance, slope[1] * distance};
+    if (response[0] > 8.0f && response[1] > 8.0f) {
+        axis_->motor_.config_.direction = 1;
+    } else if (response[0] < -8.0f && response[1] < -8.0f) {
+        axis_->motor_.config_.direction = -1;
+    } else {
+        set_error(ERROR_NO_RESPONSE);
+        return false;
+    }
+
+    // Check CPR
+    float elec_rad_per_enc = axis_->motor_.config_.pole_pairs * 2 * M_PI * (1.0f / (float)(config_.cpr));
+    float expected_encoder_delta = distance / elec_rad_per_enc;
+    calib_scan_response_ = 0.5f * (std::abs(response[0]) + std::abs(response[1]));
+    if (std::abs(calib_scan_response_ - expected_encoder_delta) / expected_encoder_delta > config_.calib_range) {
+        set_error(ERROR_CPR_POLEPAIRS_MISMATCH);
+        return false;
+    }
+
+    calib_scan_residual_ = std::max(fit[0].rms_residual(), fit[1].rms_residual()) * elec_rad_per_enc;
+    if (calib_scan_residual_ > config_.calib_max_residual) {
+        set_error(ERROR_CALIB_RESIDUAL_TOO_LARGE);
+        return false;
+    }
+
+    // The counts are the floor of the position, add 0.5 to center-align
+    // state to phase like the full scan
+    float offset = 0.5f * (intercept[0] + intercept[1]) + 0.5f;
+    float offset_floor = std::floor(offset);
+    config_.offset = init_enc_val + (int32_t)offset_floor;
+    config_.offset_float = offset - offset_floor;
+
     is_ready_ = true;
     return true;
 }
 
+// @brief Measures offset, amplitude and phase error of the sin/cos channels.
+// Runs the same scan as the offset calibration, forward and back, which must
+// cover at least one signal period. Offset and gain follow from the extremes
+// of each channel. The normalized signals s = sin(theta), c = cos(theta + phi)
+// then give |s + c| = sqrt(2 - 2 sin(phi)) and |s - c| = sqrt(2 + 2 sin(phi)),
+// so the phase error follows from the extremes of their sum and difference.
+bool Encoder::run_sincos_calibration(float voltage_magnitude) {
+    const int num_steps = (int)(config_.calib_scan_distance / config_.calib_scan_omega * (float)current_meas_hz);
+
+    // The samples are relative voltages in [0, 1]
+    float s_min = 1.0f, s_max = 0.0f, c_min = 1.0f, c_max = 0.0f;
+    float sum_max = 0.0f, diff_max = 0.0f;
+
+    // First pass: channel extremes, second pass: extremes of sum and difference
+    for (int pass = 0; pass < 2; ++pass) {
+        float offset_s = 0.5f * (s_max + s_min), gain_s = pass ? 2.0f / (s_max - s_min) : 0.0f;
+        float offset_c = 0.5f * (c_max + c_min), gain_c = pass ? 2.0f / (c_max - c_min) : 0.0f;
+        int i = 0;
+        axis_->run_control_loop([&](){
+            float progress = (float)i / (float)num_steps;
+            if (progress > 0.5f)
+                progress = 1.0f - progress; // scan back to the start
+            float phase = wrap_pm_pi(2.0f * config_.calib_scan_distance * progress - config_.calib_scan_distance / 2.0f);
+            float v_alpha = voltage_magnitude * our_arm_cos_f32(phase);
+            float v_beta = voltage_magnitude * our_arm_sin_f32(phase);
+            if (!axis_->motor_.enqueue_voltage_timings(v_alpha, v_beta))
+                return false; // error set inside enqueue_voltage_timings
+            axis_->motor_.log_timing(TIMING_LOG_ENC_CALIB);
+
+            if (pass == 0) {
+                s_min = std::min(s_min, sincos_sample_s_);
+                s_max = std::max(s_max, sincos_sample_s_);
+                c_min = std::min(c_min, sincos_sample_c_);
+                c_max = std::max(c_max, sincos_sample_c_);
+            } else {
+                float s = (sincos_sample_s_ - offset_s) * gain_s;
+                float c = (sincos_sample_c_ - offset_c) * gain_c;
+                sum_max = std::max(sum_max, std::abs(s + c));
+                diff_max = std::max(diff_max, std::abs(s - c));
+            }
+            return ++i < 2 * num_steps;
+        });
+        if (axis_->error_ != Axis::ERROR_NONE)
+            return false;
+
+        // A stuck or unconnected channel doesn't give a usable amplitude
+        if (pass == 0 && !(s_max - s_min > 0.05f && c_max - c_min > 0.05f)) {
+            set_error(ERROR_NO_RESPONSE);
+            return false;
+        }
+    }
+
+    config_.sincos_offset_s = 0.5f * (s_max + s_min);
+    config_.sincos_offset_c = 0.5f * (c_max + c_min);
+    config_.sincos_gain_s = 2.0f / (s_max - s_min);
+    config_.sincos_gain_c = 2.0f / (c_max - c_min);
+    float sin_phi = std::clamp(0.25f * (diff_max * diff_max - sum_max * sum_max), -0.5f, 0.5f);
+    config_.set_sincos_phase(std::asin(sin_phi));
+    return true;
+}
+
+// @brief Measures the repeatable position error over one revolution.
+// The rotor is dragged through one mechanical revolution forward and back by
+// a voltage vector at calib_scan_omega. The difference between the encoder
+// count and the commanded angle is averaged per bin of count_in_cpr_. The lag
+// behind the commanded angle cancels between both directions and the
+// remaining constant part is removed, as that is covered by the offset.
+bool Encoder::run_error_calibration() {
+    const float scan_distance = 2.0f * M_PI * (float)axis_->motor_.config_.pole_pairs; // rad electrical
+    const int num_steps = (int)(scan_distance / config_.calib_scan_omega * (float)current_meas_hz);
+    const float counts_per_rad = (float)axis_->motor_.config_.direction / axis_->derived_.elec_rad_per_enc;
+    const float bins_per_count = (float)error_map_size * axis_->derived_.inv_cpr;
+
+    float voltage_magnitude;
+    if (!get_calib_voltage(&voltage_magnitude))
+        return false;
+
+    // Measure the raw counts
+    config_.enable_error_compensation = false;
+    float* map = config_.error_map;
+    std::fill(map, map + error_map_size, 0.0f);
+    uint16_t samples[error_map_size] = {};
+
+    // lock the rotor at the start position
+    int i = 0;
+    axis_->run_control_loop([&](){
+        if (!axis_->motor_.enqueue_voltage_timings(voltage_magnitude, 0.0f))
+            return false; // error set inside enqueue_voltage_timings
+        return ++i < current_meas_hz;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    const int32_t start_count = shadow_count_;
+    for (float dir : {1.0f, -1.0f}) {
+        i = 0;
+        axis_->run_control_loop([&]() {
+            float progress = (float)i / (float)num_steps;
+            float scan_phase = scan_distance * (dir > 0.0f ? progress : 1.0f - progress);
+            float phase = wrap_pm_pi(scan_phase);
+            float v_alpha = voltage_magnitude * our_arm_cos_f32(phase);
+            float v_beta = voltage_magnitude * our_arm_sin_f32(phase);
+            if (!axis_->motor_.enqueue_voltage_timings(v_alpha, v_beta))
+                return false; // error set inside enqueue_voltage_timings
+            axis_->motor_.log_timing(TIMING_LOG_ENC_CALIB);
+
+            size_t bin = (size_t)((float)count_in_cpr_ * bins_per_count) & (error_map_size - 1);
+            map[bin] += (float)(shadow_count_ - start_count) - scan_phase * counts_per_rad;
+            samples[bin]++;
+            return ++i < num_steps;
+        });
+        if (axis_->error_ != Axis::ERROR_NONE)
+            return false;
+    }
+
+    float mean = 0.0f;
+    for (size_t bin = 0; bin < error_map_size; ++bin) {
+        if (!samples[bin]) {
+            std::fill(map, map + error_map_size, 0.0f);
+            set_error(ERROR_ERROR_MAP_INCOMPLETE);
+            return false;
+        }
+        map[bin] /= (float)samples[bin];
+        mean += map[bin];
+    }
+    mean /= (float)error_map_size;
+    for (size_t bin = 0; bin < error_map_size; ++bin)
+        map[bin] -= mean;
+
+    config_.enable_error_compensation = true;
+    return true;
+}
+
+// @brief Interpolated position error [count] at the given count.
+float Encoder::error_map_lookup(int32_t count_in_cpr) {
+    // Each bin holds the mean error across the bin, i.e. the error at its center
+    float x = (float)count_in_cpr * ((float)error_map_size * axis_->derived_.inv_cpr) - 0.5f;
+    float x_floor = std::floor(x);
+    float fract = x - x_floor;
+    size_t bin = (size_t)(int32_t)x_floor & (error_map_size - 1);
+    float e0 = config_.error_map[bin];
+    float e1 = config_.error_map[(bin + 1) & (error_map_size - 1)];
+    return e0 + fract * (e1 - e0);
+}
+
+// @brief Width [count] of the hall sector hall_cnt (0..5) according to config_.hall_edges
+float Encoder::hall_sector_width(int32_t hall_cnt) {
+    float next = hall_cnt < 5 ? config_.hall_edges[hall_cnt + 1] : config_.hall_edges[0] + 6.0f;
+    return next - config_.hall_edges[hall_cnt];
+}
+
+// @brief Updates config_.hall_edges from the phases recorded at each hall edge
+// during the offset calibration scans. The edges are kept as the deviation
+// from uniform spacing with zero mean, so the offset calibration still
+// defines the overall alignment. If any edge wasn't seen or the result isn't
+// monotonic the edges are left unchanged.
+void Encoder::learn_hall_edges(const float c[6], const float s[6], const int32_t n[6]) {
+    float elec_rad_per_enc = axis_->motor_.config_.pole_pairs * 2 * M_PI * (1.0f / (float)(config_.cpr));
+    float dir = (float)axis_->motor_.config_.direction;
+    float dev[6];
+    float dev_mean = 0.0f;
+    for (int k = 0; k < 6; ++k) {
+        if (n[k] == 0)
+            return;
+        float pos = dir * fast_atan2(s[k], c[k]) / elec_rad_per_enc;
+        dev[k] = k ? dev[0] + wrap_pm(pos - (float)k - dev[0], 6.0f) : wrap_pm(pos, 6.0f);
+        dev_mean += dev[k] * (1.0f / 6.0f);
+    }
+    float edges[6];
+    for (int k = 0; k < 6; ++k)
+        edges[k] = (float)k + dev[k] - dev_mean;
+    for (int k = 0; k < 6; ++k) {
+        float width = (k < 5 ? edges[k + 1] : edges[0] + 6.0f) - edges[k];
+        if (!(width > 0.25f && width < 1.75f))
+            return;
+    }
+    std::copy(edges, edges + 6, config_.hall_edges);
+}
+
 static bool decode_hall(uint8_t hall_state, int32_t* hall_cnt) {
     switch (hall_state) {
         case 0b001: *hall_cnt = 0; return true;
@@ -329,18 +711,19 @@ void Encoder::sample_now() {
         } break;
 
         case MODE_HALL: {
-            // do nothing: samples already captured in general GPIO capture
+            // do nothing: samples already captured in axis_->gpio_sampler_
         } break;
 
         case MODE_SINCOS: {
-            sincos_sample_s_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_sin)) - 0.5f;
-            sincos_sample_c_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_cos)) - 0.5f;
+            sincos_sample_s_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_sin));
+            sincos_sample_c_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_cos));
         } break;
 
         case MODE_SPI_ABS_AMS:
         case MODE_SPI_ABS_CUI:
         case MODE_SPI_ABS_AEAT:
         case MODE_SPI_ABS_RLS:
+        case MODE_SPI_ABS_GENERIC:
         {
             axis_->motor_.log_timing(TIMING_LOG_SAMPLE_NOW);
             // Do nothing
@@ -350,42 +733,54 @@ void Encoder::sample_now() {
            set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
         } break;
     }
-
-    for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
-        port_samples_[i] = ports_to_sample[i]->IDR;
-    }
 }
 
-bool Encoder::read_sampled_gpio(Stm32Gpio gpio) {
-    for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
-        if (ports_to_sample[i] == gpio.port_) {
-            return port_samples_[i] & gpio.pin_mask_;
-        }
+// @brief Adds the hall inputs to the GPIOs sampled at the PWM update, if they're in use
+void Encoder::add_sampled_gpios(TGpioSampler& sampler) {
+    Stm32Gpio halls[3] = {hallA_gpio_, hallB_gpio_, hallC_gpio_};
+    for (size_t i = 0; i < 3; ++i) {
+        hall_pins_[i] = (mode_ == MODE_HALL)
+                ? sampler.add(halls[i].port_, halls[i].pin_mask_)
+                : TGpioSampler::unsampled;
     }
-    return false;
 }
 
 void Encoder::decode_hall_samples() {
-    hall_state_ = (read_sampled_gpio(hallA_gpio_) ? 1 : 0)
-                | (read_sampled_gpio(hallB_gpio_) ? 2 : 0)
-                | (read_sampled_gpio(hallC_gpio_) ? 4 : 0);
+    const TGpioSampler& sampler = axis_->gpio_sampler_;
+    hall_state_ = (sampler.read(hall_pins_[0]) ? 1 : 0)
+                | (sampler.read(hall_pins_[1]) ? 2 : 0)
+                | (sampler.read(hall_pins_[2]) ? 4 : 0);
 }
 
+// The frame is only decoded by the first update() after the transfer
+// completed, so a transfer that is still in flight doesn't stall the control
+// loop. Transfers alternate between two receive buffers, so the next
+// transfer can be in flight while the previous frame is being decoded.
+// This is called once per PWM period at the start of this axis' SPI time
+// slot, also if the encoder doesn't use SPI so that other SPI traffic can use
+// the slot.
 bool Encoder::abs_spi_start_transaction(){
-    if (mode_ & MODE_FLAG_ABS){
+    if (!(mode_ & MODE_FLAG_ABS)) {
+        spi_arbiter_->transfer_in_slot(nullptr);
+    } else {
         axis_->motor_.log_timing(TIMING_LOG_SPI_START);
         
         if (Stm32SpiArbiter::acquire_task(&spi_task_)) {
             spi_task_.ncs_gpio = abs_spi_cs_gpio_;
             spi_task_.tx_buf = (uint8_t*)abs_spi_dma_tx_;
-            spi_task_.rx_buf = (uint8_t*)abs_spi_dma_rx_;
-            spi_task_.length = 1;
+            spi_task_.rx_buf = (uint8_t*)abs_spi_dma_rx_[abs_spi_rx_buf_];
+            spi_task_.length = mode_ == MODE_SPI_ABS_GENERIC
+                    ? std::min(abs_spi_frame_words(config_.abs_spi_frame), abs_spi_max_words) : 1;
             spi_task_.on_complete = [](void* ctx, bool success) { ((Encoder*)ctx)->abs_spi_cb(success); };
             spi_task_.on_complete_ctx = this;
             spi_task_.next = nullptr;
             
-            spi_arbiter_->transfer_async(&spi_task_);
+            if (!spi_arbiter_->transfer_in_slot(&spi_task_)) {
+                ++spi_slot_overruns_;
+            }
         } else {
+            // The previous transfer of this axis is still running
+            ++spi_slot_overruns_;
             return false;
         }
     }
@@ -408,41 +803,58 @@ uint8_t cui_parity(uint16_t v) {
 }
 
 void Encoder::abs_spi_cb(bool success) {
-    uint16_t pos;
-
-    if (!success) {
-        goto done;
+    if (success) {
+        axis_->motor_.log_timing(TIMING_LOG_SPI_END);
+        // Hand the frame to update() and receive the next one into the other buffer
+        abs_spi_rx_ready_ = abs_spi_rx_buf_;
+        abs_spi_rx_buf_ ^= 1;
     }
+    Stm32SpiArbiter::release_task(&spi_task_);
+}
 
-    axis_->motor_.log_timing(TIMING_LOG_SPI_END);
+// @brief Decodes the frame received in the previous period, if any.
+void Encoder::abs_spi_decode() {
+    int8_t ready = __atomic_exchange_n(&abs_spi_rx_ready_, -1, __ATOMIC_ACQUIRE);
+    if (ready < 0) {
+        return;
+    }
+    const uint16_t* rx = abs_spi_dma_rx_[ready];
+    uint32_t pos;
 
     switch (mode_) {
         case MODE_SPI_ABS_AMS: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
+            uint16_t rawVal = rx[0];
             // check if parity is correct (even) and error flag clear
             if (ams_parity(rawVal) || ((rawVal >> 14) & 1)) {
-                goto done;
+                return;
             }
             pos = rawVal & 0x3fff;
         } break;
 
         case MODE_SPI_ABS_CUI: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
+            uint16_t rawVal = rx[0];
             // check if parity is correct
             if (cui_parity(rawVal)) {
-                goto done;
+                return;
             }
             pos = rawVal & 0x3fff;
         } break;
 
         case MODE_SPI_ABS_RLS: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
+            uint16_t rawVal = rx[0];
             pos = (rawVal >> 2) & 0x3fff;
         } break;
 
+        case MODE_SPI_ABS_GENERIC: {
+            if (!abs_spi_frame_valid(config_.abs_spi_frame)
+                    || !abs_spi_decode_frame(config_.abs_spi_frame, rx, &pos)) {
+                return;
+            }
+        } break;
+
         default: {
            set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
-           goto done;
+           return;
         } break;
     }
 
@@ -451,9 +863,18 @@ void Encoder::abs_spi_cb(bool success) {
     if (config_.pre_calibrated) {
         is_ready_ = true;
     }
+}
 
-done:
-    Stm32SpiArbiter::release_task(&spi_task_);
+// @brief Continues the turn count that was saved before the last power loss.
+// Called once, with the first valid absolute reading after boot.
+void Encoder::restore_multiturn() {
+    int32_t count;
+    if (config_.retain_multiturn && multiturn_restore(multiturn_saved_, count_in_cpr_, config_.cpr, &count)) {
+        set_linear_count(count);
+        axis_->homing_.is_homed = multiturn_saved_.is_homed;
+        multiturn_restored_ = true;
+    }
+    multiturn_saved_.valid = false;
 }
 
 void Encoder::abs_spi_cs_pin_init(){
@@ -465,9 +886,13 @@ void Encoder::abs_spi_cs_pin_init(){
     abs_spi_cs_gpio_.write(true);
 }
 
-bool Encoder::update() {
+HOT_FUNCTION bool Encoder::update() {
     // update internal encoder state.
     int32_t delta_enc = 0;
+    bool abs_pos_updated = false;
+    if (mode_ & MODE_FLAG_ABS) {
+        abs_spi_decode();
+    }
     int32_t pos_abs_latched = pos_abs_; //LATCH
 
     switch (mode_) {
@@ -494,20 +919,30 @@ bool Encoder::update() {
         } break;
 
         case MODE_SINCOS: {
-            float phase = fast_atan2(sincos_sample_s_, sincos_sample_c_);
-            int fake_count = (int)(1000.0f * phase);
-            //CPR = 6283 = 2pi * 1k
-
-            delta_enc = fake_count - count_in_cpr_;
-            delta_enc = mod(delta_enc, 6283);
-            if (delta_enc > 6283/2)
-                delta_enc -= 6283;
+            // With s = sin(theta) and c = cos(theta + phi), c + s * sin(phi)
+            // is proportional to cos(theta).
+            float s = (sincos_sample_s_ - config_.sincos_offset_s) * config_.sincos_gain_s;
+            float c = (sincos_sample_c_ - config_.sincos_offset_c) * config_.sincos_gain_c;
+            c += sincos_phase_sin_ * s;
+            float phase = fast_atan2(s, c); // [-pi, pi]
+            const int32_t interpolation = config_.sincos_interpolation;
+            int32_t count_in_period = (int32_t)((phase * (0.5f / M_PI) + 0.5f) * (float)interpolation);
+            count_in_period = std::clamp(count_in_period, 0, interpolation - 1);
+
+            // The signal periods are counted by accumulating into count_in_cpr_,
+            // so encoders with many periods per revolution work as well.
+            delta_enc = count_in_period - sincos_count_in_period_;
+            delta_enc = mod(delta_enc, interpolation);
+            if (delta_enc > interpolation/2)
+                delta_enc -= interpolation;
+            sincos_count_in_period_ = count_in_period;
         } break;
         
         case MODE_SPI_ABS_RLS:
         case MODE_SPI_ABS_AMS:
         case MODE_SPI_ABS_CUI: 
-        case MODE_SPI_ABS_AEAT: {
+        case MODE_SPI_ABS_AEAT:
+        case MODE_SPI_ABS_GENERIC: {
             if (abs_spi_pos_updated_ == false) {
                 // Low pass filter the error
                 spi_error_rate_ += current_meas_period * (1.0f - spi_error_rate_);
@@ -518,9 +953,10 @@ bool Encoder::update() {
                 spi_error_rate_ += current_meas_period * (0.0f - spi_error_rate_);
             }
 
+            abs_pos_updated = abs_spi_pos_updated_;
             abs_spi_pos_updated_ = false;
             delta_enc = pos_abs_latched - count_in_cpr_; //LATCH
-            delta_enc = mod(delta_enc, config_.cpr);
+            delta_enc = mod_fast(delta_enc, config_.cpr);
             if (delta_enc > config_.cpr/2) {
                 delta_enc -= config_.cpr;
             }
@@ -532,65 +968,147 @@ bool Encoder::update() {
         } break;
     }
 
-    shadow_count_ += delta_enc;
+    // Unsigned arithmetic so that the count wraps around instead of overflowing
+    shadow_count_ = (int32_t)((uint32_t)shadow_count_ + (uint32_t)delta_enc);
     count_in_cpr_ += delta_enc;
-    count_in_cpr_ = mod(count_in_cpr_, config_.cpr);
+    count_in_cpr_ = mod_fast(count_in_cpr_, config_.cpr);
 
     if(mode_ & MODE_FLAG_ABS)
         count_in_cpr_ = pos_abs_latched;
 
+    if (multiturn_saved_.valid && abs_pos_updated)
+        restore_multiturn();
+
+    // Repeatable per-revolution error of the encoder, e.g. from eccentricity
+    float error_comp = config_.enable_error_compensation ? error_map_lookup(count_in_cpr_) : 0.0f;
+
     // Memory for pos_circular
     float pos_cpr_counts_last = pos_cpr_counts_;
 
+    if (config_.adaptive_bandwidth_enable) {
+        set_pll_bandwidth(pll_bandwidth_schedule_.update(vel_estimate_,
+                config_.adaptive_bandwidth_vel, config_.adaptive_bandwidth_accel,
+                config_.adaptive_bandwidth_hold_time, current_meas_period));
+    }
+
     //// run pll (for now pll is in units of encoder counts)
     // Predict current pos
     pos_estimate_counts_ += current_meas_period * vel_estimate_counts_;
     pos_cpr_counts_      += current_meas_period * vel_estimate_counts_;
+    const bool observer = config_.vel_estimator_mode == VEL_ESTIMATOR_MODE_TRACKING_OBSERVER;
+    const bool low_speed = config_.vel_estimator_mode == VEL_ESTIMATOR_MODE_LOW_SPEED;
+    if (observer) {
+        // Predict current vel from the estimated and the commanded acceleration.
+        // The torque setpoint of the last cycle is the one that acted since then.
+        float accel = accel_estimate_counts_;
+        const float inertia = axis_->controller_.config_.inertia;
+        if (config_.enable_torque_feedforward && inertia > 0.0f
+                && axis_->motor_.armed_state_ == Motor::ARMED_STATE_ARMED) {
+            float torque = axis_->motor_.current_control_.Iq_setpoint * axis_->motor_.config_.torque_constant;
+            accel += torque * (float)config_.cpr / inertia;
+        }
+        vel_estimate_counts_ += current_meas_period * accel;
+    }
     // discrete phase detector
-    float delta_pos_counts = (float)(shadow_count_ - (int32_t)std::floor(pos_estimate_counts_));
-    float delta_pos_cpr_counts = (float)(count_in_cpr_ - (int32_t)std::floor(pos_cpr_counts_));
-    delta_pos_cpr_counts = wrap_pm(delta_pos_cpr_counts, (float)(config_.cpr));
+    float delta_pos_counts = pll_linear_phase_error(shadow_count_, pos_estimate_turns_, pos_estimate_counts_, config_.cpr) - error_comp;
+    float delta_pos_cpr_counts = (float)(count_in_cpr_ - (int32_t)std::floor(pos_cpr_counts_)) - error_comp;
+    if (low_speed) {
+        // Compare against the position within the count from the edge timing
+        // instead of only the count
+        float fraction = count_timing_.update(delta_enc, current_meas_period);
+        delta_pos_counts += fraction - (pos_estimate_counts_ - std::floor(pos_estimate_counts_));
+        delta_pos_cpr_counts += fraction - (pos_cpr_counts_ - std::floor(pos_cpr_counts_));
+    }
+    delta_pos_cpr_counts = wrap_pm_fast(delta_pos_cpr_counts, (float)(config_.cpr));
     // pll feedback
     pos_estimate_counts_ += current_meas_period * pll_kp_ * delta_pos_counts;
+    pll_wrap_turns(&pos_estimate_turns_, &pos_estimate_counts_, config_.cpr, axis_->derived_.inv_cpr);
     pos_cpr_counts_ += current_meas_period * pll_kp_ * delta_pos_cpr_counts;
-    pos_cpr_counts_ = fmodf_pos(pos_cpr_counts_, (float)(config_.cpr));
+    pos_cpr_counts_ = fmodf_pos_fast(pos_cpr_counts_, (float)(config_.cpr));
     vel_estimate_counts_ += current_meas_period * pll_ki_ * delta_pos_cpr_counts;
     bool snap_to_zero_vel = false;
-    if (std::abs(vel_estimate_counts_) < 0.5f * current_meas_period * pll_ki_) {
+    if (observer) {
+        // The acceleration state would wind up against a snapped velocity, so
+        // the observer is left to settle on its own.
+        accel_estimate_counts_ += current_meas_period * pll_ka_ * delta_pos_cpr_counts;
+    } else if (!low_speed && std::abs(vel_estimate_counts_) < 0.5f * current_meas_period * pll_ki_) {
         vel_estimate_counts_ = 0.0f;  //align delta-sigma on zero to prevent jitter
         snap_to_zero_vel = true;
     }
 
+    // At low speed there are few counts per loop period, so the PLL velocity
+    // is mostly quantization noise. Measuring the time between count edges
+    // instead gives a clean velocity and is blended in below the threshold.
+    // The encoder timer decodes the counts in hardware and is only sampled
+    // once per period, so the edge times have a resolution of one period.
+    float vel_counts = vel_estimate_counts_;
+    // Halls are sampled the same way in the timer update interrupt, and at the
+    // much lower hall edge rate the one period resolution matters even less.
+    const bool hall = mode_ == MODE_HALL;
+    const bool edge_timing = config_.enable_edge_timing && (mode_ == MODE_INCREMENTAL || hall);
+    // Width of the current count state: the hall sectors are not all equal
+    int32_t hall_cnt = mod(count_in_cpr_, 6);
+    float count_width = hall ? hall_sector_width(hall_cnt) : 1.0f;
+    if (edge_timing) {
+        if (delta_enc != 0) {
+            int32_t edge_dir = delta_enc > 0 ? 1 : -1;
+            // the state that was just left, which is what the interval measured
+            float left_width = hall ? hall_sector_width(mod(hall_cnt - edge_dir, 6)) : 1.0f;
+            edge_vel_counts_ = (edge_dir == edge_dir_)
+                    ? (float)delta_enc * left_width * current_meas_hz / (float)(periods_since_edge_ + 1)
+                    : 0.0f; // direction reversal: the interval is meaningless
+            edge_dir_ = edge_dir;
+            periods_since_edge_ = 0;
+        } else {
+            // No edge yet: the speed is at most one count per elapsed time
+            ++periods_since_edge_;
+            float edge_vel_max = current_meas_hz / (float)(periods_since_edge_ + 1);
+            edge_vel_counts_ = std::clamp(edge_vel_counts_, -edge_vel_max, edge_vel_max);
+        }
+        float threshold = config_.edge_timing_vel_threshold * (float)config_.cpr;
+        if (threshold > 0.0f) {
+            float weight = std::clamp(1.0f - std::abs(vel_estimate_counts_) / threshold, 0.0f, 1.0f);
+            vel_counts += weight * (edge_vel_counts_ - vel_estimate_counts_);
+        }
+    }
+
     // Outputs from Encoder for Controller
-    pos_estimate_ = pos_estimate_counts_ / (float)config_.cpr;
-    vel_estimate_ = vel_estimate_counts_ / (float)config_.cpr;
-    pos_circular_ +=  wrap_pm((pos_cpr_counts_ - pos_cpr_counts_last) / (float)config_.cpr, 1.0f);
-    pos_circular_ = fmodf_pos(pos_circular_, axis_->controller_.config_.circular_setpoint_range);
+    const float inv_cpr = axis_->derived_.inv_cpr;
+    pos_estimate_in_turn_ = pos_estimate_counts_ * inv_cpr;
+    pos_estimate_ = (float)pos_estimate_turns_ + pos_estimate_in_turn_;
+    vel_estimate_ = vel_counts * inv_cpr;
+    pos_circular_ +=  wrap_pm_fast((pos_cpr_counts_ - pos_cpr_counts_last) * inv_cpr, 1.0f);
+    pos_circular_ = fmodf_pos_fast(pos_circular_, axis_->controller_.config_.circular_setpoint_range);
 
     //// run encoder count interpolation
     int32_t corrected_enc = count_in_cpr_ - config_.offset;
     // if we are stopped, make sure we don't randomly drift
     if (snap_to_zero_vel || !config_.enable_phase_interpolation) {
         interpolation_ = 0.5f;
+    } else if (low_speed) {
+        interpolation_ = count_timing_.fraction();
     // reset interpolation if encoder edge comes
-    // TODO: This isn't correct. At high velocities the first phase in this count may very well not be at the edge.
+    // With edge timing the edge is assumed in the middle of the last period,
+    // otherwise right at the sample (which isn't correct at high velocities).
     } else if (delta_enc > 0) {
-        interpolation_ = 0.0f;
+        interpolation_ = edge_timing ? std::min(0.5f * current_meas_period * std::abs(vel_counts) / count_width, 1.0f) : 0.0f;
     } else if (delta_enc < 0) {
-        interpolation_ = 1.0f;
+        interpolation_ = edge_timing ? std::max(1.0f - 0.5f * current_meas_period * std::abs(vel_counts) / count_width, 0.0f) : 1.0f;
     } else {
         // Interpolate (predict) between encoder counts using vel_estimate,
-        interpolation_ += current_meas_period * vel_estimate_counts_;
+        interpolation_ += current_meas_period * vel_counts / count_width;
         // don't allow interpolation indicated position outside of [enc, enc+1)
         if (interpolation_ > 1.0f) interpolation_ = 1.0f;
         if (interpolation_ < 0.0f) interpolation_ = 0.0f;
     }
-    float interpolated_enc = corrected_enc + interpolation_;
+    float interpolated_enc = corrected_enc + interpolation_ - error_comp;
+    if (hall) {
+        // interpolation_ is the fraction of the hall sector, place it between the learned edges
+        interpolated_enc += config_.hall_edges[hall_cnt] - (float)hall_cnt + interpolation_ * (count_width - 1.0f);
+    }
 
     //// compute electrical phase
-    //TODO avoid recomputing elec_rad_per_enc every time
-    float elec_rad_per_enc = axis_->motor_.config_.pole_pairs * 2 * M_PI * (1.0f / (float)(config_.cpr));
-    float ph = elec_rad_per_enc * (interpolated_enc - config_.offset_float);
+    float ph = axis_->derived_.elec_rad_per_enc * (interpolated_enc - config_.offset_float);
     // ph = fmodf(ph, 2*M_PI);
     phase_ = wrap_pm_pi(ph);
 
@@ -4,12 +4,17 @@
 #include <arm_math.h>
 #include <Drivers/STM32/stm32_spi_arbiter.hpp>
 #include "utils.hpp"
+#include "abs_spi_frame.hpp"
+#include "multiturn.hpp"
+#include "pll_bandwidth_schedule.hpp"
+#include "count_timing_estimator.hpp"
 #include <autogen/interfaces.hpp>
 
 
 class Encoder : public ODriveIntf::EncoderIntf {
 public:
     static constexpr uint32_t MODE_FLAG_ABS = 0x100;
+    static constexpr size_t error_map_size = 128; // must be a power of two
 
     struct Config_t {
         Mode mode = MODE_INCREMENTAL;
@@ -27,13 +32,50 @@ public:
         float calib_range = 0.02f; // Accuracy required to pass encoder cpr check
         float calib_scan_distance = 16.0f * M_PI; // rad electrical
         float calib_scan_omega = 4.0f * M_PI; // rad/s electrical
-        float bandwidth = 1000.0f;
+        bool calib_fast_enable = false; // Fit the offset over a shorter and faster scan, see run_fast_offset_calibration()
+        float calib_fast_scan_distance = 4.0f * M_PI; // rad electrical
+        float calib_fast_scan_omega = 16.0f * M_PI; // rad/s electrical
+        float calib_max_residual = 0.5f; // [rad electrical] RMS deviation from linear tolerated by the fast calibration
+        float bandwidth = 1000.0f; // [rad/s] at standstill with adaptive_bandwidth_enable
+        bool adaptive_bandwidth_enable = false; // Schedule the PLL bandwidth by velocity and acceleration, see PllBandwidthSchedule
+        float bandwidth_max = 4000.0f; // [rad/s]
+        float adaptive_bandwidth_vel = 5.0f; // [turn/s] velocity at which bandwidth_max is reached
+        float adaptive_bandwidth_accel = 100.0f; // [turn/s^2] acceleration at which bandwidth_max is reached, 0 to ignore the acceleration
+        float adaptive_bandwidth_hold_time = 0.05f; // [s]
+        VelEstimatorMode vel_estimator_mode = VEL_ESTIMATOR_MODE_PLL;
+        bool enable_torque_feedforward = false; // Feed the commanded torque into the tracking observer
+        bool enable_edge_timing = false; // Blend in velocity from the time between count edges at low speed
+        float edge_timing_vel_threshold = 0.5f; // [turn/s]
         bool find_idx_on_lockin_only = false; // Only be sensitive during lockin scan constant vel state
         bool idx_search_unidirectional = false; // Only allow index search in known direction
         bool ignore_illegal_hall_state = false; // dont error on bad states like 000 or 111
+        // [count] electrical position at which each hall state begins. Real
+        // hall placements are not exactly 60° apart, so these are learned by
+        // the offset calibration in MODE_HALL.
+        float hall_edges[6] = {0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f};
         uint16_t abs_spi_cs_gpio_pin = 1;
+        // Frame format for MODE_SPI_ABS_GENERIC. The default is an 18 bit
+        // BiSS-C style frame with active low error and warning bits and
+        // inverted CRC-6.
+        AbsSpiFrameFormat abs_spi_frame = {
+            .frame_bits = 32, .pos_shift = 8, .pos_bits = 18,
+            .status_shift = 6, .status_mask = 0x3, .status_ok = 0x3,
+            .crc_bits = 6, .crc_poly = 0x03, .crc_data_bits = 20, .crc_inverted = true,
+        };
+        bool abs_spi_clk_idle_high = true; // MODE_SPI_ABS_GENERIC only
+        bool retain_multiturn = false; // Continue the turn count of an absolute encoder after a power loss, see MultiturnRecord_t
         uint16_t sincos_gpio_pin_sin = 3;
         uint16_t sincos_gpio_pin_cos = 4;
+        // sin/cos channels are normalized as (v - offset) * gain, v being the
+        // relative ADC voltage. Set by the offset calibration in MODE_SINCOS.
+        float sincos_offset_s = 0.5f;
+        float sincos_offset_c = 0.5f;
+        float sincos_gain_s = 1.0f;
+        float sincos_gain_c = 1.0f;
+        float sincos_phase = 0.0f; // [rad] deviation of the cos channel from quadrature
+        int32_t sincos_interpolation = 6283; // counts per signal period, cpr must be a multiple of this
+        bool enable_error_compensation = false;
+        float error_map[error_map_size] = {}; // [count] position error per bin of count_in_cpr, filled by run_error_calibration()
 
         // custom setters
         Encoder* parent = nullptr;
@@ -42,6 +84,11 @@ public:
         void set_abs_spi_cs_gpio_pin(uint16_t value) { abs_spi_cs_gpio_pin = value; parent->abs_spi_cs_pin_init(); }
         void set_pre_calibrated(bool value) { pre_calibrated = value; parent->check_pre_calibrated(); }
         void set_bandwidth(float value) { bandwidth = value; parent->update_pll_gains(); }
+        void set_adaptive_bandwidth_enable(bool value) { adaptive_bandwidth_enable = value; parent->update_pll_gains(); }
+        void set_bandwidth_max(float value) { bandwidth_max = value; parent->update_pll_gains(); }
+        void set_vel_estimator_mode(VelEstimatorMode value) { vel_estimator_mode = value; parent->accel_estimate_counts_ = 0.0f; parent->count_timing_.reset(); parent->update_pll_gains(); }
+        void set_cpr(int32_t value);
+        void set_sincos_phase(float value) { sincos_phase = value; parent->sincos_phase_sin_ = our_arm_sin_f32(value); }
     };
 
     Encoder(TIM_HandleTypeDef* timer, Stm32Gpio index_gpio,
@@ -55,18 +102,33 @@ public:
 
     void enc_index_cb();
     void set_idx_subscribe(bool override_enable = false);
+    // Latches the encoder count at the next index pulse, independently of
+    // use_index. Fails if the index interrupt line is in use.
+    bool arm_index_latch();
+    void disarm_index_latch();
+    void index_latch_cb();
+    bool index_latched() const { return index_latched_; }
     void update_pll_gains();
+    void set_pll_bandwidth(float bandwidth);
     void check_pre_calibrated();
 
     void set_linear_count(int32_t count);
+    int32_t count_now();
     void set_circular_count(int32_t count, bool update_offset);
     bool calib_enc_offset(float voltage_magnitude);
 
     bool run_index_search();
     bool run_direction_find();
     bool run_offset_calibration();
+    bool run_fast_offset_calibration(float voltage_magnitude);
+    bool run_error_calibration();
+    bool run_sincos_calibration(float voltage_magnitude);
+    float get_error_map_value(uint32_t index) { return index < error_map_size ? config_.error_map[index] : 0.0f; }
+    float get_hall_edge(uint32_t index) { return index < 6 ? config_.hall_edges[index] : 0.0f; }
+    // Linear position in counts like before the split, loses resolution far from zero
+    float get_pos_estimate_counts() const { return (float)pos_estimate_turns_ * (float)config_.cpr + pos_estimate_counts_; }
     void sample_now();
-    bool read_sampled_gpio(Stm32Gpio gpio);
+    void add_sampled_gpios(TGpioSampler& sampler);
     void decode_hall_samples();
     bool update();
 
@@ -82,21 +144,38 @@ public:
 
     Error error_ = ERROR_NONE;
     bool index_found_ = false;
+    int32_t index_latched_count_ = 0; // [counts] linear count at the latched index pulse
+    volatile bool index_latched_ = false;
+    bool index_latch_armed_ = false;
     bool is_ready_ = false;
     int32_t shadow_count_ = 0;
     int32_t count_in_cpr_ = 0;
     float interpolation_ = 0.0f;
     float phase_ = 0.0f;        // [count]
-    float pos_estimate_counts_ = 0.0f;  // [count]
+    float pos_estimate_counts_ = 0.0f;  // [count] position within the turn, in [0, cpr)
     float pos_cpr_counts_ = 0.0f;  // [count]
     float vel_estimate_counts_ = 0.0f;  // [count/s]
     float pll_kp_ = 0.0f;   // [count/s / count]
     float pll_ki_ = 0.0f;   // [(count/s^2) / count]
+    float pll_ka_ = 0.0f;   // [(count/s^3) / count] only used by the tracking observer
+    float pll_bandwidth_ = 0.0f; // [rad/s] in use, scheduled with adaptive_bandwidth_enable
+    PllBandwidthSchedule pll_bandwidth_schedule_;
+    float accel_estimate_counts_ = 0.0f;  // [count/s^2] unmodelled acceleration (tracking observer)
+    float edge_vel_counts_ = 0.0f;  // [count/s] velocity from the time between count edges
+    uint32_t periods_since_edge_ = 0;
+    int32_t edge_dir_ = 0;
+    CountTimingEstimator count_timing_; // VEL_ESTIMATOR_MODE_LOW_SPEED
     float calib_scan_response_ = 0.0f; // debug report from offset calib
+    float calib_scan_residual_ = 0.0f; // [rad electrical] from the fast offset calib
     int32_t pos_abs_ = 0;
     float spi_error_rate_ = 0.0f;
+    uint32_t spi_slot_overruns_ = 0;
+    MultiturnRecord_t multiturn_saved_; // loaded at boot, applied to the first absolute reading
+    bool multiturn_restored_ = false;
 
     float pos_estimate_ = 0.0f; // [turn]
+    int32_t pos_estimate_turns_ = 0; // [turn] whole turns of pos_estimate_
+    float pos_estimate_in_turn_ = 0.0f; // [turn] pos_estimate_ - pos_estimate_turns_, in [0, 1)
     float vel_estimate_ = 0.0f; // [turn/s]
     float pos_circular_ = 0.0f; // [turn]
 
@@ -104,29 +183,35 @@ public:
     bool vel_estimate_valid_ = false;
 
     int16_t tim_cnt_sample_ = 0; // 
-    static const constexpr GPIO_TypeDef* ports_to_sample[] = { GPIOA, GPIOB, GPIOC };
-    uint16_t port_samples_[sizeof(ports_to_sample) / sizeof(ports_to_sample[0])];
+    TGpioSampler::Pin_t hall_pins_[3] = {TGpioSampler::unsampled, TGpioSampler::unsampled, TGpioSampler::unsampled};
     // Updated by low_level pwm_adc_cb
     uint8_t hall_state_ = 0x0; // bit[0] = HallA, .., bit[2] = HallC
-    float sincos_sample_s_ = 0.0f;
-    float sincos_sample_c_ = 0.0f;
+    float sincos_sample_s_ = 0.0f; // [relative ADC voltage]
+    float sincos_sample_c_ = 0.0f; // [relative ADC voltage]
+    float sincos_phase_sin_ = 0.0f; // sin(config_.sincos_phase)
+    int32_t sincos_count_in_period_ = 0;
+
+    bool get_calib_voltage(float* voltage_magnitude);
+    float error_map_lookup(int32_t count_in_cpr);
+    float hall_sector_width(int32_t hall_cnt);
+    void learn_hall_edges(const float c[6], const float s[6], const int32_t n[6]);
 
     bool abs_spi_start_transaction();
     void abs_spi_cb(bool success);
+    void abs_spi_decode();
     void abs_spi_cs_pin_init();
+    void restore_multiturn();
     bool abs_spi_pos_updated_ = false;
     Mode mode_ = MODE_INCREMENTAL;
     Stm32Gpio abs_spi_cs_gpio_;
     uint32_t abs_spi_cr1;
     uint32_t abs_spi_cr2;
-    uint16_t abs_spi_dma_tx_[1] = {0xFFFF};
-    uint16_t abs_spi_dma_rx_[1];
+    uint16_t abs_spi_dma_tx_[abs_spi_max_words] = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
+    uint16_t abs_spi_dma_rx_[2][abs_spi_max_words];
+    uint8_t abs_spi_rx_buf_ = 0; // buffer that the next transfer receives into
+    int8_t abs_spi_rx_ready_ = -1; // buffer holding an undecoded frame, or -1
     Stm32SpiArbiter::SpiTask spi_task_;
 
-    constexpr float getCoggingRatio(){
-        return 1.0f / 3600.0f;
-    }
-
 };
 
 #endif // __ENCODER_HPP
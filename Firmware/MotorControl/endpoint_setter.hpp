@@ -0,0 +1,36 @@
+#ifndef __ENDPOINT_SETTER_HPP
+#define __ENDPOINT_SETTER_HPP
+
+#include <fibre/protocol.hpp>
+#include <fibre/introspection.hpp>
+
+// Writable number given by an endpoint reference, looked up once when the
+// reference changes instead of on every write. resolve() and set() must be
+// called from the same context.
+class EndpointSetter {
+public:
+    // @brief Looks the endpoint up again if the reference changed
+    // @returns true if the endpoint can be set from a float
+    bool resolve(endpoint_ref_t ref) {
+        if (!resolved_ || ref.json_crc != ref_.json_crc || ref.endpoint_id != ref_.endpoint_id) {
+            ref_ = ref;
+            type_info_ = fibre::get_float_settable_endpoint(ref, &property_);
+            resolved_ = true;
+        }
+        return type_info_;
+    }
+
+    bool valid() const { return type_info_; }
+
+    bool set(float value) const {
+        return type_info_ && type_info_->set_float(property_, value);
+    }
+
+private:
+    endpoint_ref_t ref_;
+    Introspectable property_;
+    const FloatSettableTypeInfo* type_info_ = nullptr;
+    bool resolved_ = false;
+};
+
+#endif // __ENDPOINT_SETTER_HPP
@@ -7,7 +7,8 @@ void Endstop::update() {
     if (config_.enabled) {
         bool last_pin_state = pin_state_;
 
-        pin_state_ = get_gpio(config_.gpio_num).read();
+        // Sampled at the PWM update, coherent with the encoder sample
+        pin_state_ = axis_->gpio_sampler_.read(sampled_pin_);
 
         // If the pin state has changed, reset the timer
         if (pin_state_ != last_pin_state)
@@ -28,5 +29,38 @@ bool Endstop::apply_config() {
         debounceTimer_.stop();
     }
     debounceTimer_.setIncrement(config_.debounce_ms * 0.001f);
+    if (axis_)
+        axis_->update_sampled_gpios();
     return true;
 }
+
+void Endstop::add_sampled_gpios(TGpioSampler& sampler) {
+    Stm32Gpio gpio = config_.enabled ? get_gpio(config_.gpio_num) : Stm32Gpio::none;
+    sampled_pin_ = sampler.add(gpio.port_, gpio.pin_mask_);
+}
+
+static void latch_cb_wrapper(void* ctx) {
+    reinterpret_cast<Endstop*>(ctx)->latch_cb();
+}
+
+bool Endstop::arm_latch() {
+    disarm_latch();
+    latched_ = false;
+    latch_gpio_ = get_gpio(config_.gpio_num);
+    // Only the first edge counts, the switch may bounce after it
+    latch_armed_ = latch_gpio_.subscribe(config_.is_active_high, !config_.is_active_high, latch_cb_wrapper, this);
+    return latch_armed_;
+}
+
+void Endstop::disarm_latch() {
+    if (latch_armed_)
+        latch_gpio_.unsubscribe();
+    latch_armed_ = false;
+}
+
+void Endstop::latch_cb() {
+    if (!latched_) {
+        latched_count_ = axis_->encoder_.count_now();
+        latched_ = true;
+    }
+}
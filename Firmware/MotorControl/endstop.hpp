@@ -24,6 +24,7 @@ class Endstop {
     Axis* axis_ = nullptr;
 
     bool apply_config();
+    void add_sampled_gpios(TGpioSampler& sampler);
 
     void update();
     constexpr bool get_state(){
@@ -38,12 +39,26 @@ class Endstop {
         return (endstop_state_ != last_state_) && !endstop_state_;
     }
 
+    // @brief Latches the encoder count at the next active edge of the
+    // switch, in the GPIO interrupt. The debounced state lags behind by
+    // debounce_ms, the latched count doesn't.
+    bool arm_latch();
+    void disarm_latch();
+    void latch_cb();
+    constexpr bool latched() {
+        return latched_;
+    }
+
     bool endstop_state_ = false;
+    int32_t latched_count_ = 0; // [counts] encoder count at the latched edge
 
    private:
     bool last_state_ = false;
     bool pin_state_ = false;
-    float pos_when_pressed_ = 0.0f;
+    TGpioSampler::Pin_t sampled_pin_ = TGpioSampler::unsampled;
+    volatile bool latched_ = false;
+    bool latch_armed_ = false;
+    Stm32Gpio latch_gpio_;
     Timer<float> debounceTimer_;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+
+#include "odrive_main.h"
+
+#include <algorithm>
+
+// @brief Appends an event to the ring, overwriting the oldest one.
+// Can be called from any thread or interrupt.
+void EventTrace::record(EventType type, uint8_t source, uint16_t arg, uint32_t value) {
+    uint32_t timestamp = odrv.config_.board_time_timestamps ? odrv.timebase_.now() : axes[0].loop_counter_;
+    uint32_t mask = cpu_enter_critical();
+    events_[count_ & (size - 1)] = {timestamp, (uint8_t)type, source, arg, value};
+    ++count_;
+    cpu_exit_critical(mask);
+}
+
+// @brief Copies the ring, returns the event count that goes with it
+uint32_t EventTrace::copy(Event_t (&events)[size]) const {
+    uint32_t mask = cpu_enter_critical();
+    std::copy(std::begin(events_), std::end(events_), events);
+    uint32_t count = count_;
+    cpu_exit_critical(mask);
+    return count;
+}
+
+// @brief Copies event n, returns false if it was not recorded yet or was
+// overwritten already
+bool EventTrace::get(uint32_t n, Event_t* event) const {
+    uint32_t mask = cpu_enter_critical();
+    bool valid = (n < count_) && (count_ - n <= size);
+    if (valid)
+        *event = events_[n & (size - 1)];
+    cpu_exit_critical(mask);
+    return valid;
+}
+
+// Returns as much of the event ring as fits into the response, starting at
+// the byte offset in the request. Same format as read_oscilloscope_buffer().
+bool EventTrace::read_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    if (offset.value() >= sizeof(events_))
+        return true; // empty response marks the end of the buffer
+    size_t n_copy = std::min(output_buffer->size(), sizeof(events_) - (size_t)offset.value());
+    uint32_t mask = cpu_enter_critical();
+    memcpy(output_buffer->begin(), (const uint8_t*)events_ + offset.value(), n_copy);
+    cpu_exit_critical(mask);
+    *output_buffer = output_buffer->skip(n_copy);
+    return true;
+}
+
+void EventTrace::clear() {
+    uint32_t mask = cpu_enter_critical();
+    count_ = 0;
+    std::fill(std::begin(events_), std::end(events_), Event_t{});
+    cpu_exit_critical(mask);
+}
@@ -0,0 +1,50 @@
+#ifndef __EVENT_TRACE_HPP
+#define __EVENT_TRACE_HPP
+
+#include <fibre/protocol.hpp>
+#include <autogen/interfaces.hpp>
+
+// Ring buffer of the last events that change the state of the ODrive: axis
+// state transitions, newly set error bits, motor arming and disarming, brake
+// resistor saturation and CAN bus-off. The error codes only tell what went
+// wrong, the trace also tells in which order and at which control loop
+// iteration.
+//
+// Recording an event costs a few instructions in a critical section, events
+// are only recorded on changes, so there is no cost per control loop
+// iteration beyond detecting them.
+//
+// Event format (little endian, 12 bytes):
+//     uint32 timestamp (loop_counter of axis0, or the board time in us with
+//     config.board_time_timestamps), uint8 type, uint8 source,
+//     uint16 arg, uint32 value
+class EventTrace : public ODriveIntf::EventTraceIntf {
+public:
+    static constexpr size_t size = 128; // [events], power of two
+    static constexpr uint8_t source_board = 0xff; // source of events that don't belong to an axis
+
+    struct Event_t {
+        uint32_t timestamp;
+        uint8_t type;
+        uint8_t source;
+        uint16_t arg;
+        uint32_t value;
+    };
+    static_assert(sizeof(Event_t) == 12, "event must be packed");
+    static_assert((size & (size - 1)) == 0, "size must be a power of two");
+
+    void record(EventType type, uint8_t source, uint16_t arg, uint32_t value);
+    uint32_t copy(Event_t (&events)[size]) const;
+    bool get(uint32_t n, Event_t* event) const;
+    bool read_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    void clear() override;
+
+    // Total number of events since startup or clear(). The ring holds the
+    // last `size` of them, event n is at index n % size.
+    uint32_t count_ = 0;
+
+private:
+    Event_t events_[size] = {};
+};
+
+#endif // __EVENT_TRACE_HPP
@@ -0,0 +1,87 @@
+#ifndef __FAST_TORQUE_WINDOW_HPP
+#define __FAST_TORQUE_WINDOW_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+
+// Maps a torque input that arrives after the control loop ran to the torque
+// the loop would have produced for it, so the current loop interrupt can
+// apply it right away, see Controller::Config_t::fast_torque_input.
+//
+// In torque control with passthrough input the loop only adds terms that
+// don't depend on the input (anticogging) and clamps the sum (velocity
+// limit, torque limits). A chain of clamps is again a clamp, so the output
+// for any input is
+//   clamp(input + offset, min, max)
+// with the offset at the first clamp. Stages that depend on the history of
+// the input, like the resonance filters, invalidate the window.
+class FastTorqueWindow {
+public:
+    // @brief Starts tracking the torque of one control loop update
+    // @param active: false if the loop doesn't pass the input through
+    // @param input: [Nm] the torque input the loop started with
+    // @param seq: sequence number of the fast torque input it belongs to
+    void begin(bool active, float input, uint32_t seq) {
+        active_ = active;
+        has_offset_ = false;
+        input_ = input;
+        offset_ = 0.0f;
+        min_ = -std::numeric_limits<float>::infinity();
+        max_ = std::numeric_limits<float>::infinity();
+        seq_ = seq;
+    }
+
+    // @brief Clamps the torque like std::clamp and narrows the window. If the
+    // bounds cross, the lower one wins.
+    float clamp(float torque, float lo, float hi) {
+        narrow(torque, lo, hi);
+        return std::clamp(torque, lo, std::max(lo, hi));
+    }
+
+    // @brief Narrows the window by a clamp that the caller applies itself
+    // @param torque: [Nm] the torque before the clamp
+    void narrow(float torque, float lo, float hi) {
+        hi = std::max(lo, hi);
+        if (!has_offset_) {
+            offset_ = torque - input_;
+            has_offset_ = true;
+        }
+        min_ = std::clamp(min_, lo, hi);
+        max_ = std::clamp(max_, lo, hi);
+    }
+
+    void invalidate() { active_ = false; }
+
+    // @param torque: [Nm] output of the control loop
+    void end(float torque) {
+        if (!has_offset_)
+            offset_ = torque - input_;
+        output_ = torque;
+    }
+
+    bool active() const { return active_; }
+    uint32_t seq() const { return seq_; }
+    float output() const { return output_; }
+
+    // @brief Torque for a fast input that arrived after the control loop ran
+    // @returns false if there is no newer input or the window is not active
+    bool apply(uint32_t seq, float input, float* torque) const {
+        if (!active_ || seq == seq_)
+            return false;
+        *torque = std::clamp(input + offset_, min_, max_);
+        return true;
+    }
+
+private:
+    bool active_ = false;
+    bool has_offset_ = false;
+    float input_ = 0.0f;
+    float offset_ = 0.0f;
+    float min_ = 0.0f;
+    float max_ = 0.0f;
+    float output_ = 0.0f;
+    uint32_t seq_ = 0;
+};
+
+#endif // __FAST_TORQUE_WINDOW_HPP
@@ -0,0 +1,57 @@
+#ifndef __FEATURES_HPP
+#define __FEATURES_HPP
+
+#include <stdint.h>
+
+// Subsystems that a build can leave out, selected in tup.config (see
+// tup.config.default). A disabled subsystem keeps its objects and its
+// configuration, so the interface and the saved configuration don't change,
+// but the control loop never calls it and the linker drops its code. A
+// configuration that needs it fails like an unsupported one:
+//  - ACIM: arming an ACIM motor sets ERROR_NOT_IMPLEMENTED_MOTOR_TYPE
+//  - sensorless: AXIS_STATE_SENSORLESS_CONTROL sets ERROR_INVALID_STATE
+//  - endstops: they never trigger, homing needs config.homing.use_hard_stop
+//  - anticogging: the calibration doesn't start, no torque is applied
+//  - oscilloscope: arming fails and the buffer shrinks to one value
+//
+// The flags are constexpr so the disabled branches are removed at compile
+// time, but all code is still compiled in every build.
+
+#ifdef NO_ACIM
+constexpr bool kFeatureAcim = false;
+#else
+constexpr bool kFeatureAcim = true;
+#endif
+
+#ifdef NO_SENSORLESS
+constexpr bool kFeatureSensorless = false;
+#else
+constexpr bool kFeatureSensorless = true;
+#endif
+
+#ifdef NO_ENDSTOPS
+constexpr bool kFeatureEndstops = false;
+#else
+constexpr bool kFeatureEndstops = true;
+#endif
+
+#ifdef NO_ANTICOGGING
+constexpr bool kFeatureAnticogging = false;
+#else
+constexpr bool kFeatureAnticogging = true;
+#endif
+
+#ifdef NO_OSCILLOSCOPE
+constexpr bool kFeatureOscilloscope = false;
+#else
+constexpr bool kFeatureOscilloscope = true;
+#endif
+
+// Bitmask of the subsystems in this build, reported as odrv.build_features
+constexpr uint32_t kBuildFeatures = (kFeatureAcim ? 1u << 0 : 0)
+                                  | (kFeatureSensorless ? 1u << 1 : 0)
+                                  | (kFeatureEndstops ? 1u << 2 : 0)
+                                  | (kFeatureAnticogging ? 1u << 3 : 0)
+                                  | (kFeatureOscilloscope ? 1u << 4 : 0);
+
+#endif // __FEATURES_HPP
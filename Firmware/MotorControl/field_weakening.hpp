@@ -0,0 +1,54 @@
+#ifndef __FIELD_WEAKENING_HPP
+#define __FIELD_WEAKENING_HPP
+
+#include <algorithm>
+#include <cmath>
+
+// Field weakening for PMSM motors. Above base speed the back-EMF leaves the
+// current controller no voltage headroom and the torque collapses. A negative
+// d axis current weakens the magnet flux, which lowers the back-EMF and
+// allows higher speeds from the same DC bus voltage.
+//
+// The d axis current comes from an integrator on the modulation that the
+// current controller asked for: it grows while the modulation is above the
+// setpoint and winds back to zero below it, so it is only injected when the
+// voltage runs out. The integrator runs at the control loop rate on the
+// modulation of the latest current control cycle.
+class FieldWeakening {
+public:
+    struct Config_t {
+        bool enable = false;
+        float mod_setpoint = 0.95f; // fraction of max_modulation at which the field weakening starts
+        float gain = 5000.0f;       // [A/s] per 1.0 of modulation above the setpoint
+        float max_current = 10.0f;  // [A] largest negative d axis current
+    };
+
+    void reset() { Id_ = 0.0f; }
+
+    // @param modulation: unsaturated modulation magnitude of the current
+    //        controller relative to its limit, > 1 while saturated
+    // @param current_lim: [A] the injection never exceeds it
+    // @returns [A] d axis current, 0 or negative
+    float update(const Config_t& config, float modulation, float current_lim, float dt) {
+        if (!config.enable) {
+            return Id_ = 0.0f;
+        }
+        Id_ -= config.gain * (modulation - config.mod_setpoint) * dt;
+        Id_ = std::clamp(Id_, -std::min(config.max_current, current_lim), 0.0f);
+        return Id_;
+    }
+
+    float Id() const { return Id_; } // [A]
+
+private:
+    float Id_ = 0.0f; // [A]
+};
+
+// @brief Largest q axis current that keeps the current vector within the
+// current limit, the d axis current takes precedence.
+// @param Id: [A] must not exceed ilim
+inline float max_Iq_for_current_lim(float Id, float ilim) {
+    return std::sqrt(std::max(ilim * ilim - Id * Id, 0.0f));
+}
+
+#endif // __FIELD_WEAKENING_HPP
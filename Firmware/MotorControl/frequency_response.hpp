@@ -0,0 +1,183 @@
+#ifndef __FREQUENCY_RESPONSE_HPP
+#define __FREQUENCY_RESPONSE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// Stepped sine frequency response measurement, see
+// Controller::start_frequency_response().
+//
+// At each of a number of logarithmically spaced frequencies a sine is added
+// to the control loop and, after it settled, the response and the torque
+// command are correlated with the sine and the cosine over a whole number of
+// periods. This gives the response at that frequency without an FFT and is
+// immune to noise and to harmonics. The sine comes from a rotating phasor,
+// so the control loop only does a few multiply-adds per period. Completed
+// points are kept as complex ratios, gain and phase are computed when the
+// table is read.
+class FrequencyResponseAnalyzer {
+public:
+    static constexpr size_t max_points = 64;
+
+    struct Point_t {
+        float freq;        // [Hz]
+        float response_re; // response over excitation
+        float response_im;
+        float torque_re;   // torque command over excitation
+        float torque_im;
+    };
+
+    // One row of the bode table
+    struct Bode_t {
+        float freq;         // [Hz]
+        float gain;         // response over excitation
+        float phase;        // [deg]
+        float torque_gain;  // torque command over excitation
+        float torque_phase; // [deg]
+    };
+
+    // @param amplitude: of the excitation
+    // @param measure_cycles: periods of each frequency that are correlated
+    // @param settle_cycles: periods before that, for the transient to decay
+    // @param dt: [s] period of update()
+    // @returns false if the parameters are out of range. The frequencies
+    // must be below a quarter of the update rate.
+    bool start(float amplitude, float freq_start, float freq_end, uint32_t num_points,
+               float settle_cycles, uint32_t measure_cycles, float dt) {
+        active_ = false;
+        if (!(amplitude > 0.0f) || !(freq_start > 0.0f) || !(freq_end >= freq_start)
+                || !(dt > 0.0f) || !(freq_end * dt <= 0.25f) || num_points < 1
+                || num_points > max_points || !(settle_cycles >= 0.0f) || measure_cycles < 1)
+            return false;
+        amplitude_ = amplitude;
+        freq_start_ = freq_start;
+        freq_end_ = freq_end;
+        num_requested_ = num_points;
+        settle_cycles_ = settle_cycles;
+        measure_cycles_ = measure_cycles;
+        dt_ = dt;
+        sin_ = 0.0f;
+        cos_ = 1.0f;
+        num_points_ = 0;
+        start_point();
+        active_ = true;
+        return true;
+    }
+
+    void stop() { active_ = false; }
+    bool active() const { return active_; }
+
+    // @brief Excitation for this period, to be added at the injection point
+    float excitation() const { return active_ ? amplitude_ * sin_ : 0.0f; }
+
+    // @brief Correlates the signals of this period with the excitation and
+    // advances it to the next period
+    // @param response: the measured output, sampled before the excitation
+    // of this period took effect
+    // @param torque: [Nm] the torque command of this period
+    void update(float response, float torque) {
+        if (!active_)
+            return;
+        if (tick_ >= settle_ticks_) {
+            // Relative to the first sample to keep the sums small
+            if (tick_ == settle_ticks_) {
+                response_ref_ = response;
+                torque_ref_ = torque;
+            }
+            float y = response - response_ref_;
+            float t = torque - torque_ref_;
+            response_sin_ += y * sin_;
+            response_cos_ += y * cos_;
+            torque_sin_ += t * sin_;
+            torque_cos_ += t * cos_;
+        }
+
+        float s = sin_ * rot_cos_ + cos_ * rot_sin_;
+        float c = cos_ * rot_cos_ - sin_ * rot_sin_;
+        float k = 1.5f - 0.5f * (s * s + c * c); // keeps the phasor on the unit circle
+        sin_ = k * s;
+        cos_ = k * c;
+
+        if (++tick_ == settle_ticks_ + measure_ticks_)
+            finish_point();
+    }
+
+    // @brief Number of completed points, these don't change until the next
+    // start()
+    uint32_t num_points() const { return num_points_; }
+    const Point_t& point(size_t i) const { return points_[i]; }
+
+    Bode_t bode(size_t i) const {
+        const Point_t& p = points_[i];
+        constexpr float rad_to_deg = 180.0f / 3.14159265f;
+        return {
+            p.freq,
+            std::sqrt(p.response_re * p.response_re + p.response_im * p.response_im),
+            std::atan2(p.response_im, p.response_re) * rad_to_deg,
+            std::sqrt(p.torque_re * p.torque_re + p.torque_im * p.torque_im),
+            std::atan2(p.torque_im, p.torque_re) * rad_to_deg,
+        };
+    }
+
+private:
+    void start_point() {
+        float freq = num_requested_ > 1
+                ? freq_start_ * std::pow(freq_end_ / freq_start_, (float)num_points_ / (float)(num_requested_ - 1))
+                : freq_start_;
+        // A whole number of periods in a whole number of updates, so that
+        // constant offsets don't leak into the sums
+        measure_ticks_ = std::max<uint32_t>((uint32_t)std::lround((float)measure_cycles_ / (freq * dt_)), 1);
+        freq_ = (float)measure_cycles_ / ((float)measure_ticks_ * dt_);
+        settle_ticks_ = (uint32_t)std::ceil(settle_cycles_ / (freq_ * dt_));
+        float step = 2.0f * 3.14159265f * freq_ * dt_;
+        rot_cos_ = std::cos(step);
+        rot_sin_ = std::sin(step);
+        tick_ = 0;
+        response_sin_ = response_cos_ = torque_sin_ = torque_cos_ = 0.0f;
+    }
+
+    void finish_point() {
+        // y = |G| A sin(wt + phi) correlates to N/2 |G| A (cos(phi), sin(phi))
+        float scale = 2.0f / ((float)measure_ticks_ * amplitude_);
+        points_[num_points_] = {freq_, scale * response_sin_, scale * response_cos_,
+                                scale * torque_sin_, scale * torque_cos_};
+        std::atomic_signal_fence(std::memory_order_release); // the point is written before it is counted
+        ++num_points_;
+        if (num_points_ < num_requested_)
+            start_point();
+        else
+            active_ = false;
+    }
+
+    bool active_ = false;
+    float amplitude_ = 0.0f;
+    float freq_start_ = 0.0f;  // [Hz]
+    float freq_end_ = 0.0f;    // [Hz]
+    uint32_t num_requested_ = 0;
+    float settle_cycles_ = 0.0f;
+    uint32_t measure_cycles_ = 0;
+    float dt_ = 0.0f;          // [s]
+
+    float freq_ = 0.0f;        // [Hz] of the current point
+    float sin_ = 0.0f;
+    float cos_ = 1.0f;
+    float rot_cos_ = 1.0f;     // rotation of the phasor per update
+    float rot_sin_ = 0.0f;
+    uint32_t tick_ = 0;        // updates since the start of the current point
+    uint32_t settle_ticks_ = 0;
+    uint32_t measure_ticks_ = 0;
+    float response_ref_ = 0.0f;
+    float torque_ref_ = 0.0f;
+    float response_sin_ = 0.0f;
+    float response_cos_ = 0.0f;
+    float torque_sin_ = 0.0f;
+    float torque_cos_ = 0.0f;
+
+    volatile uint32_t num_points_ = 0; // read by the protocol threads
+    Point_t points_[max_points] = {};
+};
+
+#endif // __FREQUENCY_RESPONSE_HPP
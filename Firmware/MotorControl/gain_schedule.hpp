@@ -0,0 +1,97 @@
+#ifndef __GAIN_SCHEDULE_HPP
+#define __GAIN_SCHEDULE_HPP
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+#include "interpolation_table.hpp"
+
+// Scaling of the position, velocity and velocity integrator gains with the
+// speed and the load, e.g. stiff at standstill and softer at high speed or
+// with a heavy payload.
+//
+// The speed dependency is given by a few breakpoints of |velocity| with a
+// scale factor for each gain, interpolated linearly in between and held
+// constant outside. build() resamples them into evenly spaced tables so that
+// the control loop evaluates them in constant time. The load index is an
+// input from the application in [0, 1], the scale factors at load index 1
+// are interpolated towards 1 at load index 0 and multiply the speed scale.
+class GainSchedule {
+public:
+    static constexpr size_t num_points = 4;
+    static constexpr size_t table_size = 32;
+
+    struct Point_t {
+        float vel = 0.0f;                 // [turn/s] of |vel_estimate|
+        float pos_gain = 1.0f;            // scale factors of the configured gains
+        float vel_gain = 1.0f;
+        float vel_integrator_gain = 1.0f;
+    };
+
+    struct Config_t {
+        bool enable = false;
+        // Sorted by vel. The breakpoints are used up to the first one that
+        // isn't faster than its predecessor.
+        Point_t points[num_points];
+        float load_pos_gain = 1.0f;       // scale factors at load index 1
+        float load_vel_gain = 1.0f;
+        float load_vel_integrator_gain = 1.0f;
+    };
+
+    struct Scales_t {
+        float pos_gain;
+        float vel_gain;
+        float vel_integrator_gain;
+    };
+
+    GainSchedule() { build(Config_t{}); }
+
+    void build(const Config_t& config) {
+        const Point_t* p = config.points;
+        size_t n = 1;
+        while (n < num_points && p[n].vel > p[n - 1].vel)
+            ++n;
+        float vel_min = p[0].vel;
+        float vel_max = p[n - 1].vel;
+        inv_vel_max_ = vel_max > 0.0f ? 1.0f / vel_max : 0.0f;
+
+        auto sample = [&](float Point_t::*scale) {
+            return [&, scale](float x) {
+                float vel = x * vel_max;
+                if (n == 1 || vel <= vel_min)
+                    return p[0].*scale;
+                size_t i = 1;
+                while (i < n - 1 && vel > p[i].vel)
+                    ++i;
+                float t = (vel - p[i - 1].vel) / (p[i].vel - p[i - 1].vel);
+                return p[i - 1].*scale + std::min(t, 1.0f) * (p[i].*scale - p[i - 1].*scale);
+            };
+        };
+        pos_gain_.build(sample(&Point_t::pos_gain));
+        vel_gain_.build(sample(&Point_t::vel_gain));
+        vel_integrator_gain_.build(sample(&Point_t::vel_integrator_gain));
+        load_ = {config.load_pos_gain - 1.0f, config.load_vel_gain - 1.0f, config.load_vel_integrator_gain - 1.0f};
+    }
+
+    // @param vel: [turn/s] velocity estimate
+    // @param load_index: 0 to 1
+    Scales_t eval(float vel, float load_index) const {
+        float x = std::min(std::abs(vel) * inv_vel_max_, 1.0f);
+        float load = std::clamp(load_index, 0.0f, 1.0f);
+        return {
+            pos_gain_.eval(x) * (1.0f + load * load_.pos_gain),
+            vel_gain_.eval(x) * (1.0f + load * load_.vel_gain),
+            vel_integrator_gain_.eval(x) * (1.0f + load * load_.vel_integrator_gain),
+        };
+    }
+
+private:
+    InterpolationTable<table_size> pos_gain_;
+    InterpolationTable<table_size> vel_gain_;
+    InterpolationTable<table_size> vel_integrator_gain_;
+    Scales_t load_ = {0.0f, 0.0f, 0.0f}; // scale at load index 1, minus 1
+    float inv_vel_max_ = 0.0f; // [1/(turn/s)]
+};
+
+#endif // __GAIN_SCHEDULE_HPP
@@ -0,0 +1,64 @@
+#ifndef __GPIO_SAMPLER_HPP
+#define __GPIO_SAMPLER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Samples the input data registers of the GPIO ports that are in use at one
+// instant, so that all pins read from the samples are coherent. The set of
+// ports and the port index and mask of each pin are resolved when the
+// configuration is applied, so sample() reads just these ports and read()
+// is a single lookup.
+//
+// Rebuilding the set with clear() and add() while sample() keeps running in
+// an interrupt is fine: pins that are added in the same order get the same
+// slots as before, and ports that are missing for a moment keep their last
+// sample.
+template<size_t MaxPorts>
+class GpioSampler {
+public:
+    struct Pin_t {
+        uint8_t port; // index into the samples, MaxPorts for a pin that is not sampled
+        uint16_t mask;
+    };
+
+    static constexpr Pin_t unsampled = {MaxPorts, 0};
+
+    void clear() { num_ports_ = 0; }
+
+    // @brief Adds the port of the pin to the sampled set
+    // @returns the slot of the pin, or unsampled if the pin is not valid or
+    // the set is full. Unsampled pins always read false.
+    template<typename TPort>
+    Pin_t add(TPort* port, uint16_t mask) {
+        if (!port || !mask)
+            return unsampled;
+        const volatile uint32_t* idr = &port->IDR;
+        size_t i = 0;
+        while (i < num_ports_ && idr_[i] != idr)
+            ++i;
+        if (i == MaxPorts)
+            return unsampled;
+        if (i == num_ports_) {
+            idr_[i] = idr;
+            num_ports_ = i + 1;
+        }
+        return {(uint8_t)i, mask};
+    }
+
+    void sample() {
+        for (size_t i = 0; i < num_ports_; ++i)
+            samples_[i] = (uint16_t)*idr_[i];
+    }
+
+    bool read(Pin_t pin) const { return samples_[pin.port] & pin.mask; }
+
+    size_t num_ports() const { return num_ports_; }
+
+private:
+    const volatile uint32_t* idr_[MaxPorts] = {};
+    uint16_t samples_[MaxPorts + 1] = {}; // the last one is never written, for unsampled pins
+    volatile size_t num_ports_ = 0;
+};
+
+#endif // __GPIO_SAMPLER_HPP
@@ -0,0 +1,77 @@
+#ifndef __HARMONIC_COMPENSATOR_HPP
+#define __HARMONIC_COMPENSATOR_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+// Compensation of torque ripple at multiples of the electrical frequency,
+// e.g. 6x from back-EMF harmonics, 1x and 2x from offset and gain errors of
+// the current sensors. The correction is a sum of a few harmonics of the
+// electrical phase with one cos/sin coefficient pair each for Iq and Id.
+//
+// The Iq coefficients can be learned at speed by adaptive feedforward
+// cancellation: the velocity loop counteracts the ripple, so its current
+// command carries the ripple with opposite sign. Correlating the command with
+// each harmonic moves the ripple over from the velocity loop to the
+// feedforward until the command no longer contains it. With the loop delay at
+// a harmonic approaching 90 degrees of phase the learning becomes unstable,
+// so harmonics far above the velocity loop bandwidth need a small learn_rate.
+//
+// The coefficients live in the config so that they are saved with it.
+class HarmonicCompensator {
+public:
+    static constexpr size_t num_harmonics = 3;
+    static constexpr uint32_t max_order = 24;
+
+    struct Harmonic_t {
+        uint32_t order = 0; // multiple of the electrical frequency up to max_order, 0 disables the entry
+        float Iq_cos = 0.0f; // [A]
+        float Iq_sin = 0.0f; // [A]
+        float Id_cos = 0.0f; // [A]
+        float Id_sin = 0.0f; // [A]
+    };
+
+    struct Config_t {
+        bool enable = false;
+        bool learn = false;
+        float learn_rate = 0.5f; // [1/s]
+        float learn_min_vel = 100.0f; // [rad/s electrical] learning pauses below this speed
+        Harmonic_t harmonics[num_harmonics] = {{1}, {2}, {6}};
+    };
+
+    // @brief Learns from the current command of the velocity loop (without this
+    // correction) and returns the correction.
+    // @param phase: [rad electrical]
+    // @param phase_vel: [rad/s electrical]
+    // @param Iq_command: [A] q axis current from the torque setpoint
+    // @param Id, Iq: [A] the corrections are added to these
+    static void update(Config_t& config, float phase, float phase_vel, float Iq_command, float dt, float* Id, float* Iq) {
+        if (!config.enable)
+            return;
+        bool learn = config.learn && std::abs(phase_vel) >= config.learn_min_vel;
+        float k = config.learn_rate * dt * Iq_command;
+        float c1 = std::cos(phase);
+        float s1 = std::sin(phase);
+        for (size_t i = 0; i < num_harmonics; ++i) {
+            Harmonic_t& h = config.harmonics[i];
+            if (!h.order || h.order > max_order)
+                continue;
+            // cos and sin of order * phase by repeated rotation
+            float c = c1, s = s1;
+            for (uint32_t n = 1; n < h.order; ++n) {
+                float c_next = c * c1 - s * s1;
+                s = s * c1 + c * s1;
+                c = c_next;
+            }
+            if (learn) {
+                h.Iq_cos += k * c;
+                h.Iq_sin += k * s;
+            }
+            *Iq += h.Iq_cos * c + h.Iq_sin * s;
+            *Id += h.Id_cos * c + h.Id_sin * s;
+        }
+    }
+};
+
+#endif // __HARMONIC_COMPENSATOR_HPP
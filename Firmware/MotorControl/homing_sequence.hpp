@@ -0,0 +1,145 @@
+#ifndef __HOMING_SEQUENCE_HPP
+#define __HOMING_SEQUENCE_HPP
+
+#include <stddef.h>
+#include <cmath>
+
+// Stages of the homing sequence, built from the homing configuration.
+//
+// Without a fast approach the axis seeks the min endstop at homing_speed,
+// as it always did. With one, it first seeks the endstop at fast_speed, backs
+// off until the switch has released and the axis has travelled at least
+// backoff_distance, and then approaches it again at homing_speed, so that the
+// switch edge is always taken at the slow speed. With use_index the axis
+// finally moves away from the switch until the next encoder index pulse,
+// which then defines home instead of the switch edge.
+//
+// Axes without an endstop can home against a mechanical stop instead
+// (use_hard_stop). The axis approaches it at homing_speed with the torque
+// limited to hard_stop_torque and detects the stall when the velocity has
+// collapsed while the measured torque is at the limit. It then backs off by
+// backoff_distance (or seeks the index) with the full torque available. The
+// fast approach is skipped, the stop would be hit too hard.
+//
+// Velocities are signed, towards the min endstop is the negative direction of
+// homing_speed. Travel is measured from the start of each stage, in turns of
+// the axis' own encoder.
+class HomingSequence {
+public:
+    struct Config_t {
+        float fast_speed = 0.0f;        // [turn/s] 0 skips the fast approach
+        float backoff_distance = 0.1f;  // [turn]
+        bool use_index = false;         // refine home to the next index pulse after the switch
+        bool use_hard_stop = false;     // home against a mechanical stop instead of the min endstop
+        float hard_stop_torque = 0.1f;  // [Nm] torque limit while seeking the stop
+        float stall_time = 0.05f;       // [s] the stall must persist this long
+    };
+
+    enum StageType {
+        SEEK_ENDSTOP,   // until the endstop is pressed
+        LEAVE_ENDSTOP,  // until the endstop is released and distance is covered
+        SEEK_INDEX,     // until the index pulse, fails after distance
+        SEEK_HARD_STOP, // until the axis stalls
+        BACK_OFF,       // until distance is covered
+    };
+
+    struct Stage_t {
+        StageType type;
+        float vel;       // [turn/s]
+        float distance;  // [turn]
+        bool reference;  // the count latched in this stage defines home
+        float torque_limit = INFINITY; // [Nm]
+        float stall_time = 0.0f;       // [s]
+    };
+
+    enum Result {
+        RUNNING,
+        DONE,
+        FAILED,
+    };
+
+    static constexpr size_t kMaxStages = 4;
+    // The index must show up within one turn, with some margin for the
+    // pulse width and the ramp
+    static constexpr float kIndexSearchDistance = 1.1f; // [turn]
+
+    // @param homing_speed: slow approach speed, its sign sets the direction
+    void build(const Config_t& config, float homing_speed) {
+        size_ = 0;
+        if (config.use_hard_stop) {
+            stages_[size_++] = {SEEK_HARD_STOP, -homing_speed, 0.0f, !config.use_index,
+                                std::abs(config.hard_stop_torque), config.stall_time};
+            if (config.use_index)
+                stages_[size_++] = {SEEK_INDEX, homing_speed, kIndexSearchDistance, true};
+            else
+                stages_[size_++] = {BACK_OFF, homing_speed, std::abs(config.backoff_distance), false};
+            return;
+        }
+        float fast_speed = std::copysign(std::abs(config.fast_speed), homing_speed);
+        if (config.fast_speed != 0.0f) {
+            stages_[size_++] = {SEEK_ENDSTOP, -fast_speed, 0.0f, false};
+            stages_[size_++] = {LEAVE_ENDSTOP, homing_speed, std::abs(config.backoff_distance), false};
+        }
+        stages_[size_++] = {SEEK_ENDSTOP, -homing_speed, 0.0f, !config.use_index};
+        if (config.use_index)
+            stages_[size_++] = {SEEK_INDEX, homing_speed, kIndexSearchDistance, true};
+    }
+
+    size_t size() const { return size_; }
+    const Stage_t& operator[](size_t i) const { return stages_[i]; }
+
+    // @param endstop_pressed: debounced state of the min endstop
+    // @param index_latched: the index pulse was seen in this stage
+    // @param travel: distance since the start of this stage [turn]
+    // @param stalled: see StallDetector
+    static Result check(const Stage_t& stage, bool endstop_pressed, bool index_latched, float travel, bool stalled = false) {
+        switch (stage.type) {
+            case SEEK_ENDSTOP:
+                return endstop_pressed ? DONE : RUNNING;
+            case LEAVE_ENDSTOP:
+                return (!endstop_pressed && std::abs(travel) >= stage.distance) ? DONE : RUNNING;
+            case SEEK_INDEX:
+                if (index_latched)
+                    return DONE;
+                return std::abs(travel) > stage.distance ? FAILED : RUNNING;
+            case SEEK_HARD_STOP:
+                return stalled ? DONE : RUNNING;
+            case BACK_OFF:
+                return std::abs(travel) >= stage.distance ? DONE : RUNNING;
+        }
+        return FAILED;
+    }
+
+private:
+    Stage_t stages_[kMaxStages] = {};
+    size_t size_ = 0;
+};
+
+// Detects an axis pushing against a stop: the velocity is below kVelRatio
+// of the commanded velocity and the measured torque is at least kTorqueRatio
+// of the torque limit, both for stall_time without interruption.
+class StallDetector {
+public:
+    static constexpr float kVelRatio = 0.25f;
+    static constexpr float kTorqueRatio = 0.9f;
+
+    void reset() {
+        time_ = 0.0f;
+    }
+
+    // @param vel: velocity estimate [turn/s]
+    // @param torque: measured torque [Nm]
+    // @param dt: time since the last update [s]
+    // @returns true while stalled
+    bool update(const HomingSequence::Stage_t& stage, float vel, float torque, float dt) {
+        bool pushing = std::abs(vel) < kVelRatio * std::abs(stage.vel)
+                    && std::abs(torque) >= kTorqueRatio * stage.torque_limit;
+        time_ = pushing ? time_ + dt : 0.0f;
+        return pushing && time_ >= stage.stall_time;
+    }
+
+private:
+    float time_ = 0.0f; // [s] since the stall started
+};
+
+#endif // __HOMING_SEQUENCE_HPP
@@ -0,0 +1,34 @@
+#ifndef __INTERPOLATION_TABLE_HPP
+#define __INTERPOLATION_TABLE_HPP
+
+#include <stddef.h>
+
+// Samples of a function on [0, 1] at N equidistant points, evaluated by
+// linear interpolation. For functions that are too expensive to evaluate in
+// a loop but change only with the configuration.
+template<size_t N>
+class InterpolationTable {
+    static_assert(N >= 2, "need at least two points");
+
+public:
+    template<typename TFunc>
+    void build(TFunc f) {
+        for (size_t i = 0; i < N; ++i)
+            y_[i] = f((float)i / (float)(N - 1));
+    }
+
+    // @brief Evaluates the table at x, which must be in [0, 1]
+    float eval(float x) const {
+        float pos = x * (float)(N - 1);
+        size_t i = (size_t)pos;
+        if (i > N - 2)
+            i = N - 2;
+        float t = pos - (float)i;
+        return y_[i] + t * (y_[i + 1] - y_[i]);
+    }
+
+private:
+    float y_[N] = {};
+};
+
+#endif // __INTERPOLATION_TABLE_HPP
@@ -0,0 +1,54 @@
+#ifndef __LINEAR_FIT_HPP
+#define __LINEAR_FIT_HPP
+
+#include <cmath>
+#include <algorithm>
+
+// Least squares fit of a line y = slope * x + intercept to a stream of
+// samples. The means and co-moments are updated incrementally (Welford), which
+// stays accurate in single precision over many thousand samples with a large
+// offset of x or y.
+class LinearFit {
+public:
+    void reset() { *this = LinearFit(); }
+
+    void add(float x, float y) {
+        ++n_;
+        float dx = x - mean_x_;
+        float dy = y - mean_y_;
+        mean_x_ += dx / (float)n_;
+        mean_y_ += dy / (float)n_;
+        m_xx_ += dx * (x - mean_x_);
+        m_xy_ += dx * (y - mean_y_);
+        m_yy_ += dy * (y - mean_y_);
+    }
+
+    // @returns false if x did not vary
+    bool solve(float* slope, float* intercept) const {
+        if (!(n_ >= 2 && m_xx_ > 0.0f))
+            return false;
+        *slope = m_xy_ / m_xx_;
+        *intercept = mean_y_ - *slope * mean_x_;
+        return true;
+    }
+
+    // @brief RMS deviation of the samples from the fitted line
+    float rms_residual() const {
+        if (!(n_ >= 2 && m_xx_ > 0.0f))
+            return 0.0f;
+        float ss = m_yy_ - m_xy_ * m_xy_ / m_xx_;
+        return std::sqrt(std::max(ss, 0.0f) / (float)n_);
+    }
+
+    int samples() const { return n_; }
+
+private:
+    int n_ = 0;
+    float mean_x_ = 0.0f;
+    float mean_y_ = 0.0f;
+    float m_xx_ = 0.0f;
+    float m_xy_ = 0.0f;
+    float m_yy_ = 0.0f;
+};
+
+#endif // __LINEAR_FIT_HPP
@@ -0,0 +1,230 @@
+#ifndef __LOG_STORAGE_HPP
+#define __LOG_STORAGE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fibre/crc.hpp>
+
+// Circular log of binary records in a NOR flash. The sectors are used in
+// turn and each one is erased right before it is written again, so all
+// sectors wear evenly and the log always holds the most recent records.
+//
+// Sector format (little endian):
+//     uint32 magic, uint32 seq, then records until a length of 0xffff
+// Record format:
+//     uint16 length (of the payload), uint16 crc16 (of everything from the
+//     timestamp to the end of the payload), uint32 timestamp, uint8 type,
+//     uint8 source, uint16 reserved (0xffff), payload, padding to 4 bytes
+//
+// The seq of a sector is one more than that of the sector before it. The
+// readable sectors are the one with the highest seq and those before it
+// with consecutive seqs, so clear() only has to start a new sector with a
+// seq that skips ahead. A record whose write was interrupted by a reset
+// fails its CRC and is skipped by the reader, records never span two
+// sectors.
+//
+// TFlash provides size(), read(), program() and erase_sector() like
+// SpiFlash. The functions are not thread-safe.
+template<typename TFlash>
+class LogStorage {
+public:
+    static constexpr size_t sector_size = 4096;
+    static constexpr uint32_t sector_magic = 0x474f4c44; // "DLOG"
+    static constexpr uint16_t crc16_init = 0x1337; // same CRC as the fibre packets
+    static constexpr uint16_t crc16_polynomial = 0x3d65;
+
+    struct SectorHeader_t {
+        uint32_t magic;
+        uint32_t seq;
+    };
+
+    struct RecordHeader_t {
+        uint16_t length;
+        uint16_t crc16;
+        uint32_t timestamp;
+        uint8_t type;
+        uint8_t source;
+        uint16_t reserved;
+    };
+    static_assert(sizeof(RecordHeader_t) == 12, "record header must be packed");
+
+    static constexpr size_t max_payload = sector_size - sizeof(SectorHeader_t) - sizeof(RecordHeader_t);
+
+    LogStorage(TFlash& flash) : flash_(flash) {}
+
+    // @brief Finds the readable sectors and the end of the last record
+    // @returns false if the flash holds less than two sectors or can't be read
+    bool mount() {
+        mounted_ = false;
+        num_sectors_ = flash_.size() / sector_size;
+        if (num_sectors_ < 2)
+            return false;
+
+        // Find the newest sector
+        bool found = false;
+        uint32_t max_seq = 0;
+        for (uint32_t i = 0; i < num_sectors_; ++i) {
+            SectorHeader_t header;
+            if (!read_header(i, &header))
+                return false;
+            if (header.magic == sector_magic && (!found || (int32_t)(header.seq - max_seq) > 0)) {
+                found = true;
+                max_seq = header.seq;
+                current_ = i;
+            }
+        }
+
+        if (!found) {
+            // Empty log, the first append() starts at sector 0
+            current_ = num_sectors_ - 1;
+            seq_ = 0;
+            write_offset_ = sector_size;
+            oldest_ = 0;
+            num_readable_ = 0;
+            mounted_ = true;
+            return true;
+        }
+
+        // The readable sectors precede the newest one without gaps in seq
+        seq_ = max_seq;
+        num_readable_ = 1;
+        while (num_readable_ < num_sectors_) {
+            SectorHeader_t header;
+            uint32_t i = (current_ + num_sectors_ - num_readable_) % num_sectors_;
+            if (!read_header(i, &header))
+                return false;
+            if (header.magic != sector_magic || header.seq != max_seq - num_readable_)
+                break;
+            ++num_readable_;
+        }
+        oldest_ = (current_ + num_sectors_ + 1 - num_readable_) % num_sectors_;
+
+        // Find the end of the records in the newest sector
+        write_offset_ = sizeof(SectorHeader_t);
+        while (write_offset_ + sizeof(RecordHeader_t) <= sector_size) {
+            uint16_t length;
+            if (!flash_.read(current_ * sector_size + write_offset_, (uint8_t*)&length, sizeof(length)))
+                return false;
+            if (length == 0xffff)
+                break;
+            write_offset_ += record_size(length);
+        }
+        if (write_offset_ > sector_size)
+            write_offset_ = sector_size;
+
+        mounted_ = true;
+        return true;
+    }
+
+    // @brief Appends a record, starting a new sector if it doesn't fit into
+    // the current one. This drops the oldest sector once all are in use.
+    bool append(uint8_t type, uint8_t source, uint32_t timestamp, const uint8_t* payload, size_t length) {
+        if (!mounted_ || length > max_payload)
+            return false;
+        if (write_offset_ + record_size(length) > sector_size && !start_sector(seq_ + 1))
+            return false;
+
+        RecordHeader_t header = {
+            .length = (uint16_t)length,
+            .crc16 = 0,
+            .timestamp = timestamp,
+            .type = type,
+            .source = source,
+            .reserved = 0xffff,
+        };
+        header.crc16 = record_crc(header, payload, length);
+
+        // The header goes first, so an interrupted write fails the CRC
+        // instead of being overwritten by the next record.
+        uint32_t addr = current_ * sector_size + write_offset_;
+        write_offset_ += record_size(length);
+        return flash_.program(addr, (const uint8_t*)&header, sizeof(header))
+            && (!length || flash_.program(addr + sizeof(header), payload, length));
+    }
+
+    // @brief Reads from the readable sectors as if they were one buffer,
+    // oldest first
+    // @param offset: [bytes] must be within readable_size()
+    bool read(uint32_t offset, uint8_t* data, size_t length) {
+        if (!mounted_ || offset + length > readable_size())
+            return false;
+        while (length) {
+            uint32_t sector = (oldest_ + offset / sector_size) % num_sectors_;
+            size_t in_sector = offset % sector_size;
+            size_t chunk = length < sector_size - in_sector ? length : sector_size - in_sector;
+            if (!flash_.read(sector * sector_size + in_sector, data, chunk))
+                return false;
+            offset += chunk;
+            data += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    // @brief Drops all records. Only the next sector is erased, the others
+    // are no longer readable because of their seq.
+    bool clear() {
+        if (!mounted_)
+            return false;
+        num_readable_ = 0;
+        return start_sector(seq_ + num_sectors_);
+    }
+
+    // @brief [bytes] of the readable sectors up to the end of the last record
+    size_t readable_size() const {
+        return num_readable_ ? (num_readable_ - 1) * sector_size + write_offset_ : 0;
+    }
+
+    size_t capacity() const { return num_sectors_ * sector_size; }
+    bool mounted() const { return mounted_; }
+
+    static uint16_t record_crc(const RecordHeader_t& header, const uint8_t* payload, size_t length) {
+        uint16_t crc16 = calc_crc16<crc16_polynomial>(crc16_init, (const uint8_t*)&header.timestamp,
+                                                      sizeof(header) - offsetof(RecordHeader_t, timestamp));
+        return calc_crc16<crc16_polynomial>(crc16, payload, length);
+    }
+
+    static size_t record_size(size_t length) {
+        return (sizeof(RecordHeader_t) + length + 3) & ~(size_t)3;
+    }
+
+private:
+    bool read_header(uint32_t sector, SectorHeader_t* header) {
+        return flash_.read(sector * sector_size, (uint8_t*)header, sizeof(*header));
+    }
+
+    bool start_sector(uint32_t seq) {
+        uint32_t next = (current_ + 1) % num_sectors_;
+        if (!num_readable_) {
+            oldest_ = next;
+            num_readable_ = 1;
+        } else if (num_readable_ == num_sectors_) {
+            oldest_ = (oldest_ + 1) % num_sectors_; // the oldest sector is about to be erased
+        } else {
+            ++num_readable_;
+        }
+
+        current_ = next;
+        seq_ = seq;
+        write_offset_ = sector_size; // full until the header is written
+        SectorHeader_t header = {.magic = sector_magic, .seq = seq};
+        if (!flash_.erase_sector(current_ * sector_size)
+            || !flash_.program(current_ * sector_size, (const uint8_t*)&header, sizeof(header)))
+            return false;
+        write_offset_ = sizeof(SectorHeader_t);
+        return true;
+    }
+
+    TFlash& flash_;
+    bool mounted_ = false;
+    uint32_t num_sectors_ = 0;
+    uint32_t current_ = 0; // sector that is appended to
+    uint32_t seq_ = 0; // of the current sector
+    size_t write_offset_ = sector_size; // [bytes] end of the last record in the current sector
+    uint32_t oldest_ = 0; // first readable sector
+    uint32_t num_readable_ = 0; // [sectors] including the current one
+};
+
+#endif // __LOG_STORAGE_HPP
@@ -0,0 +1,188 @@
+#ifndef __LOOP_ANALYSIS_HPP
+#define __LOOP_ANALYSIS_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+// Consistency check of the configured gains and bandwidths of the cascaded
+// loops, see Controller::analyze_tuning().
+//
+// The velocity loop is the PI controller on the inertia,
+//   L(s) = (vel_gain + vel_integrator_gain / s) / (inertia * s) * Hc(s) * He(s) * exp(-s * delay)
+// where Hc is the current loop, approximated by a first order lag at its
+// bandwidth, He the velocity estimate of the encoder PLL or tracking
+// observer, and the delay 1.5 control periods from the sampling of the
+// velocity to the middle of the PWM period. The position loop is pos_gain / s
+// on the closed velocity loop. Each inner loop should be several times faster
+// than the one around it, otherwise its lag eats the phase margin of the
+// outer loop.
+enum : uint32_t {
+    // Same bits as Controller::TuningWarning
+    LOOP_ANALYSIS_INERTIA_UNKNOWN = 1u << 0,
+    LOOP_ANALYSIS_ENCODER_TOO_SLOW = 1u << 1,
+    LOOP_ANALYSIS_CURRENT_LOOP_TOO_SLOW = 1u << 2,
+    LOOP_ANALYSIS_POS_LOOP_TOO_FAST = 1u << 3,
+    LOOP_ANALYSIS_LOW_PHASE_MARGIN = 1u << 4,
+    LOOP_ANALYSIS_UNSTABLE = 1u << 5,
+    LOOP_ANALYSIS_ENCODER_UNSTABLE_GAIN = 1u << 6,
+};
+
+struct LoopAnalysisInput_t {
+    float inertia;             // [Nm/(turn/s^2)] 0 if unknown
+    float vel_gain;            // [Nm/(turn/s)]
+    float vel_integrator_gain; // [Nm/turn]
+    float pos_gain;            // [(turn/s)/turn]
+    float encoder_bandwidth;   // [rad/s]
+    bool tracking_observer;    // third order velocity estimate instead of the PLL
+    float current_bandwidth;   // [rad/s]
+    float control_period;      // [s] of the velocity loop
+    float current_meas_period; // [s] of the encoder PLL
+};
+
+struct LoopAnalysis_t {
+    float vel_crossover = 0.0f;    // [rad/s] 0 if unknown
+    float vel_phase_margin = 0.0f; // [deg]
+    float pos_crossover = 0.0f;    // [rad/s] 0 if unknown or no position gain
+    float pos_phase_margin = 0.0f; // [deg]
+    float encoder_ratio = 0.0f;    // encoder bandwidth over the velocity crossover
+    float current_ratio = 0.0f;    // current loop bandwidth over the velocity crossover
+    float pos_ratio = 0.0f;        // velocity crossover over the position crossover
+    uint32_t warnings = 0;
+};
+
+class LoopAnalyzer {
+public:
+    static constexpr float min_encoder_ratio = 4.0f;
+    static constexpr float min_current_ratio = 5.0f;
+    static constexpr float min_pos_ratio = 3.0f;
+    static constexpr float min_phase_margin = 30.0f; // [deg]
+
+    explicit LoopAnalyzer(const LoopAnalysisInput_t& in) : in_(in) {}
+
+    LoopAnalysis_t analyze() const {
+        LoopAnalysis_t result;
+        float kp = (in_.tracking_observer ? 3.0f : 2.0f) * in_.encoder_bandwidth;
+        if (!(in_.current_meas_period * kp < 1.0f))
+            result.warnings |= LOOP_ANALYSIS_ENCODER_UNSTABLE_GAIN;
+        if (!(in_.inertia > 0.0f) || !(in_.vel_gain > 0.0f) || !(in_.control_period > 0.0f)) {
+            result.warnings |= LOOP_ANALYSIS_INERTIA_UNKNOWN;
+            return result;
+        }
+
+        // Up to the Nyquist frequency of the velocity loop
+        const float w_max = 3.14159265f / in_.control_period;
+        float wc = crossover([this](float w) { return vel_open_loop(w); }, w_max);
+        if (wc == 0.0f) {
+            result.warnings |= LOOP_ANALYSIS_UNSTABLE;
+            return result;
+        }
+        result.vel_crossover = wc;
+        result.vel_phase_margin = 180.0f + vel_phase(wc) * rad_to_deg;
+        result.encoder_ratio = in_.encoder_bandwidth / wc;
+        result.current_ratio = in_.current_bandwidth / wc;
+        // A bandwidth of 0 stands for an ideal loop, e.g. the voltage
+        // control of a gimbal motor
+        if (in_.encoder_bandwidth > 0.0f && result.encoder_ratio < min_encoder_ratio)
+            result.warnings |= LOOP_ANALYSIS_ENCODER_TOO_SLOW;
+        if (in_.current_bandwidth > 0.0f && result.current_ratio < min_current_ratio)
+            result.warnings |= LOOP_ANALYSIS_CURRENT_LOOP_TOO_SLOW;
+
+        if (in_.pos_gain > 0.0f) {
+            float wp = crossover([this](float w) { return pos_open_loop(w); }, w_max);
+            if (wp == 0.0f) {
+                result.warnings |= LOOP_ANALYSIS_UNSTABLE;
+            } else {
+                result.pos_crossover = wp;
+                result.pos_phase_margin = 180.0f + std::arg(pos_open_loop(wp)) * rad_to_deg;
+                result.pos_ratio = wc / wp;
+                if (result.pos_ratio < min_pos_ratio)
+                    result.warnings |= LOOP_ANALYSIS_POS_LOOP_TOO_FAST;
+            }
+        }
+
+        float pm = std::min(result.vel_phase_margin, in_.pos_gain > 0.0f ? result.pos_phase_margin : 180.0f);
+        if (pm <= 0.0f)
+            result.warnings |= LOOP_ANALYSIS_UNSTABLE;
+        else if (pm < min_phase_margin)
+            result.warnings |= LOOP_ANALYSIS_LOW_PHASE_MARGIN;
+        return result;
+    }
+
+    // @brief Velocity loop L(jw)
+    std::complex<float> vel_open_loop(float w) const {
+        const std::complex<float> s(0.0f, w);
+        float gain = std::abs(controller(s) * plant(s) * current(s) * encoder_num(s))
+                   / std::pow(std::abs(encoder_pole(s)), (float)encoder_order());
+        return std::polar(gain, vel_phase(w));
+    }
+
+    // @brief Phase of L(jw) [rad], not wrapped to +-pi
+    float vel_phase(float w) const {
+        const std::complex<float> s(0.0f, w);
+        float delay = 1.5f * in_.control_period;
+        return std::arg(controller(s) * plant(s)) + std::arg(current(s))
+             + std::arg(encoder_num(s)) - (float)encoder_order() * std::arg(encoder_pole(s))
+             - w * delay;
+    }
+
+    // @brief Position loop on the closed velocity loop
+    std::complex<float> pos_open_loop(float w) const {
+        std::complex<float> l = vel_open_loop(w);
+        return in_.pos_gain / std::complex<float>(0.0f, w) * (l / (1.0f + l));
+    }
+
+private:
+    static constexpr float rad_to_deg = 180.0f / 3.14159265f;
+
+    std::complex<float> controller(std::complex<float> s) const { return in_.vel_gain + in_.vel_integrator_gain / s; }
+    std::complex<float> plant(std::complex<float> s) const { return 1.0f / (in_.inertia * s); }
+    std::complex<float> current(std::complex<float> s) const {
+        return in_.current_bandwidth > 0.0f ? 1.0f / (1.0f + s / in_.current_bandwidth) : 1.0f;
+    }
+
+    // Velocity estimate over the actual velocity, encoder_num(s) /
+    // encoder_pole(s)^encoder_order() with a double (PLL) or triple (tracking
+    // observer) pole at -bandwidth. The phase of each factor is within +-pi,
+    // so their sum doesn't wrap.
+    int encoder_order() const { return in_.encoder_bandwidth > 0.0f ? (in_.tracking_observer ? 3 : 2) : 0; }
+    std::complex<float> encoder_num(std::complex<float> s) const {
+        float b = in_.encoder_bandwidth;
+        if (!(b > 0.0f))
+            return 1.0f;
+        if (in_.tracking_observer)
+            return 3.0f * b * s * s + 3.0f * b * b * s + b * b * b;
+        return 2.0f * b * s + b * b;
+    }
+    std::complex<float> encoder_pole(std::complex<float> s) const { return s + in_.encoder_bandwidth; }
+
+    // @brief Lowest frequency of the logarithmic sweep at which the open loop
+    // gain drops below 1, refined by bisection
+    // @returns 0 if the gain stays above 1 up to w_max
+    template<typename TOpenLoop>
+    static float crossover(TOpenLoop open_loop, float w_max) {
+        constexpr int steps = 96;
+        const float w_min = 1e-5f * w_max;
+        const float k = std::pow(w_max / w_min, 1.0f / steps);
+        float lo = w_min;
+        if (std::abs(open_loop(lo)) < 1.0f)
+            return lo;
+        for (int i = 0; i < steps; ++i) {
+            float hi = lo * k;
+            if (std::abs(open_loop(hi)) < 1.0f) {
+                for (int j = 0; j < 20; ++j) {
+                    float mid = std::sqrt(lo * hi);
+                    (std::abs(open_loop(mid)) < 1.0f ? hi : lo) = mid;
+                }
+                return std::sqrt(lo * hi);
+            }
+            lo = hi;
+        }
+        return 0.0f;
+    }
+
+    LoopAnalysisInput_t in_;
+};
+
+#endif // __LOOP_ANALYSIS_HPP
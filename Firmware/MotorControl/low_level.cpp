@@ -15,6 +15,9 @@
 #include <utils.hpp>
 
 #include "odrive_main.h"
+#include "dc_bus_regulator.hpp"
+#include "adc_scan_sequence.hpp"
+#include "endpoint_setter.hpp"
 
 /* Private defines -----------------------------------------------------------*/
 
@@ -30,11 +33,20 @@ constexpr float adc_ref_voltage = 3.3f;
 // This value is updated by the DC-bus reading ADC.
 // Arbitrary non-zero inital value to avoid division by zero if ADC reading is late
 float vbus_voltage = 12.0f;
+float vbus_voltage_raw = 12.0f;
+float vbus_ripple = 0.0f;
+float vbus_min = INFINITY;
+float vbus_max = 0.0f;
+static uint32_t vbus_oversampling = 1; // injected conversions per trigger
+static float vbus_ripple_ms = 0.0f; // [V^2] mean square of vbus_voltage_raw - vbus_voltage
 float ibus_ = 0.0f; // exposed for monitoring only
 bool task_timers_armed = false;
 bool brake_resistor_armed = false;
 bool brake_resistor_saturated = false;
+float dc_bus_regen_scale = 1.0f;
+static DcBusVoltageRegulator dc_bus_regulator;
 /* Private constant data -----------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
 /* CPU critical section helpers ----------------------------------------------*/
 
 /* Safety critical functions -------------------------------------------------*/
@@ -82,6 +94,7 @@ void low_level_fault(Motor::Error error) {
     }
 
     safety_critical_disarm_brake_resistor();
+    odrv.crash_snapshot_.capture(CrashSnapshot::CAUSE_LOW_LEVEL_FAULT, error);
 }
 
 // @brief Kicks off the arming process of the motor.
@@ -106,6 +119,8 @@ bool safety_critical_disarm_motor_pwm(Motor& motor) {
     motor.armed_state_ = Motor::ARMED_STATE_DISARMED;
     __HAL_TIM_MOE_DISABLE_UNCONDITIONALLY(motor.timer_);
     cpu_exit_critical(mask);
+    if (was_armed)
+        odrv.event_trace_.record(EventTrace::EVENT_TYPE_MOTOR_DISARMED, motor.axis_->axis_num_, 0, 0);
     return was_armed;
 }
 
@@ -114,7 +129,7 @@ bool safety_critical_disarm_motor_pwm(Motor& motor) {
 // If this is called at a rate higher than the motor's timer period,
 // the actual PMW timings on the pins can be undefined for up to one
 // timer period.
-void safety_critical_apply_motor_pwm_timings(Motor& motor, uint16_t timings[3]) {
+HOT_FUNCTION void safety_critical_apply_motor_pwm_timings(Motor& motor, uint16_t timings[3]) {
     uint32_t mask = cpu_enter_critical();
     if (!brake_resistor_armed) {
         motor.armed_state_ = Motor::ARMED_STATE_DISARMED;
@@ -135,6 +150,7 @@ void safety_critical_apply_motor_pwm_timings(Motor& motor, uint16_t timings[3])
         // enable the actual PWM outputs.
         motor.armed_state_ = Motor::ARMED_STATE_ARMED;
         __HAL_TIM_MOE_ENABLE(motor.timer_);  // enable pwm outputs
+        odrv.event_trace_.record(EventTrace::EVENT_TYPE_MOTOR_ARMED, motor.axis_->axis_num_, 0, 0);
     } else if (motor.armed_state_ == Motor::ARMED_STATE_ARMED) {
         // nothing to do, PWM is running, all good
     } else {
@@ -214,8 +230,8 @@ void start_adc_pwm() {
     __HAL_ADC_ENABLE(&hadc1);
     __HAL_ADC_ENABLE(&hadc2);
     __HAL_ADC_ENABLE(&hadc3);
-    // Warp field stabilize.
-    osDelay(2);
+    // Wait for the ADC stabilization time (t_STAB, 3us max)
+    delay_us(10);
     __HAL_ADC_CLEAR_FLAG(&hadc1, ADC_FLAG_JEOC);
     __HAL_ADC_CLEAR_FLAG(&hadc2, ADC_FLAG_JEOC);
     __HAL_ADC_CLEAR_FLAG(&hadc3, ADC_FLAG_JEOC);
@@ -248,31 +264,70 @@ void start_adc_pwm() {
 }
 
 // @brief ADC1 measurements are written to this buffer by DMA
-uint16_t adc_measurements_[ADC_CHANNEL_COUNT] = { 0 };
+uint16_t adc_measurements_[ADC_CHANNEL_COUNT] = { 0 }; // in the order of adc_sequence
+static AdcScanSequence adc_sequence;
+
+// @brief Collects the ADC1 channels that are in use with their sampling times.
+// Only the configuration at boot is taken into account.
+static void build_adc_sequence() {
+    const BoardConfig_t& config = odrv.config_;
+    adc_sequence.clear();
+
+    if (config.adc_scan_all_channels) {
+        for (uint32_t channel = 0; channel < ADC_CHANNEL_COUNT; ++channel)
+            adc_sequence.add(channel, config.adc_sample_cycles_analog_in);
+    }
+
+    for (size_t i = 0; i < GPIO_COUNT; ++i) {
+        if (config.gpio_modes[i] == ODriveIntf::GPIO_MODE_ANALOG_IN ||
+            fibre::is_endpoint_ref_valid(config.analog_mappings[i].endpoint))
+            adc_sequence.add(channel_from_gpio(get_gpio(i)), config.adc_sample_cycles_analog_in);
+    }
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        adc_sequence.add(motors[i].fet_thermistor_.adc_channel_, config.adc_sample_cycles_thermistor);
+        if (motors[i].motor_thermistor_.config_.enabled)
+            adc_sequence.add(motors[i].motor_thermistor_.adc_channel_, config.adc_sample_cycles_thermistor);
+        if (encoders[i].config_.mode == Encoder::MODE_SINCOS) {
+            adc_sequence.add(channel_from_gpio(get_gpio(encoders[i].config_.sincos_gpio_pin_sin)), config.adc_sample_cycles_sincos);
+            adc_sequence.add(channel_from_gpio(get_gpio(encoders[i].config_.sincos_gpio_pin_cos)), config.adc_sample_cycles_sincos);
+        }
+    }
+}
 
 // @brief Starts the general purpose ADC on the ADC1 peripheral.
 // The measured ADC voltages can be read with get_adc_voltage().
 //
-// ADC1 is set up to continuously sample all channels 0 to 15 in a
-// round-robin fashion.
+// ADC1 samples the channels that are in use (see build_adc_sequence()) in a
+// round-robin fashion, either continuously or once per TIM8 update event if
+// config.adc_scan_sync_to_pwm is set.
 // DMA is used to copy the measured 12-bit values to adc_measurements_.
 //
-// The injected (high priority) channel of ADC1 is used to sample vbus_voltage.
-// This conversion is triggered by TIM1 at the frequency of the motor control loop.
+// The injected (high priority) channels of ADC1 are used to sample vbus_voltage,
+// config.vbus_oversampling times back to back. This sequence is triggered by TIM1
+// at the frequency of the motor control loop.
 void start_general_purpose_adc() {
     ADC_ChannelConfTypeDef sConfig;
+    ADC_InjectionConfTypeDef sConfigInjected;
+
+    build_adc_sequence();
+    // The ADC needs at least one regular conversion, the vbus channel is
+    // the cheapest one to add
+    if (!adc_sequence.size())
+        adc_sequence.add(ADC_CHANNEL_6, 3);
+    const bool sync = odrv.config_.adc_scan_sync_to_pwm;
 
     // Configure the global features of the ADC (Clock, Resolution, Data Alignment and number of conversion)
     hadc1.Instance = ADC1;
     hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
     hadc1.Init.Resolution = ADC_RESOLUTION_12B;
     hadc1.Init.ScanConvMode = ENABLE;
-    hadc1.Init.ContinuousConvMode = ENABLE;
+    hadc1.Init.ContinuousConvMode = sync ? DISABLE : ENABLE;
     hadc1.Init.DiscontinuousConvMode = DISABLE;
-    hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
-    hadc1.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+    hadc1.Init.ExternalTrigConvEdge = sync ? ADC_EXTERNALTRIGCONVEDGE_RISING : ADC_EXTERNALTRIGCONVEDGE_NONE;
+    hadc1.Init.ExternalTrigConv = sync ? ADC_EXTERNALTRIGCONV_T8_TRGO : ADC_SOFTWARE_START;
     hadc1.Init.DataAlign = ADC_DATAALIGN_RIGHT;
-    hadc1.Init.NbrOfConversion = ADC_CHANNEL_COUNT;
+    hadc1.Init.NbrOfConversion = adc_sequence.size();
     hadc1.Init.DMAContinuousRequests = ENABLE;
     hadc1.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
     if (HAL_ADC_Init(&hadc1) != HAL_OK) {
@@ -280,37 +335,57 @@ void start_general_purpose_adc() {
         return;
     }
 
-    // Set up sampling sequence (channel 0 ... channel 15)
-    sConfig.SamplingTime = ADC_SAMPLETIME_15CYCLES;
-    for (uint32_t channel = 0; channel < ADC_CHANNEL_COUNT; ++channel) {
+    // Set up sampling sequence. The HAL ADC_SAMPLETIME_x values are the SMPx codes.
+    for (size_t rank = 0; rank < adc_sequence.size(); ++rank) {
+        uint32_t channel = adc_sequence.channel(rank);
         sConfig.Channel = channel << ADC_CR1_AWDCH_Pos;
-        sConfig.Rank = channel + 1; // rank numbering starts at 1
+        sConfig.Rank = rank + 1; // rank numbering starts at 1
+        sConfig.SamplingTime = adc_sequence.sample_code_of(channel);
         if (HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK) {
             odrv.misconfigured_ = true; // TODO: this is a bit of an abuse of this flag
             return;
         }
     }
 
-    HAL_ADC_Start_DMA(&hadc1, reinterpret_cast<uint32_t*>(adc_measurements_), ADC_CHANNEL_COUNT);
+    // Injected sequence of the vbus channel, the trigger is as in MX_ADC1_Init()
+    vbus_oversampling = std::clamp<uint32_t>(odrv.config_.vbus_oversampling, 1, 4);
+    for (uint32_t rank = 1; rank <= vbus_oversampling; ++rank) {
+        sConfigInjected.InjectedChannel = ADC_CHANNEL_6;
+        sConfigInjected.InjectedRank = rank;
+        sConfigInjected.InjectedNbrOfConversion = vbus_oversampling;
+        sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_3CYCLES;
+        sConfigInjected.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONVEDGE_RISING;
+        sConfigInjected.ExternalTrigInjecConv = ADC_EXTERNALTRIGINJECCONV_T1_TRGO;
+        sConfigInjected.AutoInjectedConv = DISABLE;
+        sConfigInjected.InjectedDiscontinuousConvMode = DISABLE;
+        sConfigInjected.InjectedOffset = 0;
+        if (HAL_ADCEx_InjectedConfigChannel(&hadc1, &sConfigInjected) != HAL_OK) {
+            odrv.misconfigured_ = true; // TODO: this is a bit of an abuse of this flag
+            return;
+        }
+    }
+
+    HAL_ADC_Start_DMA(&hadc1, reinterpret_cast<uint32_t*>(adc_measurements_), adc_sequence.size());
 }
 
 // @brief Returns the ADC voltage associated with the specified pin.
 // This only works if the GPIO was not used for anything else since bootup, otherwise
 // it must be put to analog mode first.
-// Returns -1.0f if the pin has no associated ADC1 channel.
+// Returns -1.0f if the pin has no associated ADC1 channel or if the channel
+// is not part of the scan sequence.
 //
 // On ODrive 3.3 and 3.4 the following pins can be used with this function:
 //  GPIO_1, GPIO_2, GPIO_3, GPIO_4 and some pins that are connected to
 //  on-board sensors (M0_TEMP, M1_TEMP, AUX_TEMP)
 //
-// The ADC values are sampled in background at ~30kHz without
-// any CPU involvement.
+// The ADC values are sampled in background without any CPU involvement.
 //
-// Details: each of the 16 conversion takes (15+26) ADC clock
-// cycles and the ADC, so the update rate of the entire sequence is:
-//  21000kHz / (15+26) / 16 = 32kHz
-// The true frequency is slightly lower because of the injected vbus
-// measurements
+// Details: each conversion takes its sampling time plus 12 ADC clock
+// cycles, so in continuous mode the update rate of the entire sequence is:
+//  21000kHz / adc_sequence.scan_cycles()
+// e.g. 21000kHz / (15+12) / 4 = 194kHz for two sincos channels and two
+// analog inputs. The true frequency is slightly lower because of the
+// injected vbus measurements.
 float get_adc_voltage(Stm32Gpio gpio) {
     return get_adc_relative_voltage(gpio) * adc_ref_voltage;
 }
@@ -366,8 +441,9 @@ uint16_t channel_from_gpio(Stm32Gpio gpio) {
 // @brief Given an adc channel return the voltage as a ratio of adc_ref_voltage
 // returns -1.0f if the channel is not valid.
 float get_adc_relative_voltage_ch(uint16_t channel) {
-    if (channel < ADC_CHANNEL_COUNT)
-        return (float)adc_measurements_[channel] / adc_full_scale;
+    int rank = adc_sequence.rank_of(channel);
+    if (rank >= 0)
+        return (float)adc_measurements_[rank] / adc_full_scale;
     else
         return -1.0f;
 }
@@ -376,34 +452,57 @@ float get_adc_relative_voltage_ch(uint16_t channel) {
 // IRQ Callbacks
 //--------------------------------
 
+// @brief Averages the oversampled vbus conversions and filters them into
+// vbus_voltage. The overvoltage fast trip is checked on the unfiltered value,
+// the other checks use the filtered one.
 void vbus_sense_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
     constexpr float voltage_scale = adc_ref_voltage * VBUS_S_DIVIDER_RATIO / adc_full_scale;
-    // Only one conversion in sequence, so only rank1
-    uint32_t ADCValue = HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1);
-    vbus_voltage = ADCValue * voltage_scale;
+    static const uint32_t ranks[] = {ADC_INJECTED_RANK_1, ADC_INJECTED_RANK_2, ADC_INJECTED_RANK_3, ADC_INJECTED_RANK_4};
+    uint32_t ADCValue = 0;
+    for (uint32_t i = 0; i < vbus_oversampling; ++i)
+        ADCValue += HAL_ADCEx_InjectedGetValue(hadc, ranks[i]);
+    float vbus_raw = (float)ADCValue * (voltage_scale / (float)vbus_oversampling);
+
+    vbus_voltage_raw = vbus_raw;
+    vbus_voltage += odrv.config_.vbus_filter_k * (vbus_raw - vbus_voltage);
+    vbus_ripple_ms += 0.001f * (SQ(vbus_raw - vbus_voltage) - vbus_ripple_ms);
+    vbus_ripple = std::sqrt(vbus_ripple_ms);
+    vbus_min = std::min(vbus_min, vbus_raw);
+    vbus_max = std::max(vbus_max, vbus_raw);
+
+    if (vbus_raw > odrv.config_.dc_bus_overvoltage_trip_level + odrv.config_.dc_bus_overvoltage_fast_trip_margin) {
+        // Stop the motors from regenerating, the brake resistor stays armed
+        for (size_t i = 0; i < AXIS_COUNT; ++i) {
+            if (safety_critical_disarm_motor_pwm(axes[i].motor_))
+                axes[i].motor_.error_ |= Motor::ERROR_DC_BUS_OVER_VOLTAGE;
+        }
+    }
 }
 
 // This is the callback from the ADC that we expect after the PWM has triggered an ADC conversion.
 // Timing diagram: Firmware/timing_diagram_v3.png
-void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
-
-    adc_timestamp = sample_TIM13();
-#define calib_tau 0.2f  //@TOTO make more easily configurable
-    constexpr float calib_filter_k = CURRENT_MEAS_PERIOD / calib_tau;
+HOT_FUNCTION void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
 
+    adc_timestamp = sample_task_timer();
+#ifdef TASK_TIMER_DWT
+    // Reference for Motor::log_timing: the cycle count at the last TIM13 reload
+    period_start_cycles = adc_timestamp - sample_TIM13();
+#endif
     // Ensure ADCs are expected ones to simplify the logic below
     if (!(hadc == &hadc2 || hadc == &hadc3)) {
         low_level_fault(Motor::ERROR_ADC_FAILED);
         return;
     };
 
-    // Motor 0 is on Timer 1, which triggers ADC 2 and 3 on an injected conversion
-    // Motor 1 is on Timer 8, which triggers ADC 2 and 3 on a regular conversion
+    // Each axis timer triggers ADC 2 and 3 on its own conversion, see axis_schedule
     // If the corresponding timer is counting up, we just sampled in SVM vector 0, i.e. real current
     // If we are counting down, we just sampled in SVM vector 7, with zero current
-    Axis& axis = injected ? axes[0] : axes[1];
-    int axis_num = injected ? 0 : 1;
-    Axis& other_axis = injected ? axes[1] : axes[0];
+    constexpr size_t injected_axis = axis_for_adc_trigger(axis_schedule, true);
+    constexpr size_t regular_axis = axis_for_adc_trigger(axis_schedule, false);
+    static_assert(injected_axis < AXIS_COUNT && regular_axis < AXIS_COUNT, "both ADC triggers must sample an axis");
+    size_t axis_num = injected ? injected_axis : regular_axis;
+    Axis& axis = axes[axis_num];
+    const AxisSchedule_t& schedule = axis_schedule[axis_num];
     bool counting_down = axis.motor_.timer_->Instance->CR1 & TIM_CR1_DIR;
     bool current_meas_not_DC_CAL = !counting_down;
 
@@ -415,39 +514,34 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
         axis.motor_.log_timing(TIMING_LOG_ADC_CB_DC);
     }
 
-    bool update_timings = false;
-    if (hadc == &hadc2) {
-        if (&axis == &axes[1] && counting_down)
-            update_timings = true; // update timings of M0
-        else if (&axis == &axes[0] && !counting_down)
-            update_timings = true; // update timings of M1
-
-        // TODO: this is out of place here. However when moving it somewhere
-        // else we have to consider the timing requirements to prevent the SPI
-        // transfers of axis0 and axis1 from conflicting.
-        // Also see comment on sync_timers.
-        if((current_meas_not_DC_CAL && !axis_num) ||
-                (axis_num && !current_meas_not_DC_CAL)){
-            axis.encoder_.abs_spi_start_transaction();
-        }
-    }
-
-    // Load next timings for the motor that we're not currently sampling
-    if (update_timings) {
+    // Each axis owns a time slot starting at one of the two ADC events per PWM
+    // period (see axis_schedule), so the encoder reads of the axes are spread
+    // over the period. Other SPI traffic (e.g. the gate drivers) only runs in
+    // the slack after a slot's transfer (see Stm32SpiArbiter::transfer_in_slot).
+    // Also see comment on sync_timers.
+    bool slot_start = hadc == &hadc2 && counting_down == schedule.slot_counting_down;
+    if (slot_start) {
+        axis.encoder_.abs_spi_start_transaction();
+
+        // Load the next timings of the motor whose control loop had until this slot
+        Axis& other_axis = axes[schedule.timings_axis];
         if (!other_axis.motor_.next_timings_valid_) {
             // the motor control loop failed to update the timings in time
             // we must assume that it died and therefore float all phases
             bool was_armed = safety_critical_disarm_motor_pwm(other_axis.motor_);
             if (was_armed) {
                 other_axis.motor_.error_ |= Motor::ERROR_CONTROL_DEADLINE_MISSED;
+                ++other_axis.motor_.deadline_monitor_.deadline_misses;
             }
         } else {
+            other_axis.motor_.record_deadline_slack(adc_timestamp);
             other_axis.motor_.next_timings_valid_ = false;
             safety_critical_apply_motor_pwm_timings(
                 other_axis.motor_, other_axis.motor_.next_timings_
             );
         }
-        update_brake_current();
+        // Runs once per slot, i.e. once for each motor
+        update_brake_current(current_meas_period / AXIS_COUNT);
     }
 
     uint32_t ADCValue;
@@ -463,12 +557,15 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
         if (task_timers_armed) {
             TaskTimer::sample_next = true;
             task_timers_armed = false;
-            axes[0].task_times_.adc_cb.startTime = adc_timestamp; // Start of ADC2
         }
     }
 
-    if(current_meas_not_DC_CAL && axis_num == 0 && hadc == &hadc3){
-        axes[0].task_times_.adc_cb.stopTimer(); // End of ADC3
+    if (current_meas_not_DC_CAL && hadc == &hadc2) {
+        axis.task_times_.adc_cb.startTime = adc_timestamp; // Start of ADC2
+    }
+
+    if (current_meas_not_DC_CAL && hadc == &hadc3) {
+        axis.task_times_.adc_cb.stopTimer(); // End of ADC3
     }
 
     if (current_meas_not_DC_CAL) {
@@ -480,35 +577,67 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
 
         // return or continue
         if (hadc == &hadc2) {
-            axis.motor_.current_meas_.phB = current - axis.motor_.DC_calib_.phB;
+            axis.motor_.current_meas_.phB = (current - axis.motor_.DC_calib_.phB) * axis.motor_.config_.current_sense_gain_phB;
             return;
         } else {
-            axis.motor_.current_meas_.phC = current - axis.motor_.DC_calib_.phC;
+            axis.motor_.current_meas_.phC = (current - axis.motor_.DC_calib_.phC) * axis.motor_.config_.current_sense_gain_phC;
         }
+        // ODrive v3 has no phase A shunt (see CURRENT_SENSE_PHASE_A in board.h)
+#ifdef CURRENT_SENSE_PHASE_A
+        axis.motor_.reconstruct_phase_currents(true);
+#else
+        axis.motor_.reconstruct_phase_currents(false);
+#endif
         // Prepare hall readings
         // TODO move this to inside encoder update function
         axis.encoder_.decode_hall_samples();
+        // Run the current loop right here if configured to do so
+        axis.motor_.current_meas_isr_update();
         // Trigger axis thread
         axis.signal_current_meas();
     } else {
-        // DC_CAL measurement
+        // DC_CAL measurement: the mean of the first dc_calib_startup_samples,
+        // then a low-pass with the time constant dc_calib_tau that tracks drift
+        uint32_t n = axis.motor_.dc_calib_samples_;
+        float dc_calib_k;
+        if (n < odrv.config_.dc_calib_startup_samples) {
+            dc_calib_k = 1.0f / (float)(n + 1);
+        } else {
+            float tau = odrv.config_.dc_calib_tau;
+            dc_calib_k = (tau > CURRENT_MEAS_PERIOD) ? (CURRENT_MEAS_PERIOD / tau) : 1.0f;
+        }
         if (hadc == &hadc2) {
-            axis.motor_.DC_calib_.phB += (current - axis.motor_.DC_calib_.phB) * calib_filter_k;
+            axis.motor_.DC_calib_.phB += (current - axis.motor_.DC_calib_.phB) * dc_calib_k;
         } else {
-            axis.motor_.DC_calib_.phC += (current - axis.motor_.DC_calib_.phC) * calib_filter_k;
+            axis.motor_.DC_calib_.phC += (current - axis.motor_.DC_calib_.phC) * dc_calib_k;
+            if (n < odrv.config_.dc_calib_startup_samples)
+                axis.motor_.dc_calib_samples_ = n + 1;
         }
     }
 }
 
+// @brief True once the startup averaging of the DC offsets is done on all motors
+bool dc_calib_settled() {
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (motors[i].dc_calib_samples_ < odrv.config_.dc_calib_startup_samples)
+            return false;
+    }
+    return true;
+}
+
 // @brief Sums up the Ibus contribution of each motor and updates the
 // brake resistor PWM accordingly.
-void update_brake_current() {
-    axes[0].task_times_.brake_update.beginTimer();
-    axes[1].task_times_.brake_update.beginTimer();
+// @param dt: Time since the last call from the current measurement interrupt,
+// 0 for calls from elsewhere, which don't advance the DC bus voltage regulator
+void update_brake_current(float dt) {
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        axes[i].task_times_.brake_update.beginTimer();
     float Ibus_sum = 0.0f;
+    size_t num_armed = 0;
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         if (axes[i].motor_.armed_state_ == Motor::ARMED_STATE_ARMED) {
             Ibus_sum += axes[i].motor_.current_control_.Ibus;
+            ++num_armed;
         }
     }
     
@@ -520,6 +649,25 @@ void update_brake_current() {
         brake_duty += std::max((vbus_voltage - odrv.config_.dc_bus_overvoltage_ramp_start) / (odrv.config_.dc_bus_overvoltage_ramp_end - odrv.config_.dc_bus_overvoltage_ramp_start), 0.0f);
     }
 
+    if (odrv.config_.enable_dc_bus_voltage_regulator && (odrv.config_.brake_resistance > 0.0f) && !is_nan(brake_duty)) {
+        DcBusVoltageRegulator::Config_t config = {
+            .setpoint = odrv.config_.dc_bus_voltage_regulator_setpoint,
+            .p_gain = odrv.config_.dc_bus_voltage_regulator_p_gain,
+            .i_gain = odrv.config_.dc_bus_voltage_regulator_i_gain,
+            .trip_level = odrv.config_.dc_bus_overvoltage_trip_level,
+            .max_duty = 0.95f
+        };
+        if (dt > 0.0f) {
+            brake_duty = dc_bus_regulator.update(config, vbus_voltage, brake_duty, dt);
+            dc_bus_regen_scale = dc_bus_regulator.regen_scale();
+        } else {
+            brake_duty += dc_bus_regulator.correction(config, vbus_voltage);
+        }
+    } else {
+        dc_bus_regulator.reset();
+        dc_bus_regen_scale = 1.0f;
+    }
+
     if (is_nan(brake_duty)) {
         // Shuts off all motors AND brake resistor, sets error code on all motors.
         low_level_fault(Motor::ERROR_BRAKE_DUTY_CYCLE_NAN);
@@ -527,6 +675,8 @@ void update_brake_current() {
     }
 
     if (brake_duty >= 0.95f) {
+        if (!brake_resistor_saturated)
+            odrv.event_trace_.record(EventTrace::EVENT_TYPE_BRAKE_SATURATED, EventTrace::source_board, 0, 0);
         brake_resistor_saturated = true;
     }
 
@@ -540,6 +690,19 @@ void update_brake_current() {
 
     ibus_ += odrv.ibus_report_filter_k_ * (Ibus_sum - ibus_);
 
+    // The controllers reduce the torque as the bus current approaches the
+    // graceful limits, the net current including the brake resistor is what
+    // the power supply sees
+    if (dt > 0.0f) {
+        DcBusLimiter::Config_t config = {
+            .current_limit = odrv.config_.dc_bus_current_limit,
+            .regen_current_limit = odrv.config_.dc_bus_regen_current_limit,
+            .power_limit = odrv.config_.dc_bus_power_limit,
+            .regen_power_limit = odrv.config_.dc_bus_regen_power_limit
+        };
+        odrv.dc_bus_limiter_.update(config, Ibus_sum, vbus_voltage, num_armed);
+    }
+
     if (Ibus_sum > odrv.config_.dc_max_positive_current) {
         low_level_fault(Motor::ERROR_DC_BUS_OVER_CURRENT);
         return;
@@ -553,34 +716,74 @@ void update_brake_current() {
     int low_off = high_on - TIM_APB1_DEADTIME_CLOCKS;
     if (low_off < 0) low_off = 0;
     safety_critical_apply_brake_resistor_timings(low_off, high_on);
-    axes[0].task_times_.brake_update.stopTimer();
-    axes[1].task_times_.brake_update.stopTimer();
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        axes[i].task_times_.brake_update.stopTimer();
 }
 
 
 /* Analog speed control input */
 
-static void update_analog_endpoint(const struct PWMMapping_t *map, int gpio)
-{
-    float fraction = get_adc_voltage(get_gpio(gpio)) / 3.3f;
-    float value = map->min + (fraction * (map->max - map->min));
-    fibre::set_endpoint_from_float(map->endpoint, value);
+static EndpointSetter analog_mapping_setters[GPIO_COUNT];
+static float analog_mapping_values[GPIO_COUNT]; // filtered
+static bool analog_mapping_primed[GPIO_COUNT];
+// Latched from config.analog_mapping_in_control_loop at startup, so that the
+// setters are only ever used from one context
+static bool analog_mapping_in_control_loop = false;
+
+// @brief Writes the analog inputs to the endpoints of their analog_mappings.
+// Runs either in the analog thread or from the control loop, depending on
+// config.analog_mapping_in_control_loop.
+// @param dt: time since the last call [s]
+static void do_analog_mappings(float dt) {
+    float k = std::min(2.0f * (float)M_PI * odrv.config_.analog_mapping_filter_bandwidth * dt, 1.0f);
+    for (size_t i = 0; i < GPIO_COUNT; i++) {
+        const PWMMapping_t& map = odrv.config_.analog_mappings[i];
+        if (!analog_mapping_setters[i].resolve(map.endpoint)) {
+            analog_mapping_primed[i] = false;
+            continue;
+        }
+
+        float fraction = get_adc_voltage(get_gpio(i)) / 3.3f;
+        float value = map.min + (fraction * (map.max - map.min));
+        if (analog_mapping_primed[i])
+            analog_mapping_values[i] += k * (value - analog_mapping_values[i]);
+        else
+            analog_mapping_values[i] = value;
+        analog_mapping_primed[i] = true;
+        analog_mapping_setters[i].set(analog_mapping_values[i]);
+    }
 }
 
+// @brief Called once per control loop iteration
+void update_analog_mappings(float dt) {
+    if (analog_mapping_in_control_loop)
+        do_analog_mappings(dt);
+}
+
+osThreadId analog_thread;
+
 static void analog_polling_thread(void *)
 {
     while (true) {
-        for (int i = 0; i < GPIO_COUNT; i++) {
-            struct PWMMapping_t *map = &odrv.config_.analog_mappings[i];
-
-            if (fibre::is_endpoint_ref_valid(map->endpoint))
-                update_analog_endpoint(map, i);
+        if (!analog_mapping_in_control_loop)
+            do_analog_mappings(0.01f);
+        pwm0_input.check_timeouts();
+
+        // The temperatures change on a timescale of seconds, the control
+        // loop only picks up the resulting current limits
+        for (Motor& motor : motors) {
+            motor.fet_thermistor_.update();
+            motor.motor_thermistor_.update();
         }
         osDelay(10);
     }
 }
 
+CCM_RAM static StackType_t analog_thread_stack[512 / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t analog_thread_tcb;
+
 void start_analog_thread() {
-    osThreadDef(thread_def, analog_polling_thread, osPriorityLow, 0, 512 / sizeof(StackType_t));
-    osThreadCreate(osThread(thread_def), NULL);
+    analog_mapping_in_control_loop = odrv.config_.analog_mapping_in_control_loop;
+    osThreadStaticDef(thread_def, analog_polling_thread, osPriorityLow, 0, sizeof(analog_thread_stack) / sizeof(StackType_t), analog_thread_stack, &analog_thread_tcb);
+    analog_thread = osThreadCreate(osThread(thread_def), NULL);
 }
@@ -18,10 +18,15 @@ extern const float adc_full_scale;
 extern const float adc_ref_voltage;
 /* Exported variables --------------------------------------------------------*/
 extern float vbus_voltage;
+extern float vbus_voltage_raw;
+extern float vbus_ripple;
+extern float vbus_min;
+extern float vbus_max;
 extern float ibus_;
 extern bool task_timers_armed;
 extern bool brake_resistor_armed;
 extern bool brake_resistor_saturated;
+extern float dc_bus_regen_scale;
 extern uint16_t adc_measurements_[ADC_CHANNEL_COUNT];
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
@@ -42,13 +47,16 @@ void pwm_in_cb(TIM_HandleTypeDef *htim);
 
 // Initalisation
 void start_adc_pwm();
+bool dc_calib_settled();
 void start_pwm(TIM_HandleTypeDef* htim);
 void sync_timers(TIM_HandleTypeDef* htim_a, TIM_HandleTypeDef* htim_b,
                  uint16_t TIM_CLOCKSOURCE_ITRx, uint16_t count_offset,
                  TIM_HandleTypeDef* htim_refbase = nullptr);
 void start_general_purpose_adc();
 void pwm_in_init();
+extern osThreadId analog_thread;
 void start_analog_thread();
+void update_analog_mappings(float dt);
 
 // ADC getters
 uint16_t channel_from_gpio(Stm32Gpio gpio);
@@ -56,7 +64,7 @@ float get_adc_voltage(Stm32Gpio gpio);
 float get_adc_relative_voltage(Stm32Gpio gpio);
 float get_adc_relative_voltage_ch(uint16_t channel);
 
-void update_brake_current();
+void update_brake_current(float dt = 0.0f);
 
 #ifdef __cplusplus
 }
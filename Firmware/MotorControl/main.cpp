@@ -2,6 +2,7 @@
 #define __MAIN_CPP__
 #include "odrive_main.h"
 #include "nvm_config.hpp"
+#include "autogen/config_fields.hpp"
 
 #include "usart.h"
 #include "freertos_vars.h"
@@ -14,16 +15,23 @@
 osSemaphoreId sem_usb_irq;
 osSemaphoreId sem_uart_dma;
 osSemaphoreId sem_usb_rx;
-osSemaphoreId sem_usb_tx;
+osSemaphoreId sem_usb_tx_cdc;
+osSemaphoreId sem_usb_tx_native;
 osSemaphoreId sem_can;
+static StaticSemaphore_t sem_usb_irq_cb;
+static StaticSemaphore_t sem_uart_dma_cb;
+static StaticSemaphore_t sem_usb_rx_cb;
+static StaticSemaphore_t sem_usb_tx_cdc_cb;
+static StaticSemaphore_t sem_usb_tx_native_cb;
+static StaticSemaphore_t sem_can_cb;
 
 osThreadId usb_irq_thread;
 const uint32_t stack_size_usb_irq_thread = 2048; // Bytes
+CCM_RAM static StackType_t usb_irq_thread_stack[stack_size_usb_irq_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t usb_irq_thread_tcb;
 
-#if defined(STM32F405xx)
-// Place FreeRTOS heap in core coupled memory for better performance
-__attribute__((section(".ccmram")))
-#endif
+// The thread stacks take up about 35 kB of the core coupled memory, the
+// FreeRTOS heap doesn't fit next to them and goes into the main SRAM
 uint8_t ucHeap[configTOTAL_HEAP_SIZE];
 
 uint32_t _reboot_cookie __attribute__ ((section (".noinit")));
@@ -37,49 +45,214 @@ ODrive odrv{};
 
 ConfigManager config_manager;
 
+// Keys of the config records in NVM. A key must never be reused for a
+// different object, the fields of the old object would be loaded into it.
+enum : uint16_t {
+    kConfigKeyBoard = 0x0001,
+    kConfigKeyCan = 0x0002,
+    kConfigKeyDataLogger = 0x0003,
+    // Per axis, offset by 0x100 * (axis number + 1)
+    kConfigKeyEncoder = 0x00,
+    kConfigKeySensorlessEstimator = 0x01,
+    kConfigKeyController = 0x02,
+    kConfigKeyTrapTraj = 0x03,
+    kConfigKeyMinEndstop = 0x04,
+    kConfigKeyMaxEndstop = 0x05,
+    kConfigKeyMechanicalBrake = 0x06,
+    kConfigKeyMotor = 0x07,
+    kConfigKeyFetThermistor = 0x08,
+    kConfigKeyMotorThermistor = 0x09,
+    kConfigKeyAxis = 0x0a,
+    kConfigKeyMotorThermalModel = 0x0b,
+    kConfigKeyFetThermalModel = 0x0c,
+    kConfigKeyMultiturn = 0x0d, // not part of the configuration, see multiturn_store()
+    kConfigKeyCoggingMap = 0x0e, // read in place, see cogging_map_find_all()
+    kConfigKeyProfile = 0x10, // up to 0x10 + Axis::Profile_t::count - 1
+};
+
+static uint16_t axis_config_key(size_t axis, uint16_t key) {
+    return (uint16_t)(0x100 * (axis + 1) + key);
+}
+
+// Config fields that are not exposed in odrive-interface.yaml
+struct EncoderPrivateConfigFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(Encoder::Config_t, "hall_edges", hall_edges),
+        CONFIG_FIELD(Encoder::Config_t, "error_map", error_map),
+    };
+};
+
+// The cogging map is a record of its own, written from Controller::cogging_map_
+static constexpr uint32_t kCoggingMapFieldId = config_field_id("anticogging.cogging_map");
+static constexpr size_t kCoggingMapSize = sizeof(int16_t) * Controller::max_cogging_map_size;
+struct CoggingMapFields {
+    static constexpr ConfigField fields[] = {
+        ConfigField{kCoggingMapFieldId, 0, (uint16_t)kCoggingMapSize},
+    };
+};
+
+struct MultiturnFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(MultiturnRecord_t, "linear_count", linear_count),
+        CONFIG_FIELD(MultiturnRecord_t, "count_in_cpr", count_in_cpr),
+        CONFIG_FIELD(MultiturnRecord_t, "cpr", cpr),
+        CONFIG_FIELD(MultiturnRecord_t, "valid", valid),
+        CONFIG_FIELD(MultiturnRecord_t, "is_homed", is_homed),
+    };
+};
+
+struct ProfileFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(Axis::Profile_t, "valid", valid),
+        CONFIG_FIELD(Axis::Profile_t, "control_mode", control_mode),
+        CONFIG_FIELD(Axis::Profile_t, "input_mode", input_mode),
+        CONFIG_FIELD(Axis::Profile_t, "pos_gain", pos_gain),
+        CONFIG_FIELD(Axis::Profile_t, "vel_gain", vel_gain),
+        CONFIG_FIELD(Axis::Profile_t, "vel_integrator_gain", vel_integrator_gain),
+        CONFIG_FIELD(Axis::Profile_t, "vel_limit", vel_limit),
+        CONFIG_FIELD(Axis::Profile_t, "vel_ramp_rate", vel_ramp_rate),
+        CONFIG_FIELD(Axis::Profile_t, "torque_ramp_rate", torque_ramp_rate),
+        CONFIG_FIELD(Axis::Profile_t, "inertia", inertia),
+        CONFIG_FIELD(Axis::Profile_t, "input_filter_bandwidth", input_filter_bandwidth),
+        CONFIG_FIELD(Axis::Profile_t, "current_lim", current_lim),
+        CONFIG_FIELD(Axis::Profile_t, "torque_lim", torque_lim),
+        CONFIG_FIELD(Axis::Profile_t, "trap_traj.vel_limit", trap_traj.vel_limit),
+        CONFIG_FIELD(Axis::Profile_t, "trap_traj.accel_limit", trap_traj.accel_limit),
+        CONFIG_FIELD(Axis::Profile_t, "trap_traj.decel_limit", trap_traj.decel_limit),
+        CONFIG_FIELD(Axis::Profile_t, "trap_traj.jerk_limit", trap_traj.jerk_limit),
+    };
+};
+
+using BoardConfigFields = ODriveConfigFields<BoardConfig_t>;
+using CanConfigFields = ODriveCanConfigFields<ODriveCAN::Config_t>;
+using DataLoggerConfigFields = ODriveDataLoggerConfigFields<DataLogger::Config_t>;
+using EncoderConfigFields = ODriveEncoderConfigFields<Encoder::Config_t>;
+using SensorlessEstimatorConfigFields = ODriveSensorlessEstimatorConfigFields<SensorlessEstimator::Config_t>;
+using ControllerConfigFields = ODriveControllerConfigFields<Controller::Config_t>;
+using TrapTrajConfigFields = ODriveTrapezoidalTrajectoryConfigFields<TrapezoidalTrajectory::Config_t>;
+using EndstopConfigFields = ODriveEndstopConfigFields<Endstop::Config_t>;
+using MechanicalBrakeConfigFields = ODriveMechanicalBrakeConfigFields<MechanicalBrake::Config_t>;
+using MotorConfigFields = ODriveMotorConfigFields<Motor::Config_t>;
+using FetThermistorConfigFields = ODriveOnboardThermistorCurrentLimiterConfigFields<OnboardThermistorCurrentLimiter::Config_t>;
+using MotorThermistorConfigFields = ODriveOffboardThermistorCurrentLimiterConfigFields<OffboardThermistorCurrentLimiter::Config_t>;
+using ThermalModelConfigFields = ODriveThermalModelCurrentLimiterConfigFields<ThermalModelCurrentLimiter::Config_t>;
+using AxisConfigFields = ODriveAxisConfigFields<Axis::Config_t>;
+
 static bool config_read_all() {
     bool success = board_read_config() &&
-           config_manager.read(&odrv.config_) &&
-           config_manager.read(&can_config);
+           config_manager.read<BoardConfigFields>(kConfigKeyBoard, &odrv.config_) &&
+           config_manager.read<CanConfigFields>(kConfigKeyCan, &can_config) &&
+           config_manager.read<DataLoggerConfigFields>(kConfigKeyDataLogger, &odrv.data_logger_.config_);
     for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
-        success = config_manager.read(&encoders[i].config_) &&
-                  config_manager.read(&axes[i].sensorless_estimator_.config_) &&
-                  config_manager.read(&axes[i].controller_.config_) &&
-                  config_manager.read(&axes[i].trap_traj_.config_) &&
-                  config_manager.read(&axes[i].min_endstop_.config_) &&
-                  config_manager.read(&axes[i].max_endstop_.config_) &&
-                  config_manager.read(&axes[i].mechanical_brake_.config_) &&
-                  config_manager.read(&motors[i].config_) &&
-                  config_manager.read(&motors[i].fet_thermistor_.config_) &&
-                  config_manager.read(&motors[i].motor_thermistor_.config_) &&
-                  config_manager.read(&axes[i].config_);
+        success = config_manager.read<EncoderConfigFields, EncoderPrivateConfigFields>(axis_config_key(i, kConfigKeyEncoder), &encoders[i].config_) &&
+                  config_manager.read<SensorlessEstimatorConfigFields>(axis_config_key(i, kConfigKeySensorlessEstimator), &axes[i].sensorless_estimator_.config_) &&
+                  config_manager.read<ControllerConfigFields>(axis_config_key(i, kConfigKeyController), &axes[i].controller_.config_) &&
+                  config_manager.read<TrapTrajConfigFields>(axis_config_key(i, kConfigKeyTrapTraj), &axes[i].trap_traj_.config_) &&
+                  config_manager.read<EndstopConfigFields>(axis_config_key(i, kConfigKeyMinEndstop), &axes[i].min_endstop_.config_) &&
+                  config_manager.read<EndstopConfigFields>(axis_config_key(i, kConfigKeyMaxEndstop), &axes[i].max_endstop_.config_) &&
+                  config_manager.read<MechanicalBrakeConfigFields>(axis_config_key(i, kConfigKeyMechanicalBrake), &axes[i].mechanical_brake_.config_) &&
+                  config_manager.read<MotorConfigFields>(axis_config_key(i, kConfigKeyMotor), &motors[i].config_) &&
+                  config_manager.read<FetThermistorConfigFields>(axis_config_key(i, kConfigKeyFetThermistor), &motors[i].fet_thermistor_.config_) &&
+                  config_manager.read<MotorThermistorConfigFields>(axis_config_key(i, kConfigKeyMotorThermistor), &motors[i].motor_thermistor_.config_) &&
+                  config_manager.read<ThermalModelConfigFields>(axis_config_key(i, kConfigKeyMotorThermalModel), &motors[i].motor_thermal_model_.config_) &&
+                  config_manager.read<ThermalModelConfigFields>(axis_config_key(i, kConfigKeyFetThermalModel), &motors[i].fet_thermal_model_.config_) &&
+                  config_manager.read<AxisConfigFields>(axis_config_key(i, kConfigKeyAxis), &axes[i].config_);
+        for (size_t j = 0; j < Axis::Profile_t::count; ++j) {
+            success = success && config_manager.read<ProfileFields>(axis_config_key(i, kConfigKeyProfile + j), &axes[i].profiles_[j]);
+        }
     }
     return success;
 }
 
+// Controller::cogging_map_version_ of the maps that config_write_all() added
+// to the current store operation
+static uint32_t cogging_map_versions[AXIS_COUNT];
+
 static bool config_write_all() {
+    if (odrv.config_.enable_fast_boot && dc_calib_settled()) {
+        // Seeds for the DC calibration on the next boot
+        for (Motor& motor : motors) {
+            motor.config_.dc_calib_phB = motor.DC_calib_.phB;
+            motor.config_.dc_calib_phC = motor.DC_calib_.phC;
+        }
+    }
     bool success = board_write_config() &&
-           config_manager.write(&odrv.config_) &&
-           config_manager.write(&can_config);
+           config_manager.write<BoardConfigFields>(kConfigKeyBoard, &odrv.config_) &&
+           config_manager.write<CanConfigFields>(kConfigKeyCan, &can_config) &&
+           config_manager.write<DataLoggerConfigFields>(kConfigKeyDataLogger, &odrv.data_logger_.config_);
     for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
-        success = config_manager.write(&encoders[i].config_) &&
-                  config_manager.write(&axes[i].sensorless_estimator_.config_) &&
-                  config_manager.write(&axes[i].controller_.config_) &&
-                  config_manager.write(&axes[i].trap_traj_.config_) &&
-                  config_manager.write(&axes[i].min_endstop_.config_) &&
-                  config_manager.write(&axes[i].max_endstop_.config_) &&
-                  config_manager.write(&axes[i].mechanical_brake_.config_) &&
-                  config_manager.write(&motors[i].config_) &&
-                  config_manager.write(&motors[i].fet_thermistor_.config_) &&
-                  config_manager.write(&motors[i].motor_thermistor_.config_) &&
-                  config_manager.write(&axes[i].config_);
+        success = config_manager.write<EncoderConfigFields, EncoderPrivateConfigFields>(axis_config_key(i, kConfigKeyEncoder), &encoders[i].config_) &&
+                  config_manager.write<SensorlessEstimatorConfigFields>(axis_config_key(i, kConfigKeySensorlessEstimator), &axes[i].sensorless_estimator_.config_) &&
+                  config_manager.write<ControllerConfigFields>(axis_config_key(i, kConfigKeyController), &axes[i].controller_.config_) &&
+                  config_manager.write<TrapTrajConfigFields>(axis_config_key(i, kConfigKeyTrapTraj), &axes[i].trap_traj_.config_) &&
+                  config_manager.write<EndstopConfigFields>(axis_config_key(i, kConfigKeyMinEndstop), &axes[i].min_endstop_.config_) &&
+                  config_manager.write<EndstopConfigFields>(axis_config_key(i, kConfigKeyMaxEndstop), &axes[i].max_endstop_.config_) &&
+                  config_manager.write<MechanicalBrakeConfigFields>(axis_config_key(i, kConfigKeyMechanicalBrake), &axes[i].mechanical_brake_.config_) &&
+                  config_manager.write<MotorConfigFields>(axis_config_key(i, kConfigKeyMotor), &motors[i].config_) &&
+                  config_manager.write<FetThermistorConfigFields>(axis_config_key(i, kConfigKeyFetThermistor), &motors[i].fet_thermistor_.config_) &&
+                  config_manager.write<MotorThermistorConfigFields>(axis_config_key(i, kConfigKeyMotorThermistor), &motors[i].motor_thermistor_.config_) &&
+                  config_manager.write<ThermalModelConfigFields>(axis_config_key(i, kConfigKeyMotorThermalModel), &motors[i].motor_thermal_model_.config_) &&
+                  config_manager.write<ThermalModelConfigFields>(axis_config_key(i, kConfigKeyFetThermalModel), &motors[i].fet_thermal_model_.config_) &&
+                  config_manager.write<AxisConfigFields>(axis_config_key(i, kConfigKeyAxis), &axes[i].config_);
+        for (size_t j = 0; j < Axis::Profile_t::count; ++j) {
+            success = success && config_manager.write<ProfileFields>(axis_config_key(i, kConfigKeyProfile + j), &axes[i].profiles_[j]);
+        }
+        // The version before the map, so an edit in between keeps the copy
+        cogging_map_versions[i] = axes[i].controller_.cogging_map_version_;
+        const int16_t* cogging_map = axes[i].controller_.cogging_map_;
+        if (cogging_map) {
+            success = success && config_manager.write<CoggingMapFields>(axis_config_key(i, kConfigKeyCoggingMap), cogging_map);
+        }
     }
     return success;
 }
 
+// @brief Looks up the cogging maps in the current load operation, nullptr for
+// the axes without one. The pointers stay valid as long as the NVM sector or
+// the image. The map of a config saved by an older firmware is still in the
+// controller record.
+static void cogging_map_find_all(const int16_t* maps[AXIS_COUNT]) {
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        const uint8_t* map = config_manager.read_in_place(axis_config_key(i, kConfigKeyCoggingMap), kCoggingMapFieldId, kCoggingMapSize);
+        if (!map) {
+            map = config_manager.read_in_place(axis_config_key(i, kConfigKeyController), kCoggingMapFieldId, kCoggingMapSize);
+        }
+        maps[i] = (const int16_t*)map;
+    }
+}
+
+// @brief Points the cogging maps at their records in the current load
+// operation from NVM, the axes without a record keep their map.
+static bool cogging_map_read_in_place() {
+    const int16_t* maps[AXIS_COUNT];
+    cogging_map_find_all(maps);
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Controller& controller = axes[i].controller_;
+        if (maps[i]) {
+            controller.set_stored_cogging_map(maps[i], controller.cogging_map_version_);
+        }
+    }
+    return true;
+}
+
+// @brief Points the cogging maps at their records after a store, which can
+// have moved them into the other sector, and releases the copies that were
+// saved. Must run before the next store, which can erase the old sector.
+static void cogging_map_relocate_all() {
+    if (!config_manager.start_load()) {
+        return;
+    }
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        const uint8_t* map = config_manager.read_in_place(axis_config_key(i, kConfigKeyCoggingMap), kCoggingMapFieldId, kCoggingMapSize);
+        axes[i].controller_.set_stored_cogging_map((const int16_t*)map, cogging_map_versions[i]);
+    }
+    config_manager.finish_load(nullptr);
+}
+
 static void config_clear_all() {
     odrv.config_ = {};
     can_config = {};
+    odrv.data_logger_.config_ = {};
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         encoders[i].config_ = {};
         axes[i].sensorless_estimator_.config_ = {};
@@ -92,6 +265,8 @@ static void config_clear_all() {
         motors[i].config_ = {};
         motors[i].fet_thermistor_.config_ = {};
         motors[i].motor_thermistor_.config_ = {};
+        motors[i].motor_thermal_model_.clear_config();
+        motors[i].fet_thermal_model_.clear_config();
         axes[i].clear_config();
     }
 }
@@ -101,6 +276,7 @@ static bool config_apply_all() {
     for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
         success = encoders[i].apply_config(motors[i].config_.motor_type)
                && axes[i].controller_.apply_config()
+               && axes[i].sensorless_estimator_.apply_config()
                && axes[i].min_endstop_.apply_config()
                && axes[i].max_endstop_.apply_config()
                && motors[i].apply_config()
@@ -114,10 +290,9 @@ void ODrive::save_configuration(void) {
     size_t config_size = 0;
     bool success = config_manager.prepare_store()
                 && config_write_all()
-                && config_manager.start_store(&config_size)
-                && config_write_all()
-                && config_manager.finish_store();
+                && config_manager.finish_store(&config_size);
     if (success) {
+        cogging_map_relocate_all();
         user_config_loaded_ = config_size;
     } else {
         printf("saving configuration failed\r\n");
@@ -125,7 +300,437 @@ void ODrive::save_configuration(void) {
     }
 }
 
+osThreadId config_save_thread;
+const uint32_t stack_size_config_save_thread = 1024; // Bytes
+CCM_RAM static StackType_t config_save_thread_stack[stack_size_config_save_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t config_save_thread_tcb;
+static uint8_t* config_snapshot = nullptr;
+
+enum : int32_t {
+    kConfigSaveSignalStart = 1 << 0,
+    kConfigSaveSignalMultiturn = 1 << 1
+};
+
+static bool any_motor_armed() {
+    return std::any_of(axes.begin(), axes.end(), [](Axis& axis) {
+        return axis.motor_.armed_state_ != Motor::ARMED_STATE_DISARMED;
+    });
+}
+
+// @brief True while every armed motor has the PWM timings for its next update
+// queued, i.e. between the end of its control loop and the next current
+// measurement. A flash stall in this window only delays the interrupt that
+// loads the timings, which shows up in `deadline_monitor.slack`.
+static bool in_control_loop_slack() {
+    return std::all_of(axes.begin(), axes.end(), [](Axis& axis) {
+        return axis.motor_.armed_state_ == Motor::ARMED_STATE_DISARMED
+            || axis.motor_.next_timings_valid_;
+    });
+}
+
+// Multi-turn positions of the absolute encoders. They are appended to the
+// config log on their own and never compact it, so a power loss can't
+// interrupt a compaction. save_configuration() doesn't write them, after a
+// compaction there is no saved position until the next multiturn_store().
+static MultiturnRecord_t multiturn_records[AXIS_COUNT]; // referenced until the store is done
+
+static bool any_multiturn_retained() {
+    return std::any_of(axes.begin(), axes.end(), [](Axis& axis) {
+        return axis.encoder_.config_.retain_multiturn && (axis.encoder_.mode_ & Encoder::MODE_FLAG_ABS);
+    });
+}
+
+static bool any_multiturn_pending() {
+    return std::any_of(axes.begin(), axes.end(), [](Axis& axis) {
+        return axis.encoder_.multiturn_saved_.valid && (axis.encoder_.mode_ & Encoder::MODE_FLAG_ABS);
+    });
+}
+
+static bool multiturn_read_all() {
+    bool success = true;
+    for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
+        success = config_manager.read<MultiturnFields>(axis_config_key(i, kConfigKeyMultiturn), &encoders[i].multiturn_saved_);
+    }
+    return success;
+}
+
+// @brief Appends the multi-turn records of all axes to the NVM log. Must be
+// called with the scheduler suspended and all motors disarmed.
+// @param capture: true to save the current positions, false to invalidate
+//        the saved ones. Records that were not restored yet stay as they are.
+// @returns false if a store is in progress or the log is full, in that case
+//        nothing is saved until the next save_configuration()
+static bool multiturn_store(bool capture) {
+    if (config_manager.store_state != ConfigManager::kStoreStateIdle
+            && config_manager.store_state != ConfigManager::kStoreStateFailed) {
+        return false; // don't interfere with a configuration store
+    }
+    bool success = config_manager.prepare_store();
+    for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
+        Encoder& encoder = encoders[i];
+        MultiturnRecord_t& record = multiturn_records[i];
+        if (encoder.multiturn_saved_.valid) {
+            record = encoder.multiturn_saved_;
+        } else if (capture && encoder.config_.retain_multiturn && (encoder.mode_ & Encoder::MODE_FLAG_ABS)) {
+            uint32_t mask = cpu_enter_critical();
+            record.linear_count = encoder.shadow_count_;
+            record.count_in_cpr = encoder.count_in_cpr_;
+            cpu_exit_critical(mask);
+            record.cpr = encoder.config_.cpr;
+            record.valid = !(encoder.error_ & Encoder::ERROR_ABS_SPI_COM_FAIL);
+            record.is_homed = axes[i].homing_.is_homed;
+        } else {
+            record = {};
+        }
+        success = config_manager.write<MultiturnFields>(axis_config_key(i, kConfigKeyMultiturn), &record);
+    }
+    return success && config_manager.finish_append(nullptr);
+}
+
+// @brief Runs multiturn_store() once all motors are disarmed, e.g. by the
+// undervoltage error of a brownout, and the encoders had time to restore the
+// positions saved before the last power loss.
+static bool save_multiturn(bool capture) {
+    if (!any_multiturn_retained()) {
+        return true;
+    }
+    for (uint32_t waited = 0; waited < 100; ++waited) {
+        osThreadSuspendAll();
+        bool ready = !any_motor_armed() && !any_multiturn_pending();
+        bool success = ready && multiturn_store(capture);
+        osThreadResumeAll();
+        if (ready) {
+            return success;
+        }
+        osDelay(1);
+    }
+    return false;
+}
+
+// @brief Writes the snapshot of a background save to NVM.
+// With a motor armed, one word at a time is programmed in the slack of the
+// control loops. The erase that a compaction needs stalls the flash for more
+// than a second, it waits until all motors are disarmed.
+static void config_save_thread_fn(void*) {
+    for (;;) {
+        osEvent event = osSignalWait(kConfigSaveSignalStart | kConfigSaveSignalMultiturn, osWaitForever);
+        if (event.value.signals & kConfigSaveSignalMultiturn) {
+            // Entering a brownout saves the positions, leaving it (or a
+            // boot) invalidates them, so they are only restored once
+            if (!save_multiturn(odrv.brownout_)) {
+                printf("saving multi-turn positions failed\r\n");
+            }
+        }
+        if (!(event.value.signals & kConfigSaveSignalStart)) {
+            continue;
+        }
+
+        ConfigManager::BackgroundStoreStatus status = ConfigManager::kBackgroundStoreBusy;
+        size_t config_size = 0;
+        while (status == ConfigManager::kBackgroundStoreBusy) {
+            if (config_manager.background_store_needs_erase()) {
+                // Keep the other threads from arming a motor meanwhile
+                osThreadSuspendAll();
+                bool armed = any_motor_armed();
+                if (!armed) {
+                    status = config_manager.continue_background_store(0, &config_size);
+                }
+                osThreadResumeAll();
+                if (armed) {
+                    osDelay(10);
+                }
+            } else if (!any_motor_armed()) {
+                status = config_manager.continue_background_store(256, &config_size);
+            } else if (in_control_loop_slack()) {
+                status = config_manager.continue_background_store(4, &config_size);
+            } else {
+                osDelay(1);
+            }
+        }
+
+        if (status == ConfigManager::kBackgroundStoreDone) {
+            cogging_map_relocate_all();
+            odrv.user_config_loaded_ = config_size;
+        } else {
+            printf("saving configuration failed\r\n");
+        }
+        vPortFree(config_snapshot);
+        config_snapshot = nullptr;
+        odrv.background_save_in_progress_ = false;
+    }
+}
+
+static void start_config_save_thread() {
+    osThreadStaticDef(thread_def, config_save_thread_fn, osPriorityLow, 0, stack_size_config_save_thread / sizeof(StackType_t), config_save_thread_stack, &config_save_thread_tcb);
+    config_save_thread = osThreadCreate(osThread(thread_def), NULL);
+}
+
+// @brief Called by the control loops with the state of the DC bus, see
+// Axis::check_PSU_brownout()
+void ODrive::report_brownout(bool brownout) {
+    if (brownout != brownout_) {
+        brownout_ = brownout;
+        if (config_save_thread) {
+            osSignalSet(config_save_thread, kConfigSaveSignalMultiturn);
+        }
+    }
+}
+
+// @brief Saves the multi-turn positions of the absolute encoders for the next
+// boot, for a controlled shutdown. Fails if a motor is armed.
+bool ODrive::save_multiturn_positions() {
+    osThreadSuspendAll();
+    bool success = !any_motor_armed() && !any_multiturn_pending() && multiturn_store(true);
+    osThreadResumeAll();
+    return success;
+}
+
+static bool system_watchdog_running = false;
+
+// @brief Starts the IWDG if the system watchdog is enabled. From here on the
+// IWDG is only refreshed by service_system_watchdog().
+static void start_system_watchdog() {
+    if (!odrv.config_.enable_system_watchdog)
+        return;
+
+    ThreadWatchdog& wd = odrv.thread_watchdog_;
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        wd.set_budget(WATCHDOG_THREAD_AXIS0 + i, odrv.config_.thread_budget_axis);
+    wd.set_budget(WATCHDOG_THREAD_USB, odrv.config_.thread_budget_usb);
+    wd.set_budget(WATCHDOG_THREAD_UART, odrv.config_.thread_budget_uart);
+    wd.set_budget(WATCHDOG_THREAD_CAN, odrv.config_.thread_budget_can);
+
+    // The LSI runs at about 32 kHz, with the prescaler at 256 one reload count
+    // is 8 ms, and the 12-bit reload value gives at most 32 s.
+    float reload = std::clamp(odrv.config_.system_watchdog_timeout * (32000.0f / 256.0f), 1.0f, 4095.0f);
+    DBGMCU->APB1FZ |= DBGMCU_APB1_FZ_DBG_IWDG_STOP; // don't reset while halted by the debugger
+    IWDG->KR = 0xCCCC; // start, this also enables the LSI
+    IWDG->KR = 0x5555; // unlock PR and RLR
+    IWDG->PR = IWDG_PR_PR_2 | IWDG_PR_PR_1; // /256
+    IWDG->RLR = (uint32_t)reload;
+    while (IWDG->SR & (IWDG_SR_PVU | IWDG_SR_RVU));
+    IWDG->KR = 0xAAAA; // reload
+    system_watchdog_running = true;
+}
+
+// @brief Refreshes the IWDG as long as all supervised threads check in.
+// Called from the idle task, so the lowest priority must get CPU time too.
+// The first missed budget disarms the motors and takes a crash snapshot,
+// after that the IWDG is never refreshed again and resets the chip.
+static void service_system_watchdog() {
+    static uint32_t last_check = 0;
+    uint32_t now = HAL_GetTick();
+    if (!system_watchdog_running || now == last_check)
+        return;
+    last_check = now;
+
+    uint32_t missed = odrv.thread_watchdog_.overdue(now);
+    if (missed && !odrv.missed_threads_) {
+        for (Axis& axis : axes)
+            safety_critical_disarm_motor_pwm(axis.motor_);
+        odrv.crash_snapshot_.capture(CrashSnapshot::CAUSE_THREAD_STALLED, missed);
+    }
+    odrv.missed_threads_ |= missed;
+    if (!odrv.missed_threads_)
+        IWDG->KR = 0xAAAA;
+}
+
+// Image of the configuration for read_configuration_image() and
+// write_configuration_image(), allocated from the FreeRTOS heap. It never
+// exists at the same time as the snapshot of a background save, so the heap
+// only needs room for one of them.
+static uint8_t* config_image = nullptr;
+static size_t config_image_size = 0;
+
+static void free_config_image() {
+    vPortFree(config_image);
+    config_image = nullptr;
+    config_image_size = 0;
+}
+
+// @brief Takes a snapshot of the configuration and writes it to NVM from a low
+// priority thread, so the motors can keep running.
+// Only the records that changed are copied, the snapshot is allocated from the
+// FreeRTOS heap.
+// @returns false if a background save is still in progress, a configuration
+// image is being transferred or the snapshot could not be taken
+bool ODrive::save_configuration_background() {
+    if (background_save_in_progress_ || config_image) {
+        return false;
+    }
+    size_t snapshot_size = 0;
+    if (!(config_manager.prepare_store()
+            && config_write_all()
+            && config_manager.plan_background_store(&snapshot_size))) {
+        return false;
+    }
+    config_snapshot = snapshot_size ? (uint8_t*)pvPortMalloc(snapshot_size) : nullptr;
+    if (!config_manager.start_background_store(config_snapshot)) {
+        vPortFree(config_snapshot);
+        config_snapshot = nullptr;
+        return false;
+    }
+    background_save_in_progress_ = true;
+    osSignalSet(config_save_thread, kConfigSaveSignalStart);
+    return true;
+}
+
+// Returns as much of the oscilloscope buffer as fits into the response,
+// starting at the byte offset in the request. Same format as endpoint 0.
+bool ODrive::read_oscilloscope_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    if (offset.value() >= sizeof(oscilloscope))
+        return true; // empty response marks the end of the buffer
+    size_t n_copy = std::min(output_buffer->size(), sizeof(oscilloscope) - (size_t)offset.value());
+    memcpy(output_buffer->begin(), (const uint8_t*)oscilloscope + offset.value(), n_copy);
+    *output_buffer = output_buffer->skip(n_copy);
+    return true;
+}
+
+// Echoes the request and fills the rest of the response with a counting
+// pattern, so the host can time round trips with any request and response
+// size.
+bool ODrive::loopback(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    size_t n_echo = std::min(input_buffer->size(), output_buffer->size());
+    memcpy(output_buffer->begin(), input_buffer->begin(), n_echo);
+    for (size_t i = n_echo; i < output_buffer->size(); ++i)
+        output_buffer->begin()[i] = (uint8_t)i;
+    *output_buffer = output_buffer->skip(output_buffer->size());
+    return true;
+}
+
+// Returns as much of an image of the current configuration as fits into the
+// response, starting at the byte offset in the request. The image is taken on
+// the request for offset 0 and released once its end was read.
+bool ODrive::read_configuration_image(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value())
+        return false;
+    if (offset.value() == 0) {
+        free_config_image();
+        size_t size = 0;
+        bool success = !background_save_in_progress_
+                    && config_manager.prepare_store()
+                    && config_write_all()
+                    && config_manager.export_image(nullptr, &size)
+                    && (config_image = (uint8_t*)pvPortMalloc(size))
+                    && config_manager.export_image(config_image, &size);
+        if (!success) {
+            free_config_image();
+            return true; // empty response
+        }
+        config_image_size = size;
+    }
+    if (!config_image || offset.value() >= config_image_size)
+        return true; // empty response marks the end of the image
+    size_t n_copy = std::min(output_buffer->size(), config_image_size - (size_t)offset.value());
+    memcpy(output_buffer->begin(), config_image + offset.value(), n_copy);
+    *output_buffer = output_buffer->skip(n_copy);
+    if (offset.value() + n_copy == config_image_size)
+        free_config_image();
+    return true;
+}
+
+// @brief Allocates the buffer for an image that is then sent with
+// write_configuration_image()
+bool ODrive::start_configuration_restore(uint32_t size) {
+    free_config_image();
+    if ((size & 3) || background_save_in_progress_)
+        return false;
+    config_image = (uint8_t*)pvPortMalloc(size);
+    config_image_size = config_image ? size : 0;
+    return config_image != nullptr;
+}
+
+// Copies the data that follows the byte offset in the request into the image.
+// The response is a single byte, 1 if the data was accepted.
+bool ODrive::write_configuration_image(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    if (!offset.has_value() || output_buffer->size() < 1)
+        return false;
+    bool accepted = config_image && offset.value() <= config_image_size
+                 && input_buffer->size() <= config_image_size - offset.value();
+    if (accepted)
+        memcpy(config_image + offset.value(), input_buffer->begin(), input_buffer->size());
+    *output_buffer->begin() = accepted;
+    *output_buffer = output_buffer->skip(1);
+    return true;
+}
+
+// @brief Checks the image sent with write_configuration_image() and loads it
+// into the configuration. The NVM is only written by save_configuration().
+// @returns false if a motor is armed, a background save is in progress or the
+// image is incomplete, corrupt or from a firmware with a different config
+// version. The configuration is unchanged in that case.
+bool ODrive::finish_configuration_restore() {
+    bool success = config_image && !any_motor_armed() && !background_save_in_progress_
+                && config_manager.start_load_image(config_image, config_image_size);
+    // The maps in the image are only copied once everything else succeeded.
+    // The copies are allocated up front, they hold the current maps until then.
+    const int16_t* maps[AXIS_COUNT] = {};
+    if (success) {
+        cogging_map_find_all(maps);
+        for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
+            success = !maps[i] || axes[i].controller_.edit_cogging_map();
+        }
+    }
+    success = success
+           && config_read_all()
+           && config_manager.finish_load(nullptr)
+           && config_apply_all();
+    for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
+        if (maps[i]) {
+            axes[i].controller_.restore_cogging_map(maps[i]);
+        }
+    }
+    free_config_image();
+    return success;
+}
+
+bool ODrive::coordinated_move(float goal0, float goal1) {
+    const float goals[AXIS_COUNT] = {goal0, goal1};
+
+    // The axis that takes longest on its own limits sets the accel and decel
+    // time, all axes then share them so they move along a straight line.
+    float duration = 0.0f;
+    float accel_time = 0.0f;
+    float decel_time = 0.0f;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        TrapezoidalTrajectory::Config_t& limits = axes[i].trap_traj_.config_;
+        TrapezoidalTrajectory probe;
+        probe.planTrapezoidal(goals[i], axes[i].controller_.pos_setpoint_, 0.0f,
+                              limits.vel_limit, limits.accel_limit, limits.decel_limit);
+        if (probe.Tf_ > duration) {
+            duration = probe.Tf_;
+            accel_time = probe.Ta_;
+            decel_time = probe.Td_;
+        }
+    }
+    if (duration <= 0.0f)
+        return true; // all axes are at their goal already
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        duration = std::max(duration, axes[i].controller_.get_min_move_time(goals[i], accel_time, decel_time));
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (!axes[i].controller_.stage_move(goals[i], duration, accel_time, decel_time))
+            return false;
+    }
+    start_staged_moves();
+    return true;
+}
+
+void ODrive::start_staged_moves() {
+    // Both axes are updated in the same control loop iteration, so the moves
+    // start on the same tick
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        axes[i].controller_.trigger_staged_move();
+}
+
 void ODrive::erase_configuration(void) {
+    for (Axis& axis : axes)
+        axis.controller_.set_stored_cogging_map(nullptr, 0); // the copies stay valid until the reset
     NVM_erase();
 
     // FIXME: this reboot is a workaround because we don't want the next save_configuration
@@ -169,6 +774,54 @@ static void usb_deferred_interrupt_thread(void * ctx) {
     }
 }
 
+const uint32_t thread_stats_update_period = 1000; // [ms]
+
+// @brief Updates the CPU load and stack space of each thread from the
+// FreeRTOS run time stats. Every CPU cycle counts towards the thread that
+// was running, including the cycles of the interrupts that preempted it.
+static void update_thread_stats() {
+    static TaskStatus_t task_status[16]; // static to keep it off the idle task stack
+    static uint32_t last_total_run_time = 0;
+
+    uint32_t total_run_time;
+    UBaseType_t num_tasks = uxTaskGetSystemState(task_status, sizeof(task_status) / sizeof(task_status[0]), &total_run_time);
+    uint32_t period = total_run_time - last_total_run_time;
+    last_total_run_time = total_run_time;
+    if (!period)
+        return;
+
+    ThreadStatsList_t& threads = odrv.system_stats_.threads;
+    const std::pair<osThreadId, ThreadStats_t*> thread_list[] = {
+        {axes[0].thread_id_, &threads.axis0},
+        {axes[1].thread_id_, &threads.axis1},
+#ifdef BOARD_CONTROL_LOOP
+        {board_control_loop_thread_id, &threads.board_control_loop},
+#endif
+        {usb_thread, &threads.usb},
+        {usb_irq_thread, &threads.usb_irq},
+        {uart_thread, &threads.uart},
+        {odCAN->thread_id_, &threads.can},
+        {comms_thread, &threads.comms},
+        {analog_thread, &threads.analog},
+        {odrv.telemetry_.thread_id_, &threads.telemetry},
+        {odrv.subscriptions_.thread_id_, &threads.subscriptions},
+        {odrv.data_logger_.thread_id_, &threads.data_logger},
+        {async_call_thread, &threads.async_calls},
+        {defaultTaskHandle, &threads.startup},
+        {xTaskGetIdleTaskHandle(), &threads.idle},
+    };
+
+    for (UBaseType_t i = 0; i < num_tasks; ++i) {
+        for (auto& [thread, stats] : thread_list) {
+            if (!thread || thread != task_status[i].xHandle)
+                continue;
+            stats->cpu_load = 100.0f * (float)(task_status[i].ulRunTimeCounter - stats->last_run_time) / (float)period;
+            stats->last_run_time = task_status[i].ulRunTimeCounter;
+            stats->min_stack_space = task_status[i].usStackHighWaterMark * sizeof(StackType_t);
+        }
+    }
+}
+
 extern "C" {
 
 void vApplicationStackOverflowHook(xTaskHandle *pxTask, signed portCHAR *pcTaskName) {
@@ -199,7 +852,21 @@ void vApplicationIdleHook(void) {
         odrv.system_stats_.stack_usage_usb_irq = stack_size_usb_irq_thread - odrv.system_stats_.min_stack_space_usb_irq;
         odrv.system_stats_.stack_usage_startup = stack_size_default_task - odrv.system_stats_.min_stack_space_startup;
         odrv.system_stats_.stack_usage_can = odCAN->stack_size_ - odrv.system_stats_.min_stack_space_can;
+
+        static uint32_t last_thread_stats_update = 0;
+        if (odrv.system_stats_.uptime - last_thread_stats_update >= thread_stats_update_period) {
+            last_thread_stats_update = odrv.system_stats_.uptime;
+            update_thread_stats();
+        }
     }
+
+    service_system_watchdog();
+
+    // Nothing else to run until the next interrupt. Sleep mode only gates the
+    // CPU clock, the peripherals and DMA keep running and any interrupt wakes
+    // the CPU within a few cycles. The run time stats are unaffected, they
+    // count the sleep as idle time.
+    __WFI();
 }
 
 }
@@ -270,10 +937,15 @@ static void rtos_main(void*) {
         }
     }
 
-    // Setup motors (DRV8301 SPI transactions here)
+    // Setup motors (DRV8301 SPI transactions here). The gate drivers power
+    // up in parallel.
+    for(auto& axis : axes){
+        axis.motor_.gate_driver_.enable();
+    }
     for(auto& axis : axes){
         axis.motor_.setup();
     }
+    odrv.system_stats_.boot_timings.gate_drivers = micros();
 
     // Setup encoders (Starts encoder SPI transactions)
     for(auto& axis : axes){
@@ -285,16 +957,58 @@ static void rtos_main(void*) {
         axis.setup();
     }
 
+    bool fast_boot = odrv.config_.enable_fast_boot;
+    if (fast_boot) {
+        // A stored seed counts as the first half of the startup average
+        for (Motor& motor : motors) {
+            if (motor.config_.dc_calib_phB != 0.0f || motor.config_.dc_calib_phC != 0.0f) {
+                motor.DC_calib_.phB = motor.config_.dc_calib_phB;
+                motor.DC_calib_.phC = motor.config_.dc_calib_phC;
+                motor.dc_calib_samples_ = odrv.config_.dc_calib_startup_samples / 2;
+            }
+        }
+    }
+
     // Start PWM and enable adc interrupts/callbacks
     start_adc_pwm();
 
-    // This delay serves two purposes:
-    //  - Let the current sense calibration converge (the current
-    //    sense interrupts are firing in background by now)
-    //  - Allow a user to interrupt the code, e.g. by flashing a new code,
-    //    before it does anything crazy
-    // TODO make timing a function of calibration filter tau
-    osDelay(1500);
+    if (fast_boot) {
+        // Wait for the startup average of the DC offsets, at most four times
+        // as long as it should take
+        uint32_t timeout = (uint32_t)(4.0f * 1000.0f * current_meas_period * odrv.config_.dc_calib_startup_samples) + 1; // [ms]
+        for (uint32_t waited = 0; waited < timeout && !dc_calib_settled(); ++waited)
+            osDelay(1);
+        odrv.system_stats_.boot_timings.dc_calib = micros();
+
+        // Pre-calibrated absolute encoders are ready once they read their
+        // position, so the startup sequence can go straight to closed loop
+        for (uint32_t waited = 0; waited < 10; ++waited) {
+            bool ready = std::all_of(axes.begin(), axes.end(), [](Axis& axis) {
+                return !(axis.encoder_.mode_ & Encoder::MODE_FLAG_ABS)
+                    || !axis.encoder_.config_.pre_calibrated
+                    || axis.encoder_.is_ready_;
+            });
+            if (ready)
+                break;
+            osDelay(1);
+        }
+    } else {
+        // This delay serves two purposes:
+        //  - Let the current sense calibration converge (the current
+        //    sense interrupts are firing in background by now)
+        //  - Allow a user to interrupt the code, e.g. by flashing a new code,
+        //    before it does anything crazy
+        // TODO make timing a function of calibration filter tau
+        osDelay(1500);
+        odrv.system_stats_.boot_timings.dc_calib = micros();
+    }
+
+    // The thermistors are sampled by the analog thread. Take the first sample
+    // here so that the current limits are valid before the calibrations run.
+    for (Motor& motor : motors) {
+        motor.fet_thermistor_.update();
+        motor.motor_thermistor_.update();
+    }
 
     // Start state machine threads. Each thread will go through various calibration
     // procedures and then run the actual controller loops.
@@ -302,8 +1016,16 @@ static void rtos_main(void*) {
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         axes[i].start_thread();
     }
+#ifdef BOARD_CONTROL_LOOP
+    start_board_control_loop_thread();
+#endif
+    odrv.system_stats_.boot_timings.state_machines = micros();
 
     start_analog_thread();
+    odrv.data_logger_.start_thread();
+    start_config_save_thread();
+    osSignalSet(config_save_thread, kConfigSaveSignalMultiturn); // invalidates the restored positions
+    start_system_watchdog();
 
     odrv.system_stats_.fully_booted = true;
 
@@ -382,16 +1104,25 @@ extern "C" int main(void) {
     // Init low level system functions (clocks, flash interface)
     system_init();
 
+    // Pick up the snapshot of a crash before the last reset
+    odrv.crash_snapshot_.init();
+
     // Load configuration from NVM. This needs to happen after system_init()
     // since the flash interface must be initialized and before board_init()
     // since board initialization can depend on the config.
     size_t config_size = 0;
     bool success = config_manager.start_load()
             && config_read_all()
+            && cogging_map_read_in_place()
             && config_manager.finish_load(&config_size)
             && config_apply_all();
     if (success) {
         odrv.user_config_loaded_ = config_size;
+        // Positions saved before the last power loss, applied by the encoders
+        // to their first absolute reading
+        config_manager.start_load()
+            && multiturn_read_all()
+            && config_manager.finish_load(nullptr);
     } else {
         config_clear_all();
         config_apply_all();
@@ -424,6 +1155,7 @@ extern "C" int main(void) {
             mode == ODriveIntf::GPIO_MODE_DIGITAL_PULL_UP ||
             mode == ODriveIntf::GPIO_MODE_DIGITAL_PULL_DOWN ||
             mode == ODriveIntf::GPIO_MODE_MECH_BRAKE ||
+            mode == ODriveIntf::GPIO_MODE_POSITION_COMPARE ||
             mode == ODriveIntf::GPIO_MODE_ANALOG_IN) {
             GPIO_InitStruct.Alternate = 0;
         } else {
@@ -525,6 +1257,11 @@ extern "C" int main(void) {
                 GPIO_InitStruct.Pull = GPIO_NOPULL;
                 GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
             } break;
+            case ODriveIntf::GPIO_MODE_POSITION_COMPARE: {
+                GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+                GPIO_InitStruct.Pull = GPIO_NOPULL;
+                GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+            } break;
             default: {
                 odrv.misconfigured_ = true;
                 continue;
@@ -535,29 +1272,31 @@ extern "C" int main(void) {
     }
 
     // Init usb irq binary semaphore, and start with no tokens by removing the starting one.
-    osSemaphoreDef(sem_usb_irq);
+    osSemaphoreStaticDef(sem_usb_irq, &sem_usb_irq_cb);
     sem_usb_irq = osSemaphoreCreate(osSemaphore(sem_usb_irq), 1);
     osSemaphoreWait(sem_usb_irq, 0);
 
     // Create a semaphore for UART DMA and remove a token
-    osSemaphoreDef(sem_uart_dma);
+    osSemaphoreStaticDef(sem_uart_dma, &sem_uart_dma_cb);
     sem_uart_dma = osSemaphoreCreate(osSemaphore(sem_uart_dma), 1);
 
     // Create a semaphore for USB RX
-    osSemaphoreDef(sem_usb_rx);
+    osSemaphoreStaticDef(sem_usb_rx, &sem_usb_rx_cb);
     sem_usb_rx = osSemaphoreCreate(osSemaphore(sem_usb_rx), 1);
     osSemaphoreWait(sem_usb_rx, 0);  // Remove a token.
 
-    // Create a semaphore for USB TX
-    osSemaphoreDef(sem_usb_tx);
-    sem_usb_tx = osSemaphoreCreate(osSemaphore(sem_usb_tx), 1);
+    // Create a semaphore for USB TX on each endpoint pair, with a token per TX buffer
+    osSemaphoreStaticDef(sem_usb_tx_cdc, &sem_usb_tx_cdc_cb);
+    sem_usb_tx_cdc = osSemaphoreCreate(osSemaphore(sem_usb_tx_cdc), 2);
+    osSemaphoreStaticDef(sem_usb_tx_native, &sem_usb_tx_native_cb);
+    sem_usb_tx_native = osSemaphoreCreate(osSemaphore(sem_usb_tx_native), 2);
 
-    osSemaphoreDef(sem_can);
+    osSemaphoreStaticDef(sem_can, &sem_can_cb);
     sem_can = osSemaphoreCreate(osSemaphore(sem_can), 1);
     osSemaphoreWait(sem_can, 0);
 
     // Start USB interrupt handler thread
-    osThreadDef(task_usb_pump, usb_deferred_interrupt_thread, osPriorityAboveNormal, 0, stack_size_usb_irq_thread / sizeof(StackType_t));
+    osThreadStaticDef(task_usb_pump, usb_deferred_interrupt_thread, osPriorityAboveNormal, 0, stack_size_usb_irq_thread / sizeof(StackType_t), usb_irq_thread_stack, &usb_irq_thread_tcb);
     usb_irq_thread = osThreadCreate(osThread(task_usb_pump), NULL);
 
 
@@ -565,7 +1304,7 @@ extern "C" int main(void) {
     odCAN = new ODriveCAN(can_config, &hcan1);
 
     // Create main thread
-    osThreadDef(defaultTask, rtos_main, osPriorityNormal, 0, stack_size_default_task / sizeof(StackType_t));
+    osThreadStaticDef(defaultTask, rtos_main, osPriorityNormal, 0, stack_size_default_task / sizeof(StackType_t), default_task_stack, &default_task_tcb);
     defaultTaskHandle = osThreadCreate(osThread(defaultTask), NULL);
 
     // Start scheduler
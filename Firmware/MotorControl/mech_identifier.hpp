@@ -0,0 +1,95 @@
+#ifndef __MECH_IDENTIFIER_HPP
+#define __MECH_IDENTIFIER_HPP
+
+#include <cmath>
+#include <algorithm>
+
+// Online identification of the mechanical load from the torque command and
+// the velocity estimate. Fits the model
+//     torque = inertia * accel + viscous * vel + coulomb * sign(vel)
+// with recursive least squares and exponential forgetting, so the estimate
+// follows slow load changes.
+// Torque and velocity go through the same first order low-pass filter, which
+// keeps them in phase, and the acceleration is the derivative of the filtered
+// velocity. The filter runs every control period, the least squares update
+// only every few periods.
+class MechIdentifier {
+public:
+    static constexpr int N = 3;
+
+    // @brief Low-pass filters the inputs, call every control period
+    void filter(float torque, float vel, float k) {
+        torque_filt_ += k * (torque - torque_filt_);
+        vel_filt_ += k * (vel - vel_filt_);
+    }
+
+    // @brief Least squares update from the filtered inputs
+    // @param dt: time since the previous call
+    // @param lambda: forgetting factor per update, in (0, 1]
+    // @param vel_band: [turn/s] the Coulomb term ramps in over this velocity
+    void update(float dt, float lambda, float vel_band) {
+        float accel = (vel_filt_ - vel_filt_last_) / dt;
+        vel_filt_last_ = vel_filt_;
+        if (!primed_) {
+            primed_ = true;
+            return;
+        }
+        // Without motion the data holds no information and forgetting would
+        // only blow up the covariance
+        if (std::abs(vel_filt_) < vel_band && std::abs(accel) * dt < 1e-6f)
+            return;
+
+        const float phi[N] = {accel, vel_filt_, std::clamp(vel_filt_ / vel_band, -1.0f, 1.0f)};
+        float P_phi[N];
+        float denom = lambda;
+        for (int i = 0; i < N; ++i) {
+            P_phi[i] = P_[i][0] * phi[0] + P_[i][1] * phi[1] + P_[i][2] * phi[2];
+            denom += phi[i] * P_phi[i];
+        }
+        float err = torque_filt_ - (theta_[0] * phi[0] + theta_[1] * phi[1] + theta_[2] * phi[2]);
+        float inv_denom = 1.0f / denom;
+        float trace = 0.0f;
+        for (int i = 0; i < N; ++i)
+            theta_[i] += P_phi[i] * inv_denom * err;
+        for (int i = 0; i < N; ++i) {
+            for (int j = i; j < N; ++j) {
+                float p = P_[i][j] - P_phi[i] * P_phi[j] * inv_denom;
+                P_[i][j] = P_[j][i] = p; // keep P symmetric
+            }
+            trace += P_[i][i];
+        }
+        // Bound the covariance when the excitation is poor
+        if (trace < max_trace) {
+            float inv_lambda = 1.0f / lambda;
+            for (int i = 0; i < N; ++i)
+                for (int j = 0; j < N; ++j)
+                    P_[i][j] *= inv_lambda;
+        }
+    }
+
+    void reset() {
+        for (int i = 0; i < N; ++i) {
+            theta_[i] = 0.0f;
+            for (int j = 0; j < N; ++j)
+                P_[i][j] = i == j ? initial_covariance : 0.0f;
+        }
+        primed_ = false;
+    }
+
+    float inertia() const { return theta_[0]; }  // [Nm/(turn/s^2)]
+    float viscous() const { return theta_[1]; }  // [Nm/(turn/s)]
+    float coulomb() const { return theta_[2]; }  // [Nm]
+
+    static constexpr float initial_covariance = 100.0f;
+    static constexpr float max_trace = 1e4f;
+
+private:
+    float theta_[N] = {};
+    float P_[N][N] = {{initial_covariance, 0, 0}, {0, initial_covariance, 0}, {0, 0, initial_covariance}};
+    float torque_filt_ = 0.0f;
+    float vel_filt_ = 0.0f;
+    float vel_filt_last_ = 0.0f;
+    bool primed_ = false;
+};
+
+#endif // __MECH_IDENTIFIER_HPP
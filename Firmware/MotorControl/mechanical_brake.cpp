@@ -1,13 +1,18 @@
 #include <odrive_main.h>
 
+// @brief True if the GPIO of the brake is in GPIO_MODE_MECH_BRAKE
+bool MechanicalBrake::is_present() {
+	return odrv.config_.gpio_modes[config_.gpio_num] == ODriveIntf::GPIO_MODE_MECH_BRAKE;
+}
+
 void MechanicalBrake::engage() {
-	if (odrv.config_.gpio_modes[config_.gpio_num] == ODriveIntf::GPIO_MODE_MECH_BRAKE){
+	if (is_present()){
 		get_gpio(config_.gpio_num).write(config_.is_active_low ? 0 : 1);
 	}
 }
 
 void MechanicalBrake::release() {
-	if (odrv.config_.gpio_modes[config_.gpio_num] == ODriveIntf::GPIO_MODE_MECH_BRAKE){
+	if (is_present()){
 		get_gpio(config_.gpio_num).write(config_.is_active_low ? 1 : 0);
 	}
 }
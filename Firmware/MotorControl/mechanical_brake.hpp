@@ -2,12 +2,14 @@
 #define __MECHANICAL_BRAKE_HPP
 
 #include <autogen/interfaces.hpp>
+#include "brake_handoff.hpp"
 
 class MechanicalBrake : public ODriveIntf::MechanicalBrakeIntf  {
    public:
     struct Config_t {
         uint16_t gpio_num = 0;
         bool is_active_low = true;
+        BrakeHandoff::Config_t handoff;
 
         // custom setters
         MechanicalBrake* parent = nullptr;
@@ -18,7 +20,9 @@ class MechanicalBrake : public ODriveIntf::MechanicalBrakeIntf  {
 
     MechanicalBrake::Config_t config_;
     Axis* axis_ = nullptr;
+    BrakeHandoff handoff_;
 
+    bool is_present();
     void release();
     void engage();
 };
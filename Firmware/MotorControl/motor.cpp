@@ -3,8 +3,11 @@
 #include "axis.hpp"
 #include "low_level.h"
 #include "odrive_main.h"
+#include "rl_identifier.hpp"
+#include "control_law.hpp"
 
 #include <algorithm>
+#include <atomic>
 
 Motor::Motor(TIM_HandleTypeDef* timer,
              uint16_t control_deadline,
@@ -23,6 +26,8 @@ Motor::Motor(TIM_HandleTypeDef* timer,
     apply_config();
     fet_thermistor_.motor_ = this;
     motor_thermistor_.motor_ = this;
+    motor_thermal_model_.motor_ = this;
+    fet_thermal_model_.motor_ = this;
 }
 
 // @brief Arms the PWM outputs that belong to this motor.
@@ -37,6 +42,8 @@ Motor::Motor(TIM_HandleTypeDef* timer,
 //
 // @returns: True on success, false otherwise
 bool Motor::arm() {
+    if (!kFeatureAcim && config_.motor_type == MOTOR_TYPE_ACIM)
+        return set_error(ERROR_NOT_IMPLEMENTED_MOTOR_TYPE), false; // left out of this build
 
     // Reset controller states, integrators, setpoints, etc.
     axis_->controller_.reset();
@@ -47,6 +54,8 @@ bool Motor::arm() {
     if (!axis_->wait_for_current_meas())
         return axis_->error_ |= Axis::ERROR_CURRENT_MEASUREMENT_TIMEOUT, false;
     next_timings_valid_ = false;
+    current_command_valid_ = false;
+    current_loop_in_isr_ = config_.current_loop_in_isr_enable;
     safety_critical_arm_motor_pwm(*this);
     return true;
 }
@@ -55,23 +64,62 @@ void Motor::reset_current_control() {
     current_control_.v_current_control_integral_d = 0.0f;
     current_control_.v_current_control_integral_q = 0.0f;
     current_control_.acim_rotor_flux = 0.0f;
+    acim_flux_observer_.reset();
     current_control_.Ibus = 0.0f;
+    current_control_.mod_q = 0.0f;
+    current_control_.modulation = 0.0f;
+    current_control_.Id_field_weakening = 0.0f;
+    field_weakening_.reset();
+}
+
+void Motor::Config_t::set_pole_pairs(int32_t value) {
+    pole_pairs = value;
+    parent->axis_->update_derived_constants();
+    parent->update_mtpa_table();
+}
+
+void Motor::Config_t::set_torque_constant(float value) {
+    torque_constant = value;
+    parent->axis_->update_derived_constants();
+    parent->update_mtpa_table();
 }
 
 // @brief Tune the current controller based on phase resistance and inductance
 // This should be invoked whenever one of these values changes.
 // TODO: allow update on user-request or update automatically via hooks
 void Motor::update_current_controller_gains() {
-    // Calculate current control gains
-    current_control_.p_gain = config_.current_control_bandwidth * config_.phase_inductance;
-    float plant_pole = config_.phase_resistance / config_.phase_inductance;
-    current_control_.i_gain = plant_pole * current_control_.p_gain;
+    // Sampling to the middle of the next PWM period
+    float delay = config_.current_control_delay_comp_enable ? 1.5f * current_meas_period : 0.0f;
+    CurrentPiGains_t gains = current_pi_gains(config_.phase_inductance, config_.phase_resistance,
+            config_.current_control_bandwidth, delay);
+    current_control_.p_gain = gains.p_gain;
+    current_control_.i_gain = gains.i_gain;
+}
+
+// @brief Derives the PWM timing correction from the configured dead time.
+// This should be invoked whenever config.dead_time or
+// config.dead_time_comp_ramp_current changes.
+void Motor::update_dead_time_compensation() {
+    constexpr float pwm_hz = (float)TIM_1_8_CLOCK_HZ / (float)(2 * TIM_1_8_PERIOD_CLOCKS);
+    dead_time_comp_ = std::max(config_.dead_time, 0.0f) * pwm_hz;
+    dead_time_comp_slope_ = dead_time_comp_ / std::max(config_.dead_time_comp_ramp_current, 1e-3f);
+}
+
+// @brief Rebuilds the MTPA table from the motor parameters.
+// This should be invoked whenever config.mtpa_*, config.current_lim,
+// config.torque_constant or config.pole_pairs changes.
+void Motor::update_mtpa_table() {
+    if (config_.mtpa_enable)
+        mtpa_.build(config_.torque_constant, config_.pole_pairs, config_.mtpa_Ld, config_.mtpa_Lq, config_.current_lim);
 }
 
 bool Motor::apply_config() {
     config_.parent = this;
     is_calibrated_ = config_.pre_calibrated;
     update_current_controller_gains();
+    update_dead_time_compensation();
+    update_mtpa_table();
+    update_acim_flux_observer();
     return true;
 }
 
@@ -112,7 +160,30 @@ void Motor::set_error(Motor::Error error){
     update_brake_current();
 }
 
+// @brief Adapts the rotor time constant of the ACIM flux observer to the
+// motor temperature, from the thermistor if it is enabled, else the thermal
+// model. Called at the outer loop rate and whenever the config changes.
+void Motor::update_acim_flux_observer() {
+    float temperature = NAN;
+    if (motor_thermistor_.config_.enabled && !is_nan(motor_thermistor_.temperature_))
+        temperature = motor_thermistor_.temperature_;
+    else if (motor_thermal_model_.config_.enabled)
+        temperature = motor_thermal_model_.temperature_;
+    acim_flux_observer_.set_params({
+        .slip_velocity = config_.acim_slip_velocity,
+        .rotor_tempco = config_.acim_rotor_tempco,
+        .ref_temp = config_.acim_rotor_ref_temp,
+        .min_flux = config_.acim_gain_min_flux,
+        .max_slip = 0.1f * (float)current_meas_hz,
+    }, temperature, current_meas_period);
+}
+
 bool Motor::do_checks() {
+    gate_driver_.poll_status();
+    uint16_t status_reg_1, status_reg_2;
+    if (gate_driver_.get_fault_status(&status_reg_1, &status_reg_2)) {
+        odrv.event_trace_.record(EventTrace::EVENT_TYPE_DRV_FAULT, axis_->axis_num_, status_reg_2, status_reg_1);
+    }
     if (!gate_driver_.check_fault()) {
         set_error(ERROR_DRV_FAULT);
         return false;
@@ -143,6 +214,8 @@ float Motor::effective_current_lim() {
     // Apply thermistor current limiters
     current_lim = std::min(current_lim, motor_thermistor_.get_current_limit(config_.current_lim));
     current_lim = std::min(current_lim, fet_thermistor_.get_current_limit(config_.current_lim));
+    current_lim = std::min(current_lim, motor_thermal_model_.get_current_limit(config_.current_lim));
+    current_lim = std::min(current_lim, fet_thermal_model_.get_current_limit(config_.current_lim));
     effective_current_lim_ = current_lim;
 
     return effective_current_lim_;
@@ -151,7 +224,7 @@ float Motor::effective_current_lim() {
 //return the maximum available torque for the motor.
 //Note - for ACIM motors, available torque is allowed to be 0.
 float Motor::max_available_torque() {
-    if (config_.motor_type == Motor::MOTOR_TYPE_ACIM) {
+    if (is_acim()) {
         float max_torque = effective_current_lim_ * config_.torque_constant * current_control_.acim_rotor_flux;
         max_torque = std::clamp(max_torque, 0.0f, config_.torque_lim);
         return max_torque;
@@ -163,16 +236,31 @@ float Motor::max_available_torque() {
     }
 }
 
+// @brief Records the time from queueing the timings to loading them into the
+// timer at timestamp. Called from the current measurement interrupt.
+void Motor::record_deadline_slack(uint32_t timestamp) {
+    uint32_t slack = task_timer_delta(deadline_monitor_.slack.startTime, timestamp);
+    deadline_monitor_.slack.endTime = timestamp;
+    deadline_monitor_.slack.length = slack;
+    deadline_monitor_.slack.record(slack);
+    if (slack < config_.deadline_near_miss_threshold)
+        ++deadline_monitor_.near_misses;
+}
+
 void Motor::log_timing(TimingLog_t log_idx) {
-    static const uint16_t clocks_per_cnt = (uint16_t)((float)TIM_1_8_CLOCK_HZ / (float)TIM_APB1_CLOCK_HZ);
-    uint16_t timing = clocks_per_cnt * htim13.Instance->CNT; // TODO: Use a hw_config
+#ifdef TASK_TIMER_DWT
+    // clocks since the start of the current measurement period
+    uint16_t timing = (uint16_t)(DWT->CYCCNT - period_start_cycles);
+#else
+    uint16_t timing = sample_TIM13();
+#endif
 
     if (log_idx < TIMING_LOG_NUM_SLOTS) {
         timing_log_[log_idx] = timing;
     }
 }
 
-float Motor::phase_current_from_adcval(uint32_t ADCValue) {
+HOT_FUNCTION float Motor::phase_current_from_adcval(uint32_t ADCValue) {
     int adcval_bal = (int)ADCValue - (1 << 11);
     float amp_out_volt = (3.3f / (float)(1 << 12)) * (float)adcval_bal;
     float shunt_volt = amp_out_volt * phase_current_rev_gain_;
@@ -192,7 +280,7 @@ bool Motor::measure_phase_resistance(float test_current, float max_voltage) {
     
     size_t i = 0;
     axis_->run_control_loop([&](){
-        float Ialpha = -(current_meas_.phB + current_meas_.phC);
+        float Ialpha = current_meas_.phA;
         test_voltage += (kI * current_meas_period) * (test_current - Ialpha);
         if (test_voltage > max_voltage || test_voltage < -max_voltage)
             return set_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE), false;
@@ -216,6 +304,38 @@ bool Motor::measure_phase_resistance(float test_current, float max_voltage) {
     return true; // if we ran to completion that means success
 }
 
+// @brief Measures the voltage error that remains after dead time compensation
+// and updates config.dead_time and config.phase_resistance accordingly.
+//
+// Must run right after measure_phase_resistance(test_current, ...). The
+// voltage needed to drive a DC current I > 0 along phase A is
+//   V(I) = R * I + V_err,  V_err = 4/3 * vbus * (residual dead time) * f_pwm
+// so a second measurement at half the current separates R from V_err.
+// @brief Dead time that causes the voltage error V_err on a DC current along
+// phase A, see measure_dead_time()
+static float residual_dead_time(float V_err, float vbus) {
+    constexpr float pwm_hz = (float)TIM_1_8_CLOCK_HZ / (float)(2 * TIM_1_8_PERIOD_CLOCKS);
+    return 0.75f * V_err / (vbus * pwm_hz);
+}
+
+bool Motor::measure_dead_time(float test_current, float max_voltage) {
+    float V_full = config_.phase_resistance * test_current;
+    float I_half = 0.5f * test_current;
+    if (!measure_phase_resistance(I_half, max_voltage))
+        return false;
+    float V_half = config_.phase_resistance * I_half;
+
+    float R = (V_full - V_half) / (test_current - I_half);
+    float V_err = V_full - R * test_current;
+    if (!(R > 0.0f))
+        return set_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE), false;
+
+    config_.phase_resistance = R;
+    config_.dead_time = std::max(config_.dead_time + residual_dead_time(V_err, vbus_voltage), 0.0f);
+    update_dead_time_compensation();
+    return true;
+}
+
 bool Motor::measure_phase_inductance(float voltage_low, float voltage_high) {
     float test_voltages[2] = {voltage_low, voltage_high};
     float Ialphas[2] = {0.0f};
@@ -224,7 +344,7 @@ bool Motor::measure_phase_inductance(float voltage_low, float voltage_high) {
     size_t t = 0;
     axis_->run_control_loop([&](){
         int i = t & 1;
-        Ialphas[i] += -current_meas_.phB - current_meas_.phC;
+        Ialphas[i] += current_meas_.phA;
 
         // Test voltage along phase A
         if (!enqueue_voltage_timings(test_voltages[i], 0.0f))
@@ -253,13 +373,251 @@ bool Motor::measure_phase_inductance(float voltage_low, float voltage_high) {
     return true;
 }
 
+// @brief Measures the phase resistance and the d and q axis inductance in a
+// fraction of a second, as an alternative to measure_phase_resistance(),
+// measure_dead_time() and measure_phase_inductance().
+//
+// The voltage along phase A is ramped up until test_current flows, which
+// also aligns the rotor d axis with phase A unless the rotor is blocked.
+// A pseudo random binary sequence on top of it excites the winding and the
+// fit of the response with RLIdentifier gives R and Ld, independent of the
+// voltage lost to the dead time. The remaining DC voltage error then gives
+// the dead time, if its compensation is enabled. A zero mean sequence on the
+// beta axis while phase A holds the rotor gives Lq.
+// config.phase_inductance is set to the mean of Ld and Lq, which the
+// current controller gains are based on.
+bool Motor::measure_phase_rl_fast(float test_current, float max_voltage) {
+    static const float ramp_time = 0.1f; // [s] to reach max_voltage
+    static const int num_settle_cycles = (int)(0.02f / CURRENT_MEAS_PERIOD);
+    static const int num_fit_cycles = (int)(0.2f / CURRENT_MEAS_PERIOD);
+    uint32_t lfsr = 0x5a; // 7 bit maximal length sequence, repeats every 127 cycles
+    auto prbs = [&lfsr]() {
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0x60u);
+        return (lfsr & 1u) ? 1.0f : -1.0f;
+    };
+
+    float V_dc = 0.0f;
+    axis_->run_control_loop([&](){
+        if (current_meas_.phA >= test_current)
+            return false;
+        V_dc += (max_voltage / ramp_time) * current_meas_period;
+        if (V_dc > max_voltage)
+            return set_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE), false;
+        if (!enqueue_voltage_timings(V_dc, 0.0f))
+            return false; // error set inside enqueue_voltage_timings
+        log_timing(TIMING_LOG_MEAS_R);
+        return true;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    float V_step = 0.25f * V_dc;
+    RLIdentifier ident;
+    ident.reset(test_current, V_dc);
+    float I_sum = 0.0f;
+    int i = 0;
+    axis_->run_control_loop([&](){
+        float V = V_dc;
+        if (i >= num_settle_cycles) {
+            V += V_step * prbs();
+            ident.add(current_meas_.phA, V);
+            I_sum += current_meas_.phA;
+        }
+        if (!enqueue_voltage_timings(V, 0.0f))
+            return false; // error set inside enqueue_voltage_timings
+        log_timing(TIMING_LOG_MEAS_R);
+        return ++i < num_settle_cycles + num_fit_cycles;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+    float R, Ld;
+    if (!ident.solve(current_meas_period, &R, &Ld))
+        return set_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE), false;
+
+    ident.reset(0.0f, 0.0f);
+    i = 0;
+    axis_->run_control_loop([&](){
+        float V_beta = V_step * prbs();
+        ident.add(one_by_sqrt3 * (current_meas_.phB - current_meas_.phC), V_beta);
+        if (!enqueue_voltage_timings(V_dc, V_beta))
+            return false; // error set inside enqueue_voltage_timings
+        log_timing(TIMING_LOG_MEAS_L);
+        return ++i < num_fit_cycles;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+    float R_beta, Lq;
+    if (!ident.solve(current_meas_period, &R_beta, &Lq))
+        return set_error(ERROR_PHASE_INDUCTANCE_OUT_OF_RANGE), false;
+
+    config_.phase_resistance = R;
+    phase_inductance_d_ = Ld;
+    phase_inductance_q_ = Lq;
+    config_.mtpa_Ld = Ld;
+    config_.mtpa_Lq = Lq;
+    update_mtpa_table();
+    float L = 0.5f * (Ld + Lq);
+    config_.phase_inductance = L;
+    if (config_.dead_time_comp_enable) {
+        float V_err = V_dc - R * (I_sum / (float)num_fit_cycles);
+        config_.dead_time = std::max(config_.dead_time + residual_dead_time(V_err, vbus_voltage), 0.0f);
+        update_dead_time_compensation();
+    }
+    // same limits as measure_phase_inductance()
+    if (Ld < 2e-6f || Ld > 4000e-6f || Lq < 2e-6f || Lq > 4000e-6f)
+        return set_error(ERROR_PHASE_INDUCTANCE_OUT_OF_RANGE), false;
+    return true;
+}
+
+// @brief Measures the torque constant from the back-EMF during a short
+// open loop spin and writes it to config.torque_constant.
+// Needs the phase resistance and inductance.
+//
+// Like the lock-in spin, a d axis current along a rotating phase drags the
+// rotor along. In the steady state at the electrical velocity w the stator
+// voltage is V = (R + j w L) I + j w flux e^(j delta) with the unknown load
+// angle delta, so the magnitude of the remaining voltage gives the flux
+// linkage and with it the torque constant 3/2 * pole_pairs * flux.
+bool Motor::measure_torque_constant(float test_current, float phase_vel) {
+    static const float accel_time = 0.5f; // [s]
+    static const int num_test_cycles = (int)(0.25f / CURRENT_MEAS_PERIOD);
+    float phase = 0.0f;
+    float vel = 0.0f;
+    float Vd_sum = 0.0f, Vq_sum = 0.0f;
+    int i = 0;
+    axis_->run_control_loop([&](){
+        bool accelerating = std::abs(vel) < std::abs(phase_vel);
+        if (accelerating)
+            vel = std::clamp(vel + (phase_vel / accel_time) * current_meas_period, -std::abs(phase_vel), std::abs(phase_vel));
+        phase = wrap_pm_pi(phase + vel * current_meas_period);
+        float pwm_phase = phase + 1.5f * current_meas_period * vel;
+        if (!FOC_current(test_current, 0.0f, phase, pwm_phase, vel))
+            return false; // error set inside FOC_current
+        if (accelerating)
+            return true;
+        // The applied voltage in the frame of the current vector
+        float c, s;
+        our_arm_sincos_f32(pwm_phase, &s, &c);
+        Vd_sum += c * current_control_.final_v_alpha + s * current_control_.final_v_beta;
+        Vq_sum += c * current_control_.final_v_beta - s * current_control_.final_v_alpha;
+        return ++i < num_test_cycles;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    float Ed = Vd_sum / (float)num_test_cycles - config_.phase_resistance * test_current;
+    float Eq = Vq_sum / (float)num_test_cycles - phase_vel * config_.phase_inductance * test_current;
+    float flux = std::sqrt(Ed * Ed + Eq * Eq) / std::abs(phase_vel);
+    float torque_constant = 1.5f * (float)config_.pole_pairs * flux;
+    if (!(torque_constant > 1e-4f && torque_constant < 10.0f))
+        return set_error(ERROR_TORQUE_CONSTANT_OUT_OF_RANGE), false;
+    config_.set_torque_constant(torque_constant);
+    return true;
+}
+
+// @brief Steps the d axis current between 75% and 100% of test_current at
+// standstill and reports the achieved bandwidth and overshoot of the current
+// controller, averaged over a few steps.
+bool Motor::verify_current_control(float test_current) {
+    static const int num_steps = 4;
+    static const int step_cycles = (int)(0.02f / CURRENT_MEAS_PERIOD);
+    const float I_low = 0.75f * test_current;
+    float Id = I_low;
+    float bandwidth_sum = 0.0f, overshoot_sum = 0.0f;
+    StepResponse response;
+    int i = 0, step = -1; // the first period settles at I_low
+    float filter_k = current_control_.I_measured_report_filter_k;
+    current_control_.I_measured_report_filter_k = 1.0f;
+    reset_current_control();
+    axis_->run_control_loop([&](){
+        if (!FOC_current(Id, 0.0f, 0.0f, 0.0f, 0.0f))
+            return false; // error set inside FOC_current
+        if (step >= 0)
+            response.add(current_control_.Id_measured, current_meas_period);
+        if (++i < step_cycles)
+            return true;
+        i = 0;
+        if (step >= 0) {
+            bandwidth_sum += response.bandwidth();
+            overshoot_sum += response.overshoot();
+        }
+        if (++step >= num_steps)
+            return false;
+        float next = (step & 1) ? I_low : test_current;
+        response.reset(Id, next);
+        Id = next;
+        return true;
+    });
+    current_control_.I_measured_report_filter_k = filter_k;
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    current_control_step_bandwidth_ = bandwidth_sum / (float)num_steps;
+    current_control_step_overshoot_ = overshoot_sum / (float)num_steps;
+    return true;
+}
+
+
+// @brief Measures the gain mismatch of the phase B and C current sensors and
+// updates config.current_sense_gain_phB/phC such that both read the same.
+//
+// A DC current along phase A returns through phase B and C in equal parts,
+// whatever the resistance of the motor. The current is driven in both
+// directions and the readings are correlated with the direction, so that a
+// residual offset cancels. The mean gain of both sensors is kept.
+bool Motor::measure_current_sense_gain(float test_current, float max_voltage) {
+    static const float kI = 10.0f; // [(V/s)/A]
+    static const int num_settle_cycles = (int)(0.5f / CURRENT_MEAS_PERIOD);
+    static const int num_test_cycles = (int)(0.5f / CURRENT_MEAS_PERIOD);
+    float test_voltage = 0.0f;
+    float sum_B = 0.0f, sum_C = 0.0f;
+    int i = 0;
+    axis_->run_control_loop([&](){
+        float sign = i < num_settle_cycles + num_test_cycles ? 1.0f : -1.0f;
+        int cycle = i % (num_settle_cycles + num_test_cycles);
+        test_voltage += (kI * current_meas_period) * (sign * test_current - current_meas_.phA);
+        if (test_voltage > max_voltage || test_voltage < -max_voltage)
+            return set_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE), false;
+        if (cycle >= num_settle_cycles) {
+            sum_B += sign * current_meas_.phB;
+            sum_C += sign * current_meas_.phC;
+        }
+        if (!enqueue_voltage_timings(test_voltage, 0.0f))
+            return false; // error set inside enqueue_voltage_timings
+        log_timing(TIMING_LOG_MEAS_R);
+        return ++i < 2 * (num_settle_cycles + num_test_cycles);
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    // Both sums are about -test_current / 2 per cycle
+    float mean = 0.5f * (sum_B + sum_C);
+    float correction_B = mean / sum_B;
+    float correction_C = mean / sum_C;
+    if (!(correction_B > 0.8f && correction_B < 1.2f && correction_C > 0.8f && correction_C < 1.2f))
+        return set_error(ERROR_CURRENT_SENSE_GAIN_OUT_OF_RANGE), false;
+    config_.current_sense_gain_phB *= correction_B;
+    config_.current_sense_gain_phC *= correction_C;
+    return true;
+}
 
 bool Motor::run_calibration() {
     float R_calib_max_voltage = config_.resistance_calib_max_voltage;
-    if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
+    // The other measurements rely on the current sensors, so this comes first
+    if (config_.current_sense_gain_calib_enable
+            && (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT || config_.motor_type == MOTOR_TYPE_ACIM)
+            && !measure_current_sense_gain(config_.calibration_current, R_calib_max_voltage))
+        return false;
+    if (config_.fast_calibration_enable
+        && (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT || config_.motor_type == MOTOR_TYPE_ACIM)) {
+        if (!measure_phase_rl_fast(config_.calibration_current, R_calib_max_voltage))
+            return false;
+    } else if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
         || config_.motor_type == MOTOR_TYPE_ACIM) {
         if (!measure_phase_resistance(config_.calibration_current, R_calib_max_voltage))
             return false;
+        if (config_.dead_time_comp_enable && !measure_dead_time(config_.calibration_current, R_calib_max_voltage))
+            return false;
         if (!measure_phase_inductance(-R_calib_max_voltage, R_calib_max_voltage))
             return false;
     } else if (config_.motor_type == MOTOR_TYPE_GIMBAL) {
@@ -269,20 +627,52 @@ bool Motor::run_calibration() {
     }
 
     update_current_controller_gains();
+
+    // The spin needs the current controller, so this comes last
+    if (config_.torque_constant_calib_vel != 0.0f && config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
+            && !measure_torque_constant(config_.calibration_current, config_.torque_constant_calib_vel))
+        return false;
+    if (config_.current_control_step_test_current > 0.0f && config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
+            && !verify_current_control(config_.current_control_step_test_current))
+        return false;
     
     is_calibrated_ = true;
     return true;
 }
 
-bool Motor::enqueue_modulation_timings(float mod_alpha, float mod_beta) {
+HOT_FUNCTION bool Motor::enqueue_modulation_timings(float mod_alpha, float mod_beta) {
     if (is_nan(mod_alpha) || is_nan(mod_beta))
         return set_error(ERROR_MODULATION_IS_NAN), false;
-    auto [tA, tB, tC, success] = SVM(mod_alpha, mod_beta);
-    if(!success)
-        return set_error(ERROR_MODULATION_MAGNITUDE), false;
-    next_timings_[0] = (uint16_t)(tA * (float)TIM_1_8_PERIOD_CLOCKS);
-    next_timings_[1] = (uint16_t)(tB * (float)TIM_1_8_PERIOD_CLOCKS);
-    next_timings_[2] = (uint16_t)(tC * (float)TIM_1_8_PERIOD_CLOCKS);
+    float timings[3];
+    if (config_.modulation_mode == MODULATION_MODE_MIN_MAX) {
+        if (!minmax_svm(mod_alpha, mod_beta, timings))
+            return set_error(ERROR_MODULATION_MAGNITUDE), false;
+    } else {
+        auto [tA, tB, tC, success] = SVM(mod_alpha, mod_beta);
+        if(!success)
+            return set_error(ERROR_MODULATION_MAGNITUDE), false;
+        timings[0] = tA;
+        timings[1] = tB;
+        timings[2] = tC;
+    }
+
+    if (config_.dead_time_comp_enable) {
+        // During the dead time the phase is clamped to one of the rails by the
+        // freewheeling diodes, depending on the direction of the phase current.
+        // Positive current shortens the effective high side on-time by the
+        // dead time, negative current extends it. Near zero the direction is
+        // uncertain, so the correction is ramped in linearly.
+        timings[0] -= std::clamp(dead_time_comp_slope_ * current_meas_.phA, -dead_time_comp_, dead_time_comp_);
+        timings[1] -= std::clamp(dead_time_comp_slope_ * current_meas_.phB, -dead_time_comp_, dead_time_comp_);
+        timings[2] -= std::clamp(dead_time_comp_slope_ * current_meas_.phC, -dead_time_comp_, dead_time_comp_);
+        for (float& t : timings)
+            t = std::clamp(t, 0.0f, 1.0f);
+    }
+
+    next_timings_[0] = (uint16_t)(timings[0] * (float)TIM_1_8_PERIOD_CLOCKS);
+    next_timings_[1] = (uint16_t)(timings[1] * (float)TIM_1_8_PERIOD_CLOCKS);
+    next_timings_[2] = (uint16_t)(timings[2] * (float)TIM_1_8_PERIOD_CLOCKS);
+    deadline_monitor_.slack.startTime = sample_task_timer();
     next_timings_valid_ = true;
     return true;
 }
@@ -299,14 +689,14 @@ bool Motor::enqueue_voltage_timings(float v_alpha, float v_beta) {
 
 // We should probably make FOC Current call FOC Voltage to avoid duplication.
 bool Motor::FOC_voltage(float v_d, float v_q, float pwm_phase) {
-    float c = our_arm_cos_f32(pwm_phase);
-    float s = our_arm_sin_f32(pwm_phase);
+    float c, s;
+    our_arm_sincos_f32(pwm_phase, &s, &c);
     float v_alpha = c*v_d - s*v_q;
     float v_beta = c*v_q + s*v_d;
     return enqueue_voltage_timings(v_alpha, v_beta);
 }
 
-bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase, float phase_vel) {
+HOT_FUNCTION bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase, float phase_vel) {
     axis_->task_times_.FOC_Current.beginTimer();
     // Syntactic sugar
     CurrentControl_t& ictrl = current_control_;
@@ -315,18 +705,21 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
     ictrl.Iq_setpoint = Iq_des;
 
     // Check for current sense saturation
-    if (std::abs(current_meas_.phB) > ictrl.overcurrent_trip_level || std::abs(current_meas_.phC) > ictrl.overcurrent_trip_level) {
+    if (std::abs(current_meas_.phA) > ictrl.overcurrent_trip_level
+            || std::abs(current_meas_.phB) > ictrl.overcurrent_trip_level
+            || std::abs(current_meas_.phC) > ictrl.overcurrent_trip_level) {
         set_error(ERROR_CURRENT_SENSE_SATURATION);
         return false;
     }
 
     // Clarke transform
-    float Ialpha = -current_meas_.phB - current_meas_.phC;
+    // The phase currents sum to zero after reconstruct_phase_currents()
+    float Ialpha = current_meas_.phA;
     float Ibeta = one_by_sqrt3 * (current_meas_.phB - current_meas_.phC);
 
     // Park transform
-    float c_I = our_arm_cos_f32(I_phase);
-    float s_I = our_arm_sin_f32(I_phase);
+    float c_I, s_I;
+    our_arm_sincos_f32(I_phase, &s_I, &c_I);
     float Id = c_I * Ialpha + s_I * Ibeta;
     float Iq = c_I * Ibeta - s_I * Ialpha;
     ictrl.Iq_measured += ictrl.I_measured_report_filter_k * (Iq - ictrl.Iq_measured);
@@ -339,9 +732,21 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
         return false;
     }
 
+    // With high frequency injection the currents carry a ripple at half the
+    // control frequency. The mean of two consecutive samples cancels it, so
+    // the current controller doesn't react to the injection.
+    float Id_ctrl = Id;
+    float Iq_ctrl = Iq;
+    if (hfi_voltage_ != 0.0f) {
+        Id_ctrl = 0.5f * (Id + hfi_Id_last_);
+        Iq_ctrl = 0.5f * (Iq + hfi_Iq_last_);
+    }
+    hfi_Id_last_ = Id;
+    hfi_Iq_last_ = Iq;
+
     // Current error
-    float Ierr_d = Id_des - Id;
-    float Ierr_q = Iq_des - Iq;
+    float Ierr_d = Id_des - Id_ctrl;
+    float Ierr_q = Iq_des - Iq_ctrl;
 
     // Apply PI control
     float Vd = ictrl.v_current_control_integral_d + Ierr_d * ictrl.p_gain;
@@ -355,69 +760,52 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
     }
 
     if (config_.bEMF_FF_enable) {
-        Vq += phase_vel * (2.0f/3.0f) * (config_.torque_constant / config_.pole_pairs);
+        Vq += phase_vel * axis_->derived_.bemf_ff_gain;
+    }
+
+    // Square wave injection on the d axis for the sensorless estimator,
+    // alternating every cycle
+    if (hfi_voltage_ != 0.0f) {
+        hfi_sign_ = hfi_sign_ > 0.0f ? -1.0f : 1.0f;
+        Vd += hfi_sign_ * hfi_voltage_;
+    } else {
+        hfi_sign_ = 0.0f;
     }
 
     float mod_to_V = (2.0f / 3.0f) * vbus_voltage;
     float V_to_mod = 1.0f / mod_to_V;
-    float mod_d = V_to_mod * Vd;
-    float mod_q = V_to_mod * Vq;
-
-    // Vector modulation saturation, lock integrator if saturated
-    // TODO make maximum modulation configurable
-    float mod_scalefactor = 0.80f * sqrt3_by_2 * 1.0f / std::sqrt(mod_d * mod_d + mod_q * mod_q);
-    if (mod_scalefactor < 1.0f) {
-        mod_d *= mod_scalefactor;
-        mod_q *= mod_scalefactor;
-        // TODO make decayfactor configurable
-        ictrl.v_current_control_integral_d *= 0.99f;
-        ictrl.v_current_control_integral_q *= 0.99f;
+
+    // Vector modulation saturation and inverse park transform
+    FocModulation_t mod = foc_modulation(V_to_mod * Vd, V_to_mod * Vq, c_I, s_I, I_phase, pwm_phase,
+            config_.max_modulation, config_.overmodulation_enable, config_.small_angle_pwm_phase_enable,
+            our_arm_sincos_f32);
+    ictrl.modulation = mod.modulation; // for the field weakening
+
+    // Lock integrator if saturated
+    if (mod.saturated) {
+        ictrl.v_current_control_integral_d *= config_.current_control_integrator_decay;
+        ictrl.v_current_control_integral_q *= config_.current_control_integrator_decay;
     } else {
-        ictrl.v_current_control_integral_d += Ierr_d * (ictrl.i_gain * current_meas_period);
-        ictrl.v_current_control_integral_q += Ierr_q * (ictrl.i_gain * current_meas_period);
+        float pi_vel = config_.current_control_complex_vector_enable ? phase_vel : 0.0f;
+        current_pi_integrate(&ictrl.v_current_control_integral_d, &ictrl.v_current_control_integral_q,
+                Ierr_d, Ierr_q, ictrl.p_gain, ictrl.i_gain, pi_vel, current_meas_period);
     }
 
     // Compute estimated bus current
-    ictrl.Ibus = mod_d * Id + mod_q * Iq;
-
-    // Inverse park transform
-    float c_p = our_arm_cos_f32(pwm_phase);
-    float s_p = our_arm_sin_f32(pwm_phase);
-    float mod_alpha = c_p * mod_d - s_p * mod_q;
-    float mod_beta = c_p * mod_q + s_p * mod_d;
+    ictrl.Ibus = mod.mod_d * Id + mod.mod_q * Iq;
+    ictrl.mod_q = mod.mod_q;
 
     // Report final applied voltage in stationary frame (for sensorles estimator)
-    ictrl.final_v_alpha = mod_to_V * mod_alpha;
-    ictrl.final_v_beta = mod_to_V * mod_beta;
+    ictrl.final_v_alpha = mod_to_V * mod.mod_alpha;
+    ictrl.final_v_beta = mod_to_V * mod.mod_beta;
 
     // Apply SVM
-    if (!enqueue_modulation_timings(mod_alpha, mod_beta))
+    if (!enqueue_modulation_timings(mod.mod_alpha, mod.mod_beta))
         return false; // error set inside enqueue_modulation_timings
     log_timing(TIMING_LOG_FOC_CURRENT);
 
-    if (axis_->axis_num_ == 0) {
-
-        // Edit these to suit your capture needs
-        float trigger_data = ictrl.v_current_control_integral_d;
-        float trigger_threshold = 0.5f;
-        float sample_data = Ialpha;
-
-        static bool ready = false;
-        static bool capturing = false;
-        if (trigger_data < trigger_threshold) {
-            ready = true;
-        }
-        if (ready && trigger_data >= trigger_threshold) {
-            capturing = true;
-            ready = false;
-        }
-        if (capturing) {
-            oscilloscope[oscilloscope_pos] = sample_data;
-            if (++oscilloscope_pos >= OSCILLOSCOPE_SIZE) {
-                oscilloscope_pos = 0;
-                capturing = false;
-            }
-        }
+    if (kFeatureOscilloscope && axis_->axis_num_ == 0) {
+        odrv.oscilloscope_.update();
     }
 
     axis_->task_times_.FOC_Current.stopTimer();
@@ -427,60 +815,96 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
 // torque_setpoint [Nm]
 // phase [rad electrical]
 // phase_vel [rad/s electrical]
-bool Motor::update(float torque_setpoint, float phase, float phase_vel) {
+HOT_FUNCTION bool Motor::update(float torque_setpoint, float phase, float phase_vel) {
     float current_setpoint = 0.0f;
     phase *= config_.direction;
     phase_vel *= config_.direction;
 
-    if (config_.motor_type == MOTOR_TYPE_ACIM) {
-        current_setpoint = torque_setpoint / (config_.torque_constant * std::max(current_control_.acim_rotor_flux, config_.acim_gain_min_flux));
+    float id_mtpa = 0.0f;
+    if (is_acim()) {
+        current_setpoint = torque_setpoint * axis_->derived_.inv_torque_constant * acim_flux_observer_.inv_flux();
+    }
+    else if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT && config_.mtpa_enable) {
+        // Reluctance torque from negative Id, see Mtpa
+        mtpa_.get(torque_setpoint, &id_mtpa, &current_setpoint);
     }
     else {
-        current_setpoint = torque_setpoint / config_.torque_constant;
+        current_setpoint = torque_setpoint * axis_->derived_.inv_torque_constant;
     }
     current_setpoint *= config_.direction;
 
-    // TODO: 2-norm vs independent clamping (current could be sqrt(2) bigger)
     float ilim = effective_current_lim_;
-    float id = std::clamp(current_control_.Id_setpoint, -ilim, ilim);
+    float id = std::clamp(current_control_.Id_setpoint + id_mtpa, -ilim, ilim);
     float iq = std::clamp(current_setpoint, -ilim, ilim);
 
-    if (config_.motor_type == MOTOR_TYPE_ACIM) {
+    // Electrical frequency torque ripple and negative Id once the current
+    // controller runs out of voltage
+    if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT) {
+        HarmonicCompensator::update(config_.harmonic_compensation, phase, phase_vel, iq, current_meas_period, &id, &iq);
+        float id_fw = field_weakening_.update(config_.field_weakening, current_control_.modulation, ilim, current_meas_period);
+        current_control_.Id_field_weakening = id_fw;
+        id = std::clamp(id + id_fw, -ilim, ilim);
+    }
+
+    if (is_acim()) {
         // Note that the effect of the current commands on the real currents is actually 1.5 PWM cycles later
         // However the rotor time constant is (usually) so slow that it doesn't matter
         // So we elect to write it as if the effect is immediate, to have cleaner code
 
         if (config_.acim_autoflux_enable) {
-            float abs_iq = std::abs(iq);
-            float gain = abs_iq > id ? config_.acim_autoflux_attack_gain : config_.acim_autoflux_decay_gain;
-            id += gain * (abs_iq - id) * current_meas_period;
+            // Towards the flux with the least copper loss for the torque.
+            // Unlike |Iq| this target doesn't wait for the flux to build up.
+            float id_opt = acim_loss_optimal_Id(torque_setpoint, config_.torque_constant);
+            float gain = id_opt > id ? config_.acim_autoflux_attack_gain : config_.acim_autoflux_decay_gain;
+            id += gain * (id_opt - id) * current_meas_period;
             id = std::clamp(id, config_.acim_autoflux_min_Id, ilim);
             current_control_.Id_setpoint = id;
         }
 
-        // acim_rotor_flux is normalized to units of [A] tracking Id; rotor inductance is unspecified
-        float dflux_by_dt = config_.acim_slip_velocity * (id - current_control_.acim_rotor_flux);
-        current_control_.acim_rotor_flux += dflux_by_dt * current_meas_period;
-        float slip_velocity = config_.acim_slip_velocity * (iq / current_control_.acim_rotor_flux);
-        // Check for issues with small denominator.
-        if (is_nan(slip_velocity) || std::abs(slip_velocity) > 0.1f * (float)current_meas_hz)
-            slip_velocity = 0.0f;
+        // The rotor flux is normalized to units of [A] tracking Id; rotor inductance is unspecified
+        float slip_velocity = acim_flux_observer_.update(id, iq);
+        current_control_.acim_rotor_flux = acim_flux_observer_.flux();
         phase_vel += slip_velocity;
         // reporting only:
         current_control_.async_phase_vel = slip_velocity;
 
         current_control_.async_phase_offset += slip_velocity * current_meas_period;
-        current_control_.async_phase_offset = wrap_pm_pi(current_control_.async_phase_offset);
+        current_control_.async_phase_offset = wrap_pm_pi_fast(current_control_.async_phase_offset);
         phase += current_control_.async_phase_offset;
-        phase = wrap_pm_pi(phase);
+        phase = wrap_pm_pi_fast(phase);
     }
 
+    // The current vector is limited to ilim (as checked by FOC_current), Id
+    // has precedence
+    float iq_lim = max_Iq_for_current_lim(id, ilim);
+    iq = std::clamp(iq, -iq_lim, iq_lim);
+
     float pwm_phase = phase + 1.5f * current_meas_period * phase_vel;
 
+    // Fast torque inputs on top of this command, the torque is the output of
+    // the controller update that set up the window
+    const FastTorqueWindow& fast_torque = axis_->controller_.fast_torque_window_;
+    bool fast_torque_active = fast_torque.active() && fast_torque.output() == torque_setpoint;
+
     // Execute current command
     switch(config_.motor_type){
-        case MOTOR_TYPE_HIGH_CURRENT: return FOC_current(id, iq, phase, pwm_phase, phase_vel); break;
-        case MOTOR_TYPE_ACIM: return FOC_current(id, iq, phase, pwm_phase, phase_vel); break;
+        case MOTOR_TYPE_HIGH_CURRENT:
+        case MOTOR_TYPE_ACIM:
+            if (current_loop_in_isr_) {
+                // The interrupt has already passed for this cycle, so the
+                // timings for the very first cycle after arming come from here.
+                bool ok = current_command_valid_ || FOC_current(id, iq, phase, pwm_phase, phase_vel);
+                // Iq is linear in the torque unless MTPA or the ACIM flux shape it
+                bool linear = config_.motor_type == MOTOR_TYPE_HIGH_CURRENT && !config_.mtpa_enable;
+                float iq_per_torque = fast_torque_active && linear
+                                    ? axis_->derived_.inv_torque_constant * config_.direction : 0.0f;
+                post_current_command({id, iq, phase, phase_vel, fast_torque, iq_per_torque, iq_lim});
+                return ok;
+            }
+            if (fast_torque_active)
+                record_fast_torque_latency(fast_torque.seq());
+            return FOC_current(id, iq, phase, pwm_phase, phase_vel);
+            break;
         case MOTOR_TYPE_GIMBAL: return FOC_voltage(id, iq, pwm_phase); break;
         default: set_error(ERROR_NOT_IMPLEMENTED_MOTOR_TYPE); return false; break;
     }
@@ -494,5 +918,99 @@ void Motor::tim_update_cb() {
     if (counting_down)
         return;
 
+    axis_->gpio_sampler_.sample();
     axis_->encoder_.sample_now();
 }
+
+// @brief Hands a new current command to the current loop in the interrupt.
+// Must only be called from the axis thread.
+void Motor::post_current_command(const CurrentCommand_t& command) {
+    uint32_t seq = current_command_seq_;
+    current_command_buf_[(seq + 1) & 1] = command;
+    std::atomic_signal_fence(std::memory_order_release); // publish the buffer before the counter
+    current_command_seq_ = seq + 1;
+    current_command_valid_ = true;
+}
+
+// @brief Hands a torque input to the current loop in the interrupt, which
+// applies it through the window of the last controller update.
+// Must be called from a critical section.
+void Motor::post_fast_torque(float torque) {
+    fast_torque_ = torque;
+    fast_torque_time_ = micros();
+    fast_torque_seq_ = fast_torque_seq_ + 1;
+}
+
+// @brief Records the latency of a fast torque input when the current loop
+// first applies it. The torque takes effect 1.5 current measurement periods
+// after the current loop ran, in the middle of the next PWM period.
+void Motor::record_fast_torque_latency(uint32_t seq) {
+    // Inputs that were overwritten before they were applied have no latency
+    bool first = false;
+    uint32_t time = 0;
+    CRITICAL_SECTION() {
+        first = seq == fast_torque_seq_ && seq != fast_torque_seq_applied_;
+        time = fast_torque_time_;
+    }
+    if (!first)
+        return;
+    fast_torque_seq_applied_ = seq;
+    fast_torque_latency_ = micros() - time + (uint32_t)(1.5f * current_meas_period * 1e6f);
+    fast_torque_max_latency_ = std::max(fast_torque_max_latency_, fast_torque_latency_);
+}
+
+// @brief Completes the phase current measurement of this period.
+// With only two shunts, phase A is derived from phase B and C. If the board
+// also measured phase A, the phase with the shortest low side window in the
+// timings that were active while sampling is derived from the other two.
+// The timings enqueued in the previous period are the ones that were active.
+// @param phA_measured: true if the board wrote current_meas_.phA
+HOT_FUNCTION void Motor::reconstruct_phase_currents(bool phA_measured) {
+    if (!phA_measured) {
+        current_meas_.phA = -current_meas_.phB - current_meas_.phC;
+        return;
+    }
+    float I[3] = {current_meas_.phA, current_meas_.phB, current_meas_.phC};
+    reconstruct_phase_current(I, next_timings_);
+    current_meas_ = {I[0], I[1], I[2]};
+}
+
+// @brief Runs the current controller on the latest posted command.
+// This is called from the current measurement interrupt right after both
+// phase currents were sampled. It does nothing unless the axis thread posted
+// a command since the motor was armed.
+HOT_FUNCTION void Motor::current_meas_isr_update() {
+    // Number of cycles for which a command is reused if the axis thread falls
+    // behind. After that no timings are produced and the interrupt handler
+    // disarms the motor with ERROR_CONTROL_DEADLINE_MISSED.
+    constexpr uint32_t max_command_age = 2;
+
+    if (!current_loop_in_isr_ || !current_command_valid_ || armed_state_ == ARMED_STATE_DISARMED)
+        return;
+
+    uint32_t seq = current_command_seq_;
+    if (seq != current_command_seq_seen_) {
+        current_command_seq_seen_ = seq;
+        current_command_age_ = 0;
+    } else if (++current_command_age_ > max_command_age) {
+        return;
+    }
+    const CurrentCommand_t& cmd = current_command_buf_[seq & 1];
+
+    // The command was computed from the previous current measurement (or an
+    // earlier one if the thread fell behind), so extrapolate its phase.
+    float dt = (float)(current_command_age_ + 1) * current_meas_period;
+    float phase = wrap_pm_pi_fast(cmd.phase + dt * cmd.phase_vel);
+    float pwm_phase = phase + 1.5f * current_meas_period * cmd.phase_vel;
+
+    // A torque input that arrived after the axis thread computed the command
+    float iq = cmd.Iq_setpoint;
+    float torque;
+    if (cmd.Iq_per_torque != 0.0f && cmd.fast_torque.apply(fast_torque_seq_, fast_torque_, &torque)) {
+        iq = std::clamp(iq + (torque - cmd.fast_torque.output()) * cmd.Iq_per_torque, -cmd.Iq_limit, cmd.Iq_limit);
+        record_fast_torque_latency(fast_torque_seq_);
+    } else if (cmd.fast_torque.active()) {
+        record_fast_torque_latency(cmd.fast_torque.seq());
+    }
+    FOC_current(cmd.Id_setpoint, iq, phase, pwm_phase, cmd.phase_vel);
+}
@@ -7,6 +7,13 @@ class Motor;
 #include <board.h>
 
 #include <autogen/interfaces.hpp>
+#include "field_weakening.hpp"
+#include "acim_flux_observer.hpp"
+#include "mtpa.hpp"
+#include "current_loop_tuning.hpp"
+#include "harmonic_compensator.hpp"
+#include "fast_torque_window.hpp"
+#include "features.hpp"
 
 enum TimingLog_t {
     TIMING_LOG_GENERAL,
@@ -26,11 +33,25 @@ enum TimingLog_t {
 
 class Motor : public ODriveIntf::MotorIntf {
 public:
-    struct Iph_BC_t {
+    struct Iph_ABC_t {
+        float phA;
         float phB;
         float phC;
     };
 
+    // Current command that the axis thread hands to the current controller
+    // when the latter runs in the current measurement interrupt.
+    struct CurrentCommand_t {
+        float Id_setpoint; // [A]
+        float Iq_setpoint; // [A]
+        float phase; // [rad] electrical, at the time of the latest current measurement
+        float phase_vel; // [rad/s] electrical
+        // Fast torque input, see Controller::Config_t::fast_torque_input
+        FastTorqueWindow fast_torque;
+        float Iq_per_torque; // [A/Nm] 0 if the interrupt must not apply fast torque inputs
+        float Iq_limit; // [A]
+    };
+
     struct CurrentControl_t{
         float p_gain; // [V/A]
         float i_gain; // [V/As]
@@ -50,6 +71,9 @@ public:
         float acim_rotor_flux; // [A]
         float async_phase_vel; // [rad/s electrical]
         float async_phase_offset; // [rad electrical]
+        float modulation; // unsaturated modulation magnitude of the last cycle, relative to its limit
+        float Id_field_weakening; // [A] included in the d axis current command
+        float mod_q; // applied q axis modulation of the last cycle, the change of Ibus with Iq
     };
 
     // NOTE: for gimbal motors, all units of Nm are instead V.
@@ -70,19 +94,48 @@ public:
         float current_lim = 10.0f;          //[A]
         float current_lim_margin = 8.0f;    // Maximum violation of current_lim
         float torque_lim = std::numeric_limits<float>::infinity();           //[Nm]. 
+        float motoring_torque_lim = std::numeric_limits<float>::infinity();  // [Nm] along the direction of rotation
+        float regen_torque_lim = std::numeric_limits<float>::infinity();     // [Nm] against the direction of rotation
         // Value used to compute shunt amplifier gains
         float requested_current_range = 60.0f; // [A]
         float current_control_bandwidth = 1000.0f;  // [rad/s]
+        bool current_control_delay_comp_enable = false; // Include the 1.5 period loop delay in the design of the current controller gains
+        bool current_control_complex_vector_enable = false; // Complex vector PI that keeps d and q decoupled at high electrical speeds
+        float max_modulation = 0.80f; // Modulation limit of the current controller, 1.0 = largest undistorted sine wave
+        float current_control_integrator_decay = 0.99f; // Decay factor per cycle of the current integrators while the modulation is saturated
+        bool overmodulation_enable = false; // Allow max_modulation up to 2/sqrt(3), clipping the voltage vector to the SVM hexagon
         float inverter_temp_limit_lower = 100;
         float inverter_temp_limit_upper = 120;
-        float acim_slip_velocity = 14.706f; // [rad/s electrical] = 1/rotor_tau
+        float acim_slip_velocity = 14.706f; // [rad/s electrical] = 1/rotor_tau at acim_rotor_ref_temp
+        float acim_rotor_tempco = 0.0039f; // [1/K] of the rotor resistance, aluminium bars
+        float acim_rotor_ref_temp = 25.0f; // [°C]
         float acim_gain_min_flux = 10; // [A]
         float acim_autoflux_min_Id = 10; // [A]
         bool acim_autoflux_enable = false;
         float acim_autoflux_attack_gain = 10.0f;
         float acim_autoflux_decay_gain = 1.0f;
+        FieldWeakening::Config_t field_weakening; // MOTOR_TYPE_HIGH_CURRENT only
+        HarmonicCompensator::Config_t harmonic_compensation; // MOTOR_TYPE_HIGH_CURRENT only
+        bool mtpa_enable = false; // MOTOR_TYPE_HIGH_CURRENT only
+        float mtpa_Ld = 0.0f; // [H] d axis inductance for the MTPA table, set by measure_phase_rl_fast
+        float mtpa_Lq = 0.0f; // [H] q axis inductance for the MTPA table, set by measure_phase_rl_fast
         bool R_wL_FF_enable = false; // Enable feedforwards for R*I and w*L*I terms
         bool bEMF_FF_enable = false; // Enable feedforward for bEMF
+        bool small_angle_pwm_phase_enable = true; // Derive the PWM phase sin/cos from the current phase sin/cos by a small-angle rotation
+        ModulationMode modulation_mode = MODULATION_MODE_SVM;
+        bool current_loop_in_isr_enable = false; // Run FOC_current in the current measurement interrupt. Takes effect when the motor is armed.
+        bool fast_calibration_enable = false; // Measure R and L with measure_phase_rl_fast() in run_calibration
+        float torque_constant_calib_vel = 0.0f; // [rad/s electrical] spin velocity of measure_torque_constant() in run_calibration, 0 to disable
+        float current_control_step_test_current = 0.0f; // [A] steps of verify_current_control() in run_calibration, 0 to disable
+        bool dead_time_comp_enable = false; // Compensate the PWM timings for the voltage error caused by the dead time
+        float dead_time = (float)TIM_1_8_DEADTIME_CLOCKS / (float)TIM_1_8_CLOCK_HZ; // [s] effective dead time, measured by run_calibration if compensation is enabled
+        float dead_time_comp_ramp_current = 0.5f; // [A] phase current below which the compensation is ramped down linearly
+        uint32_t deadline_near_miss_threshold = 0; // [clocks] slack below which a near miss of the PWM update deadline is counted
+        float dc_calib_phB = 0.0f; // [A] settled current sensor offsets at the last save, seed the DC calibration on fast boot
+        float dc_calib_phC = 0.0f; // [A]
+        bool current_sense_gain_calib_enable = false; // Measure current_sense_gain_phB/phC with measure_current_sense_gain() in run_calibration
+        float current_sense_gain_phB = 1.0f; // correction factor of the phase B current sensor
+        float current_sense_gain_phC = 1.0f;
 
         // custom property setters
         Motor* parent = nullptr;
@@ -93,6 +146,15 @@ public:
         void set_phase_inductance(float value) { phase_inductance = value; parent->update_current_controller_gains(); }
         void set_phase_resistance(float value) { phase_resistance = value; parent->update_current_controller_gains(); }
         void set_current_control_bandwidth(float value) { current_control_bandwidth = value; parent->update_current_controller_gains(); }
+        void set_current_control_delay_comp_enable(bool value) { current_control_delay_comp_enable = value; parent->update_current_controller_gains(); }
+        void set_dead_time(float value) { dead_time = value; parent->update_dead_time_compensation(); }
+        void set_dead_time_comp_ramp_current(float value) { dead_time_comp_ramp_current = value; parent->update_dead_time_compensation(); }
+        void set_current_lim(float value) { current_lim = value; parent->update_mtpa_table(); }
+        void set_mtpa_enable(bool value) { mtpa_enable = value; parent->update_mtpa_table(); }
+        void set_mtpa_Ld(float value) { mtpa_Ld = value; parent->update_mtpa_table(); }
+        void set_mtpa_Lq(float value) { mtpa_Lq = value; parent->update_mtpa_table(); }
+        void set_pole_pairs(int32_t value);
+        void set_torque_constant(float value);
     };
 
     Motor(TIM_HandleTypeDef* timer,
@@ -110,20 +172,35 @@ public:
     void reset_current_control();
 
     void update_current_controller_gains();
+    void update_dead_time_compensation();
+    void update_mtpa_table();
+    void update_acim_flux_observer();
     void set_error(Error error);
     bool do_checks();
     float effective_current_lim();
     float max_available_torque();
+    bool is_acim() const { return kFeatureAcim && config_.motor_type == MOTOR_TYPE_ACIM; }
     void log_timing(TimingLog_t log_idx);
+    void record_deadline_slack(uint32_t timestamp);
     float phase_current_from_adcval(uint32_t ADCValue);
     bool measure_phase_resistance(float test_current, float max_voltage);
     bool measure_phase_inductance(float voltage_low, float voltage_high);
+    bool measure_dead_time(float test_current, float max_voltage);
+    bool measure_phase_rl_fast(float test_current, float max_voltage);
+    bool measure_torque_constant(float test_current, float phase_vel);
+    bool measure_current_sense_gain(float test_current, float max_voltage);
+    bool verify_current_control(float test_current);
     bool run_calibration();
     bool enqueue_modulation_timings(float mod_alpha, float mod_beta);
     bool enqueue_voltage_timings(float v_alpha, float v_beta);
     bool FOC_voltage(float v_d, float v_q, float pwm_phase);
     bool FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase, float phase_vel);
     bool update(float current_setpoint, float phase, float phase_vel);
+    void post_current_command(const CurrentCommand_t& command);
+    void post_fast_torque(float torque);
+    void record_fast_torque_latency(uint32_t seq);
+    void reconstruct_phase_currents(bool phA_measured);
+    void current_meas_isr_update();
     void tim_update_cb();
 
     // hardware config
@@ -134,6 +211,18 @@ public:
     TOpAmp& opamp_;
     OnboardThermistorCurrentLimiter& fet_thermistor_;
     OffboardThermistorCurrentLimiter& motor_thermistor_;
+    // The default parameters are rough values for a 63mm hobby motor and the
+    // FETs of the v3.6 board, they should be fitted to a heating run.
+    ThermalModelCurrentLimiter motor_thermal_model_{motor_thermistor_, 0, {
+        .resistance = 0.0f, .resistance_tempco = 0.00393f,
+        .heat_capacity_source = 30.0f, .thermal_resistance_source = 0.5f,
+        .heat_capacity_sink = 300.0f, .thermal_resistance_sink = 1.5f,
+        .temp_limit = 120.0f}};
+    ThermalModelCurrentLimiter fet_thermal_model_{fet_thermistor_, 1, {
+        .resistance = 0.002f, .resistance_tempco = 0.005f,
+        .heat_capacity_source = 2.0f, .thermal_resistance_source = 1.0f,
+        .heat_capacity_sink = 50.0f, .thermal_resistance_sink = 3.0f,
+        .temp_limit = 125.0f}};
 
     Config_t config_;
     Axis* axis_ = nullptr; // set by Axis constructor
@@ -146,6 +235,12 @@ public:
         TIM_1_8_PERIOD_CLOCKS / 2
     };
     bool next_timings_valid_ = false;
+    struct {
+        TaskTimer slack; // startTime is when the timings were queued
+        uint32_t near_misses = 0;
+        uint32_t deadline_misses = 0;
+        uint32_t current_meas_timeouts = 0;
+    } deadline_monitor_;
     uint16_t last_cpu_time_ = 0;
     int timing_log_index_ = 0;
     struct {
@@ -160,8 +255,9 @@ public:
     // It is for exclusive use by the safety_critical_... functions.
     ArmedState armed_state_ = ARMED_STATE_DISARMED; 
     bool is_calibrated_ = config_.pre_calibrated;
-    Iph_BC_t current_meas_ = {0.0f, 0.0f};
-    Iph_BC_t DC_calib_ = {0.0f, 0.0f};
+    Iph_ABC_t current_meas_ = {0.0f, 0.0f, 0.0f};
+    Iph_ABC_t DC_calib_ = {0.0f, 0.0f, 0.0f};
+    uint32_t dc_calib_samples_ = 0; // DC offset measurements averaged so far, counts up to config.dc_calib_startup_samples
     float phase_current_rev_gain_ = 0.0f; // Reverse gain for ADC to Amps (to be set by DRV8301_setup)
     CurrentControl_t current_control_ = {
         .p_gain = 0.0f,        // [V/A] should be auto set after resistance and inductance measurement
@@ -181,8 +277,46 @@ public:
         .acim_rotor_flux = 0.0f,
         .async_phase_vel = 0.0f,
         .async_phase_offset = 0.0f,
+        .modulation = 0.0f,
+        .Id_field_weakening = 0.0f,
+        .mod_q = 0.0f,
     };
     float effective_current_lim_ = 10.0f; // [A]
+    FieldWeakening field_weakening_;
+    Mtpa mtpa_;
+    AcimFluxObserver acim_flux_observer_; // MOTOR_TYPE_ACIM only
+    float phase_inductance_d_ = 0.0f; // [H] set by measure_phase_rl_fast
+    float phase_inductance_q_ = 0.0f; // [H] set by measure_phase_rl_fast
+    float current_control_step_bandwidth_ = 0.0f; // [rad/s] set by verify_current_control
+    float current_control_step_overshoot_ = 0.0f; // set by verify_current_control
+    float dead_time_comp_ = 0.0f; // PWM timing correction at full compensation
+    float dead_time_comp_slope_ = 0.0f; // [1/A] PWM timing correction per phase current in the ramp region
+    // High frequency injection, driven by the sensorless estimator
+    float hfi_voltage_ = 0.0f; // [V] amplitude of the square wave added to Vd, 0 to disable
+    float hfi_sign_ = 0.0f; // sign of the injection of the last FOC_current cycle, 0 if none
+    float hfi_Id_last_ = 0.0f; // [A]
+    float hfi_Iq_last_ = 0.0f; // [A]
+
+    // Mailbox from the axis thread to the interrupt-context current loop.
+    // The thread only ever writes the buffer that the interrupt is not
+    // pointed at and then publishes it by incrementing the sequence counter.
+    // This is lock-free because the interrupt can preempt the thread but not
+    // vice versa.
+    bool current_loop_in_isr_ = false; // latched from config on arm()
+    CurrentCommand_t current_command_buf_[2] = {};
+    volatile uint32_t current_command_seq_ = 0;
+    volatile bool current_command_valid_ = false; // set by the first command after arming
+    uint32_t current_command_seq_seen_ = 0; // interrupt only
+    uint32_t current_command_age_ = 0; // [cycles] interrupt only
+
+    // Latest fast torque input, written in a critical section by
+    // Controller::set_input_setpoints
+    volatile float fast_torque_ = 0.0f; // [Nm]
+    volatile uint32_t fast_torque_time_ = 0; // [us] micros() when it was posted
+    volatile uint32_t fast_torque_seq_ = 0;
+    uint32_t fast_torque_seq_applied_ = 0; // the latest input whose latency was recorded
+    uint32_t fast_torque_latency_ = 0; // [us] from the input to the middle of the PWM period that applies it
+    uint32_t fast_torque_max_latency_ = 0; // [us] cleared by writing 0
 };
 
 #endif // __MOTOR_HPP
@@ -0,0 +1,96 @@
+#ifndef __MTPA_HPP
+#define __MTPA_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+// Maximum torque per ampere current references for salient PM motors.
+// With Ld < Lq (interior magnets) a negative d axis current adds reluctance
+// torque:
+//   T = 1.5 * pole_pairs * Iq * (flux + (Ld - Lq) * Id)
+// where torque_constant = 1.5 * pole_pairs * flux. For a given current
+// magnitude I the torque is largest at
+//   Id = (flux - sqrt(flux^2 + 8 * (Lq - Ld)^2 * I^2)) / (4 * (Lq - Ld))
+//
+// Solving this for a torque request needs a square root and an iteration, so
+// build() tabulates Id over evenly spaced torques up to the torque at
+// max_current, whenever the motor parameters change. get() then interpolates
+// Id from the table and solves the torque equation for Iq. Above the table
+// the last Id is used, the current limit of the caller takes over there.
+class Mtpa {
+public:
+    static constexpr size_t table_size = 32;
+
+    // @brief Rebuilds the table.
+    // @param Ld, Lq: [H] d and q axis inductance
+    // @param max_current: [A] current magnitude of the last table entry
+    // @returns false if the motor is not salient (Lq <= Ld) or a parameter is
+    //          invalid. get() then returns Id = 0 and Iq = torque / torque_constant.
+    bool build(float torque_constant, int32_t pole_pairs, float Ld, float Lq, float max_current) {
+        kt_ = torque_constant;
+        kr_ = 0.0f;
+        valid_ = false;
+        if (!(torque_constant > 0.0f) || pole_pairs <= 0 || !(Ld > 0.0f) || !(Lq > Ld) || !(max_current > 0.0f))
+            return false;
+
+        float flux = torque_constant / (1.5f * (float)pole_pairs);
+        float dL = Lq - Ld;
+        float kr = -1.5f * (float)pole_pairs * dL;
+        auto Id_at = [&](float I) { return (flux - std::sqrt(flux * flux + 8.0f * dL * dL * I * I)) / (4.0f * dL); };
+        auto torque_at = [&](float I) {
+            float Id = Id_at(I);
+            return std::sqrt(std::max(I * I - Id * Id, 0.0f)) * (torque_constant + kr * Id);
+        };
+
+        torque_step_ = torque_at(max_current) / (float)(table_size - 1);
+        Id_[0] = 0.0f;
+        for (size_t i = 1; i < table_size; ++i) {
+            // The torque rises monotonically with the current magnitude
+            float torque = torque_step_ * (float)i;
+            float lo = 0.0f, hi = max_current;
+            for (int j = 0; j < 24; ++j) {
+                float mid = 0.5f * (lo + hi);
+                (torque_at(mid) < torque ? lo : hi) = mid;
+            }
+            Id_[i] = Id_at(0.5f * (lo + hi));
+        }
+        kr_ = kr;
+        inv_torque_step_ = 1.0f / torque_step_;
+        return valid_ = true;
+    }
+
+    // @param torque: [Nm] signed torque request
+    // @param Id, Iq: [A] current references, Id <= 0, Iq has the sign of torque
+    void get(float torque, float* Id, float* Iq) const {
+        if (!valid_) {
+            *Id = 0.0f;
+            *Iq = torque / kt_;
+            return;
+        }
+        float x = std::abs(torque) * inv_torque_step_;
+        size_t i = (size_t)std::min(x, (float)(table_size - 1));
+        float id;
+        if (i >= table_size - 1) {
+            id = Id_[table_size - 1];
+        } else {
+            float frac = x - (float)i;
+            id = Id_[i] + frac * (Id_[i + 1] - Id_[i]);
+        }
+        *Id = id;
+        *Iq = torque / (kt_ + kr_ * id);
+    }
+
+    bool valid() const { return valid_; }
+
+private:
+    float kt_ = 1.0f; // [Nm/A]
+    float kr_ = 0.0f; // [Nm/A^2] reluctance torque per Id * Iq, negative
+    float torque_step_ = 0.0f; // [Nm] between table entries
+    float inv_torque_step_ = 0.0f; // [1/Nm]
+    float Id_[table_size] = {}; // [A] at torque_step_ * index
+    bool valid_ = false;
+};
+
+#endif // __MTPA_HPP
@@ -0,0 +1,42 @@
+#ifndef __MULTITURN_HPP
+#define __MULTITURN_HPP
+
+#include <stdint.h>
+
+// Turn count of an absolute single-turn encoder across power cycles. The
+// encoder reports the position within one turn only, so the linear count
+// (and with it pos_estimate) restarts in the first turn after every boot.
+// A record saved before the power goes away (controlled shutdown or
+// brownout) keeps the linear count and the single-turn reading at that time,
+// on the next boot the linear count continues from there by the shortest
+// path to the new single-turn reading.
+//
+// This assumes the shaft moved by less than half a turn while unpowered,
+// larger moves are off by a multiple of one turn and cannot be detected.
+struct MultiturnRecord_t {
+    int32_t linear_count = 0; // [count] Encoder::shadow_count_ at the time of the save
+    int32_t count_in_cpr = 0; // [count] single-turn reading at the time of the save
+    int32_t cpr = 0;          // [count] the record is ignored if cpr changed since
+    bool valid = false;       // cleared once the record was used, so it only applies once
+    bool is_homed = false;    // Axis::homing_.is_homed at the time of the save
+};
+
+// @brief Returns the linear count that continues the saved one.
+// @param count_in_cpr: [count] current single-turn reading, in [0, cpr)
+// @returns false if the record is invalid or doesn't match the encoder
+inline bool multiturn_restore(const MultiturnRecord_t& record, int32_t count_in_cpr, int32_t cpr, int32_t* linear_count) {
+    if (!record.valid || cpr <= 0 || record.cpr != cpr
+            || record.count_in_cpr < 0 || record.count_in_cpr >= cpr
+            || count_in_cpr < 0 || count_in_cpr >= cpr)
+        return false;
+    int32_t delta = count_in_cpr - record.count_in_cpr; // in (-cpr, cpr)
+    if (delta > cpr / 2)
+        delta -= cpr;
+    else if (delta < -(cpr / 2))
+        delta += cpr;
+    // Unsigned arithmetic so that the count wraps around like shadow_count_
+    *linear_count = (int32_t)((uint32_t)record.linear_count + (uint32_t)delta);
+    return true;
+}
+
+#endif // __MULTITURN_HPP
@@ -1,14 +1,53 @@
 /*
 * Convenience functions to load and store multiple objects from and to NVM.
-* 
-* The NVM stores consecutive one-to-one copies of arbitrary objects.
-* The types of these objects are passed as template arguments to Config<Ts...>.
+*
+* Each object is stored as a record with its own CRC16 under a key that the
+* caller assigns. The records are appended to a log in one of the two NVM
+* sectors:
+*
+*   sector header: magic (u32), generation (u32)
+*   record:        key (u16), length (u16), fields, CRC16 of key, length and
+*                  fields (u16), 0x0000 (u16)
+*   field:         ID (u32), size (u16), 0xffff (u16), data (padded to 4 bytes)
+*
+* The fields of an object are described by tables of ConfigField, which are
+* generated from odrive-interface.yaml (autogen/config_fields.hpp). A field
+* is loaded if the record contains an entry with its ID and size, unknown
+* fields are skipped and missing fields keep their current value. So fields
+* can be added, removed and reordered without losing the rest of the config.
+*
+* A store operation appends only the records whose content differs from the
+* stored one, followed by a commit record (kCommitKey, no fields). Records
+* after the last commit record belong to an interrupted store and are ignored.
+* Only if the new records don't fit into the sector, all records are
+* compacted into the other sector, which takes over once its header is
+* written. Of two valid sectors the one with the newer generation is used.
+*
+* An append (finish_append() instead of finish_store()) never compacts, it
+* only adds the changed records to the active sector and fails if there is no
+* space left. It can store a few records on their own, e.g. with little time
+* left before a power loss, without dropping the records of the other keys.
+* The records it added are dropped by the next compaction unless that store
+* writes them again.
+*
+* A background store serializes the same records into a RAM snapshot first
+* and then programs it in small steps, so the caller can spread the flash
+* stalls over time and the objects can change meanwhile.
+*
+* An image is the content of a compacted sector (header, all records, commit
+* record) in RAM, e.g. for a backup. It can be loaded like the NVM, its
+* record CRCs also reject an image of a different config_version.
 */
 
+#ifndef __NVM_CONFIG_HPP
+#define __NVM_CONFIG_HPP
+
 /* Includes ------------------------------------------------------------------*/
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <Drivers/STM32/stm32_nvm.h>
 #include <fibre/crc.hpp>
@@ -19,174 +58,737 @@
 #define CONFIG_CRC16_POLYNOMIAL 0x3d65
 
 /* Private macros ------------------------------------------------------------*/
+
+// @brief Describes the field at the path (e.g. "anticogging.map_size")
+// relative to the config object of type T
+#define CONFIG_FIELD(T, path, member) \
+    ConfigField{config_field_id(path), (uint16_t)offsetof(T, member), (uint16_t)sizeof(((T*)nullptr)->member)}
+
 /* Private typedef -----------------------------------------------------------*/
+
+struct ConfigField {
+    uint32_t id;     // see config_field_id()
+    uint16_t offset; // in the config object
+    uint16_t size;
+};
+
+struct ConfigFieldTable {
+    const ConfigField* fields;
+    size_t n_fields;
+};
+
 /* Global constant data ------------------------------------------------------*/
 /* Global variables ----------------------------------------------------------*/
 /* Private constant data -----------------------------------------------------*/
 
-// IMPORTANT: if you change, reorder or otherwise modify any of the fields in
-// the config structs without changing its total length, make sure to increment this number:
+// IMPORTANT: the fields are only matched by their path and size. If you change
+// the meaning or the unit of a field without changing its size, rename it
+// (or increment this number, which discards the whole stored configuration):
 static constexpr uint16_t config_version = 0x0001;
 
 /* Private variables ---------------------------------------------------------*/
 /* Private function prototypes -----------------------------------------------*/
 /* Function implementations --------------------------------------------------*/
 
+// @brief Returns the ID under which a field is stored: the 32-bit FNV-1a hash
+// of its path
+constexpr uint32_t config_field_id(const char* path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash = (hash ^ (uint8_t)*path++) * 16777619u;
+    }
+    return hash;
+}
+
 /**
  * @brief Manages configuration load and store operations from and to NVM
- * 
+ *
  * Usage:
  *  1. start_load()
- *  2. read() (as often needed)
- *  3. finish_load() (to see if all reads were successful and the CRC in the end is valid)
- * 
+ *  2. read() or read_in_place() (as often needed)
+ *  3. finish_load() (to see if all reads were successful)
+ *
  *  1. prepare_store()
  *  2. write() (as often as needed)
- *  3. start_store()
- *  4. write() (same sequence as before)
- *  5. finish_store()
- * 
- * The two store passes are required in order to measure the size on the first
- * pass. If the size increases between the first and second pass, finish_store()
- * will return an error.
+ *  3. finish_store() (or finish_append() to never compact)
+ *
+ *  or, to store in the background:
+ *  3. plan_background_store() (to get the size of the snapshot)
+ *  4. start_background_store() (copies the objects into the snapshot)
+ *  5. continue_background_store() (until it no longer returns kBackgroundStoreBusy)
+ *
+ * read() and write() take the field tables of the object as template
+ * arguments: types with a static member array `fields` of ConfigField, e.g.
+ * config_manager.write<ODriveControllerConfigFields<Controller::Config_t>>(key, &config).
+ * write() only keeps a reference to the object, the objects must stay valid
+ * until finish_store() returns.
  */
 class ConfigManager {
 public:
+    static constexpr uint32_t kSectorMagic = 0x4e564d31; // "1MVN"
+    static constexpr uint16_t kCommitKey = 0xfffe;
+    static constexpr size_t kMaxRecords = 48;
+    static constexpr size_t kHeaderSize = 8;
+    static constexpr size_t kFieldHeaderSize = 8;
+
+    enum BackgroundStoreStatus {
+        kBackgroundStoreDone = 0,
+        kBackgroundStoreBusy = 1,
+        kBackgroundStoreFailed = 2
+    };
+
     /**
      * @brief Starts a load operation. This can be called at any time, even half
      * way through a previous load operation.
      */
     bool start_load() {
-        if (NVM_init() != 0) {
+        if (!open()) {
             return (load_state = kLoadStateFailed), false;
         }
-        load_offset = 0;
-        load_crc16 = CONFIG_CRC16_INIT ^ config_version;
+        load_log = NVM_get_sector(active_sector);
+        load_end = committed_end;
+        load_size = 0;
         load_state = kLoadStateInProgress;
         return true;
     }
 
     /**
-     * @brief Loads the next chunk from NVM.
-     * Note that this may return true even if invalid data was read. The user
-     * will know the final verdict by the return value of finish_load().
+     * @brief Starts a load operation from an image of export_image() instead
+     * of NVM. Fails unless the image consists of a sector header and valid
+     * records only and ends with a commit record.
+     * @param image: must stay valid until finish_load()
      */
-    template<typename T>
-    bool read(T* val) {
-        if (load_state != 1) {
+    bool start_load_image(const uint8_t* image, size_t size) {
+        if (size < kHeaderSize || read_u32(image) != kSectorMagic) {
             return (load_state = kLoadStateFailed), false;
         }
-        size_t size = sizeof(T);
-        if (NVM_read(load_offset, (uint8_t *)val, size) != 0)
+        size_t end = kHeaderSize;
+        for (size_t offset = kHeaderSize; offset + 4 <= size; ) {
+            uint32_t header = read_u32(image + offset);
+            size_t next = offset + record_size(header >> 16);
+            if (next > size || !record_valid(image + offset)) {
+                return (load_state = kLoadStateFailed), false;
+            }
+            if ((header & 0xffff) == kCommitKey) {
+                end = next;
+            }
+            offset = next;
+        }
+        if (end != size) {
             return (load_state = kLoadStateFailed), false;
-        load_crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(load_crc16, (uint8_t *)val, size);
-        load_offset += size;
+        }
+        load_log = image;
+        load_end = end;
+        load_size = 0;
+        load_state = kLoadStateInProgress;
         return true;
     }
 
+    /**
+     * @brief Loads the fields of an object from the record with the key.
+     * Fields that are not stored keep their value, so does the whole object
+     * if there is no record with this key.
+     */
+    template<typename ... TFields, typename T>
+    bool read(uint16_t key, T* val) {
+        static constexpr ConfigFieldTable tables[] = {{TFields::fields, sizeof(TFields::fields) / sizeof(ConfigField)}...};
+        return read(key, (uint8_t*)val, tables, sizeof...(TFields));
+    }
+
+    /**
+     * @brief Returns the data of a field of the record with the key where it
+     * is stored instead of copying it, for tables that are too large to keep
+     * in RAM. Data in NVM stays valid until a store operation compacts the
+     * log back into its sector, so the caller has to look it up again after
+     * every store. Data in an image is only valid as long as the image.
+     * @returns nullptr if there is no record with this key or it doesn't
+     *          contain the field with this ID and size
+     */
+    const uint8_t* read_in_place(uint16_t key, uint32_t id, size_t size) {
+        if (load_state != kLoadStateInProgress) {
+            return (load_state = kLoadStateFailed), nullptr;
+        }
+        size_t length;
+        const uint8_t* data = find_record(load_log, load_end, key, &length);
+        if (!data) {
+            return nullptr;
+        }
+        for (size_t offset = 0; offset + kFieldHeaderSize <= length; ) {
+            size_t field_size = read_u32(data + offset + 4) & 0xffff;
+            size_t next = offset + kFieldHeaderSize + padded(field_size);
+            if (next > length) {
+                break;
+            }
+            if (read_u32(data + offset) == id && field_size == size) {
+                load_size += record_size(length);
+                return data + offset + kFieldHeaderSize;
+            }
+            offset = next;
+        }
+        return nullptr;
+    }
+
     /**
      * @brief Checks the final state of the load operation.
-     * If this function returns false, it is possible that previous read()
-     * operations actually returned garbage.
+     * @param occupied_size: set to the size of the records that were loaded
      */
     bool finish_load(size_t* occupied_size) {
         if (occupied_size) {
-            *occupied_size = load_offset + 2;
+            *occupied_size = load_size;
         }
-
-        uint16_t crc16_calculated = load_crc16;
-        uint16_t crc16_loaded;
-        if (!read(&crc16_loaded)) {
-            return (load_state = kLoadStateFailed), false;
-        }
-        bool result = (load_state == 1) && (crc16_loaded == crc16_calculated);
+        bool result = (load_state == kLoadStateInProgress);
         load_state = kLoadStateIdle;
         return result;
     }
 
     /**
-     * @brief Starts preparation of a new store operation.
+     * @brief Starts a new store operation.
+     * Nothing is written to NVM before finish_store(), so this can also be
+     * called after a failed store operation.
      */
     bool prepare_store() {
-        if (store_state != kStoreStateIdle) {
-            // it might be possible to restart the store process from other states but let's be safe
+        if (store_state == kStoreStateBackground) {
+            return false; // doesn't interfere with the background store
+        }
+        if (store_state == kStoreStatePreparing) {
             return (store_state = kStoreStateFailed), false;
         }
-        store_offset = 0;
-        store_crc16 = CONFIG_CRC16_INIT ^ config_version;
+        n_pending = 0;
         store_state = kStoreStatePreparing;
         return true;
     }
 
-    template<typename T>
-    bool write(T* val) {
-        if (store_state == kStoreStateInProgress) {
-            if (NVM_write(store_offset, (uint8_t*)val, sizeof(T)) != 0) {
-                return (store_state = kStoreStateFailed), false;
-            }
-        } else if (store_state != kStoreStatePreparing) {
+    /**
+     * @brief Adds an object to the store operation under the key.
+     * Fails if the key was already used or if two fields have the same ID.
+     */
+    template<typename ... TFields, typename T>
+    bool write(uint16_t key, T* val) {
+        static constexpr ConfigFieldTable tables[] = {{TFields::fields, sizeof(TFields::fields) / sizeof(ConfigField)}...};
+        return write(key, (const uint8_t*)val, tables, sizeof...(TFields));
+    }
+
+    /**
+     * @brief Writes the records of all objects that changed since the last
+     * store operation and commits them.
+     * If this function succeeds, the new configuration was successfully saved.
+     * If this function fails, the old configuration was not touched.
+     * @param occupied_size: set to the size of the committed records in the
+     *        sector, including old versions of changed records
+     */
+    bool finish_store(size_t* occupied_size) {
+        if (store_state != kStoreStatePreparing || !plan_store()) {
+            return (store_state = kStoreStateFailed), false;
+        }
+
+        bool success;
+        if (compacting) {
+            success = compact(target_sector);
+        } else if (changed_size) {
+            success = append(target_sector, false);
+        } else {
+            success = true; // nothing changed
+        }
+
+        if (!success || !open()) {
             return (store_state = kStoreStateFailed), false;
         }
-        store_crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(store_crc16, (uint8_t *)val, sizeof(T));
-        store_offset += sizeof(T);
+        if (occupied_size) {
+            *occupied_size = committed_end;
+        }
+        store_state = kStoreStateIdle;
         return true;
     }
 
     /**
-     * @brief Finishes the prepare pass and starts the actual store pass.
+     * @brief Alternative to finish_store(): appends the changed records to the
+     * active sector and commits them, the records of other keys stay valid.
+     * Fails without writing anything if this would need a compaction, i.e.
+     * if the sector is full or there is no valid sector.
+     * @param occupied_size: see finish_store()
      */
-    bool start_store(size_t* occupied_size) {
+    bool finish_append(size_t* occupied_size) {
+        if (store_state != kStoreStatePreparing || !plan_store() || compacting) {
+            return (store_state = kStoreStateFailed), false;
+        }
+        if ((changed_size && !append(target_sector, false)) || !open()) {
+            return (store_state = kStoreStateFailed), false;
+        }
         if (occupied_size) {
-            *occupied_size = store_offset + 2;
+            *occupied_size = committed_end;
         }
+        store_state = kStoreStateIdle;
+        return true;
+    }
 
+    /**
+     * @brief Alternative to finish_store(): serializes all records into an
+     * image instead of writing them to NVM.
+     * @param buffer: 4-byte aligned, nullptr to only query the size, the store
+     *        operation then stays open for a second call
+     * @param size: in: size of the buffer, out: size of the image, also if
+     *        the buffer is too small, and 0 if no store operation is open
+     */
+    bool export_image(uint8_t* buffer, size_t* size) {
         if (store_state != kStoreStatePreparing) {
+            *size = 0;
             return (store_state = kStoreStateFailed), false;
         }
-        store_offset += 2; // account for CRC16
-        if (store_offset > NVM_get_max_write_length()) {
+        size_t image_size = kHeaderSize + record_size(0);
+        for (size_t i = 0; i < n_pending; ++i) {
+            image_size += record_size(pending[i].length);
+        }
+        if (!buffer) {
+            *size = image_size;
+            return true;
+        }
+        if (*size < image_size) {
+            *size = image_size;
             return (store_state = kStoreStateFailed), false;
         }
-        if (NVM_start_write(store_offset) != 0) {
+
+        const uint32_t header[2] = {kSectorMagic, 0};
+        memcpy(buffer, header, kHeaderSize);
+        size_t nvm_write_offset = write_offset;
+        snapshot = buffer;
+        snapshot_offset = 0;
+        write_offset = kHeaderSize;
+        serializing = true;
+        bool success = append(0, true);
+        serializing = false;
+        snapshot = nullptr;
+        write_offset = nvm_write_offset;
+        *size = image_size;
+        store_state = success ? kStoreStateIdle : kStoreStateFailed;
+        return success;
+    }
+
+    /**
+     * @brief Alternative to finish_store(): decides where the records go and
+     * returns the size of the snapshot that start_background_store() needs.
+     * @param snapshot_size: set to the size in bytes, 0 if nothing changed
+     */
+    bool plan_background_store(size_t* snapshot_size) {
+        if (store_state != kStoreStatePreparing || !plan_store()) {
             return (store_state = kStoreStateFailed), false;
         }
-        store_offset = 0;
-        store_crc16 = CONFIG_CRC16_INIT ^ config_version;
-        store_state = kStoreStateInProgress;
+        *snapshot_size = compacting ? total_size - kHeaderSize
+                       : changed_size ? changed_size + record_size(0) : 0;
+        store_state = kStoreStatePlanned;
         return true;
     }
 
     /**
-     * @brief Commits the store operation.
-     * If this function succeeds, the new configuration was successfully saved.
-     * If this function fails, the old configuration was not touched.
+     * @brief Serializes the records into the snapshot buffer. After this the
+     * objects are no longer referenced and nothing was written to NVM yet.
+     * @param buffer: 4-byte aligned, of the size returned by
+     *        plan_background_store(). Must stay valid until
+     *        continue_background_store() is done.
      */
-    bool finish_store() {
-        uint16_t crc16 = store_crc16;
-        if (!write(&crc16)) {
+    bool start_background_store(uint8_t* buffer) {
+        if (store_state != kStoreStatePlanned || (!buffer && (compacting || changed_size))) {
             return (store_state = kStoreStateFailed), false;
         }
-        if (NVM_commit() != 0) {
+        if (compacting) {
+            write_offset = kHeaderSize;
+        }
+        snapshot = buffer;
+        snapshot_offset = write_offset;
+        serializing = true;
+        bool success = !(compacting || changed_size) || append(target_sector, compacting);
+        serializing = false;
+        snapshot_length = write_offset - snapshot_offset;
+        snapshot_progress = 0;
+        erase_pending = compacting && !sector_blank(target_sector);
+        if (!success) {
             return (store_state = kStoreStateFailed), false;
         }
-        store_state = kStoreStateIdle;
+        store_state = kStoreStateBackground;
         return true;
     }
 
+    /**
+     * @brief True if the next step of the background store erases the target
+     * sector, which stalls the flash for much longer than programming.
+     */
+    bool background_store_needs_erase() const {
+        return store_state == kStoreStateBackground && erase_pending;
+    }
+
+    /**
+     * @brief Runs the next step of the background store: the erase of the
+     * target sector if needed, programming up to max_length bytes of the
+     * snapshot or finally committing the new sector.
+     * The old configuration stays valid until the last step is done.
+     * @param max_length: a multiple of 4
+     * @param occupied_size: set once done, see finish_store()
+     */
+    BackgroundStoreStatus continue_background_store(size_t max_length, size_t* occupied_size) {
+        if (store_state != kStoreStateBackground) {
+            return kBackgroundStoreFailed;
+        }
+        if (erase_pending) {
+            if (NVM_erase_sector(target_sector) != 0) {
+                return (store_state = kStoreStateFailed), kBackgroundStoreFailed;
+            }
+            erase_pending = false;
+            return kBackgroundStoreBusy;
+        }
+        if (snapshot_progress < snapshot_length) {
+            size_t length = snapshot_length - snapshot_progress;
+            length = length < max_length ? length : max_length;
+            if (NVM_program(target_sector, snapshot_offset + snapshot_progress, snapshot + snapshot_progress, length) != 0) {
+                return (store_state = kStoreStateFailed), kBackgroundStoreFailed;
+            }
+            snapshot_progress += length;
+            return kBackgroundStoreBusy;
+        }
+
+        size_t end = snapshot_offset + snapshot_length;
+        if ((compacting && !write_sector_header(target_sector)) || !open()
+                || (snapshot_length && ((unsigned)active_sector != target_sector || committed_end != end))) {
+            return (store_state = kStoreStateFailed), kBackgroundStoreFailed;
+        }
+        if (occupied_size) {
+            *occupied_size = committed_end;
+        }
+        store_state = kStoreStateIdle;
+        return kBackgroundStoreDone;
+    }
+
     enum {
         kLoadStateIdle = 0,
         kLoadStateInProgress = 1,
         kLoadStateFailed = 2
     } load_state = kLoadStateIdle;
-    size_t load_offset;
-    size_t load_crc16;
+    size_t load_size;
 
     enum {
         kStoreStateIdle = 0,
         kStoreStatePreparing = 1,
-        kStoreStateInProgress = 2,
-        kStoreStateFailed = 3
+        kStoreStateFailed = 2,
+        kStoreStatePlanned = 3,
+        kStoreStateBackground = 4
     } store_state = kStoreStateIdle;
-    size_t store_offset;
-    size_t store_crc16;
+
+private:
+    struct PendingRecord {
+        uint16_t key;
+        const uint8_t* obj;
+        const ConfigFieldTable* tables;
+        size_t n_tables;
+        size_t length; // of the serialized fields
+        bool changed;
+    };
+
+    static uint32_t read_u32(const uint8_t* ptr) {
+        uint32_t value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    static size_t padded(size_t length) {
+        return (length + 3) & ~(size_t)3;
+    }
+
+    static size_t record_size(size_t length) {
+        return 4 + padded(length) + 4;
+    }
+
+    static const ConfigField* find_field(const ConfigFieldTable* tables, size_t n_tables, uint32_t id) {
+        for (size_t i = 0; i < n_tables; ++i) {
+            for (size_t j = 0; j < tables[i].n_fields; ++j) {
+                if (tables[i].fields[j].id == id) {
+                    return &tables[i].fields[j];
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    bool read(uint16_t key, uint8_t* obj, const ConfigFieldTable* tables, size_t n_tables) {
+        if (load_state != kLoadStateInProgress) {
+            return (load_state = kLoadStateFailed), false;
+        }
+        size_t length;
+        const uint8_t* data = find_record(load_log, load_end, key, &length);
+        if (!data) {
+            return true; // not stored, keeps the defaults
+        }
+        for (size_t offset = 0; offset + kFieldHeaderSize <= length; ) {
+            uint32_t id = read_u32(data + offset);
+            size_t size = read_u32(data + offset + 4) & 0xffff;
+            size_t next = offset + kFieldHeaderSize + padded(size);
+            if (next > length) {
+                break;
+            }
+            const ConfigField* field = find_field(tables, n_tables, id);
+            if (field && field->size == size) {
+                memcpy(obj + field->offset, data + offset + kFieldHeaderSize, size);
+            }
+            offset = next;
+        }
+        load_size += record_size(length);
+        return true;
+    }
+
+    bool write(uint16_t key, const uint8_t* obj, const ConfigFieldTable* tables, size_t n_tables) {
+        if (store_state != kStoreStatePreparing || n_pending >= kMaxRecords || key == kCommitKey) {
+            return (store_state = kStoreStateFailed), false;
+        }
+        for (size_t i = 0; i < n_pending; ++i) {
+            if (pending[i].key == key) {
+                return (store_state = kStoreStateFailed), false;
+            }
+        }
+        size_t length = 0;
+        for (size_t i = 0; i < n_tables; ++i) {
+            for (size_t j = 0; j < tables[i].n_fields; ++j) {
+                const ConfigField& field = tables[i].fields[j];
+                if (find_field(tables, n_tables, field.id) != &field) {
+                    return (store_state = kStoreStateFailed), false; // ID collision
+                }
+                length += kFieldHeaderSize + padded(field.size);
+            }
+        }
+        if (length > 0xffff) {
+            return (store_state = kStoreStateFailed), false;
+        }
+        pending[n_pending++] = {key, obj, tables, n_tables, length, false};
+        return true;
+    }
+
+    /**
+     * @brief Decides where the pending records go: appended to the active
+     * sector or, if they don't fit or there is none, compacted into the other
+     * sector.
+     * @returns false if the records don't fit into a sector at all
+     */
+    bool plan_store() {
+        bool has_sector = open();
+
+        size_t sector_size = NVM_get_sector_size();
+        total_size = kHeaderSize + record_size(0);
+        changed_size = 0;
+        for (size_t i = 0; i < n_pending; ++i) {
+            pending[i].changed = !has_sector || !record_matches(pending[i]);
+            total_size += record_size(pending[i].length);
+            changed_size += pending[i].changed ? record_size(pending[i].length) : 0;
+        }
+        if (total_size > sector_size) {
+            return false;
+        }
+
+        // No space left or an interrupted store in the way
+        compacting = !has_sector || write_offset != committed_end
+                  || write_offset + changed_size + record_size(0) > sector_size;
+        target_sector = compacting ? (has_sector ? 1 - active_sector : 0) : active_sector;
+        return true;
+    }
+
+    static uint16_t record_crc(uint32_t header, const uint8_t* data, size_t length) {
+        uint16_t crc16 = CONFIG_CRC16_INIT ^ config_version;
+        crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(crc16, (const uint8_t*)&header, sizeof(header));
+        return calc_crc16<CONFIG_CRC16_POLYNOMIAL>(crc16, data, length);
+    }
+
+    static bool record_valid(const uint8_t* record) {
+        uint32_t header = read_u32(record);
+        size_t length = header >> 16;
+        uint32_t trailer = read_u32(record + record_size(length) - 4);
+        return trailer == record_crc(header, record + 4, padded(length));
+    }
+
+    /**
+     * @brief Selects the active sector and scans its log.
+     * @returns false if neither sector is valid
+     */
+    bool open() {
+        active_sector = -1;
+        for (unsigned i = 0; i < 2; ++i) {
+            const uint8_t* sector = NVM_get_sector(i);
+            uint32_t sector_generation = read_u32(sector + 4);
+            if (read_u32(sector) == kSectorMagic
+                    && (active_sector < 0 || (int32_t)(sector_generation - generation) > 0)) {
+                active_sector = i;
+                generation = sector_generation;
+            }
+        }
+        committed_end = write_offset = kHeaderSize;
+        if (active_sector < 0) {
+            return false;
+        }
+
+        const uint8_t* sector = NVM_get_sector(active_sector);
+        size_t sector_size = NVM_get_sector_size();
+        while (write_offset + 4 <= sector_size) {
+            uint32_t header = read_u32(sector + write_offset);
+            if (header == 0xffffffff) {
+                break; // end of the log
+            }
+            size_t next = write_offset + record_size(header >> 16);
+            if (next > sector_size) {
+                write_offset = sector_size; // corrupt, compact on the next store
+                break;
+            }
+            if ((header & 0xffff) == kCommitKey && record_valid(sector + write_offset)) {
+                committed_end = next;
+            }
+            write_offset = next;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Returns the fields of the latest record with the key in the log
+     * up to end or nullptr if there is none.
+     */
+    static const uint8_t* find_record(const uint8_t* log, size_t end, uint16_t key, size_t* length) {
+        const uint8_t* latest = nullptr;
+        for (size_t offset = kHeaderSize; offset < end; ) {
+            const uint8_t* record = log + offset;
+            uint32_t header = read_u32(record);
+            if ((header & 0xffff) == key && record_valid(record)) {
+                latest = record;
+            }
+            offset += record_size(header >> 16);
+        }
+        if (!latest) {
+            return nullptr;
+        }
+        *length = read_u32(latest) >> 16;
+        return latest + 4;
+    }
+
+    // @brief Checks if the stored record contains exactly the current fields
+    bool record_matches(const PendingRecord& record) {
+        size_t length;
+        const uint8_t* data = find_record(NVM_get_sector(active_sector), committed_end, record.key, &length);
+        if (!data || length != record.length) {
+            return false;
+        }
+        for (size_t i = 0; i < record.n_tables; ++i) {
+            for (size_t j = 0; j < record.tables[i].n_fields; ++j) {
+                const ConfigField& field = record.tables[i].fields[j];
+                if (read_u32(data) != field.id
+                        || (read_u32(data + 4) & 0xffff) != field.size
+                        || memcmp(data + kFieldHeaderSize, record.obj + field.offset, field.size)) {
+                    return false;
+                }
+                data += kFieldHeaderSize + padded(field.size);
+            }
+        }
+        return true;
+    }
+
+    // @brief Programs the data to NVM or, while serializing a background
+    // store, copies it into the snapshot
+    bool program(unsigned sector, size_t offset, const uint8_t* data, size_t length) {
+        if (serializing) {
+            memcpy(snapshot + (offset - snapshot_offset), data, length);
+            return true;
+        }
+        return NVM_program(sector, offset, data, length) == 0;
+    }
+
+    bool program(unsigned sector, size_t offset, const uint8_t* data, size_t length, uint16_t* crc16) {
+        *crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(*crc16, data, length);
+        return program(sector, offset, data, length);
+    }
+
+    // @brief Writes the fields of a pending record or a commit record (nullptr)
+    // to the end of the log
+    bool write_record(unsigned sector, const PendingRecord* record) {
+        size_t length = record ? record->length : 0;
+        uint32_t header = (uint32_t)(record ? record->key : kCommitKey) | ((uint32_t)length << 16);
+        uint16_t crc16 = CONFIG_CRC16_INIT ^ config_version;
+        size_t offset = write_offset;
+        if (!program(sector, offset, (const uint8_t*)&header, 4, &crc16)) {
+            return false;
+        }
+        offset += 4;
+
+        for (size_t i = 0; record && i < record->n_tables; ++i) {
+            for (size_t j = 0; j < record->tables[i].n_fields; ++j) {
+                const ConfigField& field = record->tables[i].fields[j];
+                const uint8_t padding[3] = {0xff, 0xff, 0xff};
+                uint32_t field_header[2] = {field.id, 0xffff0000u | field.size};
+                if (!program(sector, offset, (const uint8_t*)field_header, kFieldHeaderSize, &crc16)
+                        || !program(sector, offset + kFieldHeaderSize, record->obj + field.offset, field.size, &crc16)
+                        || !program(sector, offset + kFieldHeaderSize + field.size, padding, padded(field.size) - field.size, &crc16)) {
+                    return false;
+                }
+                offset += kFieldHeaderSize + padded(field.size);
+            }
+        }
+
+        uint32_t trailer = crc16;
+        write_offset += record_size(length);
+        return program(sector, offset, (const uint8_t*)&trailer, 4);
+    }
+
+    // @brief Writes the pending records (all or only the changed ones) and a
+    // commit record at the end of the log
+    bool append(unsigned sector, bool all) {
+        for (size_t i = 0; i < n_pending; ++i) {
+            if ((all || pending[i].changed) && !write_record(sector, &pending[i])) {
+                return false;
+            }
+        }
+        return write_record(sector, nullptr);
+    }
+
+    static bool sector_blank(unsigned sector) {
+        const uint8_t* data = NVM_get_sector(sector);
+        size_t sector_size = NVM_get_sector_size();
+        for (size_t offset = 0; offset < sector_size; offset += 4) {
+            if (read_u32(data + offset) != 0xffffffff) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // @brief Makes the sector the active sector, the header is written last
+    bool write_sector_header(unsigned sector) {
+        uint32_t new_generation = generation + 1;
+        return NVM_program(sector, 4, (const uint8_t*)&new_generation, 4) == 0
+            && NVM_program(sector, 0, (const uint8_t*)&kSectorMagic, 4) == 0;
+    }
+
+    // @brief Writes all pending records to the target sector, which is erased
+    // first unless it is blank already, and then makes it the active sector
+    bool compact(unsigned sector) {
+        write_offset = kHeaderSize;
+        return (sector_blank(sector) || NVM_erase_sector(sector) == 0)
+            && append(sector, true)
+            && write_sector_header(sector);
+    }
+
+    PendingRecord pending[kMaxRecords];
+    size_t n_pending = 0;
+    int active_sector = -1;
+    uint32_t generation = 0;
+    size_t committed_end = kHeaderSize; // end of the last commit record
+    size_t write_offset = kHeaderSize; // end of the log
+
+    // Log of the current load operation, in NVM or an image
+    const uint8_t* load_log = nullptr;
+    size_t load_end = 0; // end of the last commit record
+
+    // Plan of the current store operation
+    bool compacting = false;
+    unsigned target_sector = 0;
+    size_t total_size = 0; // of the header and all records
+    size_t changed_size = 0; // of the changed records
+
+    // Background store
+    bool serializing = false;
+    bool erase_pending = false;
+    uint8_t* snapshot = nullptr;
+    size_t snapshot_offset = 0; // in the target sector
+    size_t snapshot_length = 0;
+    size_t snapshot_progress = 0;
 };
+
+#endif // __NVM_CONFIG_HPP
@@ -27,6 +27,39 @@ extern char serial_number_str[13];
 #ifdef __cplusplus
 }
 
+typedef struct {
+    float cpu_load; // [%] of the CPU cycles in the last update period, including the interrupts that preempted the thread
+    uint32_t min_stack_space; // minimum remaining space since startup [Bytes]
+    uint32_t last_run_time; // run time counter at the last update [cycles]
+} ThreadStats_t;
+
+typedef struct {
+    ThreadStats_t axis0;
+    ThreadStats_t axis1;
+    ThreadStats_t board_control_loop;
+    ThreadStats_t usb;
+    ThreadStats_t usb_irq;
+    ThreadStats_t uart;
+    ThreadStats_t can;
+    ThreadStats_t comms;
+    ThreadStats_t analog;
+    ThreadStats_t telemetry;
+    ThreadStats_t subscriptions;
+    ThreadStats_t data_logger;
+    ThreadStats_t async_calls;
+    ThreadStats_t startup;
+    ThreadStats_t idle;
+} ThreadStatsList_t;
+
+// Time of the boot phases [us since reset], 0 if not reached yet
+typedef struct {
+    uint32_t gate_drivers;       // gate drivers and shunt amplifiers set up
+    uint32_t dc_calib;           // DC offset calibration of the current sensors settled
+    uint32_t state_machines;     // axis state machines started
+    uint32_t closed_loop_axis0;  // first entry into closed loop control
+    uint32_t closed_loop_axis1;
+} BootTimings_t;
+
 typedef struct {
     bool fully_booted;
     uint32_t uptime; // [ms]
@@ -45,7 +78,11 @@ typedef struct {
     uint32_t stack_usage_startup;
     uint32_t stack_usage_can;
 
+    ThreadStatsList_t threads;
+    BootTimings_t boot_timings;
+
     USBStats_t& usb = usb_stats_;
+    ChannelStats_t& usb_channel = usb_channel_stats_;
     I2CStats_t& i2c = i2c_stats_;
 } SystemStats_t;
 
@@ -67,9 +104,14 @@ struct BoardConfig_t {
     uint32_t uart0_baudrate = 115200;
     uint32_t uart1_baudrate = 115200;
     uint32_t uart2_baudrate = 115200;
+    ODriveIntf::StreamProtocol uart0_protocol = ODriveIntf::STREAM_PROTOCOL_ASCII_AND_FIBRE;
+    uint8_t uart0_node_id = 0; // 0: point-to-point, otherwise addressed, see uart_bus.hpp
+    uint16_t uart0_de_gpio_pin = 0; // 0: none
+    uint32_t uart0_turnaround_us = 100;
     bool enable_can0 = true;
     bool enable_i2c0 = false;
     bool enable_ascii_protocol_on_usb = true;
+    bool enable_fast_boot = false;
     float max_regen_current = 0.0f;
     float brake_resistance = DEFAULT_BRAKE_RESISTANCE;
     float dc_bus_undervoltage_trip_level = 8.0f;                        //<! [V] minimum voltage below which the motor stops operating
@@ -99,10 +141,64 @@ struct BoardConfig_t {
                                                                     //!< Must be larger than `dc_bus_overvoltage_ramp_start`,
                                                                     //!< otherwise the ramp feature is disabled.
 
+    /**
+     * If enabled, a PI controller on the measured DC voltage adds to the
+     * brake duty cycle to hold the voltage at `dc_bus_voltage_regulator_setpoint`
+     * when the feedforward from the bus current is not enough. If the brake
+     * resistor saturates, the regenerative torque is reduced linearly to
+     * zero between the setpoint and `dc_bus_overvoltage_trip_level`.
+     * This feature is disabled if `brake_resistance` is non-positive.
+     */
+    bool enable_dc_bus_voltage_regulator = false;
+    float dc_bus_voltage_regulator_setpoint = 1.04f * HW_VERSION_VOLTAGE; //!< [V] Must be above the supply voltage
+    float dc_bus_voltage_regulator_p_gain = 1.0f; //!< [1/V] brake duty cycle per volt
+    float dc_bus_voltage_regulator_i_gain = 1000.0f; //!< [1/(V*s)]
+
+    uint32_t vbus_oversampling = 1; //!< Number of vbus conversions per control loop period, 1...4. Takes effect after a reboot.
+    float vbus_filter_k = 0.5f; //!< Gain of the IIR filter on `vbus_voltage`, 1.0 disables the filter.
+    float dc_bus_overvoltage_fast_trip_margin = 1.0f; //!< [V] margin above `dc_bus_overvoltage_trip_level` at which the unfiltered vbus disarms the motors in the ISR.
+    uint32_t dc_calib_startup_samples = 256; //!< DC offset measurements of the current sensors that are averaged after startup
+    float dc_calib_tau = 0.2f; //!< [s] time constant with which the DC offsets track drift after the startup averaging
+
+    // General purpose ADC scan, see start_general_purpose_adc().
+    // Takes effect after a reboot.
+    bool adc_scan_all_channels = false; //!< Scan all 16 channels instead of only the ones in use
+    bool adc_scan_sync_to_pwm = false; //!< Scan once per PWM update event instead of continuously
+    uint32_t adc_sample_cycles_analog_in = 15; //!< [ADC clocks] for GPIOs in GPIO_MODE_ANALOG_IN
+    uint32_t adc_sample_cycles_thermistor = 144; //!< [ADC clocks]
+    uint32_t adc_sample_cycles_sincos = 15; //!< [ADC clocks]
+
     float dc_max_positive_current = INFINITY; // Max current [A] the power supply can source
     float dc_max_negative_current = -0.000001f; // Max current [A] the power supply can sink. You most likely want a non-positive value here. Set to -INFINITY to disable.
+    // Limits that reduce the torque before the bus current trips the ones above, see DcBusLimiter
+    float dc_bus_current_limit = INFINITY; //!< [A] drawn from the power supply
+    float dc_bus_regen_current_limit = INFINITY; //!< [A] fed back into the power supply, positive
+    float dc_bus_power_limit = INFINITY; //!< [W] drawn from the power supply
+    float dc_bus_regen_power_limit = INFINITY; //!< [W] fed back into the power supply, positive
     PWMMapping_t pwm_mappings[4];
+    bool pwm_input_median_filter = false; //!< Median of the last three pulses, rejects single glitches
+    float pwm_input_filter_bandwidth = INFINITY; //!< [Hz] of the first order filter on the PWM inputs
+    bool enable_pwm_input_timeout = false; //!< Write the neutral value to a PWM mapping on signal loss
+    float pwm_input_timeout = 0.1f; //!< [s] without a valid pulse until the signal counts as lost
     PWMMapping_t analog_mappings[GPIO_COUNT];
+    bool analog_mapping_in_control_loop = false; //!< Update the analog mappings every control loop iteration instead of at 100 Hz. Takes effect after a reboot.
+    float analog_mapping_filter_bandwidth = INFINITY; //!< [Hz] of the first order filter on the mapped values
+
+    // System watchdog, see ThreadWatchdog. Takes effect after a reboot.
+    bool enable_system_watchdog = false;
+    bool board_time_timestamps = false; // timestamp telemetry and the event trace with timebase_ instead of loop_counter_
+    float system_watchdog_timeout = 3.0f; //!< [s] of the IWDG, must cover a flash sector erase
+    uint32_t thread_budget_axis = 10; //!< [ms]
+    uint32_t thread_budget_usb = 500; //!< [ms]
+    uint32_t thread_budget_uart = 500; //!< [ms]
+    uint32_t thread_budget_can = 500; //!< [ms]
+
+    // Communication threads, the axis threads always run above them. Take
+    // effect after a reboot.
+    ODriveIntf::ThreadPriority usb_thread_priority = ODriveIntf::THREAD_PRIORITY_NORMAL;
+    ODriveIntf::ThreadPriority uart_thread_priority = ODriveIntf::THREAD_PRIORITY_NORMAL;
+    ODriveIntf::ThreadPriority can_thread_priority = ODriveIntf::THREAD_PRIORITY_NORMAL;
+    bool enable_single_comms_thread = false; //!< USB, UART and CAN are polled by one thread
 };
 
 // Forward Declarations
@@ -112,11 +208,6 @@ class ODriveCAN;
 
 extern ODriveCAN *odCAN;
 
-// if you use the oscilloscope feature you can bump up this value
-#define OSCILLOSCOPE_SIZE 4096
-extern float oscilloscope[OSCILLOSCOPE_SIZE];
-extern size_t oscilloscope_pos;
-
 // TODO: move
 // this is technically not thread-safe but practically it might be
 #define DEFINE_ENUM_FLAG_OPERATORS(ENUMTYPE) \
@@ -142,7 +233,16 @@ inline ENUMTYPE operator ~ (ENUMTYPE a) { return static_cast<ENUMTYPE>(~static_c
 #include <trapTraj.hpp>
 #include <endstop.hpp>
 #include <mechanical_brake.hpp>
+#include <oscilloscope.hpp>
+#include <telemetry.hpp>
+#include <subscriptions.hpp>
+#include <event_trace.hpp>
+#include <data_logger.hpp>
+#include <timebase.hpp>
+#include <dc_bus_limiter.hpp>
 #include <axis.hpp>
+#include <crash_snapshot.hpp>
+#include <thread_watchdog.hpp>
 #include <communication/communication.h>
 
 // Defined in autogen/version.c based on git-derived version numbers
@@ -157,22 +257,43 @@ static Stm32Gpio get_gpio(size_t gpio_num) {
     return (gpio_num < GPIO_COUNT) ? gpios[gpio_num] : GPIO_COUNT ? gpios[0] : Stm32Gpio::none;
 }
 
+// Threads supervised by the system watchdog, the bits of ODrive::missed_threads_
+enum WatchdogThread {
+    WATCHDOG_THREAD_AXIS0 = 0, // one per axis
+    WATCHDOG_THREAD_USB = AXIS_COUNT,
+    WATCHDOG_THREAD_UART,
+    WATCHDOG_THREAD_CAN,
+};
+
 // general system functions defined in main.cpp
 class ODrive : public ODriveIntf {
 public:
     void save_configuration() override;
+    bool save_configuration_background() override;
+    bool save_multiturn_positions() override;
+    void report_brownout(bool brownout);
     void erase_configuration() override;
     void reboot() override { NVIC_SystemReset(); }
     void enter_dfu_mode() override;
 
     float get_oscilloscope_val(uint32_t index) override {
-        return oscilloscope[index];
+        return index < OSCILLOSCOPE_SIZE ? oscilloscope[index] : 0.0f;
     }
 
+    bool read_oscilloscope_buffer(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    bool read_configuration_image(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    bool start_configuration_restore(uint32_t size) override;
+    bool write_configuration_image(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+    bool finish_configuration_restore() override;
+
     float get_adc_voltage(uint32_t gpio) override {
         return ::get_adc_voltage(get_gpio(gpio));
     }
 
+    uint32_t benchmark_kernel(uint32_t kernel) override;
+
+    bool loopback(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) override;
+
     int32_t test_function(int32_t delta) override {
         static int cnt = 0;
         return cnt += delta;
@@ -184,7 +305,15 @@ public:
     uint32_t get_interrupt_status(int32_t irqn);
     uint32_t get_dma_status(uint8_t stream_num);
 
+    bool coordinated_move(float goal0, float goal1);
+    void start_staged_moves();
+
     float& vbus_voltage_ = ::vbus_voltage; // TODO: make this the actual variable
+    float& vbus_voltage_raw_ = ::vbus_voltage_raw;
+    float& vbus_ripple_ = ::vbus_ripple;
+    float& vbus_min_ = ::vbus_min;
+    float& vbus_max_ = ::vbus_max;
+    const uint32_t& pwm_input_signal_lost_ = pwm0_input.signal_lost_;
     float& ibus_ = ::ibus_; // TODO: make this the actual variable
     float ibus_report_filter_k_ = 1.0f;
 
@@ -217,15 +346,30 @@ public:
     const uint8_t fw_version_minor_ = ::fw_version_minor_;
     const uint8_t fw_version_revision_ = ::fw_version_revision_;
     const uint8_t fw_version_unreleased_ = ::fw_version_unreleased_; // 0 for official releases, 1 otherwise
+    const uint32_t build_features_ = kBuildFeatures;
 
     bool& task_timers_armed_ = ::task_timers_armed;
+    bool& task_timer_stats_enabled_ = TaskTimer::stats_enabled;
     bool& brake_resistor_armed_ = ::brake_resistor_armed; // TODO: make this the actual variable
     bool& brake_resistor_saturated_ = ::brake_resistor_saturated; // TODO: make this the actual variable
+    float& dc_bus_regen_scale_ = ::dc_bus_regen_scale; // TODO: make this the actual variable
 
     SystemStats_t system_stats_;
+    Oscilloscope oscilloscope_;
+    Telemetry telemetry_;
+    Subscriptions subscriptions_;
+    EventTrace event_trace_;
+    Timebase timebase_{TIM_1_8_CLOCK_HZ};
+    DcBusLimiter dc_bus_limiter_;
+    CrashSnapshot crash_snapshot_{crash_snapshot_data};
+    DataLogger data_logger_{&ext_spi_arbiter};
+    ThreadWatchdog thread_watchdog_;
+    uint32_t missed_threads_ = 0;
 
     BoardConfig_t config_;
     uint32_t user_config_loaded_ = 0;
+    bool background_save_in_progress_ = false;
+    bool brownout_ = false;
     bool misconfigured_ = false;
 
     uint32_t test_property_ = 0;
@@ -0,0 +1,101 @@
+
+#include "oscilloscope.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+float oscilloscope[OSCILLOSCOPE_SIZE] = {0};
+
+// @brief Resolves the configured signals and starts waiting for the trigger.
+// Returns false if a channel can't be read as a number.
+bool Oscilloscope::arm() {
+    state_ = CAPTURE_STATE_IDLE;
+    if (!kFeatureOscilloscope)
+        return false; // left out of this build
+
+    num_channels_ = std::clamp<size_t>(config_.num_channels, 1, max_channels);
+    for (size_t i = 0; i < num_channels_; ++i) {
+        channels_[i].type_info = fibre::get_float_endpoint(config_.channels[i], &channels_[i].property);
+        if (!channels_[i].type_info)
+            return false;
+    }
+    trigger_.type_info = nullptr;
+    if (config_.trigger_mode != TRIGGER_MODE_IMMEDIATE) {
+        trigger_.type_info = fibre::get_float_endpoint(config_.trigger_source, &trigger_.property);
+        if (!trigger_.type_info)
+            return false;
+    }
+
+    num_frames_ = OSCILLOSCOPE_SIZE / num_channels_;
+    first_frame_ = 0;
+    frame_ = 0;
+    frames_written_ = 0;
+    decimation_count_ = 0;
+    last_trigger_value_ = trigger_.get();
+    std::atomic_signal_fence(std::memory_order_release); // the capture state is written before the control loop sees it
+    state_ = CAPTURE_STATE_ARMED;
+    return true;
+}
+
+bool Oscilloscope::triggered(float value) {
+    float last = last_trigger_value_;
+    last_trigger_value_ = value;
+    float level = config_.trigger_level;
+    bool rising = last < level && value >= level;
+    bool falling = last > level && value <= level;
+    switch (config_.trigger_mode) {
+        case TRIGGER_MODE_IMMEDIATE: return true;
+        case TRIGGER_MODE_RISING_EDGE: return rising;
+        case TRIGGER_MODE_FALLING_EDGE: return falling;
+        case TRIGGER_MODE_ANY_EDGE: return rising || falling;
+        default: return false;
+    }
+}
+
+// @brief Records a frame, called every current measurement period
+void Oscilloscope::update() {
+    if (state_ != CAPTURE_STATE_ARMED && state_ != CAPTURE_STATE_CAPTURING)
+        return;
+    if (++decimation_count_ < config_.decimation)
+        return;
+    decimation_count_ = 0;
+
+    float* frame = &oscilloscope[frame_ * num_channels_];
+    for (size_t i = 0; i < num_channels_; ++i)
+        frame[i] = channels_[i].get();
+    if (++frame_ >= num_frames_)
+        frame_ = 0;
+    ++frames_written_;
+
+    if (state_ == CAPTURE_STATE_ARMED) {
+        // the trigger is only accepted once the pretrigger frames are recorded
+        uint32_t pretrigger = std::min(config_.pretrigger, num_frames_ - 1);
+        if (triggered(trigger_.get()) && frames_written_ > pretrigger) {
+            frames_left_ = num_frames_ - pretrigger - 1;
+            state_ = CAPTURE_STATE_CAPTURING;
+        }
+    } else if (frames_left_) {
+        --frames_left_;
+    }
+
+    if (state_ == CAPTURE_STATE_CAPTURING && !frames_left_) {
+        first_frame_ = frame_;
+        state_ = CAPTURE_STATE_DONE;
+    }
+}
+
+// @brief Copies the frames written last into dst, oldest first.
+// Returns the number of values copied, whole frames of num_channels values.
+size_t Oscilloscope::copy_last_values(float* dst, size_t max_values, uint32_t* num_channels) const {
+    *num_channels = num_channels_;
+    if (!num_frames_)
+        return 0; // never armed
+    uint32_t n_frames = std::min<uint32_t>({frames_written_, num_frames_, (uint32_t)(max_values / num_channels_)});
+    uint32_t frame = (frame_ + num_frames_ - n_frames) % num_frames_;
+    for (uint32_t i = 0; i < n_frames; ++i) {
+        std::copy_n(&oscilloscope[frame * num_channels_], num_channels_, dst + i * num_channels_);
+        if (++frame >= num_frames_)
+            frame = 0;
+    }
+    return n_frames * num_channels_;
+}
@@ -0,0 +1,70 @@
+#ifndef __OSCILLOSCOPE_HPP
+#define __OSCILLOSCOPE_HPP
+
+#include <fibre/protocol.hpp>
+#include <fibre/introspection.hpp>
+#include <autogen/interfaces.hpp>
+#include "features.hpp"
+
+// if you use the oscilloscope feature you can bump up this value
+#ifdef NO_OSCILLOSCOPE
+#define OSCILLOSCOPE_SIZE 1
+#else
+#define OSCILLOSCOPE_SIZE 4096
+#endif
+extern float oscilloscope[OSCILLOSCOPE_SIZE];
+
+// Triggered capture of up to max_channels signals into the oscilloscope
+// buffer. The signals and the trigger source are selected at runtime by
+// endpoint reference. The buffer holds one frame of all channels per sample.
+class Oscilloscope : public ODriveIntf::OscilloscopeIntf {
+public:
+    static constexpr size_t max_channels = 4;
+
+    // Number read from an endpoint given by reference
+    struct Signal_t {
+        Introspectable property;
+        const FloatGettableTypeInfo* type_info = nullptr;
+
+        float get() const {
+            float val = 0.0f;
+            if (type_info)
+                type_info->get_float(property, &val);
+            return val;
+        }
+    };
+
+    struct Config_t {
+        endpoint_ref_t channels[max_channels];
+        uint32_t num_channels = 1;
+        endpoint_ref_t trigger_source;
+        float trigger_level = 0.0f;
+        TriggerMode trigger_mode = TRIGGER_MODE_RISING_EDGE;
+        uint32_t pretrigger = 0; // frames kept from before the trigger
+        uint32_t decimation = 1; // current measurement periods per frame
+    };
+
+    bool arm();
+    void stop() { state_ = CAPTURE_STATE_IDLE; }
+    void update();
+    size_t copy_last_values(float* dst, size_t max_values, uint32_t* num_channels) const;
+
+    Config_t config_;
+    CaptureState state_ = CAPTURE_STATE_IDLE;
+    uint32_t num_frames_ = 0;  // capacity in frames of the current capture
+    uint32_t first_frame_ = 0; // oldest frame of a completed capture
+
+private:
+    bool triggered(float value);
+
+    Signal_t channels_[max_channels];
+    Signal_t trigger_;
+    size_t num_channels_ = 0;
+    uint32_t frame_ = 0;          // next frame to write
+    uint32_t frames_written_ = 0; // since arm()
+    uint32_t frames_left_ = 0;    // after the trigger
+    uint32_t decimation_count_ = 0;
+    float last_trigger_value_ = 0.0f;
+};
+
+#endif // __OSCILLOSCOPE_HPP
@@ -0,0 +1,78 @@
+#ifndef __PLL_BANDWIDTH_SCHEDULE_HPP
+#define __PLL_BANDWIDTH_SCHEDULE_HPP
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+#include "interpolation_table.hpp"
+
+// Adaptation of the encoder PLL bandwidth to the motion. A low bandwidth
+// filters the quantization noise of the counts at standstill, a high
+// bandwidth tracks fast moves with little lag.
+//
+// The bandwidth is scheduled by a load in [0, 1], the larger of |velocity|
+// and |acceleration| relative to the values at which the full bandwidth is
+// reached. It is interpolated geometrically between the two bandwidths, which
+// build() precomputes into a table. The load follows increases immediately
+// and decays over hold_time, so that the bandwidth does not drop at the
+// reversal of a move and the noise of the estimate at standstill doesn't
+// modulate the bandwidth.
+class PllBandwidthSchedule {
+public:
+    static constexpr size_t table_size = 16;
+
+    PllBandwidthSchedule() { build(1.0f, 1.0f); }
+
+    // @param bandwidth_min: [rad/s] at standstill
+    // @param bandwidth_max: [rad/s] at full load, must be >= bandwidth_min
+    void build(float bandwidth_min, float bandwidth_max) {
+        float ratio = bandwidth_max / bandwidth_min;
+        table_.build([&](float x) { return bandwidth_min * std::pow(ratio, x); });
+    }
+
+    void reset() {
+        initialized_ = false;
+        accel_ = 0.0f;
+        load_ = 0.0f;
+    }
+
+    // @param vel: [turn/s] velocity estimate
+    // @param vel_full: [turn/s] velocity at which the full bandwidth is reached
+    // @param accel_full: [turn/s^2] acceleration at which the full bandwidth is reached, 0 to only schedule by velocity
+    // @param hold_time: [s] time constant of the decay of the load
+    // @returns [rad/s] PLL bandwidth
+    float update(float vel, float vel_full, float accel_full, float hold_time, float dt) {
+        if (!initialized_) {
+            initialized_ = true;
+            vel_prev_ = vel;
+        }
+        // The acceleration is differentiated from the velocity and smoothed
+        // over a quarter of the hold time, the PLL itself has no acceleration
+        // state.
+        float accel_alpha = std::min(4.0f * dt / hold_time, 1.0f);
+        accel_ += accel_alpha * ((vel - vel_prev_) / dt - accel_);
+        vel_prev_ = vel;
+
+        float load = vel_full > 0.0f ? std::abs(vel) / vel_full : 1.0f;
+        if (accel_full > 0.0f)
+            load = std::max(load, std::abs(accel_) / accel_full);
+        load = std::min(load, 1.0f);
+        if (load > load_)
+            load_ = load;
+        else
+            load_ += std::min(dt / hold_time, 1.0f) * (load - load_);
+        return table_.eval(load_);
+    }
+
+    float load() const { return load_; } // [0, 1]
+
+private:
+    InterpolationTable<table_size> table_;
+    bool initialized_ = false;
+    float vel_prev_ = 0.0f; // [turn/s]
+    float accel_ = 0.0f;    // [turn/s^2]
+    float load_ = 0.0f;
+};
+
+#endif // __PLL_BANDWIDTH_SCHEDULE_HPP
@@ -0,0 +1,121 @@
+#ifndef __POSITION_COMPARE_HPP
+#define __POSITION_COMPARE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Position compare output: a pulse on a GPIO when the encoder count crosses
+// configured positions, e.g. to trigger a camera or a dispenser at exact
+// positions without polling them from the host.
+//
+// The targets are either up to max_positions counts in the order in which
+// they are approached, or, with a nonzero interval, positions[0] and then a
+// target every interval counts. The next target fires when the count passes
+// it in either direction. When several targets are crossed within one
+// control period they fire together in one pulse, merged counts these.
+//
+// The GPIO is set in the control period in which the crossing is detected.
+// The time of the crossing since the previous update is interpolated from the
+// counts and reported as phase, so the host can correct the timestamps for
+// the output latency of up to one period.
+//
+// Counts are compared modulo 2^32 like the linear count of the encoder.
+class PositionCompare {
+public:
+    static constexpr size_t max_positions = 8;
+
+    struct Config_t {
+        bool enable = false;
+        uint16_t gpio_num = 0;        // in GPIO_MODE_POSITION_COMPARE
+        bool is_active_low = false;
+        float pulse_width = 0.001f;   // [s] rounded up to whole control periods
+        int32_t positions[max_positions] = {}; // [count] linear encoder count
+        uint32_t num_positions = 1;   // without interval
+        int32_t interval = 0;         // [count] spacing of periodic targets from positions[0], 0 for the list
+        uint32_t num_periodic = 0;    // targets with interval, 0 for unlimited
+    };
+
+    // @brief Starts over at the first target
+    // @param count: current linear encoder count
+    void arm(int32_t count) {
+        armed_ = true;
+        next_ = 0;
+        prev_count_ = count;
+        pulse_remaining_ = 0.0f;
+    }
+
+    void disarm() {
+        armed_ = false;
+        pulse_remaining_ = 0.0f;
+    }
+
+    // @param count: linear encoder count
+    // @returns true while the output pulse is active
+    bool update(const Config_t& config, int32_t count, float dt) {
+        fired_ = false;
+        if (armed_) {
+            int32_t delta = (int32_t)((uint32_t)count - (uint32_t)prev_count_);
+            uint32_t crossed = 0;
+            float phase = 0.0f;
+            int32_t target;
+            while (delta && get_target(config, next_, &target)) {
+                int32_t to_target = (int32_t)((uint32_t)target - (uint32_t)prev_count_);
+                bool crossing = delta > 0 ? (to_target > 0 && to_target <= delta)
+                                          : (to_target < 0 && to_target >= delta);
+                if (!crossing)
+                    break;
+                if (!crossed)
+                    phase = (float)to_target / (float)delta;
+                ++crossed;
+                ++next_;
+            }
+            if (crossed) {
+                fired_ = true;
+                phase_ = phase;
+                triggers_ += crossed;
+                merged_ += crossed - 1;
+                pulse_remaining_ = config.pulse_width;
+            }
+            if (!get_target(config, next_, &target))
+                armed_ = false; // all targets done
+        }
+        prev_count_ = count;
+
+        bool active = pulse_remaining_ > 0.0f;
+        pulse_remaining_ -= dt;
+        return active;
+    }
+
+    bool armed() const { return armed_; }
+    bool fired() const { return fired_; }        // in the last update
+    float phase() const { return phase_; }       // of the last crossing from the update before it fired (0) to that update (1)
+    uint32_t triggers() const { return triggers_; }
+    uint32_t merged() const { return merged_; }
+    void reset_counters() { triggers_ = 0; merged_ = 0; }
+
+private:
+    // @returns false if there is no target with this index
+    static bool get_target(const Config_t& config, uint32_t index, int32_t* target) {
+        if (config.interval) {
+            if (config.num_periodic && index >= config.num_periodic)
+                return false;
+            *target = (int32_t)((uint32_t)config.positions[0] + index * (uint32_t)config.interval);
+            return true;
+        }
+        if (index >= config.num_positions || index >= max_positions)
+            return false;
+        *target = config.positions[index];
+        return true;
+    }
+
+    bool armed_ = false;
+    bool fired_ = false;
+    uint32_t next_ = 0;        // index of the next target
+    int32_t prev_count_ = 0;   // [count]
+    float pulse_remaining_ = 0.0f; // [s]
+    float phase_ = 0.0f;
+    uint32_t triggers_ = 0;
+    uint32_t merged_ = 0;
+};
+
+#endif // __POSITION_COMPARE_HPP
@@ -0,0 +1,53 @@
+#ifndef __PULSE_FILTER_HPP
+#define __PULSE_FILTER_HPP
+
+#include <cmath>
+#include <algorithm>
+
+// Filter for values that arrive at an irregular rate, such as the pulse
+// widths of an RC PWM input. An optional median of the last three values
+// rejects single glitches at the cost of one value of latency, a first order
+// low pass then smooths the result.
+class PulseFilter {
+public:
+    struct Config_t {
+        bool median;     // median of three before the low pass
+        float bandwidth; // [Hz] of the low pass, INFINITY disables it
+    };
+
+    void reset() {
+        count_ = 0;
+    }
+
+    // @param dt: time since the previous value [s]
+    // @returns the filtered value
+    float update(const Config_t& config, float x, float dt) {
+        history_[index_] = x;
+        index_ = (index_ + 1) % 3;
+        count_ = std::min(count_ + 1, 3u);
+        if (config.median && count_ >= 3)
+            x = median3(history_[0], history_[1], history_[2]);
+
+        if (count_ == 1) {
+            y_ = x;
+        } else {
+            float k = std::min(2.0f * (float)M_PI * config.bandwidth * dt, 1.0f);
+            y_ += k * (x - y_);
+        }
+        return y_;
+    }
+
+    float value() const { return y_; }
+
+private:
+    static float median3(float a, float b, float c) {
+        return std::max(std::min(a, b), std::min(std::max(a, b), c));
+    }
+
+    float history_[3] = {};
+    unsigned index_ = 0;
+    unsigned count_ = 0; // saturates at 3
+    float y_ = 0.0f;
+};
+
+#endif // __PULSE_FILTER_HPP
@@ -12,63 +12,87 @@ void PwmInput::init() {
     uint32_t channels[] = {TIM_CHANNEL_1, TIM_CHANNEL_2, TIM_CHANNEL_3, TIM_CHANNEL_4};
 
     for (size_t i = 0; i < 4; ++i) {
-        if (!fibre::is_endpoint_ref_valid(odrv.config_.pwm_mappings[i].endpoint))
+        // The endpoints are looked up once, the ISR only writes them
+        if (!channels_[i].setter.resolve(odrv.config_.pwm_mappings[i].endpoint))
             continue;
         HAL_TIM_IC_ConfigChannel(htim_, &sConfigIC, channels[i]);
         HAL_TIM_IC_Start_IT(htim_, channels[i]);
     }
 }
 
-//TODO: These expressions have integer division by 1MHz, so it will be incorrect for clock speeds of not-integer MHz
-#define TIM_2_5_CLOCK_HZ        TIM_APB1_CLOCK_HZ
-#define PWM_MIN_HIGH_TIME          ((TIM_2_5_CLOCK_HZ / 1000000UL) * 1000UL) // 1ms high is considered full reverse
-#define PWM_MAX_HIGH_TIME          ((TIM_2_5_CLOCK_HZ / 1000000UL) * 2000UL) // 2ms high is considered full forward
-#define PWM_MIN_LEGAL_HIGH_TIME    ((TIM_2_5_CLOCK_HZ / 1000000UL) * 500UL) // ignore high periods shorter than 0.5ms
-#define PWM_MAX_LEGAL_HIGH_TIME    ((TIM_2_5_CLOCK_HZ / 1000000UL) * 2500UL) // ignore high periods longer than 2.5ms
+#define PWM_MIN_HIGH_TIME          1000e-6f // [s] 1ms high is considered full reverse
+#define PWM_MAX_HIGH_TIME          2000e-6f // [s] 2ms high is considered full forward
+#define PWM_MIN_LEGAL_HIGH_TIME    500e-6f // [s] ignore high periods shorter than 0.5ms
+#define PWM_MAX_LEGAL_HIGH_TIME    2500e-6f // [s] ignore high periods longer than 2.5ms
 #define PWM_INVERT_INPUT        false
 
 /**
  * @param channel: A channel number in [0, 3]
+ * @param timestamp: end of the pulse [ticks]
+ * @param high_time: [ticks]
  */
-void handle_pulse(int channel, uint32_t high_time) {
-    if (high_time < PWM_MIN_LEGAL_HIGH_TIME || high_time > PWM_MAX_LEGAL_HIGH_TIME)
+void PwmInput::handle_pulse(int channel, uint32_t timestamp, uint32_t high_time) {
+    Channel_t& ch = channels_[channel];
+    float t_high = (float)high_time * tick_period_;
+    if (t_high < PWM_MIN_LEGAL_HIGH_TIME || t_high > PWM_MAX_LEGAL_HIGH_TIME)
         return;
 
-    if (high_time < PWM_MIN_HIGH_TIME)
-        high_time = PWM_MIN_HIGH_TIME;
-    if (high_time > PWM_MAX_HIGH_TIME)
-        high_time = PWM_MAX_HIGH_TIME;
-    float fraction = (float)(high_time - PWM_MIN_HIGH_TIME) / (float)(PWM_MAX_HIGH_TIME - PWM_MIN_HIGH_TIME);
-    float value = odrv.config_.pwm_mappings[channel].min +
-                  (fraction * (odrv.config_.pwm_mappings[channel].max - odrv.config_.pwm_mappings[channel].min));
+    t_high = std::clamp(t_high, PWM_MIN_HIGH_TIME, PWM_MAX_HIGH_TIME);
+    float fraction = (t_high - PWM_MIN_HIGH_TIME) / (PWM_MAX_HIGH_TIME - PWM_MIN_HIGH_TIME);
 
-    fibre::set_endpoint_from_float(odrv.config_.pwm_mappings[channel].endpoint, value);
+    if (!ch.active)
+        ch.filter.reset();
+    float dt = (float)(timestamp - ch.last_pulse_timestamp) * tick_period_;
+    PulseFilter::Config_t filter_config = {odrv.config_.pwm_input_median_filter, odrv.config_.pwm_input_filter_bandwidth};
+    fraction = ch.filter.update(filter_config, fraction, dt);
+    ch.last_pulse_timestamp = timestamp;
+    ch.active = true;
+
+    const PWMMapping_t& map = odrv.config_.pwm_mappings[channel];
+    ch.setter.set(map.min + (fraction * (map.max - map.min)));
 }
 
 /**
  * @param channel: A channel number in [0, 3]
  */
 void PwmInput::on_capture(int channel, uint32_t timestamp) {
-    static uint32_t last_timestamp[4] = { 0 };
-    static bool last_pin_state[4] = { false };
-    static bool last_sample_valid[4] = { false };
-
     if (channel >= 4)
         return;
+    Channel_t& ch = channels_[channel];
     Stm32Gpio gpio = get_gpio(gpios_[channel]);
     if (!gpio)
         return;
     bool current_pin_state = gpio.read();
 
-    if (last_sample_valid[channel]
-        && (last_pin_state[channel] != PWM_INVERT_INPUT)
+    if (ch.last_sample_valid
+        && (ch.last_pin_state != PWM_INVERT_INPUT)
         && (current_pin_state == PWM_INVERT_INPUT)) {
-        handle_pulse(channel, timestamp - last_timestamp[channel]);
+        handle_pulse(channel, timestamp, timestamp - ch.last_timestamp);
     }
 
-    last_timestamp[channel] = timestamp;
-    last_pin_state[channel] = current_pin_state;
-    last_sample_valid[channel] = true;
+    ch.last_timestamp = timestamp;
+    ch.last_pin_state = current_pin_state;
+    ch.last_sample_valid = true;
+}
+
+void PwmInput::check_timeouts() {
+    uint32_t now = htim_->Instance->CNT;
+    uint32_t lost = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        Channel_t& ch = channels_[i];
+        if (!ch.setter.valid())
+            continue;
+        bool alive = ch.active && (float)(now - ch.last_pulse_timestamp) * tick_period_ < odrv.config_.pwm_input_timeout;
+        if (!alive)
+            lost |= 1 << i;
+        if (!alive && ch.active && odrv.config_.enable_pwm_input_timeout) {
+            // Neutral stick, the value of a 1.5ms pulse
+            const PWMMapping_t& map = odrv.config_.pwm_mappings[i];
+            ch.active = false;
+            ch.setter.set(0.5f * (map.min + map.max));
+        }
+    }
+    signal_lost_ = lost;
 }
 
 void PwmInput::on_capture() {
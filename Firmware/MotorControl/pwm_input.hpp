@@ -3,20 +3,42 @@
 
 #include <tim.h>
 #include <array>
+#include "endpoint_setter.hpp"
+#include "pulse_filter.hpp"
 
 class PwmInput {
 public:
-    PwmInput(TIM_HandleTypeDef* htim, std::array<uint16_t, 4> gpios)
-            : htim_(htim), gpios_(gpios) {}
+    // @param timer_clock_hz: tick rate of the capture timer. A 32 bit timer
+    // at full clock speed gives the best resolution.
+    PwmInput(TIM_HandleTypeDef* htim, uint32_t timer_clock_hz, std::array<uint16_t, 4> gpios)
+            : htim_(htim), tick_period_(1.0f / (float)timer_clock_hz), gpios_(gpios) {}
 
     void init();
     void on_capture();
+    // @brief Writes the neutral value to the mappings that didn't see a
+    // pulse for config.pwm_input_timeout. Called from a thread.
+    void check_timeouts();
+
+    uint32_t signal_lost_ = 0; // bit i is set while channel i is timed out
 
 private:
+    struct Channel_t {
+        EndpointSetter setter; // resolved in init(), only set() from the ISR
+        PulseFilter filter;
+        uint32_t last_timestamp = 0; // [ticks] of the last edge
+        uint32_t last_pulse_timestamp = 0; // [ticks] of the end of the last valid pulse
+        bool last_pin_state = false;
+        bool last_sample_valid = false;
+        bool active = false; // a valid pulse was seen since the last timeout
+    };
+
     void on_capture(int channel, uint32_t timestamp);
+    void handle_pulse(int channel, uint32_t timestamp, uint32_t high_time);
 
     TIM_HandleTypeDef* htim_;
+    float tick_period_; // [s]
     std::array<uint16_t, 4> gpios_;
+    Channel_t channels_[4];
 };
 
-#endif // __PWM_INPUT_HPP
\ No newline at end of file
+#endif // __PWM_INPUT_HPP
@@ -0,0 +1,127 @@
+#ifndef __RL_IDENTIFIER_HPP
+#define __RL_IDENTIFIER_HPP
+
+#include <cmath>
+#include <algorithm>
+
+// Identification of the resistance and inductance of a winding from its
+// response to a voltage excitation, sampled once per control period.
+// Fits the discrete model
+//     I[k+1] = a * I[k] + b0 * V[k] + b1 * V[k-1] + b2 * V[k-2] + c
+// with batch least squares, where V[k] is the voltage commanded in period k.
+// The three voltage terms absorb the delay of the PWM update and the current
+// sampling, whichever it is, and c absorbs a constant voltage error such as
+// the one of the dead time. With b = b0 + b1 + b2 the zero order hold
+// discretization of L dI/dt = V - R I gives
+//     R = (1 - a) / b,  L = -R * dt / ln(a).
+// The noise of the measured I[k] would bias plain least squares towards a
+// higher R, so this is an instrumental variable fit: V[k-3] stands in for
+// I[k] as the instrument, it is correlated with I[k] but not with its noise.
+// The samples are taken relative to an operating point and the model is fit
+// for I[k+1] - I[k], which keeps the equations well conditioned in single
+// precision.
+class RLIdentifier {
+public:
+    static constexpr int N = 5;
+
+    // @brief Starts a new fit around the given operating point
+    void reset(float I_ref, float V_ref) {
+        I_ref_ = I_ref;
+        V_ref_ = V_ref;
+        for (int i = 0; i < N; ++i) {
+            rhs_[i] = 0.0f;
+            for (int j = 0; j < N; ++j)
+                A_[i][j] = 0.0f;
+        }
+        V_hist_[0] = V_hist_[1] = V_hist_[2] = V_hist_[3] = 0.0f;
+        I_last_ = 0.0f;
+        samples_ = 0;
+    }
+
+    // @brief Adds the sample of one control period
+    // @param I: current measured in this period
+    // @param V: voltage commanded in this period
+    void add(float I, float V) {
+        float i = I - I_ref_;
+        if (samples_ >= 4) {
+            const float phi[N] = {I_last_, V_hist_[0], V_hist_[1], V_hist_[2], 1.0f};
+            const float z[N] = {V_hist_[3], V_hist_[0], V_hist_[1], V_hist_[2], 1.0f};
+            float y = i - I_last_;
+            for (int r = 0; r < N; ++r) {
+                rhs_[r] += z[r] * y;
+                for (int c = 0; c < N; ++c)
+                    A_[r][c] += z[r] * phi[c];
+            }
+        }
+        I_last_ = i;
+        V_hist_[3] = V_hist_[2];
+        V_hist_[2] = V_hist_[1];
+        V_hist_[1] = V_hist_[0];
+        V_hist_[0] = V - V_ref_;
+        ++samples_;
+    }
+
+    // @brief Solves the fit
+    // @param dt: control period
+    // @returns false if the excitation was insufficient or the result is not
+    // a passive RL circuit
+    bool solve(float dt, float* R, float* L) const {
+        float M[N][N + 1];
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c)
+                M[r][c] = A_[r][c];
+            M[r][N] = rhs_[r];
+        }
+        // Column magnitudes, for the singularity check
+        float scale[N];
+        for (int c = 0; c < N; ++c) {
+            scale[c] = 1e-30f;
+            for (int r = 0; r < N; ++r)
+                scale[c] = std::max(scale[c], std::abs(A_[r][c]));
+        }
+        // Gaussian elimination with partial pivoting
+        for (int k = 0; k < N; ++k) {
+            int pivot = k;
+            for (int r = k + 1; r < N; ++r)
+                if (std::abs(M[r][k]) > std::abs(M[pivot][k]))
+                    pivot = r;
+            if (!(std::abs(M[pivot][k]) > 1e-6f * scale[k]))
+                return false;
+            for (int c = 0; c <= N; ++c)
+                std::swap(M[k][c], M[pivot][c]);
+            for (int r = k + 1; r < N; ++r) {
+                float f = M[r][k] / M[k][k];
+                for (int c = k; c <= N; ++c)
+                    M[r][c] -= f * M[k][c];
+            }
+        }
+        float theta[N];
+        for (int r = N - 1; r >= 0; --r) {
+            float s = M[r][N];
+            for (int c = r + 1; c < N; ++c)
+                s -= M[r][c] * theta[c];
+            theta[r] = s / M[r][r];
+        }
+
+        float a = 1.0f + theta[0];
+        float b = theta[1] + theta[2] + theta[3];
+        if (!(a > 0.0f && a < 1.0f && b > 0.0f))
+            return false;
+        *R = (1.0f - a) / b;
+        *L = -*R * dt / std::log(a);
+        return std::isfinite(*R) && std::isfinite(*L);
+    }
+
+    int samples() const { return samples_; }
+
+private:
+    float A_[N][N] = {};  // sum of z * phi^T
+    float rhs_[N] = {};
+    float V_hist_[4] = {};
+    float I_last_ = 0.0f;
+    float I_ref_ = 0.0f;
+    float V_ref_ = 0.0f;
+    int samples_ = 0;
+};
+
+#endif // __RL_IDENTIFIER_HPP
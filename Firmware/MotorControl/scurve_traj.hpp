@@ -0,0 +1,163 @@
+#ifndef __SCURVE_TRAJ_HPP
+#define __SCURVE_TRAJ_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <stddef.h>
+
+// Jerk limited point to point trajectory (7-segment S-curve).
+// The move is planned as a velocity change from the initial velocity to a
+// peak velocity, an optional cruise at that velocity and a velocity change
+// down to zero. Each velocity change is a jerk-up, constant acceleration,
+// jerk-down sequence, so the acceleration is continuous throughout. The
+// initial acceleration is assumed to be zero.
+class SCurveTrajectory {
+public:
+    struct Step_t {
+        float Y;
+        float Yd;
+        float Ydd;
+    };
+
+    // One jerk limited velocity change, symmetric in time
+    struct Ramp_t {
+        float v0 = 0.0f; // [turn/s] start velocity
+        float dv = 0.0f; // [turn/s] signed change of velocity
+        float a = 0.0f;  // [turn/s^2] signed peak acceleration
+        float Tj = 0.0f; // [s] duration of each jerk phase
+        float Ta = 0.0f; // [s] duration of the constant acceleration phase
+        float T = 0.0f;  // [s] total duration
+
+        // The profile is point symmetric, so the mean velocity is the mean of the end points
+        float dist() const { return (v0 + 0.5f * dv) * T; }
+    };
+
+    static Ramp_t planRamp(float v0, float v1, float Amax, float Jmax) {
+        Ramp_t r;
+        r.v0 = v0;
+        r.dv = v1 - v0;
+        float abs_dv = std::abs(r.dv);
+        float a = std::min(Amax, std::sqrt(abs_dv * Jmax)); // Amax isn't reached on small changes
+        r.Tj = a / Jmax;
+        r.Ta = a > 0.0f ? std::max(abs_dv / a - r.Tj, 0.0f) : 0.0f;
+        r.T = 2.0f * r.Tj + r.Ta;
+        r.a = std::copysign(a, r.dv);
+        return r;
+    }
+
+    // @brief Evaluates a ramp at time t in [0, r.T], the position is relative to its start
+    static Step_t evalRamp(const Ramp_t& r, float t) {
+        float j = r.Tj > 0.0f ? r.a / r.Tj : 0.0f;
+        if (t < r.Tj) {  // Jerk up
+            return {r.v0 * t + j * t * t * t * (1.0f / 6.0f),
+                    r.v0 + 0.5f * j * t * t,
+                    j * t};
+        } else if (t < r.Tj + r.Ta) {  // Constant acceleration
+            float ta = t - r.Tj;
+            float v1 = r.v0 + 0.5f * r.a * r.Tj;
+            float y1 = r.v0 * r.Tj + r.a * r.Tj * r.Tj * (1.0f / 6.0f);
+            return {y1 + v1 * ta + 0.5f * r.a * ta * ta,
+                    v1 + r.a * ta,
+                    r.a};
+        } else {  // Jerk down, evaluated backwards from the end
+            float td = std::max(r.T - t, 0.0f);
+            float v_end = r.v0 + r.dv;
+            return {r.dist() - (v_end * td - j * td * td * td * (1.0f / 6.0f)),
+                    v_end - 0.5f * j * td * td,
+                    j * td};
+        }
+    }
+
+    // @returns false if any of the limits is not positive
+    bool plan(float Xf, float Xi, float Vi,
+              float Vmax, float Amax, float Dmax, float Jmax) {
+        if (!(Vmax > 0.0f && Amax > 0.0f && Dmax > 0.0f && Jmax > 0.0f))
+            return false;
+
+        float dX = Xf - Xi; // Distance to travel
+        float dXstop = planRamp(Vi, 0.0f, Dmax, Jmax).dist(); // Minimum stopping displacement
+        float s = std::copysign(1.0f, dX - dXstop); // Sign of the peak velocity
+
+        // Speeding up uses the acceleration limit, slowing down (including
+        // the over-speed case) the deceleration limit. A reversal is both.
+        auto plan_peak = [&](float Vp) {
+            float A1 = s * (Vp - Vi) < 0.0f ? Dmax : s * Vi < 0.0f ? std::min(Amax, Dmax) : Amax;
+            accel_ = planRamp(Vi, Vp, A1, Jmax);
+            decel_ = planRamp(Vp, 0.0f, Dmax, Jmax);
+            return accel_.dist() + decel_.dist();
+        };
+
+        Vr_ = s * Vmax;
+        float dXmin = plan_peak(Vr_);
+        if (s * dX >= s * dXmin) {
+            // Long move, cruise at Vmax
+            Tv_ = (dX - dXmin) / Vr_;
+        } else {
+            // Short move: bisect the peak velocity. The displacement of
+            // peak 0 (just stopping) is never beyond dX by the choice of s.
+            float lo = 0.0f;
+            float hi = Vr_;
+            for (int i = 0; i < 24; ++i) {
+                float mid = 0.5f * (lo + hi);
+                if (s * plan_peak(mid) <= s * dX)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            Vr_ = lo;
+            float dXpeak = plan_peak(Vr_);
+            // cruise over the remaining bisection tolerance
+            Tv_ = Vr_ != 0.0f ? std::max((dX - dXpeak) / Vr_, 0.0f) : 0.0f;
+        }
+
+        Tf_ = accel_.T + Tv_ + decel_.T;
+        Xi_ = Xi;
+        Xf_ = Xf;
+        Vi_ = Vi;
+        return true;
+    }
+
+    Step_t eval(float t) const {
+        if (t < 0.0f) {  // Initial Condition
+            return {Xi_, Vi_, 0.0f};
+        } else if (t < accel_.T) {  // Accelerating
+            Step_t step = evalRamp(accel_, t);
+            step.Y += Xi_;
+            return step;
+        } else if (t < accel_.T + Tv_) {  // Coasting
+            return {Xi_ + accel_.dist() + Vr_ * (t - accel_.T), Vr_, 0.0f};
+        } else if (t < Tf_) {  // Decelerating, relative to the goal so there is no step at the end
+            Step_t step = evalRamp(decel_, t - accel_.T - Tv_);
+            step.Y += Xf_ - decel_.dist();
+            return step;
+        } else {  // Final Condition
+            return {Xf_, 0.0f, 0.0f};
+        }
+    }
+
+    // @brief Lists the start times and jerks of the constant jerk phases
+    // @returns the number of phases (7)
+    size_t phases(float* T, float* J) const {
+        float Td = accel_.T + Tv_;
+        float ja = accel_.Tj > 0.0f ? accel_.a / accel_.Tj : 0.0f;
+        float jd = decel_.Tj > 0.0f ? decel_.a / decel_.Tj : 0.0f;
+        const float times[] = {0.0f, accel_.Tj, accel_.Tj + accel_.Ta, accel_.T,
+                               Td, Td + decel_.Tj, Td + decel_.Tj + decel_.Ta};
+        const float jerks[] = {ja, 0.0f, -ja, 0.0f, jd, 0.0f, -jd};
+        std::copy(std::begin(times), std::end(times), T);
+        std::copy(std::begin(jerks), std::end(jerks), J);
+        return 7;
+    }
+
+    float Xi_ = 0.0f;
+    float Xf_ = 0.0f;
+    float Vi_ = 0.0f;
+    float Vr_ = 0.0f; // [turn/s] peak velocity
+    float Tv_ = 0.0f; // [s] duration of the cruise phase
+    float Tf_ = 0.0f; // [s] total duration
+    Ramp_t accel_;
+    Ramp_t decel_;
+};
+
+#endif // __SCURVE_TRAJ_HPP
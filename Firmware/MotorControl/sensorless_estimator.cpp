@@ -1,6 +1,99 @@
 
 #include "odrive_main.h"
 
+bool SensorlessEstimator::apply_config() {
+    config_.parent = this;
+    update_gains();
+    return true;
+}
+
+// @brief Caches everything the update loop needs from config_. Must be called
+// whenever one of the estimator config values changes.
+void SensorlessEstimator::update_gains() {
+    // Pll gains as a function of bandwidth
+    float pll_kp = 2.0f * config_.pll_bandwidth;
+    // Critically damped
+    float pll_ki = 0.25f * (pll_kp * pll_kp);
+    // Check that we don't get problems with discrete time approximation
+    gains_stable_ = current_meas_period * pll_kp < 1.0f;
+
+    pll_kp_dt_ = current_meas_period * pll_kp;
+    pll_ki_dt_ = current_meas_period * pll_ki;
+    pm_flux_sqr_ = config_.pm_flux_linkage * config_.pm_flux_linkage;
+    observer_gain_dt_ = current_meas_period * 0.5f * config_.observer_gain / pm_flux_sqr_;
+
+    float hfi_kp = 2.0f * config_.hfi_bandwidth;
+    hfi_kp_dt_ = current_meas_period * hfi_kp;
+    hfi_ki_dt_ = current_meas_period * 0.25f * (hfi_kp * hfi_kp);
+    hfi_filter_k_ = std::min(current_meas_period * config_.hfi_bandwidth, 1.0f);
+    // See update_hfi(), the phase_inductance factor is applied there
+    hfi_err_gain_ = config_.hfi_saliency > 1.0f
+            ? 1.0f / (config_.hfi_voltage * current_meas_period * (1.0f - 1.0f / config_.hfi_saliency))
+            : 0.0f;
+}
+
+// @returns false if the injection can't track the rotor with the current config
+bool SensorlessEstimator::start_hfi() {
+    if (!(config_.hfi_saliency > 1.0f && config_.hfi_voltage > 0.0f))
+        return false;
+    hfi_enabled_ = true;
+    hfi_active_ = true;
+    hfi_pos_ = 0.0f;
+    hfi_vel_ = 0.0f;
+    hfi_d_response_ = 0.0f;
+    hfi_sign_memory_ = 0.0f;
+    I_alpha_beta_last_[0] = I_alpha_beta_last_[1] = 0.0f;
+    pll_pos_ = 0.0f;
+    vel_estimate_erad_ = 0.0f;
+    return true;
+}
+
+void SensorlessEstimator::stop_hfi() {
+    hfi_enabled_ = false;
+    hfi_active_ = false;
+    axis_->motor_.hfi_voltage_ = 0.0f;
+    axis_->motor_.hfi_sign_ = 0.0f;
+}
+
+// @brief The injection response only reveals the d axis up to 180°. Called by
+// the axis if the magnet polarity detection found the estimate to be reversed.
+void SensorlessEstimator::flip_hfi_polarity() {
+    hfi_pos_ = wrap_pm_pi(hfi_pos_ + M_PI);
+    phase_ = hfi_pos_;
+}
+
+// @brief Square wave high frequency injection estimator, for salient (Ld < Lq)
+// motors where the flux observer can't see the rotor at low speed.
+// Motor::FOC_current adds +-hfi_voltage to the estimated d axis, alternating
+// every cycle. With an angle error e between the estimated and the real
+// rotor, the change of current over one cycle is in the estimated frame
+//   dI_d = s * V * T * (Y_sum + Y_diff * cos(2e))
+//   dI_q = s * V * T * Y_diff * sin(2e)
+// with Y_sum, Y_diff = (1/Ld +- 1/Lq) / 2 and s the injection sign. So the
+// demodulated dI_q is an error signal for a PLL on the d axis, and with
+// Ld ~ phase_inductance it scales to e as implemented by hfi_err_gain_.
+void SensorlessEstimator::update_hfi(float I_alpha, float I_beta) {
+    // The current step up to this sample was caused by the voltage computed
+    // two cycles ago, like V_alpha_beta_memory_.
+    float sign = hfi_sign_memory_;
+    hfi_sign_memory_ = axis_->motor_.hfi_sign_;
+
+    float dI_alpha = I_alpha - I_alpha_beta_last_[0];
+    float dI_beta = I_beta - I_alpha_beta_last_[1];
+    I_alpha_beta_last_[0] = I_alpha;
+    I_alpha_beta_last_[1] = I_beta;
+
+    float c, s;
+    our_arm_sincos_f32(hfi_pos_, &s, &c);
+    float dI_d = sign * (c * dI_alpha + s * dI_beta);
+    float dI_q = sign * (c * dI_beta - s * dI_alpha);
+    hfi_d_response_ += hfi_filter_k_ * (dI_d - hfi_d_response_);
+
+    float err = hfi_err_gain_ * axis_->motor_.config_.phase_inductance * dI_q;
+    hfi_pos_ = wrap_pm_pi(hfi_pos_ + current_meas_period * hfi_vel_ + hfi_kp_dt_ * err);
+    hfi_vel_ += hfi_ki_dt_ * err;
+}
+
 bool SensorlessEstimator::update() {
     // Algorithm based on paper: Sensorless Control of Surface-Mount Permanent-Magnet Synchronous Motors Based on a Nonlinear Observer
     // http://cas.ensmp.fr/~praly/Telechargement/Journaux/2010-IEEE_TPEL-Lee-Hong-Nam-Ortega-Praly-Astolfi.pdf
@@ -10,71 +103,83 @@ bool SensorlessEstimator::update() {
     // is the one computed two cycles ago. To get the correct measurement, it was stored twice:
     // once by final_v_alpha/final_v_beta in the current control reporting, and once by V_alpha_beta_memory.
 
-    // Clarke transform
-    float I_alpha_beta[2] = {
-        -axis_->motor_.current_meas_.phB - axis_->motor_.current_meas_.phC,
-        one_by_sqrt3 * (axis_->motor_.current_meas_.phB - axis_->motor_.current_meas_.phC)};
-
-    // Swap sign of I_beta if motor is reversed
-    I_alpha_beta[1] *= axis_->motor_.config_.direction;
-
-    // alpha-beta vector operations
-    float eta[2];
-    for (int i = 0; i <= 1; ++i) {
-        // y is the total flux-driving voltage (see paper eqn 4)
-        float y = -axis_->motor_.config_.phase_resistance * I_alpha_beta[i] + V_alpha_beta_memory_[i];
-        // flux dynamics (prediction)
-        float x_dot = y;
-        // integrate prediction to current timestep
-        flux_state_[i] += x_dot * current_meas_period;
-
-        // eta is the estimated permanent magnet flux (see paper eqn 6)
-        eta[i] = flux_state_[i] - axis_->motor_.config_.phase_inductance * I_alpha_beta[i];
+    if (!gains_stable_) {
+        error_ |= ERROR_UNSTABLE_GAIN;
+        vel_estimate_valid_ = false;
+        return false;
     }
 
-    // Non-linear observer (see paper eqn 8):
-    float pm_flux_sqr = config_.pm_flux_linkage * config_.pm_flux_linkage;
-    float est_pm_flux_sqr = eta[0] * eta[0] + eta[1] * eta[1];
-    float bandwidth_factor = 1.0f / pm_flux_sqr;
-    float eta_factor = 0.5f * (config_.observer_gain * bandwidth_factor) * (pm_flux_sqr - est_pm_flux_sqr);
-
-    // alpha-beta vector operations
-    for (int i = 0; i <= 1; ++i) {
-        // add observer action to flux estimate dynamics
-        float x_dot = eta_factor * eta[i];
-        // convert action to discrete-time
-        flux_state_[i] += x_dot * current_meas_period;
-        // update new eta
-        eta[i] = flux_state_[i] - axis_->motor_.config_.phase_inductance * I_alpha_beta[i];
-    }
+    const float R = axis_->motor_.config_.phase_resistance;
+    const float L = axis_->motor_.config_.phase_inductance;
+    const float direction = (float)axis_->motor_.config_.direction;
+
+    // Clarke transform, swap sign of I_beta if motor is reversed
+    float I_alpha = axis_->motor_.current_meas_.phA;
+    float I_beta = direction * one_by_sqrt3 * (axis_->motor_.current_meas_.phB - axis_->motor_.current_meas_.phC);
+
+    // Flux dynamics (prediction): y = V - R*I is the total flux-driving voltage
+    // (see paper eqn 4), integrated to the current timestep
+    float flux_alpha = flux_state_[0] + current_meas_period * (V_alpha_beta_memory_[0] - R * I_alpha);
+    float flux_beta = flux_state_[1] + current_meas_period * (V_alpha_beta_memory_[1] - R * I_beta);
+
+    // eta is the estimated permanent magnet flux (see paper eqn 6)
+    float eta_alpha = flux_alpha - L * I_alpha;
+    float eta_beta = flux_beta - L * I_beta;
+
+    // Non-linear observer (see paper eqn 8), added to the flux estimate dynamics
+    float est_pm_flux_sqr = eta_alpha * eta_alpha + eta_beta * eta_beta;
+    float eta_factor = observer_gain_dt_ * (pm_flux_sqr_ - est_pm_flux_sqr);
+    flux_alpha += eta_factor * eta_alpha;
+    flux_beta += eta_factor * eta_beta;
+    flux_state_[0] = flux_alpha;
+    flux_state_[1] = flux_beta;
+
+    // update new eta
+    eta_alpha = flux_alpha - L * I_alpha;
+    eta_beta = flux_beta - L * I_beta;
 
     // Flux state estimation done, store V_alpha_beta for next timestep
     V_alpha_beta_memory_[0] = axis_->motor_.current_control_.final_v_alpha;
-    V_alpha_beta_memory_[1] = axis_->motor_.current_control_.final_v_beta * axis_->motor_.config_.direction;
+    V_alpha_beta_memory_[1] = axis_->motor_.current_control_.final_v_beta * direction;
 
     // PLL
     // TODO: the PLL part has some code duplication with the encoder PLL
-    // Pll gains as a function of bandwidth
-    float pll_kp = 2.0f * config_.pll_bandwidth;
-    // Critically damped
-    float pll_ki = 0.25f * (pll_kp * pll_kp);
-    // Check that we don't get problems with discrete time approximation
-    if (!(current_meas_period * pll_kp < 1.0f)) {
-        error_ |= ERROR_UNSTABLE_GAIN;
-        vel_estimate_valid_ = false;
-        return false;
-    }
-
     // predict PLL phase with velocity
-    pll_pos_ = wrap_pm_pi(pll_pos_ + current_meas_period * vel_estimate_erad_);
+    pll_pos_ = wrap_pm_pi_fast(pll_pos_ + current_meas_period * vel_estimate_erad_);
     // update PLL phase with observer permanent magnet phase
-    phase_ = fast_atan2(eta[1], eta[0]);
-    float delta_phase = wrap_pm_pi(phase_ - pll_pos_);
-    pll_pos_ = wrap_pm_pi(pll_pos_ + current_meas_period * pll_kp * delta_phase);
+    float flux_phase = fast_atan2(eta_beta, eta_alpha);
+    float delta_phase = wrap_pm_pi_fast(flux_phase - pll_pos_);
+    pll_pos_ = wrap_pm_pi_fast(pll_pos_ + pll_kp_dt_ * delta_phase);
     // update PLL velocity
-    vel_estimate_erad_ += current_meas_period * pll_ki * delta_phase;
+    vel_estimate_erad_ += pll_ki_dt_ * delta_phase;
+
+    if (hfi_enabled_) {
+        // Hand over between the estimators with hysteresis. The flux observer
+        // keeps running during injection, but its PLL is reset to the
+        // injection estimate when handing over to it.
+        if (hfi_active_ && std::abs(hfi_vel_) > config_.hfi_handoff_vel) {
+            hfi_active_ = false;
+            pll_pos_ = hfi_pos_;
+            vel_estimate_erad_ = hfi_vel_;
+        } else if (!hfi_active_ && std::abs(vel_estimate_erad_) < 0.5f * config_.hfi_handoff_vel) {
+            hfi_active_ = true;
+            hfi_pos_ = pll_pos_;
+            hfi_vel_ = vel_estimate_erad_;
+            hfi_sign_memory_ = 0.0f;
+        }
+        axis_->motor_.hfi_voltage_ = hfi_active_ ? config_.hfi_voltage : 0.0f;
+        if (hfi_active_) {
+            update_hfi(I_alpha, I_beta);
+            phase_ = hfi_pos_;
+            vel_estimate_ = hfi_vel_ * axis_->derived_.turns_per_elec_rad;
+            vel_estimate_valid_ = true;
+            return true;
+        }
+    }
+
+    phase_ = flux_phase;
     // convert to mechanical turns/s for controller usage.
-    vel_estimate_ = vel_estimate_erad_ / (std::max((float)axis_->motor_.config_.pole_pairs, 1.0f) * 2.0f * M_PI);
+    vel_estimate_ = vel_estimate_erad_ * axis_->derived_.turns_per_elec_rad;
 
     vel_estimate_valid_ = true;
     return true;
@@ -7,9 +7,30 @@ public:
         float observer_gain = 1000.0f; // [rad/s]
         float pll_bandwidth = 1000.0f;  // [rad/s]
         float pm_flux_linkage = 1.58e-3f; // [V / (rad/s)]  { 5.51328895422 / (<pole pairs> * <rpm/v>) }
+        // High frequency injection for salient motors at low speed
+        bool enable_hfi = false;
+        float hfi_voltage = 2.0f; // [V] square wave amplitude on the estimated d axis
+        float hfi_bandwidth = 200.0f; // [rad/s]
+        float hfi_saliency = 1.5f; // Lq / Ld
+        float hfi_handoff_vel = 300.0f; // [rad/s] electrical, to the flux observer above this
+        float hfi_polarity_current = 5.0f; // [A] d axis current pulses for magnet polarity detection
+
+        // custom setters
+        SensorlessEstimator* parent = nullptr;
+        void set_observer_gain(float value) { observer_gain = value; parent->update_gains(); }
+        void set_pll_bandwidth(float value) { pll_bandwidth = value; parent->update_gains(); }
+        void set_pm_flux_linkage(float value) { pm_flux_linkage = value; parent->update_gains(); }
+        void set_hfi_voltage(float value) { hfi_voltage = value; parent->update_gains(); }
+        void set_hfi_bandwidth(float value) { hfi_bandwidth = value; parent->update_gains(); }
+        void set_hfi_saliency(float value) { hfi_saliency = value; parent->update_gains(); }
     };
 
+    bool apply_config();
+    void update_gains();
     bool update();
+    bool start_hfi();
+    void stop_hfi();
+    void flip_hfi_polarity();
 
     Axis* axis_ = nullptr; // set by Axis constructor
     Config_t config_;
@@ -21,11 +42,32 @@ public:
     float vel_estimate_ = 0.0f;                      // [turn/s]
     float vel_estimate_erad_ = 0.0f;                 // [rad/s]
     bool vel_estimate_valid_ = false;
-    // float pll_kp_ = 0.0f;                       // [rad/s / rad]
-    // float pll_ki_ = 0.0f;                       // [(rad/s^2) / rad]
+    // Derived from config_ by update_gains(), all premultiplied by current_meas_period
+    float pll_kp_dt_ = 0.0f;                    // [rad / rad]
+    float pll_ki_dt_ = 0.0f;                    // [(rad/s) / rad]
+    float pm_flux_sqr_ = 0.0f;                  // [(Vs)^2]
+    float observer_gain_dt_ = 0.0f;             // [1 / (Vs)^2]
+    bool gains_stable_ = false;
     float flux_state_[2] = {0.0f, 0.0f};        // [Vs]
     float V_alpha_beta_memory_[2] = {0.0f, 0.0f}; // [V]
     bool estimator_good_ = false;
+
+    // High frequency injection estimator, enabled by the axis during
+    // sensorless control. It is active below hfi_handoff_vel.
+    bool hfi_enabled_ = false;
+    bool hfi_active_ = false;
+    float hfi_pos_ = 0.0f;                      // [rad]
+    float hfi_vel_ = 0.0f;                      // [rad/s]
+    float hfi_d_response_ = 0.0f;               // [A] filtered d axis current step per injection step
+    float hfi_sign_memory_ = 0.0f;
+    float I_alpha_beta_last_[2] = {0.0f, 0.0f}; // [A]
+    float hfi_kp_dt_ = 0.0f;                    // [rad / rad]
+    float hfi_ki_dt_ = 0.0f;                    // [(rad/s) / rad]
+    float hfi_err_gain_ = 0.0f;                 // [1 / (V s)]
+    float hfi_filter_k_ = 0.0f;
+
+private:
+    void update_hfi(float I_alpha, float I_beta);
 };
 
 #endif /* __SENSORLESS_ESTIMATOR_HPP */
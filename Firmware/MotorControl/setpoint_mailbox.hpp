@@ -0,0 +1,75 @@
+#ifndef __SETPOINT_MAILBOX_HPP
+#define __SETPOINT_MAILBOX_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+// Setpoints handed from the protocol threads to the control loop as one
+// consistent set, so that the control loop never sees the new velocity with
+// the old torque feedforward of a command. Like the current command mailbox
+// in Motor it is double buffered: publish() fills the buffer the control loop
+// isn't reading and then advances the sequence counter, take() copies the
+// latest buffer once per control loop iteration without locks.
+//
+// Several protocols can publish, so calls to publish() must be serialized
+// by the caller. The control loop has a higher priority than all of them and
+// never waits for a writer, it always finds a complete buffer.
+//
+// The fields published since the last take() accumulate, so a velocity
+// command followed by a torque command within one control period applies
+// both.
+class SetpointMailbox {
+public:
+    enum Field : uint32_t {
+        POS = 1u << 0,
+        VEL = 1u << 1,
+        TORQUE = 1u << 2,
+    };
+
+    struct Setpoints_t {
+        float input_pos = 0.0f;    // [turn]
+        float input_vel = 0.0f;    // [turn/s]
+        float input_torque = 0.0f; // [Nm]
+        uint32_t fields = 0;       // Field bits that were published
+    };
+
+    // @brief Producer side. Must not be interrupted by another publish().
+    // @param fields: Field bits of the values to update, the others are ignored
+    void publish(uint32_t fields, float pos, float vel, float torque) {
+        uint32_t seq = seq_;
+        const Setpoints_t& prev = buf_[seq & 1];
+        Setpoints_t& next = buf_[(seq + 1) & 1];
+        next = prev;
+        if (seq_taken_ == seq)
+            next.fields = 0; // prev was already applied
+        if (fields & POS)
+            next.input_pos = pos;
+        if (fields & VEL)
+            next.input_vel = vel;
+        if (fields & TORQUE)
+            next.input_torque = torque;
+        next.fields |= fields;
+        std::atomic_signal_fence(std::memory_order_release); // publish the buffer before the counter
+        seq_ = seq + 1;
+    }
+
+    // @brief Consumer side. Returns false if nothing was published since the
+    // last call.
+    bool take(Setpoints_t* setpoints) {
+        uint32_t seq = seq_;
+        if (seq == seq_taken_)
+            return false;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        *setpoints = buf_[seq & 1];
+        std::atomic_signal_fence(std::memory_order_release); // done reading before the buffer is released
+        seq_taken_ = seq;
+        return true;
+    }
+
+private:
+    Setpoints_t buf_[2];
+    volatile uint32_t seq_ = 0;       // written by publish()
+    volatile uint32_t seq_taken_ = 0; // written by take()
+};
+
+#endif // __SETPOINT_MAILBOX_HPP
@@ -0,0 +1,55 @@
+#ifndef __SNAPSHOT_MAILBOX_HPP
+#define __SNAPSHOT_MAILBOX_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+// Latest value of a set of control loop signals, handed to a lower priority
+// thread as one consistent snapshot. The control loop writes without ever
+// waiting, the reader copies the snapshot and retries if the control loop
+// wrote meanwhile (a sequence lock). Like the SetpointMailbox this relies on
+// a single core, where compiler fences are sufficient.
+//
+// There must be only one writer, which is not preempted by the readers.
+template<typename T>
+class SnapshotMailbox {
+public:
+    static constexpr int max_retries = 4;
+
+    // @brief Producer side
+    void write(const T& value) {
+        uint32_t seq = seq_;
+        seq_ = seq + 1; // odd while the value is written
+        std::atomic_signal_fence(std::memory_order_release);
+        value_ = value;
+        std::atomic_signal_fence(std::memory_order_release);
+        seq_ = (seq + 2) ? seq + 2 : 2; // 0 stays reserved for "not written yet"
+    }
+
+    // @brief Consumer side. Returns false if nothing was written yet or the
+    // writer interrupted every attempt to copy the value.
+    // @param seq: if not null, receives the sequence number of the snapshot,
+    //        which changes with every write()
+    bool read(T* value, uint32_t* seq = nullptr) const {
+        for (int i = 0; i < max_retries; ++i) {
+            uint32_t before = seq_;
+            if (!before)
+                return false;
+            std::atomic_signal_fence(std::memory_order_acquire);
+            *value = value_;
+            std::atomic_signal_fence(std::memory_order_acquire);
+            if (!(before & 1) && seq_ == before) {
+                if (seq)
+                    *seq = before;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    T value_ = {};
+    volatile uint32_t seq_ = 0;
+};
+
+#endif // __SNAPSHOT_MAILBOX_HPP
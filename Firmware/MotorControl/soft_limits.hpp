@@ -0,0 +1,95 @@
+#ifndef __SOFT_LIMITS_HPP
+#define __SOFT_LIMITS_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+// Software travel limits of the position. Position setpoints are clamped into
+// [min_pos, max_pos], and the velocity toward a limit is kept below the one
+// from which the axis can still stop at the limit with the deceleration
+// limit, like the stop distance of the trapezoidal planner:
+//   v_max = sqrt(2 * decel * distance to the limit)
+// less the distance covered until the next update, so that the sampled
+// velocity doesn't overshoot the limit or the deceleration near it.
+// So a velocity setpoint, the feedforward of a trajectory or a large position
+// error all bring the axis to a controlled stop at the limit instead of into
+// it. The velocity away from a limit is not restricted, an axis beyond a limit
+// can always be moved back.
+//
+// The limits are checked against the position estimate. Being beyond a limit
+// by more than the tolerance, e.g. after being pushed there by an external
+// force, is counted as a violation.
+class SoftLimits {
+public:
+    struct Config_t {
+        bool enable = false;
+        float min_pos = -INFINITY;  // [turn]
+        float max_pos = INFINITY;   // [turn]
+        float decel_limit = 0.0f;   // [turn/s^2] 0 to use trap_traj.config.decel_limit
+        float tolerance = 0.05f;    // [turn] beyond a limit before it is a violation
+        bool error_on_violation = false;
+    };
+
+    // @brief Once per control loop iteration, before clamp_pos() and clamp_vel()
+    // @param pos: [turn] position estimate
+    // @param decel: [turn/s^2] deceleration toward a limit
+    // @param dt: [s] time until the next update
+    // @returns false if the position is beyond a limit by more than the tolerance
+    bool update(const Config_t& config, float pos, float decel, float dt) {
+        vel_max_ = stop_vel(config.max_pos - pos, decel, dt);
+        vel_min_ = -stop_vel(pos - config.min_pos, decel, dt);
+        bool violated = pos > config.max_pos + config.tolerance || pos < config.min_pos - config.tolerance;
+        if (violated && !violated_)
+            ++violations_;
+        violated_ = violated;
+        return !violated;
+    }
+
+    // @brief Clamps a position setpoint into the limits
+    float clamp_pos(const Config_t& config, float pos) const {
+        return std::clamp(pos, config.min_pos, config.max_pos);
+    }
+
+    // @brief Clamps a velocity into the range from which the axis can still
+    // stop at the limits
+    float clamp_vel(float vel) {
+        float clamped = std::clamp(vel, vel_min_, vel_max_);
+        limited_ = clamped != vel;
+        return clamped;
+    }
+
+    // @brief Releases the velocity range, e.g. while disabled
+    void reset() {
+        vel_min_ = -INFINITY;
+        vel_max_ = INFINITY;
+        limited_ = false;
+        violated_ = false;
+    }
+
+    float vel_min() const { return vel_min_; } // [turn/s]
+    float vel_max() const { return vel_max_; } // [turn/s]
+    bool limited() const { return limited_; }  // clamp_vel() reduced the velocity
+    bool violated() const { return violated_; }
+    uint32_t violations() const { return violations_; }
+
+private:
+    // @brief Largest velocity v with v * dt + v^2 / (2 * decel) <= distance
+    // @param distance: [turn] to the limit, negative beyond it
+    static float stop_vel(float distance, float decel, float dt) {
+        if (!(distance > 0.0f))
+            return 0.0f;
+        if (std::isinf(decel) || std::isinf(distance))
+            return distance / dt;
+        float decel_dt = decel * dt;
+        return std::sqrt(decel_dt * decel_dt + 2.0f * decel * distance) - decel_dt;
+    }
+
+    float vel_min_ = -INFINITY; // [turn/s]
+    float vel_max_ = INFINITY;  // [turn/s]
+    bool limited_ = false;
+    bool violated_ = false;
+    uint32_t violations_ = 0;
+};
+
+#endif // __SOFT_LIMITS_HPP
@@ -0,0 +1,51 @@
+#ifndef __SPLINE_TRAJ_HPP
+#define __SPLINE_TRAJ_HPP
+
+#include <algorithm>
+
+// Cubic Hermite segment between two waypoints given by position and velocity.
+// Streaming these gives a path with continuous position and velocity, the
+// acceleration steps at the waypoints.
+class CubicHermiteSegment {
+public:
+    struct Step_t {
+        float Y;
+        float Yd;
+        float Ydd;
+    };
+
+    // @brief Plans the segment from (p0, v0) to (p1, v1) over T seconds, T > 0
+    void plan(float p0, float v0, float p1, float v1, float T) {
+        float inv_T = 1.0f / T;
+        float slope = (p1 - p0) * inv_T;
+        c0_ = p0;
+        c1_ = v0;
+        c2_ = (3.0f * slope - 2.0f * v0 - v1) * inv_T;
+        c3_ = (v0 + v1 - 2.0f * slope) * inv_T * inv_T;
+        T_ = T;
+        p1_ = p1;
+        v1_ = v1;
+    }
+
+    // @brief Evaluates the segment at t in [0, T_], t is clamped to that range
+    Step_t eval(float t) const {
+        if (t >= T_)
+            return {p1_, v1_, 2.0f * c2_ + 6.0f * c3_ * T_};
+        t = std::max(t, 0.0f);
+        return {c0_ + t * (c1_ + t * (c2_ + t * c3_)),
+                c1_ + t * (2.0f * c2_ + 3.0f * c3_ * t),
+                2.0f * c2_ + 6.0f * c3_ * t};
+    }
+
+    float T_ = 0.0f;  // [s] duration
+    float p1_ = 0.0f; // end position, returned exactly at T_
+    float v1_ = 0.0f; // end velocity
+
+private:
+    float c0_ = 0.0f; // polynomial coefficients in t
+    float c1_ = 0.0f;
+    float c2_ = 0.0f;
+    float c3_ = 0.0f;
+};
+
+#endif // __SPLINE_TRAJ_HPP
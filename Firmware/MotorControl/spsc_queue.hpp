@@ -0,0 +1,69 @@
+#ifndef __SPSC_QUEUE_HPP
+#define __SPSC_QUEUE_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+// Fixed size queue of setpoints streamed to the control loop.
+// There must be only one producer (the protocol that queues items) and one
+// consumer (the control loop). The producer only writes head_ and flush_to_,
+// the consumer only writes tail_, so no locks are needed. Like the current
+// command mailbox in Motor this relies on a single core, where compiler
+// fences are sufficient.
+template<typename T, uint32_t N>
+class SpscQueue {
+public:
+    static constexpr uint32_t capacity = N;
+
+    // @brief Producer side. Returns false if the queue is full.
+    bool push(const T& item) {
+        uint32_t head = head_;
+        if (head - begin() >= capacity)
+            return false;
+        buf_[head % capacity] = item;
+        std::atomic_signal_fence(std::memory_order_release); // publish the item before the index
+        head_ = head + 1;
+        return true;
+    }
+
+    // @brief Producer side. Drops all queued items.
+    void clear() {
+        flush_to_ = head_;
+    }
+
+    // @brief Consumer side. Returns the oldest item or nullptr if empty.
+    // The item stays valid until pop().
+    const T* peek() {
+        uint32_t tail = begin();
+        tail_ = tail;
+        if (tail == head_)
+            return nullptr;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        return &buf_[tail % capacity];
+    }
+
+    // @brief Consumer side. Removes the item returned by peek().
+    void pop() {
+        std::atomic_signal_fence(std::memory_order_release); // done reading before the slot is released
+        tail_ = tail_ + 1;
+    }
+
+    uint32_t depth() const {
+        return head_ - begin();
+    }
+
+private:
+    // First valid index, taking a pending clear() into account
+    uint32_t begin() const {
+        uint32_t tail = tail_;
+        uint32_t flush_to = flush_to_;
+        return (int32_t)(flush_to - tail) > 0 ? flush_to : tail;
+    }
+
+    T buf_[capacity] = {};
+    volatile uint32_t head_ = 0;
+    volatile uint32_t tail_ = 0;
+    volatile uint32_t flush_to_ = 0;
+};
+
+#endif // __SPSC_QUEUE_HPP
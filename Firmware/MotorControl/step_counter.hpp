@@ -0,0 +1,48 @@
+#ifndef __STEP_COUNTER_HPP
+#define __STEP_COUNTER_HPP
+
+#include <stdint.h>
+
+// Signed count of the pulses of a step/dir input.
+//
+// In software mode the step interrupt calls on_step() for every pulse. In
+// timer mode a hardware timer counts the pulses upwards regardless of the
+// direction, and only a change of the direction pin calls on_dir_change(),
+// which books the pulses since the last change with the old direction.
+// sync() does the same once per control loop iteration, so that the timer
+// difference never gets close to overflowing.
+class StepCounter {
+public:
+    void reset(uint32_t timer_count, bool dir) {
+        count_ = 0;
+        last_timer_count_ = timer_count;
+        dir_ = dir;
+    }
+
+    // @brief Software mode: one pulse in the given direction
+    void on_step(bool dir) {
+        count_ += dir ? 1 : -1;
+    }
+
+    // @brief Timer mode: the direction pin changed
+    void on_dir_change(uint32_t timer_count, bool dir) {
+        sync(timer_count);
+        dir_ = dir;
+    }
+
+    // @brief Timer mode: books the pulses since the last call
+    void sync(uint32_t timer_count) {
+        int32_t delta = (int32_t)(timer_count - last_timer_count_);
+        count_ += dir_ ? delta : -delta;
+        last_timer_count_ = timer_count;
+    }
+
+    int32_t count() const { return count_; }
+
+private:
+    int32_t count_ = 0;
+    uint32_t last_timer_count_ = 0;
+    bool dir_ = true;
+};
+
+#endif // __STEP_COUNTER_HPP
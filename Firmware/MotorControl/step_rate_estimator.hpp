@@ -0,0 +1,43 @@
+#ifndef __STEP_RATE_ESTIMATOR_HPP
+#define __STEP_RATE_ESTIMATOR_HPP
+
+#include <algorithm>
+
+// Second order tracking loop on the staircase position of a step/dir input,
+// like the PLL of the encoder. It interpolates the position between the
+// steps and estimates the velocity and acceleration of the step stream, which
+// the controller can use as feedforward. Being a type 2 loop, the position
+// follows a constant velocity without lag.
+class StepRateEstimator {
+public:
+    void reset(float pos) {
+        pos_ = pos;
+        vel_ = 0.0f;
+        accel_ = 0.0f;
+    }
+
+    // @param pos_meas: position of the step count [turns]
+    // @param bandwidth: [rad/s] of the tracking loop
+    void update(float pos_meas, float dt, float bandwidth) {
+        float kp = 2.0f * bandwidth;
+        float ki = 0.25f * kp * kp; // critically damped
+        pos_ += dt * vel_;
+        float err = pos_meas - pos_;
+        pos_ += dt * kp * err;
+        vel_ += dt * ki * err;
+        // ki * err is the change of the velocity, it is as rough as the
+        // steps and gets another low pass below the loop bandwidth
+        accel_ += std::min(0.25f * dt * bandwidth, 1.0f) * (ki * err - accel_);
+    }
+
+    float pos() const { return pos_; }     // [turns]
+    float vel() const { return vel_; }     // [turns/s]
+    float accel() const { return accel_; } // [turns/s^2]
+
+private:
+    float pos_ = 0.0f;
+    float vel_ = 0.0f;
+    float accel_ = 0.0f;
+};
+
+#endif // __STEP_RATE_ESTIMATOR_HPP
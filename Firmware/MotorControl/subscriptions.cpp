@@ -0,0 +1,104 @@
+#include "subscriptions.hpp"
+
+#include <odrive_main.h>
+#include <communication/interface_usb.h>
+#include <usbd_cdc_if.h>
+#include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
+
+#include <algorithm>
+#include <cmath>
+
+const uint32_t stack_size_subscriptions_thread = 1024; // Bytes
+CCM_RAM static StackType_t subscriptions_thread_stack[stack_size_subscriptions_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t subscriptions_thread_tcb;
+static constexpr int32_t kSubscriptionsSignalStart = 1;
+
+// @brief Resolves the configured properties and starts notifying.
+// Returns false if a property can't be read as a number or the native USB
+// interface doesn't carry raw packets in this build.
+bool Subscriptions::start() {
+    active_ = false;
+#if !defined(USB_PROTOCOL_NATIVE)
+    return false;
+#else
+    num_subscriptions_ = std::clamp<size_t>(config_.num_subscriptions, 1, max_subscriptions);
+    for (size_t i = 0; i < num_subscriptions_; ++i) {
+        signals_[i].type_info = fibre::get_float_endpoint(config_.endpoints[i], &signals_[i].property);
+        if (!signals_[i].type_info)
+            return false;
+    }
+    initial_ = true;
+    sent_packets_ = 0;
+    failed_packets_ = 0;
+    active_ = true;
+    if (thread_id_)
+        osSignalSet(thread_id_, kSubscriptionsSignalStart);
+    return true;
+#endif
+}
+
+// @brief Reads all subscribed properties
+// @returns the mask of the values to send
+uint8_t Subscriptions::check(bool refresh, float* values) {
+    uint8_t mask = 0;
+    for (size_t i = 0; i < num_subscriptions_; ++i) {
+        values[i] = signals_[i].get();
+        float deadband = std::max(config_.deadbands[i], 0.0f);
+        float delta = std::abs(values[i] - sent_values_[i]);
+        bool changed = deadband > 0.0f ? delta >= deadband : values[i] != sent_values_[i];
+        if (refresh || changed)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+void Subscriptions::run_notifier() {
+    uint8_t packet[7 + 4 * max_subscriptions];
+    uint32_t last_refresh = 0;
+
+    for (;;) {
+        if (!active_) {
+            osSignalWait(kSubscriptionsSignalStart, osWaitForever);
+            continue;
+        }
+
+        uint32_t now = HAL_GetTick();
+        bool refresh = initial_ || (config_.refresh_interval_ms && now - last_refresh >= config_.refresh_interval_ms);
+        float values[max_subscriptions];
+        uint8_t mask = check(refresh, values);
+
+        if (mask) {
+            uint8_t* ptr = packet;
+            ptr += write_le<uint16_t>(notification_seq_no, ptr);
+            ptr += write_le<uint32_t>(odrv.timebase_.now(), ptr);
+            *(ptr++) = mask;
+            for (size_t i = 0; i < num_subscriptions_; ++i) {
+                if (mask & (1 << i))
+                    ptr += write_le<float>(values[i], ptr);
+            }
+            // A value is only taken as sent if the packet went out, so a
+            // change isn't lost while the USB is busy
+            if (usb_native_packet_output_ptr->process_packet(packet, ptr - packet) == 0) {
+                for (size_t i = 0; i < num_subscriptions_; ++i) {
+                    if (mask & (1 << i))
+                        sent_values_[i] = values[i];
+                }
+                if (refresh) {
+                    initial_ = false;
+                    last_refresh = now;
+                }
+                ++sent_packets_;
+            } else {
+                ++failed_packets_;
+            }
+        }
+
+        osDelay(std::max<uint32_t>(config_.interval_ms, 1));
+    }
+}
+
+void Subscriptions::start_thread() {
+    osThreadStaticDef(subscriptions_thread_def, thread_entry, osPriorityLow, 0, stack_size_subscriptions_thread / sizeof(StackType_t), subscriptions_thread_stack, &subscriptions_thread_tcb);
+    thread_id_ = osThreadCreate(osThread(subscriptions_thread_def), this);
+}
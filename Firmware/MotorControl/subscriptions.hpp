@@ -0,0 +1,51 @@
+#ifndef __SUBSCRIPTIONS_HPP
+#define __SUBSCRIPTIONS_HPP
+
+#include <oscilloscope.hpp>
+
+// Notifies the host of changes of up to max_subscriptions properties over
+// the native USB endpoint, so that it doesn't have to poll them. A low
+// priority thread reads the properties every config.interval_ms and sends a
+// packet with the ones that moved by more than their deadband since they
+// were last sent. A deadband of 0 sends every change. All values are sent
+// every config.refresh_interval_ms regardless, so the host recovers from a
+// lost packet.
+//
+// Packet format (little endian):
+//     uint16 notification_seq_no, uint32 board_time [us], uint8 mask,
+//     then one float32 per set bit of mask, in the order of the subscriptions
+class Subscriptions : public ODriveIntf::SubscriptionsIntf {
+public:
+    static constexpr size_t max_subscriptions = 8;
+    static constexpr uint16_t notification_seq_no = 0x7ffe; // next to Telemetry::telemetry_seq_no
+
+    struct Config_t {
+        endpoint_ref_t endpoints[max_subscriptions];
+        float deadbands[max_subscriptions] = {}; // 0: notify on any change
+        uint32_t num_subscriptions = 1;
+        uint32_t interval_ms = 10;          // [ms] between two checks
+        uint32_t refresh_interval_ms = 1000; // [ms] between two packets with all values, 0 to disable
+    };
+
+    bool start();
+    void stop() { active_ = false; }
+    void start_thread();
+
+    Config_t config_;
+    osThreadId thread_id_ = nullptr;
+    bool active_ = false;
+    uint32_t sent_packets_ = 0;
+    uint32_t failed_packets_ = 0;
+
+private:
+    static void thread_entry(void* ctx) { reinterpret_cast<Subscriptions*>(ctx)->run_notifier(); }
+    void run_notifier();
+    uint8_t check(bool refresh, float* values);
+
+    Oscilloscope::Signal_t signals_[max_subscriptions];
+    float sent_values_[max_subscriptions] = {};
+    size_t num_subscriptions_ = 0;
+    bool initial_ = true; // the first check sends all values
+};
+
+#endif // __SUBSCRIPTIONS_HPP
@@ -1,4 +1,8 @@
 #include "taskTimer.hpp"
 
 bool TaskTimer::sample_next = false;
+bool TaskTimer::stats_enabled = true;
 volatile uint32_t adc_timestamp = 0;
+#ifdef TASK_TIMER_DWT
+volatile uint32_t period_start_cycles = 0;
+#endif
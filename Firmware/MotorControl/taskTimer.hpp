@@ -11,26 +11,102 @@ inline uint16_t sample_TIM13() {
     return clocks_per_cnt * htim13.Instance->CNT;  // TODO: Use a hw_config
 }
 
+// Timestamp source of the task timers, in CPU clocks (TIM_1_8_CLOCK_HZ).
+// TASK_TIMER_DWT selects the free running 32 bit cycle counter of the core,
+// otherwise TIM13 is used, which only resolves APB1 ticks and reloads every
+// current measurement period.
+#ifdef TASK_TIMER_DWT
+inline uint32_t sample_task_timer() {
+    return DWT->CYCCNT;
+}
+
+inline uint32_t task_timer_delta(uint32_t start, uint32_t end) {
+    return end - start;
+}
+#else
+inline uint32_t sample_task_timer() {
+    return sample_TIM13();
+}
+
+inline uint32_t task_timer_delta(uint32_t start, uint32_t end) {
+    constexpr uint32_t period_clocks = 2 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1);
+    return end >= start ? end - start : end + period_clocks - start;
+}
+#endif
+
+// @brief Enables the timestamp source, called once at startup
+// The cycle counter is enabled with either backend, it also gives the
+// timestamps of Timebase.
+inline void task_timer_init() {
+    // Not reset, the counter is shared with the FreeRTOS run time stats
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
 struct TaskTimer {
+    // Bin i counts the lengths in [2^(i-1), 2^i) clocks, bin 0 the zero length
+    static constexpr size_t histogram_size = 18;
+
     uint32_t startTime = 0;
     uint32_t endTime = 0;
     uint32_t length = 0;
     uint32_t maxLength = 0;
 
+    // Continuous statistics, recorded on every run while stats_enabled is set
+    uint32_t count = 0;
+    uint64_t totalLength = 0;
+    uint32_t minLength = UINT32_MAX;
+    uint32_t peakLength = 0;
+    uint32_t histogram[histogram_size] = {};
+
     static bool sample_next;
+    static bool stats_enabled;
 
     void beginTimer() {
-        if (sample_next)
-            startTime = sample_TIM13();
+        if (sample_next || stats_enabled)
+            startTime = sample_task_timer();
     }
 
     void stopTimer() {
-        if (sample_next) {
-            endTime = sample_TIM13();
-            length = endTime - startTime;
-            maxLength = std::max(maxLength, length);
+        if (sample_next || stats_enabled) {
+            endTime = sample_task_timer();
+            uint32_t sample = task_timer_delta(startTime, endTime);
+            if (sample_next) {
+                length = sample;
+                maxLength = std::max(maxLength, length);
+            }
+            if (stats_enabled)
+                record(sample);
         }
     }
+
+    void record(uint32_t sample) {
+        ++count;
+        totalLength += sample;
+        minLength = std::min(minLength, sample);
+        peakLength = std::max(peakLength, sample);
+        size_t bin = sample ? 32 - __builtin_clz(sample) : 0;
+        ++histogram[std::min(bin, histogram_size - 1)];
+    }
+
+    uint32_t get_histogram(uint32_t bin) {
+        return bin < histogram_size ? histogram[bin] : 0;
+    }
+
+    float get_mean() {
+        return count ? (float)totalLength / (float)count : 0.0f;
+    }
+
+    void reset_stats() {
+        count = 0;
+        totalLength = 0;
+        minLength = UINT32_MAX;
+        peakLength = 0;
+        std::fill(histogram, histogram + histogram_size, 0);
+    }
 };
 
-extern volatile uint32_t adc_timestamp;
\ No newline at end of file
+extern volatile uint32_t adc_timestamp;
+#ifdef TASK_TIMER_DWT
+extern volatile uint32_t period_start_cycles;
+#endif
\ No newline at end of file
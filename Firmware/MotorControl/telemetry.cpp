@@ -0,0 +1,103 @@
+
+#include "telemetry.hpp"
+
+#include <communication/interface_usb.h>
+#include <usbd_cdc_if.h>
+#include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
+
+#include <algorithm>
+#include <atomic>
+
+const uint32_t stack_size_telemetry_thread = 1024; // Bytes
+CCM_RAM static StackType_t telemetry_thread_stack[stack_size_telemetry_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t telemetry_thread_tcb;
+static constexpr int32_t kTelemetrySignalStart = 1;
+
+// @brief Resolves the configured signals and starts streaming.
+// Returns false if a channel can't be read as a number or the native USB
+// interface doesn't carry raw packets in this build.
+bool Telemetry::start() {
+    active_ = false;
+#if !defined(USB_PROTOCOL_NATIVE)
+    return false;
+#else
+    num_channels_ = std::clamp<size_t>(config_.num_channels, 1, max_channels);
+    for (size_t i = 0; i < num_channels_; ++i) {
+        channels_[i].type_info = fibre::get_float_endpoint(config_.channels[i], &channels_[i].property);
+        if (!channels_[i].type_info)
+            return false;
+    }
+    decimation_count_ = 0;
+    sent_frames_ = 0;
+    dropped_frames_ = 0;
+    std::atomic_signal_fence(std::memory_order_release); // the channels are written before the control loop sees active_
+    active_ = true;
+    if (thread_id_)
+        osSignalSet(thread_id_, kTelemetrySignalStart);
+    return true;
+#endif
+}
+
+// @brief Records a frame, called by the control loop
+void Telemetry::sample(uint32_t loop_counter) {
+    if (!active_)
+        return;
+    if (++decimation_count_ < config_.decimation)
+        return;
+    decimation_count_ = 0;
+
+    Frame_t frame;
+    frame.loop_counter = loop_counter;
+    for (size_t i = 0; i < num_channels_; ++i)
+        frame.values[i] = channels_[i].get();
+    if (!queue_.push(frame))
+        ++dropped_frames_;
+}
+
+void Telemetry::run_sender() {
+    // One byte short of a full USB packet, so each packet ends the transfer
+    // without a zero length packet.
+    uint8_t packet[USB_TX_DATA_SIZE - 1];
+    const size_t header_size = 4;
+
+    for (;;) {
+        if (!active_) {
+            while (queue_.peek())
+                queue_.pop(); // discard what's left of the last stream
+            osSignalWait(kTelemetrySignalStart, osWaitForever);
+            continue;
+        }
+        if (!queue_.peek()) {
+            osDelay(1);
+            continue;
+        }
+
+        size_t num_channels = num_channels_;
+        size_t frame_size = 4 * (1 + num_channels);
+        size_t max_frames = (sizeof(packet) - header_size) / frame_size;
+        uint8_t* ptr = packet + header_size;
+        uint8_t num_frames = 0;
+        while (num_frames < max_frames) {
+            const Frame_t* frame = queue_.peek();
+            if (!frame)
+                break;
+            ptr += write_le<uint32_t>(frame->loop_counter, ptr);
+            for (size_t i = 0; i < num_channels; ++i)
+                ptr += write_le<float>(frame->values[i], ptr);
+            queue_.pop();
+            ++num_frames;
+        }
+        write_le<uint16_t>(telemetry_seq_no, packet);
+        packet[2] = (uint8_t)num_channels;
+        packet[3] = num_frames;
+
+        if (usb_native_packet_output_ptr->process_packet(packet, ptr - packet) == 0)
+            sent_frames_ += num_frames;
+    }
+}
+
+void Telemetry::start_thread() {
+    osThreadStaticDef(telemetry_thread_def, thread_entry, osPriorityBelowNormal, 0, stack_size_telemetry_thread / sizeof(StackType_t), telemetry_thread_stack, &telemetry_thread_tcb);
+    thread_id_ = osThreadCreate(osThread(telemetry_thread_def), this);
+}
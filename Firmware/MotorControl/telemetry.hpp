@@ -0,0 +1,56 @@
+#ifndef __TELEMETRY_HPP
+#define __TELEMETRY_HPP
+
+#include <oscilloscope.hpp>
+#include <spsc_queue.hpp>
+
+// Streams up to max_channels signals to the host over the native USB
+// endpoint. The control loop pushes one frame per sample into a queue, a
+// low priority thread packs the frames into USB packets, so the control loop
+// never waits on USB. Frames that don't fit into the queue are dropped and
+// counted.
+//
+// Packet format (little endian):
+//     uint16 telemetry_seq_no, uint8 num_channels, uint8 num_frames,
+//     then num_frames times {uint32 loop_counter, float32 values[num_channels]}
+// With config.board_time_timestamps the loop_counter is the board time in us.
+class Telemetry : public ODriveIntf::TelemetryIntf {
+public:
+    static constexpr size_t max_channels = 8;
+    static constexpr uint32_t queue_size = 64; // [frames]
+    static constexpr uint16_t telemetry_seq_no = 0x7fff; // never used by responses, these have bit 15 set
+
+    struct Config_t {
+        endpoint_ref_t channels[max_channels];
+        uint32_t num_channels = 1;
+        uint32_t decimation = 1; // control loop iterations per frame
+    };
+
+    bool start();
+    void stop() { active_ = false; }
+    void sample(uint32_t loop_counter);
+    void start_thread();
+
+    Config_t config_;
+    osThreadId thread_id_ = nullptr;
+    bool active_ = false;
+    uint32_t sent_frames_ = 0;
+    uint32_t dropped_frames_ = 0;
+
+private:
+    struct Frame_t {
+        uint32_t loop_counter;
+        float values[max_channels];
+    };
+
+    static void thread_entry(void* ctx) { reinterpret_cast<Telemetry*>(ctx)->run_sender(); }
+    void run_sender();
+
+    Oscilloscope::Signal_t channels_[max_channels];
+    size_t num_channels_ = 0;
+    uint32_t decimation_count_ = 0;
+
+    SpscQueue<Frame_t, queue_size> queue_; // producer: control loop, consumer: sender thread
+};
+
+#endif // __TELEMETRY_HPP
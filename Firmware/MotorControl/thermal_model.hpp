@@ -0,0 +1,100 @@
+#ifndef __THERMAL_MODEL_HPP
+#define __THERMAL_MODEL_HPP
+
+#include <cmath>
+#include <algorithm>
+
+// Lumped two node thermal model of a heat source (winding, FET junction)
+// mounted to a heat sink (motor housing, PCB) that is cooled by the ambient:
+//
+//     P -> [T0, C0] --R01-- [T1, C1] --R1a-- T_ambient
+//
+// The ambient temperature is estimated from a thermistor at one of the nodes,
+// which calibrates the model against slow effects it doesn't know about
+// (environment, airflow, the other axis). The fast rise of T0 under a current
+// peak comes from the model.
+//
+// The model is stepped at step_period from the losses averaged since the
+// last step, so that the temperature increments don't get lost to the float
+// resolution at the control loop rate. The time constants C0 * R01 and
+// C1 * R1a must be much longer than step_period.
+class ThermalModel {
+public:
+    static constexpr float step_period = 0.01f; // [s]
+
+    struct Params_t {
+        float C0;  // [J/K] heat capacity of the source
+        float R01; // [K/W] thermal resistance from the source to the heat sink
+        float C1;  // [J/K] heat capacity of the heat sink
+        float R1a; // [K/W] thermal resistance from the heat sink to the ambient
+    };
+
+    void reset(float T_ambient) {
+        T_[0] = T_[1] = T_ambient_ = T_ambient;
+        energy_ = 0.0f;
+        time_ = 0.0f;
+    }
+
+    // @brief Accumulates the losses over one call period and steps the model
+    // once step_period has passed
+    // @returns true if the model was stepped
+    bool add_losses(const Params_t& params, float P, float dt) {
+        energy_ += P * dt;
+        time_ += dt;
+        if (time_ < step_period)
+            return false;
+        step(params, energy_ / time_, time_);
+        energy_ = 0.0f;
+        time_ = 0.0f;
+        return true;
+    }
+
+    void step(const Params_t& params, float P, float dt) {
+        float P01 = (T_[0] - T_[1]) / params.R01;
+        float P1a = (T_[1] - T_ambient_) / params.R1a;
+        T_[0] += (P - P01) * (dt / params.C0);
+        T_[1] += (P01 - P1a) * (dt / params.C1);
+    }
+
+    // @brief Moves the ambient estimate so that the given node approaches a
+    // measured temperature
+    // @param k: bandwidth of the estimate times the time since the last call
+    void correct(int node, float T_measured, float k) {
+        if (is_valid(T_measured))
+            T_ambient_ += std::min(k, 1.0f) * (T_measured - T_[node]);
+    }
+
+    // @brief Losses that heat the source to T_max in the given time. T1 is
+    // assumed constant over that time, which is the case for a horizon much
+    // shorter than C1 * R1a.
+    float max_losses(const Params_t& params, float T_max, float horizon) const {
+        float e = std::exp(-horizon / (params.C0 * params.R01));
+        float T_inf = (T_max - T_[0] * e) / (1.0f - e);
+        return std::max(0.0f, (T_inf - T_[1]) / params.R01);
+    }
+
+    // @brief Time it takes losses P to heat the source to T_max, with the
+    // same assumption as max_losses()
+    // @returns INFINITY if the losses are sustainable
+    float peak_duration(const Params_t& params, float P, float T_max) const {
+        if (T_[0] >= T_max)
+            return 0.0f;
+        float T_inf = T_[1] + P * params.R01;
+        if (T_inf <= T_max)
+            return INFINITY;
+        return params.C0 * params.R01 * std::log((T_inf - T_[0]) / (T_inf - T_max));
+    }
+
+    float temperature(int node) const { return T_[node]; }
+    float ambient() const { return T_ambient_; }
+
+private:
+    static bool is_valid(float T) { return std::isfinite(T); }
+
+    float T_[2] = {25.0f, 25.0f}; // [°C]
+    float T_ambient_ = 25.0f; // [°C]
+    float energy_ = 0.0f; // [J] since the last step
+    float time_ = 0.0f; // [s] since the last step
+};
+
+#endif // __THERMAL_MODEL_HPP
@@ -19,8 +19,27 @@ ThermistorCurrentLimiter::ThermistorCurrentLimiter(uint16_t adc_channel,
 }
 
 void ThermistorCurrentLimiter::update() {
+    if (!table_valid_) {
+        table_.build([this](float x) { return horner_poly_eval(x, coefficients_, num_coeffs_); });
+        table_valid_ = true;
+    }
+
     const float normalized_voltage = get_adc_relative_voltage_ch(adc_channel_);
-    temperature_ = horner_poly_eval(normalized_voltage, coefficients_, num_coeffs_);
+    float temperature;
+    if (normalized_voltage >= 0.0f && normalized_voltage <= 1.0f) {
+        temperature = table_.eval(normalized_voltage);
+    } else {
+        temperature = horner_poly_eval(normalized_voltage, coefficients_, num_coeffs_); // invalid channel
+    }
+
+    const float temp_margin = temp_limit_upper_ - temperature;
+    const float derating_range = temp_limit_upper_ - temp_limit_lower_;
+    float fraction = temp_margin / derating_range;
+    if (fraction < 0.0f || is_nan(fraction)) {
+        fraction = 0.0f;
+    }
+    temperature_ = temperature;
+    current_lim_fraction_ = std::min(fraction, 1.0f);
 }
 
 bool ThermistorCurrentLimiter::do_checks() {
@@ -35,14 +54,7 @@ float ThermistorCurrentLimiter::get_current_limit(float base_current_lim) const
         return base_current_lim;
     }
 
-    const float temp_margin = temp_limit_upper_ - temperature_;
-    const float derating_range = temp_limit_upper_ - temp_limit_lower_;
-    float thermal_current_lim = base_current_lim * (temp_margin / derating_range);
-    if (thermal_current_lim < 0.0f || is_nan(thermal_current_lim)) {
-        thermal_current_lim = 0.0f;
-    }
-
-    return std::min(thermal_current_lim, base_current_lim);
+    return base_current_lim * current_lim_fraction_;
 }
 
 OnboardThermistorCurrentLimiter::OnboardThermistorCurrentLimiter(uint16_t adc_channel, const float* const coefficients, size_t num_coeffs) :
@@ -69,9 +81,73 @@ OffboardThermistorCurrentLimiter::OffboardThermistorCurrentLimiter() :
 bool OffboardThermistorCurrentLimiter::apply_config() {
     config_.parent = this;
     decode_pin();
+    invalidate_table();
     return true;
 }
 
 void OffboardThermistorCurrentLimiter::decode_pin() {
     adc_channel_ = channel_from_gpio(get_gpio(config_.gpio_pin));
 }
+
+ThermalModelCurrentLimiter::ThermalModelCurrentLimiter(const ThermistorCurrentLimiter& thermistor, int sensed_node, const Config_t& default_config) :
+    config_(default_config),
+    thermistor_(thermistor),
+    sensed_node_(sensed_node),
+    default_config_(default_config)
+{
+}
+
+float ThermalModelCurrentLimiter::loss_resistance() const {
+    float R = config_.resistance > 0.0f ? config_.resistance : motor_->config_.phase_resistance;
+    return R * (1.0f + config_.resistance_tempco * (model_.temperature(0) - 25.0f));
+}
+
+void ThermalModelCurrentLimiter::update(float dt) {
+    const ThermalModel::Params_t params = this->params();
+    if (!config_.enabled || !(params.C0 > 0.0f && params.R01 > 0.0f && params.C1 > 0.0f && params.R1a > 0.0f)) {
+        initialized_ = false;
+        temperature_ = NAN;
+        ambient_temperature_ = NAN;
+        current_limit_ = INFINITY;
+        return;
+    }
+
+    bool use_thermistor = thermistor_.enabled_ && !is_nan(thermistor_.temperature_);
+    if (!initialized_) {
+        // The nodes start out at the thermistor temperature, which errs on
+        // the safe side after a reboot with a hot motor
+        model_.reset(use_thermistor ? thermistor_.temperature_ : config_.ambient_temperature);
+        initialized_ = true;
+    }
+
+    // The sum over the phases is 1.5 times the square of the dq current
+    const Motor::Iph_ABC_t& I = motor_->current_meas_;
+    float I_sq = SQ(I.phA) + SQ(I.phB) + SQ(I.phC);
+    float R = loss_resistance();
+    if (is_nan(I_sq) || !(R > 0.0f))
+        I_sq = 0.0f;
+    if (!model_.add_losses(params, R * I_sq, dt))
+        return;
+
+    if (use_thermistor)
+        model_.correct(sensed_node_, thermistor_.temperature_, config_.ambient_bandwidth * ThermalModel::step_period);
+    temperature_ = model_.temperature(0);
+    ambient_temperature_ = model_.ambient();
+
+    float P_max = model_.max_losses(params, config_.temp_limit, config_.horizon);
+    current_limit_ = R > 0.0f ? std::sqrt(P_max / (1.5f * R)) : INFINITY;
+}
+
+float ThermalModelCurrentLimiter::get_current_limit(float base_current_lim) const {
+    if (!config_.enabled || is_nan(current_limit_)) {
+        return base_current_lim;
+    }
+    return std::min(current_limit_, base_current_lim);
+}
+
+float ThermalModelCurrentLimiter::get_peak_duration(float current) {
+    if (!initialized_) {
+        return NAN;
+    }
+    return model_.peak_duration(params(), 1.5f * loss_resistance() * SQ(current), config_.temp_limit);
+}
@@ -4,6 +4,8 @@
 class Motor; // declared in motor.hpp
 
 #include "current_limiter.hpp"
+#include "thermal_model.hpp"
+#include "interpolation_table.hpp"
 #include <autogen/interfaces.hpp>
 
 class ThermistorCurrentLimiter : public CurrentLimiter, public ODriveIntf::ThermistorCurrentLimiterIntf {
@@ -17,7 +19,12 @@ public:
                              const float& temp_limit_upper,
                              const bool& enabled);
 
+    // @brief Samples the thermistor and updates the current limit. Runs in
+    // the analog polling thread, the control loop only reads the results.
     void update();
+    // @brief Makes the next update() rebuild the lookup table of the
+    // polynomial
+    void invalidate_table() { table_valid_ = false; }
     bool do_checks();
     float get_current_limit(float base_current_lim) const override;
 
@@ -29,6 +36,13 @@ public:
     const float& temp_limit_upper_;
     const bool& enabled_;
     Motor* motor_ = nullptr; // set by Motor::apply_config()
+
+private:
+    // Written by update() only, as single words so that the control loop
+    // always sees a consistent value
+    float current_lim_fraction_ = 0.0f;
+    InterpolationTable<65> table_; // temperature over the normalized voltage
+    bool table_valid_ = false;
 };
 
 class OnboardThermistorCurrentLimiter : public ThermistorCurrentLimiter, public ODriveIntf::OnboardThermistorCurrentLimiterIntf {
@@ -60,6 +74,10 @@ public:
         // custom setters
         OffboardThermistorCurrentLimiter* parent;
         void set_gpio_pin(uint16_t value) { gpio_pin = value; parent->decode_pin(); }
+        void set_poly_coefficient_0(float value) { thermistor_poly_coeffs[0] = value; parent->invalidate_table(); }
+        void set_poly_coefficient_1(float value) { thermistor_poly_coeffs[1] = value; parent->invalidate_table(); }
+        void set_poly_coefficient_2(float value) { thermistor_poly_coeffs[2] = value; parent->invalidate_table(); }
+        void set_poly_coefficient_3(float value) { thermistor_poly_coeffs[3] = value; parent->invalidate_table(); }
     };
 
     virtual ~OffboardThermistorCurrentLimiter() = default;
@@ -73,4 +91,57 @@ private:
     void decode_pin();
 };
 
+// Limits the current so that the temperature predicted by a ThermalModel of
+// the I^2 R losses stays below temp_limit over the next horizon seconds. Unlike
+// the thermistor limiters this allows a peak current on a cold motor and only
+// derates towards the sustainable current as the limit is approached. The
+// model is calibrated against the thermistor if it is enabled.
+class ThermalModelCurrentLimiter : public CurrentLimiter, public ODriveIntf::ThermalModelCurrentLimiterIntf {
+public:
+    struct Config_t {
+        bool enabled = false;
+        float resistance = 0.0f; // [Ω] per phase at 25°C, 0 to use the motor phase resistance
+        float resistance_tempco = 0.00393f; // [1/K]
+        float heat_capacity_source = 0.0f; // [J/K]
+        float thermal_resistance_source = 0.0f; // [K/W]
+        float heat_capacity_sink = 0.0f; // [J/K]
+        float thermal_resistance_sink = 0.0f; // [K/W]
+        float temp_limit = 120.0f; // [°C]
+        float horizon = 1.0f; // [s]
+        float ambient_temperature = 25.0f; // [°C] without the thermistor
+        float ambient_bandwidth = 0.01f; // [rad/s]
+    };
+
+    virtual ~ThermalModelCurrentLimiter() = default;
+
+    // @param thermistor: calibrates the model while enabled
+    // @param sensed_node: the node of the model at the thermistor, 0 for the
+    // heat source, 1 for the heat sink
+    ThermalModelCurrentLimiter(const ThermistorCurrentLimiter& thermistor, int sensed_node, const Config_t& default_config);
+
+    void clear_config() { config_ = default_config_; }
+    void update(float dt);
+    float get_current_limit(float base_current_lim) const override;
+    float get_peak_duration(float current);
+
+    Config_t config_;
+    float temperature_ = NAN; // [°C] of the heat source, NaN until the model is initialized
+    float ambient_temperature_ = NAN; // [°C] estimate
+    float current_limit_ = INFINITY; // [A]
+    Motor* motor_ = nullptr; // set by Motor::apply_config()
+
+private:
+    ThermalModel::Params_t params() const {
+        return {config_.heat_capacity_source, config_.thermal_resistance_source,
+                config_.heat_capacity_sink, config_.thermal_resistance_sink};
+    }
+    float loss_resistance() const;
+
+    const ThermistorCurrentLimiter& thermistor_;
+    const int sensed_node_;
+    const Config_t default_config_;
+    ThermalModel model_;
+    bool initialized_ = false;
+};
+
 #endif // __THERMISTOR_HPP
@@ -0,0 +1,67 @@
+#ifndef __THREAD_WATCHDOG_HPP
+#define __THREAD_WATCHDOG_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Liveness supervision of the threads that must keep running, such as the
+// control loops and the protocol servers. Each thread checks in at least once
+// per budget, a thread is supervised from its first check-in on, so threads
+// that were never started (e.g. a disabled UART) don't count as missing.
+// check_in() is a single store and can be called at the control loop rate.
+//
+// overdue() is called periodically from a low priority context and returns
+// the threads whose last check-in is older than their budget. If overdue()
+// itself wasn't called for longer than the smallest budget, the whole CPU
+// was stalled (flash sector erase, debugger halt, long protocol requests that
+// starve the caller) and the check-ins start over instead of reporting all
+// threads at once.
+//
+// Times are in ms and may wrap around.
+class ThreadWatchdog {
+public:
+    static constexpr size_t max_threads = 8;
+
+    // @param budget: [ms] 0 disables the supervision of this thread
+    void set_budget(size_t thread, uint32_t budget) {
+        if (thread < max_threads)
+            budget_[thread] = budget;
+    }
+
+    void check_in(size_t thread, uint32_t now) {
+        last_check_in_[thread] = now;
+        started_[thread] = true;
+    }
+
+    // @returns bitmask of the overdue threads, 0 if all threads are alive
+    uint32_t overdue(uint32_t now) {
+        uint32_t min_budget = UINT32_MAX;
+        for (size_t i = 0; i < max_threads; ++i) {
+            if (started_[i] && budget_[i])
+                min_budget = budget_[i] < min_budget ? budget_[i] : min_budget;
+        }
+        bool stalled = checked_ && now - last_check_ > min_budget;
+        last_check_ = now;
+        checked_ = true;
+
+        uint32_t mask = 0;
+        for (size_t i = 0; i < max_threads; ++i) {
+            if (!started_[i] || !budget_[i])
+                continue;
+            if (stalled)
+                last_check_in_[i] = now;
+            else if ((int32_t)(now - last_check_in_[i]) > (int32_t)budget_[i])
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+
+private:
+    uint32_t budget_[max_threads] = {};              // [ms]
+    volatile uint32_t last_check_in_[max_threads] = {}; // [ms] written by the supervised threads
+    volatile bool started_[max_threads] = {};
+    uint32_t last_check_ = 0; // [ms] of the previous overdue() call
+    bool checked_ = false;
+};
+
+#endif // __THREAD_WATCHDOG_HPP
@@ -0,0 +1,162 @@
+#ifndef __TIMEBASE_HPP
+#define __TIMEBASE_HPP
+
+#include <stdint.h>
+
+// Board time in microseconds, advanced by the control loop once per current
+// measurement period and optionally synchronized to a master on the CAN bus.
+// Setpoints that carry an execution time refer to this time base, so several
+// boards synchronized to the same master execute them on the same tick.
+//
+// Each tick publishes the time of the start of the control period together
+// with the CPU cycle count at that instant, so that the interrupts can take
+// timestamps with the resolution of the cycle counter with timestamp().
+//
+// The synchronization is given pairs of the master time of an event and the
+// local timestamp of the same event, the reception of a time message. The
+// control loop applies the last pair in the next tick(): the first time and
+// after a difference of more than step_threshold it steps the time,
+// otherwise a PI servo corrects a fraction of the phase error and the rate
+// of the local clock. That compensates the crystal tolerance of both boards
+// and averages the jitter of the timestamps instead of following it.
+//
+// The time wraps around after 2^32 us (71 minutes), times must be compared
+// through their signed difference.
+class Timebase {
+public:
+    static constexpr int32_t step_threshold = 1000; // [us]
+    static constexpr float phase_gain = 0.5f;       // fraction of the phase error corrected per sync
+    static constexpr float rate_gain = 0.1f;        // fraction of the phase error per interval corrected in the rate
+    static constexpr float max_rate = 500e-6f;      // beyond the crystal tolerance of both boards
+
+    struct Timestamp_t {
+        uint32_t us;
+        uint32_t ns; // 0 to 999
+    };
+
+    // @param cpu_hz: rate of the cycle counter given to tick() and timestamp()
+    explicit Timebase(uint32_t cpu_hz = 168000000) : cpu_hz_(cpu_hz) {}
+
+    // @brief Advances the time by one control period and applies the last
+    // captured sync. Called by the control loop.
+    // @param period: [s] nominal period of the local clock
+    // @param period_start_cycles: cycle count at the start of the new period
+    void tick(float period, uint32_t period_start_cycles) {
+        float advance_ns = period * 1e9f * (1.0f + rate_);
+        uint32_t seq = capture_seq_;
+        Timestamp_t master = {sync_master_.us, sync_master_.ns};
+        Timestamp_t local = {sync_local_.us, sync_local_.ns};
+        // A capture in between the reads is applied in the next tick
+        if (seq != applied_seq_ && seq == capture_seq_) {
+            applied_seq_ = seq;
+            int32_t error_us = (int32_t)(master.us - local.us);
+            if (!synced_ || error_us > step_threshold || error_us < -step_threshold) {
+                now_us_ = now_us_ + (uint32_t)error_us;
+                advance_ns += (float)((int32_t)master.ns - (int32_t)local.ns);
+                synced_ = true;
+                sync_error_ = 0;
+                pending_phase_ns_ = 0.0f;
+            } else {
+                sync_error_ = error_us * 1000 + ((int32_t)master.ns - (int32_t)local.ns);
+                pending_phase_ns_ = phase_gain * (float)sync_error_;
+                float interval = (float)(int32_t)(local.us - last_sync_local_us_) * 1e-6f; // [s]
+                if (interval > 0.0f) {
+                    rate_ += rate_gain * (float)sync_error_ * 1e-9f / interval;
+                    rate_ = rate_ > max_rate ? max_rate : rate_ < -max_rate ? -max_rate : rate_;
+                }
+            }
+            last_sync_local_us_ = local.us;
+            ++sync_count_;
+        }
+
+        // The phase is corrected over several periods if necessary, so that
+        // the time never runs backwards
+        float max_phase_ns = 0.5f * period * 1e9f;
+        float phase_ns = pending_phase_ns_ > max_phase_ns ? max_phase_ns
+                       : pending_phase_ns_ < -max_phase_ns ? -max_phase_ns : pending_phase_ns_;
+        pending_phase_ns_ -= phase_ns;
+        advance_ns += phase_ns;
+
+        // Whole nanoseconds, the rest is carried over so that rate
+        // corrections below 1ns per period add up
+        residual_ns_ += advance_ns;
+        int32_t whole_ns = (int32_t)residual_ns_;
+        if ((float)whole_ns > residual_ns_)
+            --whole_ns;
+        residual_ns_ -= (float)whole_ns;
+        advance(whole_ns);
+
+        // Written to the slot the interrupts don't read
+        uint32_t slot = anchor_slot_ ^ 1;
+        anchors_[slot] = {now_us_, (uint32_t)frac_ns_, period_start_cycles};
+        anchor_slot_ = slot;
+    }
+
+    // @brief Board time at the given cycle count, which must not be before
+    // the start of the current period. Can be called from any interrupt.
+    Timestamp_t timestamp(uint32_t cycles) const {
+        const Anchor_t& anchor = anchors_[anchor_slot_];
+        uint64_t ns = anchor.ns + (uint64_t)(cycles - anchor.cycles) * 1000000000ull / cpu_hz_;
+        return {anchor.us + (uint32_t)(ns / 1000), (uint32_t)(ns % 1000)};
+    }
+
+    // @brief Records the master time of an event and the local timestamp of
+    // the same event. Called from the RX interrupt.
+    void capture(Timestamp_t master, Timestamp_t local) {
+        sync_master_.us = master.us;
+        sync_master_.ns = master.ns;
+        sync_local_.us = local.us;
+        sync_local_.ns = local.ns;
+        capture_seq_ = capture_seq_ + 1;
+    }
+
+    uint32_t now() const { return now_us_; } // [us] at the start of the current control period
+    bool synced() const { return synced_; }
+    uint32_t sync_count() const { return sync_count_; }
+    int32_t sync_error() const { return sync_error_; } // [ns] master minus local time at the last sync, 0 on a step
+    float rate() const { return rate_; }               // correction of the local clock rate
+
+private:
+    struct Anchor_t {
+        uint32_t us;
+        uint32_t ns;
+        uint32_t cycles;
+    };
+    struct VolatileTimestamp_t {
+        volatile uint32_t us;
+        volatile uint32_t ns;
+    };
+
+    // @param ns: may be negative
+    void advance(int32_t ns) {
+        int32_t frac = frac_ns_ + ns;
+        int32_t us = frac / 1000;
+        frac -= us * 1000;
+        if (frac < 0) {
+            frac += 1000;
+            --us;
+        }
+        now_us_ = now_us_ + (uint32_t)us;
+        frac_ns_ = frac;
+    }
+
+    const uint32_t cpu_hz_;
+    volatile uint32_t now_us_ = 0; // [us] single word, read by any thread
+    int32_t frac_ns_ = 0;          // [ns] 0 to 999, beyond now_us_
+    float residual_ns_ = 0.0f;     // [ns] below 1, not yet added
+    float pending_phase_ns_ = 0.0f; // [ns] of the phase correction, not yet added
+    float rate_ = 0.0f;
+    Anchor_t anchors_[2] = {};
+    volatile uint32_t anchor_slot_ = 0; // the one the interrupts read
+
+    VolatileTimestamp_t sync_master_ = {};
+    VolatileTimestamp_t sync_local_ = {};
+    volatile uint32_t capture_seq_ = 0; // incremented after each capture
+    uint32_t applied_seq_ = 0;
+    uint32_t last_sync_local_us_ = 0;
+    bool synced_ = false;
+    uint32_t sync_count_ = 0;
+    int32_t sync_error_ = 0;
+};
+
+#endif // __TIMEBASE_HPP
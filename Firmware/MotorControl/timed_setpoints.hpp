@@ -0,0 +1,99 @@
+#ifndef __TIMED_SETPOINTS_HPP
+#define __TIMED_SETPOINTS_HPP
+
+#include <stdint.h>
+#include "spsc_queue.hpp"
+#include "spline_traj.hpp"
+
+// Setpoints that carry the board time (see Timebase) at which they take
+// effect, so that the latency and jitter of the transport don't show up in
+// the motion. The host sends them ahead of time, the control loop applies
+// each one on the first tick at or after its time and interpolates between
+// it and the next one:
+//  - with the velocity given at both, cubic Hermite in position and velocity
+//  - otherwise linear in position, with the slope as velocity feedforward
+// The torque feedforward is interpolated linearly.
+//
+// When the buffer runs out the axis stops at the last setpoint. A setpoint that
+// arrives after it was due is applied right away and counted as late. Like
+// the waypoint buffer there must only be one producer, i.e. one protocol
+// streaming timed setpoints at a time.
+class TimedSetpoints {
+public:
+    struct Setpoint_t {
+        uint32_t time; // [us] board time at which it takes effect
+        float pos;     // [turn]
+        float vel;     // [turn/s]
+        float torque;  // [Nm]
+        bool has_vel;  // false to use the slope to the next setpoint
+    };
+    typedef SpscQueue<Setpoint_t, 16> Queue;
+
+    struct Output_t {
+        float pos;    // [turn]
+        float vel;    // [turn/s]
+        float torque; // [Nm]
+    };
+
+    // Producer side
+    bool push(const Setpoint_t& setpoint) { return queue_.push(setpoint); }
+    void clear() { queue_.clear(); }
+
+    // @brief Consumer side, once per control loop iteration
+    // @param now: [us] current board time
+    // @returns false if there is nothing to apply, i.e. no setpoint was due
+    // since the buffer last ran out
+    bool update(uint32_t now, Output_t* out) {
+        while (const Setpoint_t* next = queue_.peek()) {
+            if ((int32_t)(next->time - now) > 0)
+                break;
+            // Due before the previous iteration, so it arrived too late
+            if (started_ && (int32_t)(next->time - prev_now_) <= 0)
+                ++late_;
+            current_ = *next;
+            queue_.pop();
+            active_ = true;
+        }
+        started_ = true;
+        prev_now_ = now;
+        if (!active_)
+            return false;
+
+        const Setpoint_t* next = queue_.peek();
+        if (!next) {
+            // Hold the last setpoint once it is reached
+            active_ = false;
+            *out = {current_.pos, 0.0f, current_.torque};
+            return true;
+        }
+
+        float T = (float)(int32_t)(next->time - current_.time) * 1e-6f; // [s]
+        float t = (float)(int32_t)(now - current_.time) * 1e-6f;         // [s]
+        float frac = t / T;
+        out->torque = current_.torque + frac * (next->torque - current_.torque);
+        if (current_.has_vel && next->has_vel) {
+            CubicHermiteSegment segment;
+            segment.plan(current_.pos, current_.vel, next->pos, next->vel, T);
+            CubicHermiteSegment::Step_t step = segment.eval(t);
+            out->pos = step.Y;
+            out->vel = step.Yd;
+        } else {
+            out->pos = current_.pos + frac * (next->pos - current_.pos);
+            out->vel = (next->pos - current_.pos) / T;
+        }
+        return true;
+    }
+
+    uint32_t depth() const { return queue_.depth(); }
+    uint32_t late() const { return late_; }
+
+private:
+    Queue queue_;
+    Setpoint_t current_ = {}; // last setpoint that was due
+    bool active_ = false;     // current_ is being followed
+    bool started_ = false;
+    uint32_t prev_now_ = 0;   // [us] of the previous update
+    uint32_t late_ = 0;
+};
+
+#endif // __TIMED_SETPOINTS_HPP
@@ -0,0 +1,103 @@
+#ifndef __TRAJ_TICKER_HPP
+#define __TRAJ_TICKER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+#include <algorithm>
+
+// Tick based evaluation of a planned trajectory.
+// The trajectory is split into phases of constant jerk. At plan time each
+// phase gets the index of the first control loop tick that falls into it and
+// its initial state, so the control loop only advances an integer tick
+// counter and evaluates a single polynomial per tick. The time within a phase
+// is computed from the integer tick offset, so it doesn't drift on long moves
+// the way an accumulated float time does.
+class TrajectoryTicker {
+public:
+    struct Step_t {
+        float Y;
+        float Yd;
+        float Ydd;
+    };
+
+    static constexpr size_t max_phases = 7;
+
+    // @brief Prepares the evaluation of traj, which must have an eval(t)
+    // method returning {Y, Yd, Ydd}.
+    // @param T: start time of each phase, ascending, T[0] = 0
+    // @param J: jerk during each phase
+    // @param Tf: end of the trajectory
+    // @param dt: control loop period
+    template<typename TTraj>
+    void start(const TTraj& traj, const float* T, const float* J, size_t num_phases, float Tf, float dt) {
+        num_phases_ = 0;
+        for (size_t i = 0; i < num_phases && i < max_phases; ++i) {
+            uint32_t start_tick = ceil_tick(T[i], dt);
+            if (num_phases_ && start_tick == phases_[num_phases_ - 1].start_tick)
+                --num_phases_; // the previous phase contains no tick
+            auto state = traj.eval(T[i]);
+            Phase_t& phase = phases_[num_phases_++];
+            phase.start_tick = start_tick;
+            phase.tau0 = start_tick * dt - T[i];
+            phase.Y = state.Y;
+            phase.Yd = state.Yd;
+            phase.Ydd = state.Ydd;
+            phase.J = J[i];
+        }
+        // the last tick evaluated is the last one at or before Tf
+        end_tick_ = (uint32_t)std::max(std::floor(Tf / dt) + 1.0f, 0.0f);
+        Xf_ = traj.eval(Tf).Y;
+        dt_ = dt;
+        tick_ = 0;
+        phase_ = 0;
+    }
+
+    // @brief Returns the setpoint of the current tick and advances to the next
+    Step_t next() {
+        if (tick_ >= end_tick_)
+            return {Xf_, 0.0f, 0.0f};
+        while (phase_ + 1 < num_phases_ && tick_ >= phases_[phase_ + 1].start_tick)
+            ++phase_;
+        const Phase_t& p = phases_[phase_];
+        float tau = (float)(tick_ - p.start_tick) * dt_ + p.tau0;
+        ++tick_;
+        float Ydd = p.Ydd + p.J * tau;
+        float Yd = p.Yd + tau * (p.Ydd + 0.5f * p.J * tau);
+        float Y = p.Y + tau * (p.Yd + tau * (0.5f * p.Ydd + (1.0f / 6.0f) * p.J * tau));
+        return {Y, Yd, Ydd};
+    }
+
+    // @brief True when all ticks up to the end of the trajectory were evaluated
+    bool done() const { return tick_ >= end_tick_; }
+
+    // @brief True if the next tick is at or after time t
+    bool reached(float t) const { return tick_ >= ceil_tick(t, dt_); }
+
+    uint32_t tick() const { return tick_; }
+
+private:
+    struct Phase_t {
+        uint32_t start_tick; // first tick in this phase
+        float tau0;          // [s] time of start_tick relative to the start of the phase
+        float Y;             // state at the start of the phase
+        float Yd;
+        float Ydd;
+        float J;
+    };
+
+    // first tick at or after t
+    static uint32_t ceil_tick(float t, float dt) {
+        return (uint32_t)std::max(std::ceil(t / dt), 0.0f);
+    }
+
+    Phase_t phases_[max_phases] = {};
+    size_t num_phases_ = 0;
+    size_t phase_ = 0;
+    uint32_t tick_ = 0;
+    uint32_t end_tick_ = 0;
+    float dt_ = 0.0f;
+    float Xf_ = 0.0f;
+};
+
+#endif // __TRAJ_TICKER_HPP
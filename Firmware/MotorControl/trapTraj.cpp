@@ -1,5 +1,6 @@
 #include <cmath>
-#include "odrive_main.h"
+#include <algorithm>
+#include "trapTraj.hpp"
 #include "utils.hpp"
 
 // A sign function where input 0 has positive sign (not 0)
@@ -57,11 +58,75 @@ bool TrapezoidalTrajectory::planTrapezoidal(float Xf, float Xi, float Vi,
     Xf_ = Xf;
     Vi_ = Vi;
     yAccel_ = Xi + Vi*Ta_ + 0.5f*Ar_*SQ(Ta_); // pos at end of accel phase
+    scurve_active_ = false;
 
     return true;
 }
 
-TrapezoidalTrajectory::Step_t TrapezoidalTrajectory::eval(float t) {
+bool TrapezoidalTrajectory::planSCurve(float Xf, float Xi, float Vi,
+                                       float Vmax, float Amax, float Dmax, float Jmax) {
+    if (!scurve_.plan(Xf, Xi, Vi, Vmax, Amax, Dmax, Jmax))
+        return false;
+    Tf_ = scurve_.Tf_;
+    Xi_ = Xi;
+    Xf_ = Xf;
+    Vi_ = Vi;
+    scurve_active_ = true;
+    return true;
+}
+
+bool TrapezoidalTrajectory::planTimed(float Xf, float Xi, float T, float Ta, float Td) {
+    if (!(Ta > 0.0f && Td > 0.0f && Ta + Td <= T))
+        return false;
+
+    // All moves with the same T, Ta and Td have the same normalized profile,
+    // so axes that share them move along a straight line.
+    Vr_ = (Xf - Xi) / (T - 0.5f * (Ta + Td));
+    Ar_ = Vr_ / Ta;
+    Dr_ = -Vr_ / Td;
+    Ta_ = Ta;
+    Tv_ = T - Ta - Td;
+    Td_ = Td;
+    Tf_ = T;
+    Xi_ = Xi;
+    Xf_ = Xf;
+    Vi_ = 0.0f;
+    yAccel_ = Xi + 0.5f*Ar_*SQ(Ta_);
+    scurve_active_ = false;
+    return true;
+}
+
+float TrapezoidalTrajectory::minTimedDuration(float dX, float Vmax, float Amax, float Dmax, float Ta, float Td) {
+    // The cruise velocity |dX| / (T - (Ta + Td) / 2) must not exceed Vmax,
+    // Amax * Ta or Dmax * Td
+    float Vr = std::min(Vmax, std::min(Amax * Ta, Dmax * Td));
+    float T = Vr > 0.0f ? std::abs(dX) / Vr + 0.5f * (Ta + Td) : INFINITY;
+    return std::max(T, Ta + Td);
+}
+
+void TrapezoidalTrajectory::start(float dt) {
+    float T[TrajectoryTicker::max_phases];
+    float J[TrajectoryTicker::max_phases];
+    size_t num_phases;
+    if (scurve_active_) {
+        num_phases = scurve_.phases(T, J);
+    } else {
+        // accelerating, coasting, decelerating
+        T[0] = 0.0f;
+        T[1] = Ta_;
+        T[2] = Ta_ + Tv_;
+        J[0] = J[1] = J[2] = 0.0f;
+        num_phases = 3;
+    }
+    ticker_.start(*this, T, J, num_phases, Tf_, dt);
+}
+
+TrapezoidalTrajectory::Step_t TrapezoidalTrajectory::eval(float t) const {
+    if (scurve_active_) {
+        SCurveTrajectory::Step_t step = scurve_.eval(t);
+        return {step.Y, step.Yd, step.Ydd};
+    }
+
     Step_t trajStep;
     if (t < 0.0f) {  // Initial Condition
         trajStep.Y   = Xi_;
@@ -1,12 +1,18 @@
 #ifndef _TRAP_TRAJ_H
 #define _TRAP_TRAJ_H
 
+#include "scurve_traj.hpp"
+#include "traj_ticker.hpp"
+
+class Axis;
+
 class TrapezoidalTrajectory {
 public:
     struct Config_t {
         float vel_limit = 2.0f;   // [turn/s]
         float accel_limit = 0.5f; // [turn/s^2]
         float decel_limit = 0.5f; // [turn/s^2]
+        float jerk_limit = 5.0f;  // [turn/s^3] only for INPUT_MODE_SCURVE_TRAJ
     };
     
     struct Step_t {
@@ -17,7 +23,26 @@ public:
 
     bool planTrapezoidal(float Xf, float Xi, float Vi,
                          float Vmax, float Amax, float Dmax);
-    Step_t eval(float t);
+    bool planSCurve(float Xf, float Xi, float Vi,
+                    float Vmax, float Amax, float Dmax, float Jmax);
+    // @brief Plans a rest to rest move with the given total, accel and decel time
+    bool planTimed(float Xf, float Xi, float T, float Ta, float Td);
+    // @brief Minimum total time of a planTimed() move within the given limits
+    static float minTimedDuration(float dX, float Vmax, float Amax, float Dmax, float Ta, float Td);
+    Step_t eval(float t) const;
+
+    // @brief Starts the tick based evaluation of the planned trajectory
+    void start(float dt);
+    // @brief Returns the setpoint for the current control loop tick and advances to the next
+    Step_t next() {
+        TrajectoryTicker::Step_t step = ticker_.next();
+        return {step.Y, step.Yd, step.Ydd};
+    }
+    bool done() const { return ticker_.done(); }
+    // @brief True once the final deceleration towards Xf_ has begun
+    bool decelerating() const {
+        return ticker_.reached(scurve_active_ ? scurve_.accel_.T + scurve_.Tv_ : Ta_ + Tv_);
+    }
 
     Axis* axis_ = nullptr;  // set by Axis constructor
     Config_t config_;
@@ -37,7 +62,11 @@ public:
 
     float yAccel_;
 
-    float t_;
+    TrajectoryTicker ticker_;
+
+    // Set by planSCurve(), eval() then follows scurve_ until the next plan
+    bool scurve_active_ = false;
+    SCurveTrajectory scurve_;
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <cmath>
 #include <limits>
 #include <algorithm>
 #include <array>
@@ -74,6 +75,7 @@ void delay_us(uint32_t us);
 extern "C" {
 float our_arm_sin_f32(float x);
 float our_arm_cos_f32(float x);
+void our_arm_sincos_f32(float x, float* sin_val, float* cos_val);
 }
 
 // ----------------
@@ -139,6 +141,223 @@ inline float wrap_pm_pi(float x) {
     return wrap_pm(x, 2 * M_PI);
 }
 
+// Same as wrap_pm, without the division for the common case that x is at
+// most one period outside the range, as for a position that moved by less
+// than one period since it was last wrapped. Falls back to wrap_pm otherwise.
+// The result is identical to wrap_pm except within a few ulp of ±y/2, where
+// wrap_pm can round the quotient either way and both results are in range.
+inline float wrap_pm_fast(float x, float y) {
+    float half = 0.5f * y;
+    if (x >= -half && x <= half)
+        return x;
+    float shifted = x > 0.0f ? x - y : x + y;
+    if (shifted >= -half && shifted <= half)
+        return shifted;
+    return wrap_pm(x, y); // also handles NaN
+}
+
+// Same as fmodf_pos, with the shortcut of wrap_pm_fast
+inline float fmodf_pos_fast(float x, float y) {
+    float res = wrap_pm_fast(x, y);
+    if (res < 0) res += y;
+    return res;
+}
+
+inline float wrap_pm_pi_fast(float x) {
+    return wrap_pm_fast(x, 2 * M_PI);
+}
+
+// Largest angle [rad] for which rotate_by_small_angle() is accurate to ~1e-7.
+constexpr float small_angle_rotation_max = 0.25f;
+
+// @brief Rotates the vector (c, s) by the angle delta.
+// sin(delta) and cos(delta) are evaluated as truncated Taylor series, which
+// is cheaper than a full trig evaluation if delta is small. This is typically
+// used to derive sin/cos of a slightly advanced angle from an existing pair.
+// @returns false (and leaves c and s untouched) if |delta| is larger than
+// small_angle_rotation_max.
+inline bool rotate_by_small_angle(float delta, float* c, float* s) {
+    if (!(std::abs(delta) <= small_angle_rotation_max))
+        return false;
+    float delta_sq = delta * delta;
+    float cos_d = 1.0f - delta_sq * (0.5f - delta_sq * (1.0f / 24.0f));
+    float sin_d = delta * (1.0f - delta_sq * ((1.0f / 6.0f) - delta_sq * (1.0f / 120.0f)));
+    float c_rot = *c * cos_d - *s * sin_d;
+    float s_rot = *s * cos_d + *c * sin_d;
+    *c = c_rot;
+    *s = s_rot;
+    return true;
+}
+
+// @brief The sextant based space vector modulation of SVM(), which is a hot
+// function in utils.cpp. Inline here so that the host tests can compare the
+// other modulators against it.
+inline std::tuple<float, float, float, bool> sextant_svm(float alpha, float beta) {
+    float tA, tB, tC;
+    int Sextant;
+
+    if (beta >= 0.0f) {
+        if (alpha >= 0.0f) {
+            //quadrant I
+            if (one_by_sqrt3 * beta > alpha)
+                Sextant = 2; //sextant v2-v3
+            else
+                Sextant = 1; //sextant v1-v2
+        } else {
+            //quadrant II
+            if (-one_by_sqrt3 * beta > alpha)
+                Sextant = 3; //sextant v3-v4
+            else
+                Sextant = 2; //sextant v2-v3
+        }
+    } else {
+        if (alpha >= 0.0f) {
+            //quadrant IV
+            if (-one_by_sqrt3 * beta > alpha)
+                Sextant = 5; //sextant v5-v6
+            else
+                Sextant = 6; //sextant v6-v1
+        } else {
+            //quadrant III
+            if (one_by_sqrt3 * beta > alpha)
+                Sextant = 4; //sextant v4-v5
+            else
+                Sextant = 5; //sextant v5-v6
+        }
+    }
+
+    switch (Sextant) {
+        // sextant v1-v2
+        case 1: {
+            // Vector on-times
+            float t1 = alpha - one_by_sqrt3 * beta;
+            float t2 = two_by_sqrt3 * beta;
+
+            // PWM timings
+            tA = (1.0f - t1 - t2) * 0.5f;
+            tB = tA + t1;
+            tC = tB + t2;
+        } break;
+
+        // sextant v2-v3
+        case 2: {
+            // Vector on-times
+            float t2 = alpha + one_by_sqrt3 * beta;
+            float t3 = -alpha + one_by_sqrt3 * beta;
+
+            // PWM timings
+            tB = (1.0f - t2 - t3) * 0.5f;
+            tA = tB + t3;
+            tC = tA + t2;
+        } break;
+
+        // sextant v3-v4
+        case 3: {
+            // Vector on-times
+            float t3 = two_by_sqrt3 * beta;
+            float t4 = -alpha - one_by_sqrt3 * beta;
+
+            // PWM timings
+            tB = (1.0f - t3 - t4) * 0.5f;
+            tC = tB + t3;
+            tA = tC + t4;
+        } break;
+
+        // sextant v4-v5
+        case 4: {
+            // Vector on-times
+            float t4 = -alpha + one_by_sqrt3 * beta;
+            float t5 = -two_by_sqrt3 * beta;
+
+            // PWM timings
+            tC = (1.0f - t4 - t5) * 0.5f;
+            tB = tC + t5;
+            tA = tB + t4;
+        } break;
+
+        // sextant v5-v6
+        case 5: {
+            // Vector on-times
+            float t5 = -alpha - one_by_sqrt3 * beta;
+            float t6 = alpha - one_by_sqrt3 * beta;
+
+            // PWM timings
+            tC = (1.0f - t5 - t6) * 0.5f;
+            tA = tC + t5;
+            tB = tA + t6;
+        } break;
+
+        // sextant v6-v1
+        case 6: {
+            // Vector on-times
+            float t6 = -two_by_sqrt3 * beta;
+            float t1 = alpha + one_by_sqrt3 * beta;
+
+            // PWM timings
+            tA = (1.0f - t6 - t1) * 0.5f;
+            tC = tA + t1;
+            tB = tC + t6;
+        } break;
+    }
+
+    bool result_valid =
+            tA >= 0.0f && tA <= 1.0f
+         && tB >= 0.0f && tB <= 1.0f
+         && tC >= 0.0f && tC <= 1.0f;
+    return {tA, tB, tC, result_valid};
+}
+
+// @brief Modulation magnitude of (alpha, beta) relative to the SVM hexagon.
+// Values up to 1 can be modulated, 1 lies exactly on the hexagon boundary.
+// This equals the spread between the largest and smallest PWM timing.
+inline float svm_hexagon_norm(float alpha, float beta) {
+    float uA = (2.0f / 3.0f) * alpha;
+    float uB = (-1.0f / 3.0f) * alpha + one_by_sqrt3 * beta;
+    float uC = (-1.0f / 3.0f) * alpha - one_by_sqrt3 * beta;
+    return std::max(uA, std::max(uB, uC)) - std::min(uA, std::min(uB, uC));
+}
+
+// @brief Space vector modulation by min/max zero-sequence injection.
+// Yields the same timings as SVM() but instead of locating the sextant, the
+// phase voltages are shifted such that their maximum and minimum are centered
+// in the PWM period. This only takes FPU min/max and add operations, so the
+// cycle count does not depend on the input.
+// @param timings: output PWM timings of phase A, B, C in [0, 1]
+// @returns true if all timings are within [0, 1]
+inline bool minmax_svm(float alpha, float beta, float timings[3]) {
+    // Phase voltages, scaled such that timing = 0.5 - (u - u_mid)
+    float uA = (2.0f / 3.0f) * alpha;
+    float uB = (-1.0f / 3.0f) * alpha + one_by_sqrt3 * beta;
+    float uC = (-1.0f / 3.0f) * alpha - one_by_sqrt3 * beta;
+
+    float u_max = std::max(uA, std::max(uB, uC));
+    float u_min = std::min(uA, std::min(uB, uC));
+    float offset = 0.5f + 0.5f * (u_max + u_min);
+
+    timings[0] = offset - uA;
+    timings[1] = offset - uB;
+    timings[2] = offset - uC;
+
+    // The smallest timing is 0.5 - (u_max - u_min) / 2, the largest is the
+    // complement of that, so one comparison covers all three phases.
+    return (u_max - u_min) <= 1.0f;
+}
+
+// @brief Replaces the least trustworthy of three measured phase currents by
+// the value implied by the other two (the phase currents sum to zero).
+// The low side shunts are sampled around the bottom of the PWM period, where
+// the low side of each phase conducts for a duration proportional to its
+// timing. The phase with the smallest timing has the shortest window for the
+// current sense amplifier to settle, so that is the one that gets replaced.
+// @param timings: PWM timings of phase A, B, C that were active while sampling
+// @returns the index of the reconstructed phase
+inline int reconstruct_phase_current(float I[3], const uint16_t timings[3]) {
+    int worst = (timings[0] <= timings[1] && timings[0] <= timings[2]) ? 0
+              : (timings[1] <= timings[2]) ? 1 : 2;
+    I[worst] = -(I[(worst + 1) % 3] + I[(worst + 2) % 3]);
+    return worst;
+}
+
 // Evaluate polynomials in an efficient way
 // coeffs[0] is highest order, as per numpy.polyfit
 // p(x) = coeffs[0] * x^deg + ... + coeffs[deg], for some degree "deg"
@@ -155,3 +374,15 @@ inline int mod(const int dividend, const int divisor){
     if (r < 0) r += divisor;
     return r;
 }
+
+// Same as mod for a positive divisor, without the division if the dividend
+// is at most one divisor outside of [0, divisor). The result is identical.
+inline int mod_fast(int dividend, const int divisor) {
+    if (dividend >= divisor)
+        dividend -= divisor;
+    else if (dividend < 0)
+        dividend += divisor;
+    if ((unsigned)dividend < (unsigned)divisor)
+        return dividend;
+    return mod(dividend, divisor);
+}
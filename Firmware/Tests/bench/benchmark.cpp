@@ -0,0 +1,150 @@
+// Host microbenchmarks of the hot path kernels that compile without the HAL.
+// Numbers from a desktop CPU only compare implementations relative to each
+// other, the absolute cost on the STM32 is reported by the firmware with
+// odrv.benchmark_kernel() (see MotorControl/benchmark.cpp).
+//
+// Built with CONFIG_BENCHMARK=true, or by hand from the Firmware directory:
+//   g++ -O3 -std=c++17 -I. -I./MotorControl -I./fibre/cpp/include Tests/bench/benchmark.cpp -o benchmark
+//   ./benchmark [filter]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "MotorControl/utils.hpp"
+#include "MotorControl/biquad.hpp"
+#include "MotorControl/mech_identifier.hpp"
+#include "MotorControl/scurve_traj.hpp"
+#include "MotorControl/traj_ticker.hpp"
+#include "communication/ascii_helpers.hpp"
+#include "fibre/crc.hpp"
+
+static constexpr size_t calls_per_run = 1 << 16;
+static constexpr size_t runs = 15;
+
+// Keeps the compiler from dropping the kernel calls
+static volatile float sink;
+
+// CANONICAL_CRC16_* of fibre/protocol.hpp, which doesn't build on the host
+static constexpr uint16_t crc16_polynomial = 0x3d65;
+static constexpr uint16_t crc16_init = 0x1337;
+
+static float angle(size_t i) {
+    return (float)(i % 1024) * (2.0f * (float)M_PI / 1024.0f) - (float)M_PI;
+}
+
+// @brief Runs the kernel calls_per_run times per run and prints the fastest
+// run in ns per call, which is the least disturbed by the OS.
+template<typename T>
+static void bench(const char* filter, const char* name, T&& kernel) {
+    if (filter && !strstr(name, filter))
+        return;
+    double best = INFINITY;
+    for (size_t run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls_per_run; ++i)
+            kernel(i);
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / calls_per_run);
+    }
+    printf("%-28s %8.2f ns\n", name, best);
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+
+    bench(filter, "minmax_svm", [](size_t i) {
+        float timings[3];
+        bool success = minmax_svm(0.5f * std::cos(angle(i)), 0.5f * std::sin(angle(i)), timings);
+        sink = success ? timings[0] + timings[1] + timings[2] : 0.0f;
+    });
+
+    bench(filter, "svm_hexagon_norm", [](size_t i) {
+        sink = svm_hexagon_norm(0.5f * std::cos(angle(i)), 0.5f * std::sin(angle(i)));
+    });
+
+    bench(filter, "rotate_by_small_angle", [](size_t i) {
+        float c = std::cos(angle(i));
+        float s = std::sin(angle(i));
+        rotate_by_small_angle(0.01f, &c, &s);
+        sink = c + s;
+    });
+
+    bench(filter, "std::sin + std::cos", [](size_t i) {
+        sink = std::sin(angle(i)) + std::cos(angle(i));
+    });
+
+    bench(filter, "wrap_pm_pi", [](size_t i) {
+        sink = wrap_pm_pi(4.0f * angle(i));
+    });
+
+    // The common case of the hot paths: at most one period outside the range
+    bench(filter, "wrap_pm_pi (single wrap)", [](size_t i) {
+        sink = wrap_pm_pi(1.5f * angle(i));
+    });
+
+    bench(filter, "wrap_pm_pi_fast", [](size_t i) {
+        sink = wrap_pm_pi_fast(1.5f * angle(i));
+    });
+
+    bench(filter, "mod", [](size_t i) {
+        sink = (float)mod((int)(i % 16384) - 8192, 8192);
+    });
+
+    bench(filter, "mod_fast", [](size_t i) {
+        sink = (float)mod_fast((int)(i % 16384) - 8192, 8192);
+    });
+
+    static uint8_t packet[64];
+    for (size_t i = 0; i < sizeof(packet); ++i)
+        packet[i] = (uint8_t)(i * 37);
+    bench(filter, "calc_crc16 (64 bytes)", [](size_t i) {
+        packet[0] = (uint8_t)i;
+        sink = calc_crc16<crc16_polynomial>(crc16_init, packet, sizeof(packet));
+    });
+
+    static Biquad notch;
+    notch.design_notch(200.0f, 2.0f, 8000.0f);
+    bench(filter, "Biquad::filter", [](size_t i) {
+        sink = notch.filter(std::sin(angle(i)));
+    });
+
+    static MechIdentifier ident;
+    bench(filter, "MechIdentifier::update", [](size_t i) {
+        ident.filter(0.1f * std::sin(angle(i)), std::cos(angle(i)), 0.01f);
+        ident.update(1e-3f, 0.9995f, 0.01f);
+        sink = ident.inertia();
+    });
+
+    static SCurveTrajectory scurve;
+    scurve.plan(10.0f, 0.0f, 0.0f, 2.0f, 0.5f, 0.5f, 5.0f);
+    bench(filter, "SCurveTrajectory::eval", [](size_t i) {
+        sink = scurve.eval((float)(i % 1024) * (scurve.Tf_ / 1024.0f)).Y;
+    });
+
+    static float T[TrajectoryTicker::max_phases];
+    static float J[TrajectoryTicker::max_phases];
+    static size_t num_phases = scurve.phases(T, J);
+    static TrajectoryTicker ticker;
+    bench(filter, "TrajectoryTicker::next", [](size_t i) {
+        if (ticker.done())
+            ticker.start(scurve, T, J, num_phases, scurve.Tf_, 1.0f / 8000.0f);
+        sink = ticker.next().Y;
+    });
+
+    bench(filter, "ascii_format_float", [](size_t i) {
+        char buffer[32];
+        sink = (float)ascii_format_float(buffer, 100.0f * std::sin(angle(i)));
+    });
+
+    bench(filter, "ascii_parse_float", [](size_t i) {
+        static const char* inputs[] = {"0.5", "-12.25", "3000.125", "1e-3"};
+        const char* str = inputs[i % 4];
+        float value = 0.0f;
+        ascii_parse_float(str, &value);
+        sink = value;
+    });
+
+    return 0;
+}
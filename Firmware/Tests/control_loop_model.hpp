@@ -0,0 +1,193 @@
+#ifndef __CONTROL_LOOP_MODEL_HPP
+#define __CONTROL_LOOP_MODEL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#include "MotorControl/utils.hpp"
+#include "MotorControl/biquad.hpp"
+#include "MotorControl/control_law.hpp"
+#include "MotorControl/current_loop_tuning.hpp"
+
+// Host models of the control cascade for the simulation and golden trace
+// tests. They wire up the same kernels as Motor::FOC_current(),
+// Encoder::update() and Controller::update() (control_law.hpp,
+// current_pi_integrate(), minmax_svm(), Biquad), without the parts that need
+// the hardware or the other firmware objects: error checks, feedforward
+// terms, injections and the optional estimator and controller modes.
+
+// Motor::FOC_current() without the error checks, the feedforward terms and
+// the high frequency injection
+struct FocCurrentModel {
+    struct Output_t {
+        float Id, Iq;      // [A]
+        float Vd, Vq;      // [V] controller output before the modulation limit
+        float mod_alpha, mod_beta;
+        float Ibus;        // [A]
+        float timings[3];  // SVM timings as written to the timer compare registers
+        bool valid;
+    };
+
+    FocCurrentModel(float p_gain, float i_gain, float dt) : p_gain(p_gain), i_gain(i_gain), dt(dt) {}
+
+    Output_t update(const float I[3], float vbus_voltage, float Id_des, float Iq_des, float I_phase, float pwm_phase) {
+        Output_t out;
+
+        // Clarke and Park transform
+        float Ialpha = I[0];
+        float Ibeta = one_by_sqrt3 * (I[1] - I[2]);
+        float c_I = std::cos(I_phase);
+        float s_I = std::sin(I_phase);
+        out.Id = c_I * Ialpha + s_I * Ibeta;
+        out.Iq = c_I * Ibeta - s_I * Ialpha;
+
+        float Ierr_d = Id_des - out.Id;
+        float Ierr_q = Iq_des - out.Iq;
+        out.Vd = v_integral_d + Ierr_d * p_gain;
+        out.Vq = v_integral_q + Ierr_q * p_gain;
+
+        float V_to_mod = 1.0f / ((2.0f / 3.0f) * vbus_voltage);
+        auto sincos = [](float x, float* s, float* c) {
+            *s = std::sin(x);
+            *c = std::cos(x);
+        };
+        FocModulation_t mod = foc_modulation(V_to_mod * out.Vd, V_to_mod * out.Vq, c_I, s_I, I_phase, pwm_phase,
+                max_modulation, overmodulation_enable, small_angle_pwm_phase_enable, sincos);
+        out.mod_alpha = mod.mod_alpha;
+        out.mod_beta = mod.mod_beta;
+
+        if (mod.saturated) {
+            v_integral_d *= integrator_decay;
+            v_integral_q *= integrator_decay;
+        } else {
+            current_pi_integrate(&v_integral_d, &v_integral_q, Ierr_d, Ierr_q, p_gain, i_gain, 0.0f, dt);
+        }
+
+        out.Ibus = mod.mod_d * out.Id + mod.mod_q * out.Iq;
+        out.valid = minmax_svm(out.mod_alpha, out.mod_beta, out.timings);
+        return out;
+    }
+
+    float p_gain;
+    float i_gain;
+    float dt;
+    float max_modulation = 0.8f;
+    bool overmodulation_enable = false;
+    bool small_angle_pwm_phase_enable = true;
+    float integrator_decay = 0.99f;
+    float v_integral_d = 0.0f; // [V]
+    float v_integral_q = 0.0f; // [V]
+};
+
+// Encoder::update() for an incremental encoder with the PLL velocity
+// estimator, without the error compensation
+struct EncoderPllModel {
+    EncoderPllModel(int32_t cpr, float bandwidth, float dt) : cpr(cpr), dt(dt) {
+        pll_kp = 2.0f * bandwidth;
+        pll_ki = 0.25f * pll_kp * pll_kp;
+    }
+
+    // @param count: The free running 32 bit count of the encoder timer
+    void update(int32_t count) {
+        int32_t delta_enc = (int32_t)((uint32_t)count - (uint32_t)shadow_count);
+        shadow_count = count;
+        count_in_cpr = mod(count_in_cpr + delta_enc, cpr);
+
+        // PLL in counts, the linear estimate split into turns and the
+        // position within the turn
+        pos_estimate_counts += dt * vel_estimate_counts;
+        pos_cpr_counts += dt * vel_estimate_counts;
+        float delta_pos_counts = pll_linear_phase_error(shadow_count, pos_estimate_turns, pos_estimate_counts, cpr);
+        float delta_pos_cpr_counts = (float)(count_in_cpr - (int32_t)std::floor(pos_cpr_counts));
+        delta_pos_cpr_counts = wrap_pm_fast(delta_pos_cpr_counts, (float)cpr);
+        pos_estimate_counts += dt * pll_kp * delta_pos_counts;
+        pll_wrap_turns(&pos_estimate_turns, &pos_estimate_counts, cpr, 1.0f / (float)cpr);
+        pos_cpr_counts += dt * pll_kp * delta_pos_cpr_counts;
+        pos_cpr_counts = fmodf_pos_fast(pos_cpr_counts, (float)cpr);
+        vel_estimate_counts += dt * pll_ki * delta_pos_cpr_counts;
+        bool snap_to_zero_vel = false;
+        if (std::abs(vel_estimate_counts) < 0.5f * dt * pll_ki) {
+            vel_estimate_counts = 0.0f;
+            snap_to_zero_vel = true;
+        }
+
+        // Interpolation between the counts for the commutation
+        if (snap_to_zero_vel) {
+            interpolation = 0.5f;
+        } else if (delta_enc > 0) {
+            interpolation = 0.0f;
+        } else if (delta_enc < 0) {
+            interpolation = 1.0f;
+        } else {
+            interpolation += dt * vel_estimate_counts;
+            interpolation = std::clamp(interpolation, 0.0f, 1.0f);
+        }
+    }
+
+    float pos_estimate() const { return (float)pos_estimate_turns + pos_estimate_counts / (float)cpr; } // [turn]
+    float vel_estimate() const { return vel_estimate_counts / (float)cpr; } // [turn/s]
+    float interpolated_pos_cpr() const { return ((float)count_in_cpr + interpolation) / (float)cpr; } // [turn]
+
+    int32_t cpr;
+    float dt;
+    float pll_kp;
+    float pll_ki;
+    int32_t shadow_count = 0;
+    int32_t count_in_cpr = 0;
+    int32_t pos_estimate_turns = 0;
+    float pos_estimate_counts = 0.0f;
+    float pos_cpr_counts = 0.0f;
+    float vel_estimate_counts = 0.0f;
+    float interpolation = 0.5f;
+};
+
+// Controller::update() in position or velocity control with passthrough
+// input, without anticogging and the ACIM gain scheduling
+struct ControllerModel {
+    explicit ControllerModel(float dt) : dt(dt) {}
+
+    // @returns the torque setpoint [Nm]
+    float update(float pos_setpoint, float vel_setpoint, float torque_setpoint, float pos_estimate, float vel_estimate) {
+        float gain_scheduling_multiplier = 1.0f;
+        float vel_des = vel_setpoint;
+        if (position_control) {
+            float pos_err = pos_setpoint - pos_estimate;
+            vel_des += pos_gain * pos_err;
+            if (enable_gain_scheduling)
+                gain_scheduling_multiplier = pos_error_gain_schedule(pos_err, gain_scheduling_width);
+        }
+        vel_des = std::clamp(vel_des, -vel_limit, vel_limit);
+
+        float v_err = vel_des - vel_estimate;
+        float torque = torque_setpoint;
+        torque += (vel_gain * gain_scheduling_multiplier) * v_err;
+        torque += vel_integrator_torque;
+        torque += friction_feedforward(friction_coulomb, friction_viscous, friction_vel_band, vel_setpoint);
+
+        torque = torque_lpf.filter(torque_notch1.filter(torque));
+
+        bool limited = limit_torque(&torque, torque_lim, torque_lim);
+        float integrator_step = ((vel_integrator_gain * gain_scheduling_multiplier) * dt) * v_err;
+        vel_integrator_decay_update(&vel_integrator_torque, integrator_step, limited, 0.99f);
+        return torque;
+    }
+
+    float dt;
+    bool position_control = false;
+    float pos_gain = 20.0f; // [(turn/s) / turn]
+    float vel_gain = 1.0f / 6.0f; // [Nm/(turn/s)]
+    float vel_integrator_gain = 2.0f / 6.0f; // [Nm/(turn/s * s)]
+    float vel_limit = 2.0f; // [turn/s]
+    float torque_lim = 1.0f; // [Nm]
+    bool enable_gain_scheduling = false;
+    float gain_scheduling_width = 10.0f;
+    float friction_coulomb = 0.0f; // [Nm]
+    float friction_viscous = 0.0f; // [Nm/(turn/s)]
+    float friction_vel_band = 0.1f; // [turn/s]
+    Biquad torque_notch1;
+    Biquad torque_lpf;
+    float vel_integrator_torque = 0.0f; // [Nm]
+};
+
+#endif // __CONTROL_LOOP_MODEL_HPP
@@ -0,0 +1,137 @@
+#ifndef __GOLDEN_TRACE_HPP
+#define __GOLDEN_TRACE_HPP
+
+#include <doctest.h>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Records named channels of a test run and compares them against a stored
+// reference trace in Tests/golden/<name>.csv, so that optimizations of the
+// control path can be shown to leave its outputs unchanged.
+//
+// The path is relative to the Firmware directory, which is the working
+// directory of the test runner. Run the tests with GOLDEN_TRACE_UPDATE=1 to
+// (re)write the reference traces instead of checking them, and review the
+// diff of the CSV files like any other change.
+class GoldenTrace {
+public:
+    explicit GoldenTrace(std::vector<std::string> channels) : channels_(std::move(channels)) {}
+
+    void record(std::initializer_list<float> values) {
+        REQUIRE(values.size() == channels_.size());
+        rows_.emplace_back(values);
+    }
+
+    // @brief Sets the tolerance of a channel, the default is 0. It is
+    // absolute for values up to 1 and relative above, so that the rounding
+    // differences between compilers and FPUs fit in.
+    GoldenTrace& tolerance(const std::string& channel, float tol) {
+        tolerances_[channel] = tol;
+        return *this;
+    }
+
+    void check(const std::string& name) const {
+        std::string path = "Tests/golden/" + name + ".csv";
+        const char* update = std::getenv("GOLDEN_TRACE_UPDATE");
+        if (update && *update && std::string(update) != "0") {
+            write(path);
+            MESSAGE("updated " << path);
+        } else {
+            compare(name);
+        }
+    }
+
+    // @brief Checks the trace against the reference, never updates it
+    void compare(const std::string& name) const {
+        for (const Mismatch_t& m : mismatches(name)) {
+            INFO("channel " << m.channel << ": max error " << m.max_error << ", tolerance " << m.tolerance);
+            INFO("first at row " << m.row << ": " << m.value << " vs golden " << m.golden);
+            CHECK(m.row == SIZE_MAX);
+        }
+    }
+
+    struct Mismatch_t {
+        std::string channel;
+        float tolerance;
+        float max_error;
+        size_t row; // the first one out of tolerance, SIZE_MAX if none
+        float value;
+        float golden;
+    };
+
+    // @brief Compares all channels against the reference trace
+    std::vector<Mismatch_t> mismatches(const std::string& name) const {
+        std::string path = "Tests/golden/" + name + ".csv";
+        std::ifstream file(path);
+        INFO("golden trace " << path << " (run with GOLDEN_TRACE_UPDATE=1 to create it)");
+        REQUIRE(file.good());
+        std::string line;
+        std::getline(file, line);
+        REQUIRE(line == header());
+
+        std::vector<std::vector<float>> golden;
+        while (std::getline(file, line)) {
+            std::vector<float> row;
+            std::stringstream ss(line);
+            std::string cell;
+            while (std::getline(ss, cell, ','))
+                row.push_back(std::strtof(cell.c_str(), nullptr));
+            REQUIRE(row.size() == channels_.size());
+            golden.push_back(row);
+        }
+        REQUIRE(golden.size() == rows_.size());
+
+        std::vector<Mismatch_t> result;
+        for (size_t c = 0; c < channels_.size(); ++c) {
+            auto it = tolerances_.find(channels_[c]);
+            Mismatch_t m = {channels_[c], it == tolerances_.end() ? 0.0f : it->second, 0.0f, SIZE_MAX, 0.0f, 0.0f};
+            for (size_t r = 0; r < rows_.size(); ++r) {
+                float err = std::abs(rows_[r][c] - golden[r][c]);
+                bool bad = !(err <= m.tolerance * std::max(1.0f, std::abs(golden[r][c]))) && !(std::isnan(rows_[r][c]) && std::isnan(golden[r][c]));
+                if (bad && m.row == SIZE_MAX) {
+                    m.row = r;
+                    m.value = rows_[r][c];
+                    m.golden = golden[r][c];
+                }
+                m.max_error = std::max(m.max_error, err);
+            }
+            if (m.row != SIZE_MAX)
+                result.push_back(m);
+        }
+        return result;
+    }
+
+private:
+    std::string header() const {
+        std::string result;
+        for (size_t c = 0; c < channels_.size(); ++c)
+            result += (c ? "," : "") + channels_[c];
+        return result;
+    }
+
+    void write(const std::string& path) const {
+        FILE* file = std::fopen(path.c_str(), "w");
+        REQUIRE(file);
+        std::fprintf(file, "%s\n", header().c_str());
+        for (const std::vector<float>& row : rows_) {
+            for (size_t c = 0; c < row.size(); ++c)
+                std::fprintf(file, c ? ",%.9g" : "%.9g", row[c]); // round trips a float exactly
+            std::fprintf(file, "\n");
+        }
+        std::fclose(file);
+    }
+
+    std::vector<std::string> channels_;
+    std::vector<std::vector<float>> rows_;
+    std::map<std::string, float> tolerances_;
+};
+
+#endif // __GOLDEN_TRACE_HPP
@@ -0,0 +1,112 @@
+#ifndef __PMSM_PLANT_HPP
+#define __PMSM_PLANT_HPP
+
+#include <cmath>
+
+// Averaged model of a surface mount PMSM on a three phase inverter and its
+// mechanical load, for running the control loop models of
+// control_loop_model.hpp against in simulated time.
+//
+// The inverter applies the phase duty cycles for a whole PWM period, the
+// electrical and mechanical state is integrated in substeps within it.
+// Positions are in turns and velocities in turn/s like in the firmware,
+// torques in Nm.
+class PmsmPlant {
+public:
+    struct Params_t {
+        float phase_resistance = 0.05f; // [Ohm]
+        float phase_inductance = 20e-6f; // [H]
+        float torque_constant = 0.04f; // [Nm/A]
+        int pole_pairs = 7;
+        float vbus_voltage = 24.0f; // [V]
+        float inertia = 1e-4f; // [kg m^2]
+        float viscous_friction = 1e-5f; // [Nm/(rad/s)]
+        float coulomb_friction = 0.0f; // [Nm]
+        float coulomb_band = 0.1f; // [rad/s] the friction ramps up over this speed
+    };
+
+    explicit PmsmPlant(const Params_t& params) : params_(params) {}
+
+    // Applies the duty cycles (0..1) of the three phases for dt seconds
+    void step(const float duty[3], float dt, int substeps = 8) {
+        const float sqrt3 = 1.7320508f;
+        float mean = (duty[0] + duty[1] + duty[2]) / 3.0f;
+        float va = (duty[0] - mean) * params_.vbus_voltage;
+        float vb = (duty[1] - mean) * params_.vbus_voltage;
+        float vc = (duty[2] - mean) * params_.vbus_voltage;
+        float v_alpha = (2.0f / 3.0f) * (va - 0.5f * vb - 0.5f * vc);
+        float v_beta = (vb - vc) / sqrt3;
+
+        float flux = params_.torque_constant / (1.5f * params_.pole_pairs); // [Wb]
+        float h = dt / substeps;
+        for (int i = 0; i < substeps; ++i) {
+            float theta_e = params_.pole_pairs * theta_;
+            float c = std::cos(theta_e);
+            float s = std::sin(theta_e);
+            float vd = c * v_alpha + s * v_beta;
+            float vq = c * v_beta - s * v_alpha;
+            float omega_e = params_.pole_pairs * omega_;
+
+            float L = params_.phase_inductance;
+            float R = params_.phase_resistance;
+            float did = (vd - R * id_ + omega_e * L * iq_) / L;
+            float diq = (vq - R * iq_ - omega_e * L * id_ - omega_e * flux) / L;
+            id_ += did * h;
+            iq_ += diq * h;
+
+            float friction = params_.viscous_friction * omega_
+                    + params_.coulomb_friction * std::fmax(-1.0f, std::fmin(1.0f, omega_ / params_.coulomb_band));
+            omega_ += (torque() - friction - load_torque_) / params_.inertia * h;
+            theta_ += omega_ * h;
+        }
+    }
+
+    // Lets the rotor spin freely for dt seconds with the inverter off. Below
+    // the bus voltage the back EMF doesn't drive any current through the
+    // body diodes, so the currents are taken to be zero.
+    void coast(float dt, int substeps = 8) {
+        id_ = 0.0f;
+        iq_ = 0.0f;
+        float h = dt / substeps;
+        for (int i = 0; i < substeps; ++i) {
+            float friction = params_.viscous_friction * omega_
+                    + params_.coulomb_friction * std::fmax(-1.0f, std::fmin(1.0f, omega_ / params_.coulomb_band));
+            omega_ += (-friction - load_torque_) / params_.inertia * h;
+            theta_ += omega_ * h;
+        }
+    }
+
+    // Phase currents as seen by the current sensors
+    void phase_currents(float I[3]) const {
+        const float sqrt3_by_2 = 0.8660254f;
+        float theta_e = params_.pole_pairs * theta_;
+        float c = std::cos(theta_e);
+        float s = std::sin(theta_e);
+        float i_alpha = c * id_ - s * iq_;
+        float i_beta = s * id_ + c * iq_;
+        I[0] = i_alpha;
+        I[1] = -0.5f * i_alpha + sqrt3_by_2 * i_beta;
+        I[2] = -0.5f * i_alpha - sqrt3_by_2 * i_beta;
+    }
+
+    float torque() const { return params_.torque_constant * iq_; }
+    float pos() const { return theta_ / (2.0f * (float)M_PI); } // [turn]
+    float vel() const { return omega_ / (2.0f * (float)M_PI); } // [turn/s]
+    float electrical_phase() const { return std::remainder(params_.pole_pairs * theta_, 2.0f * (float)M_PI); } // [rad]
+    float id() const { return id_; }
+    float iq() const { return iq_; }
+
+    void set_load_torque(float torque) { load_torque_ = torque; }
+
+    const Params_t& params() const { return params_; }
+
+private:
+    Params_t params_;
+    float id_ = 0.0f; // [A]
+    float iq_ = 0.0f; // [A]
+    float omega_ = 0.0f; // [rad/s] mechanical
+    float theta_ = 0.0f; // [rad] mechanical
+    float load_torque_ = 0.0f; // [Nm]
+};
+
+#endif // __PMSM_PLANT_HPP
@@ -0,0 +1,216 @@
+// Networked simulator of an ODrive with two axes, for developing and testing
+// host software without hardware. The native protocol is served over TCP by
+// the firmware's own fibre stack (fibre/cpp/protocol.cpp, posix_tcp.cpp), so
+// odrivetool, the GUI and scripts connect to it like to a board:
+//
+//   odrivetool --path tcp:localhost:9910
+//
+// The axes run the control cascade of Tests/control_loop_model.hpp against
+// Tests/pmsm_plant.hpp at 8 kHz, real time or faster, see sim_board.hpp.
+// Motors and encoders start out calibrated, the calibration states finish
+// right away.
+//
+// The interface is the subset of odrive-interface.yaml listed in
+// sim_endpoints.yaml. sim_endpoints_generator.py generates its JSON and
+// endpoint table from the definitions into autogen/sim_endpoints.hpp, so the
+// names, types and access modes are those of the firmware. The firmware's own
+// endpoints need the whole firmware object tree, which doesn't build on the
+// host.
+//
+// With --can, the simulator also speaks a subset of the CANSimple protocol
+// (see docs/can-protocol.md, sim_can.hpp) on a SocketCAN interface. Simulators on the same
+// virtual CAN interface form one bus with each other and with the host:
+//
+//   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+//   ./odrive_sim --port 9910 --can vcan0 --node-ids 0,1 &
+//   ./odrive_sim --port 9911 --can vcan0 --node-ids 2,3 --serial-number 2 &
+//
+// Built with CONFIG_SIMULATOR=true, or by hand from the Firmware directory:
+//   python3 Tests/sim/sim_endpoints_generator.py --definitions odrive-interface.yaml --bindings Tests/sim/sim_endpoints.yaml --output autogen/sim_endpoints.hpp
+//   g++ -O2 -std=c++17 -I. -I./MotorControl -I./fibre/cpp/include Tests/sim/odrive_sim.cpp fibre/cpp/protocol.cpp fibre/cpp/posix_tcp.cpp -lpthread -o odrive_sim
+//   ./odrive_sim [--port 9910] [--can vcan0] [--node-ids 0,1] [--serial-number 1] [--speed 1]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <fibre/protocol.hpp>
+#include <fibre/posix_tcp.hpp>
+
+#include "Tests/sim/sim_board.hpp"
+#include "Tests/sim/sim_can.hpp"
+
+using namespace odrive_sim;
+
+static SimBoard board;
+
+/* Fibre endpoints -----------------------------------------------------------*/
+
+namespace fibre {
+
+// Entry of the generated endpoint table, the handler of endpoint 0 (the JSON)
+// is nullptr
+struct Endpoint {
+    bool (*handler)(const Endpoint& endpoint, cbufptr_t* input_buffer, bufptr_t* output_buffer);
+    void* property;
+    bool writable;
+    void (*function)();
+};
+
+template<typename T>
+static std::optional<T> decode(cbufptr_t* buffer) { return read_le<T>(buffer); }
+
+template<>
+std::optional<float> decode<float>(cbufptr_t* buffer) {
+    std::optional<uint32_t> bits = read_le<uint32_t>(buffer);
+    if (!bits.has_value())
+        return std::nullopt;
+    float value;
+    memcpy(&value, &bits.value(), sizeof(value));
+    return value;
+}
+
+template<typename T>
+static bool encode(T value, bufptr_t* buffer) { return write_le<T>(value, buffer); }
+
+template<>
+bool encode<float>(float value, bufptr_t* buffer) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return write_le<uint32_t>(bits, buffer);
+}
+
+// @brief Writes the property if the input holds a value and returns the old
+// value if a response is expected, like the exchange stubs of the firmware
+template<typename T>
+static bool exchange(const Endpoint& endpoint, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    T* property = reinterpret_cast<T*>(endpoint.property);
+    T old_value = *property;
+    if (input_buffer->size()) {
+        std::optional<T> value = decode<T>(input_buffer);
+        if (!value.has_value() || !endpoint.writable)
+            return false;
+        *property = value.value();
+    }
+    return !output_buffer->size() || encode<T>(old_value, output_buffer);
+}
+
+static bool call(const Endpoint& endpoint, cbufptr_t*, bufptr_t*) {
+    endpoint.function();
+    return true;
+}
+
+static constexpr Endpoint json_endpoint() { return {nullptr, nullptr, false, nullptr}; }
+
+// The type is the one of the generated JSON, so the member must match it
+template<typename T>
+static constexpr Endpoint property_endpoint(T* property, bool writable) { return {&exchange<T>, property, writable, nullptr}; }
+
+static constexpr Endpoint function_endpoint(void (*function)()) { return {&call, nullptr, false, function}; }
+
+#include "autogen/sim_endpoints.hpp"
+
+const uint16_t json_crc_ = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(PROTOCOL_VERSION, embedded_json, embedded_json_length);
+const uint32_t json_version_id_ = (json_crc_ << 16) | calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(json_crc_, embedded_json, embedded_json_length);
+
+static constexpr size_t endpoint_table_length = sizeof(endpoint_table) / sizeof(endpoint_table[0]);
+
+bool endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    if (idx < 0 || (size_t)idx >= endpoint_table_length)
+        return false;
+    const Endpoint& endpoint = endpoint_table[idx];
+    if (!endpoint.handler)
+        return endpoint0_handler(input_buffer, output_buffer);
+
+    RequestLock lock(board);
+    return endpoint.handler(endpoint, input_buffer, output_buffer);
+}
+
+}
+
+/* CAN -----------------------------------------------------------------------*/
+
+static SimCanBus can_bus(board);
+
+/* Main ----------------------------------------------------------------------*/
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [--port 9910] [--can INTERFACE] [--node-ids 0,1] [--serial-number 1] [--speed 1]\n"
+                    "  --speed: simulated time per real time, 0 to run as fast as possible\n", name);
+}
+
+int main(int argc, char** argv) {
+    unsigned int port = 9910;
+    const char* can_interface = nullptr;
+    double speed = 1.0;
+    board.axes[1].node_id = 1; // the defaults of the firmware
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+        ++i;
+        if (!strcmp(arg, "--port")) {
+            port = strtoul(value, nullptr, 0);
+        } else if (!strcmp(arg, "--can")) {
+            can_interface = value;
+        } else if (!strcmp(arg, "--node-ids")) {
+            char* end;
+            board.axes[0].node_id = strtoul(value, &end, 0);
+            board.axes[1].node_id = *end == ',' ? strtoul(end + 1, nullptr, 0) : board.axes[0].node_id + 1;
+        } else if (!strcmp(arg, "--serial-number")) {
+            board.serial_number = strtoull(value, nullptr, 0);
+        } else if (!strcmp(arg, "--speed")) {
+            speed = strtod(value, nullptr);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (can_interface) {
+        if (!can_bus.open(can_interface)) {
+            fprintf(stderr, "failed to open CAN interface %s: %s\n", can_interface, strerror(errno));
+            return 1;
+        }
+        std::thread(&SimCanBus::run_receiver, &can_bus).detach();
+    }
+
+    std::thread([port] {
+        serve_on_tcp(port);
+        fprintf(stderr, "failed to serve on TCP port %u: %s\n", port, strerror(errno));
+        exit(1);
+    }).detach();
+    printf("simulating ODrive %012llX on TCP port %u\n", (unsigned long long)board.serial_number, port);
+    fflush(stdout);
+
+    // One millisecond of simulated time per iteration
+    auto next = std::chrono::steady_clock::now();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(board.mutex);
+            for (int i = 0; i < current_meas_hz / 1000; ++i) {
+                float ibus = 0.0f;
+                for (SimAxis& axis : board.axes) {
+                    axis.update();
+                    ibus += axis.current_state == AXIS_STATE_CLOSED_LOOP_CONTROL ? axis.ibus : 0.0f;
+                }
+                board.ibus = ibus;
+            }
+            ++board.time_ms;
+            for (SimAxis& axis : board.axes)
+                can_bus.send_cyclic(axis, board.time_ms);
+        }
+        if (speed > 0.0) {
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1e-3 / speed));
+            std::this_thread::sleep_until(next);
+        }
+        while (board.waiting_requests)
+            std::this_thread::yield();
+    }
+}
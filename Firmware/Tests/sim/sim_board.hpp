@@ -0,0 +1,195 @@
+#ifndef __SIM_BOARD_HPP
+#define __SIM_BOARD_HPP
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <stdint.h>
+
+#include "Tests/control_loop_model.hpp"
+#include "Tests/pmsm_plant.hpp"
+
+// The simulated board of odrive_sim.cpp: two axes that run the control loop
+// models against PmsmPlant, and the values the protocols serve.
+
+namespace odrive_sim {
+
+static constexpr float current_meas_period = 1.0f / 8000.0f; // [s]
+static constexpr int current_meas_hz = 8000;
+
+// Values of tools/odrive/enums.py
+enum : int32_t {
+    AXIS_STATE_UNDEFINED = 0,
+    AXIS_STATE_IDLE = 1,
+    AXIS_STATE_FULL_CALIBRATION_SEQUENCE = 3,
+    AXIS_STATE_MOTOR_CALIBRATION = 4,
+    AXIS_STATE_ENCODER_INDEX_SEARCH = 6,
+    AXIS_STATE_ENCODER_OFFSET_CALIBRATION = 7,
+    AXIS_STATE_CLOSED_LOOP_CONTROL = 8,
+    AXIS_STATE_ENCODER_DIR_FIND = 10,
+};
+
+enum : int32_t {
+    CONTROL_MODE_TORQUE_CONTROL = 1,
+    CONTROL_MODE_VELOCITY_CONTROL = 2,
+    CONTROL_MODE_POSITION_CONTROL = 3,
+};
+
+enum : int32_t {
+    AXIS_ERROR_INVALID_STATE = 0x00000001,
+    AXIS_ERROR_MOTOR_FAILED = 0x00000040,
+    AXIS_ERROR_ESTOP_REQUESTED = 0x00004000,
+};
+
+struct SimAxis {
+    explicit SimAxis(const PmsmPlant::Params_t& params)
+            : plant(params),
+              foc(current_control_bandwidth * params.phase_inductance,
+                  current_control_bandwidth * params.phase_resistance, current_meas_period),
+              encoder(8192, 1000.0f, current_meas_period),
+              controller(current_meas_period),
+              torque_constant(params.torque_constant) {
+        controller.vel_gain = 0.02f;
+        controller.vel_integrator_gain = 0.2f;
+        controller.vel_limit = 20.0f;
+    }
+
+    // @brief Runs one current control period, like Axis::control_loop_cb()
+    void update() {
+        encoder.update((int32_t)std::floor(plant.pos() * (float)encoder.cpr));
+        pos_estimate = encoder.pos_estimate();
+        vel_estimate = encoder.vel_estimate();
+
+        if (requested_state != AXIS_STATE_UNDEFINED) {
+            enter_state(requested_state);
+            requested_state = AXIS_STATE_UNDEFINED;
+        }
+
+        if (current_state != AXIS_STATE_CLOSED_LOOP_CONTROL) {
+            plant.coast(current_meas_period);
+            Id_measured = Iq_measured = Iq_setpoint = 0.0f;
+            return;
+        }
+
+        controller.torque_lim = current_lim * torque_constant;
+        controller.position_control = control_mode == CONTROL_MODE_POSITION_CONTROL;
+        float torque;
+        if (control_mode == CONTROL_MODE_TORQUE_CONTROL) {
+            torque = std::clamp(input_torque, -controller.torque_lim, controller.torque_lim);
+        } else {
+            torque = controller.update(input_pos, input_vel, input_torque, pos_estimate, vel_estimate);
+        }
+        Iq_setpoint = torque / torque_constant;
+
+        float I[3];
+        plant.phase_currents(I);
+        float phase = plant.electrical_phase();
+        float phase_vel = 2.0f * (float)M_PI * plant.params().pole_pairs * vel_estimate;
+        FocCurrentModel::Output_t out = foc.update(I, plant.params().vbus_voltage, 0.0f, Iq_setpoint,
+                                                   phase, phase + 1.5f * current_meas_period * phase_vel);
+        Id_measured = out.Id;
+        Iq_measured = out.Iq;
+        ibus = out.Ibus;
+        if (!out.valid) {
+            error |= AXIS_ERROR_MOTOR_FAILED;
+            current_state = AXIS_STATE_IDLE;
+            return;
+        }
+        float duty[3] = {1.0f - out.timings[0], 1.0f - out.timings[1], 1.0f - out.timings[2]};
+        plant.step(duty, current_meas_period);
+    }
+
+    void enter_state(int32_t state) {
+        switch (state) {
+            case AXIS_STATE_IDLE:
+                current_state = AXIS_STATE_IDLE;
+                break;
+            case AXIS_STATE_CLOSED_LOOP_CONTROL:
+                if (error)
+                    break;
+                foc.v_integral_d = foc.v_integral_q = 0.0f;
+                controller.vel_integrator_torque = 0.0f;
+                input_pos = pos_estimate;
+                current_state = AXIS_STATE_CLOSED_LOOP_CONTROL;
+                break;
+            case AXIS_STATE_FULL_CALIBRATION_SEQUENCE:
+            case AXIS_STATE_MOTOR_CALIBRATION:
+            case AXIS_STATE_ENCODER_INDEX_SEARCH:
+            case AXIS_STATE_ENCODER_OFFSET_CALIBRATION:
+            case AXIS_STATE_ENCODER_DIR_FIND:
+                current_state = AXIS_STATE_IDLE; // already calibrated
+                break;
+            default:
+                error |= AXIS_ERROR_INVALID_STATE;
+                current_state = AXIS_STATE_IDLE;
+                break;
+        }
+    }
+
+    void clear_errors() { error = 0; }
+
+    PmsmPlant plant;
+    float current_control_bandwidth = 1000.0f; // [rad/s]
+    FocCurrentModel foc;
+    EncoderPllModel encoder;
+    ControllerModel controller;
+    float ibus = 0.0f; // [A]
+
+    // Properties, see sim_endpoints.yaml
+    int32_t error = 0;
+    int32_t current_state = AXIS_STATE_IDLE;
+    int32_t requested_state = AXIS_STATE_UNDEFINED;
+    uint32_t node_id = 0;
+    uint32_t heartbeat_rate_ms = 100;
+    uint32_t encoder_rate_ms = 10;
+    bool is_calibrated = true;
+    float Id_measured = 0.0f; // [A]
+    float Iq_measured = 0.0f; // [A]
+    float Iq_setpoint = 0.0f; // [A]
+    float current_lim = 10.0f; // [A]
+    float torque_constant; // [Nm/A]
+    float pos_estimate = 0.0f; // [turn]
+    float vel_estimate = 0.0f; // [turn/s]
+    float input_pos = 0.0f; // [turn]
+    float input_vel = 0.0f; // [turn/s]
+    float input_torque = 0.0f; // [Nm]
+    int32_t control_mode = CONTROL_MODE_VELOCITY_CONTROL;
+
+    uint32_t last_heartbeat = 0; // [ms] simulated time
+    uint32_t last_encoder = 0; // [ms] simulated time
+};
+
+struct SimBoard {
+    SimAxis axes[2] = {SimAxis(PmsmPlant::Params_t{}), SimAxis(PmsmPlant::Params_t{})};
+    float vbus_voltage = PmsmPlant::Params_t{}.vbus_voltage; // [V]
+    float ibus = 0.0f; // [A]
+    uint64_t serial_number = 1;
+    uint8_t hw_version[3] = {3, 6, 56};
+    uint8_t fw_version[4] = {0, 5, 1, 1};
+    uint32_t time_ms = 0; // simulated time
+
+    // Taken by the fibre and CAN threads for every request and by the
+    // simulation for every millisecond of simulated time. The simulation
+    // waits for the requests that are waiting when it releases the lock, so
+    // that they get through while it runs as fast as possible.
+    std::mutex mutex;
+    std::atomic<int> waiting_requests{0};
+};
+
+// Lock of a request on the board
+class RequestLock {
+public:
+    explicit RequestLock(SimBoard& board) : board_(board) {
+        ++board_.waiting_requests;
+        board_.mutex.lock();
+        --board_.waiting_requests;
+    }
+    ~RequestLock() { board_.mutex.unlock(); }
+
+private:
+    SimBoard& board_;
+};
+
+}
+
+#endif // __SIM_BOARD_HPP
@@ -0,0 +1,203 @@
+#ifndef __SIM_CAN_HPP
+#define __SIM_CAN_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+#include <linux/can.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "communication/can_helpers.hpp"
+#include "Tests/sim/sim_board.hpp"
+
+namespace odrive_sim {
+
+// The CANSimple messages the simulator handles, see communication/can_simple.hpp
+enum : uint32_t {
+    MSG_ODRIVE_HEARTBEAT = 0x001,
+    MSG_ODRIVE_ESTOP = 0x002,
+    MSG_SET_AXIS_REQUESTED_STATE = 0x007,
+    MSG_GET_ENCODER_ESTIMATES = 0x009,
+    MSG_SET_CONTROLLER_MODES = 0x00B,
+    MSG_SET_INPUT_POS = 0x00C,
+    MSG_SET_INPUT_VEL = 0x00D,
+    MSG_SET_INPUT_TORQUE = 0x00E,
+    MSG_SET_VEL_LIMIT = 0x00F,
+    MSG_GET_IQ = 0x014,
+    MSG_GET_VBUS_VOLTAGE = 0x017,
+    MSG_CLEAR_ERRORS = 0x018,
+};
+
+static constexpr uint8_t NUM_CMD_ID_BITS = 5;
+
+// @brief Opens a raw CAN socket on the interface, e.g. vcan0
+// @returns the socket, or -1 on failure
+inline int open_can_socket(const char* interface) {
+    int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (s < 0)
+        return -1;
+    struct ifreq ifr = {};
+    strncpy(ifr.ifr_name, interface, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(s, SIOCGIFINDEX, &ifr) == 0) {
+        struct sockaddr_can addr = {};
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = ifr.ifr_ifindex;
+        if (bind(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0)
+            return s;
+    }
+    close(s);
+    return -1;
+}
+
+// CANSimple node of the axes of a SimBoard on a socket that carries one
+// struct can_frame per datagram: a raw SocketCAN socket, or for the tests one
+// end of a socketpair.
+class SimCanBus {
+public:
+    explicit SimCanBus(SimBoard& board) : board_(board) {}
+
+    bool open(const char* interface) {
+        socket_ = open_can_socket(interface);
+        return socket_ >= 0;
+    }
+
+    void attach(int socket) { socket_ = socket; }
+
+    // @brief Waits for one frame and handles it
+    // @returns false if the socket failed
+    bool receive() {
+        struct can_frame frame;
+        ssize_t n = read(socket_, &frame, sizeof(frame));
+        if (n < 0)
+            return false;
+        if (n != sizeof(frame) || (frame.can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG)))
+            return true; // CANSimple uses standard IDs
+        can_Message_t msg;
+        msg.id = frame.can_id & CAN_SFF_MASK;
+        msg.rtr = frame.can_id & CAN_RTR_FLAG;
+        msg.len = std::min<uint8_t>(frame.can_dlc, 8);
+        memcpy(msg.buf, frame.data, msg.len);
+
+        RequestLock lock(board_);
+        for (SimAxis& axis : board_.axes) {
+            if ((msg.id >> NUM_CMD_ID_BITS) == axis.node_id)
+                handle(axis, msg);
+        }
+        return true;
+    }
+
+    void run_receiver() {
+        while (receive()) {}
+    }
+
+    uint32_t tx_dropped() const { return tx_dropped_; }
+
+    // @brief Sends the heartbeat and the encoder estimates at their configured
+    // rates, like CANSimple::send_cyclic()
+    void send_cyclic(SimAxis& axis, uint32_t now) {
+        if (socket_ < 0)
+            return;
+        if (axis.heartbeat_rate_ms && now - axis.last_heartbeat >= axis.heartbeat_rate_ms) {
+            can_Message_t msg = reply(axis, MSG_ODRIVE_HEARTBEAT);
+            can_setSignal<uint32_t>(msg, axis.error, 0, 32, true);
+            can_setSignal<uint32_t>(msg, axis.current_state, 32, 32, true);
+            send(msg);
+            axis.last_heartbeat = now;
+        }
+        if (axis.encoder_rate_ms && now - axis.last_encoder >= axis.encoder_rate_ms) {
+            send_encoder_estimates(axis);
+            axis.last_encoder = now;
+        }
+    }
+
+private:
+    void handle(SimAxis& axis, const can_Message_t& msg) {
+        switch (msg.id & ((1 << NUM_CMD_ID_BITS) - 1)) {
+            case MSG_ODRIVE_ESTOP:
+                axis.error |= AXIS_ERROR_ESTOP_REQUESTED;
+                axis.current_state = AXIS_STATE_IDLE;
+                break;
+            case MSG_SET_AXIS_REQUESTED_STATE:
+                axis.requested_state = can_getSignal<uint32_t>(msg, 0, 16, true);
+                break;
+            case MSG_GET_ENCODER_ESTIMATES:
+                if (msg.rtr)
+                    send_encoder_estimates(axis);
+                break;
+            case MSG_SET_CONTROLLER_MODES:
+                axis.control_mode = can_getSignal<int32_t>(msg, 0, 32, true);
+                break;
+            case MSG_SET_INPUT_POS:
+                axis.input_pos = can_getSignal<float>(msg, 0, 32, true);
+                axis.input_vel = can_getSignal<int16_t>(msg, 32, 16, true, 0.001f, 0);
+                axis.input_torque = can_getSignal<int16_t>(msg, 48, 16, true, 0.001f, 0);
+                break;
+            case MSG_SET_INPUT_VEL:
+                axis.input_vel = can_getSignal<float>(msg, 0, 32, true);
+                axis.input_torque = can_getSignal<float>(msg, 32, 32, true);
+                break;
+            case MSG_SET_INPUT_TORQUE:
+                axis.input_torque = can_getSignal<float>(msg, 0, 32, true);
+                break;
+            case MSG_SET_VEL_LIMIT:
+                axis.controller.vel_limit = can_getSignal<float>(msg, 0, 32, true);
+                break;
+            case MSG_GET_IQ:
+                if (msg.rtr) {
+                    can_Message_t txmsg = reply(axis, MSG_GET_IQ);
+                    can_setSignal<float>(txmsg, axis.Iq_setpoint, 0, 32, true);
+                    can_setSignal<float>(txmsg, axis.Iq_measured, 32, 32, true);
+                    send(txmsg);
+                }
+                break;
+            case MSG_GET_VBUS_VOLTAGE:
+                if (msg.rtr) {
+                    can_Message_t txmsg = reply(axis, MSG_GET_VBUS_VOLTAGE);
+                    can_setSignal<float>(txmsg, board_.vbus_voltage, 0, 32, true);
+                    send(txmsg);
+                }
+                break;
+            case MSG_CLEAR_ERRORS:
+                axis.error = 0;
+                break;
+            default:
+                break;
+        }
+    }
+
+    static can_Message_t reply(const SimAxis& axis, uint32_t cmd) {
+        can_Message_t msg;
+        msg.id = (axis.node_id << NUM_CMD_ID_BITS) + cmd;
+        msg.len = 8;
+        return msg;
+    }
+
+    void send_encoder_estimates(const SimAxis& axis) {
+        can_Message_t msg = reply(axis, MSG_GET_ENCODER_ESTIMATES);
+        can_setSignal<float>(msg, axis.pos_estimate, 0, 32, true);
+        can_setSignal<float>(msg, axis.vel_estimate, 32, 32, true);
+        send(msg);
+    }
+
+    void send(const can_Message_t& msg) {
+        struct can_frame frame = {};
+        frame.can_id = msg.id;
+        frame.can_dlc = msg.len;
+        memcpy(frame.data, msg.buf, msg.len);
+        // A full TX queue drops the frame, like the mailboxes of the bxCAN
+        if (write(socket_, &frame, sizeof(frame)) != sizeof(frame))
+            ++tx_dropped_;
+    }
+
+    SimBoard& board_;
+    int socket_ = -1;
+    uint32_t tx_dropped_ = 0;
+};
+
+}
+
+#endif // __SIM_CAN_HPP
@@ -0,0 +1,222 @@
+#!/bin/python3
+"""
+Generates the Fibre v0.1 endpoints of the simulator (Tests/sim/odrive_sim.cpp)
+from odrive-interface.yaml, for the properties, functions and objects bound in
+Tests/sim/sim_endpoints.yaml.
+
+The names, types and access modes come from the interface definitions and are
+mapped like fibre/tools/interface_generator.py does for the firmware: type
+names resolve in the innermost enclosing interface first, inline
+sub-interfaces are named after their attribute in PascalCase and enums and
+flags go over the wire as int32. The endpoint IDs count up from 1 over the
+served subset in definition order, the host reads them from the JSON.
+
+This only needs PyYAML, so the simulator builds on hosts without the
+generator dependencies of the firmware.
+"""
+
+import argparse
+import json
+import re
+import sys
+import zlib
+
+import yaml
+
+builtin_types = {
+    'bool': 'bool',
+    'float32': 'float',
+    'uint8': 'uint8_t',
+    'uint16': 'uint16_t',
+    'uint32': 'uint32_t',
+    'uint64': 'uint64_t',
+    'int8': 'int8_t',
+    'int16': 'int16_t',
+    'int32': 'int32_t',
+    'int64': 'int64_t',
+}
+
+dictionary = []
+interfaces = {}
+value_types = {}
+
+
+def join_name(*names):
+    return '.'.join(y for x in names for y in x.split('.') if y != '')
+
+def to_pascal_case(s):
+    regex = ''.join((re.escape(w) + '|') for w in dictionary) + '[a-z0-9]+|[A-Z][a-z0-9]*'
+    return ''.join((w if w in dictionary else w.title()) for w in re.findall(regex, s))
+
+
+def collect(path, elem):
+    """Registers the interface at path and its inline sub-interfaces and value types"""
+    elem = elem or {}
+    interfaces[path] = elem
+    for name, attr in (elem.get('attributes') or {}).items():
+        if isinstance(attr, dict) and not 'type' in attr:
+            if 'flags' in attr or 'values' in attr:
+                value_types[join_name(path, to_pascal_case(name))] = attr
+            else:
+                collect(join_name(path, to_pascal_case(name)), attr)
+
+def resolve(scope, name):
+    """Resolves a type name, the innermost scope first, like resolve_interface()"""
+    if name in builtin_types:
+        return 'value', name
+    scope = scope.split('.')
+    for i in range(len(scope) + 1):
+        probe_name = join_name(*scope[:len(scope) - i], name)
+        if probe_name in interfaces:
+            return 'interface', probe_name
+        if probe_name in value_types:
+            return 'value', 'int32' # all value types besides the builtins are enums or flags
+    raise Exception('could not resolve type {} in {}'.format(name, '.'.join(scope)))
+
+def attribute_type(intf_name, name, attr):
+    """
+    Returns (kind, type, access) of an attribute, where kind is 'value' for
+    properties and 'interface' for objects
+    """
+    if attr is None:
+        attr = {}
+    if isinstance(attr, str):
+        attr = {'type': attr}
+    if not 'type' in attr:
+        if 'flags' in attr or 'values' in attr:
+            mode = (attr.get('typeargs') or {}).get('fibre.Property.mode', 'readwrite')
+            return 'value', 'int32', 'r' if mode == 'readonly' else 'rw'
+        return 'interface', join_name(intf_name, to_pascal_case(name)), None
+    type_name = attr['type']
+    access = 'rw'
+    if type_name.startswith('readonly '):
+        type_name = type_name[len('readonly '):]
+        access = 'r'
+    kind, resolved = resolve(intf_name, type_name)
+    return kind, resolved, access if kind == 'value' else None
+
+
+# Names of the bound objects for the comments of the table, e.g.
+# board.axes[0] => axis0
+object_paths = {}
+
+def path_of(obj, path):
+    return join_name(object_paths.get(obj, ''), path)
+
+
+class Generator():
+    def __init__(self, bindings):
+        self.bindings = bindings
+        self.used = set()
+        self.endpoints = []
+
+    def generate_object(self, intf_name, obj):
+        """
+        Returns the JSON members of an object of the given interface that is
+        implemented by the C++ object obj
+        """
+        if not intf_name in self.bindings:
+            raise Exception('no bindings for interface {}'.format(intf_name))
+        return self.generate_members(intf_name, intf_name, '', obj)
+
+    def generate_members(self, binding_intf, intf_name, prefix, obj):
+        bindings = self.bindings[binding_intf]
+        intf = interfaces[intf_name]
+        members = []
+
+        for name, attr in (intf.get('attributes') or {}).items():
+            path = prefix + name
+            is_parent = any(k.startswith(path + '.') for k in bindings)
+            if not path in bindings and not is_parent:
+                continue
+            kind, type_name, access = attribute_type(intf_name, name, attr)
+            if path in bindings:
+                self.used.add((binding_intf, path))
+                member = obj + '.' + bindings[path]
+                if kind == 'value':
+                    members.append(self.add_property(name, type_name, access, member, path_of(obj, path)))
+                else:
+                    members.append({'name': name, 'type': 'object', 'members': self.generate_object(type_name, member)})
+            elif kind == 'interface':
+                members.append({'name': name, 'type': 'object',
+                                'members': self.generate_members(binding_intf, type_name, path + '.', obj)})
+
+        for name, func in (intf.get('functions') or {}).items():
+            path = prefix + name
+            if not path in bindings:
+                continue
+            self.used.add((binding_intf, path))
+            func = func or {}
+            if func.get('in') or func.get('out') or func.get('raw', False):
+                raise Exception('{}.{}: only functions without arguments are supported'.format(intf_name, name))
+            members.append({'name': name, 'id': len(self.endpoints) + 1, 'type': 'function', 'inputs': [], 'outputs': []})
+            self.endpoints.append(('function_endpoint([] {{ {}.{}; }})'.format(obj, bindings[path]), path_of(obj, path)))
+
+        return members
+
+    def add_property(self, name, type_name, access, member, comment):
+        endpoint_id = len(self.endpoints) + 1
+        self.endpoints.append(('property_endpoint<{}>(&{}, {})'.format(builtin_types[type_name], member, 'true' if access == 'rw' else 'false'), comment))
+        return {'name': name, 'id': endpoint_id, 'type': 'float' if type_name == 'float32' else type_name, 'access': access}
+
+
+# Parse arguments
+
+parser = argparse.ArgumentParser(description="Generate the endpoints of the simulator from the YAML interface definitions")
+parser.add_argument("-d", "--definitions", type=argparse.FileType('r', encoding='utf-8'), required=True,
+                    help="the YAML interface definition file, i.e. odrive-interface.yaml")
+parser.add_argument("-b", "--bindings", type=argparse.FileType('r', encoding='utf-8'), required=True,
+                    help="the served endpoints and their C++ members, i.e. sim_endpoints.yaml")
+parser.add_argument("-o", "--output", type=argparse.FileType('w', encoding='utf-8'), required=True,
+                    help="path of the generated header")
+args = parser.parse_args()
+
+definitions = yaml.safe_load(args.definitions)
+sim_bindings = yaml.safe_load(args.bindings)
+dictionary += definitions.get('dictionary', None) or []
+for k, item in (definitions.get('interfaces') or {}).items():
+    collect(k, item)
+value_types.update(definitions.get('valuetypes') or {})
+
+root = sim_bindings['root']
+for name, member in sim_bindings['bindings'][root['interface']].items():
+    object_paths[root['object'] + '.' + member] = name
+
+generator = Generator(sim_bindings['bindings'])
+members = generator.generate_object(root['interface'], root['object'])
+unused = [join_name(intf, path) for intf, paths in sim_bindings['bindings'].items() for path in paths if not (intf, path) in generator.used]
+if len(unused):
+    print('**Error**: bindings for endpoints that are not in the interface definitions: ' + ', '.join(unused), file=sys.stderr)
+    sys.exit(1)
+
+# Like the to_c_string and to_c_zlib_array filters of interface_generator.py
+definitions = [{'name': '', 'id': 0, 'type': 'json', 'access': 'r'}] + members
+json_str = json.dumps(definitions, separators=(',', ':'))
+json_lines = '\n'.join(('"' + line.replace('"', '\\"') + '"') for line in json_str.replace('{"name"', '\n{"name"').split('\n'))
+zlib_data = zlib.compress(json_str.encode('ascii'), 9)
+zlib_lines = ',\n'.join(','.join('0x{:02x}'.format(b) for b in zlib_data[i:i+16]) for i in range(0, len(zlib_data), 16))
+table_lines = '\n'.join('    {}, // {} {}'.format(binding, i + 1, comment) for i, (binding, comment) in enumerate(generator.endpoints))
+
+args.output.write('''/*
+ * ============================ WARNING ============================
+ * ==== This is an autogenerated file.                          ====
+ * ==== Any changes to this file will be lost when recompiling. ====
+ * =================================================================
+ *
+ * Endpoints of the simulator, generated by Tests/sim/sim_endpoints_generator.py
+ * from odrive-interface.yaml and Tests/sim/sim_endpoints.yaml. Included by
+ * Tests/sim/odrive_sim.cpp after the definitions it refers to.
+ */
+
+const unsigned char embedded_json[] = {json};
+const size_t embedded_json_length = sizeof(embedded_json) - 1;
+const unsigned char embedded_json_zlib[] = {{
+{zlib}
+}};
+const size_t embedded_json_zlib_length = sizeof(embedded_json_zlib);
+
+static const Endpoint endpoint_table[] = {{
+    json_endpoint(), // 0
+{table}
+}};
+'''.format(json=json_lines, zlib=zlib_lines, table=table_lines))
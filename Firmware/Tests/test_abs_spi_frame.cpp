@@ -0,0 +1,73 @@
+#include <doctest.h>
+#include <initializer_list>
+
+#include "MotorControl/abs_spi_frame.hpp"
+
+// 18 bit BiSS-C style frame: [6 leading bits][18 pos][err][warn][6 inverted CRC]
+static const AbsSpiFrameFormat biss18 = {
+    .frame_bits = 32, .pos_shift = 8, .pos_bits = 18,
+    .status_shift = 6, .status_mask = 0x3, .status_ok = 0x3,
+    .crc_bits = 6, .crc_poly = 0x03, .crc_data_bits = 20, .crc_inverted = true,
+};
+
+static uint64_t make_biss18_frame(uint32_t pos, uint8_t status) {
+    uint64_t data = ((uint64_t)pos << 2) | status;
+    uint8_t crc = ~abs_spi_crc(data, 20, 0x03, 6) & 0x3f;
+    return (0x20ull << 26) | (data << 6) | crc;
+}
+
+TEST_SUITE("abs_spi_frame") {
+    TEST_CASE("crc") {
+        // CRC-6 x^6+x+1: remainder of M(x) * x^6
+        CHECK(abs_spi_crc(0x1, 1, 0x03, 6) == 0x03); // x^6 = x + 1
+        CHECK(abs_spi_crc(0x40, 7, 0x03, 6) == 0x05); // x^12 = x^2 + 1
+        CHECK(abs_spi_crc(0, 20, 0x03, 6) == 0);
+    }
+
+    TEST_CASE("format validation") {
+        CHECK(abs_spi_frame_valid(biss18));
+        CHECK(abs_spi_frame_words(biss18) == 2);
+        AbsSpiFrameFormat too_long = biss18;
+        too_long.frame_bits = 65;
+        CHECK(!abs_spi_frame_valid(too_long));
+        AbsSpiFrameFormat pos_outside = biss18;
+        pos_outside.pos_shift = 20;
+        CHECK(!abs_spi_frame_valid(pos_outside));
+    }
+
+    TEST_CASE("decode") {
+        for (uint32_t pos : {0u, 1u, 0x2aaaau, 0x3ffffu}) {
+            uint64_t frame = make_biss18_frame(pos, 0x3);
+            uint16_t rx[2] = {(uint16_t)(frame >> 16), (uint16_t)frame};
+            uint32_t decoded = 0xffffffff;
+            REQUIRE(abs_spi_decode_frame(biss18, rx, &decoded));
+            CHECK(decoded == pos);
+
+            // any single bit error in the covered bits is detected
+            for (int bit = 0; bit < 26; ++bit) {
+                uint64_t corrupted = frame ^ (1ull << bit);
+                uint16_t rx_bad[2] = {(uint16_t)(corrupted >> 16), (uint16_t)corrupted};
+                CHECK(!abs_spi_decode_frame(biss18, rx_bad, &decoded));
+            }
+        }
+
+        // error bit (active low) set
+        uint64_t frame = make_biss18_frame(1234, 0x1);
+        uint16_t rx[2] = {(uint16_t)(frame >> 16), (uint16_t)frame};
+        uint32_t decoded;
+        CHECK(!abs_spi_decode_frame(biss18, rx, &decoded));
+    }
+
+    TEST_CASE("trailing bits") {
+        // 24 bit frame in two words: the last 8 bits clocked in are padding
+        AbsSpiFrameFormat fmt = {
+            .frame_bits = 24, .pos_shift = 0, .pos_bits = 24,
+            .status_shift = 0, .status_mask = 0, .status_ok = 0,
+            .crc_bits = 0, .crc_poly = 0, .crc_data_bits = 0, .crc_inverted = false,
+        };
+        uint16_t rx[2] = {0x1234, 0x56ff};
+        uint32_t decoded;
+        REQUIRE(abs_spi_decode_frame(fmt, rx, &decoded));
+        CHECK(decoded == 0x123456);
+    }
+}
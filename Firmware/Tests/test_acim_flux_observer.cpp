@@ -0,0 +1,60 @@
+#include <doctest.h>
+
+#include "MotorControl/acim_flux_observer.hpp"
+
+static const AcimFluxObserver::Params_t params = {
+    .slip_velocity = 10.0f, .rotor_tempco = 0.004f, .ref_temp = 25.0f,
+    .min_flux = 2.0f, .max_slip = 800.0f,
+};
+
+TEST_SUITE("AcimFluxObserver") {
+    TEST_CASE("flux follows Id with the rotor time constant") {
+        AcimFluxObserver obs;
+        obs.set_params(params, NAN, 1e-3f);
+        obs.reset();
+        CHECK(obs.inv_flux() == doctest::Approx(0.5f)); // min_flux
+        for (int i = 0; i < 100; ++i) // one time constant
+            obs.update(20.0f, 0.0f);
+        CHECK(obs.flux() == doctest::Approx(20.0f * (1.0f - std::exp(-1.0f))).epsilon(1e-3));
+        for (int i = 0; i < 1000; ++i)
+            obs.update(20.0f, 0.0f);
+        CHECK(obs.flux() == doctest::Approx(20.0f).epsilon(1e-4));
+        CHECK(obs.inv_flux() == doctest::Approx(0.05f).epsilon(1e-4));
+    }
+
+    TEST_CASE("slip velocity") {
+        AcimFluxObserver obs;
+        obs.set_params(params, NAN, 1e-3f);
+        obs.reset();
+        for (int i = 0; i < 2000; ++i)
+            obs.update(10.0f, 0.0f);
+        CHECK(obs.update(10.0f, 5.0f) == doctest::Approx(5.0f).epsilon(1e-3)); // 10 rad/s * 5 A / 10 A
+        CHECK(obs.update(10.0f, -5.0f) == doctest::Approx(-5.0f).epsilon(1e-3));
+
+        // Without flux the slip is bounded by min_flux and max_slip
+        obs.reset();
+        CHECK(obs.update(0.0f, 100.0f) == doctest::Approx(500.0f));
+        CHECK(obs.update(0.0f, 1000.0f) == 800.0f);
+    }
+
+    TEST_CASE("rotor time constant follows the temperature") {
+        AcimFluxObserver obs;
+        obs.set_params(params, 25.0f, 1e-3f);
+        CHECK(obs.slip_velocity() == doctest::Approx(10.0f));
+        obs.set_params(params, 125.0f, 1e-3f);
+        CHECK(obs.slip_velocity() == doctest::Approx(14.0f)); // +40% rotor resistance
+        obs.set_params(params, -1000.0f, 1e-3f);
+        CHECK(obs.slip_velocity() == doctest::Approx(1.0f)); // floor at 10%
+    }
+
+    TEST_CASE("loss optimal Id") {
+        const float kt = 0.01f; // [Nm/A^2]
+        float id = acim_loss_optimal_Id(-1.0f, kt);
+        CHECK(id == doctest::Approx(10.0f));
+        // A split of the same torque with Id != Iq draws more current
+        float iq = 1.0f / (kt * id);
+        CHECK(iq == doctest::Approx(id));
+        float id_other = 8.0f, iq_other = 1.0f / (kt * id_other);
+        CHECK(id_other * id_other + iq_other * iq_other > id * id + iq * iq);
+    }
+}
@@ -0,0 +1,39 @@
+#include <doctest.h>
+
+#include "MotorControl/adc_scan_sequence.hpp"
+
+TEST_SUITE("AdcScanSequence") {
+    TEST_CASE("only the added channels in ascending order") {
+        AdcScanSequence seq;
+        seq.add(13, 480); // motor thermistor
+        seq.add(3, 15);   // sincos
+        seq.add(2, 15);
+        seq.add(UINT16_MAX, 480); // pin without ADC channel
+        REQUIRE(seq.size() == 3);
+        CHECK(seq.channel(0) == 2);
+        CHECK(seq.channel(1) == 3);
+        CHECK(seq.channel(2) == 13);
+        CHECK(seq.rank_of(3) == 1);
+        CHECK(seq.rank_of(13) == 2);
+        CHECK(seq.rank_of(0) == -1);
+        CHECK(seq.rank_of(UINT16_MAX) == -1);
+        CHECK(seq.scan_cycles() == (15 + 12) * 2 + 480 + 12);
+    }
+
+    TEST_CASE("a shared channel gets the longest sampling time") {
+        AdcScanSequence seq;
+        seq.add(4, 15);
+        seq.add(4, 100);
+        seq.add(4, 3);
+        CHECK(seq.size() == 1);
+        CHECK(seq.sample_code_of(4) == 5); // 112 cycles
+        CHECK(AdcScanSequence::sample_code(0) == 0);
+        CHECK(AdcScanSequence::sample_code(480) == 7);
+        CHECK(AdcScanSequence::sample_code(1000) == 7);
+
+        seq.clear();
+        CHECK(seq.size() == 0);
+        CHECK(seq.rank_of(4) == -1);
+        CHECK(seq.scan_cycles() == 0);
+    }
+}
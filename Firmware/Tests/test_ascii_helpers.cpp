@@ -0,0 +1,121 @@
+#include <doctest.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "communication/ascii_helpers.hpp"
+
+static bool parse_float(const char* str, float* value, const char** end = nullptr) {
+    const char* p = str;
+    bool ok = ascii_parse_float(p, value);
+    if (end)
+        *end = p;
+    return ok;
+}
+
+static float bits_to_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+TEST_SUITE("ascii_helpers") {
+    TEST_CASE("parse uint") {
+        const char* p = " 12 x";
+        unsigned value = 0;
+        CHECK(ascii_parse_uint(p, &value));
+        CHECK(value == 12);
+        CHECK(*p == ' ');
+        CHECK(!ascii_parse_uint(p, &value)); // "x"
+        CHECK(value == 12);
+
+        p = "-1";
+        CHECK(ascii_parse_uint(p, &value));
+        CHECK(value == (unsigned)-1);
+
+        p = "";
+        CHECK(!ascii_parse_uint(p, &value));
+    }
+
+    TEST_CASE("parse float") {
+        float value;
+        const char* end;
+        CHECK((parse_float("1.5", &value) && value == 1.5f));
+        CHECK((parse_float("  -0.25 3", &value, &end) && value == -0.25f && *end == ' '));
+        CHECK((parse_float("+.5", &value) && value == 0.5f));
+        CHECK((parse_float("7.", &value) && value == 7.0f));
+        CHECK((parse_float("1e3", &value) && value == 1000.0f));
+        CHECK((parse_float("2.5E-2", &value) && value == 0.025f));
+        CHECK((parse_float("1e", &value, &end) && value == 1.0f && *end == 'e'));
+        CHECK((parse_float("-inf", &value) && std::isinf(value) && value < 0));
+        CHECK((parse_float("Infinity", &value, &end) && std::isinf(value) && *end == 0));
+        CHECK((parse_float("nan", &value) && std::isnan(value)));
+        CHECK((parse_float("1e40", &value) && std::isinf(value)));
+        CHECK((parse_float("0.000000000000000000000000000000000000000000001401298", &value) && value == bits_to_float(1)));
+        CHECK((parse_float("123456789012345678901234567890", &value) && value == 123456789012345678901234567890.0f));
+        CHECK(!parse_float("", &value));
+        CHECK(!parse_float(".", &value));
+        CHECK(!parse_float("-x", &value));
+    }
+
+    TEST_CASE("parse float matches strtof") {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<uint32_t> dist;
+        char text[64];
+        for (int i = 0; i < 200000; ++i) {
+            float expected = bits_to_float(dist(rng));
+            if (!std::isfinite(expected))
+                continue;
+            snprintf(text, sizeof(text), i & 1 ? "%.9g" : "%f", (double)expected);
+            float value;
+            REQUIRE(parse_float(text, &value));
+            REQUIRE(value == strtof(text, nullptr));
+        }
+    }
+
+    TEST_CASE("format uint") {
+        char buffer[11];
+        CHECK(ascii_format_uint(buffer, 0) == 1);
+        CHECK(strcmp(buffer, "0") == 0);
+        CHECK(ascii_format_uint(buffer, 4294967295u) == 10);
+        CHECK(strcmp(buffer, "4294967295") == 0);
+    }
+
+    TEST_CASE("format float") {
+        char buffer[ASCII_FLOAT_MAX_LENGTH];
+        CHECK(ascii_format_float(buffer, 1.5f) == 8);
+        CHECK(strcmp(buffer, "1.500000") == 0);
+        ascii_format_float(buffer, -0.0f);
+        CHECK(strcmp(buffer, "-0.000000") == 0);
+        ascii_format_float(buffer, 0.0078125f); // a tie, rounds to even
+        CHECK(strcmp(buffer, "0.007812") == 0);
+        ascii_format_float(buffer, 0.0234375f);
+        CHECK(strcmp(buffer, "0.023438") == 0);
+        ascii_format_float(buffer, INFINITY);
+        CHECK(strcmp(buffer, "inf") == 0);
+        ascii_format_float(buffer, -INFINITY);
+        CHECK(strcmp(buffer, "-inf") == 0);
+        ascii_format_float(buffer, NAN);
+        CHECK(strcmp(buffer, "nan") == 0);
+    }
+
+    TEST_CASE("format float matches snprintf") {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<uint32_t> dist;
+        char expected[64];
+        char buffer[ASCII_FLOAT_MAX_LENGTH];
+        for (int i = 0; i < 200000; ++i) {
+            // Mostly magnitudes that are typical for positions and velocities
+            float value = (i & 1) ? bits_to_float(dist(rng))
+                                  : bits_to_float(dist(rng) % 0x10000000 + 0x30000000) * ((i & 2) ? 1 : -1);
+            if (std::isnan(value))
+                continue;
+            size_t len = ascii_format_float(buffer, value);
+            snprintf(expected, sizeof(expected), "%f", (double)value);
+            REQUIRE(len == strlen(expected));
+            REQUIRE(strcmp(buffer, expected) == 0);
+        }
+    }
+}
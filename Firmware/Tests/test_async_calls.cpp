@@ -0,0 +1,57 @@
+#include <doctest.h>
+
+#include <fibre/async_calls.hpp>
+
+#include <vector>
+
+TEST_SUITE("AsyncCallQueue") {
+    using Queue = AsyncCallQueue<3>;
+
+    TEST_CASE("runs the calls in order") {
+        Queue queue;
+        uint16_t a = queue.start(10);
+        uint16_t b = queue.start(20);
+        CHECK(a != 0);
+        CHECK(b != 0);
+        CHECK(a != b);
+        CHECK(queue.status(a) == Queue::STATUS_QUEUED);
+
+        std::vector<uint16_t> called;
+        CHECK(queue.run_next([&](uint16_t id) {
+            CHECK(queue.status(a) == Queue::STATUS_RUNNING);
+            called.push_back(id);
+            return true;
+        }));
+        CHECK(queue.status(a) == Queue::STATUS_DONE);
+        CHECK(queue.status(b) == Queue::STATUS_QUEUED);
+        CHECK(queue.run_next([&](uint16_t id) { called.push_back(id); return false; }));
+        CHECK(queue.status(b) == Queue::STATUS_FAILED);
+        CHECK(!queue.run_next([&](uint16_t id) { called.push_back(id); return true; }));
+        CHECK(called == std::vector<uint16_t>{10, 20});
+    }
+
+    TEST_CASE("full queue and slot reuse") {
+        Queue queue;
+        uint16_t handles[3];
+        for (uint16_t i = 0; i < 3; ++i)
+            handles[i] = queue.start(i);
+        CHECK(queue.start(3) == 0); // nothing finished yet
+        CHECK(queue.status(0) == Queue::STATUS_UNKNOWN);
+
+        auto ok = [](uint16_t) { return true; };
+        queue.run_next(ok);
+        queue.run_next(ok);
+        uint16_t next = queue.start(4); // takes the slot of the oldest finished call
+        CHECK(next != 0);
+        CHECK(queue.status(handles[0]) == Queue::STATUS_UNKNOWN);
+        CHECK(queue.status(handles[1]) == Queue::STATUS_DONE);
+
+        // The older queued call still runs first
+        uint16_t id = 0xffff;
+        queue.run_next([&](uint16_t endpoint_id) { id = endpoint_id; return true; });
+        CHECK(id == 2);
+        queue.run_next([&](uint16_t endpoint_id) { id = endpoint_id; return true; });
+        CHECK(id == 4);
+        CHECK(queue.status(next) == Queue::STATUS_DONE);
+    }
+}
@@ -0,0 +1,37 @@
+#include <doctest.h>
+
+#include <MotorControl/axis_schedule.hpp>
+
+TEST_SUITE("AxisSchedule") {
+    TEST_CASE("two axes on the injected and regular conversion") {
+        constexpr AxisSchedule_t schedule[2] = {
+            {.injected = true, .slot_counting_down = false, .timings_axis = 1},
+            {.injected = false, .slot_counting_down = true, .timings_axis = 0},
+        };
+        static_assert(is_valid_axis_schedule(schedule));
+        CHECK(axis_for_adc_trigger(schedule, true) == 0);
+        CHECK(axis_for_adc_trigger(schedule, false) == 1);
+    }
+
+    TEST_CASE("invalid schedules") {
+        // both axes on the same trigger
+        constexpr AxisSchedule_t shared_trigger[2] = {
+            {.injected = true, .slot_counting_down = false, .timings_axis = 1},
+            {.injected = true, .slot_counting_down = true, .timings_axis = 0},
+        };
+        CHECK(!is_valid_axis_schedule(shared_trigger));
+        CHECK(axis_for_adc_trigger(shared_trigger, false) == 2);
+
+        // the timings of axis 1 are never loaded
+        constexpr AxisSchedule_t unloaded[2] = {
+            {.injected = true, .slot_counting_down = false, .timings_axis = 0},
+            {.injected = false, .slot_counting_down = true, .timings_axis = 0},
+        };
+        CHECK(!is_valid_axis_schedule(unloaded));
+
+        constexpr AxisSchedule_t out_of_range[1] = {
+            {.injected = true, .slot_counting_down = false, .timings_axis = 1},
+        };
+        CHECK(!is_valid_axis_schedule(out_of_range));
+    }
+}
@@ -0,0 +1,83 @@
+#include <doctest.h>
+
+#include "MotorControl/backlash_comp.hpp"
+
+#include <cmath>
+
+TEST_SUITE("BacklashCompensator") {
+    const float dt = 1.0f / 8000.0f;
+
+    static BacklashCompensator::Config_t make_config() {
+        BacklashCompensator::Config_t config;
+        config.enable = true;
+        config.backlash = 0.02f;
+        return config;
+    }
+
+    TEST_CASE("offset on reversal") {
+        BacklashCompensator::Config_t config = make_config();
+        BacklashCompensator comp;
+        CHECK(comp.update(config, 1.0f, dt).pos == 0.0f);
+        CHECK(comp.update(config, 1.0003f, dt).pos == 0.0f); // within the threshold
+        CHECK(comp.dir() == 0);
+
+        // Moving forward, the offset takes transition_time to build up
+        float pos = 1.0003f;
+        float max_step = 0.0f;
+        float prev = 0.0f;
+        float integrated = 0.0f;
+        for (int i = 0; i < 160; ++i) {
+            pos += 0.001f;
+            BacklashCompensator::Output_t out = comp.update(config, pos, dt);
+            max_step = std::max(max_step, std::abs(out.pos - prev));
+            integrated += out.vel * dt;
+            prev = out.pos;
+        }
+        CHECK(comp.dir() == 1);
+        CHECK(comp.offset() == doctest::Approx(0.01f));
+        CHECK(integrated == doctest::Approx(0.01f).epsilon(0.02));
+        CHECK(max_step < 0.01f * 1.5f / 80.0f); // smooth step over 80 periods
+
+        // Small noise doesn't reverse it
+        comp.update(config, pos - 0.0004f, dt);
+        CHECK(comp.dir() == 1);
+        comp.update(config, pos - 0.0006f, dt);
+        CHECK(comp.dir() == -1);
+        CHECK(comp.reversals() == 2);
+        for (int i = 0; i < 100; ++i)
+            comp.update(config, pos - 0.0006f, dt);
+        CHECK(comp.offset() == doctest::Approx(-0.01f));
+    }
+
+    TEST_CASE("calibration with a load encoder") {
+        BacklashCompensator::Config_t config = make_config();
+        const float backlash = 0.013f;
+        const float windup = 0.001f; // by the friction, in the direction of motion
+        BacklashCalibration calib;
+        float motor = 2.0f;
+        float load = motor;
+        calib.start(motor);
+        CHECK(calib.active());
+        float pos = motor, vel = 0.0f;
+        float min_pos = motor, max_pos = motor;
+        int ticks = 0;
+        while (!calib.update(config, motor, load, dt, &pos, &vel) && ticks < 1000000) {
+            ++ticks;
+            // The motor follows the setpoint, the load is dragged through the gap
+            motor = pos;
+            float gap = 0.5f * backlash + windup;
+            if (motor - load > gap)
+                load = motor - gap;
+            else if (motor - load < -gap)
+                load = motor + gap;
+            min_pos = std::min(min_pos, motor);
+            max_pos = std::max(max_pos, motor);
+        }
+        CHECK(!calib.active());
+        CHECK(calib.backlash() == doctest::Approx(backlash + 2.0f * windup).epsilon(0.01));
+        CHECK(pos == doctest::Approx(2.0f)); // back at the start
+        CHECK(max_pos == doctest::Approx(2.1f).epsilon(1e-3));
+        CHECK(min_pos >= 2.0f - 1e-4f);
+        CHECK(ticks == doctest::Approx(6 * 0.1f / 0.05f / dt).epsilon(0.01));
+    }
+}
@@ -0,0 +1,57 @@
+#include <doctest.h>
+#include <cmath>
+#include <algorithm>
+
+#include "MotorControl/biquad.hpp"
+
+// Amplitude of the steady state response to a sine at f [Hz]
+static float response(Biquad& filter, float f, float fs) {
+    filter.reset();
+    float amplitude = 0.0f;
+    const int n = (int)(2.0f * fs);
+    for (int i = 0; i < n; ++i) {
+        float y = filter.filter(std::sin(2.0f * (float)M_PI * f * i / fs));
+        if (i > n / 2)
+            amplitude = std::max(amplitude, std::abs(y));
+    }
+    return amplitude;
+}
+
+TEST_SUITE("Biquad") {
+    TEST_CASE("disabled") {
+        Biquad filter;
+        CHECK(filter.filter(1.234f) == 1.234f);
+        filter.design_notch(0.0f, 2.0f, 8000.0f);
+        CHECK(!filter.enabled());
+        filter.design_lowpass(5000.0f, 0.7071f, 8000.0f); // above Nyquist
+        CHECK(!filter.enabled());
+        CHECK(filter.filter(-1.0f) == -1.0f);
+    }
+
+    TEST_CASE("notch") {
+        const float fs = 8000.0f;
+        Biquad filter;
+        filter.design_notch(200.0f, 2.0f, fs);
+        REQUIRE(filter.enabled());
+        CHECK(response(filter, 200.0f, fs) < 0.01f);
+        CHECK(response(filter, 20.0f, fs) == doctest::Approx(1.0f).epsilon(0.01));
+        CHECK(response(filter, 2000.0f, fs) == doctest::Approx(1.0f).epsilon(0.01));
+    }
+
+    TEST_CASE("lowpass") {
+        const float fs = 8000.0f;
+        Biquad filter;
+        filter.design_lowpass(500.0f, 0.7071f, fs);
+        REQUIRE(filter.enabled());
+        CHECK(response(filter, 10.0f, fs) == doctest::Approx(1.0f).epsilon(0.01));
+        CHECK(response(filter, 500.0f, fs) == doctest::Approx(0.7071f).epsilon(0.01));
+        CHECK(response(filter, 3000.0f, fs) < 0.05f);
+
+        // unity gain at DC
+        filter.reset();
+        float y = 0.0f;
+        for (int i = 0; i < 1000; ++i)
+            y = filter.filter(1.0f);
+        CHECK(y == doctest::Approx(1.0f));
+    }
+}
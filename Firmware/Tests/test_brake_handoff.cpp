@@ -0,0 +1,82 @@
+#include <doctest.h>
+
+#include "MotorControl/brake_handoff.hpp"
+
+TEST_SUITE("BrakeHandoff") {
+    static BrakeHandoff::Config_t make_config() {
+        return {0.1f, 0.2f, 0.05f};
+    }
+
+    // Runs updates for duration [s] with the torque [Nm]
+    static void run(BrakeHandoff& handoff, const BrakeHandoff::Config_t& config, float torque, float duration) {
+        const float dt = 0.001f;
+        for (float t = 0.0f; t < duration - 0.5f * dt; t += dt)
+            handoff.update(config, torque, dt);
+    }
+
+    TEST_CASE("without delays") {
+        BrakeHandoff handoff;
+        BrakeHandoff::Config_t config = {};
+        CHECK(!handoff.hold());
+        handoff.start();
+        CHECK(handoff.update(config, 0.0f, 0.001f) == BrakeHandoff::PHASE_RUN);
+        CHECK(handoff.brake_released());
+        CHECK(!handoff.hold());
+        handoff.stop();
+        CHECK(handoff.update(config, 1.0f, 0.001f) == BrakeHandoff::PHASE_DONE);
+        CHECK(handoff.holding_torque() == 1.0f);
+        CHECK(handoff.torque_scale() == 0.0f);
+    }
+
+    TEST_CASE("release and engage") {
+        BrakeHandoff handoff;
+        BrakeHandoff::Config_t config = make_config();
+        handoff.start();
+        run(handoff, config, 0.0f, 0.05f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_RELEASE); // no holding torque to load yet
+        CHECK(handoff.brake_released());
+        CHECK(handoff.hold());
+        run(handoff, config, 0.0f, 0.06f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_RUN);
+
+        handoff.stop();
+        run(handoff, config, 2.0f, 0.15f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_ENGAGE);
+        CHECK(!handoff.brake_released());
+        CHECK(handoff.hold());
+        CHECK(handoff.torque_scale() == 1.0f);
+        run(handoff, config, 2.0f, 0.075f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_UNLOAD);
+        CHECK(handoff.holding_torque() == 2.0f);
+        CHECK(handoff.torque_scale() == doctest::Approx(0.5f).epsilon(0.05));
+        run(handoff, config, 1.0f, 0.03f);
+        CHECK(handoff.done());
+        handoff.reset();
+
+        // The next release loads the holding torque first
+        handoff.start();
+        run(handoff, config, 0.0f, 0.025f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_LOAD);
+        CHECK(!handoff.brake_released());
+        CHECK(handoff.load_torque() == doctest::Approx(1.0f).epsilon(0.05));
+        run(handoff, config, 0.0f, 0.03f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_RELEASE);
+    }
+
+    TEST_CASE("stop before the release") {
+        BrakeHandoff handoff;
+        BrakeHandoff::Config_t config = make_config();
+        handoff.start();
+        run(handoff, config, 0.0f, 0.2f);
+        handoff.stop();
+        run(handoff, config, 3.0f, 0.3f);
+        CHECK(handoff.done());
+        handoff.reset();
+        handoff.start();
+        handoff.update(config, 0.0f, 0.001f);
+        CHECK(handoff.phase() == BrakeHandoff::PHASE_LOAD);
+        handoff.stop();
+        CHECK(handoff.done());
+        CHECK(handoff.torque_scale() == 0.0f);
+    }
+}
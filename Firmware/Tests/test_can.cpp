@@ -83,6 +83,129 @@ TEST_SUITE("CAN Functions") {
         CHECK(can_getSignal<float>(txmsg, 12, 32, false, 2.0f, 1.1f) == 234981.0f);
     }
 
+    TEST_CASE("setSignal negative") {
+        can_Message_t txmsg;
+
+        can_setSignal<int32_t>(txmsg, -2, 0, 12, true);
+        can_setSignal<int32_t>(txmsg, 0x345, 12, 12, true);
+        CHECK(can_getSignal<uint16_t>(txmsg, 0, 12, true) == 0xffe);
+        CHECK(can_getSignal<uint16_t>(txmsg, 12, 12, true) == 0x345);
+        CHECK(can_getSignal<uint32_t>(txmsg, 24, 32, true) == 0);
+
+        can_setSignal<int64_t>(txmsg, -1, 24, 8, false);
+        CHECK(can_getSignal<uint8_t>(txmsg, 24, 8, false) == 0xff);
+        CHECK(can_getSignal<uint16_t>(txmsg, 12, 12, true) == 0x345);
+    }
+
+    TEST_CASE("FD payload") {
+        can_FdMessage_t msg;
+
+        can_setSignal<double>(msg, 1234.5678, 300, 64, true);
+        can_setSignal<int32_t>(msg, -3, 364, 20, true);
+        CHECK(can_getSignal<double>(msg, 300, 64, true) == 1234.5678);
+        CHECK(can_getSignal<int32_t>(msg, 364, 20, true, 1, 0) == 0xffffd);
+        CHECK(can_getSignal<uint32_t>(msg, 0, 32, true) == 0);
+
+        // Motorola signals count from the MSB of the whole payload
+        can_setSignal<uint16_t>(msg, 0xABCD, 0, 16, false);
+        CHECK(msg.buf[0] == 0xAB);
+        CHECK(msg.buf[1] == 0xCD);
+        can_setSignal<uint16_t>(msg, 0x5A5, 500, 12, false);
+        CHECK(can_getSignal<uint16_t>(msg, 500, 12, false) == 0x5A5);
+        CHECK(can_getSignal<uint16_t>(msg, 0, 16, false) == 0xABCD);
+
+        CHECK(can_fd_dlc_to_len(9) == 12);
+        CHECK(can_fd_dlc_to_len(15) == 64);
+        CHECK(can_fd_len_to_dlc(8) == 8);
+        CHECK(can_fd_len_to_dlc(13) == 10);
+        CHECK(can_fd_len_to_dlc(64) == 15);
+    }
+
+    TEST_CASE("frame bits") {
+        CHECK(can_frame_bits(false, false, 0) == 47);
+        CHECK(can_frame_bits(false, false, 8) == 111);
+        CHECK(can_frame_bits(true, false, 8) == 131);
+        CHECK(can_frame_bits(true, true, 8) == 67);
+    }
+
+    TEST_CASE("bit timing") {
+        can_BitTiming_t timing;
+
+        // the classic ODrive timings, 21 tq with the sample point at 81%
+        REQUIRE(can_calcBitTiming(42000000, 250000, 0.8f, 0.01f, &timing));
+        CHECK(timing.prescaler == 8);
+        CHECK(timing.time_seg1 == 16);
+        CHECK(timing.time_seg2 == 4);
+        CHECK(timing.sjw == 4);
+        CHECK(timing.baud_rate == 250000);
+        REQUIRE(can_calcBitTiming(42000000, 1000000, 0.8f, 0.01f, &timing));
+        CHECK(timing.prescaler == 2);
+
+        REQUIRE(can_calcBitTiming(42000000, 333333, 0.875f, 0.01f, &timing));
+        CHECK(timing.baud_rate == 333333);
+        CHECK(timing.sample_point == doctest::Approx(0.875f).epsilon(0.05));
+        CHECK(1 + timing.time_seg1 + timing.time_seg2 >= 8);
+
+        // not exactly achievable, within 1%
+        REQUIRE(can_calcBitTiming(42000000, 800000, 0.8f, 0.01f, &timing));
+        CHECK(timing.baud_rate == doctest::Approx(800000).epsilon(0.01));
+        CHECK(timing.time_seg2 >= 2);
+        CHECK(timing.time_seg2 <= 8);
+        CHECK(timing.time_seg1 <= 16);
+        CHECK(!can_calcBitTiming(42000000, 800000, 0.8f, 0.001f, &timing));
+
+        CHECK(!can_calcBitTiming(42000000, 0, 0.8f, 0.01f, &timing));
+        CHECK(!can_calcBitTiming(42000000, 10000000, 0.8f, 0.01f, &timing));
+        CHECK(!can_calcBitTiming(42000000, 250000, 1.0f, 0.01f, &timing));
+    }
+
+    TEST_CASE("acceptance filters") {
+        // Like ODriveCAN::update_filters() for CANSimple (5 command ID bits)
+        // with an axis on node 3 that gears to the encoder estimates (0x009)
+        // of node 5
+        constexpr uint32_t cmd_id_bits = 5;
+        constexpr uint32_t encoder_estimates = 0x009;
+        const can_Filter_t filters[] = {
+            can_nodeFilter(3, cmd_id_bits, false),
+            can_idFilter((5 << cmd_id_bits) | encoder_estimates, false),
+        };
+        auto passes = [&](uint32_t id, bool isExt, bool rtr = false) {
+            can_Message_t msg;
+            msg.id = id;
+            msg.isExt = isExt;
+            msg.rtr = rtr;
+            return std::any_of(std::begin(filters), std::end(filters),
+                               [&](const can_Filter_t& filter) { return can_filterMatches(filter, msg); });
+        };
+
+        // All commands of the own node, data and remote frames
+        CHECK(passes((3 << cmd_id_bits) | 0x00c, false));
+        CHECK(passes((3 << cmd_id_bits) | 0x01f, false, true));
+        // The master's encoder estimates, but none of its other frames
+        CHECK(passes((5 << cmd_id_bits) | encoder_estimates, false));
+        CHECK(!passes((5 << cmd_id_bits) | 0x001, false));
+        CHECK(!passes((5 << cmd_id_bits) | 0x00a, false));
+        // Other nodes and the other frame format
+        CHECK(!passes((4 << cmd_id_bits) | encoder_estimates, false));
+        CHECK(!passes((5 << cmd_id_bits) | encoder_estimates, true));
+        CHECK(!passes((3 << cmd_id_bits) | 0x00c, true));
+
+        // Extended node IDs use all 24 bits above the command ID
+        can_Filter_t ext = can_nodeFilter(0x123456, cmd_id_bits, true);
+        can_Message_t msg;
+        msg.isExt = true;
+        msg.id = (0x123456 << cmd_id_bits) | 0x007;
+        CHECK(can_filterMatches(ext, msg));
+        msg.id = (0x123457 << cmd_id_bits) | 0x007;
+        CHECK(!can_filterMatches(ext, msg));
+
+        // The register layout of bxCAN: STID in bits 31..21, EXID in 20..3, IDE
+        CHECK(can_idFilter(0x7ff, false).id == 0xffe00000);
+        CHECK(can_idFilter(0x7ff, false).mask == 0xffe00004);
+        CHECK(can_idFilter(0x1fffffff, true).id == 0xfffffffc);
+        CHECK(can_idFilter(0x1fffffff, true).mask == 0xfffffffc);
+    }
+
     TEST_CASE("getSignal enums") {
         can_Message_t rxmsg;
         rxmsg.buf[0] = INPUT_MODE_MIX_CHANNELS;
@@ -0,0 +1,17 @@
+#include <doctest.h>
+
+#include <fibre/protocol.hpp>
+
+TEST_SUITE("ChannelStats") {
+    TEST_CASE("process time histogram") {
+        ChannelStats_t stats = {};
+        for (uint32_t us : {0, 99, 100, 999, 1000, 9999, 10000, 250000})
+            stats.add_process_time(us);
+        stats.add_process_time(50);
+        CHECK(stats.process_time_under_100us == 3);
+        CHECK(stats.process_time_under_1ms == 2);
+        CHECK(stats.process_time_under_10ms == 2);
+        CHECK(stats.process_time_over_10ms == 2);
+        CHECK(stats.max_process_time == 250000);
+    }
+}
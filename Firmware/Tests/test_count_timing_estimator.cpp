@@ -0,0 +1,97 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/count_timing_estimator.hpp"
+
+// The PLL of Encoder::update in VEL_ESTIMATOR_MODE_LOW_SPEED on the count of
+// an ideal incremental encoder
+struct LowSpeedPll {
+    float pos = 0.0f; // [count]
+    float vel = 0.0f; // [count/s]
+    int32_t count = 0;
+    CountTimingEstimator timing;
+
+    void update(float true_pos, float dt, float bandwidth) {
+        int32_t new_count = (int32_t)std::floor(true_pos);
+        float fraction = timing.update(new_count - count, dt);
+        count = new_count;
+        float kp = 2.0f * bandwidth;
+        float ki = 0.25f * kp * kp;
+        pos += dt * vel;
+        float err = (float)count + fraction - pos;
+        pos += dt * kp * err;
+        vel += dt * ki * err;
+    }
+};
+
+TEST_SUITE("CountTimingEstimator") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("position within the count at constant velocity") {
+        CountTimingEstimator timing;
+        const float vel = 3.0f; // [count/s]
+        int32_t count = 0;
+        float max_err = 0.0f;
+        for (int i = 0; i < 8000 * 4; ++i) {
+            float pos = 0.2f + vel * i * dt;
+            int32_t new_count = (int32_t)std::floor(pos);
+            float fraction = timing.update(new_count - count, dt);
+            count = new_count;
+            if (i > 8000)
+                max_err = std::max(max_err, std::abs((float)count + fraction - pos));
+        }
+        CHECK(timing.vel() == doctest::Approx(vel).epsilon(0.01));
+        CHECK(max_err < 0.01f);
+    }
+
+    TEST_CASE("a dithering count gives the boundary") {
+        CountTimingEstimator timing;
+        timing.update(1, dt);
+        for (int i = 0; i < 100; ++i)
+            timing.update(0, dt);
+        for (int i = 0; i < 50; ++i) {
+            CHECK(timing.update(i % 2 ? 1 : -1, dt) == (i % 2 ? 0.0f : 1.0f));
+            CHECK(timing.vel() == 0.0f);
+            CHECK(timing.update(0, dt) == (i % 2 ? 0.0f : 1.0f));
+        }
+    }
+
+    TEST_CASE("several counts per period") {
+        CountTimingEstimator timing;
+        timing.update(3, dt);
+        timing.update(3, dt);
+        CHECK(timing.fraction() == doctest::Approx(0.5f));
+        timing.update(-3, dt);
+        CHECK(timing.fraction() == 1.0f);
+    }
+
+    TEST_CASE("PLL velocity at fractions of a count per second") {
+        // The PLL mode would snap this velocity to zero below 0.5 * dt * ki,
+        // here about 6 count/s
+        const float bandwidth = 100.0f; // [rad/s]
+        for (float vel : {0.25f, 2.0f, -0.5f}) {
+            LowSpeedPll pll;
+            float max_err = 0.0f;
+            for (int i = 0; i < 8000 * 40; ++i) {
+                pll.update(0.5f + vel * i * dt, dt, bandwidth);
+                if (i > 8000 * 10)
+                    max_err = std::max(max_err, std::abs(pll.vel - vel));
+            }
+            CHECK(max_err < 0.1f * std::abs(vel));
+        }
+    }
+
+    TEST_CASE("PLL at standstill with a dithering count") {
+        LowSpeedPll pll;
+        for (int i = 0; i < 8000; ++i)
+            pll.update(10.5f + 1e-3f * i * dt, dt, 100.0f);
+        float max_vel = 0.0f;
+        for (int i = 0; i < 8000; ++i) {
+            pll.update((i / 7) % 2 ? 11.0f : 10.999f, dt, 100.0f);
+            if (i > 4000)
+                max_vel = std::max(max_vel, std::abs(pll.vel));
+        }
+        CHECK(pll.pos == doctest::Approx(11.0f).epsilon(1e-3));
+        CHECK(max_vel < 0.01f);
+    }
+}
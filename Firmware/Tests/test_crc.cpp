@@ -0,0 +1,51 @@
+#include <doctest.h>
+
+#include <fibre/crc.hpp>
+
+#include <initializer_list>
+
+TEST_SUITE("crc") {
+    // The CANONICAL_* values of fibre/protocol.hpp, which isn't host buildable
+    static constexpr uint8_t crc8_polynomial = 0x37;
+    static constexpr uint8_t crc8_init = 0x42;
+    static constexpr uint16_t crc16_polynomial = 0x3d65;
+    static constexpr uint16_t crc16_init = 0x1337;
+
+    // The bitwise division the lookup tables are generated from
+    template<typename T, unsigned POLYNOMIAL>
+    static T calc_crc_bitwise(T remainder, const uint8_t* buffer, size_t length) {
+        constexpr T BIT_WIDTH = (CHAR_BIT * sizeof(T));
+        constexpr T TOPBIT = ((T)1 << (BIT_WIDTH - 1));
+        while (length--) {
+            remainder ^= (*(buffer++) << (BIT_WIDTH - 8));
+            for (uint8_t bit = 8; bit; --bit)
+                remainder = (remainder & TOPBIT) ? (T)((remainder << 1) ^ POLYNOMIAL) : (T)(remainder << 1);
+        }
+        return remainder;
+    }
+
+    TEST_CASE("matches the bitwise division") {
+        uint8_t data[300];
+        for (size_t i = 0; i < sizeof(data); ++i)
+            data[i] = (uint8_t)(i * 37 + (i >> 3));
+        for (size_t length : {0u, 1u, 7u, 64u, 300u}) {
+            CHECK(calc_crc8<crc8_polynomial>(crc8_init, data, length)
+                  == calc_crc_bitwise<uint8_t, crc8_polynomial>(crc8_init, data, length));
+            CHECK(calc_crc16<crc16_polynomial>(crc16_init, data, length)
+                  == calc_crc_bitwise<uint16_t, crc16_polynomial>(crc16_init, data, length));
+        }
+    }
+
+    TEST_CASE("check values") {
+        const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+        CHECK(calc_crc16<0x1021>(0xffff, check, sizeof(check)) == 0x29b1); // CRC-16/CCITT-FALSE
+        CHECK(calc_crc8<0x07>(0x00, check, sizeof(check)) == 0xf4);        // CRC-8/SMBUS
+
+        // Appending the CRC gives a zero remainder, as the packet sink checks it
+        uint8_t packet[11] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+        uint16_t crc16 = calc_crc16<crc16_polynomial>(crc16_init, packet, 9);
+        packet[9] = (uint8_t)(crc16 >> 8);
+        packet[10] = (uint8_t)crc16;
+        CHECK(calc_crc16<crc16_polynomial>(crc16_init, packet, 11) == 0);
+    }
+}
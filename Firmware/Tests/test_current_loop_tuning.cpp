@@ -0,0 +1,135 @@
+#include <doctest.h>
+
+#include "MotorControl/current_loop_tuning.hpp"
+
+static const float Ts = 1.0f / 8000.0f; // [s]
+static const float L = 20e-6f; // [H]
+static const float R = 0.05f;  // [Ohm]
+
+// Steps the current setpoint of a discrete PI loop on an R-L plant where the
+// voltage computed from a sample is applied during the following period,
+// like FOC_current.
+static StepResponse simulate_step(CurrentPiGains_t gains, float step) {
+    float a = std::exp(-R * Ts / L);
+    float i = 0.0f, integrator = 0.0f, v_applied = 0.0f;
+    StepResponse response;
+    response.reset(0.0f, step);
+    for (int k = 0; k < 400; ++k) {
+        float err = step - i;
+        float v = integrator + gains.p_gain * err;
+        integrator += gains.i_gain * Ts * err;
+        i = a * i + (1.0f - a) * v_applied / R;
+        v_applied = v;
+        response.add(i, Ts);
+    }
+    return response;
+}
+
+// Iq step at a constant electrical speed on an R-L plant in the rotating
+// frame, with the delay of simulate_step(). The rotation during the delay is
+// assumed to be compensated, like pwm_phase does.
+// @returns largest deviation of Id
+static float simulate_cross_coupling(CurrentPiGains_t gains, float phase_vel, float controller_vel, StepResponse* response) {
+    const int substeps = 20;
+    float h = Ts / (float)substeps;
+    float id = 0.0f, iq = 0.0f, int_d = 0.0f, int_q = 0.0f, vd_applied = 0.0f, vq_applied = 0.0f;
+    float max_id = 0.0f;
+    response->reset(0.0f, 1.0f);
+    for (int k = 0; k < 400; ++k) {
+        float err_d = 0.0f - id, err_q = 1.0f - iq;
+        float vd = int_d + gains.p_gain * err_d;
+        float vq = int_q + gains.p_gain * err_q;
+        current_pi_integrate(&int_d, &int_q, err_d, err_q, gains.p_gain, gains.i_gain, controller_vel, Ts);
+        for (int j = 0; j < substeps; ++j) {
+            float did = (vd_applied - R * id + phase_vel * L * iq) / L;
+            float diq = (vq_applied - R * iq - phase_vel * L * id) / L;
+            id += did * h;
+            iq += diq * h;
+        }
+        vd_applied = vd;
+        vq_applied = vq;
+        response->add(iq, Ts);
+        max_id = std::max(max_id, std::abs(id));
+    }
+    return max_id;
+}
+
+TEST_SUITE("CurrentLoopTuning") {
+    TEST_CASE("ideal design") {
+        CurrentPiGains_t gains = current_pi_gains(L, R, 1000.0f, 0.0f);
+        CHECK(gains.p_gain == doctest::Approx(1000.0f * L));
+        CHECK(gains.i_gain == doctest::Approx(1000.0f * R));
+    }
+
+    TEST_CASE("delay aware design hits the requested bandwidth") {
+        const float delay = 1.5f * Ts;
+        for (float bandwidth : {500.0f, 2000.0f, 3000.0f}) {
+            CurrentPiGains_t gains = current_pi_gains(L, R, bandwidth, delay);
+            float wc = gains.p_gain / L;
+            CHECK(wc < bandwidth);
+            CHECK(gains.i_gain / gains.p_gain == doctest::Approx(R / L));
+            CHECK(current_loop_closed_loop_gain(wc, delay, bandwidth) == doctest::Approx(0.70710678f).epsilon(1e-3));
+        }
+        // Capped at 45 degrees of phase margin
+        CurrentPiGains_t gains = current_pi_gains(L, R, 20000.0f, delay);
+        CHECK(gains.p_gain / L * delay == doctest::Approx(0.25f * 3.14159265f));
+    }
+
+    TEST_CASE("delay aware design overshoots less") {
+        const float bandwidth = 3000.0f;
+        StepResponse ideal = simulate_step(current_pi_gains(L, R, bandwidth, 0.0f), 1.0f);
+        StepResponse aware = simulate_step(current_pi_gains(L, R, bandwidth, 1.5f * Ts), 1.0f);
+        REQUIRE(ideal.complete());
+        REQUIRE(aware.complete());
+        CHECK(ideal.overshoot() > 0.1f);
+        CHECK(aware.overshoot() < ideal.overshoot());
+        CHECK(ideal.bandwidth() > bandwidth * 1.2f); // faster and oscillating
+        CHECK(aware.bandwidth() < ideal.bandwidth());
+    }
+
+    TEST_CASE("step response of a first order system") {
+        const float tau = 1e-3f, dt = 1e-5f;
+        StepResponse response;
+        response.reset(2.0f, -1.0f); // a step down works the same
+        CHECK_FALSE(response.complete());
+        CHECK(response.bandwidth() == 0.0f);
+        for (int k = 1; k <= 1000; ++k)
+            response.add(2.0f - 3.0f * (1.0f - std::exp(-k * dt / tau)), dt);
+        REQUIRE(response.complete());
+        CHECK(response.bandwidth() == doctest::Approx(1.0f / tau).epsilon(0.01));
+        CHECK(response.overshoot() == 0.0f);
+    }
+
+    TEST_CASE("overshoot of a second order system") {
+        const float zeta = 0.5f, wn = 1000.0f, dt = 1e-6f;
+        float wd = wn * std::sqrt(1.0f - zeta * zeta);
+        StepResponse response;
+        response.reset(0.0f, 1.0f);
+        for (int k = 1; k <= 20000; ++k) {
+            float t = k * dt;
+            float y = 1.0f - std::exp(-zeta * wn * t) * (std::cos(wd * t) + zeta / std::sqrt(1.0f - zeta * zeta) * std::sin(wd * t));
+            response.add(y, dt);
+        }
+        CHECK(response.overshoot() == doctest::Approx(std::exp(-3.14159265f * zeta / std::sqrt(1.0f - zeta * zeta))).epsilon(0.01));
+    }
+
+    TEST_CASE("complex vector PI decouples the axes at speed") {
+        CurrentPiGains_t gains = current_pi_gains(L, R, 1000.0f, 1.5f * Ts);
+        const float phase_vel = 5000.0f; // [rad/s electrical]
+        StepResponse plain, complex_vector, standstill;
+        float id_plain = simulate_cross_coupling(gains, phase_vel, 0.0f, &plain);
+        float id_complex = simulate_cross_coupling(gains, phase_vel, phase_vel, &complex_vector);
+        simulate_cross_coupling(gains, 0.0f, 0.0f, &standstill);
+        CHECK(id_complex < 0.5f * id_plain);
+        CHECK(complex_vector.overshoot() < plain.overshoot());
+        // The response at speed stays close to the one at standstill
+        CHECK(complex_vector.bandwidth() == doctest::Approx(standstill.bandwidth()).epsilon(0.2));
+    }
+
+    TEST_CASE("complex vector integrator at standstill is the plain one") {
+        float int_d = 1.0f, int_q = 2.0f;
+        current_pi_integrate(&int_d, &int_q, 0.5f, -0.5f, 0.02f, 50.0f, 0.0f, 1e-3f);
+        CHECK(int_d == doctest::Approx(1.025f));
+        CHECK(int_q == doctest::Approx(1.975f));
+    }
+}
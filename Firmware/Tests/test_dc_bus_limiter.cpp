@@ -0,0 +1,101 @@
+#include <doctest.h>
+
+#include "MotorControl/dc_bus_limiter.hpp"
+
+#include <cmath>
+
+TEST_SUITE("DcBusLimiter") {
+    static DcBusLimiter::Config_t make_config() {
+        return {10.0f, 5.0f, INFINITY, INFINITY};
+    }
+
+    // A motor whose bus current is k * torque plus a loss the limiter
+    // doesn't know about
+    struct Motor_t {
+        float k;           // [A/Nm]
+        float torque_cmd;  // [Nm]
+        float torque = 0.0f;
+        float ibus() const { return k * torque + 0.5f * std::abs(torque); }
+        void step(const DcBusLimiter& limiter) {
+            float tmin, tmax;
+            limiter.torque_range(torque, k, &tmin, &tmax);
+            torque = std::clamp(torque_cmd, tmin, tmax);
+        }
+    };
+
+    TEST_CASE("unlimited") {
+        DcBusLimiter limiter;
+        float tmin, tmax;
+        limiter.torque_range(1.0f, 2.0f, &tmin, &tmax);
+        CHECK(std::isinf(tmin));
+        CHECK(std::isinf(tmax));
+        limiter.update(make_config(), 1.0f, 24.0f, 1);
+        limiter.torque_range(1.0f, 0.0f, &tmin, &tmax); // at standstill
+        CHECK(std::isinf(tmax));
+        CHECK(!limiter.active());
+    }
+
+    TEST_CASE("settles at the motoring limit") {
+        DcBusLimiter limiter;
+        Motor_t motor = {4.0f, 10.0f};
+        float max_ibus = 0.0f;
+        for (int i = 0; i < 100; ++i) {
+            limiter.update(make_config(), motor.ibus(), 24.0f, 1);
+            motor.step(limiter);
+            max_ibus = std::max(max_ibus, motor.ibus());
+        }
+        CHECK(motor.ibus() == doctest::Approx(10.0f).epsilon(1e-3));
+        CHECK(max_ibus < 10.01f);
+        CHECK(limiter.active());
+
+        // Released when the demand drops
+        motor.torque_cmd = 1.0f;
+        limiter.update(make_config(), motor.ibus(), 24.0f, 1);
+        motor.step(limiter);
+        CHECK(motor.torque == 1.0f);
+    }
+
+    TEST_CASE("regen and power limits") {
+        DcBusLimiter limiter;
+        DcBusLimiter::Config_t config = make_config();
+        config.power_limit = 120.0f; // 5A at 24V
+        Motor_t motor = {-4.0f, -10.0f}; // spinning backwards
+        for (int i = 0; i < 100; ++i) {
+            limiter.update(config, motor.ibus(), 24.0f, 1);
+            motor.step(limiter);
+        }
+        CHECK(motor.ibus() == doctest::Approx(5.0f).epsilon(1e-3));
+
+        // Braking, the loss helps
+        motor = {4.0f, -10.0f};
+        for (int i = 0; i < 100; ++i) {
+            limiter.update(config, motor.ibus(), 24.0f, 1);
+            motor.step(limiter);
+        }
+        CHECK(motor.ibus() == doctest::Approx(-5.0f).epsilon(1e-3));
+        CHECK(motor.torque < 0.0f);
+    }
+
+    TEST_CASE("shares the bus between motors") {
+        DcBusLimiter limiter;
+        Motor_t a = {4.0f, 10.0f};
+        Motor_t b = {2.0f, 10.0f};
+        float max_ibus = 0.0f;
+        for (int i = 0; i < 200; ++i) {
+            limiter.update(make_config(), a.ibus() + b.ibus(), 24.0f, 2);
+            a.step(limiter);
+            b.step(limiter);
+            max_ibus = std::max(max_ibus, a.ibus() + b.ibus());
+        }
+        CHECK(a.ibus() + b.ibus() == doctest::Approx(10.0f).epsilon(1e-3));
+        CHECK(max_ibus < 10.01f);
+
+        // A motor that would have to reverse to bring the bus back is only
+        // stopped
+        limiter.update(make_config(), 30.0f, 24.0f, 2);
+        float tmin, tmax;
+        limiter.torque_range(0.1f, 4.0f, &tmin, &tmax);
+        CHECK(tmax == 0.0f);
+        CHECK(tmin < 0.0f);
+    }
+}
@@ -0,0 +1,62 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/dc_bus_regulator.hpp"
+
+// DC bus with a capacitor, a brake resistor and a supply that can't sink
+// current. The regenerated current is scaled by the regen_scale() of the
+// regulator, like the torque limit in the controller. It ramps up over
+// 10ms, the torque doesn't change faster than that on an axis with a large
+// inertia.
+struct DcBusSim {
+    float run(DcBusVoltageRegulator& reg, float I_regen, float seconds) {
+        float max_vbus = vbus;
+        for (int i = 0; i < (int)(seconds / dt); ++i) {
+            float duty = reg.update(config, vbus, 0.0f, dt);
+            float ramp = std::min(i * dt / 0.01f, 1.0f);
+            float I = ramp * I_regen * reg.regen_scale() - duty * vbus / R_brake;
+            vbus = std::max(vbus + I / C * dt, V_supply);
+            max_vbus = std::max(max_vbus, vbus);
+        }
+        return max_vbus;
+    }
+
+    const float dt = 1.0f / 16000.0f;
+    const float C = 2e-3f; // [F]
+    const float R_brake = 2.0f; // [Ohm]
+    const float V_supply = 24.0f; // [V]
+    DcBusVoltageRegulator::Config_t config = {24.96f, 1.0f, 1000.0f, 25.68f, 0.95f};
+    float vbus = V_supply;
+};
+
+TEST_SUITE("DcBusVoltageRegulator") {
+    TEST_CASE("holds the setpoint without feedforward") {
+        DcBusSim sim;
+        DcBusVoltageRegulator reg;
+        float max_vbus = sim.run(reg, 5.0f, 0.2f);
+        CHECK(max_vbus < sim.config.trip_level);
+        CHECK(sim.vbus == doctest::Approx(sim.config.setpoint).epsilon(0.002));
+        CHECK(reg.regen_scale() == doctest::Approx(1.0f));
+
+        // The integrator winds down once the regeneration stops
+        sim.run(reg, 0.0f, 0.2f);
+        CHECK(reg.integrator() == 0.0f);
+        CHECK(reg.correction(sim.config, sim.vbus) == 0.0f);
+    }
+
+    TEST_CASE("limits the regeneration when the resistor saturates") {
+        DcBusSim sim;
+        DcBusVoltageRegulator reg;
+        // 0.95 * 25V / 2 Ohm = 11.9A is all the resistor takes
+        float max_vbus = sim.run(reg, 20.0f, 0.5f);
+        CHECK(max_vbus < sim.config.trip_level);
+        CHECK(reg.regen_scale() == doctest::Approx(11.9f / 20.0f).epsilon(0.05));
+    }
+
+    TEST_CASE("doesn't reduce the feedforward") {
+        DcBusSim sim;
+        DcBusVoltageRegulator reg;
+        CHECK(reg.update(sim.config, 24.0f, 0.3f, sim.dt) == doctest::Approx(0.3f));
+        CHECK(reg.update(sim.config, 24.0f, 2.0f, sim.dt) == doctest::Approx(0.95f));
+    }
+}
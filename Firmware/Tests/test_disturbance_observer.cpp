@@ -0,0 +1,55 @@
+#include <doctest.h>
+
+#include "MotorControl/disturbance_observer.hpp"
+
+#include <algorithm>
+
+// Velocity loop on an inertia with a load step at t = 0.2s
+// @returns largest velocity error after the step
+static float simulate_load_step(const DisturbanceObserver::Config_t& config, DisturbanceObserver& observer) {
+    const float dt = 1.0f / 8000.0f;
+    const float inertia = 0.01f; // [Nm/(turn/s^2)]
+    const float vel_gain = 0.2f, vel_integrator_gain = 1.0f;
+    const float vel_setpoint = 10.0f;
+    float vel = vel_setpoint, integrator = 0.0f, torque = 0.0f;
+    float max_err = 0.0f;
+    observer.reset();
+    for (int k = 0; k < 8000; ++k) {
+        float load = k * dt >= 0.2f ? -1.0f : 0.0f;
+        vel += (torque + load) / inertia * dt;
+
+        float load_est = observer.update(config, inertia, torque, vel, dt);
+        float err = vel_setpoint - vel;
+        integrator += vel_integrator_gain * err * dt;
+        torque = vel_gain * err + integrator - config.feedforward_gain * load_est;
+        max_err = std::max(max_err, std::abs(err));
+    }
+    return max_err;
+}
+
+TEST_SUITE("DisturbanceObserver") {
+    TEST_CASE("estimates the load torque") {
+        DisturbanceObserver::Config_t config;
+        DisturbanceObserver observer;
+        simulate_load_step(config, observer);
+        CHECK(observer.load_torque() == doctest::Approx(-1.0f).epsilon(0.01));
+    }
+
+    TEST_CASE("no estimate at constant speed without load") {
+        const float dt = 1.0f / 8000.0f;
+        DisturbanceObserver::Config_t config;
+        DisturbanceObserver observer;
+        for (int k = 0; k < 1000; ++k)
+            CHECK(observer.update(config, 0.01f, 0.0f, 5.0f, dt) == doctest::Approx(0.0f));
+    }
+
+    TEST_CASE("feedforward shrinks the velocity dip") {
+        DisturbanceObserver::Config_t config;
+        DisturbanceObserver observer;
+        float err_without = simulate_load_step(config, observer);
+        config.feedforward_gain = 1.0f;
+        float err_with = simulate_load_step(config, observer);
+        CHECK(err_with < 0.3f * err_without);
+        CHECK(observer.load_torque() == doctest::Approx(-1.0f).epsilon(0.01));
+    }
+}
@@ -0,0 +1,87 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/dual_loop.hpp"
+
+// Splits a position like Encoder::pos_estimate_turns_ and pos_estimate_in_turn_
+static void split(double pos, int32_t* turns, float* in_turn) {
+    double t = std::floor(pos);
+    *turns = (int32_t)t;
+    *in_turn = (float)(pos - t);
+}
+
+static float step(DualLoopEstimator& est, const DualLoopEstimator::Config_t& config,
+                  double load, double motor, float torque, float vel_setpoint, float dt = 0.001f) {
+    int32_t lt, mt;
+    float lf, mf;
+    split(load, &lt, &lf);
+    split(motor, &mt, &mf);
+    return est.update(config, lt, lf, mt, mf, torque, vel_setpoint, dt);
+}
+
+TEST_SUITE("DualLoopEstimator") {
+    TEST_CASE("load encoder only without a bandwidth") {
+        DualLoopEstimator est;
+        DualLoopEstimator::Config_t config;
+        config.ratio = 0.25f;
+        for (int i = 0; i < 100; ++i)
+            CHECK(step(est, config, 0.01 * i, 0.03 * i + 17.0, 1.0f, 1.0f) == doctest::Approx(0.0f));
+    }
+
+    TEST_CASE("follows the motor above and the load below the bandwidth") {
+        DualLoopEstimator est;
+        DualLoopEstimator::Config_t config;
+        config.ratio = 0.5f;
+        config.bandwidth = 1.0f;
+        CHECK(step(est, config, 100.0, -3000.0, 0.0f, 0.0f) == 0.0f);
+
+        // The load gets stuck for a moment while the motor moves 0.1 turn:
+        // the feedback follows the motor prediction at first
+        float offset = 0.0f;
+        for (int i = 1; i <= 10; ++i)
+            offset = step(est, config, 100.0, -3000.0 + 0.01 * i, 0.0f, 0.0f);
+        CHECK(offset == doctest::Approx(0.05f).epsilon(0.05));
+
+        // and converges to the load encoder
+        for (int i = 0; i < 5000; ++i)
+            offset = step(est, config, 100.0, -2999.9, 0.0f, 0.0f);
+        CHECK(std::abs(offset) < 1e-4f);
+    }
+
+    TEST_CASE("compensated compliance and backlash don't disturb the feedback") {
+        DualLoopEstimator est;
+        DualLoopEstimator::Config_t config;
+        config.ratio = 2.0f;
+        config.bandwidth = 0.5f;
+        config.compliance = 0.001f;
+        config.backlash = 0.02f;
+        float max_offset = 0.0f;
+        // Load lags the scaled motor by the wind-up and half the backlash
+        auto load_of = [&](double motor, float torque, float dir) {
+            return config.ratio * (motor - config.compliance * torque) - 0.5 * config.backlash * dir;
+        };
+        double motor = 10.0;
+        step(est, config, load_of(motor, 0.0f, 0.0f), motor, 0.0f, 0.0f);
+        for (int i = 0; i < 2000; ++i) {
+            float dir = (i / 500) % 2 ? -1.0f : 1.0f; // reverses every 0.5 s
+            float torque = 2.0f * dir;
+            motor += 0.001 * dir;
+            float offset = step(est, config, load_of(motor, torque, dir), motor, torque, dir);
+            max_offset = std::max(max_offset, std::abs(offset));
+        }
+        CHECK(max_offset < 1e-4f);
+    }
+
+    TEST_CASE("long travel keeps the resolution") {
+        DualLoopEstimator est;
+        DualLoopEstimator::Config_t config;
+        config.bandwidth = 2.0f;
+        double pos = 1e6;
+        float offset = 0.0f;
+        for (int i = 0; i < 10000; ++i) {
+            pos += 0.0123;
+            offset = step(est, config, pos, pos - 5e5, 0.0f, 1.0f);
+        }
+        CHECK(std::abs(offset) < 1e-4f);
+    }
+}
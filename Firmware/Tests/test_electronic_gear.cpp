@@ -0,0 +1,107 @@
+#include <doctest.h>
+
+#include "MotorControl/electronic_gear.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+TEST_SUITE("ElectronicGear") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("follows the master with the ratio") {
+        ElectronicGear::Config_t config;
+        config.ratio = -2.0f;
+        config.engage_time = 0.0f;
+        ElectronicGear gear;
+        ElectronicGear::Setpoint_t sp = gear.update(config, 3.0f, 0.0f, 1.0f, dt);
+        CHECK(sp.pos == doctest::Approx(1.0f)); // keeps its position on engagement
+        sp = gear.update(config, 3.5f, 4.0f, 0.0f, dt);
+        CHECK(sp.pos == doctest::Approx(0.0f));
+        CHECK(sp.vel == doctest::Approx(-8.0f));
+
+        // A new ratio continues from the current position
+        config.ratio = 1.0f;
+        sp = gear.update(config, 3.75f, 4.0f, 0.0f, dt);
+        CHECK(sp.pos == doctest::Approx(0.25f));
+        CHECK(sp.vel == doctest::Approx(4.0f));
+    }
+
+    TEST_CASE("ramps the ratio on engagement") {
+        ElectronicGear::Config_t config;
+        config.ratio = 2.0f;
+        config.engage_time = 0.5f;
+        ElectronicGear gear;
+        const float master_vel = 1.0f;
+        float master = 10.0f, last_pos = 0.0f, max_step = 0.0f;
+        ElectronicGear::Setpoint_t sp = {};
+        for (int k = 0; k < 8000; ++k) {
+            sp = gear.update(config, master, master_vel, 0.0f, dt);
+            if (k > 0)
+                max_step = std::max(max_step, sp.pos - last_pos);
+            last_pos = sp.pos;
+            if (k == 2000) // halfway through the ramp
+                CHECK(sp.vel == doctest::Approx(1.0f).epsilon(0.01));
+            master += master_vel * dt;
+        }
+        CHECK(gear.engagement() == 1.0f);
+        CHECK(sp.vel == doctest::Approx(2.0f));
+        CHECK(max_step <= 2.0f * master_vel * dt * 1.01f);
+        // Half of the ramp time was lost at an average of half the ratio
+        CHECK(sp.pos == doctest::Approx(2.0f * (1.0f - 0.25f)).epsilon(0.01));
+    }
+
+    TEST_CASE("rotary cam") {
+        ElectronicGear::Config_t config;
+        config.engage_time = 0.0f;
+        config.cam_enable = true;
+        config.cam_period = 2.0f;
+        config.cam_rise = 1.0f;
+        // Dwell for the first half of the period, then rise by 1
+        for (size_t i = 0; i < ElectronicGear::cam_table_size; ++i) {
+            float x = (float)i / (float)ElectronicGear::cam_table_size;
+            config.cam_table[i] = x < 0.5f ? 0.0f : 2.0f * (x - 0.5f);
+        }
+        ElectronicGear gear;
+        gear.update(config, 0.0f, 0.0f, 0.0f, dt);
+        CHECK(gear.update(config, 0.5f, 1.0f, 0.0f, dt).pos == doctest::Approx(0.0f));
+        ElectronicGear::Setpoint_t sp = gear.update(config, 1.5f, 1.0f, 0.0f, dt);
+        CHECK(sp.pos == doctest::Approx(0.5f));
+        CHECK(sp.vel == doctest::Approx(1.0f));
+        // Continuous across the cycles, in both directions
+        CHECK(gear.update(config, 4.0f, 1.0f, 0.0f, dt).pos == doctest::Approx(2.0f));
+        CHECK(gear.update(config, 5.5f, 1.0f, 0.0f, dt).pos == doctest::Approx(2.5f));
+        CHECK(gear.update(config, -0.5f, 1.0f, 0.0f, dt).pos == doctest::Approx(-0.5f));
+        CHECK(gear.update(config, -1.0f, 1.0f, 0.0f, dt).pos == doctest::Approx(-1.0f));
+    }
+
+    TEST_CASE("reciprocating cam stays bounded") {
+        ElectronicGear::Config_t config;
+        config.engage_time = 0.0f;
+        config.ratio = 0.1f;
+        config.cam_enable = true;
+        for (size_t i = 0; i < ElectronicGear::cam_table_size; ++i)
+            config.cam_table[i] = std::sin(2.0f * 3.14159265f * (float)i / (float)ElectronicGear::cam_table_size);
+        ElectronicGear gear;
+        float min = INFINITY, max = -INFINITY;
+        for (int k = 0; k < 8000; ++k) {
+            float pos = gear.update(config, 10.0f * k * dt, 10.0f, 0.0f, dt).pos;
+            min = std::min(min, pos);
+            max = std::max(max, pos);
+        }
+        CHECK(min == doctest::Approx(-0.1f).epsilon(0.01));
+        CHECK(max == doctest::Approx(0.1f).epsilon(0.01));
+    }
+
+    TEST_CASE("filters the velocity feedforward") {
+        ElectronicGear::Config_t config;
+        config.engage_time = 0.0f;
+        config.vel_filter_bandwidth = 10.0f;
+        ElectronicGear gear;
+        gear.update(config, 0.0f, 0.0f, 0.0f, dt);
+        float vel = 0.0f;
+        for (int k = 0; k < 80; ++k) // 10ms, below the filter time constant
+            vel = gear.update(config, 0.0f, 1.0f, 0.0f, dt).vel;
+        CHECK(vel > 0.3f);
+        CHECK(vel < 0.6f);
+    }
+}
@@ -0,0 +1,67 @@
+#include <doctest.h>
+
+#include "MotorControl/fast_torque_window.hpp"
+
+#include <algorithm>
+
+// The torque chain of Controller::update in torque control: an additive
+// feedforward, the velocity limit and the torque limit
+struct TorqueChain {
+    float feedforward, vel_lo, vel_hi, torque_lim_neg, torque_lim_pos;
+
+    float run(float input, FastTorqueWindow* window, uint32_t seq) const {
+        window->begin(true, input, seq);
+        float torque = input + feedforward;
+        torque = window->clamp(torque, vel_lo, vel_hi);
+        window->narrow(torque, -torque_lim_neg, torque_lim_pos);
+        if (torque > torque_lim_pos)
+            torque = torque_lim_pos;
+        if (torque < -torque_lim_neg)
+            torque = -torque_lim_neg;
+        window->end(torque);
+        return torque;
+    }
+};
+
+TEST_SUITE("FastTorqueWindow") {
+    TEST_CASE("new inputs map to the output of the chain") {
+        const TorqueChain chains[] = {
+            {0.0f, -1e9f, 1e9f, 5.0f, 5.0f},  // torque limit only
+            {0.2f, -1.0f, 2.0f, 5.0f, 5.0f},  // velocity limit inside the torque limit
+            {-0.1f, -3.0f, 3.0f, 1.0f, 2.0f}, // overlapping
+            {0.0f, 3.0f, 4.0f, 1.0f, 2.0f},   // disjoint, the torque limit wins
+            {0.0f, -4.0f, -3.0f, 1.0f, 2.0f},
+        };
+        for (const TorqueChain& chain : chains) {
+            for (float first : {-6.0f, -0.5f, 0.0f, 1.5f, 6.0f}) {
+                FastTorqueWindow window;
+                float output = chain.run(first, &window, 1);
+                CHECK(window.output() == output);
+                for (float next = -6.0f; next <= 6.0f; next += 0.25f) {
+                    float torque = 0.0f;
+                    REQUIRE(window.apply(2, next, &torque));
+                    FastTorqueWindow reference;
+                    CHECK(torque == doctest::Approx(chain.run(next, &reference, 2)));
+                }
+            }
+        }
+    }
+
+    TEST_CASE("inactive") {
+        FastTorqueWindow window;
+        float torque = 0.0f;
+        CHECK(!window.apply(1, 1.0f, &torque));
+
+        window.begin(true, 1.0f, 7);
+        window.end(1.5f);
+        CHECK(!window.apply(7, 2.0f, &torque)); // the loop already used this input
+        REQUIRE(window.apply(8, 2.0f, &torque));
+        CHECK(torque == doctest::Approx(2.5f));
+
+        window.invalidate();
+        CHECK(!window.apply(8, 2.0f, &torque));
+        window.begin(false, 1.0f, 7);
+        window.end(1.0f);
+        CHECK(!window.apply(8, 2.0f, &torque));
+    }
+}
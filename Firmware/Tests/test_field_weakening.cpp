@@ -0,0 +1,49 @@
+#include <doctest.h>
+
+#include "MotorControl/field_weakening.hpp"
+
+TEST_SUITE("FieldWeakening") {
+    TEST_CASE("no injection below the setpoint") {
+        FieldWeakening fw;
+        FieldWeakening::Config_t config;
+        config.enable = true;
+        for (int i = 0; i < 1000; ++i)
+            CHECK(fw.update(config, 0.8f, 20.0f, 1e-4f) == 0.0f);
+    }
+
+    TEST_CASE("injects negative Id while the voltage runs out and winds back") {
+        FieldWeakening fw;
+        FieldWeakening::Config_t config;
+        config.enable = true;
+        config.gain = 1000.0f;
+        config.max_current = 5.0f;
+        float id = 0.0f;
+        for (int i = 0; i < 100; ++i)
+            id = fw.update(config, 0.96f, 20.0f, 1e-3f);
+        CHECK(id == doctest::Approx(-1.0f).epsilon(0.01)); // 100 ms * 1000 A/s * 0.01
+        for (int i = 0; i < 2000; ++i)
+            id = fw.update(config, 1.2f, 20.0f, 1e-3f);
+        CHECK(id == -5.0f); // max_current
+        CHECK(fw.update(config, 1.2f, 3.0f, 1e-3f) == -3.0f); // current_lim
+        for (int i = 0; i < 2000; ++i)
+            id = fw.update(config, 0.5f, 20.0f, 1e-3f);
+        CHECK(id == 0.0f);
+    }
+
+    TEST_CASE("disabled") {
+        FieldWeakening fw;
+        FieldWeakening::Config_t config;
+        config.enable = true;
+        fw.update(config, 2.0f, 20.0f, 1e-3f);
+        CHECK(fw.Id() < 0.0f);
+        config.enable = false;
+        CHECK(fw.update(config, 2.0f, 20.0f, 1e-3f) == 0.0f);
+    }
+
+    TEST_CASE("q axis current on the current limit circle") {
+        CHECK(max_Iq_for_current_lim(0.0f, 10.0f) == doctest::Approx(10.0f));
+        CHECK(max_Iq_for_current_lim(-6.0f, 10.0f) == doctest::Approx(8.0f));
+        CHECK(max_Iq_for_current_lim(10.0f, 10.0f) == 0.0f);
+        CHECK(max_Iq_for_current_lim(12.0f, 10.0f) == 0.0f);
+    }
+}
@@ -0,0 +1,68 @@
+#include <doctest.h>
+#include <cmath>
+#include <complex>
+
+#include "MotorControl/frequency_response.hpp"
+
+// A first order lag y[k+1] = a * y[k] + (1 - a) * x[k] around an offset, so
+// that y[k] is sampled before x[k] takes effect
+struct SampledLag {
+    float a;
+    float offset;
+    float y = 0.0f;
+
+    std::complex<float> response(float freq, float dt) const {
+        std::complex<float> z_inv = std::polar(1.0f, -2.0f * 3.14159265f * freq * dt);
+        return (1.0f - a) * z_inv / (1.0f - a * z_inv);
+    }
+};
+
+static void run(FrequencyResponseAnalyzer* analyzer, SampledLag* plant) {
+    for (uint32_t i = 0; i < 100000000 && analyzer->active(); ++i) {
+        float x = analyzer->excitation();
+        analyzer->update(plant->offset + plant->y, 2.0f * x + 0.5f);
+        plant->y = plant->a * plant->y + (1.0f - plant->a) * x;
+    }
+}
+
+TEST_SUITE("FrequencyResponseAnalyzer") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("bode table of a first order lag") {
+        FrequencyResponseAnalyzer analyzer;
+        REQUIRE(analyzer.start(0.1f, 2.0f, 500.0f, 12, 3.0f, 4, dt));
+        SampledLag plant = {0.98f, 12.0f};
+        run(&analyzer, &plant);
+
+        REQUIRE(analyzer.num_points() == 12);
+        CHECK(analyzer.point(0).freq == doctest::Approx(2.0f).epsilon(0.01));
+        CHECK(analyzer.point(11).freq == doctest::Approx(500.0f).epsilon(0.01));
+        for (size_t i = 0; i < analyzer.num_points(); ++i) {
+            FrequencyResponseAnalyzer::Bode_t row = analyzer.bode(i);
+            std::complex<float> expected = plant.response(row.freq, dt);
+            CHECK(row.gain == doctest::Approx(std::abs(expected)).epsilon(0.01));
+            CHECK(row.phase == doctest::Approx(std::arg(expected) * 180.0f / 3.14159265f).epsilon(0.01));
+            CHECK(row.torque_gain == doctest::Approx(2.0f).epsilon(1e-3));
+            CHECK(std::abs(row.torque_phase) < 0.1f);
+            if (i > 0)
+                CHECK(row.freq > analyzer.bode(i - 1).freq);
+        }
+    }
+
+    TEST_CASE("invalid parameters") {
+        FrequencyResponseAnalyzer analyzer;
+        CHECK(!analyzer.start(0.0f, 1.0f, 10.0f, 8, 1.0f, 2, dt));
+        CHECK(!analyzer.start(0.1f, 10.0f, 1.0f, 8, 1.0f, 2, dt));
+        CHECK(!analyzer.start(0.1f, 1.0f, 4000.0f, 8, 1.0f, 2, dt)); // above a quarter of the update rate
+        CHECK(!analyzer.start(0.1f, 1.0f, 10.0f, FrequencyResponseAnalyzer::max_points + 1, 1.0f, 2, dt));
+        CHECK(!analyzer.start(0.1f, 1.0f, 10.0f, 8, 1.0f, 0, dt));
+        CHECK(!analyzer.active());
+        CHECK(analyzer.excitation() == 0.0f);
+
+        REQUIRE(analyzer.start(0.1f, 50.0f, 50.0f, 1, 0.0f, 1, dt));
+        SampledLag plant = {0.5f, 0.0f};
+        run(&analyzer, &plant);
+        CHECK(analyzer.num_points() == 1);
+        CHECK(!analyzer.active());
+    }
+}
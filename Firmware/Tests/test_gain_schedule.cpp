@@ -0,0 +1,56 @@
+#include <doctest.h>
+
+#include "MotorControl/gain_schedule.hpp"
+
+TEST_SUITE("GainSchedule") {
+    TEST_CASE("unity by default") {
+        GainSchedule schedule;
+        for (float vel : {0.0f, 1.0f, -100.0f}) {
+            GainSchedule::Scales_t s = schedule.eval(vel, 1.0f);
+            CHECK(s.pos_gain == 1.0f);
+            CHECK(s.vel_gain == 1.0f);
+            CHECK(s.vel_integrator_gain == 1.0f);
+        }
+    }
+
+    TEST_CASE("interpolates the breakpoints") {
+        GainSchedule::Config_t config;
+        config.points[0] = {1.0f, 2.0f, 1.5f, 3.0f};
+        config.points[1] = {5.0f, 1.0f, 1.0f, 1.0f};
+        config.points[2] = {9.0f, 0.5f, 0.8f, 0.2f};
+        config.points[3] = {0.0f, 9.0f, 9.0f, 9.0f}; // not faster, ignored
+        GainSchedule schedule;
+        schedule.build(config);
+
+        CHECK(schedule.eval(0.0f, 0.0f).pos_gain == doctest::Approx(2.0f));  // held below the first point
+        CHECK(schedule.eval(-0.5f, 0.0f).vel_integrator_gain == doctest::Approx(3.0f));
+        CHECK(schedule.eval(3.0f, 0.0f).pos_gain == doctest::Approx(1.5f).epsilon(0.01));
+        CHECK(schedule.eval(-3.0f, 0.0f).vel_gain == doctest::Approx(1.25f).epsilon(0.01));
+        CHECK(schedule.eval(7.0f, 0.0f).vel_integrator_gain == doctest::Approx(0.6f).epsilon(0.01));
+        CHECK(schedule.eval(9.0f, 0.0f).pos_gain == doctest::Approx(0.5f));
+        CHECK(schedule.eval(50.0f, 0.0f).vel_gain == doctest::Approx(0.8f)); // held above the last point
+
+        // Monotonic between breakpoints
+        float prev = schedule.eval(1.0f, 0.0f).vel_integrator_gain;
+        for (float vel = 1.1f; vel < 9.0f; vel += 0.1f) {
+            float s = schedule.eval(vel, 0.0f).vel_integrator_gain;
+            CHECK(s <= prev + 1e-6f);
+            prev = s;
+        }
+    }
+
+    TEST_CASE("load index scales the gains") {
+        GainSchedule::Config_t config;
+        config.points[0] = {0.0f, 1.0f, 2.0f, 1.0f};
+        config.load_pos_gain = 0.5f;
+        config.load_vel_gain = 2.0f;
+        GainSchedule schedule;
+        schedule.build(config);
+        GainSchedule::Scales_t s = schedule.eval(3.0f, 0.5f);
+        CHECK(s.pos_gain == doctest::Approx(0.75f));
+        CHECK(s.vel_gain == doctest::Approx(3.0f));
+        CHECK(s.vel_integrator_gain == doctest::Approx(1.0f));
+        CHECK(schedule.eval(3.0f, 2.0f).pos_gain == doctest::Approx(0.5f)); // clamped to 1
+        CHECK(schedule.eval(3.0f, -1.0f).vel_gain == doctest::Approx(2.0f));
+    }
+}
@@ -0,0 +1,148 @@
+#include <doctest.h>
+#include <cmath>
+#include <stdint.h>
+
+#include "Tests/control_loop_model.hpp"
+#include "Tests/golden_trace.hpp"
+
+// Golden trace regression tests of the control path numerics. The input
+// sequences are synthetic but deterministic and recorded along with the
+// outputs, so a change of the inputs shows up as well. After an intentional
+// change of the numerics, update the traces with GOLDEN_TRACE_UPDATE=1 and
+// justify the diff.
+
+static const float dt = 1.0f / 8000.0f;
+
+// The longer traces are recorded decimated to keep the files small, a
+// deviation propagates into the recorded samples anyway
+
+// Deterministic noise in [-1, 1), independent of the standard library
+struct Noise {
+    float next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (float)(state >> 8) * (2.0f / 16777216.0f) - 1.0f;
+    }
+    uint32_t state = 0x12345678;
+};
+
+// Phase currents, rotor phase and bus voltage of a motor spinning up, with
+// a current step that saturates the modulation on a sagging bus.
+// @param timing_offset: Added to the SVM timings, to check that the traces
+// catch a changed modulation
+static GoldenTrace foc_current_trace(float timing_offset = 0.0f) {
+    GoldenTrace trace({"Ia", "Ib", "Ic", "vbus", "phase", "Id", "Iq", "Vd", "Vq",
+                       "mod_alpha", "mod_beta", "Ibus", "tA", "tB", "tC", "valid"});
+    trace.tolerance("Ia", 1e-5f).tolerance("Ib", 1e-5f).tolerance("Ic", 1e-5f)
+         .tolerance("vbus", 1e-5f).tolerance("phase", 1e-5f)
+         .tolerance("Id", 1e-4f).tolerance("Iq", 1e-4f).tolerance("Vd", 1e-4f).tolerance("Vq", 1e-4f)
+         .tolerance("mod_alpha", 1e-5f).tolerance("mod_beta", 1e-5f).tolerance("Ibus", 1e-4f)
+         .tolerance("tA", 1e-5f).tolerance("tB", 1e-5f).tolerance("tC", 1e-5f);
+
+    const float L = 200e-6f, R = 0.2f, bandwidth = 2000.0f;
+    FocCurrentModel foc(bandwidth * L, R / L * bandwidth * L, dt);
+    Noise noise;
+    double Iq_actual = 0.0;
+    for (int i = 0; i < 400; ++i) {
+        if (i == 200) {
+            foc.overmodulation_enable = true;
+            foc.max_modulation = two_by_sqrt3;
+        }
+        float Iq_des = i < 100 ? 5.0f : i < 200 ? 40.0f : i < 250 ? 60.0f : -10.0f;
+        float vbus = (float)((i < 150 ? 24.0 : 8.0) + 0.2 * std::sin(0.3 * i));
+        // The inputs are computed in double precision, so that they don't
+        // depend on the floating point contraction of the compiler.
+        // The measured current lags the setpoint with the current control
+        // bandwidth, the rotor accelerates at 2e5 rad/s^2.
+        Iq_actual += (Iq_des - Iq_actual) * (double)(bandwidth * dt);
+        double t = (i + 1) * (double)dt;
+        float phase_vel = (float)(2e5 * t);
+        float phase = (float)std::remainder(1e5 * t * t, 2.0 * M_PI);
+        float i_alpha = (float)(-std::sin(phase) * Iq_actual) + 0.05f * noise.next();
+        float i_beta = (float)(std::cos(phase) * Iq_actual) + 0.05f * noise.next();
+        float I[3] = {i_alpha, -0.5f * i_alpha + sqrt3_by_2 * i_beta, -0.5f * i_alpha - sqrt3_by_2 * i_beta};
+
+        FocCurrentModel::Output_t out = foc.update(I, vbus, 0.0f, Iq_des, phase, phase + 1.5f * dt * phase_vel);
+        trace.record({I[0], I[1], I[2], vbus, phase, out.Id, out.Iq, out.Vd, out.Vq,
+                      out.mod_alpha, out.mod_beta, out.Ibus,
+                      out.timings[0] + timing_offset, out.timings[1] + timing_offset, out.timings[2] + timing_offset,
+                      out.valid ? 1.0f : 0.0f});
+    }
+    return trace;
+}
+
+// Encoder counts of a move forward, a reversal and a stop with one count of
+// jitter.
+static GoldenTrace encoder_pll_trace() {
+    GoldenTrace trace({"count", "pos_estimate", "vel_estimate", "pos_cpr"});
+    trace.tolerance("pos_estimate", 1e-5f).tolerance("vel_estimate", 1e-3f).tolerance("pos_cpr", 1e-5f);
+
+    EncoderPllModel encoder(8192, 1000.0f, dt);
+    double pos = 0.0, vel = 0.0; // [turn], [turn/s]
+    for (int i = 0; i < 2400; ++i) {
+        double accel = i < 800 ? 20.0 : i < 1600 ? -30.0 : 0.0;
+        if (i == 2000)
+            vel = 0.0;
+        vel += accel * dt;
+        pos += vel * dt;
+        int32_t count = (int32_t)std::floor(pos * encoder.cpr);
+        if (i >= 2000 && (i / 7) % 2)
+            count += 1;
+        encoder.update(count);
+        if (i % 4 == 0)
+            trace.record({(float)count, encoder.pos_estimate(), encoder.vel_estimate(), encoder.interpolated_pos_cpr()});
+    }
+    return trace;
+}
+
+// Position steps on an inertia with friction, with the notch filter and a
+// torque limit that the large step runs into
+static GoldenTrace controller_trace() {
+    GoldenTrace trace({"pos_setpoint", "pos", "vel", "torque", "vel_integrator_torque"});
+    trace.tolerance("pos_setpoint", 0.0f).tolerance("pos", 1e-5f).tolerance("vel", 1e-4f)
+         .tolerance("torque", 1e-5f).tolerance("vel_integrator_torque", 1e-5f);
+
+    ControllerModel controller(dt);
+    controller.position_control = true;
+    controller.enable_gain_scheduling = true;
+    controller.gain_scheduling_width = 0.01f;
+    controller.vel_gain = 0.05f;
+    controller.vel_integrator_gain = 0.5f;
+    controller.torque_lim = 0.3f;
+    controller.vel_limit = 10.0f;
+    controller.torque_notch1.design_notch(300.0f, 2.0f, 1.0f / dt);
+    const float inertia = 1e-4f * 2.0f * (float)M_PI; // [Nm/(turn/s^2)]
+    const float viscous = 2e-4f; // [Nm/(turn/s)]
+    float pos = 0.0f, vel = 0.0f;
+    for (int i = 0; i < 3200; ++i) {
+        float pos_setpoint = i < 1500 ? 0.25f : 3.0f;
+        float torque = controller.update(pos_setpoint, 0.0f, 0.0f, pos, vel);
+        vel += (torque - viscous * vel) / inertia * dt;
+        pos += vel * dt;
+        if (i % 8 == 0)
+            trace.record({pos_setpoint, pos, vel, torque, controller.vel_integrator_torque});
+    }
+    return trace;
+}
+
+TEST_SUITE("golden_traces") {
+    TEST_CASE("FOC current control") {
+        foc_current_trace().check("foc_current");
+    }
+
+    TEST_CASE("encoder PLL") {
+        encoder_pll_trace().check("encoder_pll");
+    }
+
+    TEST_CASE("position and velocity control") {
+        controller_trace().check("controller");
+    }
+
+    TEST_CASE("a changed modulation is caught") {
+        auto mismatches = foc_current_trace(1e-4f).mismatches("foc_current");
+        REQUIRE(mismatches.size() == 3);
+        CHECK(mismatches[0].channel == "tA");
+        CHECK(mismatches[0].row == 0);
+    }
+}
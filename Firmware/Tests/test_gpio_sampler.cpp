@@ -0,0 +1,58 @@
+#include <doctest.h>
+
+#include <MotorControl/gpio_sampler.hpp>
+
+struct FakePort_t {
+    volatile uint32_t IDR;
+};
+
+TEST_SUITE("GpioSampler") {
+    TEST_CASE("pins share the slot of their port") {
+        FakePort_t a = {0}, b = {0};
+        GpioSampler<3> sampler;
+        auto a0 = sampler.add(&a, 1 << 0);
+        auto b4 = sampler.add(&b, 1 << 4);
+        auto a7 = sampler.add(&a, 1 << 7);
+        CHECK(sampler.num_ports() == 2);
+        CHECK(a0.port == a7.port);
+        CHECK(a0.port != b4.port);
+
+        a.IDR = (1 << 7);
+        b.IDR = 0xffff;
+        sampler.sample();
+        a.IDR = (1 << 0); // changes after the sample are not seen
+        CHECK(!sampler.read(a0));
+        CHECK(sampler.read(a7));
+        CHECK(sampler.read(b4));
+    }
+
+    TEST_CASE("unsampled pins read false") {
+        FakePort_t a = {0xffff}, b = {0xffff};
+        GpioSampler<1> sampler;
+        auto none = sampler.add((FakePort_t*)nullptr, 1);
+        auto no_mask = sampler.add(&a, 0);
+        auto a1 = sampler.add(&a, 1 << 1);
+        auto full = sampler.add(&b, 1 << 1);
+        sampler.sample();
+        CHECK(sampler.num_ports() == 1);
+        CHECK(!sampler.read(none));
+        CHECK(!sampler.read(no_mask));
+        CHECK(!sampler.read(full));
+        CHECK(sampler.read(a1));
+    }
+
+    TEST_CASE("rebuilding keeps the slots") {
+        FakePort_t a = {0}, b = {1 << 2};
+        GpioSampler<3> sampler;
+        auto b2 = sampler.add(&b, 1 << 2);
+        sampler.add(&a, 1);
+        sampler.sample();
+        sampler.clear();
+        CHECK(sampler.read(b2)); // samples are kept until the next sample()
+        auto b2_again = sampler.add(&b, 1 << 2);
+        CHECK(b2_again.port == b2.port);
+        b.IDR = 0;
+        sampler.sample();
+        CHECK(!sampler.read(b2));
+    }
+}
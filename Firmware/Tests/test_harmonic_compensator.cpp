@@ -0,0 +1,90 @@
+#include <doctest.h>
+
+#include "MotorControl/harmonic_compensator.hpp"
+
+#include <algorithm>
+
+// Velocity loop on an inertia with a current ripple at 1x and 6x the
+// electrical frequency.
+// @returns peak to peak velocity ripple over the last 0.5s
+static float simulate(HarmonicCompensator::Config_t& config, float duration) {
+    const float dt = 1.0f / 8000.0f;
+    const float inertia = 1e-3f; // [A/(rad/s^2)] electrical
+    const float vel_gain = 0.2f, vel_integrator_gain = 2.0f; // [A/(rad/s)], [A/rad]
+    const float vel_setpoint = 400.0f; // [rad/s electrical]
+    float phase = 0.0f, vel = vel_setpoint, integrator = 0.0f;
+    float vel_min = INFINITY, vel_max = -INFINITY;
+    int n = (int)(duration / dt);
+    for (int k = 0; k < n; ++k) {
+        float err = vel_setpoint - vel;
+        integrator += vel_integrator_gain * err * dt;
+        float Iq_command = vel_gain * err + integrator;
+        float Id = 0.0f, Iq = Iq_command;
+        HarmonicCompensator::update(config, phase, vel, Iq_command, dt, &Id, &Iq);
+        float ripple = 0.3f * std::cos(phase + 0.4f) + 0.2f * std::sin(6.0f * phase);
+        float friction = 0.1f;
+        vel += (Iq + ripple - friction) / inertia * dt;
+        phase = std::fmod(phase + vel * dt, 2.0f * 3.14159265f);
+        if (k >= n - (int)(0.5f / dt)) {
+            vel_min = std::min(vel_min, vel);
+            vel_max = std::max(vel_max, vel);
+        }
+    }
+    return vel_max - vel_min;
+}
+
+TEST_SUITE("HarmonicCompensator") {
+    TEST_CASE("disabled by default") {
+        HarmonicCompensator::Config_t config;
+        config.harmonics[0].Iq_cos = 1.0f;
+        float Id = 0.5f, Iq = 0.5f;
+        HarmonicCompensator::update(config, 0.0f, 0.0f, 1.0f, 0.001f, &Id, &Iq);
+        CHECK(Id == 0.5f);
+        CHECK(Iq == 0.5f);
+    }
+
+    TEST_CASE("applies the coefficients") {
+        HarmonicCompensator::Config_t config;
+        config.enable = true;
+        config.harmonics[0] = {1, 1.0f, 0.0f, 0.0f, 0.5f};
+        config.harmonics[1] = {0, 9.0f, 9.0f, 9.0f, 9.0f}; // disabled
+        config.harmonics[2] = {6, 0.0f, 0.2f, 0.0f, 0.0f};
+        for (float phase : {0.0f, 0.3f, 1.0f, -2.5f}) {
+            float Id = 0.0f, Iq = 1.0f;
+            HarmonicCompensator::update(config, phase, 0.0f, 1.0f, 0.001f, &Id, &Iq);
+            CHECK(Iq == doctest::Approx(1.0f + std::cos(phase) + 0.2f * std::sin(6.0f * phase)).epsilon(1e-4));
+            CHECK(Id == doctest::Approx(0.5f * std::sin(phase)).epsilon(1e-4));
+        }
+        CHECK(config.harmonics[0].Iq_cos == 1.0f); // not learning
+    }
+
+    TEST_CASE("learning cancels the ripple") {
+        HarmonicCompensator::Config_t config;
+        float ripple_before = simulate(config, 2.0f);
+
+        config.enable = true;
+        config.learn = true;
+        config.learn_rate = 20.0f;
+        simulate(config, 5.0f);
+        config.learn = false;
+        float ripple_after = simulate(config, 2.0f);
+        CHECK(ripple_after < 0.2f * ripple_before);
+
+        // The learned coefficients oppose the ripple
+        CHECK(config.harmonics[0].Iq_cos == doctest::Approx(-0.3f * std::cos(0.4f)).epsilon(0.1));
+        CHECK(config.harmonics[0].Iq_sin == doctest::Approx(0.3f * std::sin(0.4f)).epsilon(0.1));
+        CHECK(config.harmonics[2].Iq_sin == doctest::Approx(-0.2f).epsilon(0.1));
+        CHECK(std::abs(config.harmonics[1].Iq_cos) < 0.02f);
+    }
+
+    TEST_CASE("learning pauses at low speed") {
+        HarmonicCompensator::Config_t config;
+        config.enable = true;
+        config.learn = true;
+        float Id = 0.0f, Iq = 0.0f;
+        HarmonicCompensator::update(config, 0.0f, 10.0f, 1.0f, 0.001f, &Id, &Iq);
+        CHECK(config.harmonics[0].Iq_cos == 0.0f);
+        HarmonicCompensator::update(config, 0.0f, -200.0f, 1.0f, 0.001f, &Id, &Iq);
+        CHECK(config.harmonics[0].Iq_cos > 0.0f);
+    }
+}
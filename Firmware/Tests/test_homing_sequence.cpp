@@ -0,0 +1,109 @@
+#include <doctest.h>
+
+#include "MotorControl/homing_sequence.hpp"
+
+TEST_SUITE("HomingSequence") {
+    TEST_CASE("single slow approach by default") {
+        HomingSequence seq;
+        seq.build(HomingSequence::Config_t{}, 0.25f);
+        REQUIRE(seq.size() == 1);
+        CHECK(seq[0].type == HomingSequence::SEEK_ENDSTOP);
+        CHECK(seq[0].vel == doctest::Approx(-0.25f));
+        CHECK(seq[0].reference);
+    }
+
+    TEST_CASE("fast approach, back-off and index") {
+        HomingSequence::Config_t config;
+        config.fast_speed = 2.0f;
+        config.backoff_distance = 0.2f;
+        config.use_index = true;
+        HomingSequence seq;
+        seq.build(config, 0.25f);
+        REQUIRE(seq.size() == 4);
+        CHECK(seq[0].type == HomingSequence::SEEK_ENDSTOP);
+        CHECK(seq[0].vel == doctest::Approx(-2.0f));
+        CHECK(seq[1].type == HomingSequence::LEAVE_ENDSTOP);
+        CHECK(seq[1].vel == doctest::Approx(0.25f));
+        CHECK(seq[1].distance == doctest::Approx(0.2f));
+        CHECK(seq[2].type == HomingSequence::SEEK_ENDSTOP);
+        CHECK(seq[2].vel == doctest::Approx(-0.25f));
+        CHECK(seq[3].type == HomingSequence::SEEK_INDEX);
+        for (size_t i = 0; i < 3; ++i)
+            CHECK_FALSE(seq[i].reference);
+        CHECK(seq[3].reference);
+    }
+
+    TEST_CASE("direction follows the sign of homing_speed") {
+        HomingSequence::Config_t config;
+        config.fast_speed = 2.0f;
+        HomingSequence seq;
+        seq.build(config, -0.25f);
+        REQUIRE(seq.size() == 3);
+        CHECK(seq[0].vel == doctest::Approx(2.0f));
+        CHECK(seq[1].vel == doctest::Approx(-0.25f));
+        CHECK(seq[2].vel == doctest::Approx(0.25f));
+    }
+
+    TEST_CASE("stage completion") {
+        HomingSequence::Stage_t seek = {HomingSequence::SEEK_ENDSTOP, -1.0f, 0.0f, true};
+        CHECK(HomingSequence::check(seek, false, false, -3.0f) == HomingSequence::RUNNING);
+        CHECK(HomingSequence::check(seek, true, false, 0.0f) == HomingSequence::DONE);
+
+        // Backing off needs both the released switch and the distance
+        HomingSequence::Stage_t leave = {HomingSequence::LEAVE_ENDSTOP, 0.25f, 0.1f, false};
+        CHECK(HomingSequence::check(leave, true, false, 0.5f) == HomingSequence::RUNNING);
+        CHECK(HomingSequence::check(leave, false, false, 0.05f) == HomingSequence::RUNNING);
+        CHECK(HomingSequence::check(leave, false, false, 0.1f) == HomingSequence::DONE);
+
+        HomingSequence::Stage_t index = {HomingSequence::SEEK_INDEX, 0.25f, 1.1f, true};
+        CHECK(HomingSequence::check(index, false, false, 0.5f) == HomingSequence::RUNNING);
+        CHECK(HomingSequence::check(index, false, true, 0.5f) == HomingSequence::DONE);
+        CHECK(HomingSequence::check(index, false, false, 1.2f) == HomingSequence::FAILED);
+    }
+
+    TEST_CASE("hard stop") {
+        HomingSequence::Config_t config;
+        config.fast_speed = 2.0f; // ignored
+        config.use_hard_stop = true;
+        config.hard_stop_torque = 0.2f;
+        HomingSequence seq;
+        seq.build(config, 0.25f);
+        REQUIRE(seq.size() == 2);
+        CHECK(seq[0].type == HomingSequence::SEEK_HARD_STOP);
+        CHECK(seq[0].vel == doctest::Approx(-0.25f));
+        CHECK(seq[0].torque_limit == doctest::Approx(0.2f));
+        CHECK(seq[0].reference);
+        CHECK(seq[1].type == HomingSequence::BACK_OFF);
+        CHECK(seq[1].torque_limit == INFINITY);
+        CHECK(HomingSequence::check(seq[1], false, false, 0.05f) == HomingSequence::RUNNING);
+        CHECK(HomingSequence::check(seq[1], true, false, 0.1f) == HomingSequence::DONE);
+
+        config.use_index = true;
+        seq.build(config, 0.25f);
+        REQUIRE(seq.size() == 2);
+        CHECK_FALSE(seq[0].reference);
+        CHECK(seq[1].type == HomingSequence::SEEK_INDEX);
+    }
+
+    TEST_CASE("stall detection") {
+        HomingSequence::Stage_t stage = {HomingSequence::SEEK_HARD_STOP, -0.25f, 0.0f, true, 0.2f, 0.05f};
+        StallDetector stall;
+        const float dt = 1.0f / 8000.0f;
+        auto run = [&](float vel, float torque, float seconds) {
+            bool stalled = false;
+            for (int i = 0; i < (int)(seconds / dt); ++i)
+                stalled = stall.update(stage, vel, torque, dt);
+            return stalled;
+        };
+
+        // Moving freely, or slow without pushing (e.g. while accelerating)
+        CHECK_FALSE(run(-0.25f, 0.05f, 0.2f));
+        CHECK_FALSE(run(-0.01f, 0.05f, 0.2f));
+        // Pushing, but not for long enough
+        CHECK_FALSE(run(-0.01f, -0.2f, 0.04f));
+        // A short bounce restarts the timer
+        CHECK_FALSE(run(-0.2f, -0.2f, 0.001f));
+        CHECK_FALSE(run(-0.01f, -0.2f, 0.04f));
+        CHECK(run(-0.01f, -0.2f, 0.02f));
+    }
+}
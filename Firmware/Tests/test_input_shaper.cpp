@@ -0,0 +1,103 @@
+#include <doctest.h>
+
+#include "MotorControl/input_shaper.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Lightly damped resonance between the setpoint and the load
+// @param plant_freq: [Hz] damped frequency of the plant
+// @returns peak residual deviation of the load from a unit step, after the shaper's delay
+static float residual_vibration(InputShaper& shaper, float plant_freq, float damping, float dt) {
+    float wn = 2.0f * 3.14159265f * plant_freq / std::sqrt(1.0f - damping * damping);
+    float x = 0.0f, v = 0.0f, residual = 0.0f;
+    shaper.reset();
+    shaper.update({0.0f, 0.0f, 0.0f});
+    int n = (int)((shaper.delay() + 1.0f) / dt);
+    for (int k = 0; k < n; ++k) {
+        float u = shaper.update({1.0f, 0.0f, 0.0f}).pos;
+        // Semi-implicit Euler, fine at 8kHz
+        v += (wn * wn * (u - x) - 2.0f * damping * wn * v) * dt;
+        x += v * dt;
+        if (k * dt > shaper.delay() + 0.01f)
+            residual = std::max(residual, std::abs(x - 1.0f));
+    }
+    return residual;
+}
+
+TEST_SUITE("InputShaper") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("passes through when not configured") {
+        InputShaper shaper;
+        InputShaper::Sample_t out = shaper.update({1.0f, 2.0f, 3.0f});
+        CHECK(out.pos == 1.0f);
+        CHECK(out.vel == 2.0f);
+        CHECK(out.torque == 3.0f);
+        shaper.configure(InputShaper::TYPE_ZV, 0.0f, 0.05f, dt);
+        CHECK(shaper.update({4.0f, 0.0f, 0.0f}).pos == 4.0f);
+    }
+
+    TEST_CASE("impulse sequences") {
+        InputShaper shaper;
+        shaper.configure(InputShaper::TYPE_ZV, 100.0f, 0.0f, dt);
+        CHECK(shaper.delay() == doctest::Approx(0.005f));
+        shaper.update({0.0f, 0.0f, 0.0f});
+        CHECK(shaper.update({1.0f, 0.0f, 0.0f}).pos == doctest::Approx(0.5f));
+        for (int k = 0; k < 39; ++k)
+            CHECK(shaper.update({1.0f, 0.0f, 0.0f}).pos == doctest::Approx(0.5f));
+        InputShaper::Sample_t out = shaper.update({1.0f, 2.0f, -1.0f});
+        CHECK(out.pos == doctest::Approx(1.0f));
+        CHECK(out.vel == doctest::Approx(1.0f)); // only the first impulse saw the velocity yet
+        CHECK(out.torque == doctest::Approx(-0.5f));
+
+        shaper.configure(InputShaper::TYPE_ZVD, 100.0f, 0.0f, dt);
+        CHECK(shaper.delay() == doctest::Approx(0.01f));
+        shaper.update({0.0f, 0.0f, 0.0f});
+        CHECK(shaper.update({1.0f, 0.0f, 0.0f}).pos == doctest::Approx(0.25f));
+    }
+
+    TEST_CASE("suppresses the residual vibration") {
+        for (float damping : {0.0f, 0.05f, 0.2f}) {
+            CAPTURE(damping);
+            InputShaper unshaped;
+            float reference = residual_vibration(unshaped, 10.0f, damping, dt);
+            for (auto type : {InputShaper::TYPE_ZV, InputShaper::TYPE_ZVD}) {
+                CAPTURE(type);
+                InputShaper shaper;
+                shaper.configure(type, 10.0f, damping, dt);
+                CHECK(residual_vibration(shaper, 10.0f, damping, dt) < 0.02f * reference + 0.002f);
+            }
+            // EI leaves up to 5% by design
+            InputShaper shaper;
+            shaper.configure(InputShaper::TYPE_EI, 10.0f, damping, dt);
+            CHECK(residual_vibration(shaper, 10.0f, damping, dt) < 0.055f * reference);
+        }
+    }
+
+    TEST_CASE("robustness to a frequency error") {
+        const float damping = 0.05f;
+        InputShaper unshaped;
+        float reference = residual_vibration(unshaped, 11.5f, damping, dt);
+        InputShaper zv, zvd, ei;
+        zv.configure(InputShaper::TYPE_ZV, 10.0f, damping, dt);
+        zvd.configure(InputShaper::TYPE_ZVD, 10.0f, damping, dt);
+        ei.configure(InputShaper::TYPE_EI, 10.0f, damping, dt);
+        float r_zv = residual_vibration(zv, 11.5f, damping, dt);
+        float r_zvd = residual_vibration(zvd, 11.5f, damping, dt);
+        float r_ei = residual_vibration(ei, 11.5f, damping, dt);
+        CHECK(r_zvd < r_zv);
+        CHECK(r_ei < r_zv);
+        CHECK(r_zvd < 0.1f * reference);
+        CHECK(r_ei < 0.1f * reference);
+    }
+
+    TEST_CASE("decimated delay line at low frequency") {
+        InputShaper shaper;
+        shaper.configure(InputShaper::TYPE_ZVD, 0.5f, 0.05f, dt); // 2s delay in 126 samples
+        CHECK(shaper.delay() == doctest::Approx(2.0f));
+        InputShaper unshaped;
+        float reference = residual_vibration(unshaped, 0.5f, 0.05f, dt);
+        CHECK(residual_vibration(shaper, 0.5f, 0.05f, dt) < 0.02f * reference + 0.002f);
+    }
+}
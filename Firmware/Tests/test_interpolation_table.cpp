@@ -0,0 +1,27 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/interpolation_table.hpp"
+#include "MotorControl/utils.hpp"
+
+TEST_SUITE("InterpolationTable") {
+    TEST_CASE("linear function is exact") {
+        InterpolationTable<5> table;
+        table.build([](float x) { return 2.0f * x - 1.0f; });
+        for (float x : {0.0f, 0.1f, 0.25f, 0.6f, 0.99f, 1.0f})
+            CHECK(table.eval(x) == doctest::Approx(2.0f * x - 1.0f));
+    }
+
+    TEST_CASE("thermistor polynomial") {
+        // The coefficients of the onboard FET thermistors of the v3 boards
+        const float coeffs[] = {363.93910201f, -462.15369634f, 307.55129571f, -27.72569531f};
+        InterpolationTable<65> table;
+        table.build([&](float x) { return horner_poly_eval(x, coeffs, 4); });
+        float max_error = 0.0f;
+        for (int i = 0; i <= 1000; ++i) {
+            float x = i / 1000.0f;
+            max_error = std::max(max_error, std::abs(table.eval(x) - horner_poly_eval(x, coeffs, 4)));
+        }
+        CHECK(max_error < 0.1f); // [°C]
+    }
+}
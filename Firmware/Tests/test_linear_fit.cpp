@@ -0,0 +1,61 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/linear_fit.hpp"
+
+// The scan of the fast encoder offset calibration: the rotor follows the
+// commanded phase with a lag and the encoder reports the floor of its
+// position in counts
+static void scan(LinearFit fit[2], float counts_per_rad, float offset, float lag, float distance, int num_steps) {
+    for (int dir = 0; dir < 2; ++dir) {
+        for (int i = 0; i < num_steps; ++i) {
+            float phase = distance * ((float)i / (float)num_steps - 0.5f);
+            if (dir)
+                phase = -phase;
+            float rotor = dir ? phase + lag : phase - lag;
+            float ripple = 0.05f * std::sin(6.0f * rotor);
+            fit[dir].add(phase, std::floor(offset + counts_per_rad * (rotor + ripple)));
+        }
+    }
+}
+
+TEST_SUITE("LinearFit") {
+    TEST_CASE("line") {
+        LinearFit fit;
+        for (int i = 0; i < 100; ++i)
+            fit.add(1000.0f + i, 3.0f - 0.5f * i);
+        float slope, intercept;
+        REQUIRE(fit.solve(&slope, &intercept));
+        CHECK(slope == doctest::Approx(-0.5f));
+        CHECK(intercept == doctest::Approx(503.0f));
+        CHECK(fit.rms_residual() < 1e-3f);
+    }
+
+    TEST_CASE("no variation of x") {
+        LinearFit fit;
+        float slope, intercept;
+        CHECK(!fit.solve(&slope, &intercept));
+        for (int i = 0; i < 10; ++i)
+            fit.add(1.0f, (float)i);
+        CHECK(!fit.solve(&slope, &intercept));
+    }
+
+    TEST_CASE("encoder offset from a scan in both directions") {
+        const float counts_per_rad = 8192.0f / (7.0f * 2.0f * (float)M_PI);
+        const float offset = 123.3f;
+        LinearFit fit[2];
+        scan(fit, counts_per_rad, offset, 0.3f, 4.0f * (float)M_PI, 2000);
+
+        float slope[2] = {}, intercept[2] = {};
+        REQUIRE(fit[0].solve(&slope[0], &intercept[0]));
+        REQUIRE(fit[1].solve(&slope[1], &intercept[1]));
+        CHECK(slope[0] == doctest::Approx(counts_per_rad).epsilon(0.01));
+        CHECK(slope[1] == doctest::Approx(counts_per_rad).epsilon(0.01));
+        // The lag shifts the intercepts by about 58 counts each
+        CHECK(intercept[1] - intercept[0] == doctest::Approx(2.0f * 0.3f * counts_per_rad).epsilon(0.02));
+        // Combined like in Encoder::run_fast_offset_calibration()
+        CHECK(0.5f * (intercept[0] + intercept[1]) + 0.5f == doctest::Approx(offset).epsilon(0.002));
+        // The ripple amounts to 0.05 / sqrt(2) rad
+        CHECK(fit[0].rms_residual() / counts_per_rad == doctest::Approx(0.05f / std::sqrt(2.0f)).epsilon(0.1));
+    }
+}
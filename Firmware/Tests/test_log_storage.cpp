@@ -0,0 +1,153 @@
+#include <doctest.h>
+
+#include <MotorControl/log_storage.hpp>
+
+#include <vector>
+
+// NOR flash in RAM: erasing sets all bits, programming can only clear bits
+struct RamFlash {
+    RamFlash(size_t num_sectors) : data(num_sectors * 4096, 0xff), erase_count(num_sectors, 0) {}
+
+    size_t size() const { return data.size(); }
+    bool read(uint32_t addr, uint8_t* buf, size_t length) {
+        memcpy(buf, data.data() + addr, length);
+        return true;
+    }
+    bool program(uint32_t addr, const uint8_t* buf, size_t length) {
+        if (program_budget-- == 0)
+            return false; // simulated reset
+        for (size_t i = 0; i < length; ++i)
+            data[addr + i] &= buf[i];
+        return true;
+    }
+    bool erase_sector(uint32_t addr) {
+        memset(data.data() + addr, 0xff, 4096);
+        erase_count[addr / 4096]++;
+        return true;
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> erase_count;
+    size_t program_budget = SIZE_MAX;
+};
+
+using Storage = LogStorage<RamFlash>;
+
+struct Record {
+    uint32_t timestamp;
+    uint8_t type;
+    std::vector<uint8_t> payload;
+};
+
+// Parses the readout like the host does, skipping records with a bad CRC
+static std::vector<Record> read_all(Storage& storage) {
+    std::vector<uint8_t> buf(storage.readable_size());
+    REQUIRE(storage.read(0, buf.data(), buf.size()));
+    std::vector<Record> records;
+    for (size_t sector = 0; sector < buf.size(); sector += Storage::sector_size) {
+        size_t offset = sector + sizeof(Storage::SectorHeader_t);
+        size_t end = std::min(buf.size(), sector + Storage::sector_size);
+        while (offset + sizeof(Storage::RecordHeader_t) <= end) {
+            Storage::RecordHeader_t header;
+            memcpy(&header, &buf[offset], sizeof(header));
+            if (header.length == 0xffff)
+                break;
+            const uint8_t* payload = &buf[offset + sizeof(header)];
+            if (offset + sizeof(header) + header.length <= end
+                && Storage::record_crc(header, payload, header.length) == header.crc16)
+                records.push_back({header.timestamp, header.type, {payload, payload + header.length}});
+            offset += Storage::record_size(header.length);
+        }
+    }
+    return records;
+}
+
+static bool append(Storage& storage, uint32_t timestamp, size_t length) {
+    std::vector<uint8_t> payload(length, (uint8_t)timestamp);
+    return storage.append(1, 0, timestamp, payload.data(), length);
+}
+
+TEST_SUITE("LogStorage") {
+    TEST_CASE("records survive a remount") {
+        RamFlash flash(4);
+        Storage storage(flash);
+        REQUIRE(storage.mount());
+        CHECK(storage.readable_size() == 0);
+        CHECK(append(storage, 1, 5));
+        CHECK(append(storage, 2, 0));
+        CHECK(storage.readable_size() == 8 + 20 + 12);
+
+        Storage remounted(flash);
+        REQUIRE(remounted.mount());
+        CHECK(remounted.readable_size() == storage.readable_size());
+        CHECK(append(remounted, 3, 100));
+        auto records = read_all(remounted);
+        REQUIRE(records.size() == 3);
+        CHECK(records[0].payload == std::vector<uint8_t>(5, 1));
+        CHECK(records[1].payload.empty());
+        CHECK(records[2].timestamp == 3);
+    }
+
+    TEST_CASE("the log wraps around and wears the sectors evenly") {
+        RamFlash flash(4);
+        Storage storage(flash);
+        REQUIRE(storage.mount());
+        for (uint32_t t = 0; t < 1000; ++t)
+            REQUIRE(append(storage, t, 1000)); // 4 records per sector
+        CHECK(storage.readable_size() > 3 * Storage::sector_size);
+        auto records = read_all(storage);
+        REQUIRE(records.size() >= 12);
+        CHECK(records.back().timestamp == 999);
+        for (size_t i = 1; i < records.size(); ++i)
+            CHECK(records[i].timestamp == records[i - 1].timestamp + 1);
+        for (uint32_t count : flash.erase_count)
+            CHECK((count == 62 || count == 63)); // 250 sectors written
+
+        Storage remounted(flash);
+        REQUIRE(remounted.mount());
+        CHECK(read_all(remounted).size() == records.size());
+        CHECK(!remounted.append(1, 0, 0, nullptr, Storage::max_payload + 1));
+    }
+
+    TEST_CASE("clear drops all records") {
+        RamFlash flash(4);
+        Storage storage(flash);
+        REQUIRE(storage.mount());
+        for (uint32_t t = 0; t < 20; ++t)
+            append(storage, t, 1000);
+        REQUIRE(storage.clear());
+        CHECK(read_all(storage).empty());
+        append(storage, 100, 10);
+
+        Storage remounted(flash);
+        REQUIRE(remounted.mount());
+        auto records = read_all(remounted);
+        REQUIRE(records.size() == 1);
+        CHECK(records[0].timestamp == 100);
+    }
+
+    TEST_CASE("an interrupted write is skipped") {
+        RamFlash flash(2);
+        Storage storage(flash);
+        REQUIRE(storage.mount());
+        append(storage, 1, 10);
+        flash.program_budget = 1; // the header of the next record is written, the payload isn't
+        CHECK(!append(storage, 2, 10));
+        flash.program_budget = SIZE_MAX;
+
+        Storage remounted(flash);
+        REQUIRE(remounted.mount());
+        append(remounted, 3, 10);
+        auto records = read_all(remounted);
+        REQUIRE(records.size() == 2);
+        CHECK(records[0].timestamp == 1);
+        CHECK(records[1].timestamp == 3);
+    }
+
+    TEST_CASE("flash too small") {
+        RamFlash flash(1);
+        Storage storage(flash);
+        CHECK(!storage.mount());
+        CHECK(!append(storage, 1, 1));
+    }
+}
@@ -0,0 +1,76 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/loop_analysis.hpp"
+
+// Gains as AXIS_STATE_AUTOTUNE designs them for a crossover and phase margin
+static LoopAnalysisInput_t autotuned(float wc, float phase_margin, float pos_ratio) {
+    const float dt = 1.0f / 8000.0f;
+    const float inertia = 0.002f;
+    float pi_lag = 3.14159265f * (0.5f - phase_margin / 180.0f) - 1.5f * wc * dt;
+    float vel_gain = inertia * wc;
+    return {
+        .inertia = inertia,
+        .vel_gain = vel_gain,
+        .vel_integrator_gain = vel_gain * wc * std::tan(pi_lag),
+        .pos_gain = wc / pos_ratio,
+        .encoder_bandwidth = 0.0f, // ideal
+        .tracking_observer = false,
+        .current_bandwidth = 0.0f, // ideal
+        .control_period = dt,
+        .current_meas_period = dt,
+    };
+}
+
+TEST_SUITE("LoopAnalysis") {
+    TEST_CASE("matches the autotune design") {
+        LoopAnalysisInput_t in = autotuned(300.0f, 60.0f, 4.0f);
+        LoopAnalysis_t result = LoopAnalyzer(in).analyze();
+        // The integrator adds some gain at the crossover
+        CHECK(result.vel_crossover > 300.0f);
+        CHECK(result.vel_crossover < 350.0f);
+        CHECK(result.vel_phase_margin > 55.0f);
+        CHECK(result.vel_phase_margin < 62.0f);
+        CHECK(result.pos_ratio > 3.0f);
+        CHECK(result.pos_phase_margin > 45.0f);
+        CHECK(!(result.warnings & (LOOP_ANALYSIS_LOW_PHASE_MARGIN | LOOP_ANALYSIS_UNSTABLE | LOOP_ANALYSIS_POS_LOOP_TOO_FAST)));
+    }
+
+    TEST_CASE("well separated loops") {
+        LoopAnalysisInput_t in = autotuned(200.0f, 60.0f, 4.0f);
+        in.encoder_bandwidth = 2000.0f;
+        in.current_bandwidth = 2000.0f;
+        LoopAnalysis_t result = LoopAnalyzer(in).analyze();
+        CHECK(result.warnings == 0);
+        CHECK(result.encoder_ratio > 4.0f);
+        CHECK(result.vel_phase_margin > 40.0f);
+    }
+
+    TEST_CASE("poorly separated loops") {
+        LoopAnalysisInput_t in = autotuned(200.0f, 60.0f, 1.5f);
+        in.encoder_bandwidth = 400.0f;
+        in.current_bandwidth = 2000.0f;
+        LoopAnalysis_t result = LoopAnalyzer(in).analyze();
+        CHECK((result.warnings & LOOP_ANALYSIS_ENCODER_TOO_SLOW));
+        CHECK((result.warnings & LOOP_ANALYSIS_POS_LOOP_TOO_FAST));
+        CHECK(!(result.warnings & LOOP_ANALYSIS_CURRENT_LOOP_TOO_SLOW));
+
+        in = autotuned(200.0f, 60.0f, 4.0f);
+        in.encoder_bandwidth = 2000.0f;
+        in.current_bandwidth = 300.0f;
+        CHECK((LoopAnalyzer(in).analyze().warnings & LOOP_ANALYSIS_CURRENT_LOOP_TOO_SLOW));
+    }
+
+    TEST_CASE("unstable and unknown") {
+        LoopAnalysisInput_t in = autotuned(200.0f, 60.0f, 4.0f);
+        in.vel_gain *= 60.0f; // crossover at a quarter of the control loop rate
+        CHECK((LoopAnalyzer(in).analyze().warnings & LOOP_ANALYSIS_UNSTABLE));
+
+        in = autotuned(200.0f, 60.0f, 4.0f);
+        in.inertia = 0.0f;
+        in.encoder_bandwidth = 10000.0f;
+        LoopAnalysis_t result = LoopAnalyzer(in).analyze();
+        CHECK(result.warnings == (LOOP_ANALYSIS_INERTIA_UNKNOWN | LOOP_ANALYSIS_ENCODER_UNSTABLE_GAIN));
+        CHECK(result.vel_crossover == 0.0f);
+    }
+}
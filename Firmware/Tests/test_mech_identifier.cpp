@@ -0,0 +1,52 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/mech_identifier.hpp"
+
+// Drives a simulated load with a velocity controller following a sine and
+// feeds the torque and velocity to the identifier
+static void run(MechIdentifier& ident, float J, float b, float c, float seconds) {
+    const float dt = 1.0f / 8000.0f;
+    const float vel_band = 0.01f;
+    const int decimation = 8;
+    float vel = 0.0f;
+    for (int i = 0; i < (int)(seconds / dt); ++i) {
+        float t = i * dt;
+        float vel_des = 2.0f * std::sin(2.0f * (float)M_PI * 0.5f * t) + 0.5f * std::sin(2.0f * (float)M_PI * 3.0f * t);
+        float torque = 0.2f * (vel_des - vel);
+        float friction = b * vel + c * std::clamp(vel / vel_band, -1.0f, 1.0f);
+        vel += (torque - friction) / J * dt;
+        ident.filter(torque, vel, 2.0f * (float)M_PI * 20.0f * dt);
+        if (i % decimation == 0)
+            ident.update(decimation * dt, 0.9995f, vel_band);
+    }
+}
+
+TEST_SUITE("MechIdentifier") {
+    TEST_CASE("converges") {
+        MechIdentifier ident;
+        run(ident, 0.01f, 0.002f, 0.05f, 10.0f);
+        CHECK(ident.inertia() == doctest::Approx(0.01f).epsilon(0.05));
+        CHECK(ident.viscous() == doctest::Approx(0.002f).epsilon(0.1));
+        CHECK(ident.coulomb() == doctest::Approx(0.05f).epsilon(0.05));
+    }
+
+    TEST_CASE("standstill") {
+        MechIdentifier ident;
+        for (int i = 0; i < 1000; ++i) {
+            ident.filter(0.0f, 0.0f, 0.1f);
+            ident.update(0.001f, 0.99f, 0.01f);
+        }
+        CHECK(ident.inertia() == 0.0f);
+        CHECK(ident.coulomb() == 0.0f);
+    }
+
+    TEST_CASE("tracks changes") {
+        MechIdentifier ident;
+        run(ident, 0.01f, 0.002f, 0.05f, 10.0f);
+        run(ident, 0.02f, 0.002f, 0.05f, 10.0f);
+        CHECK(ident.inertia() == doctest::Approx(0.02f).epsilon(0.05));
+        ident.reset();
+        CHECK(ident.inertia() == 0.0f);
+    }
+}
@@ -0,0 +1,67 @@
+#include <doctest.h>
+
+#include "MotorControl/mtpa.hpp"
+
+static float torque_of(float kt, int32_t pole_pairs, float Ld, float Lq, float Id, float Iq) {
+    return 1.5f * (float)pole_pairs * Iq * (kt / (1.5f * (float)pole_pairs) + (Ld - Lq) * Id);
+}
+
+TEST_SUITE("Mtpa") {
+    TEST_CASE("falls back to Id = 0 for non-salient motors") {
+        Mtpa mtpa;
+        CHECK_FALSE(mtpa.build(0.05f, 7, 20e-6f, 20e-6f, 40.0f));
+        CHECK_FALSE(mtpa.build(0.05f, 7, 30e-6f, 20e-6f, 40.0f));
+        CHECK_FALSE(mtpa.build(0.05f, 7, 0.0f, 20e-6f, 40.0f));
+        float Id, Iq;
+        mtpa.get(-0.5f, &Id, &Iq);
+        CHECK(Id == 0.0f);
+        CHECK(Iq == doctest::Approx(-10.0f));
+    }
+
+    TEST_CASE("delivers the requested torque with less current") {
+        const float kt = 0.1f, Ld = 100e-6f, Lq = 300e-6f;
+        const int32_t pp = 4;
+        Mtpa mtpa;
+        REQUIRE(mtpa.build(kt, pp, Ld, Lq, 60.0f));
+
+        float Id, Iq;
+        mtpa.get(0.0f, &Id, &Iq);
+        CHECK(Id == 0.0f);
+        CHECK(Iq == 0.0f);
+
+        for (float torque : {0.3f, 1.0f, 2.5f, 4.0f, 8.0f}) {
+            for (float sign : {1.0f, -1.0f}) {
+                mtpa.get(sign * torque, &Id, &Iq);
+                CHECK(Id < 0.0f);
+                CHECK(Iq * sign > 0.0f);
+                CHECK(torque_of(kt, pp, Ld, Lq, Id, Iq) == doctest::Approx(sign * torque).epsilon(1e-4));
+                CHECK(std::sqrt(Id * Id + Iq * Iq) < torque / kt);
+            }
+        }
+    }
+
+    TEST_CASE("matches the optimum angle") {
+        const float kt = 0.1f, Ld = 100e-6f, Lq = 300e-6f;
+        const int32_t pp = 4;
+        const float flux = kt / (1.5f * pp), dL = Lq - Ld;
+        Mtpa mtpa;
+        REQUIRE(mtpa.build(kt, pp, Ld, Lq, 60.0f));
+        for (float torque : {1.0f, 3.0f, 5.0f}) {
+            float Id, Iq;
+            mtpa.get(torque, &Id, &Iq);
+            float I = std::sqrt(Id * Id + Iq * Iq);
+            float Id_opt = (flux - std::sqrt(flux * flux + 8.0f * dL * dL * I * I)) / (4.0f * dL);
+            CHECK(Id == doctest::Approx(Id_opt).epsilon(0.02));
+        }
+    }
+
+    TEST_CASE("keeps the last Id above the table") {
+        Mtpa mtpa;
+        REQUIRE(mtpa.build(0.1f, 4, 100e-6f, 300e-6f, 20.0f));
+        float Id_max, Iq_max, Id, Iq;
+        mtpa.get(100.0f, &Id_max, &Iq_max);
+        mtpa.get(200.0f, &Id, &Iq);
+        CHECK(Id == Id_max);
+        CHECK(Iq == doctest::Approx(2.0f * Iq_max));
+    }
+}
@@ -0,0 +1,44 @@
+#include <doctest.h>
+
+#include "MotorControl/multiturn.hpp"
+
+TEST_SUITE("Multiturn") {
+    TEST_CASE("continues the saved turn count") {
+        MultiturnRecord_t record{5 * 1000 + 100, 100, 1000, true, true};
+        int32_t count = 0;
+        REQUIRE(multiturn_restore(record, 100, 1000, &count));
+        CHECK(count == 5100);
+        REQUIRE(multiturn_restore(record, 350, 1000, &count));
+        CHECK(count == 5350);
+        REQUIRE(multiturn_restore(record, 950, 1000, &count)); // moved backwards across the zero
+        CHECK(count == 4950);
+    }
+
+    TEST_CASE("linear count with an offset from homing") {
+        // set_linear_count() after homing: the linear count is no longer a
+        // multiple of cpr plus the single-turn reading
+        MultiturnRecord_t record{-2 * 1000 - 37, 980, 1000, true, true};
+        int32_t count = 0;
+        REQUIRE(multiturn_restore(record, 10, 1000, &count)); // +30 across the zero
+        CHECK(count == -2007);
+    }
+
+    TEST_CASE("the linear count wraps around") {
+        MultiturnRecord_t record{INT32_MAX - 5, 500, 1000, true, false};
+        int32_t count = 0;
+        REQUIRE(multiturn_restore(record, 510, 1000, &count));
+        CHECK(count == (int32_t)((uint32_t)INT32_MAX + 5u));
+    }
+
+    TEST_CASE("rejects records that don't match") {
+        int32_t count = 123;
+        MultiturnRecord_t record{1000, 0, 1000, false, false};
+        CHECK_FALSE(multiturn_restore(record, 0, 1000, &count)); // not valid
+        record.valid = true;
+        CHECK_FALSE(multiturn_restore(record, 0, 2000, &count)); // cpr changed
+        CHECK_FALSE(multiturn_restore(record, 1000, 1000, &count)); // reading out of range
+        record.count_in_cpr = -1;
+        CHECK_FALSE(multiturn_restore(record, 0, 1000, &count));
+        CHECK(count == 123);
+    }
+}
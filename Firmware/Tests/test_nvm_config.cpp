@@ -0,0 +1,540 @@
+#include <doctest.h>
+#include <string.h>
+#include <vector>
+
+#include "MotorControl/nvm_config.hpp"
+
+// RAM backed stand-in for the two flash sectors
+static constexpr size_t kFakeSectorSize = 1024;
+static uint8_t fake_sectors[2][kFakeSectorSize];
+static size_t n_erases[2];
+static size_t n_programmed;
+static size_t program_budget = SIZE_MAX; // simulates a reset after this many bytes
+
+size_t NVM_get_sector_size(void) {
+    return kFakeSectorSize;
+}
+
+const uint8_t *NVM_get_sector(unsigned sector) {
+    return fake_sectors[sector & 1];
+}
+
+int NVM_erase_sector(unsigned sector) {
+    memset(fake_sectors[sector], 0xff, kFakeSectorSize);
+    n_erases[sector]++;
+    return 0;
+}
+
+int NVM_program(unsigned sector, size_t offset, const uint8_t *data, size_t length) {
+    if (offset + length > kFakeSectorSize)
+        return -1;
+    for (size_t i = 0; i < length; ++i) {
+        if (!program_budget)
+            return -1;
+        program_budget--;
+        fake_sectors[sector][offset + i] &= data[i];
+        n_programmed++;
+    }
+    return 0;
+}
+
+struct SmallConfig {
+    float gain = 1.0f;
+    uint32_t flags = 0;
+    struct {
+        uint8_t pins[3] = {1, 2, 3};
+    } sub;
+};
+
+struct LargeConfig {
+    float table[40] = {};
+};
+
+// What the generated tables look like
+struct SmallConfigFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(SmallConfig, "gain", gain),
+        CONFIG_FIELD(SmallConfig, "flags", flags),
+        CONFIG_FIELD(SmallConfig, "sub.pin0", sub.pins[0]),
+        CONFIG_FIELD(SmallConfig, "sub.pin2", sub.pins[2]),
+    };
+};
+
+struct LargeConfigFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(LargeConfig, "table", table),
+    };
+};
+
+// A later version of SmallConfig
+struct NewConfig {
+    uint8_t pins[3] = {7, 8, 9};
+    uint16_t flags = 5; // the type changed
+    float gain = 0.0f;
+    float added = 4.0f;
+};
+
+struct NewConfigFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(NewConfig, "sub.pin0", pins[0]),
+        CONFIG_FIELD(NewConfig, "sub.pin1", pins[1]),
+        CONFIG_FIELD(NewConfig, "added", added),
+        CONFIG_FIELD(NewConfig, "flags", flags),
+        CONFIG_FIELD(NewConfig, "gain", gain),
+    };
+};
+
+struct DuplicateFields {
+    static constexpr ConfigField fields[] = {
+        CONFIG_FIELD(SmallConfig, "gain", gain),
+        CONFIG_FIELD(SmallConfig, "gain", flags),
+    };
+};
+
+static SmallConfig small;
+static LargeConfig large;
+
+static bool store(ConfigManager& manager, size_t* size = nullptr) {
+    size_t dummy;
+    return manager.prepare_store()
+        && manager.write<SmallConfigFields>(1, &small)
+        && manager.write<LargeConfigFields>(2, &large)
+        && manager.finish_store(size ? size : &dummy);
+}
+
+// Prepares a background store and takes the snapshot
+static bool start_background_store(ConfigManager& manager, std::vector<uint32_t>* snapshot) {
+    size_t snapshot_size;
+    if (!(manager.prepare_store()
+            && manager.write<SmallConfigFields>(1, &small)
+            && manager.write<LargeConfigFields>(2, &large)
+            && manager.plan_background_store(&snapshot_size)))
+        return false;
+    snapshot->resize((snapshot_size + 3) / 4);
+    return manager.start_background_store((uint8_t*)snapshot->data());
+}
+
+// @returns the number of steps
+static size_t run_background_store(ConfigManager& manager, size_t step_size = 4) {
+    size_t n_steps = 0;
+    size_t size = 0;
+    ConfigManager::BackgroundStoreStatus status;
+    while ((status = manager.continue_background_store(step_size, &size)) == ConfigManager::kBackgroundStoreBusy)
+        ++n_steps;
+    REQUIRE(status == ConfigManager::kBackgroundStoreDone);
+    return n_steps;
+}
+
+static bool load(ConfigManager& manager, SmallConfig* s, LargeConfig* l) {
+    size_t size = 0;
+    return manager.start_load()
+        && manager.read<SmallConfigFields>(1, s)
+        && manager.read<LargeConfigFields>(2, l)
+        && manager.finish_load(&size);
+}
+
+static void reset_flash() {
+    memset(fake_sectors, 0xff, sizeof(fake_sectors));
+    n_erases[0] = n_erases[1] = 0;
+    n_programmed = 0;
+    program_budget = SIZE_MAX;
+    small = {};
+    large = {};
+}
+
+TEST_SUITE("nvm_config") {
+    TEST_CASE("empty flash fails to load") {
+        reset_flash();
+        ConfigManager manager;
+        SmallConfig s;
+        LargeConfig l;
+        CHECK(!load(manager, &s, &l));
+    }
+
+    TEST_CASE("store and load") {
+        reset_flash();
+        ConfigManager manager;
+        small.gain = 2.5f;
+        large.table[7] = 7.0f;
+        REQUIRE(store(manager));
+
+        SmallConfig s;
+        LargeConfig l;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, &s, &l));
+        CHECK(s.gain == 2.5f);
+        CHECK(l.table[7] == 7.0f);
+        CHECK(s.sub.pins[2] == 3);
+    }
+
+    TEST_CASE("read a field in place") {
+        reset_flash();
+        ConfigManager manager;
+        large.table[7] = 7.0f;
+        REQUIRE(store(manager));
+
+        const uint32_t id = config_field_id("table");
+        REQUIRE(manager.start_load());
+        const float* table = (const float*)manager.read_in_place(2, id, sizeof(large.table));
+        REQUIRE(table);
+        CHECK((const uint8_t*)table >= fake_sectors[0]);
+        CHECK((const uint8_t*)table < fake_sectors[0] + kFakeSectorSize);
+        CHECK(table[7] == 7.0f);
+        CHECK(manager.read_in_place(2, id, sizeof(float)) == nullptr); // other size
+        CHECK(manager.read_in_place(3, id, sizeof(large.table)) == nullptr); // no record
+        REQUIRE(manager.finish_load(nullptr));
+
+        // The record can be stored again from where it is, until the
+        // compaction into the other sector
+        uint32_t magic = ConfigManager::kSectorMagic;
+        for (int i = 0; i < 100 && memcmp(fake_sectors[1], &magic, 4); ++i) {
+            small.gain = (float)i;
+            REQUIRE(manager.prepare_store());
+            REQUIRE(manager.write<SmallConfigFields>(1, &small));
+            REQUIRE(manager.write<LargeConfigFields>(2, (const LargeConfig*)table));
+            REQUIRE(manager.finish_store(nullptr));
+        }
+        CHECK(table[7] == 7.0f); // the old sector isn't erased yet
+        REQUIRE(manager.start_load());
+        const float* moved = (const float*)manager.read_in_place(2, id, sizeof(large.table));
+        REQUIRE(manager.finish_load(nullptr));
+        REQUIRE(moved);
+        CHECK((const uint8_t*)moved >= fake_sectors[1]);
+        CHECK(moved[7] == 7.0f);
+    }
+
+    TEST_CASE("only changed records are appended") {
+        reset_flash();
+        ConfigManager manager;
+        REQUIRE(store(manager));
+        size_t programmed = n_programmed;
+
+        // Unchanged config doesn't touch the flash
+        REQUIRE(store(manager));
+        CHECK(n_programmed == programmed);
+
+        small.gain = 3.0f;
+        REQUIRE(store(manager));
+        CHECK(n_programmed - programmed < sizeof(LargeConfig)); // the large record is not rewritten
+        CHECK(n_erases[0] + n_erases[1] == 0); // the blank sector isn't erased
+
+        SmallConfig s;
+        LargeConfig l;
+        REQUIRE(load(manager, &s, &l));
+        CHECK(s.gain == 3.0f);
+    }
+
+    TEST_CASE("full sector is compacted into the other sector") {
+        reset_flash();
+        ConfigManager manager;
+        for (int i = 0; i < 200; ++i) {
+            small.gain = (float)i;
+            large.table[i % 40] = (float)i;
+            REQUIRE(store(manager));
+        }
+        CHECK(n_erases[0] > 1);
+        CHECK(n_erases[1] > 1);
+
+        SmallConfig s;
+        LargeConfig l;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, &s, &l));
+        CHECK(s.gain == 199.0f);
+        CHECK(l.table[199 % 40] == 199.0f);
+        CHECK(l.table[0] == 160.0f);
+    }
+
+    TEST_CASE("interrupted store keeps the old config") {
+        for (size_t budget = 0; budget < 400; budget += 7) {
+            reset_flash();
+            ConfigManager manager;
+            small.gain = 1.0f;
+            REQUIRE(store(manager));
+            small.gain = 2.0f;
+            REQUIRE(store(manager));
+
+            // Change all records so that the store doesn't fit and compacts
+            // after a few iterations
+            program_budget = budget;
+            small.gain = 3.0f;
+            large.table[0] = 3.0f;
+            bool stored = store(manager);
+            program_budget = SIZE_MAX;
+
+            SmallConfig s;
+            LargeConfig l;
+            ConfigManager reloaded;
+            REQUIRE(load(reloaded, &s, &l));
+            CHECK(s.gain == (stored ? 3.0f : 2.0f));
+
+            // The next store succeeds despite the interrupted one
+            small.gain = 4.0f;
+            REQUIRE(store(manager));
+            REQUIRE(load(reloaded, &s, &l));
+            CHECK(s.gain == 4.0f);
+        }
+    }
+
+    TEST_CASE("append keeps the other records and never compacts") {
+        reset_flash();
+        ConfigManager manager;
+        size_t size = 0;
+        SmallConfig s;
+        LargeConfig l;
+        CHECK(manager.prepare_store());
+        CHECK(!manager.finish_append(&size)); // no valid sector yet
+
+        large.table[3] = 3.0f;
+        REQUIRE(store(manager));
+        int i = 0;
+        for (;; ++i) {
+            small.gain = (float)i;
+            REQUIRE(manager.prepare_store());
+            REQUIRE(manager.write<SmallConfigFields>(1, &small));
+            if (!manager.finish_append(&size))
+                break;
+            REQUIRE(load(manager, &s, &l));
+            CHECK(s.gain == (float)i);
+            CHECK(l.table[3] == 3.0f);
+        }
+        CHECK(i > 1);
+        CHECK(n_erases[0] + n_erases[1] == 0);
+        REQUIRE(load(manager, &s, &l));
+        CHECK(s.gain == (float)(i - 1)); // the failed append left the log as it was
+
+        // A regular store compacts and takes over
+        REQUIRE(store(manager));
+        REQUIRE(load(manager, &s, &l));
+        CHECK(s.gain == (float)i);
+        CHECK(l.table[3] == 3.0f);
+    }
+
+    TEST_CASE("fields are matched by ID and size") {
+        reset_flash();
+        ConfigManager manager;
+        small.gain = 2.0f;
+        small.flags = 3;
+        small.sub.pins[0] = 10;
+        REQUIRE(store(manager));
+
+        NewConfig config;
+        size_t size = 0;
+        REQUIRE(manager.start_load());
+        REQUIRE(manager.read<NewConfigFields>(1, &config));
+        REQUIRE(manager.finish_load(&size));
+        CHECK(config.gain == 2.0f);
+        CHECK(config.pins[0] == 10);
+        CHECK(config.pins[1] == 8); // not stored
+        CHECK(config.flags == 5);   // stored with a different size
+        CHECK(config.added == 4.0f);
+
+        // A record that doesn't exist leaves the object untouched
+        REQUIRE(manager.start_load());
+        REQUIRE(manager.read<NewConfigFields>(3, &config));
+        REQUIRE(manager.finish_load(&size));
+        CHECK(config.gain == 2.0f);
+
+        // The record changed, so it is stored again
+        size_t programmed = n_programmed;
+        config.pins[1] = 11;
+        REQUIRE(manager.prepare_store());
+        REQUIRE(manager.write<NewConfigFields>(1, &config));
+        REQUIRE(manager.finish_store(&size));
+        CHECK(n_programmed > programmed);
+        NewConfig reloaded;
+        REQUIRE(manager.start_load());
+        REQUIRE(manager.read<NewConfigFields>(1, &reloaded));
+        CHECK(reloaded.pins[1] == 11);
+        CHECK(reloaded.flags == 5);
+    }
+
+    TEST_CASE("duplicate keys and IDs fail to store") {
+        reset_flash();
+        ConfigManager manager;
+        size_t size = 0;
+        REQUIRE(manager.prepare_store());
+        REQUIRE(manager.write<SmallConfigFields>(1, &small));
+        CHECK(!manager.write<LargeConfigFields>(1, &large));
+        CHECK(!manager.finish_store(&size));
+
+        REQUIRE(manager.prepare_store());
+        CHECK(!manager.write<DuplicateFields>(1, &small));
+        CHECK(!manager.finish_store(&size));
+
+        REQUIRE(store(manager));
+    }
+
+    TEST_CASE("background store") {
+        reset_flash();
+        ConfigManager manager;
+        REQUIRE(store(manager));
+
+        std::vector<uint32_t> snapshot;
+        small.gain = 5.0f;
+        REQUIRE(start_background_store(manager, &snapshot));
+        CHECK(snapshot.size() * 4 < sizeof(LargeConfig)); // only the changed record
+        small.gain = 6.0f; // after the snapshot
+        CHECK(!manager.prepare_store());
+        CHECK(!manager.background_store_needs_erase());
+
+        // The old config stays valid until the commit record is complete
+        size_t size = 0;
+        size_t n_steps = 0;
+        while (manager.continue_background_store(4, &size) == ConfigManager::kBackgroundStoreBusy) {
+            ++n_steps;
+            SmallConfig s;
+            LargeConfig l;
+            ConfigManager reloaded;
+            REQUIRE(load(reloaded, &s, &l));
+            CHECK(s.gain == (n_steps < snapshot.size() ? 1.0f : 5.0f));
+        }
+        CHECK(n_steps == snapshot.size());
+
+        SmallConfig s;
+        LargeConfig l;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, &s, &l));
+        CHECK(s.gain == 5.0f);
+
+        // Nothing changed since the snapshot was written except for the gain
+        REQUIRE(start_background_store(manager, &snapshot));
+        CHECK(snapshot.size() > 0);
+        run_background_store(manager);
+        REQUIRE(start_background_store(manager, &snapshot));
+        CHECK(snapshot.size() == 0);
+        CHECK(run_background_store(manager) == 0);
+        REQUIRE(load(reloaded, &s, &l));
+        CHECK(s.gain == 6.0f);
+    }
+
+    TEST_CASE("background store compacts into the other sector") {
+        reset_flash();
+        ConfigManager manager;
+        std::vector<uint32_t> snapshot;
+        size_t n_erases_seen = 0;
+        for (int i = 0; i < 100; ++i) {
+            small.gain = (float)i;
+            large.table[i % 40] = (float)i;
+            REQUIRE(start_background_store(manager, &snapshot));
+            if (manager.background_store_needs_erase())
+                n_erases_seen++;
+            run_background_store(manager, 64);
+        }
+        CHECK(n_erases_seen > 1);
+        CHECK(n_erases[0] + n_erases[1] == n_erases_seen);
+
+        SmallConfig s;
+        LargeConfig l;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, &s, &l));
+        CHECK(s.gain == 99.0f);
+        CHECK(l.table[99 % 40] == 99.0f);
+    }
+
+    TEST_CASE("abandoned background store keeps the old config") {
+        for (size_t n_steps = 0; n_steps < 60; n_steps += 3) {
+            reset_flash();
+            ConfigManager manager;
+            small.gain = 1.0f;
+            REQUIRE(store(manager));
+
+            // Reset after a few steps
+            std::vector<uint32_t> snapshot;
+            small.gain = 2.0f;
+            large.table[0] = 2.0f;
+            REQUIRE(start_background_store(manager, &snapshot));
+            size_t size = 0;
+            bool stored = false;
+            for (size_t i = 0; i <= n_steps && !stored; ++i)
+                stored = manager.continue_background_store(4, &size) == ConfigManager::kBackgroundStoreDone;
+
+            SmallConfig s;
+            LargeConfig l;
+            ConfigManager reloaded;
+            REQUIRE(load(reloaded, &s, &l));
+            CHECK(s.gain == (stored ? 2.0f : 1.0f));
+
+            small.gain = 3.0f;
+            REQUIRE(store(reloaded));
+            REQUIRE(load(reloaded, &s, &l));
+            CHECK(s.gain == 3.0f);
+        }
+    }
+
+    TEST_CASE("export and load an image") {
+        reset_flash();
+        ConfigManager manager;
+        small.gain = 2.5f;
+        small.sub.pins[2] = 9;
+        large.table[7] = 7.0f;
+        size_t size = 0;
+        REQUIRE(manager.prepare_store());
+        REQUIRE(manager.write<SmallConfigFields>(1, &small));
+        REQUIRE(manager.write<LargeConfigFields>(2, &large));
+        REQUIRE(manager.export_image(nullptr, &size));
+        std::vector<uint32_t> image(size / 4);
+        REQUIRE(manager.export_image((uint8_t*)image.data(), &size));
+        CHECK(size == image.size() * 4);
+        CHECK(n_programmed == 0); // NVM isn't touched
+
+        // Same bytes as a compacted sector, except for the generation
+        REQUIRE(store(manager));
+        CHECK(memcmp(fake_sectors[0] + 8, (uint8_t*)image.data() + 8, size - 8) == 0);
+
+        SmallConfig s;
+        LargeConfig l;
+        REQUIRE(manager.start_load_image((const uint8_t*)image.data(), size));
+        REQUIRE(manager.read<SmallConfigFields>(1, &s));
+        REQUIRE(manager.read<LargeConfigFields>(2, &l));
+        REQUIRE(manager.finish_load(&size));
+        CHECK(s.gain == 2.5f);
+        CHECK(s.sub.pins[2] == 9);
+        CHECK(l.table[7] == 7.0f);
+
+        // NVM loads are unaffected by the last image
+        small.gain = 4.0f;
+        REQUIRE(store(manager));
+        REQUIRE(load(manager, &s, &l));
+        CHECK(s.gain == 4.0f);
+    }
+
+    TEST_CASE("corrupt images fail to load") {
+        reset_flash();
+        ConfigManager manager;
+        size_t size = 0;
+        REQUIRE(manager.prepare_store());
+        REQUIRE(manager.write<SmallConfigFields>(1, &small));
+        REQUIRE(manager.export_image(nullptr, &size));
+        std::vector<uint32_t> image(size / 4);
+        REQUIRE(manager.export_image((uint8_t*)image.data(), &size));
+        const uint8_t* data = (const uint8_t*)image.data();
+        REQUIRE(manager.start_load_image(data, size));
+        REQUIRE(manager.finish_load(nullptr));
+
+        CHECK(!manager.start_load_image(data, size - 4)); // truncated commit record
+        CHECK(!manager.start_load_image(data, 4));
+        ((uint8_t*)image.data())[20] ^= 1;
+        CHECK(!manager.start_load_image(data, size));
+        ((uint8_t*)image.data())[20] ^= 1;
+        image[0] = 0;
+        CHECK(!manager.start_load_image(data, size));
+
+        size_t too_small = size - 4;
+        REQUIRE(manager.prepare_store());
+        REQUIRE(manager.write<SmallConfigFields>(1, &small));
+        CHECK(!manager.export_image((uint8_t*)image.data(), &too_small));
+        CHECK(too_small == size); // the size the buffer would need
+
+        // Without an open store operation
+        size_t no_store = size;
+        CHECK(!manager.export_image(nullptr, &no_store));
+        CHECK(no_store == 0);
+    }
+
+    TEST_CASE("field IDs") {
+        // 32-bit FNV-1a
+        static_assert(config_field_id("") == 0x811c9dc5, "");
+        CHECK(config_field_id("a") == 0xe40c292c);
+        CHECK(config_field_id("foobar") == 0xbf9cf968);
+    }
+}
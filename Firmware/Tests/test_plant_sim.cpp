@@ -0,0 +1,157 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/mech_identifier.hpp"
+#include "Tests/control_loop_model.hpp"
+#include "Tests/pmsm_plant.hpp"
+
+// Simulation of the host control loop models against PmsmPlant at the
+// current measurement rate of the v3 boards. The models share their kernels
+// with the firmware (see control_loop_model.hpp), but this doesn't run the
+// Motor, Encoder, Controller and Axis classes themselves: it checks the plant
+// and the control laws, not the integration of the firmware control loop.
+
+static const float dt = 1.0f / 8000.0f;
+
+struct SimAxis {
+    explicit SimAxis(const PmsmPlant::Params_t& params)
+            : plant(params),
+              foc(current_control_bandwidth * params.phase_inductance, 0.0f, dt),
+              encoder(8192, 1000.0f, dt),
+              controller(dt) {
+        foc.i_gain = (params.phase_resistance / params.phase_inductance) * foc.p_gain;
+        controller.vel_gain = 0.02f;
+        controller.vel_integrator_gain = 0.2f;
+        controller.vel_limit = INFINITY;
+        controller.torque_lim = 10.0f * params.torque_constant;
+    }
+
+    void foc_current(float Id_des, float Iq_des, float I_phase, float pwm_phase) {
+        float I[3];
+        plant.phase_currents(I);
+        FocCurrentModel::Output_t out = foc.update(I, plant.params().vbus_voltage, Id_des, Iq_des, I_phase, pwm_phase);
+        Id = out.Id;
+        Iq = out.Iq;
+        REQUIRE(out.valid);
+        apply_timings(out.timings);
+    }
+
+    // The timings take effect for the next PWM period, like on the hardware
+    void apply_timings(const float timings[3]) {
+        float duty[3] = {1.0f - timings[0], 1.0f - timings[1], 1.0f - timings[2]};
+        plant.step(duty, dt);
+    }
+
+    void apply_modulation(float mod_alpha, float mod_beta) {
+        float timings[3];
+        REQUIRE(minmax_svm(mod_alpha, mod_beta, timings));
+        apply_timings(timings);
+    }
+
+    // One control loop iteration in velocity control
+    float run_velocity(float vel_setpoint) {
+        encoder.update((int32_t)std::floor(plant.pos() * (float)encoder.cpr));
+        vel_estimate = encoder.vel_estimate();
+        float torque = controller.update(0.0f, vel_setpoint, 0.0f, encoder.pos_estimate(), vel_estimate);
+        float phase = plant.electrical_phase();
+        float phase_vel = 2.0f * (float)M_PI * plant.params().pole_pairs * vel_estimate;
+        foc_current(0.0f, torque / plant.params().torque_constant, phase, phase + 1.5f * dt * phase_vel);
+        return torque;
+    }
+
+    PmsmPlant plant;
+    float current_control_bandwidth = 1000.0f; // [rad/s]
+    FocCurrentModel foc;
+    EncoderPllModel encoder;
+    ControllerModel controller;
+    float Id = 0.0f, Iq = 0.0f;
+    float vel_estimate = 0.0f;
+};
+
+static PmsmPlant::Params_t locked_rotor() {
+    PmsmPlant::Params_t params;
+    params.inertia = 1e9f;
+    return params;
+}
+
+TEST_SUITE("plant_sim") {
+    TEST_CASE("open loop voltage drives the steady state current") {
+        SimAxis axis(locked_rotor());
+        float V = 0.5f;
+        float mod_alpha = V / ((2.0f / 3.0f) * axis.plant.params().vbus_voltage);
+        for (int i = 0; i < 400; ++i)
+            axis.apply_modulation(mod_alpha, 0.0f);
+        float I[3];
+        axis.plant.phase_currents(I);
+        CHECK(I[0] == doctest::Approx(V / axis.plant.params().phase_resistance).epsilon(0.01));
+        CHECK(I[0] + I[1] + I[2] == doctest::Approx(0.0f).epsilon(1e-4));
+    }
+
+    TEST_CASE("coasting rotor slows down by the friction") {
+        PmsmPlant::Params_t params;
+        SimAxis axis(params);
+        for (int i = 0; i < (int)(0.5f / dt); ++i)
+            axis.run_velocity(5.0f);
+        float vel = axis.plant.vel();
+        float pos = axis.plant.pos();
+        for (int i = 0; i < (int)(0.1f / dt); ++i)
+            axis.plant.coast(dt);
+        CHECK(axis.plant.iq() == 0.0f);
+        // Viscous friction only, so the velocity decays exponentially
+        float tau = params.inertia / params.viscous_friction;
+        CHECK(axis.plant.vel() == doctest::Approx(vel * std::exp(-0.1f / tau)).epsilon(1e-3));
+        CHECK(axis.plant.pos() - pos == doctest::Approx(vel * tau * (1.0f - std::exp(-0.1f / tau))).epsilon(1e-3));
+    }
+
+    TEST_CASE("current step follows the configured bandwidth") {
+        SimAxis axis(locked_rotor());
+        const float Iq_des = 10.0f;
+        float tau = 1.0f / axis.current_control_bandwidth;
+        int i = 0;
+        for (; i < (int)(tau / dt); ++i)
+            axis.foc_current(0.0f, Iq_des, 0.0f, 0.0f);
+        // First order response with one period of delay
+        CHECK(axis.Iq / Iq_des == doctest::Approx(1.0f - std::exp(-1.0f)).epsilon(0.15));
+        for (; i < (int)(10.0f * tau / dt); ++i)
+            axis.foc_current(0.0f, Iq_des, 0.0f, 0.0f);
+        CHECK(axis.Iq == doctest::Approx(Iq_des).epsilon(0.01));
+        CHECK(std::abs(axis.Id) < 0.05f);
+    }
+
+    TEST_CASE("velocity loop settles on a step and rejects a load step") {
+        PmsmPlant::Params_t params;
+        SimAxis axis(params);
+        float max_vel = 0.0f;
+        for (int i = 0; i < (int)(1.0f / dt); ++i) {
+            axis.run_velocity(5.0f);
+            max_vel = std::max(max_vel, axis.plant.vel());
+        }
+        CHECK(axis.plant.vel() == doctest::Approx(5.0f).epsilon(0.01));
+        CHECK(max_vel < 5.0f * 1.3f);
+
+        axis.plant.set_load_torque(0.1f);
+        for (int i = 0; i < (int)(1.0f / dt); ++i)
+            axis.run_velocity(5.0f);
+        CHECK(axis.plant.vel() == doctest::Approx(5.0f).epsilon(0.01));
+        CHECK(axis.controller.vel_integrator_torque == doctest::Approx(0.1f + params.viscous_friction * 2.0f * (float)M_PI * 5.0f).epsilon(0.05));
+    }
+
+    TEST_CASE("mechanical identification in the loop") {
+        PmsmPlant::Params_t params;
+        params.coulomb_friction = 0.005f;
+        SimAxis axis(params);
+        MechIdentifier ident;
+        const int decimation = 8;
+        for (int i = 0; i < (int)(10.0f / dt); ++i) {
+            float t = i * dt;
+            float vel_des = 2.0f * std::sin(2.0f * (float)M_PI * 0.5f * t) + 0.5f * std::sin(2.0f * (float)M_PI * 3.0f * t);
+            axis.run_velocity(vel_des);
+            ident.filter(params.torque_constant * axis.Iq, axis.vel_estimate, 2.0f * (float)M_PI * 20.0f * dt);
+            if (i % decimation == 0)
+                ident.update(decimation * dt, 0.9995f, params.coulomb_band / (2.0f * (float)M_PI));
+        }
+        // The identifier works in turns, the plant in radians
+        CHECK(ident.inertia() == doctest::Approx(params.inertia * 2.0f * (float)M_PI).epsilon(0.1));
+        CHECK(ident.coulomb() == doctest::Approx(params.coulomb_friction).epsilon(0.2));
+    }
+}
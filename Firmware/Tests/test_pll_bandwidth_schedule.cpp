@@ -0,0 +1,55 @@
+#include <doctest.h>
+
+#include "MotorControl/pll_bandwidth_schedule.hpp"
+
+#include <cmath>
+
+TEST_SUITE("PllBandwidthSchedule") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("interpolates geometrically between the bandwidths") {
+        PllBandwidthSchedule schedule;
+        schedule.build(100.0f, 1600.0f);
+        CHECK(schedule.update(0.0f, 10.0f, 0.0f, 0.05f, dt) == doctest::Approx(100.0f));
+        schedule.reset();
+        CHECK(schedule.update(5.0f, 10.0f, 0.0f, 0.05f, dt) == doctest::Approx(400.0f).epsilon(0.02));
+        schedule.reset();
+        CHECK(schedule.update(-20.0f, 10.0f, 0.0f, 0.05f, dt) == doctest::Approx(1600.0f));
+    }
+
+    TEST_CASE("holds the bandwidth after a move") {
+        PllBandwidthSchedule schedule;
+        schedule.build(100.0f, 1600.0f);
+        for (int k = 0; k < 100; ++k)
+            schedule.update(10.0f, 10.0f, 0.0f, 0.05f, dt);
+        CHECK(schedule.load() == doctest::Approx(1.0f));
+
+        // Decays with the hold time once stopped
+        for (int k = 0; k < 400; ++k) // 0.05s
+            schedule.update(0.0f, 10.0f, 0.0f, 0.05f, dt);
+        CHECK(schedule.load() == doctest::Approx(std::exp(-1.0f)).epsilon(0.01));
+        for (int k = 0; k < 4000; ++k)
+            schedule.update(0.0f, 10.0f, 0.0f, 0.05f, dt);
+        CHECK(schedule.update(0.0f, 10.0f, 0.0f, 0.05f, dt) == doctest::Approx(100.0f).epsilon(0.01));
+    }
+
+    TEST_CASE("raises the bandwidth with the acceleration") {
+        PllBandwidthSchedule schedule;
+        schedule.build(100.0f, 1600.0f);
+        float vel = 0.0f, bw = 0.0f;
+        for (int k = 0; k < 400; ++k) { // 0.05s at 100 turn/s^2 up to 5 turn/s
+            vel += 100.0f * dt;
+            bw = schedule.update(vel, 1000.0f, 100.0f, 0.05f, dt);
+        }
+        CHECK(bw > 1000.0f);
+
+        // Without the acceleration term only the velocity counts
+        schedule.reset();
+        vel = 0.0f;
+        for (int k = 0; k < 400; ++k) {
+            vel += 100.0f * dt;
+            bw = schedule.update(vel, 1000.0f, 0.0f, 0.05f, dt);
+        }
+        CHECK(bw < 110.0f);
+    }
+}
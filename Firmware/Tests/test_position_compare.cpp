@@ -0,0 +1,97 @@
+#include <doctest.h>
+
+#include "MotorControl/position_compare.hpp"
+
+#include <stdint.h>
+
+TEST_SUITE("PositionCompare") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("single position") {
+        PositionCompare::Config_t config;
+        config.positions[0] = 100;
+        config.pulse_width = 3.5f * dt;
+        PositionCompare pc;
+        pc.arm(0);
+        CHECK(!pc.update(config, 60, dt));
+        CHECK(pc.update(config, 120, dt)); // crossed at 100
+        CHECK(pc.fired());
+        CHECK(pc.phase() == doctest::Approx(40.0f / 60.0f));
+        CHECK(!pc.armed());
+        // Held for the pulse width, rounded up to whole periods
+        CHECK(pc.update(config, 180, dt));
+        CHECK(!pc.fired());
+        CHECK(pc.update(config, 240, dt));
+        CHECK(pc.update(config, 300, dt));
+        CHECK(!pc.update(config, 360, dt));
+        CHECK(pc.triggers() == 1);
+
+        // Doesn't fire again until armed
+        CHECK(!pc.update(config, 0, dt));
+        CHECK(!pc.update(config, 200, dt));
+    }
+
+    TEST_CASE("list in the direction of travel") {
+        PositionCompare::Config_t config;
+        config.num_positions = 3;
+        config.positions[0] = -10;
+        config.positions[1] = -50;
+        config.positions[2] = -20;
+        PositionCompare pc;
+        pc.arm(0);
+        pc.update(config, -10, dt); // reaching the target exactly counts
+        CHECK(pc.fired());
+        CHECK(pc.phase() == doctest::Approx(1.0f));
+        pc.update(config, -40, dt);
+        CHECK(!pc.fired()); // -20 is only armed after -50
+        pc.update(config, -60, dt);
+        CHECK(pc.fired());
+        pc.update(config, -30, dt);
+        CHECK(!pc.fired());
+        pc.update(config, -15, dt);
+        CHECK(pc.fired()); // -20 on the way back
+        CHECK(pc.triggers() == 3);
+        CHECK(!pc.armed());
+    }
+
+    TEST_CASE("periodic targets") {
+        PositionCompare::Config_t config;
+        config.positions[0] = 1000;
+        config.interval = 250;
+        config.num_periodic = 4;
+        PositionCompare pc;
+        pc.arm(0);
+        int fired = 0;
+        for (int32_t count = 0; count <= 3000; count += 7) {
+            pc.update(config, count, dt);
+            fired += pc.fired();
+        }
+        CHECK(fired == 4);
+        CHECK(pc.triggers() == 4);
+        CHECK(pc.merged() == 0);
+        CHECK(!pc.armed());
+
+        // Unlimited, faster than the spacing
+        config.num_periodic = 0;
+        pc.reset_counters();
+        pc.arm(0);
+        pc.update(config, 1600, dt); // 1000, 1250 and 1500 at once
+        CHECK(pc.fired());
+        CHECK(pc.phase() == doctest::Approx(1000.0f / 1600.0f));
+        CHECK(pc.triggers() == 3);
+        CHECK(pc.merged() == 2);
+        CHECK(pc.armed());
+    }
+
+    TEST_CASE("wraps with the linear count") {
+        PositionCompare::Config_t config;
+        config.positions[0] = INT32_MIN + 5;
+        PositionCompare pc;
+        pc.arm(INT32_MAX - 5);
+        pc.update(config, INT32_MAX, dt);
+        CHECK(!pc.fired());
+        pc.update(config, INT32_MIN + 10, dt);
+        CHECK(pc.fired());
+        CHECK(pc.phase() == doctest::Approx(6.0f / 11.0f));
+    }
+}
@@ -0,0 +1,40 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/pulse_filter.hpp"
+
+TEST_SUITE("PulseFilter") {
+    TEST_CASE("passes the values through by default") {
+        PulseFilter filter;
+        PulseFilter::Config_t config = {false, INFINITY};
+        CHECK(filter.update(config, 1.5f, 0.02f) == 1.5f);
+        CHECK(filter.update(config, 1.0f, 0.02f) == 1.0f);
+    }
+
+    TEST_CASE("the median rejects a single glitch") {
+        PulseFilter filter;
+        PulseFilter::Config_t config = {true, INFINITY};
+        filter.update(config, 1.5f, 0.02f);
+        filter.update(config, 1.5f, 0.02f);
+        CHECK(filter.update(config, 2.5f, 0.02f) == 1.5f);
+        CHECK(filter.update(config, 1.5f, 0.02f) == 1.5f);
+        CHECK(filter.update(config, 1.5f, 0.02f) == 1.5f);
+        // A step passes after one value of latency
+        CHECK(filter.update(config, 2.0f, 0.02f) == 1.5f);
+        CHECK(filter.update(config, 2.0f, 0.02f) == 2.0f);
+    }
+
+    TEST_CASE("low pass") {
+        PulseFilter filter;
+        PulseFilter::Config_t config = {false, 1.0f};
+        filter.update(config, 0.0f, 0.02f);
+        float y = 0.0f;
+        for (int i = 0; i < 50; ++i) // 1s at 50Hz
+            y = filter.update(config, 1.0f, 0.02f);
+        CHECK(y == doctest::Approx(1.0f - std::pow(1.0f - 2.0f * (float)M_PI * 0.02f, 50.0f)));
+        CHECK(y > 0.99f);
+
+        filter.reset();
+        CHECK(filter.update(config, 5.0f, 0.02f) == 5.0f);
+    }
+}
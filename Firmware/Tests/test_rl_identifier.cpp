@@ -0,0 +1,56 @@
+#include <doctest.h>
+#include <cmath>
+#include <stdint.h>
+
+#include "MotorControl/rl_identifier.hpp"
+
+static const float dt = 1.0f / 8000.0f;
+
+// Drives a simulated winding with a DC voltage plus a pseudo random binary
+// sequence with 1% measurement noise. Like on the hardware the commanded voltage takes effect one
+// period later and the inverter loses a constant voltage to the dead time.
+static bool run(float R, float L, float V_dc, float V_step, float noise, float* R_est, float* L_est) {
+    const float V_err = 0.1f;
+    const int num_samples = 1600;
+    RLIdentifier ident;
+    ident.reset(0.0f, V_dc);
+    float a = std::exp(-R * dt / L);
+    float I = 0.0f, V_active = 0.0f;
+    uint32_t lfsr = 0x5a;
+    uint32_t rng = 12345;
+    for (int k = 0; k < num_samples; ++k) {
+        rng = rng * 1664525u + 1013904223u;
+        float I_meas = I + noise * ((float)(rng >> 8) / 8388608.0f - 1.0f);
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0x60u); // 7 bit maximal length
+        float V = V_dc + ((lfsr & 1) ? V_step : -V_step);
+        ident.add(I_meas, V);
+        // zero order hold over one period with the previous command
+        float V_eff = V_active - V_err;
+        I = a * I + (1.0f - a) * V_eff / R;
+        V_active = V;
+    }
+    return ident.solve(dt, R_est, L_est);
+}
+
+TEST_SUITE("RLIdentifier") {
+    TEST_CASE("identifies R and L across the motor range") {
+        struct { float R, L, V_dc; } motors[] = {
+            {0.05f, 20e-6f, 0.5f},  // high current hobby motor
+            {0.2f, 200e-6f, 2.0f},
+            {2.0f, 2000e-6f, 4.0f}, // gimbal like
+        };
+        for (auto& m : motors) {
+            float R, L;
+            REQUIRE(run(m.R, m.L, m.V_dc, 0.25f * m.V_dc, 0.01f * m.V_dc / m.R, &R, &L));
+            CHECK(R == doctest::Approx(m.R).epsilon(0.03));
+            CHECK(L == doctest::Approx(m.L).epsilon(0.03));
+        }
+    }
+
+    TEST_CASE("no excitation") {
+        float R, L;
+        CHECK(!run(0.1f, 100e-6f, 1.0f, 0.0f, 0.0f, &R, &L));
+        RLIdentifier ident;
+        CHECK(!ident.solve(dt, &R, &L));
+    }
+}
@@ -0,0 +1,79 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/scurve_traj.hpp"
+
+static void test_scurve(float goal, float position, float velocity,
+                        float Vmax, float Amax, float Dmax, float Jmax) {
+    SCurveTrajectory traj;
+    REQUIRE(traj.plan(goal, position, velocity, Vmax, Amax, Dmax, Jmax));
+
+    const float dt = 1.0f / 8000.0f;
+    const float Vmax_test = std::max(Vmax, std::abs(velocity));
+    const float Amax_test = std::max(Amax, Dmax);
+    float acceleration = 0.0f;
+    for (float t = 0.0f; t < traj.Tf_ + dt; t += dt) {
+        SCurveTrajectory::Step_t step = traj.eval(t);
+        CHECK(std::abs(step.Yd) <= Vmax_test * 1.001f);
+        CHECK(std::abs(step.Ydd) <= Amax_test * 1.001f);
+        CHECK(std::abs(step.Ydd - acceleration) <= Jmax * dt * 1.01f);
+        // small absolute margins for float rounding of the large values
+        CHECK(std::abs(step.Yd - velocity) <= Amax_test * dt * 1.001f + 1e-6f);
+        CHECK(std::abs(step.Y - position) <= Vmax_test * dt * 1.001f + 1e-5f);
+        position = step.Y;
+        velocity = step.Yd;
+        acceleration = step.Ydd;
+    }
+
+    CHECK(position == doctest::Approx(goal).epsilon(1e-4));
+    CHECK(velocity == 0.0f);
+    CHECK(acceleration == 0.0f);
+}
+
+TEST_SUITE("S-Curve Trajectory Planner") {
+    TEST_CASE("ramp") {
+        // Amax is reached: 1 turn/s^2 after 0.1s of jerk
+        SCurveTrajectory::Ramp_t ramp = SCurveTrajectory::planRamp(0.0f, 1.0f, 1.0f, 10.0f);
+        CHECK(ramp.Tj == doctest::Approx(0.1f));
+        CHECK(ramp.Ta == doctest::Approx(0.9f));
+        CHECK(ramp.dist() == doctest::Approx(0.55f));
+        CHECK(SCurveTrajectory::evalRamp(ramp, ramp.T).Y == doctest::Approx(ramp.dist()));
+        CHECK(SCurveTrajectory::evalRamp(ramp, ramp.T).Yd == doctest::Approx(1.0f));
+
+        // Amax is not reached
+        ramp = SCurveTrajectory::planRamp(1.0f, 0.9f, 1.0f, 10.0f);
+        CHECK(ramp.Ta == doctest::Approx(0.0f));
+        CHECK(std::abs(ramp.a) == doctest::Approx(1.0f));
+        CHECK(ramp.a < 0.0f);
+    }
+
+    TEST_CASE("invalid-limits") {
+        SCurveTrajectory traj;
+        CHECK(!traj.plan(1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f));
+    }
+
+    TEST_CASE("pos-dir-long") {
+        test_scurve(10.0f, 0.0f, 0.0f, 2.0f, 1.0f, 2.0f, 10.0f);
+    }
+    TEST_CASE("neg-dir-long") {
+        test_scurve(-10.0f, 0.0f, 0.0f, 2.0f, 1.0f, 2.0f, 10.0f);
+    }
+    TEST_CASE("short-move") {
+        test_scurve(0.1f, 0.0f, 0.0f, 2.0f, 1.0f, 1.0f, 10.0f);
+        test_scurve(-0.01f, 0.0f, 0.0f, 2.0f, 1.0f, 1.0f, 5.0f);
+    }
+    TEST_CASE("moving-start") {
+        test_scurve(5.0f, 0.0f, 1.0f, 2.0f, 1.0f, 1.0f, 10.0f);
+        test_scurve(1.0f, 0.0f, 1.5f, 2.0f, 1.0f, 1.0f, 10.0f);
+    }
+    TEST_CASE("not-enough-braking-distance") {
+        test_scurve(0.5f, 0.0f, 2.0f, 2.0f, 1.0f, 1.0f, 10.0f);
+        test_scurve(-0.5f, 0.0f, -2.0f, 2.0f, 1.0f, 1.0f, 10.0f);
+    }
+    TEST_CASE("reversal") {
+        test_scurve(-3.0f, 0.0f, 1.0f, 2.0f, 1.0f, 0.5f, 10.0f);
+    }
+    TEST_CASE("over-speed") {
+        test_scurve(10.0f, 0.0f, 3.0f, 2.0f, 1.0f, 1.0f, 10.0f);
+    }
+}
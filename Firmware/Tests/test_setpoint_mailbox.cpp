@@ -0,0 +1,50 @@
+#include <doctest.h>
+
+#include "MotorControl/setpoint_mailbox.hpp"
+
+TEST_SUITE("SetpointMailbox") {
+    TEST_CASE("empty until published") {
+        SetpointMailbox mailbox;
+        SetpointMailbox::Setpoints_t sp;
+        CHECK_FALSE(mailbox.take(&sp));
+
+        mailbox.publish(SetpointMailbox::VEL | SetpointMailbox::TORQUE, 0.0f, 2.0f, 0.5f);
+        REQUIRE(mailbox.take(&sp));
+        CHECK(sp.fields == (SetpointMailbox::VEL | SetpointMailbox::TORQUE));
+        CHECK(sp.input_vel == 2.0f);
+        CHECK(sp.input_torque == 0.5f);
+        CHECK_FALSE(mailbox.take(&sp)); // taken only once
+    }
+
+    TEST_CASE("fields accumulate until taken") {
+        SetpointMailbox mailbox;
+        SetpointMailbox::Setpoints_t sp;
+        mailbox.publish(SetpointMailbox::POS | SetpointMailbox::VEL, 1.0f, 2.0f, 0.0f);
+        mailbox.publish(SetpointMailbox::TORQUE, 9.0f, 9.0f, 0.3f); // ignores pos and vel
+        mailbox.publish(SetpointMailbox::VEL, 0.0f, 4.0f, 0.0f);
+        REQUIRE(mailbox.take(&sp));
+        CHECK(sp.fields == (SetpointMailbox::POS | SetpointMailbox::VEL | SetpointMailbox::TORQUE));
+        CHECK(sp.input_pos == 1.0f);
+        CHECK(sp.input_vel == 4.0f);
+        CHECK(sp.input_torque == 0.3f);
+
+        // After a take only the new fields are reported
+        mailbox.publish(SetpointMailbox::TORQUE, 0.0f, 0.0f, 0.1f);
+        REQUIRE(mailbox.take(&sp));
+        CHECK(sp.fields == SetpointMailbox::TORQUE);
+        CHECK(sp.input_torque == 0.1f);
+    }
+
+    TEST_CASE("alternating publish and take") {
+        SetpointMailbox mailbox;
+        SetpointMailbox::Setpoints_t sp;
+        mailbox.publish(SetpointMailbox::POS | SetpointMailbox::VEL, 1.0f, 2.0f, 0.0f);
+        REQUIRE(mailbox.take(&sp));
+        for (int i = 0; i < 5; ++i) {
+            mailbox.publish(SetpointMailbox::POS | SetpointMailbox::VEL, (float)i, (float)(2 * i), 0.0f);
+            REQUIRE(mailbox.take(&sp));
+            CHECK(sp.input_pos == (float)i);
+            CHECK(sp.input_vel == (float)(2 * i));
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#include <doctest.h>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+
+#include "Tests/sim/sim_can.hpp"
+
+using namespace odrive_sim;
+
+// The CAN path of Tests/sim/odrive_sim.cpp. The simulator's node runs over a
+// socketpair that carries one struct can_frame per datagram like a raw
+// SocketCAN socket, and over a virtual CAN interface if ODRIVE_SIM_TEST_CAN
+// names one, e.g. vcan0.
+
+static void send_frame(int socket, uint32_t id, bool rtr, const can_Message_t& payload = {}) {
+    struct can_frame frame = {};
+    frame.can_id = id | (rtr ? CAN_RTR_FLAG : 0);
+    frame.can_dlc = payload.len;
+    memcpy(frame.data, payload.buf, payload.len);
+    REQUIRE(write(socket, &frame, sizeof(frame)) == sizeof(frame));
+}
+
+static bool receive_frame(int socket, can_Message_t* msg) {
+    struct pollfd pfd = {socket, POLLIN, 0};
+    struct can_frame frame;
+    if (poll(&pfd, 1, 100) != 1 || read(socket, &frame, sizeof(frame)) != sizeof(frame))
+        return false;
+    msg->id = frame.can_id & CAN_SFF_MASK;
+    msg->rtr = frame.can_id & CAN_RTR_FLAG;
+    msg->len = frame.can_dlc;
+    memcpy(msg->buf, frame.data, frame.can_dlc);
+    return true;
+}
+
+// @brief Talks to the simulator's node on the other end of host like a CAN
+// master, with the axes on nodes 0 and 3
+static void check_can_node(SimBoard& board, SimCanBus& bus, int host) {
+    constexpr uint32_t node = 3 << NUM_CMD_ID_BITS;
+    board.axes[0].node_id = 0;
+    board.axes[1].node_id = 3;
+    for (SimAxis& axis : board.axes)
+        axis.heartbeat_rate_ms = axis.encoder_rate_ms = 0;
+
+    can_Message_t msg;
+    can_Message_t payload;
+    can_setSignal<float>(payload, 1.5f, 0, 32, true);
+    can_setSignal<float>(payload, 0.25f, 32, 32, true);
+    send_frame(host, node | MSG_SET_INPUT_VEL, false, payload);
+    REQUIRE(bus.receive());
+    CHECK(board.axes[1].input_vel == 1.5f);
+    CHECK(board.axes[1].input_torque == 0.25f);
+    CHECK(board.axes[0].input_vel == 0.0f);
+
+    // Frames of the other format are ignored
+    struct can_frame ext = {};
+    ext.can_id = (node | MSG_SET_INPUT_TORQUE) | CAN_EFF_FLAG;
+    ext.can_dlc = 8;
+    REQUIRE(write(host, &ext, sizeof(ext)) == sizeof(ext));
+    REQUIRE(bus.receive());
+    CHECK(board.axes[1].input_torque == 0.25f);
+
+    // Remote frames request the signals, the replies come from the node
+    board.axes[1].pos_estimate = 1.25f;
+    board.axes[1].vel_estimate = -2.0f;
+    send_frame(host, node | MSG_GET_ENCODER_ESTIMATES, true);
+    REQUIRE(bus.receive());
+    REQUIRE(receive_frame(host, &msg));
+    CHECK(msg.id == (node | MSG_GET_ENCODER_ESTIMATES));
+    CHECK(can_getSignal<float>(msg, 0, 32, true) == 1.25f);
+    CHECK(can_getSignal<float>(msg, 32, 32, true) == -2.0f);
+    CHECK(!receive_frame(host, &msg));
+
+    // Closed loop velocity control commanded over CAN
+    payload = {};
+    can_setSignal<uint32_t>(payload, AXIS_STATE_CLOSED_LOOP_CONTROL, 0, 32, true);
+    send_frame(host, node | MSG_SET_AXIS_REQUESTED_STATE, false, payload);
+    REQUIRE(bus.receive());
+    payload = {};
+    can_setSignal<float>(payload, 2.0f, 0, 32, true);
+    send_frame(host, node | MSG_SET_INPUT_VEL, false, payload);
+    REQUIRE(bus.receive());
+    for (int i = 0; i < 4000; ++i)
+        board.axes[1].update();
+    CHECK(board.axes[1].current_state == AXIS_STATE_CLOSED_LOOP_CONTROL);
+    send_frame(host, node | MSG_GET_ENCODER_ESTIMATES, true);
+    REQUIRE(bus.receive());
+    REQUIRE(receive_frame(host, &msg));
+    CHECK(can_getSignal<float>(msg, 32, 32, true) == doctest::Approx(2.0f).epsilon(0.1));
+
+    // The heartbeat carries the error and state at the configured rate
+    board.axes[1].heartbeat_rate_ms = 100;
+    board.axes[1].last_heartbeat = 0;
+    send_frame(host, node | MSG_ODRIVE_ESTOP, false);
+    REQUIRE(bus.receive());
+    bus.send_cyclic(board.axes[1], 50);
+    CHECK(!receive_frame(host, &msg));
+    bus.send_cyclic(board.axes[1], 100);
+    REQUIRE(receive_frame(host, &msg));
+    CHECK(msg.id == (node | MSG_ODRIVE_HEARTBEAT));
+    CHECK(can_getSignal<uint32_t>(msg, 0, 32, true) == (uint32_t)AXIS_ERROR_ESTOP_REQUESTED);
+    CHECK(can_getSignal<uint32_t>(msg, 32, 32, true) == (uint32_t)AXIS_STATE_IDLE);
+
+    send_frame(host, node | MSG_CLEAR_ERRORS, false);
+    REQUIRE(bus.receive());
+    CHECK(board.axes[1].error == 0);
+    CHECK(bus.tx_dropped() == 0);
+}
+
+TEST_SUITE("odrive_sim") {
+    TEST_CASE("CAN loopback") {
+        int sockets[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) == 0);
+        SimBoard board;
+        SimCanBus bus(board);
+        bus.attach(sockets[0]);
+        check_can_node(board, bus, sockets[1]);
+        close(sockets[0]);
+        close(sockets[1]);
+    }
+
+    TEST_CASE("virtual CAN") {
+        const char* interface = getenv("ODRIVE_SIM_TEST_CAN");
+        if (!interface) {
+            MESSAGE("set ODRIVE_SIM_TEST_CAN to a virtual CAN interface to run this test");
+            return;
+        }
+        int sockets[2] = {open_can_socket(interface), open_can_socket(interface)};
+        REQUIRE(sockets[0] >= 0);
+        REQUIRE(sockets[1] >= 0);
+        SimBoard board;
+        SimCanBus bus(board);
+        bus.attach(sockets[0]);
+        check_can_node(board, bus, sockets[1]);
+        close(sockets[0]);
+        close(sockets[1]);
+    }
+}
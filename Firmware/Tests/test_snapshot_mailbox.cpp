@@ -0,0 +1,69 @@
+#include <doctest.h>
+
+#include "MotorControl/snapshot_mailbox.hpp"
+
+struct Feedback_t {
+    uint32_t loop_counter;
+    float pos;
+    float vel;
+};
+
+// Copying it into the reader simulates a control loop interrupt that writes
+// the mailbox in the middle of the copy
+struct Interrupted_t {
+    Interrupted_t& operator=(const Interrupted_t& other);
+    int value = 0;
+};
+
+static SnapshotMailbox<Interrupted_t> interrupted_mailbox;
+static int interrupts_left = 0;
+static bool in_interrupt = false;
+
+Interrupted_t& Interrupted_t::operator=(const Interrupted_t& other) {
+    value = other.value;
+    if (interrupts_left > 0 && !in_interrupt) {
+        --interrupts_left;
+        in_interrupt = true; // the copy in write() isn't interrupted
+        Interrupted_t newer;
+        newer.value = other.value + 1;
+        interrupted_mailbox.write(newer);
+        in_interrupt = false;
+    }
+    return *this;
+}
+
+TEST_SUITE("snapshot_mailbox") {
+    TEST_CASE("latest value") {
+        SnapshotMailbox<Feedback_t> mailbox;
+        Feedback_t value;
+        CHECK(!mailbox.read(&value)); // nothing written yet
+
+        mailbox.write({1, 2.0f, 3.0f});
+        mailbox.write({2, 4.0f, 5.0f});
+        uint32_t seq = 0;
+        REQUIRE(mailbox.read(&value, &seq));
+        CHECK(value.loop_counter == 2);
+        CHECK(value.vel == 5.0f);
+
+        uint32_t seq_again = 0;
+        REQUIRE(mailbox.read(&value, &seq_again));
+        CHECK(seq_again == seq); // reading doesn't consume
+        mailbox.write({3, 0.0f, 0.0f});
+        REQUIRE(mailbox.read(&value, &seq_again));
+        CHECK(seq_again != seq);
+        CHECK(value.loop_counter == 3);
+    }
+
+    TEST_CASE("the reader retries after a write") {
+        interrupted_mailbox.write(Interrupted_t{});
+        Interrupted_t value;
+
+        interrupts_left = 1;
+        REQUIRE(interrupted_mailbox.read(&value));
+        CHECK(value.value == 1); // the torn copy was discarded
+
+        interrupts_left = SnapshotMailbox<Interrupted_t>::max_retries;
+        CHECK(!interrupted_mailbox.read(&value));
+        interrupts_left = 0;
+    }
+}
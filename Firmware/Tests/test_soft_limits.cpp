@@ -0,0 +1,83 @@
+#include <doctest.h>
+
+#include "MotorControl/soft_limits.hpp"
+
+#include <cmath>
+
+TEST_SUITE("SoftLimits") {
+    static SoftLimits::Config_t make_config() {
+        SoftLimits::Config_t config;
+        config.enable = true;
+        config.min_pos = -1.0f;
+        config.max_pos = 3.0f;
+        return config;
+    }
+
+    TEST_CASE("clamps the position setpoint") {
+        SoftLimits::Config_t config = make_config();
+        SoftLimits limits;
+        CHECK(limits.clamp_pos(config, 5.0f) == 3.0f);
+        CHECK(limits.clamp_pos(config, -2.0f) == -1.0f);
+        CHECK(limits.clamp_pos(config, 1.5f) == 1.5f);
+    }
+
+    TEST_CASE("velocity range from the stop distance") {
+        SoftLimits::Config_t config = make_config();
+        SoftLimits limits;
+        CHECK(limits.update(config, 1.0f, 4.0f, 0.0f));
+        CHECK(limits.vel_max() == doctest::Approx(4.0f));            // sqrt(2 * 4 * 2)
+        CHECK(limits.vel_min() == doctest::Approx(-4.0f));
+        CHECK(limits.clamp_vel(10.0f) == doctest::Approx(4.0f));
+        CHECK(limits.limited());
+        CHECK(limits.clamp_vel(-1.0f) == -1.0f);
+        CHECK(!limits.limited());
+
+        // Only away from a limit beyond it
+        CHECK(limits.update(config, 3.01f, 4.0f, 0.0f));
+        CHECK(limits.clamp_vel(1.0f) == 0.0f);
+        CHECK(limits.clamp_vel(-1.0f) == -1.0f);
+
+        // One sided
+        config.min_pos = -INFINITY;
+        limits.update(config, 0.0f, 4.0f, 0.0f);
+        CHECK(std::isinf(limits.vel_min()));
+    }
+
+    TEST_CASE("stops at the limit") {
+        SoftLimits::Config_t config = make_config();
+        SoftLimits limits;
+        const float dt = 1.0f / 8000.0f;
+        const float decel = 10.0f;
+        float pos = 0.0f;
+        float vel = 0.0f;
+        float max_decel = 0.0f;
+        for (int i = 0; i < 8000 * 3; ++i) {
+            limits.update(config, pos, decel, dt);
+            float vel_next = limits.clamp_vel(5.0f);
+            if (i > 0)
+                max_decel = std::max(max_decel, (vel - vel_next) / dt);
+            vel = vel_next;
+            pos += vel * dt;
+        }
+        CHECK(pos <= 3.0f);
+        CHECK(pos == doctest::Approx(3.0f).epsilon(1e-3));
+        CHECK(max_decel < 1.1f * decel);
+    }
+
+    TEST_CASE("counts violations") {
+        SoftLimits::Config_t config = make_config();
+        const float dt = 1.0f / 8000.0f;
+        SoftLimits limits;
+        CHECK(limits.update(config, 3.04f, 1.0f, dt)); // within the tolerance
+        CHECK(!limits.update(config, 3.1f, 1.0f, dt));
+        CHECK(!limits.update(config, 3.2f, 1.0f, dt));
+        CHECK(limits.violated());
+        CHECK(limits.violations() == 1);
+        CHECK(limits.update(config, 2.0f, 1.0f, dt));
+        CHECK(!limits.update(config, -1.2f, 1.0f, dt));
+        CHECK(limits.violations() == 2);
+        limits.reset();
+        CHECK(!limits.violated());
+        CHECK(std::isinf(limits.vel_max()));
+    }
+}
@@ -0,0 +1,48 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/spline_traj.hpp"
+
+TEST_SUITE("Cubic Hermite Spline") {
+    TEST_CASE("end-points") {
+        CubicHermiteSegment segment;
+        segment.plan(1.0f, 2.0f, 3.0f, -1.0f, 0.5f);
+        CubicHermiteSegment::Step_t step = segment.eval(0.0f);
+        CHECK(step.Y == 1.0f);
+        CHECK(step.Yd == 2.0f);
+        step = segment.eval(0.5f - 1e-6f);
+        CHECK(step.Y == doctest::Approx(3.0f));
+        CHECK(step.Yd == doctest::Approx(-1.0f).epsilon(1e-4));
+        step = segment.eval(1.0f); // clamped to the end
+        CHECK(step.Y == 3.0f);
+        CHECK(step.Yd == -1.0f);
+    }
+
+    TEST_CASE("reproduces-cubic") {
+        // y = t^3 - t over [0, 2] is represented exactly
+        auto y = [](float t) { return t * t * t - t; };
+        auto yd = [](float t) { return 3.0f * t * t - 1.0f; };
+        CubicHermiteSegment segment;
+        segment.plan(y(0.0f), yd(0.0f), y(2.0f), yd(2.0f), 2.0f);
+        for (float t = 0.0f; t < 2.0f; t += 0.125f) {
+            CubicHermiteSegment::Step_t step = segment.eval(t);
+            CHECK(step.Y == doctest::Approx(y(t)));
+            CHECK(step.Yd == doctest::Approx(yd(t)));
+            CHECK(step.Ydd == doctest::Approx(6.0f * t));
+        }
+    }
+
+    TEST_CASE("continuous-velocity") {
+        // two 10 ms segments evaluated at 8 kHz
+        const float dt = 1.0f / 8000.0f;
+        CubicHermiteSegment a, b;
+        a.plan(0.0f, 0.0f, 0.01f, 1.0f, 0.01f);
+        b.plan(a.p1_, a.v1_, 0.02f, 0.0f, 0.01f);
+        float last_vel = 0.0f;
+        for (float t = 0.0f; t < 0.02f; t += dt) {
+            CubicHermiteSegment::Step_t step = t < a.T_ ? a.eval(t) : b.eval(t - a.T_);
+            CHECK(std::abs(step.Yd - last_vel) < 0.06f); // max acceleration 400 turn/s^2
+            last_vel = step.Yd;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#include <doctest.h>
+
+#include "MotorControl/spsc_queue.hpp"
+
+struct Segment_t {
+    float pos;
+    float vel_limit;
+    float accel_limit;
+    float decel_limit;
+};
+typedef SpscQueue<Segment_t, 16> MoveQueue;
+
+TEST_SUITE("spsc_queue") {
+    TEST_CASE("fifo") {
+        MoveQueue queue;
+        CHECK(queue.peek() == nullptr);
+        CHECK(queue.depth() == 0);
+
+        CHECK(queue.push({1.0f, 2.0f, 3.0f, 4.0f}));
+        CHECK(queue.push({5.0f, 0.0f, 0.0f, 0.0f}));
+        CHECK(queue.depth() == 2);
+
+        const Segment_t* segment = queue.peek();
+        REQUIRE(segment != nullptr);
+        CHECK(segment->pos == 1.0f);
+        CHECK(segment->decel_limit == 4.0f);
+        CHECK(queue.peek() == segment); // peek doesn't consume
+        queue.pop();
+
+        segment = queue.peek();
+        REQUIRE(segment != nullptr);
+        CHECK(segment->pos == 5.0f);
+        queue.pop();
+        CHECK(queue.peek() == nullptr);
+        CHECK(queue.depth() == 0);
+    }
+
+    TEST_CASE("full") {
+        MoveQueue queue;
+        for (uint32_t i = 0; i < MoveQueue::capacity; ++i)
+            CHECK(queue.push({(float)i, 0.0f, 0.0f, 0.0f}));
+        CHECK(!queue.push({-1.0f, 0.0f, 0.0f, 0.0f}));
+        CHECK(queue.depth() == MoveQueue::capacity);
+
+        // wrap around the buffer
+        for (uint32_t i = 0; i < 3 * MoveQueue::capacity; ++i) {
+            const Segment_t* segment = queue.peek();
+            REQUIRE(segment != nullptr);
+            CHECK(segment->pos == (float)i);
+            queue.pop();
+            CHECK(queue.push({(float)(i + MoveQueue::capacity), 0.0f, 0.0f, 0.0f}));
+        }
+    }
+
+    TEST_CASE("clear") {
+        MoveQueue queue;
+        queue.push({1.0f, 0.0f, 0.0f, 0.0f});
+        queue.push({2.0f, 0.0f, 0.0f, 0.0f});
+        queue.clear();
+        CHECK(queue.depth() == 0);
+        CHECK(queue.peek() == nullptr);
+
+        // segments pushed after the clear are kept
+        queue.push({3.0f, 0.0f, 0.0f, 0.0f});
+        queue.clear();
+        queue.push({4.0f, 0.0f, 0.0f, 0.0f});
+        CHECK(queue.depth() == 1);
+        const Segment_t* segment = queue.peek();
+        REQUIRE(segment != nullptr);
+        CHECK(segment->pos == 4.0f);
+        queue.pop();
+        CHECK(queue.depth() == 0);
+        for (uint32_t i = 0; i < MoveQueue::capacity; ++i)
+            CHECK(queue.push({0.0f, 0.0f, 0.0f, 0.0f}));
+    }
+}
@@ -0,0 +1,36 @@
+#include <doctest.h>
+
+#include "MotorControl/step_counter.hpp"
+
+TEST_SUITE("StepCounter") {
+    TEST_CASE("software mode") {
+        StepCounter counter;
+        counter.reset(0, true);
+        for (int i = 0; i < 1000; ++i)
+            counter.on_step(true);
+        for (int i = 0; i < 300; ++i)
+            counter.on_step(false);
+        CHECK(counter.count() == 700);
+    }
+
+    TEST_CASE("timer mode books the pulses with the direction at the time") {
+        StepCounter counter;
+        uint32_t timer = 0xfffff000; // wraps around below
+        counter.reset(timer, true);
+        timer += 5000;
+        counter.sync(timer);
+        CHECK(counter.count() == 5000);
+
+        timer += 100;
+        counter.on_dir_change(timer, false);
+        timer += 2000;
+        counter.sync(timer);
+        CHECK(counter.count() == 3100);
+
+        counter.on_dir_change(timer, true);
+        counter.on_dir_change(timer, false); // glitch on the dir pin without steps
+        timer += 3100;
+        counter.sync(timer);
+        CHECK(counter.count() == 0);
+    }
+}
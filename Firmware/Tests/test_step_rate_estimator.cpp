@@ -0,0 +1,46 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/step_rate_estimator.hpp"
+
+// Position of a step/dir input at the control loop rate: a ramp or parabola
+// quantized to whole steps
+static float staircase(float pos, float turns_per_step) {
+    return std::floor(pos / turns_per_step) * turns_per_step;
+}
+
+TEST_SUITE("StepRateEstimator") {
+    const float dt = 1.0f / 8000.0f;
+    const float turns_per_step = 1.0f / 1024.0f;
+    const float bandwidth = 500.0f; // [rad/s]
+
+    TEST_CASE("constant velocity") {
+        StepRateEstimator est;
+        est.reset(0.0f);
+        const float vel = 2.0f; // 2048 steps/s, 4 control loop iterations per step
+        float max_err = 0.0f;
+        for (int i = 0; i < 8000; ++i) {
+            float pos = vel * i * dt;
+            est.update(staircase(pos, turns_per_step), dt, bandwidth);
+            if (i > 4000)
+                max_err = std::max(max_err, std::abs(est.pos() - (pos - 0.5f * turns_per_step)));
+        }
+        CHECK(est.vel() == doctest::Approx(vel).epsilon(0.02));
+        CHECK(std::abs(est.accel()) < 3.0f); // some ripple of the steps remains
+        // Much smoother than the staircase, and without the lag a first
+        // order filter would have
+        CHECK(max_err < 0.25f * turns_per_step);
+    }
+
+    TEST_CASE("constant acceleration") {
+        StepRateEstimator est;
+        est.reset(0.0f);
+        const float accel = 10.0f; // [turns/s^2]
+        for (int i = 0; i < 8000; ++i) {
+            float t = i * dt;
+            est.update(staircase(0.5f * accel * t * t, turns_per_step), dt, bandwidth);
+        }
+        CHECK(est.vel() == doctest::Approx(accel * 1.0f).epsilon(0.02));
+        CHECK(est.accel() == doctest::Approx(accel).epsilon(0.2));
+    }
+}
@@ -0,0 +1,62 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/thermal_model.hpp"
+
+static const ThermalModel::Params_t params = {30.0f, 0.5f, 300.0f, 1.5f};
+
+// Runs the model at the rate of the outer control loop
+static void run(ThermalModel& model, float P, float seconds) {
+    const float dt = 1.0f / 2000.0f;
+    for (int i = 0; i < (int)(seconds / dt); ++i)
+        model.add_losses(params, P, dt);
+}
+
+TEST_SUITE("ThermalModel") {
+    TEST_CASE("steady state") {
+        ThermalModel model;
+        model.reset(25.0f);
+        run(model, 20.0f, 5000.0f);
+        CHECK(model.temperature(1) == doctest::Approx(25.0f + 20.0f * 1.5f).epsilon(0.01));
+        CHECK(model.temperature(0) == doctest::Approx(25.0f + 20.0f * 2.0f).epsilon(0.01));
+        CHECK(model.peak_duration(params, 20.0f, 70.0f) == INFINITY);
+    }
+
+    TEST_CASE("the maximum losses reach the limit at the horizon") {
+        ThermalModel model;
+        model.reset(40.0f);
+        const float horizon = 2.0f;
+        float P = model.max_losses(params, 120.0f, horizon);
+        CHECK(P > 100.0f);
+        CHECK(model.peak_duration(params, P, 120.0f) == doctest::Approx(horizon).epsilon(0.01));
+        run(model, P, horizon);
+        // Slightly less than the limit because the heat sink warms up too
+        CHECK(model.temperature(0) == doctest::Approx(120.0f).epsilon(0.01));
+        CHECK(model.temperature(0) <= 120.0f);
+
+        // At the limit only the sustainable losses remain
+        ThermalModel hot;
+        hot.reset(25.0f);
+        run(hot, 20.0f, 5000.0f);
+        CHECK(hot.max_losses(params, hot.temperature(0), horizon) == doctest::Approx(20.0f).epsilon(0.02));
+        CHECK(hot.max_losses(params, hot.temperature(0) - 10.0f, horizon) == 0.0f);
+        CHECK(hot.peak_duration(params, 100.0f, hot.temperature(0) - 10.0f) == 0.0f);
+    }
+
+    TEST_CASE("the ambient estimate follows the thermistor") {
+        ThermalModel model;
+        model.reset(25.0f);
+        const float bandwidth = 0.05f;
+        for (int i = 0; i < (int)(5000.0f / ThermalModel::step_period); ++i) {
+            model.step(params, 10.0f, ThermalModel::step_period);
+            // The actual ambient is 35°C, the thermistor is on the heat sink
+            model.correct(1, 35.0f + 10.0f * 1.5f, bandwidth * ThermalModel::step_period);
+        }
+        CHECK(model.ambient() == doctest::Approx(35.0f).epsilon(0.01));
+        CHECK(model.temperature(0) == doctest::Approx(35.0f + 10.0f * 2.0f).epsilon(0.01));
+
+        // An invalid reading doesn't move the estimate
+        model.correct(1, NAN, 1.0f);
+        CHECK(model.ambient() == doctest::Approx(35.0f).epsilon(0.01));
+    }
+}
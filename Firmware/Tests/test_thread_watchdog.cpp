@@ -0,0 +1,59 @@
+#include <doctest.h>
+
+#include "MotorControl/thread_watchdog.hpp"
+
+TEST_SUITE("ThreadWatchdog") {
+    TEST_CASE("threads are supervised from their first check-in") {
+        ThreadWatchdog wd;
+        wd.set_budget(0, 10);
+        wd.set_budget(1, 100);
+        CHECK(wd.overdue(0) == 0);
+        for (uint32_t t = 1; t <= 50; ++t)
+            CHECK(wd.overdue(t) == 0); // nobody checked in yet
+
+        wd.check_in(0, 50);
+        wd.check_in(1, 50);
+        for (uint32_t t = 51; t <= 60; ++t)
+            CHECK(wd.overdue(t) == 0);
+        CHECK(wd.overdue(61) == (1u << 0));
+        wd.check_in(0, 61);
+        CHECK(wd.overdue(62) == 0);
+    }
+
+    TEST_CASE("reports each missing thread") {
+        ThreadWatchdog wd;
+        wd.set_budget(0, 10);
+        wd.set_budget(3, 20);
+        wd.set_budget(5, 0); // not supervised
+        wd.check_in(0, 0);
+        wd.check_in(3, 0);
+        wd.check_in(5, 0);
+        uint32_t mask = 0;
+        for (uint32_t t = 1; t <= 30; ++t) {
+            wd.check_in(0, t);
+            mask = wd.overdue(t);
+        }
+        CHECK(mask == (1u << 3));
+    }
+
+    TEST_CASE("a stall of the supervisor restarts the check-ins") {
+        ThreadWatchdog wd;
+        wd.set_budget(0, 10);
+        wd.check_in(0, 0);
+        CHECK(wd.overdue(5) == 0);
+        CHECK(wd.overdue(2000) == 0); // e.g. a flash erase
+        CHECK(wd.overdue(2005) == 0);
+        CHECK(wd.overdue(2011) == (1u << 0));
+    }
+
+    TEST_CASE("time wraps around") {
+        ThreadWatchdog wd;
+        wd.set_budget(0, 10);
+        uint32_t t0 = UINT32_MAX - 5;
+        wd.check_in(0, t0);
+        CHECK(wd.overdue(t0 + 1) == 0);
+        for (uint32_t t = t0 + 2; t != t0 + 11; ++t)
+            CHECK(wd.overdue(t) == 0);
+        CHECK(wd.overdue(t0 + 11) == (1u << 0));
+    }
+}
@@ -0,0 +1,95 @@
+#include <doctest.h>
+
+#include "MotorControl/timebase.hpp"
+
+#include <stdint.h>
+#include <cmath>
+
+TEST_SUITE("Timebase") {
+    const float dt = 1.0f / 8000.0f;
+
+    Timebase::Timestamp_t from_ns(int64_t ns) {
+        return {(uint32_t)(ns / 1000), (uint32_t)(ns % 1000)};
+    }
+
+    TEST_CASE("counts the control periods") {
+        Timebase timebase;
+        for (uint32_t i = 0; i < 8000; ++i)
+            timebase.tick(dt, i * 21000);
+        CHECK(timebase.now() == 1000000);
+        CHECK(!timebase.synced());
+
+        // Periods of fractional microseconds don't drift
+        Timebase fractional;
+        for (int i = 0; i < 16000; ++i)
+            fractional.tick(1.0f / 16000.0f, 0);
+        CHECK(fractional.now() == 1000000);
+    }
+
+    TEST_CASE("timestamps between the ticks") {
+        Timebase timebase(168000000);
+        timebase.tick(dt, 1000);
+        timebase.tick(dt, 1000 + 21000);
+        Timebase::Timestamp_t t = timebase.timestamp(1000 + 21000 + 1750);
+        CHECK(t.us == 250 + 10);
+        CHECK(t.ns == 416);
+        // Cycle counter wrap around
+        timebase.tick(dt, UINT32_MAX - 99);
+        t = timebase.timestamp(68);
+        CHECK(t.us == 375 + 1);
+    }
+
+    TEST_CASE("steps to the master") {
+        Timebase timebase;
+        timebase.tick(dt, 0);
+        timebase.capture({UINT32_MAX - 100, 500}, timebase.timestamp(0)); // wraps on the step
+        timebase.tick(dt, 21000);
+        CHECK(timebase.synced());
+        CHECK(timebase.now() == UINT32_MAX - 100 + 125);
+        CHECK(timebase.sync_count() == 1);
+        CHECK(timebase.timestamp(21000).ns == 500);
+
+        // A larger error is stepped again
+        uint32_t before = timebase.now();
+        timebase.capture({before - 5000, 0}, timebase.timestamp(21000));
+        timebase.tick(dt, 42000);
+        CHECK((int32_t)(timebase.now() - before) == 125 - 5000);
+
+        // Each capture is applied once
+        before = timebase.now();
+        timebase.tick(dt, 63000);
+        CHECK(timebase.now() - before == 125);
+    }
+
+    TEST_CASE("disciplines the rate of a local clock") {
+        // The local crystal is 50ppm slow, the master is ideal
+        const double drift = -50e-6;
+        const double cpu_hz = 168e6;
+        Timebase timebase;
+        double max_error = INFINITY;
+        uint32_t prev_now = 0;
+        bool monotonic = true;
+        for (int k = 0; k < 8000 * 20; ++k) {
+            double real_time = k * (double)dt / (1.0 + drift); // [s] at the start of tick k
+            timebase.tick(dt, (uint32_t)(int64_t)(real_time * cpu_hz * (1.0 + drift)));
+            monotonic = monotonic && (int32_t)(timebase.now() - prev_now) > 0;
+            prev_now = timebase.now();
+
+            // A time message every 100ms, received a bit into the period
+            if (k % 800 == 400) {
+                double rx_time = real_time + 30e-6;
+                uint32_t rx_cycles = (uint32_t)(int64_t)(rx_time * cpu_hz * (1.0 + drift));
+                Timebase::Timestamp_t local = timebase.timestamp(rx_cycles);
+                Timebase::Timestamp_t master = from_ns((int64_t)(rx_time * 1e9) + 7777777);
+                if (k > 8000 * 15) {
+                    double error = ((double)(int32_t)(master.us - local.us) * 1000.0 + (double)master.ns - (double)local.ns);
+                    max_error = std::isinf(max_error) ? std::fabs(error) : std::max(max_error, std::fabs(error));
+                }
+                timebase.capture(master, local);
+            }
+        }
+        CHECK(monotonic);
+        CHECK(timebase.rate() == doctest::Approx(50e-6).epsilon(0.02));
+        CHECK(max_error < 100.0); // [ns]
+    }
+}
@@ -0,0 +1,56 @@
+#include <doctest.h>
+
+#include "MotorControl/timed_setpoints.hpp"
+
+TEST_SUITE("TimedSetpoints") {
+    TEST_CASE("applies each setpoint at its time") {
+        TimedSetpoints setpoints;
+        TimedSetpoints::Output_t out;
+        CHECK(setpoints.push({1000, 1.0f, 0.0f, 0.5f, false}));
+        CHECK(setpoints.push({2000, 2.0f, 0.0f, 1.5f, false}));
+        CHECK(!setpoints.update(875, &out)); // not due yet
+        CHECK(setpoints.update(1000, &out));
+        CHECK(out.pos == doctest::Approx(1.0f));
+        CHECK(out.vel == doctest::Approx(1000.0f)); // slope to the next one
+        CHECK(out.torque == doctest::Approx(0.5f));
+        CHECK(setpoints.update(1250, &out));
+        CHECK(out.pos == doctest::Approx(1.25f));
+        CHECK(out.torque == doctest::Approx(0.75f));
+
+        // Stops at the last one
+        CHECK(setpoints.update(2000, &out));
+        CHECK(out.pos == doctest::Approx(2.0f));
+        CHECK(out.vel == 0.0f);
+        CHECK(!setpoints.update(2125, &out));
+        CHECK(setpoints.late() == 0);
+    }
+
+    TEST_CASE("cubic with velocities") {
+        TimedSetpoints setpoints;
+        TimedSetpoints::Output_t out;
+        setpoints.push({0, 0.0f, 0.0f, 0.0f, true});
+        setpoints.push({1000000, 1.0f, 0.0f, 0.0f, true});
+        setpoints.update(0, &out);
+        CHECK(out.vel == doctest::Approx(0.0f));
+        setpoints.update(500000, &out);
+        CHECK(out.pos == doctest::Approx(0.5f));
+        CHECK(out.vel == doctest::Approx(1.5f));
+    }
+
+    TEST_CASE("late setpoints and wrap around") {
+        TimedSetpoints setpoints;
+        TimedSetpoints::Output_t out;
+        uint32_t now = UINT32_MAX - 200;
+        CHECK(!setpoints.update(now, &out));
+        setpoints.push({now - 100, 3.0f, 0.0f, 0.0f, false}); // already due
+        setpoints.push({now + 400, 4.0f, 0.0f, 0.0f, false}); // after the wrap
+        now += 125;
+        CHECK(setpoints.update(now, &out));
+        CHECK(setpoints.late() == 1);
+        CHECK(out.pos == doctest::Approx(3.0f + 225.0f / 500.0f));
+        now += 125;
+        CHECK(setpoints.update(now, &out));
+        CHECK(out.pos == doctest::Approx(3.0f + 350.0f / 500.0f));
+        CHECK(setpoints.depth() == 1);
+    }
+}
@@ -0,0 +1,87 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/scurve_traj.hpp"
+#include "MotorControl/traj_ticker.hpp"
+
+static void test_ticker(const SCurveTrajectory& traj, float dt) {
+    float T[TrajectoryTicker::max_phases];
+    float J[TrajectoryTicker::max_phases];
+    size_t num_phases = traj.phases(T, J);
+    TrajectoryTicker ticker;
+    ticker.start(traj, T, J, num_phases, traj.Tf_, dt);
+
+    uint32_t n = 0;
+    while (!ticker.done()) {
+        // reference time without accumulated rounding
+        float t = (float)((double)n * (double)dt);
+        SCurveTrajectory::Step_t expected = traj.eval(t);
+        TrajectoryTicker::Step_t step = ticker.next();
+        // a few float ulps, plus one jerk step for the acceleration at phase boundaries
+        CHECK(std::abs(step.Y - expected.Y) <= 1e-6f * std::max(1.0f, std::abs(expected.Y)));
+        CHECK(std::abs(step.Yd - expected.Yd) <= 1e-4f);
+        CHECK(std::abs(step.Ydd - expected.Ydd) <= 1e-4f + std::abs(J[0]) * dt);
+        ++n;
+    }
+    CHECK(n * dt > traj.Tf_);
+    CHECK((n - 1) * dt <= traj.Tf_ * 1.0001f);
+    TrajectoryTicker::Step_t step = ticker.next();
+    CHECK(step.Y == traj.Xf_);
+    CHECK(step.Yd == 0.0f);
+}
+
+TEST_SUITE("Trajectory Ticker") {
+    TEST_CASE("short-move") {
+        SCurveTrajectory traj;
+        REQUIRE(traj.plan(0.1f, 0.0f, 0.0f, 2.0f, 1.0f, 1.0f, 10.0f));
+        test_ticker(traj, 1.0f / 8000.0f);
+    }
+
+    TEST_CASE("long-move") {
+        // 100 s of cruising at 8 kHz
+        SCurveTrajectory traj;
+        REQUIRE(traj.plan(200.0f, 0.0f, 0.0f, 2.0f, 1.0f, 1.0f, 10.0f));
+        test_ticker(traj, 1.0f / 8000.0f);
+    }
+
+    TEST_CASE("no-drift") {
+        // Accumulating t in float drifts by several ticks over this move
+        SCurveTrajectory traj;
+        REQUIRE(traj.plan(400.0f, 0.0f, 0.0f, 2.0f, 1.0f, 1.0f, 10.0f));
+        const float dt = 1.0f / 8000.0f;
+        float T[TrajectoryTicker::max_phases];
+        float J[TrajectoryTicker::max_phases];
+        TrajectoryTicker ticker;
+        ticker.start(traj, T, J, traj.phases(T, J), traj.Tf_, dt);
+        uint32_t ticks = 0;
+        float t = 0.0f;
+        uint32_t float_ticks = 0;
+        while (!ticker.done()) {
+            ticker.next();
+            ++ticks;
+        }
+        while (t <= traj.Tf_) {
+            t += dt;
+            ++float_ticks;
+        }
+        CHECK(ticks == (uint32_t)std::floor(traj.Tf_ / dt) + 1);
+        CHECK(float_ticks != ticks);
+    }
+
+    TEST_CASE("boundary-ticks") {
+        // Phase boundaries on exact tick times
+        SCurveTrajectory traj;
+        REQUIRE(traj.plan(10.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 4.0f));
+        const float dt = 1.0f / 1000.0f;
+        float T[TrajectoryTicker::max_phases];
+        float J[TrajectoryTicker::max_phases];
+        size_t num_phases = traj.phases(T, J);
+        TrajectoryTicker ticker;
+        ticker.start(traj, T, J, num_phases, traj.Tf_, dt);
+        CHECK(ticker.reached(0.0f));
+        CHECK(!ticker.reached(dt * 0.5f));
+        ticker.next();
+        CHECK(ticker.reached(dt));
+        CHECK(!ticker.reached(dt * 1.5f));
+    }
+}
@@ -0,0 +1,93 @@
+#include <doctest.h>
+
+#include <communication/uart_bus.hpp>
+
+#include <string>
+
+struct BusByteSink : StreamSink {
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        bytes.append((const char*)buffer, length);
+        if (processed_bytes)
+            *processed_bytes += length;
+        return 0;
+    }
+    size_t get_free_space() override { return SIZE_MAX; }
+    std::string bytes;
+};
+
+static void feed(StreamSink& sink, const std::string& bytes) {
+    sink.process_bytes((const uint8_t*)bytes.data(), bytes.size(), nullptr);
+}
+
+static std::string envelope(uint8_t address, const std::string& payload) {
+    uint8_t header[4] = {UART_BUS_SYNC, address, (uint8_t)payload.size()};
+    header[3] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header, 3);
+    return std::string((const char*)header, 4) + payload;
+}
+
+TEST_SUITE("UartBus") {
+    TEST_CASE("ascii lines are filtered by node ID") {
+        BusByteSink parser;
+        UartBusFilter filter(UART_BUS_FRAMING_ASCII, parser);
+        filter.set_node_id(3);
+
+        feed(filter, "p 0 1.0\n@12 p 0 2.0\n@3 p 0 3.0\n");
+        CHECK(parser.bytes == "p 0 3.0\n");
+        CHECK(filter.unicast());
+
+        parser.bytes.clear();
+        feed(filter, "@0 w axis0.requested_state 1");
+        feed(filter, "\r\n#3 ignored\n@3x\n@999 q\n");
+        CHECK(parser.bytes == "w axis0.requested_state 1\r");
+        CHECK(!filter.unicast());
+    }
+
+    TEST_CASE("ascii responses are prefixed and dropped after broadcasts") {
+        BusByteSink parser, uart;
+        UartBusFilter filter(UART_BUS_FRAMING_ASCII, parser);
+        UartBusResponder responder(UART_BUS_FRAMING_ASCII, filter, uart);
+        filter.set_node_id(42);
+        responder.set_node_id(42);
+
+        feed(filter, "@42 f 0\n");
+        feed(responder, "1.5 0.0\r\nline 2\r\n");
+        CHECK(uart.bytes.empty());
+        responder.flush();
+        CHECK(uart.bytes == "#42 1.5 0.0\r\n#42 line 2\r\n");
+
+        uart.bytes.clear();
+        feed(filter, "@0 f 0\n");
+        feed(responder, "1.5 0.0\r\n");
+        responder.flush();
+        CHECK(uart.bytes.empty());
+    }
+
+    TEST_CASE("envelopes") {
+        BusByteSink parser, uart;
+        UartBusFilter filter(UART_BUS_FRAMING_ENVELOPE, parser);
+        UartBusResponder responder(UART_BUS_FRAMING_ENVELOPE, filter, uart);
+        filter.set_node_id(5);
+        responder.set_node_id(5);
+
+        std::string bad_crc = envelope(5, "corrupt");
+        bad_crc[3] ^= 1;
+        std::string stream = "noise" + envelope(6, "other") + envelope(5 | UART_BUS_RESPONSE_FLAG, "response")
+                           + bad_crc + envelope(5, "") + envelope(5, "hello") + envelope(0, " all");
+        for (char c : stream) // byte by byte, as if split over many reads
+            feed(filter, std::string(1, c));
+        CHECK(parser.bytes == "hello all");
+        CHECK(!filter.unicast());
+
+        feed(filter, envelope(5, "x"));
+        std::string response(300, 'r');
+        feed(responder, response);
+        responder.flush();
+        CHECK(uart.bytes == envelope(5 | UART_BUS_RESPONSE_FLAG, std::string(255, 'r'))
+                          + envelope(5 | UART_BUS_RESPONSE_FLAG, std::string(45, 'r')));
+
+        // The node ignores its own responses
+        parser.bytes.clear();
+        feed(filter, uart.bytes);
+        CHECK(parser.bytes.empty());
+    }
+}
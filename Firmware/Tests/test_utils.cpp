@@ -0,0 +1,121 @@
+#include <doctest.h>
+
+#include <cmath>
+
+#include "MotorControl/utils.hpp"
+
+TEST_SUITE("utils") {
+    TEST_CASE("rotate_by_small_angle") {
+        for (float phase = -M_PI; phase < M_PI; phase += 0.01f) {
+            for (float delta = -small_angle_rotation_max; delta <= small_angle_rotation_max; delta += 0.005f) {
+                float c = std::cos(phase);
+                float s = std::sin(phase);
+                REQUIRE(rotate_by_small_angle(delta, &c, &s));
+                CHECK(c == doctest::Approx(std::cos(phase + delta)).epsilon(1e-5));
+                CHECK(s == doctest::Approx(std::sin(phase + delta)).epsilon(1e-5));
+            }
+        }
+
+        float c = 1.0f;
+        float s = 0.0f;
+        CHECK(!rotate_by_small_angle(small_angle_rotation_max + 0.01f, &c, &s));
+        CHECK(!rotate_by_small_angle(NAN, &c, &s));
+        CHECK(c == 1.0f);
+        CHECK(s == 0.0f);
+    }
+
+    TEST_CASE("minmax_svm") {
+        for (float phase = -M_PI; phase < M_PI; phase += 0.01f) {
+            for (float mod = 0.0f; mod <= sqrt3_by_2; mod += 0.05f) {
+                float alpha = mod * std::cos(phase);
+                float beta = mod * std::sin(phase);
+                float t[3] = {};
+                REQUIRE(minmax_svm(alpha, beta, t));
+
+                // Active vectors must be centered in the PWM period
+                float t_max = std::max(t[0], std::max(t[1], t[2]));
+                float t_min = std::min(t[0], std::min(t[1], t[2]));
+                CHECK(t_min >= 0.0f);
+                CHECK(t_max <= 1.0f);
+                CHECK(0.5f * (t_max + t_min) == doctest::Approx(0.5f));
+
+                // Timing differences must reproduce the line-to-line voltages
+                CHECK(t[1] - t[0] == doctest::Approx(alpha - one_by_sqrt3 * beta));
+                CHECK(t[2] - t[0] == doctest::Approx(alpha + one_by_sqrt3 * beta));
+
+                // Same timings as the sextant based SVM()
+                auto [tA, tB, tC, valid] = sextant_svm(alpha, beta);
+                CHECK(valid);
+                CHECK(t[0] == doctest::Approx(tA));
+                CHECK(t[1] == doctest::Approx(tB));
+                CHECK(t[2] == doctest::Approx(tC));
+            }
+        }
+
+        float t[3] = {};
+        CHECK(!minmax_svm(0.0f, 1.0f, t)); // outside of hexagon
+        CHECK(minmax_svm(1.0f, 0.0f, t)); // hexagon vertex
+        CHECK(t[0] == doctest::Approx(0.0f));
+        CHECK(t[1] == doctest::Approx(1.0f));
+        CHECK(t[2] == doctest::Approx(1.0f));
+    }
+
+    TEST_CASE("svm_hexagon_norm") {
+        for (float phase = -M_PI; phase < M_PI; phase += 0.01f) {
+            float alpha = std::cos(phase);
+            float beta = std::sin(phase);
+            float norm = svm_hexagon_norm(alpha, beta);
+            // the unit circle touches the hexagon vertices and encloses the inscribed circle
+            CHECK(norm >= 1.0f - 1e-6f);
+            CHECK(norm <= two_by_sqrt3 + 1e-6f);
+
+            float t[3] = {};
+            CHECK(minmax_svm(0.9999f * alpha / norm, 0.9999f * beta / norm, t));
+            CHECK(!minmax_svm(1.001f * alpha / norm, 1.001f * beta / norm, t));
+        }
+    }
+
+    TEST_CASE("reconstruct_phase_current") {
+        float I[3] = {99.0f, 2.0f, -3.0f};
+        uint16_t timings[3] = {10, 500, 600};
+        CHECK(reconstruct_phase_current(I, timings) == 0);
+        CHECK(I[0] == doctest::Approx(1.0f));
+        CHECK(I[1] == 2.0f);
+        CHECK(I[2] == -3.0f);
+
+        float I2[3] = {1.0f, 2.0f, 99.0f};
+        uint16_t timings2[3] = {700, 500, 20};
+        CHECK(reconstruct_phase_current(I2, timings2) == 2);
+        CHECK(I2[2] == doctest::Approx(-3.0f));
+    }
+
+    TEST_CASE("wrap_pm_fast") {
+        for (float y : {1.0f, 6.0f, (float)(2 * M_PI), 8192.0f, 0.001f}) {
+            for (int i = -2600; i <= 2600; ++i) {
+                float x = (float)i * 0.001f * y + 1e-4f * y;
+                float res = wrap_pm_fast(x, y);
+                CHECK(res >= -0.5f * y);
+                CHECK(res <= 0.5f * y);
+                CHECK(fmodf_pos_fast(x, y) >= 0.0f);
+                CHECK(fmodf_pos_fast(x, y) < y);
+                if (std::abs(std::abs(wrap_pm(x, y)) - 0.5f * y) > 1e-5f * y) {
+                    CHECK(res == wrap_pm(x, y));
+                    CHECK(fmodf_pos_fast(x, y) == fmodf_pos(x, y));
+                }
+            }
+        }
+        CHECK(wrap_pm_pi_fast(3.0f) == 3.0f);
+        CHECK(wrap_pm_pi_fast(4.0f) == wrap_pm_pi(4.0f));
+        CHECK(wrap_pm_pi_fast(-100.0f) == wrap_pm_pi(-100.0f));
+        CHECK(is_nan(wrap_pm_fast(NAN, 1.0f)));
+    }
+
+    TEST_CASE("mod_fast") {
+        for (int divisor : {1, 6, 7, 8192}) {
+            for (int dividend = -5 * divisor; dividend <= 5 * divisor; ++dividend)
+                CHECK(mod_fast(dividend, divisor) == mod(dividend, divisor));
+            CHECK(mod_fast(INT32_MAX, divisor) == mod(INT32_MAX, divisor));
+            CHECK(mod_fast(INT32_MIN, divisor) == mod(INT32_MIN, divisor));
+        }
+    }
+}
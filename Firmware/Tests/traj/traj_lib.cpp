@@ -0,0 +1,112 @@
+// Host library of the trajectory planner of the firmware, so that tools plan
+// and evaluate moves with exactly the code that runs on the ODrive. A plain C
+// interface over arrays of moves, see tools/motion_planning/odrive_traj.py for
+// the numpy wrapper.
+//
+// Built with CONFIG_TRAJ_LIB=true, or by hand from the Firmware directory:
+//   g++ -O2 -std=c++17 -shared -fPIC -I. -I./MotorControl Tests/traj/traj_lib.cpp MotorControl/trapTraj.cpp -o Tests/libodrive_traj.so
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cmath>
+#include <new>
+
+#include "MotorControl/trapTraj.hpp"
+
+#define TRAJ_API extern "C" __attribute__((visibility("default")))
+
+// Bumped on any change of the functions below
+TRAJ_API uint32_t odrive_traj_version() { return 1; }
+
+// @brief Size of one planned move in the trajs buffers
+TRAJ_API size_t odrive_traj_size() { return sizeof(TrapezoidalTrajectory); }
+
+// @brief Plans n moves like Controller::plan_move(): with the S-curve planner
+// where Jmax[i] > 0 (INPUT_MODE_SCURVE_TRAJ), else trapezoidal.
+// @param trajs: n * odrive_traj_size() bytes that receive the planned moves
+// @param ok: 0 where the limits were rejected, may be null
+// @param Tf: duration of each move, may be null
+// @returns the number of moves that were planned
+TRAJ_API size_t odrive_traj_plan(size_t n, const float* Xf, const float* Xi, const float* Vi,
+                                 const float* Vmax, const float* Amax, const float* Dmax, const float* Jmax,
+                                 void* trajs, uint8_t* ok, float* Tf) {
+    TrapezoidalTrajectory* traj = reinterpret_cast<TrapezoidalTrajectory*>(trajs);
+    size_t num_ok = 0;
+    for (size_t i = 0; i < n; ++i) {
+        new (&traj[i]) TrapezoidalTrajectory();
+        bool result = Jmax[i] > 0.0f
+                ? traj[i].planSCurve(Xf[i], Xi[i], Vi[i], Vmax[i], Amax[i], Dmax[i], Jmax[i])
+                : traj[i].planTrapezoidal(Xf[i], Xi[i], Vi[i], Vmax[i], Amax[i], Dmax[i]);
+        num_ok += result;
+        if (ok)
+            ok[i] = result;
+        if (Tf)
+            Tf[i] = result ? traj[i].Tf_ : NAN;
+    }
+    return num_ok;
+}
+
+// @brief Plans n rest to rest moves like Controller::stage_move()
+TRAJ_API size_t odrive_traj_plan_timed(size_t n, const float* Xf, const float* Xi,
+                                       const float* T, const float* Ta, const float* Td,
+                                       void* trajs, uint8_t* ok) {
+    TrapezoidalTrajectory* traj = reinterpret_cast<TrapezoidalTrajectory*>(trajs);
+    size_t num_ok = 0;
+    for (size_t i = 0; i < n; ++i) {
+        new (&traj[i]) TrapezoidalTrajectory();
+        bool result = traj[i].planTimed(Xf[i], Xi[i], T[i], Ta[i], Td[i]);
+        num_ok += result;
+        if (ok)
+            ok[i] = result;
+    }
+    return num_ok;
+}
+
+// @brief Minimum durations of n timed moves, see TrapezoidalTrajectory::minTimedDuration()
+TRAJ_API void odrive_traj_min_timed_duration(size_t n, const float* dX, const float* Vmax,
+                                             const float* Amax, const float* Dmax,
+                                             const float* Ta, const float* Td, float* T) {
+    for (size_t i = 0; i < n; ++i)
+        T[i] = TrapezoidalTrajectory::minTimedDuration(dX[i], Vmax[i], Amax[i], Dmax[i], Ta[i], Td[i]);
+}
+
+// @brief Evaluates each of the n moves at the same m times (relative to the
+// start of each move) with TrapezoidalTrajectory::eval()
+// @param Y, Yd, Ydd: n * m values each, row i belongs to move i. Yd and Ydd may be null.
+TRAJ_API void odrive_traj_eval(size_t n, const void* trajs, size_t m, const float* t,
+                               float* Y, float* Yd, float* Ydd) {
+    const TrapezoidalTrajectory* traj = reinterpret_cast<const TrapezoidalTrajectory*>(trajs);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = 0; k < m; ++k) {
+            TrapezoidalTrajectory::Step_t step = traj[i].eval(t[k]);
+            Y[i * m + k] = step.Y;
+            if (Yd)
+                Yd[i * m + k] = step.Yd;
+            if (Ydd)
+                Ydd[i * m + k] = step.Ydd;
+        }
+    }
+}
+
+// @brief The setpoints of one move the way the control loop gets them, one
+// per tick of the period dt until the trajectory is done
+// @returns the number of ticks of the move. Only the first max_ticks
+// setpoints are written, so a call with max_ticks = 0 gets the length.
+TRAJ_API size_t odrive_traj_ticks(const void* traj, float dt, size_t max_ticks,
+                                  float* Y, float* Yd, float* Ydd) {
+    TrapezoidalTrajectory ticked = *reinterpret_cast<const TrapezoidalTrajectory*>(traj);
+    ticked.start(dt);
+    size_t n = 0;
+    while (!ticked.done()) {
+        TrapezoidalTrajectory::Step_t step = ticked.next();
+        if (n < max_ticks) {
+            Y[n] = step.Y;
+            if (Yd)
+                Yd[n] = step.Yd;
+            if (Ydd)
+                Ydd[n] = step.Ydd;
+        }
+        ++n;
+    }
+    return n;
+}
@@ -18,8 +18,17 @@ print('Using python command "'..python_command..'"')
 
 tup.frule{inputs={'fibre/cpp/interfaces_template.j2'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o', outputs='autogen/interfaces.hpp'}
 tup.frule{inputs={'fibre/cpp/function_stubs_template.j2'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o', outputs='autogen/function_stubs.hpp'}
-tup.frule{inputs={'fibre/cpp/endpoints_template.j2'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --generate-endpoints ODrive --template %f --output %o', outputs='autogen/endpoints.hpp'}
+-- Size optimized build: -Os and one fibre handler per property type instead
+-- of one per property
+optimize_size = tup.getconfig("OPTIMIZE_SIZE") == "true"
+endpoints_flags = ''
+if optimize_size then
+    endpoints_flags = ' --share-property-handlers'
+end
+
+tup.frule{inputs={'fibre/cpp/endpoints_template.j2'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --generate-endpoints ODrive'..endpoints_flags..' --template %f --output %o', outputs='autogen/endpoints.hpp'}
 tup.frule{inputs={'fibre/cpp/type_info_template.j2'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o', outputs='autogen/type_info.hpp'}
+tup.frule{inputs={'MotorControl/config_fields_template.j2'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o', outputs='autogen/config_fields.hpp'}
 
 -- Note: we currently check this file into source control for two reasons:
 --  - Don't require tup to run in order to use odrivetool from the repo
@@ -119,6 +128,46 @@ if tup.getconfig("STEP_DIR") == "y" then
     end
 end
 
+-- Current control loop frequency
+if tup.getconfig("CURRENT_LOOP_FREQ") == "8" or tup.getconfig("CURRENT_LOOP_FREQ") == "" then
+    FLAGS += "-DCURRENT_LOOP_FREQ_KHZ=8"
+elseif tup.getconfig("CURRENT_LOOP_FREQ") == "16" then
+    FLAGS += "-DCURRENT_LOOP_FREQ_KHZ=16"
+elseif tup.getconfig("CURRENT_LOOP_FREQ") == "24" then
+    FLAGS += "-DCURRENT_LOOP_FREQ_KHZ=24"
+else
+    error("unsupported current loop frequency "..tup.getconfig("CURRENT_LOOP_FREQ").." (must be 8, 16 or 24)")
+end
+
+-- Run the control loops of all axes in one thread
+if tup.getconfig("BOARD_CONTROL_LOOP") == "true" then
+    FLAGS += "-DBOARD_CONTROL_LOOP"
+end
+
+-- Timestamp source of the task timers and motor timing log
+if tup.getconfig("TASK_TIMER_BACKEND") == "dwt" then
+    FLAGS += "-DTASK_TIMER_DWT"
+elseif tup.getconfig("TASK_TIMER_BACKEND") ~= "tim13" and tup.getconfig("TASK_TIMER_BACKEND") ~= "" then
+    error("unknown task timer backend "..tup.getconfig("TASK_TIMER_BACKEND").." (must be tim13 or dwt)")
+end
+
+-- Run the current control path from SRAM instead of flash
+if tup.getconfig("HOT_CODE_IN_RAM") == "true" then
+    FLAGS += "-DHOT_CODE_IN_RAM"
+end
+
+-- Drop the property tree of the ASCII `r` and `w` commands
+if tup.getconfig("ASCII_INTROSPECTION") == "false" then
+    FLAGS += "-DNO_ASCII_INTROSPECTION"
+end
+
+-- Subsystems left out of the control loop, see MotorControl/features.hpp
+for _, feature in ipairs({'ACIM', 'SENSORLESS', 'ENDSTOPS', 'ANTICOGGING', 'OSCILLOSCOPE'}) do
+    if tup.getconfig(feature) == "false" then
+        FLAGS += "-DNO_"..feature
+    end
+end
+
 -- Compiler settings
 if tup.getconfig("STRICT") == "true" then
     FLAGS += '-Werror'
@@ -145,6 +194,8 @@ LDFLAGS += '-Wl,--undefined=uxTopUsedPriority'
 if tup.getconfig("DEBUG") == "true" then
     FLAGS += '-gdwarf-2'
     OPT += '-Og'
+elseif optimize_size then
+    OPT += '-Os'
 else
     OPT += '-O2'
 end
@@ -192,6 +243,7 @@ sources = {
     'MotorControl/utils.cpp',
     'MotorControl/arm_sin_f32.c',
     'MotorControl/arm_cos_f32.c',
+    'MotorControl/arm_sincos_f32.c',
     'MotorControl/low_level.cpp',
     'MotorControl/axis.cpp',
     'MotorControl/motor.cpp',
@@ -203,15 +255,27 @@ sources = {
     'MotorControl/sensorless_estimator.cpp',
     'MotorControl/trapTraj.cpp',
     'MotorControl/pwm_input.cpp',
+    'MotorControl/oscilloscope.cpp',
+    'MotorControl/telemetry.cpp',
+    'MotorControl/subscriptions.cpp',
+    'MotorControl/benchmark.cpp',
+    'MotorControl/event_trace.cpp',
+    'MotorControl/crash_snapshot.cpp',
+    'MotorControl/data_logger.cpp',
     'MotorControl/main.cpp',
     'MotorControl/taskTimer.cpp',
     'Drivers/STM32/stm32_system.cpp',
     'Drivers/STM32/stm32_gpio.cpp',
     'Drivers/STM32/stm32_nvm.c',
     'Drivers/STM32/stm32_spi_arbiter.cpp',
+    'Drivers/SpiFlash/spi_flash.cpp',
     'communication/can_simple.cpp',
+    'communication/canopen.cpp',
+    'communication/can_fibre.cpp',
+    'communication/can_update.cpp',
     'communication/communication.cpp',
     'communication/ascii_protocol.cpp',
+    'communication/binary_protocol.cpp',
     'communication/interface_uart.cpp',
     'communication/interface_usb.cpp',
     'communication/interface_can.cpp',
@@ -243,3 +307,16 @@ if tup.getconfig('DOCTEST') == 'true' then
     tup.frule{inputs='Tests/bin/*.o', command='g++ %f -o %o', outputs='Tests/test_runner.exe'}
     tup.frule{inputs='Tests/test_runner.exe', command='%f'}
 end
+
+if tup.getconfig('BENCHMARK') == 'true' then
+    tup.frule{inputs='Tests/bench/benchmark.cpp', command='g++ -O3 -std=c++17 -I. -I./MotorControl -I./fibre/cpp/include %f -o %o', outputs='Tests/benchmark.exe'}
+end
+
+if tup.getconfig('SIMULATOR') == 'true' then
+    tup.frule{inputs={'Tests/sim/sim_endpoints.yaml'}, command=python_command..' Tests/sim/sim_endpoints_generator.py --definitions odrive-interface.yaml --bindings %f --output %o', outputs='autogen/sim_endpoints.hpp'}
+    tup.frule{inputs={'Tests/sim/odrive_sim.cpp', 'fibre/cpp/protocol.cpp', 'fibre/cpp/posix_tcp.cpp', extra_inputs={'autogen/sim_endpoints.hpp'}}, command='g++ -O2 -std=c++17 -I. -I./MotorControl -I./fibre/cpp/include %f -lpthread -o %o', outputs='Tests/odrive_sim.exe'}
+end
+
+if tup.getconfig('TRAJ_LIB') == 'true' then
+    tup.frule{inputs={'Tests/traj/traj_lib.cpp', 'MotorControl/trapTraj.cpp'}, command='g++ -O2 -std=c++17 -shared -fPIC -I. -I./MotorControl %f -o %o', outputs='Tests/libodrive_traj.so'}
+end
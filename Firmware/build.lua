@@ -80,7 +80,7 @@ function GCCToolchain(prefix, builddir, compiler_flags, linker_flags)
         else
             extra_outputs = {}
         end
-        extra_inputs = {'autogen/interfaces.hpp', 'autogen/function_stubs.hpp', 'autogen/endpoints.hpp', 'autogen/type_info.hpp'} -- TODO: fix hack
+        extra_inputs = {'autogen/interfaces.hpp', 'autogen/function_stubs.hpp', 'autogen/endpoints.hpp', 'autogen/type_info.hpp', 'autogen/config_fields.hpp'} -- TODO: fix hack
         tup.frule{
             inputs= { src, extra_inputs=extra_inputs },
             command=compiler..' -c %f '..
@@ -107,6 +107,8 @@ function GCCToolchain(prefix, builddir, compiler_flags, linker_flags)
             }
             -- display the size
             tup.frule{inputs={output_name..'.elf'}, command=prefix..'size %f'}
+            -- flash and RAM usage per module, from the map file
+            tup.frule{inputs={output_name..'.map'}, command=python_command..' ../tools/memory_report.py %f > %o', outputs={output_name..'.memory.txt'}}
             -- generate disassembly
             tup.frule{inputs={output_name..'.elf'}, command=prefix..'objdump %f -dSC > %o', outputs={output_name..'.asm'}}
             -- create *.hex and *.bin output formats
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstdio>
+
+// Number parsing and formatting for the ASCII protocol commands on the hot
+// path (p, q, v, c, t, f, u), as a replacement for sscanf and snprintf. They
+// accept and produce the same text as "%u", "%f" and the checksum "*%u", but
+// without the locale handling, varargs and newlib's arbitrary precision
+// float conversion.
+
+inline bool ascii_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+inline bool ascii_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline char ascii_to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// @brief Returns true and advances str if it starts with the lowercase word,
+// ignoring case
+inline bool ascii_match_word(const char*& str, const char* word) {
+    const char* p = str;
+    for (; *word; ++word, ++p) {
+        if (ascii_to_lower(*p) != *word)
+            return false;
+    }
+    str = p;
+    return true;
+}
+
+// @brief Parses an unsigned decimal integer like sscanf's "%u": leading
+// whitespace and an optional sign, a negative number wraps around.
+// On success the value is stored and str is advanced past the number.
+inline bool ascii_parse_uint(const char*& str, unsigned* value) {
+    const char* p = str;
+    while (ascii_is_space(*p))
+        ++p;
+    bool negative = false;
+    if (*p == '+' || *p == '-')
+        negative = (*p++ == '-');
+    if (!ascii_is_digit(*p))
+        return false;
+
+    unsigned result = 0;
+    while (ascii_is_digit(*p))
+        result = result * 10 + (unsigned)(*p++ - '0');
+    *value = negative ? 0u - result : result;
+    str = p;
+    return true;
+}
+
+// @brief Parses a float like sscanf's "%f": leading whitespace, an optional
+// sign, decimal digits with an optional fraction and exponent, or "inf",
+// "infinity" and "nan" in any case. Hexadecimal floats are not supported.
+// On success the value is stored and str is advanced past the number.
+//
+// Up to 15 significant digits are accumulated exactly in an integer, which
+// is then scaled by an exact power of ten in double precision, so the result
+// is the correctly rounded float except in very rare double rounding cases.
+inline bool ascii_parse_float(const char*& str, float* value) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    constexpr int max_power = (int)(sizeof(powers_of_ten) / sizeof(powers_of_ten[0])) - 1;
+    constexpr uint64_t max_mantissa = 900000000000000ull; // one more digit stays below 2^53
+
+    const char* p = str;
+    while (ascii_is_space(*p))
+        ++p;
+    bool negative = false;
+    if (*p == '+' || *p == '-')
+        negative = (*p++ == '-');
+
+    if (ascii_match_word(p, "inf")) {
+        ascii_match_word(p, "inity");
+        *value = negative ? -INFINITY : INFINITY;
+        str = p;
+        return true;
+    }
+    if (ascii_match_word(p, "nan")) {
+        *value = negative ? -NAN : NAN;
+        str = p;
+        return true;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool has_digits = false;
+    for (; ascii_is_digit(*p); ++p) {
+        has_digits = true;
+        if (mantissa < max_mantissa)
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else
+            exponent++; // digits beyond the precision of a float
+    }
+    if (*p == '.') {
+        for (++p; ascii_is_digit(*p); ++p) {
+            has_digits = true;
+            if (mantissa < max_mantissa) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (!has_digits)
+        return false;
+
+    // The exponent is only consumed if it has digits, e.g. "1e" parses as 1
+    if (*p == 'e' || *p == 'E') {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (*q == '+' || *q == '-')
+            negative_exponent = (*q++ == '-');
+        if (ascii_is_digit(*q)) {
+            int e = 0;
+            for (; ascii_is_digit(*q); ++q) {
+                if (e < 10000)
+                    e = e * 10 + (*q - '0');
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double result = (double)mantissa;
+    if (mantissa) {
+        for (; exponent > max_power; exponent -= max_power)
+            result *= powers_of_ten[max_power];
+        for (; exponent < -max_power; exponent += max_power)
+            result /= powers_of_ten[max_power];
+        result = exponent < 0 ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+    }
+    *value = (float)(negative ? -result : result);
+    str = p;
+    return true;
+}
+
+// @brief Formats an unsigned integer like "%u", returns the number of
+// characters written. The buffer must hold 11 characters.
+inline size_t ascii_format_uint(char* buffer, uint32_t value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (size_t i = 0; i < n; ++i)
+        buffer[i] = digits[n - 1 - i];
+    buffer[n] = 0;
+    return n;
+}
+
+// Enough for "%f" of any float: sign, 39 digits, point, 6 decimals, null
+#define ASCII_FLOAT_MAX_LENGTH 48
+
+// @brief Formats a float exactly like "%f" (6 decimals, round half to even
+// on the exact value), returns the number of characters written.
+// The buffer must hold ASCII_FLOAT_MAX_LENGTH characters.
+inline size_t ascii_format_float(char* buffer, float value) {
+    char* p = buffer;
+    if (std::signbit(value))
+        *p++ = '-';
+    float magnitude = std::fabs(value);
+
+    if (std::isnan(value) || std::isinf(value)) {
+        const char* word = std::isnan(value) ? "nan" : "inf";
+        while (*word)
+            *p++ = *word++;
+        *p = 0;
+        return (size_t)(p - buffer);
+    }
+
+    uint64_t integer_part, fraction_part;
+    if (magnitude >= 18446744073709551616.0f) {
+        // Beyond 2^64, rare enough for the slow path
+        return (size_t)(p - buffer) + (size_t)snprintf(p, ASCII_FLOAT_MAX_LENGTH - (p - buffer), "%f", (double)magnitude);
+    } else if (magnitude >= 16777216.0f) {
+        // Floats from 2^24 on are integers
+        integer_part = (uint64_t)magnitude;
+        fraction_part = 0;
+    } else {
+        // Below 2^24 the scaled value is below 2^53, a tie is exact in double
+        // and any other value is closer to its rounding result than the error
+        // of the multiplication
+        double scaled = (double)magnitude * 1e6;
+        uint64_t rounded = (uint64_t)scaled;
+        double remainder = scaled - (double)rounded;
+        if (remainder > 0.5 || (remainder == 0.5 && (rounded & 1)))
+            rounded++;
+        integer_part = rounded / 1000000;
+        fraction_part = rounded % 1000000;
+    }
+
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + integer_part % 10);
+        integer_part /= 10;
+    } while (integer_part);
+    while (n)
+        *p++ = digits[--n];
+
+    *p++ = '.';
+    for (int i = 5; i >= 0; --i) {
+        p[i] = (char)('0' + fraction_part % 10);
+        fraction_part /= 10;
+    }
+    p += 6;
+    *p = 0;
+    return (size_t)(p - buffer);
+}
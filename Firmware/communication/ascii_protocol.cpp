@@ -10,11 +10,15 @@
 #include "odrive_main.h"
 #include "communication.h"
 #include "ascii_protocol.hpp"
+#include "ascii_helpers.hpp"
 #include <utils.hpp>
 #include <fibre/cpp_utils.hpp>
 
+#ifndef NO_ASCII_INTROSPECTION
 #include "autogen/type_info.hpp"
+#endif
 #include "communication/interface_can.hpp"
+#include "communication/interface_uart.h"
 
 /* Private macros ------------------------------------------------------------*/
 /* Private typedef -----------------------------------------------------------*/
@@ -26,9 +30,32 @@
 #define TO_STR_INNER(s) #s
 #define TO_STR(s) TO_STR_INNER(s)
 
+// Fields of the streamed feedback lines, see cmd_get_feedback()
+enum FeedbackField : uint32_t {
+    FEEDBACK_FIELD_POS_ESTIMATE = 1u << 0,
+    FEEDBACK_FIELD_VEL_ESTIMATE = 1u << 1,
+    FEEDBACK_FIELD_IQ_MEASURED = 1u << 2,
+    FEEDBACK_FIELD_IQ_SETPOINT = 1u << 3,
+    FEEDBACK_FIELD_VBUS_VOLTAGE = 1u << 4,
+    FEEDBACK_FIELD_LOOP_COUNTER = 1u << 5,
+};
+static constexpr uint32_t FEEDBACK_FIELDS_DEFAULT = FEEDBACK_FIELD_POS_ESTIMATE | FEEDBACK_FIELD_VEL_ESTIMATE;
+
 /* Private variables ---------------------------------------------------------*/
 
+// Feedback streamed on the UART, only accessed by the UART thread
+static struct {
+    uint32_t interval_ms = 0; // 0 if the axis doesn't stream
+    uint32_t fields = 0;
+    bool use_checksum = false;
+    uint32_t next_time = 0; // [ms] HAL_GetTick() when the next line is due
+} feedback_streams[AXIS_COUNT];
+
+#ifndef NO_ASCII_INTROSPECTION
+// The property tree for the `r` and `w` commands. It instantiates a type info
+// for every interface, builds without it are considerably smaller.
 static Introspectable root_obj = ODriveTypeInfo<ODrive>::make_introspectable(odrv);
+#endif
 
 /* Private function prototypes -----------------------------------------------*/
 
@@ -49,24 +76,43 @@ void cmd_encoder(char * pStr, StreamSink& response_channel, bool use_checksum);
 
 /* Function implementations --------------------------------------------------*/
 
-// @brief Sends a line on the specified output.
-template<typename ... TArgs>
-void respond(StreamSink& output, bool include_checksum, const char * fmt, TArgs&& ... args) {
-    char response[64]; // Hardcoded max buffer size. We silently truncate the output if it's too long for the buffer.
-    size_t len = snprintf(response, sizeof(response), fmt, std::forward<TArgs>(args)...);
-    len = std::min(len, sizeof(response));
-    output.process_bytes((uint8_t*)response, len, nullptr); // TODO: use process_all instead
+// @brief Sends an already formatted line on the specified output.
+void respond_line(StreamSink& output, bool include_checksum, const char * response, size_t len) {
+    output.process_bytes((const uint8_t*)response, len, nullptr); // TODO: use process_all instead
     if (include_checksum) {
         uint8_t checksum = 0;
         for (size_t i = 0; i < len; ++i)
             checksum ^= response[i];
-        len = snprintf(response, sizeof(response), "*%u", checksum);
-        len = std::min(len, sizeof(response));
-        output.process_bytes((uint8_t*)response, len, nullptr);
+        char checksum_str[12] = "*";
+        size_t checksum_len = 1 + ascii_format_uint(checksum_str + 1, checksum);
+        output.process_bytes((uint8_t*)checksum_str, checksum_len, nullptr);
     }
     output.process_bytes((const uint8_t*)"\r\n", 2, nullptr);
 }
 
+// @brief Sends a line on the specified output.
+template<typename ... TArgs>
+void respond(StreamSink& output, bool include_checksum, const char * fmt, TArgs&& ... args) {
+    char response[64]; // Hardcoded max buffer size. We silently truncate the output if it's too long for the buffer.
+    size_t len = snprintf(response, sizeof(response), fmt, std::forward<TArgs>(args)...);
+    len = std::min(len, sizeof(response));
+    respond_line(output, include_checksum, response, len);
+}
+
+// @brief Parses the arguments of a "<cmd> motor [value ...]" command like
+// sscanf(pStr, "<cmd> %u %f ...") but without its overhead
+// @param values array that receives up to num_values float arguments
+// @returns the number of arguments that were converted, including the motor number
+int scan_motor_command(const char * pStr, unsigned* motor_number, float* values = nullptr, size_t num_values = 0) {
+    const char* p = pStr + 1; // the command character was already matched
+    if (!ascii_parse_uint(p, motor_number))
+        return 0;
+    int numscan = 1;
+    for (size_t i = 0; i < num_values && ascii_parse_float(p, &values[i]); ++i)
+        numscan++;
+    return numscan;
+}
+
 
 // @brief Executes an ASCII protocol command
 // @param buffer buffer of ASCII encoded characters
@@ -101,8 +147,8 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
     bool use_checksum = (checksum_start < len);
     if (use_checksum) {
         unsigned int received_checksum;
-        int numscan = sscanf(&cmd[checksum_start], "%u", &received_checksum);
-        if ((numscan < 1) || (received_checksum != checksum))
+        const char* checksum_str = &cmd[checksum_start];
+        if (!ascii_parse_uint(checksum_str, &received_checksum) || (received_checksum != checksum))
             return;
         len = checksum_start - 1; // prune checksum and asterisk
         cmd[len] = 0; // null-terminate
@@ -134,9 +180,9 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
 // @param use_checksum bool to indicate whether a checksum is required on response
 void cmd_set_position(char * pStr, StreamSink& response_channel, bool use_checksum) {
     unsigned motor_number;
-    float pos_setpoint, vel_feed_forward, torque_feed_forward;
-
-    int numscan = sscanf(pStr, "p %u %f %f %f", &motor_number, &pos_setpoint, &vel_feed_forward, &torque_feed_forward);
+    float values[3] = {};
+    int numscan = scan_motor_command(pStr, &motor_number, values, 3);
+    float pos_setpoint = values[0], vel_feed_forward = values[1], torque_feed_forward = values[2];
     if (numscan < 2) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
@@ -144,12 +190,12 @@ void cmd_set_position(char * pStr, StreamSink& response_channel, bool use_checks
     } else {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
-        axis.controller_.input_pos_ = pos_setpoint;
+        uint32_t fields = SetpointMailbox::POS;
         if (numscan >= 3)
-            axis.controller_.input_vel_ = vel_feed_forward;
+            fields |= SetpointMailbox::VEL;
         if (numscan >= 4)
-            axis.controller_.input_torque_ = torque_feed_forward;
-        axis.controller_.input_pos_updated();
+            fields |= SetpointMailbox::TORQUE;
+        axis.controller_.set_input_setpoints(fields, pos_setpoint, vel_feed_forward, torque_feed_forward);
         axis.watchdog_feed();
     }
 }
@@ -160,9 +206,9 @@ void cmd_set_position(char * pStr, StreamSink& response_channel, bool use_checks
 // @param use_checksum bool to indicate whether a checksum is required on response
 void cmd_set_position_wl(char * pStr, StreamSink& response_channel, bool use_checksum) {
     unsigned motor_number;
-    float pos_setpoint, vel_limit, torque_lim;
-
-    int numscan = sscanf(pStr, "q %u %f %f %f", &motor_number, &pos_setpoint, &vel_limit, &torque_lim);
+    float values[3] = {};
+    int numscan = scan_motor_command(pStr, &motor_number, values, 3);
+    float pos_setpoint = values[0], vel_limit = values[1], torque_lim = values[2];
     if (numscan < 2) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
@@ -170,12 +216,11 @@ void cmd_set_position_wl(char * pStr, StreamSink& response_channel, bool use_che
     } else {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
-        axis.controller_.input_pos_ = pos_setpoint;
         if (numscan >= 3)
             axis.controller_.config_.vel_limit = vel_limit;
         if (numscan >= 4)
             axis.motor_.config_.torque_lim = torque_lim;
-        axis.controller_.input_pos_updated();
+        axis.controller_.set_input_setpoints(SetpointMailbox::POS, pos_setpoint, 0.0f, 0.0f);
         axis.watchdog_feed();
     }
 }
@@ -186,8 +231,9 @@ void cmd_set_position_wl(char * pStr, StreamSink& response_channel, bool use_che
 // @param use_checksum bool to indicate whether a checksum is required on response
 void cmd_set_velocity(char * pStr, StreamSink& response_channel, bool use_checksum) {
     unsigned motor_number;
-    float vel_setpoint, torque_feed_forward;
-    int numscan = sscanf(pStr, "v %u %f %f", &motor_number, &vel_setpoint, &torque_feed_forward);
+    float values[2] = {};
+    int numscan = scan_motor_command(pStr, &motor_number, values, 2);
+    float vel_setpoint = values[0], torque_feed_forward = values[1];
     if (numscan < 2) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
@@ -195,9 +241,10 @@ void cmd_set_velocity(char * pStr, StreamSink& response_channel, bool use_checks
     } else {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_VELOCITY_CONTROL;
-        axis.controller_.input_vel_ = vel_setpoint;
+        uint32_t fields = SetpointMailbox::VEL;
         if (numscan >= 3)
-            axis.controller_.input_torque_ = torque_feed_forward;
+            fields |= SetpointMailbox::TORQUE;
+        axis.controller_.set_input_setpoints(fields, 0.0f, vel_setpoint, torque_feed_forward);
         axis.watchdog_feed();
     }
 }
@@ -210,14 +257,14 @@ void cmd_set_torque(char * pStr, StreamSink& response_channel, bool use_checksum
     unsigned motor_number;
     float torque_setpoint;
 
-    if (sscanf(pStr, "c %u %f", &motor_number, &torque_setpoint) < 2) {
+    if (scan_motor_command(pStr, &motor_number, &torque_setpoint, 1) < 2) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(response_channel, use_checksum, "invalid motor %u", motor_number);
     } else {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_TORQUE_CONTROL;
-        axis.controller_.input_torque_ = torque_setpoint;
+        axis.controller_.set_input_setpoints(SetpointMailbox::TORQUE, 0.0f, 0.0f, torque_setpoint);
         axis.watchdog_feed();
     }
 }
@@ -256,7 +303,7 @@ void cmd_set_trapezoid_trajectory(char* pStr, StreamSink& response_channel, bool
     unsigned motor_number;
     float goal_point;
 
-    if (sscanf(pStr, "t %u %f", &motor_number, &goal_point) < 2) {
+    if (scan_motor_command(pStr, &motor_number, &goal_point, 1) < 2) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(response_channel, use_checksum, "invalid motor %u", motor_number);
@@ -264,28 +311,47 @@ void cmd_set_trapezoid_trajectory(char* pStr, StreamSink& response_channel, bool
         Axis& axis = axes[motor_number];
         axis.controller_.config_.input_mode = Controller::INPUT_MODE_TRAP_TRAJ;
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
-        axis.controller_.input_pos_ = goal_point;
-        axis.controller_.input_pos_updated();
+        axis.controller_.set_input_setpoints(SetpointMailbox::POS, goal_point, 0.0f, 0.0f);
         axis.watchdog_feed();
     }
 }
 
-// @brief Executes the get position and velocity feedback command
+// @brief Executes the get position and velocity feedback command. With an
+// interval it starts (or with 0 stops) streaming the selected fields of the
+// axis instead: "f motor interval_ms [fields]"
 // @param pStr buffer of ASCII encoded values
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
 void cmd_get_feedback(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
+    const char* p = pStr + 1;
+    unsigned motor_number, interval_ms;
+    unsigned fields = FEEDBACK_FIELDS_DEFAULT;
 
-    if (sscanf(pStr, "f %u", &motor_number) < 1) {
+    if (!ascii_parse_uint(p, &motor_number)) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(response_channel, use_checksum, "invalid motor %u", motor_number);
+    } else if (ascii_parse_uint(p, &interval_ms)) {
+        ascii_parse_uint(p, &fields);
+        if (&response_channel != uart_stream_output_ptr) {
+            respond(response_channel, use_checksum, "feedback streaming is only supported on a point-to-point UART");
+        } else if (interval_ms && !fields) {
+            respond(response_channel, use_checksum, "invalid fields %u", fields);
+        } else {
+            auto& stream = feedback_streams[motor_number];
+            stream.interval_ms = interval_ms;
+            stream.fields = fields;
+            stream.use_checksum = use_checksum;
+            stream.next_time = HAL_GetTick();
+            axes[motor_number].feedback_stream_enabled_ = interval_ms != 0;
+        }
     } else {
         Axis& axis = axes[motor_number];
-        respond(response_channel, use_checksum, "%f %f",
-                (double)axis.encoder_.pos_estimate_,
-                (double)axis.encoder_.vel_estimate_);
+        char response[2 * ASCII_FLOAT_MAX_LENGTH];
+        size_t len = ascii_format_float(response, axis.encoder_.pos_estimate_);
+        response[len++] = ' ';
+        len += ascii_format_float(response + len, axis.encoder_.vel_estimate_);
+        respond_line(response_channel, use_checksum, response, len);
     }
 }
 
@@ -302,6 +368,7 @@ void cmd_help(char * pStr, StreamSink& response_channel, bool use_checksum) {
     respond(response_channel, use_checksum, "Position: p axis pos vel-ff I-ff");
     respond(response_channel, use_checksum, "Velocity: v axis vel I-ff");
     respond(response_channel, use_checksum, "Torque: c axis T");
+    respond(response_channel, use_checksum, "Feedback: f axis [interval-ms fields]");
     respond(response_channel, use_checksum, "");
     respond(response_channel, use_checksum, "Properties start at odrive root, such as axis0.requested_state");
     respond(response_channel, use_checksum, "Read: r property");
@@ -344,6 +411,9 @@ void cmd_system_ctrl(char * pStr, StreamSink& response_channel, bool use_checksu
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
 void cmd_read_property(char * pStr, StreamSink& response_channel, bool use_checksum) {
+#ifdef NO_ASCII_INTROSPECTION
+    respond(response_channel, use_checksum, "not implemented");
+#else
     char name[MAX_LINE_LENGTH];
 
     if (sscanf(pStr, "r %255s", name) < 1) {
@@ -359,6 +429,7 @@ void cmd_read_property(char * pStr, StreamSink& response_channel, bool use_check
             respond(response_channel, use_checksum, success ? response : "not implemented");
         }
     }
+#endif
 }
 
 // @brief Executes the set write position command
@@ -366,6 +437,9 @@ void cmd_read_property(char * pStr, StreamSink& response_channel, bool use_check
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
 void cmd_write_property(char * pStr, StreamSink& response_channel, bool use_checksum) {
+#ifdef NO_ASCII_INTROSPECTION
+    respond(response_channel, use_checksum, "not implemented");
+#else
     char name[MAX_LINE_LENGTH];
     char value[MAX_LINE_LENGTH];
 
@@ -383,6 +457,7 @@ void cmd_write_property(char * pStr, StreamSink& response_channel, bool use_chec
             }
         }
     }
+#endif
 }
 
 // @brief Executes the motor watchdog update command
@@ -392,7 +467,7 @@ void cmd_write_property(char * pStr, StreamSink& response_channel, bool use_chec
 void cmd_update_axis_wdg(char * pStr, StreamSink& response_channel, bool use_checksum) {
     unsigned motor_number;
 
-    if (sscanf(pStr, "u %u", &motor_number) < 1) {
+    if (scan_motor_command(pStr, &motor_number) < 1) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(response_channel, use_checksum, "invalid motor %u", motor_number);
@@ -441,3 +516,53 @@ void ASCII_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink&
         }
     }
 }
+
+// @brief Sends "f<axis> [loop_counter] values..." with the selected fields
+// from the last snapshot of the control loop, in the order of the field bits.
+// Nothing is sent while the control loop of the axis doesn't run.
+static void send_feedback_line(size_t axis_num, uint32_t fields, bool use_checksum, StreamSink& output) {
+    Axis::FeedbackSnapshot_t snapshot;
+    if (!axes[axis_num].feedback_snapshot_.read(&snapshot))
+        return;
+    char line[4 + 6 * (ASCII_FLOAT_MAX_LENGTH + 1)] = {'f', (char)('0' + axis_num)};
+    size_t len = 2;
+    if (fields & FEEDBACK_FIELD_LOOP_COUNTER) {
+        line[len++] = ' ';
+        len += ascii_format_uint(line + len, snapshot.loop_counter);
+    }
+    const float values[] = {snapshot.pos_estimate, snapshot.vel_estimate, snapshot.Iq_measured,
+                            snapshot.Iq_setpoint, snapshot.vbus_voltage};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        if (fields & (1u << i)) {
+            line[len++] = ' ';
+            len += ascii_format_float(line + len, values[i]);
+        }
+    }
+    respond_line(output, use_checksum, line, len);
+}
+
+// @brief Sends the streamed feedback lines that are due, see cmd_get_feedback()
+// @param output the UART stream
+// @returns [ms] until the next line is due, UINT32_MAX if no axis streams
+uint32_t ASCII_protocol_stream_feedback(StreamSink& output) {
+    uint32_t now = HAL_GetTick();
+    uint32_t wait = UINT32_MAX;
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        auto& stream = feedback_streams[i];
+        if (!stream.interval_ms)
+            continue;
+
+        if ((int32_t)(now - stream.next_time) >= 0) {
+            send_feedback_line(i, stream.fields, stream.use_checksum, output);
+
+            // Lines that the UART couldn't keep up with are skipped
+            stream.next_time += stream.interval_ms;
+            now = HAL_GetTick();
+            if ((int32_t)(now - stream.next_time) > 0)
+                stream.next_time = now;
+        }
+        wait = std::min(wait, (int32_t)(stream.next_time - now) > 0 ? stream.next_time - now : 0);
+    }
+    return wait;
+}
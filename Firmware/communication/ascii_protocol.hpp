@@ -17,6 +17,7 @@
 
 /* Exported functions --------------------------------------------------------*/
 void ASCII_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink& response_channel);
+uint32_t ASCII_protocol_stream_feedback(StreamSink& output);
 
 
 #endif /* __ASCII_PROTOCOL_H */
@@ -0,0 +1,119 @@
+/*
+* The binary protocol carries the setpoint and feedback commands of the ASCII
+* protocol in fixed size frames, so that hosts don't have to format and parse
+* text. The frame format is described in binary_protocol.hpp.
+*/
+
+#include "odrive_main.h"
+#include "binary_protocol.hpp"
+
+#include <fibre/crc.hpp>
+
+#include <string.h>
+
+#define BINARY_MAX_PAYLOAD_LENGTH 13
+
+// @brief Returns the payload length of a command or -1 if it is unknown
+static int get_payload_length(uint8_t cmd) {
+    switch (cmd) {
+        case BINARY_CMD_SET_POSITION: return 13;
+        case BINARY_CMD_SET_VELOCITY: return 9;
+        case BINARY_CMD_SET_TORQUE: return 5;
+        case BINARY_CMD_GET_FEEDBACK: return 1;
+        case BINARY_CMD_FEED_WATCHDOG: return 1;
+        default: return -1;
+    }
+}
+
+static float read_float(const uint8_t* buffer) {
+    float value;
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static void write_float(uint8_t* buffer, float value) {
+    memcpy(buffer, &value, sizeof(value));
+}
+
+static void send_feedback(Axis& axis, StreamSink& response_channel) {
+    uint8_t frame[2 + 9 + 1];
+    frame[0] = BINARY_PROTOCOL_SYNC;
+    frame[1] = BINARY_CMD_GET_FEEDBACK | BINARY_PROTOCOL_RESPONSE_FLAG;
+    frame[2] = axis.axis_num_;
+    write_float(frame + 3, axis.encoder_.pos_estimate_);
+    write_float(frame + 7, axis.encoder_.vel_estimate_);
+    frame[11] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, frame + 1, 10);
+    response_channel.process_bytes(frame, sizeof(frame), nullptr); // TODO: use process_all instead
+}
+
+// @brief Executes a command with a valid CRC
+// @param cmd the command byte
+// @param payload payload of the length given by get_payload_length()
+static void process_command(uint8_t cmd, const uint8_t* payload, StreamSink& response_channel) {
+    if (payload[0] >= AXIS_COUNT)
+        return;
+    Axis& axis = axes[payload[0]];
+
+    switch (cmd) {
+        case BINARY_CMD_SET_POSITION: {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
+            axis.controller_.input_pos_ = read_float(payload + 1);
+            axis.controller_.input_vel_ = read_float(payload + 5);
+            axis.controller_.input_torque_ = read_float(payload + 9);
+            axis.controller_.input_pos_updated();
+            axis.watchdog_feed();
+        } break;
+
+        case BINARY_CMD_SET_VELOCITY: {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_VELOCITY_CONTROL;
+            axis.controller_.input_vel_ = read_float(payload + 1);
+            axis.controller_.input_torque_ = read_float(payload + 5);
+            axis.watchdog_feed();
+        } break;
+
+        case BINARY_CMD_SET_TORQUE: {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_TORQUE_CONTROL;
+            axis.controller_.input_torque_ = read_float(payload + 1);
+            axis.watchdog_feed();
+        } break;
+
+        case BINARY_CMD_GET_FEEDBACK: {
+            send_feedback(axis, response_channel);
+        } break;
+
+        case BINARY_CMD_FEED_WATCHDOG: {
+            axis.watchdog_feed();
+        } break;
+    }
+}
+
+void binary_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink& response_channel) {
+    // command, payload and CRC of the frame being received, without the sync byte
+    static uint8_t frame[1 + BINARY_MAX_PAYLOAD_LENGTH + 1];
+    static size_t frame_idx = 0;
+    static size_t frame_length = 0; // 0 while waiting for the sync byte
+
+    while (len--) {
+        uint8_t c = *(buffer++);
+
+        if (!frame_length) {
+            if (c == BINARY_PROTOCOL_SYNC)
+                frame_length = 1; // until the command byte is known
+            continue;
+        }
+
+        frame[frame_idx++] = c;
+        if (frame_idx == 1) {
+            int payload_length = get_payload_length(c);
+            if (payload_length < 0) {
+                frame_idx = frame_length = 0;
+                continue;
+            }
+            frame_length = 1 + payload_length + 1;
+        } else if (frame_idx == frame_length) {
+            if (calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, frame, frame_length - 1) == frame[frame_length - 1])
+                process_command(frame[0], frame + 1, response_channel);
+            frame_idx = frame_length = 0;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __BINARY_PROTOCOL_HPP
+#define __BINARY_PROTOCOL_HPP
+
+#include <fibre/protocol.hpp>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compact binary alternative to the ASCII protocol for the setpoint and
+// feedback commands, selected with odrv.config.uart0_protocol =
+// STREAM_PROTOCOL_BINARY. See docs/ascii-protocol.md.
+//
+// Frame: [sync 0xA5] [command] [fixed size payload] [CRC8 of command and payload]
+// All values are little endian, floats are IEEE 754 single precision. The
+// CRC8 is the same as in the native protocol (polynomial 0x37, init 0x42).
+//
+// Commands (payload):
+//     0x01 set position  axis u8, pos f32, vel_ff f32, torque_ff f32
+//     0x02 set velocity  axis u8, vel f32, torque_ff f32
+//     0x03 set torque    axis u8, torque f32
+//     0x04 get feedback  axis u8
+//     0x05 feed watchdog axis u8
+//
+// The only response is the feedback frame, command 0x84 with the payload
+// axis u8, pos_estimate f32, vel_estimate f32. Frames with an unknown command,
+// an invalid axis or a wrong CRC are dropped silently.
+
+enum : uint8_t {
+    BINARY_PROTOCOL_SYNC = 0xA5,
+    BINARY_PROTOCOL_RESPONSE_FLAG = 0x80,
+};
+
+enum BinaryCommand : uint8_t {
+    BINARY_CMD_SET_POSITION = 0x01,
+    BINARY_CMD_SET_VELOCITY = 0x02,
+    BINARY_CMD_SET_TORQUE = 0x03,
+    BINARY_CMD_GET_FEEDBACK = 0x04,
+    BINARY_CMD_FEED_WATCHDOG = 0x05,
+};
+
+void binary_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink& response_channel);
+
+#endif /* __BINARY_PROTOCOL_HPP */
@@ -0,0 +1,198 @@
+#include "can_fibre.hpp"
+
+#include <fibre/protocol.hpp>
+
+#include <algorithm>
+
+enum : uint8_t {
+    PCI_SINGLE_FRAME = 0x00,
+    PCI_FIRST_FRAME = 0x10,
+    PCI_CONSECUTIVE_FRAME = 0x20,
+    PCI_FLOW_CONTROL = 0x30,
+};
+
+enum : uint8_t {
+    FLOW_CONTINUE = 0,
+    FLOW_WAIT = 1,
+    FLOW_OVERFLOW = 2,
+};
+
+// Request being received, length is 0 while idle
+struct RxState_t {
+    uint8_t buf[RX_BUF_SIZE];
+    size_t length;
+    size_t received;
+    uint8_t seq;
+    uint32_t last_frame; // [ms]
+};
+
+// Response being sent, length is 0 while idle
+struct TxState_t {
+    uint8_t buf[TX_BUF_SIZE];
+    size_t length;
+    size_t sent;
+    uint8_t seq;
+    bool wait_flow_control;
+    uint8_t block_size; // consecutive frames per flow control, 0 = unlimited
+    uint8_t block_count;
+    uint8_t st_min; // [ms]
+    uint32_t last_frame; // [ms]
+};
+
+static RxState_t rx_;
+static TxState_t tx_;
+
+static int32_t write_frame(const uint8_t* data, uint8_t len) {
+    can_Message_t txmsg;
+    txmsg.id = CANFibre::response_id(odCAN->config_.fibre_node_id);
+    txmsg.isExt = true;
+    txmsg.len = len;
+    memcpy(txmsg.buf, data, len);
+    return odCAN->write(txmsg, ODriveCAN::TX_PRIORITY_BULK);
+}
+
+static void send_flow_control(uint8_t flag) {
+    uint8_t frame[3] = {(uint8_t)(PCI_FLOW_CONTROL | flag), 0, CANFibre::st_min};
+    write_frame(frame, sizeof(frame));
+}
+
+// Starts sending a response. The single frame or first frame is queued
+// right away, the consecutive frames by CANFibre::send_pending().
+class CANFibreSender : public PacketSink {
+public:
+    int process_packet(const uint8_t* buffer, size_t length) override {
+        if (tx_.length || !length || length > sizeof(tx_.buf))
+            return -1; // the host resends the request
+
+        uint8_t frame[8];
+        if (length <= 7) {
+            frame[0] = PCI_SINGLE_FRAME | length;
+            memcpy(frame + 1, buffer, length);
+            return write_frame(frame, length + 1);
+        }
+
+        frame[0] = PCI_FIRST_FRAME | (length >> 8);
+        frame[1] = length & 0xff;
+        memcpy(frame + 2, buffer, 6);
+        if (write_frame(frame, 8) != 0)
+            return -1;
+
+        memcpy(tx_.buf, buffer, length);
+        tx_.length = length;
+        tx_.sent = 6;
+        tx_.seq = 1;
+        tx_.wait_flow_control = true;
+        tx_.last_frame = HAL_GetTick();
+        return 0;
+    }
+} can_fibre_output;
+BidirectionalPacketBasedChannel can_fibre_channel(can_fibre_output);
+
+bool CANFibre::handle_can_message(const can_Message_t& msg) {
+    const ODriveCAN::Config_t& config = odCAN->config_;
+    if (!config.enable_fibre || config.fibre_node_id > max_node_id
+            || !msg.isExt || msg.id != request_id(config.fibre_node_id))
+        return false;
+    if (msg.rtr || msg.len < 1)
+        return true;
+
+    uint32_t now = HAL_GetTick();
+    switch (msg.buf[0] & 0xf0) {
+        case PCI_SINGLE_FRAME: {
+            size_t length = msg.buf[0] & 0x0f;
+            rx_.length = 0; // a new request aborts a partially received one
+            if (length && length < msg.len)
+                can_fibre_channel.process_packet(msg.buf + 1, length);
+        } break;
+
+        case PCI_FIRST_FRAME: {
+            size_t length = ((msg.buf[0] & 0x0f) << 8) | msg.buf[1];
+            rx_.length = 0;
+            if (msg.len < 8 || length <= 7)
+                break;
+            if (length > sizeof(rx_.buf)) {
+                send_flow_control(FLOW_OVERFLOW);
+                break;
+            }
+            memcpy(rx_.buf, msg.buf + 2, 6);
+            rx_.length = length;
+            rx_.received = 6;
+            rx_.seq = 1;
+            rx_.last_frame = now;
+            send_flow_control(FLOW_CONTINUE);
+        } break;
+
+        case PCI_CONSECUTIVE_FRAME: {
+            if (!rx_.length)
+                break;
+            if ((msg.buf[0] & 0x0f) != (rx_.seq & 0x0f)) {
+                rx_.length = 0; // lost a frame
+                break;
+            }
+            size_t n = std::min<size_t>(msg.len - 1, rx_.length - rx_.received);
+            memcpy(rx_.buf + rx_.received, msg.buf + 1, n);
+            rx_.received += n;
+            rx_.seq++;
+            rx_.last_frame = now;
+            if (rx_.received == rx_.length) {
+                rx_.length = 0;
+                can_fibre_channel.process_packet(rx_.buf, rx_.received);
+            }
+        } break;
+
+        case PCI_FLOW_CONTROL: {
+            if (!tx_.length || !tx_.wait_flow_control || msg.len < 3)
+                break;
+            uint8_t flag = msg.buf[0] & 0x0f;
+            if (flag == FLOW_CONTINUE) {
+                tx_.wait_flow_control = false;
+                tx_.block_size = msg.buf[1];
+                tx_.block_count = 0;
+                tx_.st_min = msg.buf[2] <= 0x7f ? msg.buf[2] : 1; // 0xF1..0xF9 are 100..900us
+                tx_.last_frame = now - tx_.st_min;
+            } else if (flag == FLOW_WAIT) {
+                tx_.last_frame = now;
+            } else {
+                tx_.length = 0;
+            }
+        } break;
+    }
+    return true;
+}
+
+bool CANFibre::send_pending() {
+    uint32_t now = HAL_GetTick();
+    if (rx_.length && now - rx_.last_frame > timeout_ms)
+        rx_.length = 0;
+    if (!tx_.length)
+        return false;
+
+    if (tx_.wait_flow_control) {
+        if (now - tx_.last_frame > timeout_ms)
+            tx_.length = 0;
+        return tx_.length;
+    }
+
+    // Only queue what fits, the frames wait for the realtime traffic anyway
+    while (tx_.sent < tx_.length && now - tx_.last_frame >= tx_.st_min
+            && odCAN->tx_queue_space(ODriveCAN::TX_PRIORITY_BULK)) {
+        uint8_t frame[8];
+        size_t n = std::min<size_t>(7, tx_.length - tx_.sent);
+        frame[0] = PCI_CONSECUTIVE_FRAME | (tx_.seq & 0x0f);
+        memcpy(frame + 1, tx_.buf + tx_.sent, n);
+        if (write_frame(frame, n + 1) != 0)
+            break;
+        tx_.sent += n;
+        tx_.seq++;
+        tx_.last_frame = now;
+        if (tx_.block_size && ++tx_.block_count >= tx_.block_size) {
+            tx_.block_count = 0;
+            tx_.wait_flow_control = tx_.sent < tx_.length;
+            break;
+        }
+    }
+
+    if (tx_.sent >= tx_.length)
+        tx_.length = 0;
+    return tx_.length;
+}
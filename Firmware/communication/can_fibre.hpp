@@ -0,0 +1,43 @@
+#ifndef __CAN_FIBRE_HPP_
+#define __CAN_FIBRE_HPP_
+
+#include "interface_can.hpp"
+
+// Fibre over CAN, gives the same access to all properties and functions as
+// USB. The packets of the BidirectionalPacketBasedChannel are segmented like
+// ISO-TP (ISO 15765-2) on two extended IDs of a reserved range:
+//     request (host to ODrive):  base_id + 2 * odrv.can.config.fibre_node_id
+//     response (ODrive to host): base_id + 2 * odrv.can.config.fibre_node_id + 1
+//
+// Frames, byte 0 is the protocol control information:
+//     single frame       0x0L, L = 1..7 data bytes
+//     first frame        0x1H LL, 12 bit packet length, 6 data bytes
+//     consecutive frame  0x2N, N = sequence number, 1..7 data bytes
+//     flow control       0x3F BS ST, F = 0 continue, 1 wait, 2 overflow,
+//                        BS = block size (0 = unlimited), ST = minimum
+//                        separation time in ms
+//
+// The response frames go through the lowest priority TX queue, so they
+// never delay realtime frames, and this node asks the host for st_min
+// between the consecutive frames of a request.
+class CANFibre {
+   public:
+    static constexpr uint32_t base_id = 0x1FFFFE00;
+    static constexpr uint32_t max_node_id = 0xFF;
+    static constexpr uint8_t st_min = 1; // [ms] requested from the host
+    static constexpr uint32_t timeout_ms = 1000; // N_Bs, N_Cr
+
+    static uint32_t request_id(uint32_t node_id) { return base_id + 2 * node_id; }
+    static uint32_t response_id(uint32_t node_id) { return base_id + 2 * node_id + 1; }
+
+    // @brief Handles the frame if it is addressed to the fibre channel.
+    // Returns false for all other frames.
+    static bool handle_can_message(const can_Message_t& msg);
+
+    // @brief Sends the consecutive frames of the pending response that are
+    // due. Returns true while a response is pending, the caller should call
+    // again within a millisecond then.
+    static bool send_pending();
+};
+
+#endif  // __CAN_FIBRE_HPP_
@@ -1,20 +1,133 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <iterator>
 
-struct can_Message_t {
+// CAN frame with up to N bytes of payload. Classic CAN carries 8 bytes,
+// CAN FD up to 64 bytes, in steps given by can_fd_dlc_to_len().
+template<size_t N>
+struct can_MessageN_t {
+    static constexpr size_t max_len = N;
+    static_assert(N >= 8 && N <= 64, "CAN payloads are 8 to 64 bytes");
+
     uint32_t id = 0x000;  // 11-bit max is 0x7ff, 29-bit max is 0x1FFFFFFF
     bool isExt = false;
     bool rtr = false;
     uint8_t len = 8;
-    uint8_t buf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-} ;
+    uint8_t buf[N] = {};
+};
+
+using can_Message_t = can_MessageN_t<8>;
+using can_FdMessage_t = can_MessageN_t<64>;
+
+// CAN FD encodes payloads above 8 bytes in the 4 bit DLC field
+constexpr uint8_t can_fd_dlc_to_len(uint8_t dlc) {
+    constexpr uint8_t lengths[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+    return lengths[dlc & 0xf];
+}
+
+// @brief Returns the smallest DLC whose payload holds len bytes.
+// Frames are padded up to that length.
+constexpr uint8_t can_fd_len_to_dlc(size_t len) {
+    uint8_t dlc = 0;
+    while (dlc < 15 && can_fd_dlc_to_len(dlc) < len)
+        ++dlc;
+    return dlc;
+}
+
+// @brief Bits a classic CAN frame occupies the bus for, including the
+// interframe space but without stuff bits, which add up to 20% more.
+constexpr uint32_t can_frame_bits(bool isExt, bool rtr, uint8_t len) {
+    return (isExt ? 67 : 47) + (rtr ? 0 : 8 * std::min<uint32_t>(len, 8));
+}
+
+// Bit timing of a bxCAN controller, in time quanta (tq) of prescaler clock
+// cycles. A bit is 1 tq sync segment, time_seg1 tq and time_seg2 tq, the
+// sample point lies after time_seg1.
+struct can_BitTiming_t {
+    uint32_t prescaler;  // 1..1024
+    uint32_t time_seg1;  // 1..16
+    uint32_t time_seg2;  // 1..8
+    uint32_t sjw;        // 1..4
+    uint32_t baud_rate;  // actual [bit/s]
+    float sample_point;  // actual, fraction of the bit time
+};
+
+// @brief Finds the bit timing closest to the baud rate and sample point.
+// All bit lengths of 8 to 25 tq are tried, the rate error counts first, then
+// the sample point error, then longer bits for finer resynchronization.
+// Returns false if no timing is within max_error of the baud rate.
+inline bool can_calcBitTiming(uint32_t clock_hz, uint32_t baud_rate, float sample_point, float max_error, can_BitTiming_t* timing) {
+    if (!baud_rate || !(sample_point > 0.0f && sample_point < 1.0f))
+        return false;
+
+    bool found = false;
+    uint32_t best_rate_error = 0;
+    float best_sp_error = 0.0f;
+    for (uint32_t tq = 25; tq >= 8; --tq) {
+        uint32_t prescaler = (clock_hz + baud_rate * tq / 2) / (baud_rate * tq);
+        if (prescaler < 1 || prescaler > 1024)
+            continue;
+        // the phase segment 2 keeps at least 2 tq for resynchronization
+        int32_t seg1 = (int32_t)(sample_point * (float)tq + 0.5f) - 1;
+        seg1 = std::clamp<int32_t>(seg1, (int32_t)tq - 1 - 8, 16);
+        seg1 = std::min<int32_t>(seg1, (int32_t)tq - 1 - 2);
+        if (seg1 < 1)
+            continue;
+        uint32_t seg2 = tq - 1 - (uint32_t)seg1;
+
+        uint32_t rate = clock_hz / (prescaler * tq);
+        uint32_t rate_error = rate > baud_rate ? rate - baud_rate : baud_rate - rate;
+        float sp = (float)(1 + seg1) / (float)tq;
+        float sp_error = std::abs(sp - sample_point);
+        if (found && (rate_error > best_rate_error || (rate_error == best_rate_error && sp_error >= best_sp_error)))
+            continue;
+
+        found = true;
+        best_rate_error = rate_error;
+        best_sp_error = sp_error;
+        *timing = {prescaler, (uint32_t)seg1, seg2, std::min<uint32_t>(4, seg2), rate, sp};
+    }
+    return found && (float)best_rate_error <= max_error * (float)baud_rate;
+}
+
+// Acceptance filter bank of a bxCAN controller in 32 bit ID/mask mode. id and
+// mask are in the layout of the CAN_FiRx registers: STID[10:0] EXID[17:0] IDE
+// RTR 0. A frame passes if its bits agree with id wherever mask is set.
+struct can_Filter_t {
+    uint32_t id;
+    uint32_t mask;
+};
+
+constexpr uint32_t can_filter_ide = 0x4;
+
+// @brief Matches the frames of one format whose ID agrees with id in the bits
+// of mask, data and remote frames alike
+constexpr can_Filter_t can_idFilter(uint32_t id, bool isExt, uint32_t mask = 0x1fffffff) {
+    return isExt ? can_Filter_t{(id << 3) | can_filter_ide, ((mask & 0x1fffffff) << 3) | can_filter_ide}
+                 : can_Filter_t{id << 21, ((mask & 0x7ff) << 21) | can_filter_ide};
+}
+
+// @brief Matches all command IDs of a node, for the IDs made of the node ID
+// above cmdIdBits command ID bits
+constexpr can_Filter_t can_nodeFilter(uint32_t nodeId, uint32_t cmdIdBits, bool isExt) {
+    uint32_t maxNodeId = (1u << ((isExt ? 29 : 11) - cmdIdBits)) - 1;
+    return can_idFilter(nodeId << cmdIdBits, isExt, maxNodeId << cmdIdBits);
+}
+
+// @brief Compares the frame like the filter hardware does
+template<size_t N>
+constexpr bool can_filterMatches(const can_Filter_t& filter, const can_MessageN_t<N>& msg) {
+    uint32_t bits = (msg.isExt ? (msg.id << 3) | can_filter_ide : msg.id << 21) | (msg.rtr ? 0x2 : 0);
+    return ((bits ^ filter.id) & filter.mask) == 0;
+}
 
 struct can_Signal_t {
-    const uint8_t startBit;
+    const uint16_t startBit;
     const uint8_t length;
     const bool isIntel;
     const float factor;
@@ -26,19 +139,37 @@ struct can_Cyclic_t {
     uint32_t lastTime_ms;
 };
 
-#include <iterator>
-template <typename T>
-constexpr T can_getSignal(can_Message_t msg, const uint8_t startBit, const uint8_t length, const bool isIntel) {
-    uint64_t tempVal = 0;
-    uint64_t mask = length < 64 ? (1ULL << length) - 1ULL : -1ULL;
-
+// @brief Byte and bit offset of bit pos of the payload.
+// Intel (little endian) signals count their start bit from the LSB of byte 0
+// upwards. Motorola (big endian) signals treat the payload as one big endian
+// number and count from its MSB, the start bit is the signal's MSB.
+// pos counts from the LSB of the signal in both cases.
+template<size_t N>
+constexpr void can_bitPosition(uint32_t startBit, uint32_t length, bool isIntel, uint32_t pos, uint32_t* byte, uint32_t* offset) {
     if (isIntel) {
-        std::memcpy(&tempVal, msg.buf, sizeof(tempVal));
-        tempVal = (tempVal >> startBit) & mask;
+        *byte = (startBit + pos) / 8;
+        *offset = (startBit + pos) % 8;
     } else {
-        std::reverse(std::begin(msg.buf), std::end(msg.buf));
-        std::memcpy(&tempVal, msg.buf, sizeof(tempVal));
-        tempVal = (tempVal >> (64 - startBit - length)) & mask;
+        uint32_t lsb = N * 8 - startBit - length + pos; // from the LSB of the big endian number
+        *byte = N - 1 - lsb / 8;
+        *offset = lsb % 8;
+    }
+}
+
+// The signal is copied in chunks of up to 8 bits, one per payload byte it
+// touches, so the signal can start at any bit of a classic or FD payload.
+template <typename T, size_t N>
+constexpr T can_getSignal(const can_MessageN_t<N>& msg, const uint16_t startBit, const uint8_t length, const bool isIntel) {
+    uint64_t tempVal = 0;
+    for (uint32_t pos = 0; pos < length && pos < 64;) {
+        uint32_t byte = 0, offset = 0;
+        can_bitPosition<N>(startBit, length, isIntel, pos, &byte, &offset);
+        uint32_t n = std::min<uint32_t>(8 - offset, length - pos);
+        if (byte >= N)
+            break;
+        uint64_t chunk = (msg.buf[byte] >> offset) & ((1u << n) - 1u);
+        tempVal |= chunk << pos;
+        pos += n;
     }
 
     T retVal;
@@ -46,52 +177,42 @@ constexpr T can_getSignal(can_Message_t msg, const uint8_t startBit, const uint8
     return retVal;
 }
 
-template <typename T>
-constexpr void can_setSignal(can_Message_t& msg, const T& val, const uint8_t startBit, const uint8_t length, const bool isIntel) {
+template <typename T, size_t N>
+constexpr void can_setSignal(can_MessageN_t<N>& msg, const T& val, const uint16_t startBit, const uint8_t length, const bool isIntel) {
     uint64_t valAsBits = 0;
     std::memcpy(&valAsBits, &val, sizeof(val));
 
-    uint64_t mask = length < 64 ? (1ULL << length) - 1ULL : -1ULL;
-
-    if (isIntel) {
-        uint64_t data = 0;
-        std::memcpy(&data, msg.buf, sizeof(data));
-
-        data &= ~(mask << startBit);
-        data |= valAsBits << startBit;
-
-        std::memcpy(msg.buf, &data, sizeof(data));
-    } else {
-        uint64_t data = 0;
-        std::reverse(std::begin(msg.buf), std::end(msg.buf));
-        std::memcpy(&data, msg.buf, sizeof(data));
-
-        data &= ~(mask << (64 - startBit - length));
-        data |= valAsBits << (64 - startBit - length);
-
-        std::memcpy(msg.buf, &data, sizeof(data));
-        std::reverse(std::begin(msg.buf), std::end(msg.buf));
+    // only the length bits are written, so negative values don't spill into the next signal
+    for (uint32_t pos = 0; pos < length && pos < 64;) {
+        uint32_t byte = 0, offset = 0;
+        can_bitPosition<N>(startBit, length, isIntel, pos, &byte, &offset);
+        uint32_t n = std::min<uint32_t>(8 - offset, length - pos);
+        if (byte >= N)
+            break;
+        uint8_t mask = ((1u << n) - 1u) << offset;
+        msg.buf[byte] = (msg.buf[byte] & ~mask) | (((valAsBits >> pos) << offset) & mask);
+        pos += n;
     }
 }
 
-template<typename T>
-void can_setSignal(can_Message_t& msg, const T& val, const uint8_t startBit, const uint8_t length, const bool isIntel, const float factor, const float offset) {
+template<typename T, size_t N>
+void can_setSignal(can_MessageN_t<N>& msg, const T& val, const uint16_t startBit, const uint8_t length, const bool isIntel, const float factor, const float offset) {
     T scaledVal = static_cast<T>((val - offset) / factor);
     can_setSignal<T>(msg, scaledVal, startBit, length, isIntel);
 }
 
-template<typename T>
-float can_getSignal(can_Message_t msg, const uint8_t startBit, const uint8_t length, const bool isIntel, const float factor, const float offset) {
+template<typename T, size_t N>
+float can_getSignal(const can_MessageN_t<N>& msg, const uint16_t startBit, const uint8_t length, const bool isIntel, const float factor, const float offset) {
     T retVal = can_getSignal<T>(msg, startBit, length, isIntel);
     return (retVal * factor) + offset;
 }
 
-template <typename T>
-float can_getSignal(can_Message_t msg, const can_Signal_t& signal) {
+template <typename T, size_t N>
+float can_getSignal(const can_MessageN_t<N>& msg, const can_Signal_t& signal) {
     return can_getSignal<T>(msg, signal.startBit, signal.length, signal.isIntel, signal.factor, signal.offset);
 }
 
-template <typename T>
-void can_setSignal(can_Message_t& msg, const T& val, const can_Signal_t& signal) {
+template <typename T, size_t N>
+void can_setSignal(can_MessageN_t<N>& msg, const T& val, const can_Signal_t& signal) {
     can_setSignal(msg, val, signal.startBit, signal.length, signal.isIntel, signal.factor, signal.offset);
 }
\ No newline at end of file
@@ -3,12 +3,32 @@
 
 #include <odrive_main.h>
 
+#include <cmath>
+
 void CANSimple::handle_can_message(const can_Message_t& msg) {
     //     Frame
     // nodeID | CMD
     // 6 bits | 5 bits
+    // The sync message is shared by all boards on the bus
+    if (odCAN->config_.sync_msg_id && msg.id == odCAN->config_.sync_msg_id) {
+        for (auto& axis : axes)
+            axis.controller_.trigger_staged_move();
+        return;
+    }
+
     uint32_t nodeID = get_node_id(msg.id);
 
+    // Encoder estimates of an electronic gearing master, usually another board
+    if (get_cmd_id(msg.id) == MSG_GET_ENCODER_ESTIMATES && !msg.rtr && msg.len == 8) {
+        for (auto& axis : axes) {
+            const Controller::Config_t& config = axis.controller_.config_;
+            if (config.gear_master_source == Controller::GEAR_MASTER_SOURCE_CAN
+                    && config.gear_master_can_node_id == nodeID && axis.config_.can.is_extended == msg.isExt)
+                axis.controller_.set_gear_can_master(can_getSignal<float>(msg, 0, 32, true),
+                                                     can_getSignal<float>(msg, 32, 32, true));
+        }
+    }
+
     for (auto& axis : axes) {
         if ((axis.config_.can.node_id == nodeID) && (axis.config_.can.is_extended == msg.isExt)) {
             doCommand(axis, msg);
@@ -49,8 +69,8 @@ void CANSimple::doCommand(Axis& axis, const can_Message_t& msg) {
         case MSG_SET_AXIS_REQUESTED_STATE:
             set_axis_requested_state_callback(axis, msg);
             break;
-        case MSG_SET_AXIS_STARTUP_CONFIG:
-            set_axis_startup_config_callback(axis, msg);
+        case MSG_SET_CONFIG_PROFILE:
+            set_config_profile_callback(axis, msg);
             break;
         case MSG_GET_ENCODER_ESTIMATES:
             if (msg.rtr)
@@ -105,6 +125,30 @@ void CANSimple::doCommand(Axis& axis, const can_Message_t& msg) {
         case MSG_CLEAR_ERRORS:
             clear_errors_callback(axis, msg);
             break;
+        case MSG_SET_LINEAR_COUNT:
+            set_linear_count_callback(axis, msg);
+            break;
+        case MSG_QUEUE_MOVE:
+            queue_move_callback(axis, msg);
+            break;
+        case MSG_GET_MOVE_QUEUE_STATUS:
+            if (msg.rtr)
+                get_move_queue_status_callback(axis);
+            break;
+        case MSG_PUSH_WAYPOINT:
+            push_waypoint_callback(axis, msg);
+            break;
+        case MSG_GET_WAYPOINT_STATUS:
+            if (msg.rtr)
+                get_waypoint_status_callback(axis);
+            break;
+        case MSG_STAGE_MOVE:
+            stage_move_callback(axis, msg);
+            break;
+        case MSG_GET_FEEDBACK:
+            if (msg.rtr)
+                send_feedback(axis);
+            break;
         default:
             break;
     }
@@ -156,28 +200,35 @@ int32_t CANSimple::get_sensorless_error_callback(const Axis& axis) {
 
 void CANSimple::set_axis_nodeid_callback(Axis& axis, const can_Message_t& msg) {
     axis.config_.can.node_id = can_getSignal<uint32_t>(msg, 0, 32, true);
+    odCAN->update_filters();
 }
 
 void CANSimple::set_axis_requested_state_callback(Axis& axis, const can_Message_t& msg) {
-    axis.requested_state_ = static_cast<Axis::AxisState>(can_getSignal<int32_t>(msg, 0, 16, true));
+    axis.request_state(static_cast<Axis::AxisState>(can_getSignal<int32_t>(msg, 0, 16, true)));
 }
 
-void CANSimple::set_axis_startup_config_callback(Axis& axis, const can_Message_t& msg) {
-    // Not Implemented
+void CANSimple::set_config_profile_callback(Axis& axis, const can_Message_t& msg) {
+    axis.select_profile(can_getSignal<uint8_t>(msg, 0, 8, true));
 }
 
 int32_t CANSimple::get_encoder_estimates_callback(const Axis& axis) {
+    // Composed from the whole turns and in-turn position so that the
+    // message is consistent with what the controller regulates on
+    float pos_estimate = (float)axis.encoder_.pos_estimate_turns_ + axis.encoder_.pos_estimate_in_turn_;
+    return send_encoder_estimates(axis, pos_estimate, axis.encoder_.vel_estimate_);
+}
+
+int32_t CANSimple::send_encoder_estimates(const Axis& axis, float pos_estimate, float vel_estimate) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_ENCODER_ESTIMATES;  // heartbeat ID
     txmsg.isExt = axis.config_.can.is_extended;
     txmsg.len = 8;
 
-    static_assert(sizeof(float) == sizeof(axis.encoder_.pos_estimate_));
     static_assert(sizeof(float) == sizeof(axis.encoder_.vel_estimate_));
 
-    can_setSignal<float>(txmsg, axis.encoder_.pos_estimate_, 0, 32, true);
-    can_setSignal<float>(txmsg, axis.encoder_.vel_estimate_, 32, 32, true);
+    can_setSignal<float>(txmsg, pos_estimate, 0, 32, true);
+    can_setSignal<float>(txmsg, vel_estimate, 32, 32, true);
 
     return odCAN->write(txmsg);
 }
@@ -210,25 +261,61 @@ int32_t CANSimple::get_encoder_count_callback(const Axis& axis) {
     return odCAN->write(txmsg);
 }
 
+// In sync mode the setpoints are buffered until the next sync message, see
+// ODriveCAN::latch_sync()
 void CANSimple::set_input_pos_callback(Axis& axis, const can_Message_t& msg) {
-    axis.controller_.input_pos_ = can_getSignal<float>(msg, 0, 32, true);
-    axis.controller_.input_vel_ = can_getSignal<int16_t>(msg, 32, 16, true, 0.001f, 0);
-    axis.controller_.input_torque_ = can_getSignal<int16_t>(msg, 48, 16, true, 0.001f, 0);
-    axis.controller_.input_pos_updated();
+    float input_pos = can_getSignal<float>(msg, 0, 32, true);
+    if (axis.config_.can.timed_setpoints) {
+        // The time takes the place of the feedforwards, the velocity is the
+        // slope to the next setpoint
+        uint32_t time = can_getSignal<uint32_t>(msg, 32, 32, true);
+        axis.controller_.timed_setpoints_.push({time, input_pos, 0.0f, 0.0f, false});
+        return;
+    }
+    float input_vel = can_getSignal<int16_t>(msg, 32, 16, true, 0.001f, 0);
+    float input_torque = can_getSignal<int16_t>(msg, 48, 16, true, 0.001f, 0);
+    if (axis.config_.can.sync_mode) {
+        uint32_t mask = cpu_enter_critical();
+        axis.can_.pending.input_pos = input_pos;
+        axis.can_.pending.input_vel = input_vel;
+        axis.can_.pending.input_torque = input_torque;
+        axis.can_.pending.pos_valid = axis.can_.pending.vel_valid = axis.can_.pending.torque_valid = true;
+        cpu_exit_critical(mask);
+        return;
+    }
+    axis.controller_.set_input_setpoints(SetpointMailbox::POS | SetpointMailbox::VEL | SetpointMailbox::TORQUE,
+                                         input_pos, input_vel, input_torque);
 }
 
 void CANSimple::set_input_vel_callback(Axis& axis, const can_Message_t& msg) {
-    axis.controller_.input_vel_ = can_getSignal<float>(msg, 0, 32, true);
-    axis.controller_.input_torque_ = can_getSignal<float>(msg, 32, 32, true);
+    float input_vel = can_getSignal<float>(msg, 0, 32, true);
+    float input_torque = can_getSignal<float>(msg, 32, 32, true);
+    if (axis.config_.can.sync_mode) {
+        uint32_t mask = cpu_enter_critical();
+        axis.can_.pending.input_vel = input_vel;
+        axis.can_.pending.input_torque = input_torque;
+        axis.can_.pending.vel_valid = axis.can_.pending.torque_valid = true;
+        cpu_exit_critical(mask);
+        return;
+    }
+    axis.controller_.set_input_setpoints(SetpointMailbox::VEL | SetpointMailbox::TORQUE, 0.0f, input_vel, input_torque);
 }
 
 void CANSimple::set_input_torque_callback(Axis& axis, const can_Message_t& msg) {
-    axis.controller_.input_torque_ = can_getSignal<float>(msg, 0, 32, true);
+    float input_torque = can_getSignal<float>(msg, 0, 32, true);
+    if (axis.config_.can.sync_mode) {
+        uint32_t mask = cpu_enter_critical();
+        axis.can_.pending.input_torque = input_torque;
+        axis.can_.pending.torque_valid = true;
+        cpu_exit_critical(mask);
+        return;
+    }
+    axis.controller_.set_input_setpoints(SetpointMailbox::TORQUE, 0.0f, 0.0f, input_torque);
 }
 
 void CANSimple::set_controller_modes_callback(Axis& axis, const can_Message_t& msg) {
-    axis.controller_.config_.control_mode = static_cast<Controller::ControlMode>(can_getSignal<int32_t>(msg, 0, 32, true));
-    axis.controller_.config_.input_mode = static_cast<Controller::InputMode>(can_getSignal<int32_t>(msg, 32, 32, true));
+    axis.controller_.config_.set_control_mode(static_cast<Controller::ControlMode>(can_getSignal<int32_t>(msg, 0, 32, true)));
+    axis.controller_.config_.set_input_mode(static_cast<Controller::InputMode>(can_getSignal<int32_t>(msg, 32, 32, true)));
 }
 
 void CANSimple::set_vel_limit_callback(Axis& axis, const can_Message_t& msg) {
@@ -256,6 +343,30 @@ void CANSimple::set_linear_count_callback(Axis& axis, const can_Message_t& msg){
     axis.encoder_.set_linear_count(can_getSignal<int32_t>(msg, 0, 32, true));
 }
 
+void CANSimple::queue_move_callback(Axis& axis, const can_Message_t& msg) {
+    // A full queue drops the move, this shows up in the queue depth
+    float accel_limit = can_getSignal<uint16_t>(msg, 48, 16, true, 0.01f, 0.0f);
+    axis.controller_.queue_move(can_getSignal<float>(msg, 0, 32, true),
+                                can_getSignal<uint16_t>(msg, 32, 16, true, 0.01f, 0.0f),
+                                accel_limit, accel_limit);
+}
+
+void CANSimple::push_waypoint_callback(Axis& axis, const can_Message_t& msg) {
+    // A full buffer drops the waypoint, this shows up in the buffer depth
+    axis.controller_.push_waypoint(can_getSignal<float>(msg, 0, 32, true),
+                                   can_getSignal<int16_t>(msg, 32, 16, true, 0.001f, 0.0f),
+                                   can_getSignal<uint16_t>(msg, 48, 16, true, 0.0001f, 0.0f));
+}
+
+void CANSimple::stage_move_callback(Axis& axis, const can_Message_t& msg) {
+    // The accel and decel times are fractions of the duration, so all axes
+    // that receive the same fractions share the same profile shape.
+    float duration = can_getSignal<uint16_t>(msg, 32, 16, true, 0.001f, 0.0f);
+    axis.controller_.stage_move(can_getSignal<float>(msg, 0, 32, true), duration,
+                                can_getSignal<uint8_t>(msg, 48, 8, true, 1.0f / 256.0f, 0.0f) * duration,
+                                can_getSignal<uint8_t>(msg, 56, 8, true, 1.0f / 256.0f, 0.0f) * duration);
+}
+
 int32_t CANSimple::get_iq_callback(const Axis& axis) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
@@ -286,6 +397,34 @@ int32_t CANSimple::get_vbus_voltage_callback(const Axis& axis) {
     return odCAN->write(txmsg);
 }
 
+int32_t CANSimple::get_move_queue_status_callback(const Axis& axis) {
+    can_Message_t txmsg;
+
+    txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
+    txmsg.id += MSG_GET_MOVE_QUEUE_STATUS;
+    txmsg.isExt = axis.config_.can.is_extended;
+    txmsg.len = 8;
+
+    can_setSignal<uint32_t>(txmsg, axis.controller_.move_queue_depth_, 0, 32, true);
+    can_setSignal<uint32_t>(txmsg, axis.controller_.move_queue_underruns_, 32, 32, true);
+
+    return odCAN->write(txmsg);
+}
+
+int32_t CANSimple::get_waypoint_status_callback(const Axis& axis) {
+    can_Message_t txmsg;
+
+    txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
+    txmsg.id += MSG_GET_WAYPOINT_STATUS;
+    txmsg.isExt = axis.config_.can.is_extended;
+    txmsg.len = 8;
+
+    can_setSignal<uint32_t>(txmsg, axis.controller_.waypoint_buffer_depth_, 0, 32, true);
+    can_setSignal<uint32_t>(txmsg, axis.controller_.waypoint_underruns_, 32, 32, true);
+
+    return odCAN->write(txmsg);
+}
+
 void CANSimple::clear_errors_callback(Axis& axis, const can_Message_t& msg) {
     axis.clear_errors();
 }
@@ -300,23 +439,82 @@ int32_t CANSimple::send_heartbeat(const Axis& axis) {
     can_setSignal(txmsg, axis.error_, 0, 32, true);
     can_setSignal(txmsg, axis.current_state_, 32, 32, true);
 
+    return odCAN->write(txmsg, ODriveCAN::TX_PRIORITY_HIGH);
+}
+
+// @brief Sends the feedback message composed from axis.config.can.feedback_signals.
+// The enabled signals are packed in order from bit 0, Intel byte order, each
+// one as an integer of its configured length: raw = (value - offset) / factor,
+// saturated to the range of the length. Signals that don't fit into the 64
+// bits are left out. The DLC covers the packed bits.
+int32_t CANSimple::send_feedback(const Axis& axis) {
+    can_Message_t txmsg;
+    txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
+    txmsg.id += MSG_GET_FEEDBACK;
+    txmsg.isExt = axis.config_.can.is_extended;
+
+    uint32_t bit = 0;
+    for (const auto& signal : axis.config_.can.feedback_signals) {
+        if (signal.length == 0 || signal.length > 32 || bit + signal.length > 64)
+            continue;
+        Introspectable property;
+        const FloatGettableTypeInfo* type_info = fibre::get_float_endpoint(signal.endpoint, &property);
+        if (!type_info)
+            continue;
+        float value = 0.0f;
+        type_info->get_float(property, &value);
+
+        float raw = std::round((value - signal.offset) / (signal.factor != 0.0f ? signal.factor : 1.0f));
+        if (std::isnan(raw))
+            raw = 0.0f;
+        float max = signal.is_signed ? (float)((1ULL << (signal.length - 1)) - 1) : (float)((1ULL << signal.length) - 1);
+        float min = signal.is_signed ? -max - 1.0f : 0.0f;
+        int64_t clamped = (int64_t)std::clamp(raw, min, max);
+        can_setSignal<int64_t>(txmsg, clamped, bit, signal.length, true);
+        bit += signal.length;
+    }
+    txmsg.len = (bit + 7) / 8;
+
     return odCAN->write(txmsg);
 }
 
+// @brief Returns the time the next cyclic message is due.
+// Keeps the configured rate on average instead of drifting by the loop
+// period each time, but never sends a burst to catch up on missed periods.
+static uint32_t next_cyclic_time(uint32_t last, uint32_t rate_ms, uint32_t now) {
+    last += rate_ms;
+    return (now - last) >= rate_ms ? now : last;
+}
+
+// Messages that don't fit into the TX queue are counted in
+// odCAN->tx_queue_drops_ and not retried, the next one is sent a period later.
 void CANSimple::send_cyclic(Axis& axis) {
     const uint32_t now = osKernelSysTick();
 
     if (axis.config_.can.heartbeat_rate_ms > 0) {
         if ((now - axis.can_.last_heartbeat) >= axis.config_.can.heartbeat_rate_ms) {
-            if(send_heartbeat(axis) >= 0)
-                axis.can_.last_heartbeat = now;
+            send_heartbeat(axis);
+            axis.can_.last_heartbeat = next_cyclic_time(axis.can_.last_heartbeat, axis.config_.can.heartbeat_rate_ms, now);
         }
     }
 
-    if (axis.config_.can.encoder_rate_ms > 0) {
+    if (axis.config_.can.sync_mode) {
+        // sampled by ODriveCAN::latch_sync() on the last sync message
+        if (axis.can_.feedback_pending) {
+            send_encoder_estimates(axis, axis.can_.feedback_pos, axis.can_.feedback_vel);
+            axis.can_.feedback_pending = false;
+        }
+    } else if (axis.config_.can.encoder_rate_ms > 0) {
         if ((now - axis.can_.last_encoder) >= axis.config_.can.encoder_rate_ms) {
-            if(get_encoder_estimates_callback(axis) >= 0)
-                axis.can_.last_encoder = now;
+            get_encoder_estimates_callback(axis);
+            axis.can_.last_encoder = next_cyclic_time(axis.can_.last_encoder, axis.config_.can.encoder_rate_ms, now);
+        }
+    }
+
+    if (axis.config_.can.feedback_rate_ms > 0) {
+        if ((now - axis.can_.last_feedback) >= axis.config_.can.feedback_rate_ms) {
+            send_feedback(axis);
+            axis.can_.last_feedback = next_cyclic_time(axis.can_.last_feedback, axis.config_.can.feedback_rate_ms, now);
         }
     }
 }
@@ -14,7 +14,7 @@ class CANSimple {
         MSG_GET_SENSORLESS_ERROR,
         MSG_SET_AXIS_NODE_ID,
         MSG_SET_AXIS_REQUESTED_STATE,
-        MSG_SET_AXIS_STARTUP_CONFIG,
+        MSG_SET_CONFIG_PROFILE,
         MSG_GET_ENCODER_ESTIMATES,
         MSG_GET_ENCODER_COUNT,
         MSG_SET_CONTROLLER_MODES,
@@ -31,14 +31,25 @@ class CANSimple {
         MSG_RESET_ODRIVE,
         MSG_GET_VBUS_VOLTAGE,
         MSG_CLEAR_ERRORS,
+        MSG_SET_LINEAR_COUNT,
+        MSG_QUEUE_MOVE,
+        MSG_GET_MOVE_QUEUE_STATUS,
+        MSG_PUSH_WAYPOINT,
+        MSG_GET_WAYPOINT_STATUS,
+        MSG_STAGE_MOVE,
+        MSG_GET_FEEDBACK,
         MSG_CO_HEARTBEAT_CMD = 0x700,  // CANOpen NMT Heartbeat  SEND
     };
 
+    static constexpr uint8_t NUM_NODE_ID_BITS = 6;
+    static constexpr uint8_t NUM_CMD_ID_BITS = 11 - NUM_NODE_ID_BITS;
+
     static void handle_can_message(const can_Message_t& msg);
     static void doCommand(Axis& axis, const can_Message_t& cmd);
 
     // Cyclic Senders
     static int32_t send_heartbeat(const Axis& axis);
+    static int32_t send_feedback(const Axis& axis);
     static void send_cyclic(Axis& axis);
 
    private:
@@ -48,15 +59,18 @@ class CANSimple {
     static int32_t get_controller_error_callback(const Axis& axis);
     static int32_t get_sensorless_error_callback(const Axis& axis);
     static int32_t get_encoder_estimates_callback(const Axis& axis);
+    static int32_t send_encoder_estimates(const Axis& axis, float pos_estimate, float vel_estimate);
     static int32_t get_encoder_count_callback(const Axis& axis);
     static int32_t get_iq_callback(const Axis& axis);
     static int32_t get_sensorless_estimates_callback(const Axis& axis);
     static int32_t get_vbus_voltage_callback(const Axis& axis);
+    static int32_t get_move_queue_status_callback(const Axis& axis);
+    static int32_t get_waypoint_status_callback(const Axis& axis);
 
     // Set functions
     static void set_axis_nodeid_callback(Axis& axis, const can_Message_t& msg);
     static void set_axis_requested_state_callback(Axis& axis, const can_Message_t& msg);
-    static void set_axis_startup_config_callback(Axis& axis, const can_Message_t& msg);
+    static void set_config_profile_callback(Axis& axis, const can_Message_t& msg);
     static void set_input_pos_callback(Axis& axis, const can_Message_t& msg);
     static void set_input_vel_callback(Axis& axis, const can_Message_t& msg);
     static void set_input_torque_callback(Axis& axis, const can_Message_t& msg);
@@ -66,6 +80,9 @@ class CANSimple {
     static void set_traj_accel_limits_callback(Axis& axis, const can_Message_t& msg);
     static void set_traj_inertia_callback(Axis& axis, const can_Message_t& msg);
     static void set_linear_count_callback(Axis& axis, const can_Message_t& msg);
+    static void queue_move_callback(Axis& axis, const can_Message_t& msg);
+    static void push_waypoint_callback(Axis& axis, const can_Message_t& msg);
+    static void stage_move_callback(Axis& axis, const can_Message_t& msg);
 
     // Other functions
     static void nmt_callback(const Axis& axis, const can_Message_t& msg);
@@ -73,9 +90,6 @@ class CANSimple {
     static void clear_errors_callback(Axis& axis, const can_Message_t& msg);
     static void start_anticogging_callback(const Axis& axis, const can_Message_t& msg);
 
-    static constexpr uint8_t NUM_NODE_ID_BITS = 6;
-    static constexpr uint8_t NUM_CMD_ID_BITS = 11 - NUM_NODE_ID_BITS;
-
     // Utility functions
     static constexpr uint32_t get_node_id(uint32_t msgID) {
         return (msgID >> NUM_CMD_ID_BITS);  // Upper 6 or more bits
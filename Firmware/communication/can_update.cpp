@@ -0,0 +1,175 @@
+#include "can_update.hpp"
+#include "can_fibre.hpp"
+
+#include <Drivers/STM32/stm32_nvm.h>
+#include <cmsis_os.h>
+
+#include <algorithm>
+
+enum : uint8_t {
+    CMD_START = 0x01,
+    CMD_BLOCK = 0x02,
+    CMD_FINISH = 0x03,
+    CMD_APPLY = 0x04,
+    CMD_STATUS = 0x05,
+    CMD_ABORT = 0x06,
+};
+
+// Transfer in progress
+struct UpdateState_t {
+    CANUpdate::State state;
+    CANUpdate::Error error;
+    uint32_t size;     // [bytes] of the image
+    uint32_t crc;      // expected CRC-32/MPEG-2
+    uint32_t received; // [bytes] written to the staging area
+    // Block being received, frames is 0 while idle
+    uint32_t block_offset;
+    uint32_t frames;
+    uint32_t frames_received;
+    bool skip; // the block isn't the next one, drop its frames
+    uint8_t buf[CANUpdate::max_block_frames * 8];
+};
+
+static UpdateState_t update_;
+
+static uint32_t read_le32(const uint8_t* buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static bool any_motor_armed() {
+    return std::any_of(axes.begin(), axes.end(), [](Axis& axis) {
+        return axis.motor_.armed_state_ != Motor::ARMED_STATE_DISARMED;
+    });
+}
+
+static void send_status() {
+    can_Message_t txmsg;
+    txmsg.id = CANUpdate::status_id(odCAN->config_.fibre_node_id);
+    txmsg.isExt = true;
+    txmsg.len = 8;
+    txmsg.buf[0] = update_.state;
+    txmsg.buf[1] = update_.error;
+    for (size_t i = 0; i < 4; ++i)
+        txmsg.buf[2 + i] = (uint8_t)(update_.received >> (8 * i));
+    txmsg.buf[6] = 0;
+    txmsg.buf[7] = 0;
+    odCAN->write(txmsg, ODriveCAN::TX_PRIORITY_BULK);
+}
+
+static void fail(CANUpdate::Error error) {
+    update_.state = CANUpdate::STATE_FAILED;
+    update_.error = error;
+    update_.frames = 0;
+}
+
+static void handle_command(const can_Message_t& msg) {
+    if (msg.len < 1)
+        return;
+    switch (msg.buf[0]) {
+        case CMD_START: {
+            if (msg.len < 8) {
+                update_.error = CANUpdate::ERROR_INVALID_COMMAND;
+                break;
+            }
+            update_ = {};
+            update_.size = msg.buf[1] | (msg.buf[2] << 8) | (msg.buf[3] << 16);
+            update_.crc = read_le32(msg.buf + 4);
+            if (any_motor_armed()) {
+                fail(CANUpdate::ERROR_ARMED);
+            } else if (!update_.size || update_.size > FW_STAGING_get_max_size()) {
+                fail(CANUpdate::ERROR_TOO_LARGE);
+            } else if (FW_STAGING_erase(update_.size) != 0) {
+                fail(CANUpdate::ERROR_ERASE);
+            } else {
+                update_.state = CANUpdate::STATE_RECEIVING;
+            }
+        } break;
+
+        case CMD_BLOCK: {
+            if (msg.len < 6 || msg.buf[5] < 1 || msg.buf[5] > CANUpdate::max_block_frames) {
+                update_.error = CANUpdate::ERROR_INVALID_COMMAND;
+                break;
+            }
+            // Frames of the block are dropped when not receiving, the status
+            // after the block tells the host
+            update_.block_offset = read_le32(msg.buf + 1);
+            update_.frames = msg.buf[5];
+            update_.frames_received = 0;
+            update_.skip = update_.state != CANUpdate::STATE_RECEIVING || update_.block_offset != update_.received;
+        } return; // the status follows the block
+
+        case CMD_FINISH: {
+            if (update_.state != CANUpdate::STATE_RECEIVING || update_.received < update_.size) {
+                update_.error = CANUpdate::ERROR_INVALID_STATE;
+            } else if (FW_STAGING_crc32(update_.size) != update_.crc) {
+                fail(CANUpdate::ERROR_CRC_MISMATCH);
+            } else {
+                update_.state = CANUpdate::STATE_VERIFIED;
+                update_.error = CANUpdate::ERROR_NONE;
+            }
+        } break;
+
+        case CMD_APPLY: {
+            if (update_.state != CANUpdate::STATE_VERIFIED) {
+                update_.error = CANUpdate::ERROR_INVALID_STATE;
+            } else if (any_motor_armed()) {
+                update_.error = CANUpdate::ERROR_ARMED;
+            } else {
+                send_status();
+                osDelay(10); // let the status frame go out
+                FW_STAGING_apply(update_.size);
+            }
+        } break;
+
+        case CMD_STATUS:
+            break;
+
+        case CMD_ABORT:
+            update_ = {};
+            break;
+
+        default:
+            update_.error = CANUpdate::ERROR_INVALID_COMMAND;
+            break;
+    }
+    send_status();
+}
+
+static void handle_data(const can_Message_t& msg) {
+    if (!update_.frames)
+        return;
+    if (!update_.skip) {
+        if (msg.len != 8) {
+            update_.skip = true; // a short frame, the host resends the block
+        } else {
+            memcpy(update_.buf + 8 * update_.frames_received, msg.buf, 8);
+        }
+    }
+    if (++update_.frames_received < update_.frames)
+        return;
+
+    if (!update_.skip) {
+        // The last block may extend past the image, up to a whole frame
+        size_t length = std::min<size_t>(8 * update_.frames, update_.size - update_.received);
+        if (FW_STAGING_program(update_.received, update_.buf, length) != 0)
+            fail(CANUpdate::ERROR_PROGRAM);
+        else
+            update_.received += length;
+    }
+    update_.frames = 0;
+    send_status();
+}
+
+bool CANUpdate::handle_can_message(const can_Message_t& msg) {
+    const ODriveCAN::Config_t& config = odCAN->config_;
+    if (!config.enable_firmware_update || config.fibre_node_id > CANFibre::max_node_id || !msg.isExt || msg.rtr)
+        return false;
+    if (msg.id == command_id(config.fibre_node_id) || msg.id == multicast_command_id) {
+        handle_command(msg);
+    } else if (msg.id == data_id(config.fibre_node_id) || msg.id == multicast_data_id) {
+        handle_data(msg);
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef __CAN_UPDATE_HPP_
+#define __CAN_UPDATE_HPP_
+
+#include "interface_can.hpp"
+
+// Firmware update over CAN, so that the nodes of a machine can be updated
+// without a USB connection to each of them. The image is transferred into a
+// staging area in flash while the present firmware keeps running, checked
+// against its CRC-32 and only then copied over the present firmware.
+// Enabled by odrv.can.config.enable_firmware_update, on extended IDs of a
+// reserved range:
+//     command (host to ODrive):  base_id + 4 * odrv.can.config.fibre_node_id
+//     data (host to ODrive):     base_id + 4 * odrv.can.config.fibre_node_id + 1
+//     status (ODrive to host):   base_id + 4 * odrv.can.config.fibre_node_id + 2
+//     multicast command:         base_id + 0x400
+//     multicast data:            base_id + 0x401
+// A multicast transfer updates all enabled nodes at once, each of them
+// answers on its own status ID.
+//
+// Commands, byte 0 is the opcode, integers are little endian:
+//     START  0x01 SS SS SS CC CC CC CC  image size (24 bit) and CRC-32/MPEG-2,
+//                                       erases the staging area
+//     BLOCK  0x02 OO OO OO OO NN        offset and number of data frames that
+//                                       follow, 1..max_block_frames
+//     FINISH 0x03                       checks the CRC of the staged image
+//     APPLY  0x04                       installs the verified image and reboots
+//     STATUS 0x05                       requests the status
+//     ABORT  0x06                       back to idle
+// Each data frame carries 8 bytes of the image. A block is only written if
+// its offset is the number of bytes received so far, anything else is
+// skipped, so a host resends from the lowest offset any node reported. The
+// status is sent after each command and each completed block:
+//     SS EE RR RR RR RR 00 00           state, error, bytes received
+class CANUpdate {
+   public:
+    static constexpr uint32_t base_id = 0x1FFFF800;
+    static constexpr uint32_t multicast_offset = 0x400;
+    static constexpr uint32_t max_block_frames = 64;
+
+    enum State : uint8_t {
+        STATE_IDLE,
+        STATE_RECEIVING,
+        STATE_VERIFIED,
+        STATE_FAILED,
+    };
+
+    enum Error : uint8_t {
+        ERROR_NONE,
+        ERROR_ARMED,          // a motor is armed
+        ERROR_TOO_LARGE,      // the image doesn't fit into the staging area
+        ERROR_ERASE,
+        ERROR_PROGRAM,
+        ERROR_CRC_MISMATCH,
+        ERROR_INVALID_STATE,  // command not allowed in the present state
+        ERROR_INVALID_COMMAND,
+    };
+
+    static uint32_t command_id(uint32_t node_id) { return base_id + 4 * node_id; }
+    static uint32_t data_id(uint32_t node_id) { return base_id + 4 * node_id + 1; }
+    static uint32_t status_id(uint32_t node_id) { return base_id + 4 * node_id + 2; }
+    static constexpr uint32_t multicast_command_id = base_id + multicast_offset;
+    static constexpr uint32_t multicast_data_id = base_id + multicast_offset + 1;
+
+    // @brief Handles the frame if it is addressed to the firmware update.
+    // Returns false for all other frames.
+    static bool handle_can_message(const can_Message_t& msg);
+};
+
+#endif  // __CAN_UPDATE_HPP_
@@ -0,0 +1,669 @@
+#include "canopen.hpp"
+
+#include <odrive_main.h>
+
+#include <cmath>
+
+CANopen::Node_t CANopen::nodes_[AXIS_COUNT];
+
+// SDO abort codes (CiA 301)
+enum : uint32_t {
+    SDO_OK = 0,
+    SDO_ABORT_COMMAND = 0x05040001,       // command specifier not valid or unknown
+    SDO_ABORT_READ_ONLY = 0x06010002,
+    SDO_ABORT_NO_OBJECT = 0x06020000,
+    SDO_ABORT_NOT_MAPPABLE = 0x06040041,
+    SDO_ABORT_PDO_LENGTH = 0x06040042,    // mapped objects exceed the PDO length
+    SDO_ABORT_LENGTH = 0x06070010,        // data type does not match
+    SDO_ABORT_NO_SUBINDEX = 0x06090011,
+    SDO_ABORT_VALUE_RANGE = 0x06090030,
+    SDO_ABORT_DEVICE_STATE = 0x08000022,
+};
+
+static constexpr uint32_t pdo_disabled = 1u << 31;
+
+// Modes of operation (0x6060) and the ODrive modes they select. 0 keeps the
+// modes configured in the controller.
+struct ModeMapping_t {
+    int8_t mode;
+    Controller::ControlMode control_mode;
+    Controller::InputMode input_mode;
+};
+static constexpr ModeMapping_t mode_mappings[] = {
+    {1, Controller::CONTROL_MODE_POSITION_CONTROL, Controller::INPUT_MODE_TRAP_TRAJ},   // profile position
+    {3, Controller::CONTROL_MODE_VELOCITY_CONTROL, Controller::INPUT_MODE_VEL_RAMP},    // profile velocity
+    {4, Controller::CONTROL_MODE_TORQUE_CONTROL, Controller::INPUT_MODE_TORQUE_RAMP},   // profile torque
+    {8, Controller::CONTROL_MODE_POSITION_CONTROL, Controller::INPUT_MODE_PASSTHROUGH}, // cyclic synchronous position
+    {9, Controller::CONTROL_MODE_VELOCITY_CONTROL, Controller::INPUT_MODE_PASSTHROUGH}, // cyclic synchronous velocity
+    {10, Controller::CONTROL_MODE_TORQUE_CONTROL, Controller::INPUT_MODE_PASSTHROUGH},  // cyclic synchronous torque
+};
+
+static const ModeMapping_t* find_mode(int8_t mode) {
+    for (const auto& mapping : mode_mappings) {
+        if (mapping.mode == mode)
+            return &mapping;
+    }
+    return nullptr;
+}
+
+static float get_position(const Axis& axis) {
+    return (float)axis.encoder_.pos_estimate_turns_ + axis.encoder_.pos_estimate_in_turn_;
+}
+
+// Positions wrap around at +-32768 turns like an incremental encoder
+static int32_t to_counts(float turns) {
+    float counts = std::round(turns * (float)CANopen::counts_per_turn);
+    if (!std::isfinite(counts) || std::abs(counts) > 9e18f)
+        return 0;
+    return (int32_t)(uint32_t)(int64_t)counts;
+}
+
+static void write_frame(uint32_t id, const uint8_t* data, uint8_t len, ODriveCAN::TxPriority priority = ODriveCAN::TX_PRIORITY_LOW) {
+    can_Message_t txmsg;
+    txmsg.id = id;
+    txmsg.isExt = false;
+    txmsg.len = len;
+    std::memcpy(txmsg.buf, data, len);
+    odCAN->write(txmsg, priority);
+}
+
+void CANopen::handle_can_message(const can_Message_t& msg) {
+    if (msg.isExt || msg.rtr)
+        return;
+
+    if (msg.id == FUNCTION_NMT) {
+        for (auto& axis : axes) {
+            uint32_t node_id = axis.config_.can.node_id;
+            if (is_valid_node_id(node_id) && (msg.buf[1] == 0 || msg.buf[1] == node_id))
+                handle_nmt(axis, msg.buf[0]);
+        }
+        return;
+    }
+
+    if (msg.id == FUNCTION_SYNC) {
+        handle_sync();
+        return;
+    }
+
+    for (auto& axis : axes) {
+        uint32_t node_id = axis.config_.can.node_id;
+        if (!is_valid_node_id(node_id))
+            continue;
+        Node_t& n = node(axis);
+
+        if (msg.id == FUNCTION_SDO_RX + node_id) {
+            axis.watchdog_feed();
+            if (n.nmt_state != NMT_STOPPED)
+                handle_sdo(axis, msg);
+            return;
+        }
+
+        if (n.nmt_state != NMT_OPERATIONAL)
+            continue;
+        for (auto& pdo : n.rpdos) {
+            if (!(pdo.cob_id & pdo_disabled) && msg.id == (pdo.cob_id & 0x7ff)) {
+                axis.watchdog_feed();
+                if (pdo.transmission_type <= 240) {
+                    // synchronous, applied on the next SYNC
+                    std::memcpy(pdo.rx_data, msg.buf, sizeof(pdo.rx_data));
+                    pdo.rx_len = msg.len;
+                    pdo.rx_pending = true;
+                } else {
+                    handle_rpdo(axis, pdo, msg.buf, msg.len);
+                }
+                return;
+            }
+        }
+    }
+}
+
+// @brief Processes the NMT events, sends the boot-up message, heartbeat and
+// event driven TPDOs. Called periodically by each axis.
+void CANopen::send_cyclic(Axis& axis) {
+    uint32_t node_id = axis.config_.can.node_id;
+    if (!is_valid_node_id(node_id))
+        return;
+    Node_t& n = node(axis);
+    const uint32_t now = osKernelSysTick();
+
+    if (n.nmt_state == NMT_BOOT_UP) {
+        // first call after startup, the CiA 402 state starts here as well
+        n.state = CIA402_NOT_READY_TO_SWITCH_ON;
+        n.mode = 0;
+        n.rated_torque = 1000;
+        reset_communication(axis);
+    } else if (n.node_id != node_id) {
+        reset_communication(axis); // the default COB-IDs contain the node ID
+    }
+
+    if (n.boot_up_pending) {
+        uint8_t data = NMT_BOOT_UP;
+        write_frame(FUNCTION_HEARTBEAT + node_id, &data, 1, ODriveCAN::TX_PRIORITY_HIGH);
+        n.boot_up_pending = false;
+        n.last_heartbeat = now;
+    }
+
+    if (n.heartbeat_ms > 0 && (now - n.last_heartbeat) >= n.heartbeat_ms) {
+        uint8_t data = n.nmt_state;
+        write_frame(FUNCTION_HEARTBEAT + node_id, &data, 1, ODriveCAN::TX_PRIORITY_HIGH);
+        n.last_heartbeat = now;
+    }
+
+    update_state(axis);
+
+    if (n.nmt_state != NMT_OPERATIONAL)
+        return;
+    for (auto& pdo : n.tpdos) {
+        if (pdo.transmission_type >= 254 && pdo.event_timer_ms > 0 && (now - pdo.last_sent) >= pdo.event_timer_ms) {
+            send_tpdo(axis, pdo);
+            pdo.last_sent = now;
+        }
+    }
+}
+
+// @brief Restores the default communication parameters and PDO mappings of
+// the node and sends the boot-up message.
+void CANopen::reset_communication(Axis& axis) {
+    Node_t& n = node(axis);
+    uint32_t node_id = axis.config_.can.node_id;
+
+    n.node_id = node_id;
+    n.nmt_state = NMT_PRE_OPERATIONAL;
+    n.boot_up_pending = true;
+    n.heartbeat_ms = axis.config_.can.heartbeat_rate_ms;
+
+    const uint32_t rpdo_entries[num_pdos][2] = {
+        {0x60400010, 0x607A0020}, // controlword, target position
+        {0x60400010, 0x60FF0020}, // controlword, target velocity
+    };
+    const uint32_t tpdo_entries[num_pdos][2] = {
+        {0x60410010, 0x60640020}, // statusword, position actual value
+        {0x606C0020, 0x60770010}, // velocity actual value, torque actual value
+    };
+    for (size_t i = 0; i < num_pdos; ++i) {
+        n.rpdos[i] = {};
+        n.rpdos[i].cob_id = FUNCTION_RPDO1 + 0x100 * i + node_id;
+        n.rpdos[i].transmission_type = 255;
+        n.rpdos[i].num_entries = 2;
+        std::copy(std::begin(rpdo_entries[i]), std::end(rpdo_entries[i]), n.rpdos[i].entries);
+
+        n.tpdos[i] = {};
+        n.tpdos[i].cob_id = FUNCTION_TPDO1 + 0x100 * i + node_id;
+        n.tpdos[i].transmission_type = 1; // on every SYNC
+        n.tpdos[i].num_entries = 2;
+        std::copy(std::begin(tpdo_entries[i]), std::end(tpdo_entries[i]), n.tpdos[i].entries);
+    }
+}
+
+// NMT reset node is handled like reset communication, it doesn't reboot the
+// board because the other axis may be in use.
+void CANopen::handle_nmt(Axis& axis, uint8_t command) {
+    Node_t& n = node(axis);
+    switch (command) {
+        case 0x01: n.nmt_state = NMT_OPERATIONAL; break;
+        case 0x02: n.nmt_state = NMT_STOPPED; break;
+        case 0x80: n.nmt_state = NMT_PRE_OPERATIONAL; break;
+        case 0x81: // reset node
+        case 0x82: reset_communication(axis); break;
+        default: break;
+    }
+}
+
+void CANopen::handle_sync() {
+    for (auto& axis : axes) {
+        if (!is_valid_node_id(axis.config_.can.node_id))
+            continue;
+        Node_t& n = node(axis);
+        if (n.nmt_state != NMT_OPERATIONAL)
+            continue;
+
+        for (auto& pdo : n.rpdos) {
+            if (pdo.rx_pending) {
+                pdo.rx_pending = false;
+                handle_rpdo(axis, pdo, pdo.rx_data, pdo.rx_len);
+            }
+        }
+        for (auto& pdo : n.tpdos) {
+            if ((pdo.cob_id & pdo_disabled) || pdo.transmission_type > 240)
+                continue;
+            if (++pdo.sync_count >= std::max<uint8_t>(pdo.transmission_type, 1)) {
+                pdo.sync_count = 0;
+                send_tpdo(axis, pdo);
+            }
+        }
+    }
+}
+
+// Expedited transfers only, all objects fit into 4 bytes
+void CANopen::handle_sdo(Axis& axis, const can_Message_t& msg) {
+    const uint8_t command = msg.buf[0];
+    const uint16_t index = msg.buf[1] | (msg.buf[2] << 8);
+    const uint8_t subindex = msg.buf[3];
+
+    uint8_t response[8] = {0, msg.buf[1], msg.buf[2], subindex, 0, 0, 0, 0};
+    uint32_t abort = SDO_OK;
+
+    switch (command >> 5) {
+        case 1: { // initiate download
+            bool expedited = command & 0x02;
+            bool size_indicated = command & 0x01;
+            if (!expedited) {
+                abort = SDO_ABORT_COMMAND;
+                break;
+            }
+            uint8_t size = size_indicated ? 4 - ((command >> 2) & 0x3) : 0;
+            uint32_t value = 0;
+            std::memcpy(&value, &msg.buf[4], 4);
+            if (size > 0 && size < 4)
+                value &= (1u << (8 * size)) - 1;
+            abort = od_write(axis, index, subindex, value, size);
+            response[0] = 0x60;
+        } break;
+
+        case 2: { // initiate upload
+            uint32_t value = 0;
+            uint8_t size = 0;
+            abort = od_read(axis, index, subindex, &value, &size);
+            response[0] = 0x43 | ((4 - size) << 2);
+            std::memcpy(&response[4], &value, 4);
+        } break;
+
+        case 4: // abort from the client
+            return;
+
+        default:
+            abort = SDO_ABORT_COMMAND;
+            break;
+    }
+
+    if (abort != SDO_OK) {
+        response[0] = 0x80;
+        std::memcpy(&response[4], &abort, 4);
+    }
+    write_frame(FUNCTION_SDO_TX + axis.config_.can.node_id, response, 8);
+}
+
+void CANopen::handle_rpdo(Axis& axis, Pdo_t& pdo, const uint8_t* data, uint8_t len) {
+    uint32_t offset = 0;
+    for (size_t i = 0; i < pdo.num_entries; ++i) {
+        uint32_t entry = pdo.entries[i];
+        uint8_t size = (entry & 0xff) / 8;
+        if (offset + size > len)
+            return; // too short, CiA 301 would send an EMCY
+        uint32_t value = 0;
+        std::memcpy(&value, &data[offset], size);
+        od_write(axis, entry >> 16, (entry >> 8) & 0xff, value, size);
+        offset += size;
+    }
+}
+
+int32_t CANopen::send_tpdo(Axis& axis, Pdo_t& pdo) {
+    uint8_t data[8] = {};
+    uint32_t offset = 0;
+    for (size_t i = 0; i < pdo.num_entries; ++i) {
+        uint32_t entry = pdo.entries[i];
+        uint32_t value = 0;
+        uint8_t size = 0;
+        od_read(axis, entry >> 16, (entry >> 8) & 0xff, &value, &size);
+        size = (entry & 0xff) / 8; // validated when the mapping was written
+        std::memcpy(&data[offset], &value, size);
+        offset += size;
+    }
+    write_frame(pdo.cob_id & 0x7ff, data, offset);
+    return 0;
+}
+
+uint32_t CANopen::od_read(Axis& axis, uint16_t index, uint8_t subindex, uint32_t* value, uint8_t* size) {
+    Node_t& n = node(axis);
+    auto result = [&](uint32_t val, uint8_t sz) {
+        *value = val;
+        *size = sz;
+        return (uint32_t)SDO_OK;
+    };
+    auto only_sub0 = [&](uint32_t val, uint8_t sz) {
+        return subindex == 0 ? result(val, sz) : (uint32_t)SDO_ABORT_NO_SUBINDEX;
+    };
+
+    if (index >= 0x2000 && index < 0x3000) {
+        // fibre properties by endpoint ID
+        if (subindex != 0)
+            return SDO_ABORT_NO_SUBINDEX;
+        Introspectable property;
+        const FloatGettableTypeInfo* type_info = fibre::get_float_endpoint({fibre::json_crc_, (uint16_t)(index - 0x2000)}, &property);
+        if (!type_info)
+            return SDO_ABORT_NO_OBJECT;
+        float val = 0.0f;
+        type_info->get_float(property, &val);
+        uint32_t bits;
+        std::memcpy(&bits, &val, 4);
+        return result(bits, 4);
+    }
+
+    if ((index & 0xfffe) == 0x1400 || (index & 0xfffe) == 0x1600)
+        return pdo_read(n.rpdos, false, index, subindex, value, size);
+    if ((index & 0xfffe) == 0x1800 || (index & 0xfffe) == 0x1a00)
+        return pdo_read(n.tpdos, true, index, subindex, value, size);
+
+    switch (index) {
+        case 0x1000: return only_sub0(0x00020192, 4); // CiA 402 servo drive
+        case 0x1001: return only_sub0(axis.error_ != Axis::ERROR_NONE ? 0x01 : 0x00, 1);
+        case 0x1017: return only_sub0(n.heartbeat_ms, 2);
+        case 0x1018:
+            switch (subindex) {
+                case 0: return result(4, 1);
+                case 1: return result(0, 4); // vendor ID, not registered
+                case 2: return result((odrv.hw_version_major_ << 16) | (odrv.hw_version_minor_ << 8) | odrv.hw_version_variant_, 4);
+                case 3: return result((odrv.fw_version_major_ << 16) | (odrv.fw_version_minor_ << 8) | odrv.fw_version_revision_, 4);
+                case 4: return result((uint32_t)serial_number, 4);
+                default: return SDO_ABORT_NO_SUBINDEX;
+            }
+        case 0x603F: return only_sub0(n.state == CIA402_FAULT ? 0x1000 : 0x0000, 2); // generic error
+        case 0x6040: return only_sub0(n.controlword, 2);
+        case 0x6041: return only_sub0(get_statusword(axis), 2);
+        case 0x6060: return only_sub0((uint8_t)n.mode, 1);
+        case 0x6061: return only_sub0((uint8_t)n.mode, 1);
+        case 0x6064: return only_sub0((uint32_t)to_counts(get_position(axis)), 4);
+        case 0x606C: return only_sub0((uint32_t)to_counts(axis.encoder_.vel_estimate_), 4);
+        case 0x6071: return only_sub0((uint16_t)n.target_torque, 2);
+        case 0x6076: return only_sub0(n.rated_torque, 4);
+        case 0x6077: {
+            float torque = axis.motor_.current_control_.Iq_measured * axis.motor_.config_.torque_constant; // [Nm]
+            float permille = n.rated_torque ? torque * 1e6f / (float)n.rated_torque : 0.0f;
+            return only_sub0((uint16_t)(int16_t)std::clamp(permille, -32768.0f, 32767.0f), 2);
+        }
+        case 0x607A: return only_sub0((uint32_t)n.target_position, 4);
+        case 0x60FF: return only_sub0((uint32_t)n.target_velocity, 4);
+        default: return SDO_ABORT_NO_OBJECT;
+    }
+}
+
+// @param size: number of bytes given by the client, 0 if not indicated
+uint32_t CANopen::od_write(Axis& axis, uint16_t index, uint8_t subindex, uint32_t value, uint8_t size) {
+    Node_t& n = node(axis);
+
+    // Checks the subindex, access and size like od_read reports them
+    uint32_t current = 0;
+    uint8_t object_size = 0;
+    uint32_t abort = od_read(axis, index, subindex, &current, &object_size);
+    if (abort != SDO_OK)
+        return abort;
+    if (size != 0 && size != object_size)
+        return SDO_ABORT_LENGTH;
+
+    if (index >= 0x2000 && index < 0x3000) {
+        float val;
+        std::memcpy(&val, &value, 4);
+        return fibre::set_endpoint_from_float({fibre::json_crc_, (uint16_t)(index - 0x2000)}, val) ? SDO_OK : SDO_ABORT_READ_ONLY;
+    }
+
+    if ((index & 0xfffe) == 0x1400 || (index & 0xfffe) == 0x1600)
+        return pdo_write(axis, n.rpdos, false, index, subindex, value);
+    if ((index & 0xfffe) == 0x1800 || (index & 0xfffe) == 0x1a00)
+        return pdo_write(axis, n.tpdos, true, index, subindex, value);
+
+    switch (index) {
+        case 0x1017:
+            n.heartbeat_ms = value;
+            return SDO_OK;
+        case 0x6040: {
+            uint32_t mask = cpu_enter_critical(); // update_state() runs in the control loop
+            write_controlword(axis, value);
+            cpu_exit_critical(mask);
+        } return SDO_OK;
+        case 0x6060:
+            if (value != 0 && !find_mode((int8_t)value))
+                return SDO_ABORT_VALUE_RANGE;
+            n.mode = (int8_t)value;
+            if (n.state == CIA402_OPERATION_ENABLED)
+                apply_mode(axis);
+            return SDO_OK;
+        case 0x6071:
+            n.target_torque = (int16_t)value;
+            apply_targets(axis);
+            return SDO_OK;
+        case 0x6076:
+            if (value == 0)
+                return SDO_ABORT_VALUE_RANGE;
+            n.rated_torque = value;
+            return SDO_OK;
+        case 0x607A:
+            n.target_position = (int32_t)value;
+            apply_targets(axis);
+            return SDO_OK;
+        case 0x60FF:
+            n.target_velocity = (int32_t)value;
+            apply_targets(axis);
+            return SDO_OK;
+        default:
+            return SDO_ABORT_READ_ONLY;
+    }
+}
+
+// Communication parameters: 0x1400/0x1800 + i, mapping: 0x1600/0x1A00 + i
+uint32_t CANopen::pdo_read(Pdo_t* pdos, bool tx, uint16_t index, uint8_t subindex, uint32_t* value, uint8_t* size) {
+    const Pdo_t& pdo = pdos[index & 0x1];
+    bool mapping = index & 0x0200;
+    *size = 4;
+    if (mapping) {
+        if (subindex == 0)
+            return *value = pdo.num_entries, *size = 1, SDO_OK;
+        if (subindex > max_pdo_entries)
+            return SDO_ABORT_NO_SUBINDEX;
+        return *value = pdo.entries[subindex - 1], SDO_OK;
+    }
+    switch (subindex) {
+        case 0: return *value = tx ? 5 : 2, *size = 1, SDO_OK;
+        case 1: return *value = pdo.cob_id, SDO_OK;
+        case 2: return *value = pdo.transmission_type, *size = 1, SDO_OK;
+        case 5: return tx ? (*value = pdo.event_timer_ms, *size = 2, SDO_OK) : SDO_ABORT_NO_SUBINDEX;
+        default: return SDO_ABORT_NO_SUBINDEX;
+    }
+}
+
+// Follows the CiA 301 procedure: a PDO is disabled with bit 31 of the COB-ID
+// and the number of mapped objects set to 0 before the entries are changed.
+uint32_t CANopen::pdo_write(Axis& axis, Pdo_t* pdos, bool tx, uint16_t index, uint8_t subindex, uint32_t value) {
+    Pdo_t& pdo = pdos[index & 0x1];
+    bool mapping = index & 0x0200;
+
+    if (mapping) {
+        if (subindex == 0) {
+            if (value > max_pdo_entries)
+                return SDO_ABORT_VALUE_RANGE;
+            uint32_t bits = 0;
+            for (size_t i = 0; i < value; ++i) {
+                uint32_t entry = pdo.entries[i];
+                uint32_t object_value = 0;
+                uint8_t object_size = 0;
+                if (od_read(axis, entry >> 16, (entry >> 8) & 0xff, &object_value, &object_size) != SDO_OK
+                        || (entry & 0xff) != 8u * object_size)
+                    return SDO_ABORT_NOT_MAPPABLE;
+                bits += entry & 0xff;
+            }
+            if (bits > 64)
+                return SDO_ABORT_PDO_LENGTH;
+            pdo.num_entries = value;
+            return SDO_OK;
+        }
+        if (pdo.num_entries != 0 && !(pdo.cob_id & pdo_disabled))
+            return SDO_ABORT_DEVICE_STATE;
+        pdo.entries[subindex - 1] = value;
+        return SDO_OK;
+    }
+
+    switch (subindex) {
+        case 1:
+            if ((value & 0x7ff) != (pdo.cob_id & 0x7ff) && !(pdo.cob_id & pdo_disabled) && !(value & pdo_disabled))
+                return SDO_ABORT_VALUE_RANGE; // the COB-ID can only change while the PDO is disabled
+            if (value & (1u << 29))
+                return SDO_ABORT_VALUE_RANGE; // extended frames not supported
+            pdo.cob_id = value & (pdo_disabled | 0x7ff);
+            return SDO_OK;
+        case 2:
+            if (value > 240 && value < 254)
+                return SDO_ABORT_VALUE_RANGE;
+            pdo.transmission_type = value;
+            pdo.sync_count = 0;
+            return SDO_OK;
+        case 5:
+            pdo.event_timer_ms = value;
+            return SDO_OK;
+        default:
+            return SDO_ABORT_READ_ONLY;
+    }
+}
+
+// CiA 402 state machine, controlword commands:
+//     shutdown 0bxxxx x110, switch on 0bxxxx 0111, enable operation
+//     0bxxxx 1111, disable voltage 0bxxxx xx0x, quick stop 0bxxxx x01x,
+//     fault reset 0b1xxx xxxx (rising edge)
+void CANopen::write_controlword(Axis& axis, uint16_t controlword) {
+    Node_t& n = node(axis);
+    uint16_t previous = n.controlword;
+    n.controlword = controlword;
+
+    bool shutdown = (controlword & 0x87) == 0x06;
+    bool switch_on = (controlword & 0x8f) == 0x07;
+    bool enable_operation = (controlword & 0x8f) == 0x0f;
+    bool disable_voltage = (controlword & 0x82) == 0x00;
+    bool quick_stop = (controlword & 0x86) == 0x02;
+    bool fault_reset = (controlword & 0x80) && !(previous & 0x80);
+
+    Cia402State state = n.state;
+    switch (n.state) {
+        case CIA402_FAULT:
+            if (fault_reset) {
+                axis.clear_errors();
+                state = CIA402_SWITCH_ON_DISABLED;
+            }
+            break;
+        case CIA402_SWITCH_ON_DISABLED:
+            if (shutdown)
+                state = CIA402_READY_TO_SWITCH_ON;
+            break;
+        case CIA402_READY_TO_SWITCH_ON:
+            if (enable_operation)
+                state = CIA402_OPERATION_ENABLED; // passes through switched on
+            else if (switch_on)
+                state = CIA402_SWITCHED_ON;
+            else if (disable_voltage || quick_stop)
+                state = CIA402_SWITCH_ON_DISABLED;
+            break;
+        case CIA402_SWITCHED_ON:
+            if (enable_operation)
+                state = CIA402_OPERATION_ENABLED;
+            else if (shutdown)
+                state = CIA402_READY_TO_SWITCH_ON;
+            else if (disable_voltage || quick_stop)
+                state = CIA402_SWITCH_ON_DISABLED;
+            break;
+        case CIA402_OPERATION_ENABLED:
+            if (switch_on)
+                state = CIA402_SWITCHED_ON;
+            else if (shutdown)
+                state = CIA402_READY_TO_SWITCH_ON;
+            else if (disable_voltage)
+                state = CIA402_SWITCH_ON_DISABLED;
+            else if (quick_stop)
+                state = CIA402_QUICK_STOP_ACTIVE;
+            break;
+        default:
+            break;
+    }
+
+    if (state == n.state)
+        return;
+    if (state == CIA402_OPERATION_ENABLED) {
+        if (axis.error_ != Axis::ERROR_NONE) {
+            n.state = CIA402_FAULT;
+            return;
+        }
+        // hold the present position, velocity and torque until new targets arrive
+        n.target_position = to_counts(get_position(axis));
+        n.target_velocity = 0;
+        n.target_torque = 0;
+        apply_mode(axis);
+        axis.request_state(Axis::AXIS_STATE_CLOSED_LOOP_CONTROL);
+    } else if (n.state == CIA402_OPERATION_ENABLED) {
+        axis.request_state(Axis::AXIS_STATE_IDLE); // the ODrive has no quick stop ramp
+    }
+    n.state = state;
+}
+
+// @brief Follows the axis: errors lead to the fault state, an axis that left
+// closed loop control on its own (e.g. over USB) disables operation.
+void CANopen::update_state(Axis& axis) {
+    Node_t& n = node(axis);
+    uint32_t mask = cpu_enter_critical(); // write_controlword() runs in the CAN thread
+    if (n.state == CIA402_NOT_READY_TO_SWITCH_ON || n.state == CIA402_QUICK_STOP_ACTIVE)
+        n.state = CIA402_SWITCH_ON_DISABLED;
+
+    bool fault_entered = false;
+    if (axis.error_ != Axis::ERROR_NONE && n.state != CIA402_FAULT) {
+        if (n.state == CIA402_OPERATION_ENABLED)
+            axis.request_state(Axis::AXIS_STATE_IDLE);
+        n.state = CIA402_FAULT;
+        fault_entered = true;
+    } else if (n.state == CIA402_OPERATION_ENABLED && axis.requested_state_ == Axis::AXIS_STATE_UNDEFINED
+            && axis.current_state_ != Axis::AXIS_STATE_CLOSED_LOOP_CONTROL) {
+        n.state = CIA402_SWITCH_ON_DISABLED;
+    }
+    cpu_exit_critical(mask);
+
+    if (fault_entered && n.nmt_state != NMT_STOPPED) {
+        // EMCY: error code, error register, axis error as manufacturer specific field
+        uint8_t data[8] = {0x00, 0x10, 0x01};
+        uint32_t error = axis.error_;
+        std::memcpy(&data[3], &error, 4);
+        write_frame(FUNCTION_SYNC + axis.config_.can.node_id, data, 8, ODriveCAN::TX_PRIORITY_HIGH);
+    }
+}
+
+void CANopen::apply_mode(Axis& axis) {
+    const ModeMapping_t* mapping = find_mode(node(axis).mode);
+    if (!mapping)
+        return;
+    axis.controller_.config_.set_control_mode(mapping->control_mode);
+    axis.controller_.config_.set_input_mode(mapping->input_mode);
+}
+
+// Profile position applies new targets immediately ("change set
+// immediately"), without the new setpoint handshake of controlword bit 4.
+void CANopen::apply_targets(Axis& axis) {
+    Node_t& n = node(axis);
+    if (n.state != CIA402_OPERATION_ENABLED)
+        return;
+    Controller& controller = axis.controller_;
+    switch (controller.config_.control_mode) {
+        case Controller::CONTROL_MODE_POSITION_CONTROL:
+            controller.set_input_setpoints(SetpointMailbox::POS, (float)n.target_position / (float)counts_per_turn, 0.0f, 0.0f);
+            break;
+        case Controller::CONTROL_MODE_VELOCITY_CONTROL:
+            controller.set_input_setpoints(SetpointMailbox::VEL, 0.0f, (float)n.target_velocity / (float)counts_per_turn, 0.0f);
+            break;
+        case Controller::CONTROL_MODE_TORQUE_CONTROL:
+            controller.set_input_setpoints(SetpointMailbox::TORQUE, 0.0f, 0.0f, (float)n.target_torque * (float)n.rated_torque * 1e-6f);
+            break;
+        default:
+            break;
+    }
+}
+
+uint16_t CANopen::get_statusword(const Axis& axis) {
+    const Node_t& n = node(axis);
+    static constexpr uint16_t remote = 1 << 9;
+    static constexpr uint16_t target_reached = 1 << 10;
+    uint16_t statusword = 0;
+    switch (n.state) {
+        case CIA402_NOT_READY_TO_SWITCH_ON: statusword = 0x0000; break;
+        case CIA402_SWITCH_ON_DISABLED: statusword = 0x0040; break;
+        case CIA402_READY_TO_SWITCH_ON: statusword = 0x0031; break;
+        case CIA402_SWITCHED_ON: statusword = 0x0033; break;
+        case CIA402_OPERATION_ENABLED: statusword = 0x0037; break;
+        case CIA402_QUICK_STOP_ACTIVE: statusword = 0x0017; break;
+        case CIA402_FAULT: statusword = 0x0008; break;
+    }
+    if (n.state == CIA402_OPERATION_ENABLED && axis.controller_.trajectory_done_)
+        statusword |= target_reached;
+    return statusword | remote;
+}
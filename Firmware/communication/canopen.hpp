@@ -0,0 +1,122 @@
+#ifndef __CANOPEN_HPP_
+#define __CANOPEN_HPP_
+
+#include "interface_can.hpp"
+
+// CANopen (CiA 301) slave with the CiA 402 drive profile, selected with
+// odrv.can.config.protocol = PROTOCOL_CANOPEN. Each axis is a node with the
+// node ID axis.config.can.node_id (1 to 127, standard frames only).
+//
+// Supported: NMT, boot-up and heartbeat producer, expedited SDO, SYNC, two
+// RPDOs and two TPDOs per node with configurable mapping, the CiA 402 state
+// machine and the cyclic synchronous and profile modes. The communication
+// and mapping parameters are not saved, the master configures them after
+// the boot-up message as usual. The hardware filters only pass COB-IDs that
+// end in the node ID, like all default ones.
+//
+// Object dictionary:
+//     0x1000 device type, 0x1001 error register, 0x1017 producer heartbeat
+//     time, 0x1018 identity, 0x1400/0x1401 RPDO and 0x1800/0x1801 TPDO
+//     communication parameters, 0x1600/0x1601 RPDO and 0x1A00/0x1A01 TPDO
+//     mapping, 0x603F error code, 0x6040 controlword, 0x6041 statusword,
+//     0x6060/0x6061 modes of operation, 0x6064 position actual value,
+//     0x606C velocity actual value, 0x6071 target torque, 0x6076 motor rated
+//     torque, 0x6077 torque actual value, 0x607A target position,
+//     0x60FF target velocity
+//     0x2000 + endpoint ID: any fibre property as REAL32, see
+//     odrivetool's json (`odrv._json_data`) for the endpoint IDs
+//
+// Units: positions in 1/65536 turn, velocities in 1/65536 turn/s, torques in
+// thousandths of the motor rated torque (0x6076, mNm, default 1000).
+class CANopen {
+   public:
+    static constexpr uint32_t counts_per_turn = 1 << 16;
+    static constexpr size_t num_pdos = 2;
+    static constexpr size_t max_pdo_entries = 8;
+
+    enum NmtState : uint8_t {
+        NMT_BOOT_UP = 0x00,
+        NMT_STOPPED = 0x04,
+        NMT_OPERATIONAL = 0x05,
+        NMT_PRE_OPERATIONAL = 0x7f,
+    };
+
+    enum Cia402State : uint8_t {
+        CIA402_NOT_READY_TO_SWITCH_ON,
+        CIA402_SWITCH_ON_DISABLED,
+        CIA402_READY_TO_SWITCH_ON,
+        CIA402_SWITCHED_ON,
+        CIA402_OPERATION_ENABLED,
+        CIA402_QUICK_STOP_ACTIVE,
+        CIA402_FAULT,
+    };
+
+    struct Pdo_t {
+        uint32_t cob_id;            // bit 31 disables the PDO
+        uint8_t transmission_type;  // 0..240 synchronous, 254/255 event driven
+        uint16_t event_timer_ms;    // TPDOs with type 254/255, 0 disables
+        uint8_t num_entries;
+        uint32_t entries[max_pdo_entries]; // index << 16 | subindex << 8 | bits
+        uint32_t last_sent;         // TPDO event timer
+        uint8_t sync_count;         // TPDO SYNCs since the last transmission
+        bool rx_pending;            // synchronous RPDO received, applied on the next SYNC
+        uint8_t rx_data[8];
+        uint8_t rx_len;
+    };
+
+    struct Node_t {
+        uint32_t node_id; // the COB-IDs were set up for
+        NmtState nmt_state;
+        bool boot_up_pending;
+        uint16_t heartbeat_ms;
+        uint32_t last_heartbeat;
+        Cia402State state;
+        uint16_t controlword;
+        int8_t mode;
+        uint32_t rated_torque; // [mNm]
+        int32_t target_position;
+        int32_t target_velocity;
+        int16_t target_torque;
+        Pdo_t rpdos[num_pdos];
+        Pdo_t tpdos[num_pdos];
+    };
+
+    static void handle_can_message(const can_Message_t& msg);
+    static void send_cyclic(Axis& axis);
+    static void reset_communication(Axis& axis);
+
+    static Node_t nodes_[AXIS_COUNT];
+
+   private:
+    enum Function : uint16_t {
+        FUNCTION_NMT = 0x000,
+        FUNCTION_SYNC = 0x080,
+        FUNCTION_TPDO1 = 0x180,
+        FUNCTION_RPDO1 = 0x200,
+        FUNCTION_SDO_TX = 0x580,
+        FUNCTION_SDO_RX = 0x600,
+        FUNCTION_HEARTBEAT = 0x700,
+    };
+
+    static Node_t& node(const Axis& axis) { return nodes_[axis.axis_num_]; }
+    static bool is_valid_node_id(uint32_t node_id) { return node_id >= 1 && node_id <= 127; }
+
+    static void handle_nmt(Axis& axis, uint8_t command);
+    static void handle_sync();
+    static void handle_sdo(Axis& axis, const can_Message_t& msg);
+    static void handle_rpdo(Axis& axis, Pdo_t& pdo, const uint8_t* data, uint8_t len);
+    static int32_t send_tpdo(Axis& axis, Pdo_t& pdo);
+
+    static uint32_t od_read(Axis& axis, uint16_t index, uint8_t subindex, uint32_t* value, uint8_t* size);
+    static uint32_t od_write(Axis& axis, uint16_t index, uint8_t subindex, uint32_t value, uint8_t size);
+    static uint32_t pdo_read(Pdo_t* pdos, bool tx, uint16_t index, uint8_t subindex, uint32_t* value, uint8_t* size);
+    static uint32_t pdo_write(Axis& axis, Pdo_t* pdos, bool tx, uint16_t index, uint8_t subindex, uint32_t value);
+
+    static void write_controlword(Axis& axis, uint16_t controlword);
+    static void update_state(Axis& axis);
+    static void apply_mode(Axis& axis);
+    static void apply_targets(Axis& axis);
+    static uint16_t get_statusword(const Axis& axis);
+};
+
+#endif  // __CANOPEN_HPP_
@@ -18,7 +18,9 @@
 //#include <usb_device.h>
 //#include <usart.h>
 #include <gpio.h>
+#include <Drivers/STM32/stm32_system.h>
 
+#include <algorithm>
 #include <type_traits>
 
 /* Private defines -----------------------------------------------------------*/
@@ -30,29 +32,113 @@
 uint64_t serial_number;
 char serial_number_str[13]; // 12 digits + null termination
 
-float oscilloscope[OSCILLOSCOPE_SIZE] = {0};
-size_t oscilloscope_pos = 0;
+osThreadId async_call_thread = 0;
+osThreadId comms_thread = 0;
 
 /* Private constant data -----------------------------------------------------*/
+
+// Same as the USB thread, the calls run the same endpoint handlers
+const uint32_t stack_size_async_call_thread = 4096; // Bytes
+static constexpr int32_t kAsyncCallSignalQueued = 1;
+// Same as the USB thread, it runs all endpoint handlers of USB, UART and CAN
+const uint32_t stack_size_comms_thread = 4096; // Bytes
+
 /* Private variables ---------------------------------------------------------*/
+
+CCM_RAM static StackType_t async_call_thread_stack[stack_size_async_call_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t async_call_thread_tcb;
+CCM_RAM static StackType_t comms_thread_stack[stack_size_comms_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t comms_thread_tcb;
+static bool comms_uart_enabled = false;
+static bool comms_can_enabled = false;
+
 /* Private function prototypes -----------------------------------------------*/
 /* Function implementations --------------------------------------------------*/
 
+// @brief Runs the asynchronous fibre function calls of all channels, see
+// fibre::async_call_handler(). It has a lower priority than the channel
+// threads, so they keep answering requests while a long call runs.
+static void async_call_thread_fn(void*) {
+    for (;;) {
+        osSignalWait(kAsyncCallSignalQueued, osWaitForever);
+        while (fibre::run_next_async_call());
+    }
+}
+
+static void start_async_call_thread() {
+    osThreadStaticDef(async_call_thread_def, async_call_thread_fn, osPriorityBelowNormal, 0, stack_size_async_call_thread / sizeof(StackType_t), async_call_thread_stack, &async_call_thread_tcb);
+    async_call_thread = osThreadCreate(osThread(async_call_thread_def), NULL);
+    fibre::on_async_call_queued = [] { osSignalSet(async_call_thread, kAsyncCallSignalQueued); };
+}
+
+static osPriority to_os_priority(ODriveIntf::ThreadPriority priority) {
+    return (osPriority)(osPriorityLow + std::min<int>(priority, ODriveIntf::THREAD_PRIORITY_ABOVE_NORMAL));
+}
+
+// @brief Polls USB, UART and CAN in turn, see
+// `config.enable_single_comms_thread`. All of their interrupts release
+// sem_usb_rx, so this thread only wakes up when one of them has work or wants
+// to be polled again.
+static void comms_thread_fn(void*) {
+    uint32_t wait = 0;
+    for (;;) {
+        uint32_t now = HAL_GetTick();
+        odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_USB, now);
+        if (comms_uart_enabled)
+            odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_UART, now);
+        if (comms_can_enabled)
+            odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_CAN, now);
+
+        osSemaphoreWait(sem_usb_rx, wait);
+        wait = usb_server_poll();
+        if (comms_uart_enabled)
+            wait = std::min(wait, uart_server_poll());
+        if (comms_can_enabled)
+            wait = std::min(wait, odCAN->server_poll());
+    }
+}
+
+static void start_comms_thread() {
+    comms_uart_enabled = odrv.config_.enable_uart0 && uart0;
+    comms_can_enabled = odrv.config_.enable_can0;
+    if (comms_uart_enabled)
+        init_uart_server();
+    if (comms_can_enabled) {
+        sem_can = sem_usb_rx; // the CAN interrupts wake up this thread
+        odCAN->init_can_server();
+    }
+
+    osPriority priority = std::max({to_os_priority(odrv.config_.usb_thread_priority),
+                                    comms_uart_enabled ? to_os_priority(odrv.config_.uart_thread_priority) : osPriorityIdle,
+                                    comms_can_enabled ? to_os_priority(odrv.config_.can_thread_priority) : osPriorityIdle});
+    osThreadStaticDef(comms_thread_def, comms_thread_fn, priority, 0, stack_size_comms_thread / sizeof(StackType_t), comms_thread_stack, &comms_thread_tcb);
+    comms_thread = osThreadCreate(osThread(comms_thread_def), NULL);
+}
+
 void init_communication(void) {
     printf("hi!\r\n");
 
-    if (odrv.config_.enable_uart0 && uart0) {
-        start_uart_server();
-    }
+    start_async_call_thread();
+    fibre::get_time_us = micros;
 
-    start_usb_server();
+    if (odrv.config_.enable_single_comms_thread) {
+        start_comms_thread();
+    } else {
+        if (odrv.config_.enable_uart0 && uart0) {
+            start_uart_server(to_os_priority(odrv.config_.uart_thread_priority));
+        }
+
+        start_usb_server(to_os_priority(odrv.config_.usb_thread_priority));
+    }
+    odrv.telemetry_.start_thread();
+    odrv.subscriptions_.start_thread();
 
     if (odrv.config_.enable_i2c0) {
         start_i2c_server();
     }
 
-    if (odrv.config_.enable_can0) {
-        odCAN->start_can_server();
+    if (odrv.config_.enable_can0 && !odrv.config_.enable_single_comms_thread) {
+        odCAN->start_can_server(to_os_priority(odrv.config_.can_thread_priority));
     }
 }
 
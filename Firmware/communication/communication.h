@@ -14,6 +14,9 @@ extern "C" {
 
 #include <cmsis_os.h>
 
+extern osThreadId async_call_thread;
+extern osThreadId comms_thread;
+
 void init_communication(void);
 
 #ifdef __cplusplus
@@ -6,9 +6,13 @@
 
 #include <can.h>
 #include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
 
 // Specific CAN Protocols
 #include "can_simple.hpp"
+#include "canopen.hpp"
+#include "can_fibre.hpp"
+#include "can_update.hpp"
 
 // Safer context handling via maps instead of arrays
 // #include <unordered_map>
@@ -21,155 +25,481 @@ ODriveCAN::ODriveCAN(ODriveCAN::Config_t &config, CAN_HandleTypeDef *handle)
     // ctxMap[handle_] = this;
 }
 
+// @brief Handles the messages that were received since the last call. Runs
+// on the CAN thread or on the merged comms thread.
+// @returns [ms] until the next call is needed at the latest
+uint32_t ODriveCAN::server_poll() {
+    update_stats();
+    update_filters(); // node IDs can be changed over USB at any time
+    send_time_sync();
+
+    uint32_t status = HAL_CAN_GetError(handle_);
+    if (status != HAL_CAN_ERROR_NONE) {
+        if (status == HAL_CAN_ERROR_TIMEOUT) {
+            HAL_CAN_ResetError(handle_);
+            status = HAL_CAN_Start(handle_);
+            if (status == HAL_OK)
+                status = HAL_CAN_ActivateNotification(handle_, notifications);
+        }
+        return 1;
+    }
+
+    can_Message_t rxmsg;
+    while (read(rxmsg)) {
+        if (CANUpdate::handle_can_message(rxmsg) || CANFibre::handle_can_message(rxmsg))
+            continue;
+        switch (config_.protocol) {
+            case PROTOCOL_SIMPLE:
+                CANSimple::handle_can_message(rxmsg);
+                break;
+            case PROTOCOL_CANOPEN:
+                CANopen::handle_can_message(rxmsg);
+                break;
+        }
+    }
+    // Poll every 10ms regardless of sempahore status, every 1ms while a fibre
+    // response is being sent.
+    return CANFibre::send_pending() ? 1 : 10;
+}
+
 void ODriveCAN::can_server_thread() {
+    uint32_t wait = 0;
     for (;;) {
-        uint32_t status = HAL_CAN_GetError(handle_);
-        if (status == HAL_CAN_ERROR_NONE) {
-            can_Message_t rxmsg;
-
-            osSemaphoreWait(sem_can, 10);  // Poll every 10ms regardless of sempahore status
-            while (available()) {
-                read(rxmsg);
-                switch (config_.protocol) {
-                    case PROTOCOL_SIMPLE:
-                        CANSimple::handle_can_message(rxmsg);
-                        break;
-                }
-            }
-            HAL_CAN_ActivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY);
-        } else {
-            if (status == HAL_CAN_ERROR_TIMEOUT) {
-                HAL_CAN_ResetError(handle_);
-                status = HAL_CAN_Start(handle_);
-                if (status == HAL_OK)
-                    status = HAL_CAN_ActivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY);
-            }
-        }
+        odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_CAN, HAL_GetTick());
+        // The RX ISR queues the frames and releases the semaphore.
+        osSemaphoreWait(sem_can, wait);
+        wait = server_poll();
     }
 }
 
+// There is only one ODriveCAN instance
+CCM_RAM static StackType_t thread_stack[ODriveCAN::stack_size_ / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t thread_tcb;
+
 static void can_server_thread_wrapper(void *ctx) {
     reinterpret_cast<ODriveCAN *>(ctx)->can_server_thread();
     reinterpret_cast<ODriveCAN *>(ctx)->thread_id_valid_ = false;
 }
 
-bool ODriveCAN::start_can_server() {
+bool ODriveCAN::init_can_server() {
     HAL_StatusTypeDef status;
 
-    set_baud_rate(config_.baud_rate);
+    handle_->Init.AutoBusOff = get_auto_bus_off();
+    // A stored timing that can't be set falls back to the defaults
+    if (!set_baud_rate(config_.baud_rate)) {
+        config_.sample_point = Config_t{}.sample_point;
+        set_baud_rate(Config_t{}.baud_rate);
+    }
 
     status = HAL_CAN_Init(handle_);
 
-    CAN_FilterTypeDef filter;
-    filter.FilterActivation = ENABLE;
-    filter.FilterBank = 0;
-    filter.FilterFIFOAssignment = CAN_RX_FIFO0;
-    filter.FilterIdHigh = 0x0000;
-    filter.FilterIdLow = 0x0000;
-    filter.FilterMaskIdHigh = 0x0000;
-    filter.FilterMaskIdLow = 0x0000;
-    filter.FilterMode = CAN_FILTERMODE_IDMASK;
-    filter.FilterScale = CAN_FILTERSCALE_32BIT;
-
-    status = HAL_CAN_ConfigFilter(handle_, &filter);
+    filters_valid_ = false;
+    update_filters();
 
     status = HAL_CAN_Start(handle_);
     if (status == HAL_OK)
-        status = HAL_CAN_ActivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY);
+        status = HAL_CAN_ActivateNotification(handle_, notifications);
+
+    return status;
+}
 
-    osThreadDef(can_server_thread_def, can_server_thread_wrapper, osPriorityNormal, 0, stack_size_ / sizeof(StackType_t));
+bool ODriveCAN::start_can_server(osPriority priority) {
+    bool status = init_can_server();
+
+    osThreadStaticDef(can_server_thread_def, can_server_thread_wrapper, priority, 0, stack_size_ / sizeof(StackType_t), thread_stack, &thread_tcb);
     thread_id_ = osThreadCreate(osThread(can_server_thread_def), this);
     thread_id_valid_ = true;
 
     return status;
 }
 
-// Send a CAN message on the bus
-int32_t ODriveCAN::write(can_Message_t &txmsg) {
-    if (HAL_CAN_GetError(handle_) == HAL_CAN_ERROR_NONE) {
-        CAN_TxHeaderTypeDef header;
-        header.StdId = txmsg.id;
-        header.ExtId = txmsg.id;
-        header.IDE = txmsg.isExt ? CAN_ID_EXT : CAN_ID_STD;
-        header.RTR = CAN_RTR_DATA;
-        header.DLC = txmsg.len;
-        header.TransmitGlobalTime = FunctionalState::DISABLE;
-
-        uint32_t retTxMailbox = 0;
-        if (HAL_CAN_GetTxMailboxesFreeLevel(handle_) > 0)
-            HAL_CAN_AddTxMessage(handle_, &header, txmsg.buf, &retTxMailbox);
-        else
-            return -1;
-        return (int32_t)retTxMailbox;
-    } else {
+// @brief Queues a CAN message for sending.
+// Returns -1 if the bus is in an error state or the queue of the priority is
+// full, the message is dropped then.
+// Can be called from any thread.
+int32_t ODriveCAN::write(can_Message_t &txmsg, TxPriority priority) {
+    if (HAL_CAN_GetError(handle_) != HAL_CAN_ERROR_NONE)
         return -1;
+
+    uint32_t mask = cpu_enter_critical();
+    bool queued = tx_queues_[priority].push(txmsg);
+    if (!queued)
+        ++tx_queue_drops_;
+    transmit_queued();
+    cpu_exit_critical(mask);
+    return queued ? 0 : -1;
+}
+
+// @brief Moves queued messages into the free TX mailboxes, highest priority
+// first. Called from write() and from the TX interrupt whenever a mailbox
+// becomes free, so bursts of messages are sent back to back without waiting
+// for the callers to retry.
+void ODriveCAN::transmit_queued() {
+    uint32_t mask = cpu_enter_critical();
+    for (auto& queue : tx_queues_) {
+        while (HAL_CAN_GetTxMailboxesFreeLevel(handle_) > 0) {
+            const can_Message_t* txmsg = queue.peek();
+            if (!txmsg)
+                break;
+
+            CAN_TxHeaderTypeDef header;
+            header.StdId = txmsg->id;
+            header.ExtId = txmsg->id;
+            header.IDE = txmsg->isExt ? CAN_ID_EXT : CAN_ID_STD;
+            header.RTR = CAN_RTR_DATA;
+            header.DLC = txmsg->len;
+            header.TransmitGlobalTime = FunctionalState::DISABLE;
+
+            uint32_t retTxMailbox = 0;
+            if (HAL_CAN_AddTxMessage(handle_, &header, const_cast<uint8_t*>(txmsg->buf), &retTxMailbox) != HAL_OK)
+                break; // not started, keep the message until it is
+            queue.pop();
+        }
+    }
+    cpu_exit_critical(mask);
+}
+
+// @brief Number of messages that can still be queued with the priority.
+uint32_t ODriveCAN::tx_queue_space(TxPriority priority) {
+    uint32_t mask = cpu_enter_critical();
+    uint32_t space = tx_queue_size - tx_queues_[priority].depth();
+    cpu_exit_critical(mask);
+    return space;
+}
+
+// @brief Counts the frame that was sent from the mailbox and refills the
+// mailboxes. Called from the TX interrupt.
+void ODriveCAN::tx_complete(uint32_t mailbox) {
+    const CAN_TxMailBox_TypeDef& regs = handle_->Instance->sTxMailBox[mailbox];
+    if (config_.time_master && config_.time_msg_id && (regs.TDTR & CAN_TDT0R_DLC) == 1) {
+        // Sent at the same point of the frame at which the followers receive it
+        Timebase::Timestamp_t stamp = odrv.timebase_.timestamp(DWT->CYCCNT);
+        uint32_t id = (regs.TIR & CAN_TI0R_IDE) ? (regs.TIR >> CAN_TI0R_EXID_Pos) : (regs.TIR >> CAN_TI0R_STID_Pos);
+        if (id == config_.time_msg_id) {
+            time_tx_stamp_ = stamp;
+            time_followup_pending_ = true;
+            osSemaphoreRelease(sem_can); // send the follow-up right away
+        }
     }
+    ++tx_frames_;
+    tx_bits_ += can_frame_bits(regs.TIR & CAN_TI0R_IDE, regs.TIR & CAN_TI0R_RTR, regs.TDTR & CAN_TDT0R_DLC);
+    transmit_queued();
 }
 
 uint32_t ODriveCAN::available() {
-    return (HAL_CAN_GetRxFifoFillLevel(handle_, CAN_RX_FIFO0) + HAL_CAN_GetRxFifoFillLevel(handle_, CAN_RX_FIFO1));
+    return rx_queue_.depth();
 }
 
 bool ODriveCAN::read(can_Message_t &rxmsg) {
-    CAN_RxHeaderTypeDef header;
-    bool validRead = false;
-    if (HAL_CAN_GetRxFifoFillLevel(handle_, CAN_RX_FIFO0) > 0) {
-        HAL_CAN_GetRxMessage(handle_, CAN_RX_FIFO0, &header, rxmsg.buf);
-        validRead = true;
-    } else if (HAL_CAN_GetRxFifoFillLevel(handle_, CAN_RX_FIFO1) > 0) {
-        HAL_CAN_GetRxMessage(handle_, CAN_RX_FIFO1, &header, rxmsg.buf);
-        validRead = true;
-    }
-
-    rxmsg.isExt = header.IDE;
-    rxmsg.id = rxmsg.isExt ? header.ExtId : header.StdId;  // If it's an extended message, pass the extended ID
-    rxmsg.len = header.DLC;
-    rxmsg.rtr = header.RTR;
-
-    return validRead;
-}
-
-// Set one of only a few common baud rates.  CAN doesn't do arbitrary baud rates well due to the time-quanta issue.
-// 21 TQ allows for easy sampling at exactly 80% (recommended by Vector Informatik GmbH for high reliability systems)
-// Conveniently, the CAN peripheral's 42MHz clock lets us easily create 21TQs for all common baud rates
-void ODriveCAN::set_baud_rate(uint32_t baudRate) {
-    switch (baudRate) {
-        case CAN_BAUD_125K:
-            handle_->Init.Prescaler = 16;  // 21 TQ's
-            config_.baud_rate = baudRate;
-            reinit_can();
-            break;
+    const can_Message_t* msg = rx_queue_.peek();
+    if (!msg)
+        return false;
+    rxmsg = *msg;
+    rx_queue_.pop();
+    return true;
+}
 
-        case CAN_BAUD_250K:
-            handle_->Init.Prescaler = 8;  // 21 TQ's
-            config_.baud_rate = baudRate;
-            reinit_can();
+// @brief Moves all frames from the hardware FIFO into the RX queue.
+// Called from the RX interrupt, so the 3 frame deep hardware FIFO is emptied
+// as soon as a frame arrives, independent of the server thread.
+void ODriveCAN::receive_isr() {
+    // Reception time of the frame that raised the interrupt. It is only known
+    // if that frame is alone in the FIFO, otherwise the ISR was held up.
+    Timebase::Timestamp_t rx_time = odrv.timebase_.timestamp(DWT->CYCCNT);
+    bool rx_time_valid = HAL_CAN_GetRxFifoFillLevel(handle_, CAN_RX_FIFO0) == 1;
+    while (HAL_CAN_GetRxFifoFillLevel(handle_, CAN_RX_FIFO0) > 0) {
+        CAN_RxHeaderTypeDef header;
+        can_Message_t rxmsg;
+        if (HAL_CAN_GetRxMessage(handle_, CAN_RX_FIFO0, &header, rxmsg.buf) != HAL_OK)
             break;
+        rxmsg.isExt = header.IDE;
+        rxmsg.id = rxmsg.isExt ? header.ExtId : header.StdId;  // If it's an extended message, pass the extended ID
+        rxmsg.len = header.DLC;
+        rxmsg.rtr = header.RTR;
+        ++rx_frames_;
+        rx_bits_ += can_frame_bits(rxmsg.isExt, rxmsg.rtr, rxmsg.len);
+        if (config_.sync_msg_id && rxmsg.id == config_.sync_msg_id)
+            ++sync_seq_; // latched by the control loop, independent of the server thread's latency
+        bool is_time_msg = config_.time_msg_id && rxmsg.id == config_.time_msg_id && !rxmsg.rtr;
+        if (is_time_msg && !config_.time_master)
+            receive_time_msg(rxmsg, rx_time, rx_time_valid); // at the reception, not when the thread gets to it
+        rx_time_valid = false; // the next frames arrived while this one was handled
+        if (is_time_msg)
+            continue;
+        if (!rx_queue_.push(rxmsg))
+            ++rx_queue_overruns_;
+    }
+    osSemaphoreRelease(sem_can);
+}
 
-        case CAN_BAUD_500K:
-            handle_->Init.Prescaler = 4;  // 21 TQ's
-            config_.baud_rate = baudRate;
-            reinit_can();
-            break;
+// @brief Applies the setpoints buffered in sync mode and samples the encoder
+// feedback, once per sync message.
+// The board-level control loop calls begin_sync_tick() once per tick before
+// it runs the axes, so all axes of the board latch on the same control loop
+// tick, the first one that starts after the sync message arrived. Without the
+// board-level control loop the axes may latch one tick apart.
+void ODriveCAN::latch_sync(Axis& axis) {
+    if (axis.can_.sync_seq == tick_sync_seq_)
+        return;
+    axis.can_.sync_seq = tick_sync_seq_;
+    if (!axis.config_.can.sync_mode)
+        return;
 
-        case CAN_BAUD_1000K:
-            handle_->Init.Prescaler = 2;  // 21 TQ's
-            config_.baud_rate = baudRate;
-            reinit_can();
-            break;
+    uint32_t mask = cpu_enter_critical();
+    auto pending = axis.can_.pending;
+    axis.can_.pending = {};
+    cpu_exit_critical(mask);
 
-        default:
-            // baudRate is invalid, so don't accept it.
-            break;
+    Controller& controller = axis.controller_;
+    if (pending.torque_valid)
+        controller.input_torque_ = pending.input_torque;
+    if (pending.vel_valid)
+        controller.input_vel_ = pending.input_vel;
+    if (pending.pos_valid) {
+        controller.input_pos_ = pending.input_pos;
+        controller.input_pos_updated();
+    }
+
+    axis.can_.feedback_pos = (float)axis.encoder_.pos_estimate_turns_ + axis.encoder_.pos_estimate_in_turn_;
+    axis.can_.feedback_vel = axis.encoder_.vel_estimate_;
+    axis.can_.feedback_pending = true;
+}
+
+// @brief Sends the time message as time master: every time_sync_interval_ms
+// a sync frame, and once the TX interrupt took its transmission time, the
+// follow-up frame with that time. Called by the server thread.
+// Time message formats (little endian):
+//  - sync: uint8 seq (DLC 1)
+//  - follow-up: uint32 master time [us], uint16 [ns], uint8 seq of the sync (DLC 7)
+//  - single frame from a host: uint32 master time [us] when queued (DLC 4)
+void ODriveCAN::send_time_sync() {
+    if (!config_.time_master || !config_.time_msg_id)
+        return;
+    can_Message_t txmsg;
+    txmsg.id = config_.time_msg_id;
+    txmsg.isExt = config_.time_msg_id > 0x7ff;
+    if (time_followup_pending_) {
+        time_followup_pending_ = false;
+        txmsg.len = 7;
+        can_setSignal<uint32_t>(txmsg, time_tx_stamp_.us, 0, 32, true);
+        can_setSignal<uint16_t>(txmsg, (uint16_t)time_tx_stamp_.ns, 32, 16, true);
+        can_setSignal<uint8_t>(txmsg, time_tx_seq_, 48, 8, true);
+        write(txmsg, TX_PRIORITY_HIGH);
+    }
+    uint32_t now = HAL_GetTick();
+    if (now - time_tx_last_ >= config_.time_sync_interval_ms) {
+        time_tx_last_ = now;
+        txmsg.len = 1;
+        can_setSignal<uint8_t>(txmsg, ++time_tx_seq_, 0, 8, true);
+        write(txmsg, TX_PRIORITY_HIGH);
+    }
+}
+
+// @brief Takes a time message as time follower. Called from the RX ISR.
+// @param rx_time: board time at the reception
+// @param rx_time_valid: false if the frame waited in the FIFO, so that its
+// reception time is unknown
+void ODriveCAN::receive_time_msg(const can_Message_t& msg, Timebase::Timestamp_t rx_time, bool rx_time_valid) {
+    if (msg.len == 1) {
+        time_rx_seq_ = can_getSignal<uint8_t>(msg, 0, 8, true);
+        time_rx_stamp_ = rx_time;
+        time_rx_valid_ = rx_time_valid;
+    } else if (msg.len == 7) {
+        uint8_t seq = can_getSignal<uint8_t>(msg, 48, 8, true);
+        if (time_rx_valid_ && seq == time_rx_seq_) {
+            Timebase::Timestamp_t master = {can_getSignal<uint32_t>(msg, 0, 32, true),
+                                            std::min<uint32_t>(can_getSignal<uint16_t>(msg, 32, 16, true), 999)};
+            odrv.timebase_.capture(master, time_rx_stamp_);
+        }
+        time_rx_valid_ = false;
+    } else if (msg.len == 4) {
+        odrv.timebase_.capture({can_getSignal<uint32_t>(msg, 0, 32, true), 0}, rx_time);
     }
 }
 
+// @brief Sets the baud rate with the bit timing closest to the configured
+// sample point. The 42MHz CAN clock gives exact timings for all common baud
+// rates, the others are accepted within max_baud_rate_error, the actual rate
+// is reported in timing_. Invalid rates are rejected and change nothing.
+bool ODriveCAN::set_baud_rate(uint32_t baudRate) {
+    can_BitTiming_t timing;
+    if (!can_calcBitTiming(CAN_CLK_HZ, baudRate, config_.sample_point, max_baud_rate_error, &timing))
+        return false;
+
+    handle_->Init.Prescaler = timing.prescaler;
+    handle_->Init.TimeSeg1 = (timing.time_seg1 - 1) << CAN_BTR_TS1_Pos;
+    handle_->Init.TimeSeg2 = (timing.time_seg2 - 1) << CAN_BTR_TS2_Pos;
+    handle_->Init.SyncJumpWidth = (timing.sjw - 1) << CAN_BTR_SJW_Pos;
+    config_.baud_rate = baudRate;
+    timing_ = timing;
+    reinit_can();
+    return true;
+}
+
 void ODriveCAN::reinit_can() {
     HAL_CAN_Stop(handle_);
     HAL_CAN_Init(handle_);
     auto status = HAL_CAN_Start(handle_);
     if (status == HAL_OK)
-        status = HAL_CAN_ActivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY);
+        status = HAL_CAN_ActivateNotification(handle_, notifications);
+}
+
+// Programs one 32 bit ID/mask filter bank, see can_Filter_t
+void ODriveCAN::set_filter(uint32_t bank, bool enable, const can_Filter_t& bits) {
+    CAN_FilterTypeDef filter;
+    filter.FilterActivation = enable ? ENABLE : DISABLE;
+    filter.FilterBank = bank;
+    filter.FilterFIFOAssignment = CAN_RX_FIFO0;
+    filter.FilterIdHigh = bits.id >> 16;
+    filter.FilterIdLow = bits.id & 0xffff;
+    filter.FilterMaskIdHigh = bits.mask >> 16;
+    filter.FilterMaskIdLow = bits.mask & 0xffff;
+    filter.FilterMode = CAN_FILTERMODE_IDMASK;
+    filter.FilterScale = CAN_FILTERSCALE_32BIT;
+    filter.SlaveStartFilterBank = num_filter_banks;
+    HAL_CAN_ConfigFilter(handle_, &filter);
+}
+
+// @brief Lets only the frames of our node IDs, the encoder estimates of the
+// gearing masters on CAN, the sync and time messages and the fibre requests
+// through the hardware filters, so other traffic on the bus costs neither
+// FIFO space nor CPU time. Re-programs the filter banks if an ID changed since
+// the last call. CANSimple has no broadcast node ID, the sync and time
+// messages are the only frames shared by all nodes.
+// The software checks in CANSimple::handle_can_message stay, the filters
+// only pre-select.
+void ODriveCAN::update_filters() {
+    FilterIds_t ids = {};
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        ids.node_id[i] = axes[i].config_.can.node_id;
+        ids.is_extended[i] = axes[i].config_.can.is_extended;
+        const Controller::Config_t& controller_config = axes[i].controller_.config_;
+        ids.gear_master_can[i] = controller_config.gear_master_source == Controller::GEAR_MASTER_SOURCE_CAN;
+        ids.gear_master_node_id[i] = ids.gear_master_can[i] ? controller_config.gear_master_can_node_id : 0;
+    }
+    ids.sync_msg_id = config_.sync_msg_id;
+    ids.time_msg_id = config_.time_msg_id;
+    ids.protocol = config_.protocol;
+    ids.enable_fibre = config_.enable_fibre;
+    ids.fibre_node_id = config_.fibre_node_id;
+    ids.enable_firmware_update = config_.enable_firmware_update;
+
+    bool changed = !filters_valid_ || ids.sync_msg_id != filter_ids_.sync_msg_id || ids.time_msg_id != filter_ids_.time_msg_id
+            || ids.protocol != filter_ids_.protocol
+            || ids.enable_fibre != filter_ids_.enable_fibre || ids.fibre_node_id != filter_ids_.fibre_node_id
+            || ids.enable_firmware_update != filter_ids_.enable_firmware_update;
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        changed = changed || ids.node_id[i] != filter_ids_.node_id[i] || ids.is_extended[i] != filter_ids_.is_extended[i]
+                || ids.gear_master_can[i] != filter_ids_.gear_master_can[i] || ids.gear_master_node_id[i] != filter_ids_.gear_master_node_id[i];
+    if (!changed)
+        return;
+
+    constexpr uint32_t max_std_node_id = (1u << CANSimple::NUM_NODE_ID_BITS) - 1;
+    constexpr uint32_t max_ext_node_id = (1u << (29 - CANSimple::NUM_CMD_ID_BITS)) - 1;
+    uint32_t bank = 0;
+
+    if (ids.protocol == PROTOCOL_CANOPEN) {
+        // CANopen COB-IDs are a 4 bit function code and the 7 bit node ID.
+        // Node ID 0 matches the broadcast objects NMT and SYNC.
+        set_filter(bank++, true, can_idFilter(0, false, 0x7f));
+        for (size_t i = 0; i < AXIS_COUNT; ++i) {
+            if (ids.node_id[i] >= 1 && ids.node_id[i] <= 0x7f)
+                set_filter(bank++, true, can_idFilter(ids.node_id[i], false, 0x7f));
+        }
+    }
+
+    for (size_t i = 0; i < AXIS_COUNT && ids.protocol == PROTOCOL_SIMPLE; ++i) {
+        uint32_t max_node_id = ids.is_extended[i] ? max_ext_node_id : max_std_node_id;
+        // Match all command IDs of the node
+        if (ids.node_id[i] <= max_node_id)
+            set_filter(bank++, true, can_nodeFilter(ids.node_id[i], CANSimple::NUM_CMD_ID_BITS, ids.is_extended[i]));
+        // The encoder estimates of the gearing master only, in the frame
+        // format of this axis like CANSimple::handle_can_message expects it
+        if (ids.gear_master_can[i] && ids.gear_master_node_id[i] <= max_node_id) {
+            uint32_t id = (ids.gear_master_node_id[i] << CANSimple::NUM_CMD_ID_BITS) | CANSimple::MSG_GET_ENCODER_ESTIMATES;
+            set_filter(bank++, true, can_idFilter(id, ids.is_extended[i]));
+        }
+    }
+
+    // The sync and time messages are matched on the ID alone, as standard and
+    // extended frame
+    for (uint32_t id : {ids.sync_msg_id, ids.time_msg_id}) {
+        if (!id || ids.protocol != PROTOCOL_SIMPLE)
+            continue;
+        if (id <= 0x7ff)
+            set_filter(bank++, true, can_idFilter(id, false));
+        if (id <= 0x1fffffff)
+            set_filter(bank++, true, can_idFilter(id, true));
+    }
+
+    // Fibre requests, independent of the protocol
+    if (ids.enable_fibre && ids.fibre_node_id <= CANFibre::max_node_id)
+        set_filter(bank++, true, can_idFilter(CANFibre::request_id(ids.fibre_node_id), true));
+
+    // Firmware update commands and data, of this node and multicast
+    if (ids.enable_firmware_update && ids.fibre_node_id <= CANFibre::max_node_id) {
+        set_filter(bank++, true, can_idFilter(CANUpdate::command_id(ids.fibre_node_id), true, 0x1ffffffe));
+        set_filter(bank++, true, can_idFilter(CANUpdate::multicast_command_id, true, 0x1ffffffe));
+    }
+
+    for (uint32_t i = bank; i < num_filters_; ++i)
+        set_filter(i, false, {0, 0});
+
+    num_filters_ = bank;
+    filter_ids_ = ids;
+    filters_valid_ = true;
+}
+
+// Hardware recovery only if it should happen without delay
+FunctionalState ODriveCAN::get_auto_bus_off() {
+    return (config_.auto_bus_off_recovery && !config_.bus_off_recovery_delay_ms) ? ENABLE : DISABLE;
+}
+
+// @brief Samples the error counters, handles bus-off and computes the bus
+// load once per load_window_ms. Called by the server thread.
+// With a recovery delay the controller stays off the bus for that long
+// before it is restarted, so a node on a broken bus doesn't disturb the
+// others with error frames all the time. Without automatic recovery the
+// controller stays off until the configuration or the baud rate is changed
+// or the ODrive reboots.
+void ODriveCAN::update_stats() {
+    uint32_t now = HAL_GetTick();
+    uint32_t esr = handle_->Instance->ESR;
+    tx_error_count_ = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+    rx_error_count_ = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+
+    if (handle_->Init.AutoBusOff != get_auto_bus_off()) {
+        handle_->Init.AutoBusOff = get_auto_bus_off();
+        reinit_can();
+    }
+
+    bool bus_off = esr & CAN_ESR_BOFF;
+    if (bus_off && !bus_off_) {
+        ++bus_off_count_;
+        bus_off_since_ = now;
+        odrv.event_trace_.record(EventTrace::EVENT_TYPE_CAN_BUS_OFF, EventTrace::source_board, 0, esr);
+    }
+    bus_off_ = bus_off;
+    if (bus_off && config_.auto_bus_off_recovery && config_.bus_off_recovery_delay_ms
+            && now - bus_off_since_ >= config_.bus_off_recovery_delay_ms) {
+        bus_off_since_ = now;
+        reinit_can(); // rejoins after 128 x 11 recessive bits
+    }
+
+    uint32_t window = now - load_window_start_;
+    if (window >= load_window_ms) {
+        uint32_t mask = cpu_enter_critical();
+        uint32_t rx_bits = rx_bits_;
+        uint32_t tx_bits = tx_bits_;
+        rx_bits_ = 0;
+        tx_bits_ = 0;
+        cpu_exit_critical(mask);
+
+        float window_bits = (float)config_.baud_rate * (float)window * 0.001f;
+        rx_load_ = (float)rx_bits / window_bits;
+        tx_load_ = (float)tx_bits / window_bits;
+        load_window_start_ = now;
+    }
 }
 
 void ODriveCAN::set_error(Error error) {
@@ -184,35 +514,41 @@ void ODriveCAN::send_cyclic(Axis &axis) {
         case PROTOCOL_SIMPLE:
             CANSimple::send_cyclic(axis);
             break;
+        case PROTOCOL_CANOPEN:
+            CANopen::send_cyclic(axis);
+            break;
     }
 }
 
-void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
-    osSemaphoreRelease(sem_can);
-}
-void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
-    osSemaphoreRelease(sem_can);
+// A TX mailbox became free
+static void can_tx_mailbox_empty() {
+    if (odCAN)
+        odCAN->transmit_queued();
 }
-void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
-    osSemaphoreRelease(sem_can);
+
+static void can_tx_complete(uint32_t mailbox) {
+    if (odCAN)
+        odCAN->tx_complete(mailbox);
 }
-void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan) {}
-void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan) {}
-void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan) {}
+
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan) { can_tx_complete(0); }
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan) { can_tx_complete(1); }
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan) { can_tx_complete(2); }
+void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan) { can_tx_mailbox_empty(); }
+void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan) { can_tx_mailbox_empty(); }
+void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan) { can_tx_mailbox_empty(); }
 void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_RX_FIFO0_MSG_PENDING);
-    osSemaphoreRelease(sem_can);
-}
-void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan) {
-    // osSemaphoreRelease(sem_can);
+    if (odCAN)
+        odCAN->receive_isr();
 }
+void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_RxFifo1FullCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_SleepCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_WakeUpFromRxMsgCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan) {
+    if (odCAN && (HAL_CAN_GetError(hcan) & HAL_CAN_ERROR_FOV0))
+        ++odCAN->rx_fifo_overruns_;
     HAL_CAN_ResetError(hcan);
+    can_tx_mailbox_empty(); // also called for failed transmissions
 }
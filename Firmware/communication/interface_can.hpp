@@ -5,6 +5,7 @@
 #include "fibre/protocol.hpp"
 #include "odrive_main.h"
 #include "can_helpers.hpp"
+#include <spsc_queue.hpp>
 
 #define CAN_CLK_HZ (42000000)
 #define CAN_CLK_MHZ (42)
@@ -20,37 +21,133 @@ enum {
 
 class ODriveCAN : public ODriveIntf::CanIntf {
    public:
+    static constexpr uint32_t rx_queue_size = 128; // [frames], about 6ms of a fully loaded 1Mbit/s bus
+    static constexpr uint32_t tx_queue_size = 16; // [frames] per priority
+    static constexpr uint32_t notifications = CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO0_OVERRUN | CAN_IT_TX_MAILBOX_EMPTY;
+    static constexpr uint32_t num_filter_banks = 14; // CAN1 gets banks 0..13, CAN2 the rest
+    static constexpr uint32_t load_window_ms = 1000;
+    static constexpr float max_baud_rate_error = 0.01f; // CAN tolerates about 1% with 8 or more tq per bit
+
+    // The queue of a higher priority is always emptied first
+    enum TxPriority {
+        TX_PRIORITY_HIGH, // heartbeat
+        TX_PRIORITY_LOW,  // responses and cyclic feedback
+        TX_PRIORITY_BULK, // fibre over CAN
+        num_tx_priorities
+    };
+
     struct Config_t {
         uint32_t baud_rate = CAN_BAUD_250K;
+        float sample_point = 0.8f; // used by set_baud_rate()
         Protocol protocol = PROTOCOL_SIMPLE;
+        uint32_t sync_msg_id = 0; // starts the staged moves of all axes, 0 to disable
+        uint32_t time_msg_id = 0; // synchronizes odrv.timebase_ to the master, 0 to disable
+        bool time_master = false; // send the time message instead of following it
+        uint32_t time_sync_interval_ms = 100;
+        bool enable_fibre = true;
+        uint32_t fibre_node_id = 0; // 0..CANFibre::max_node_id
+        bool enable_firmware_update = false; // see CANUpdate, uses fibre_node_id
+        bool auto_bus_off_recovery = true;
+        uint32_t bus_off_recovery_delay_ms = 0; // 0: the hardware rejoins after 128 x 11 recessive bits
     };
 
     ODriveCAN(ODriveCAN::Config_t &config, CAN_HandleTypeDef *handle);
 
     // Thread Relevant Data
-    osThreadId thread_id_;
-    const uint32_t stack_size_ = 1024; // Bytes
+    osThreadId thread_id_ = nullptr; // stays null when the merged comms thread polls CAN
+    static constexpr uint32_t stack_size_ = 2048; // Bytes, fibre over CAN runs the endpoint handlers on this thread
     Error error_ = ERROR_NONE;
 
     volatile bool thread_id_valid_ = false;
-    bool start_can_server();
+    bool init_can_server();
+    bool start_can_server(osPriority priority);
+    uint32_t server_poll();
     void can_server_thread();
     void send_cyclic(Axis& axis);
     void reinit_can();
+    void update_filters();
 
     void set_error(Error error);
 
     // I/O Functions
     uint32_t available();
-    int32_t write(can_Message_t &txmsg);
+    int32_t write(can_Message_t &txmsg, TxPriority priority = TX_PRIORITY_LOW);
     bool read(can_Message_t &rxmsg);
+    void receive_isr();
+    void transmit_queued();
+    void tx_complete(uint32_t mailbox);
+    uint32_t tx_queue_space(TxPriority priority);
+
+    // Sync mode
+    void begin_sync_tick() { tick_sync_seq_ = sync_seq_; }
+    void latch_sync(Axis& axis);
+
+    // Time synchronization
+    void send_time_sync();
+    void receive_time_msg(const can_Message_t& msg, Timebase::Timestamp_t rx_time, bool rx_time_valid);
+
+    uint32_t rx_queue_overruns_ = 0; // frames dropped because the thread didn't keep up
+    uint32_t rx_fifo_overruns_ = 0;  // frames dropped by the hardware before the ISR ran
+    uint32_t tx_queue_drops_ = 0;    // frames not sent because the TX queue of their priority was full
+    volatile uint32_t sync_seq_ = 0; // number of sync messages received, counted in the RX ISR
+
+    // Bus statistics
+    uint32_t tx_error_count_ = 0;  // TEC
+    uint32_t rx_error_count_ = 0;  // REC
+    uint32_t bus_off_count_ = 0;
+    uint32_t rx_frames_ = 0;       // frames that passed the filters
+    uint32_t tx_frames_ = 0;
+    float rx_load_ = 0.0f;         // fraction of the bus time over the last load_window_ms
+    float tx_load_ = 0.0f;
+    can_BitTiming_t timing_ = {}; // actual timing set by set_baud_rate()
 
     ODriveCAN::Config_t &config_;
 
 private:
     CAN_HandleTypeDef *handle_ = nullptr;
+    SpscQueue<can_Message_t, rx_queue_size> rx_queue_; // producer: RX ISR, consumer: server thread
+    // Written by several threads and read by the TX ISR, so only accessed in
+    // critical sections
+    SpscQueue<can_Message_t, tx_queue_size> tx_queues_[num_tx_priorities];
+    bool bus_off_ = false; // last state seen by the server thread, to trace bus-off once
+    uint32_t tick_sync_seq_ = 0; // sync_seq_ at the start of the current control loop tick
+
+    // Time master: the sync frame and its transmission time for the follow-up
+    uint8_t time_tx_seq_ = 0;
+    uint32_t time_tx_last_ = 0; // [ms]
+    Timebase::Timestamp_t time_tx_stamp_ = {};
+    volatile bool time_followup_pending_ = false; // set by the TX ISR
+    // Time follower: the reception time of the last sync frame
+    uint8_t time_rx_seq_ = 0;
+    Timebase::Timestamp_t time_rx_stamp_ = {};
+    bool time_rx_valid_ = false;
+    uint32_t bus_off_since_ = 0; // [ms] when the bus-off state was entered or recovery last attempted
+    uint32_t load_window_start_ = 0; // [ms]
+    volatile uint32_t rx_bits_ = 0; // counted in the ISRs since load_window_start_
+    volatile uint32_t tx_bits_ = 0;
+
+    // IDs the filter banks were last programmed for, to re-program on change
+    struct FilterIds_t {
+        uint32_t node_id[AXIS_COUNT];
+        bool is_extended[AXIS_COUNT];
+        bool gear_master_can[AXIS_COUNT]; // GEAR_MASTER_SOURCE_CAN
+        uint32_t gear_master_node_id[AXIS_COUNT];
+        uint32_t sync_msg_id;
+        uint32_t time_msg_id;
+        Protocol protocol;
+        bool enable_fibre;
+        uint32_t fibre_node_id;
+        bool enable_firmware_update;
+    };
+    FilterIds_t filter_ids_ = {};
+    bool filters_valid_ = false;
+    uint32_t num_filters_ = 0;
+
+    void set_filter(uint32_t bank, bool enable, const can_Filter_t& bits);
+    void update_stats();
+    FunctionalState get_auto_bus_off();
 
-    void set_baud_rate(uint32_t baudRate);
+    bool set_baud_rate(uint32_t baudRate);
 };
 
 #endif  // __INTERFACE_CAN_HPP
@@ -8,11 +8,24 @@
 #define I2C_RX_BUFFER_PREAMBLE_SIZE   4
 #define I2C_TX_BUFFER_SIZE 128
 
+// Register map mode: writing the endpoint IDs to I2C_REGISTER_MAP_ADDRESS
+//     [0xFE 0x7F] [endpoint ID 0] ... [endpoint ID N-1] [json CRC]
+// makes every following read return a fresh snapshot of all of their values,
+// concatenated in their native sizes, until another register is written.
+// Writing the address without endpoint IDs reselects the last map. The map
+// is not saved, the master sets it up after a reboot.
+#define I2C_REGISTER_MAP_ADDRESS 0x7ffe
+#define I2C_REGISTER_MAP_MAX_ENTRIES 16
+
 I2CStats_t i2c_stats_;
 
 static uint8_t i2c_rx_buffer[I2C_RX_BUFFER_PREAMBLE_SIZE + I2C_RX_BUFFER_SIZE];
 static uint8_t i2c_tx_buffer[I2C_TX_BUFFER_SIZE];
 
+static uint16_t register_map[I2C_REGISTER_MAP_MAX_ENTRIES];
+static size_t register_map_length = 0;
+static bool register_map_selected = false;
+
 class I2CSender : public PacketSink {
 public:
     int process_packet(const uint8_t* buffer, size_t length) {
@@ -24,6 +37,67 @@ public:
 } i2c1_packet_output;
 BidirectionalPacketBasedChannel i2c1_channel(i2c1_packet_output);
 
+static uint16_t read_u16(const uint8_t* buffer) {
+    return buffer[0] | (buffer[1] << 8);
+}
+
+// @brief Handles a write to the register map address, returns false if the
+// request is malformed
+static bool set_register_map(const uint8_t* buffer, size_t length) {
+    if (length < 4 || (length % 2) || read_u16(buffer + length - 2) != fibre::json_crc_)
+        return false;
+    size_t n_entries = (length - 4) / 2;
+    if (n_entries > I2C_REGISTER_MAP_MAX_ENTRIES)
+        return false;
+    if (n_entries) {
+        for (size_t i = 0; i < n_entries; ++i)
+            register_map[i] = read_u16(buffer + 2 + 2 * i);
+        register_map_length = n_entries;
+    }
+    register_map_selected = true;
+    return true;
+}
+
+// @brief Reads the mapped endpoints into the TX buffer
+static void fill_register_map() {
+    fibre::bufptr_t output{i2c_tx_buffer, sizeof(i2c_tx_buffer)};
+    for (size_t i = 0; i < register_map_length; ++i) {
+        fibre::cbufptr_t input{i2c_tx_buffer, (size_t)0};
+        if (!register_map[i] || register_map[i] >= I2C_REGISTER_MAP_ADDRESS
+                || !fibre::endpoint_handler(register_map[i], &input, &output))
+            break;
+    }
+    memset(output.begin(), 0, output.size());
+}
+
+// @brief Sends the TX buffer by DMA instead of one interrupt per byte. To
+// the HAL this looks like a sequential transmit that already completed, so
+// its listen state machine ends the transfer on the master's NACK as usual.
+static void start_tx_dma(I2C_HandleTypeDef *hi2c) {
+    if (hi2c->hdmatx->State != HAL_DMA_STATE_READY)
+        HAL_DMA_Abort(hi2c->hdmatx);
+    hi2c->hdmatx->XferCpltCallback = nullptr;
+    hi2c->hdmatx->XferHalfCpltCallback = nullptr;
+    hi2c->hdmatx->XferErrorCallback = nullptr;
+    if (HAL_DMA_Start_IT(hi2c->hdmatx, (uint32_t)i2c_tx_buffer, (uint32_t)&hi2c->Instance->DR, sizeof(i2c_tx_buffer)) != HAL_OK)
+        return;
+
+    hi2c->Mode = HAL_I2C_MODE_SLAVE;
+    hi2c->State = HAL_I2C_STATE_LISTEN;
+    hi2c->PreviousState = I2C_STATE_SLAVE_BUSY_TX;
+    hi2c->XferOptions = I2C_FIRST_AND_LAST_FRAME;
+    hi2c->XferCount = 0;
+    __HAL_I2C_DISABLE_IT(hi2c, I2C_IT_BUF);
+    hi2c->Instance->CR2 |= I2C_CR2_DMAEN;
+}
+
+static void stop_tx_dma(I2C_HandleTypeDef *hi2c) {
+    if (hi2c->Instance->CR2 & I2C_CR2_DMAEN) {
+        hi2c->Instance->CR2 &= ~I2C_CR2_DMAEN;
+        HAL_DMA_Abort(hi2c->hdmatx);
+    }
+}
+
 void start_i2c_server() {
     // CAN H = SDA
     // CAN L = SCL
@@ -34,14 +108,23 @@ void i2c_handle_packet(I2C_HandleTypeDef *hi2c) {
     size_t received = sizeof(i2c_rx_buffer) - hi2c->XferCount;
     if (received > I2C_RX_BUFFER_PREAMBLE_SIZE) {
         i2c_stats_.rx_cnt++;
-        
-        write_le<uint16_t>(0, i2c_rx_buffer); // hallucinate seq-no (not needed for I2C)
-        i2c_rx_buffer[2] = i2c_rx_buffer[4]; // endpoint-id = I2C register address
-        i2c_rx_buffer[3] = i2c_rx_buffer[5] | 0x80; // MSB must be 1
-        size_t expected_bytes = (TX_BUF_SIZE - 2) < I2C_TX_BUFFER_SIZE ? (TX_BUF_SIZE - 2) : I2C_TX_BUFFER_SIZE;
-        write_le<uint16_t>(expected_bytes, i2c_rx_buffer + 4); // hallucinate maximum number of expected response bytes
 
-        i2c1_channel.process_packet(i2c_rx_buffer, received);
+        const uint8_t* request = i2c_rx_buffer + I2C_RX_BUFFER_PREAMBLE_SIZE;
+        size_t request_length = received - I2C_RX_BUFFER_PREAMBLE_SIZE;
+        if (request_length >= 2 && read_u16(request) == I2C_REGISTER_MAP_ADDRESS) {
+            if (!set_register_map(request, request_length))
+                i2c_stats_.error_cnt++;
+        } else {
+            register_map_selected = false;
+
+            write_le<uint16_t>(0, i2c_rx_buffer); // hallucinate seq-no (not needed for I2C)
+            i2c_rx_buffer[2] = i2c_rx_buffer[4]; // endpoint-id = I2C register address
+            i2c_rx_buffer[3] = i2c_rx_buffer[5] | 0x80; // MSB must be 1
+            size_t expected_bytes = (TX_BUF_SIZE - 2) < I2C_TX_BUFFER_SIZE ? (TX_BUF_SIZE - 2) : I2C_TX_BUFFER_SIZE;
+            write_le<uint16_t>(expected_bytes, i2c_rx_buffer + 4); // hallucinate maximum number of expected response bytes
+
+            i2c1_channel.process_packet(i2c_rx_buffer, received);
+        }
 
         // reset receive buffer
         hi2c->pBuffPtr = I2C_RX_BUFFER_PREAMBLE_SIZE + i2c_rx_buffer;
@@ -55,6 +138,7 @@ void i2c_handle_packet(I2C_HandleTypeDef *hi2c) {
 
 
 void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c) {
+    stop_tx_dma(hi2c);
     i2c_handle_packet(hi2c);
     // restart listening for address
     HAL_I2C_EnableListen_IT(hi2c);
@@ -69,6 +153,9 @@ void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, ui
         HAL_I2C_Slave_Sequential_Receive_IT(hi2c,
             I2C_RX_BUFFER_PREAMBLE_SIZE + i2c_rx_buffer,
             sizeof(i2c_rx_buffer) - I2C_RX_BUFFER_PREAMBLE_SIZE, I2C_FIRST_AND_LAST_FRAME);
+    } else if (register_map_selected) {
+        fill_register_map();
+        start_tx_dma(hi2c);
     } else {
         HAL_I2C_Slave_Sequential_Transmit_IT(hi2c, i2c_tx_buffer, sizeof(i2c_tx_buffer), I2C_FIRST_AND_LAST_FRAME);
     }
@@ -80,6 +167,7 @@ void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
         return;
 
     i2c_stats_.error_cnt += 1;
+    stop_tx_dma(hi2c);
 
     // Continue listening
     HAL_I2C_EnableListen_IT(hi2c);
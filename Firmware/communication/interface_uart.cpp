@@ -2,42 +2,66 @@
 #include "interface_uart.h"
 
 #include "ascii_protocol.hpp"
+#include "binary_protocol.hpp"
+#include "uart_bus.hpp"
 
 #include <MotorControl/utils.hpp>
+#include <Drivers/STM32/stm32_system.h>
 
 #include <fibre/protocol.hpp>
 #include <usart.h>
 #include <cmsis_os.h>
 #include <freertos_vars.h>
 
-#define UART_TX_BUFFER_SIZE 64
-#define UART_RX_BUFFER_SIZE 64
+#include <odrive_main.h>
 
-// DMA open loop continous circular buffer
-// 1ms delay periodic, chase DMA ptr around
+#include <algorithm>
+
+#define UART_TX_BUFFER_SIZE ((size_t)512)
+#define UART_RX_BUFFER_SIZE 256
+
+// DMA open loop continous circular buffer. The thread is woken up by the
+// idle line interrupt at the end of each burst and by the half and full
+// transfer interrupts during long bursts, and then chases the DMA pointer.
 static uint8_t dma_rx_buffer[UART_RX_BUFFER_SIZE];
 static uint32_t dma_last_rcv_idx;
 
 osThreadId uart_thread = 0;
+static bool uart_server_active = false; // the thread or the merged comms thread polls the UART
+static constexpr int32_t UART_SIGNAL_RX = 1;
+static constexpr uint32_t UART_RX_CHECK_INTERVAL_MS = 10; // restarts the DMA after errors
 extern UART_HandleTypeDef* uart0;
 static UART_HandleTypeDef* huart_ = uart0; // defined in board.cpp.
 const uint32_t stack_size_uart_thread = 4096;  // Bytes
+CCM_RAM static StackType_t uart_thread_stack[stack_size_uart_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t uart_thread_tcb;
 
 
+// TX ring buffer, the DMA transfers chain from the TX complete interrupt.
+// On a half-duplex bus the driver enable GPIO is set while bytes are sent.
 class UARTSender : public StreamSink {
 public:
     int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) {
+        if (de_gpio_ && !de_active_)
+            delay_us(odrv.config_.uart0_turnaround_us); // the master switches its transceiver to RX
+
         // Loop to ensure all bytes get sent
         while (length) {
-            size_t chunk = length < UART_TX_BUFFER_SIZE ? length : UART_TX_BUFFER_SIZE;
-            // wait for USB interface to become ready
-            // TODO: implement ring buffer to get a more continuous stream of data
-            if (osSemaphoreWait(sem_uart_dma, PROTOCOL_SERVER_TIMEOUT_MS) != osOK)
-                return -1;
-            // transmit chunk
-            memcpy(tx_buf_, buffer, chunk);
-            if (HAL_UART_Transmit_DMA(huart_, tx_buf_, chunk) != HAL_OK)
-                return -1;
+            size_t free = get_ring_space();
+            if (!free) {
+                // wait for the DMA to make room in the ring buffer
+                if (osSemaphoreWait(sem_uart_dma, PROTOCOL_SERVER_TIMEOUT_MS) != osOK)
+                    return -1;
+                continue;
+            }
+
+            // copy up to the end of the buffer, the rest goes in the next iteration
+            size_t chunk = std::min({length, free, UART_TX_BUFFER_SIZE - head_});
+            memcpy(tx_buf_ + head_, buffer, chunk);
+            CRITICAL_SECTION() {
+                head_ = (head_ + chunk) % UART_TX_BUFFER_SIZE;
+                start_dma();
+            }
             buffer += chunk;
             length -= chunk;
             if (processed_bytes)
@@ -47,74 +71,234 @@ public:
     }
 
     size_t get_free_space() { return SIZE_MAX; }
+
+    void set_de_gpio(Stm32Gpio gpio) { de_gpio_ = gpio; }
+
+    // Called from the TX complete interrupt, which comes after the stop bit
+    // of the last byte
+    void tx_complete() {
+        tail_ = (tail_ + dma_length_) % UART_TX_BUFFER_SIZE;
+        dma_length_ = 0;
+        start_dma();
+        if (!dma_length_ && de_active_) {
+            de_gpio_.write(false);
+            de_active_ = false;
+        }
+        osSemaphoreRelease(sem_uart_dma);
+    }
+
 private:
+    // one byte stays free to tell a full buffer from an empty one
+    size_t get_ring_space() {
+        return (tail_ + UART_TX_BUFFER_SIZE - head_ - 1) % UART_TX_BUFFER_SIZE;
+    }
+
+    // Starts the DMA for the bytes up to the head or the end of the buffer if
+    // it is idle. Must be called with interrupts disabled.
+    void start_dma() {
+        if (dma_length_ || head_ == tail_)
+            return;
+        size_t length = (head_ > tail_ ? head_ : UART_TX_BUFFER_SIZE) - tail_;
+        if (de_gpio_ && !de_active_) {
+            de_gpio_.write(true);
+            de_active_ = true;
+        }
+        if (HAL_UART_Transmit_DMA(huart_, tx_buf_ + tail_, length) == HAL_OK)
+            dma_length_ = length;
+    }
+
     uint8_t tx_buf_[UART_TX_BUFFER_SIZE];
+    volatile size_t head_ = 0; // written by process_bytes()
+    volatile size_t tail_ = 0; // start of the bytes not yet sent
+    volatile size_t dma_length_ = 0; // bytes from tail_ in the running DMA transfer
+    Stm32Gpio de_gpio_; // none unless on a half-duplex bus
+    volatile bool de_active_ = false;
 } uart_stream_output;
 StreamSink* uart_stream_output_ptr = &uart_stream_output;
 
-StreamBasedPacketSink uart_packet_output(uart_stream_output);
-BidirectionalPacketBasedChannel uart_channel(uart_packet_output);
+// Addressed mode, see uart_bus.hpp. The protocol parsers respond into the
+// responders, which send the response after the received bytes were processed.
+static void uart_bus_dispatch_envelope(const uint8_t* buffer, size_t length);
+static void uart_bus_dispatch_ascii(const uint8_t* buffer, size_t length);
+
+template<void(*dispatch)(const uint8_t*, size_t)>
+class UartBusParserSink : public StreamSink {
+public:
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        dispatch(buffer, length);
+        if (processed_bytes)
+            *processed_bytes += length;
+        return 0;
+    }
+    size_t get_free_space() override { return SIZE_MAX; }
+};
+
+static UartBusParserSink<uart_bus_dispatch_envelope> uart_bus_envelope_parser;
+static UartBusParserSink<uart_bus_dispatch_ascii> uart_bus_ascii_parser;
+static UartBusFilter uart_bus_envelope_filter(UART_BUS_FRAMING_ENVELOPE, uart_bus_envelope_parser);
+static UartBusFilter uart_bus_ascii_filter(UART_BUS_FRAMING_ASCII, uart_bus_ascii_parser);
+static UartBusResponder uart_bus_envelope_responder(UART_BUS_FRAMING_ENVELOPE, uart_bus_envelope_filter, uart_stream_output);
+static UartBusResponder uart_bus_ascii_responder(UART_BUS_FRAMING_ASCII, uart_bus_ascii_filter, uart_stream_output);
+
+// The fibre responses go into an envelope in addressed mode
+class UartFibreOutput : public StreamSink {
+public:
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        if (odrv.config_.uart0_node_id)
+            return uart_bus_envelope_responder.process_bytes(buffer, length, processed_bytes);
+        return uart_stream_output.process_bytes(buffer, length, processed_bytes);
+    }
+    size_t get_free_space() override { return SIZE_MAX; }
+} uart_fibre_output;
+
+StreamBasedPacketSink uart_packet_output(uart_fibre_output);
+// Each stream packet is taken as a datagram, so a network bridge on the UART
+// can forward batched UDP datagrams as they are
+DatagramChannel uart_channel(uart_packet_output);
 StreamToPacketSegmenter uart_stream_input(uart_channel);
 
+static void uart_bus_dispatch_envelope(const uint8_t* buffer, size_t length) {
+    if (odrv.config_.uart0_protocol == ODriveIntf::STREAM_PROTOCOL_BINARY)
+        binary_protocol_parse_stream(buffer, length, uart_bus_envelope_responder);
+    else
+        uart_stream_input.process_bytes(buffer, length, nullptr);
+}
+
+static void uart_bus_dispatch_ascii(const uint8_t* buffer, size_t length) {
+    ASCII_protocol_parse_stream(buffer, length, uart_bus_ascii_responder);
+}
+
+// @brief Passes received bytes to the protocols selected by odrv.config.uart0_protocol
+static void uart_process_bytes(const uint8_t* buffer, size_t length) {
+    ODriveIntf::StreamProtocol protocol = odrv.config_.uart0_protocol;
+    if (uint8_t node_id = odrv.config_.uart0_node_id) {
+        uart_bus_envelope_filter.set_node_id(node_id);
+        uart_bus_ascii_filter.set_node_id(node_id);
+        uart_bus_envelope_responder.set_node_id(node_id);
+        uart_bus_ascii_responder.set_node_id(node_id);
+        if (protocol != ODriveIntf::STREAM_PROTOCOL_ASCII)
+            uart_bus_envelope_filter.process_bytes(buffer, length, nullptr);
+        if (protocol == ODriveIntf::STREAM_PROTOCOL_ASCII || protocol == ODriveIntf::STREAM_PROTOCOL_ASCII_AND_FIBRE)
+            uart_bus_ascii_filter.process_bytes(buffer, length, nullptr);
+        uart_bus_envelope_responder.flush();
+        uart_bus_ascii_responder.flush();
+        return;
+    }
+    if (protocol == ODriveIntf::STREAM_PROTOCOL_FIBRE || protocol == ODriveIntf::STREAM_PROTOCOL_ASCII_AND_FIBRE)
+        uart_stream_input.process_bytes(buffer, length, nullptr); // TODO: use process_all
+    if (protocol == ODriveIntf::STREAM_PROTOCOL_ASCII || protocol == ODriveIntf::STREAM_PROTOCOL_ASCII_AND_FIBRE)
+        ASCII_protocol_parse_stream(buffer, length, uart_stream_output);
+    if (protocol == ODriveIntf::STREAM_PROTOCOL_BINARY)
+        binary_protocol_parse_stream(buffer, length, uart_stream_output);
+}
+
+// @brief Sends the streamed feedback and processes the bytes that came in
+// since the last call. Runs on the UART thread or on the merged comms thread.
+// @returns [ms] until the next call is needed at the latest
+uint32_t uart_server_poll() {
+    uint32_t feedback_wait; // [ms] until the next streamed feedback line
+
+    // Nodes on a bus only speak when polled, so there is no streaming
+    ODriveIntf::StreamProtocol protocol = odrv.config_.uart0_protocol;
+    if ((protocol == ODriveIntf::STREAM_PROTOCOL_ASCII || protocol == ODriveIntf::STREAM_PROTOCOL_ASCII_AND_FIBRE)
+            && !odrv.config_.uart0_node_id)
+        feedback_wait = ASCII_protocol_stream_feedback(uart_stream_output);
+    else
+        feedback_wait = UINT32_MAX;
+    uint32_t wait = std::min(UART_RX_CHECK_INTERVAL_MS, feedback_wait);
+
+    // Check for UART errors and restart receive DMA transfer if required
+    if (huart_->RxState != HAL_UART_STATE_BUSY_RX) {
+        HAL_UART_AbortReceive(huart_);
+        HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
+        dma_last_rcv_idx = 0;
+    }
+    // Fetch the circular buffer "write pointer", where it would write next
+    uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart_->hdmarx->Instance->NDTR;
+    if (new_rcv_idx > UART_RX_BUFFER_SIZE) { // defensive programming
+        return wait;
+    }
+
+    // Process bytes in one or two chunks (two in case there was a wrap)
+    if (new_rcv_idx < dma_last_rcv_idx) {
+        uart_process_bytes(dma_rx_buffer + dma_last_rcv_idx,
+                UART_RX_BUFFER_SIZE - dma_last_rcv_idx);
+        dma_last_rcv_idx = 0;
+    }
+    if (new_rcv_idx > dma_last_rcv_idx) {
+        uart_process_bytes(dma_rx_buffer + dma_last_rcv_idx,
+                new_rcv_idx - dma_last_rcv_idx);
+        dma_last_rcv_idx = new_rcv_idx;
+    }
+    return wait;
+}
+
 static void uart_server_thread(void * ctx) {
     (void) ctx;
+    uint32_t wait = UART_RX_CHECK_INTERVAL_MS;
 
     for (;;) {
-        // Check for UART errors and restart receive DMA transfer if required
-        if (huart_->RxState != HAL_UART_STATE_BUSY_RX) {
-            HAL_UART_AbortReceive(huart_);
-            HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
-            dma_last_rcv_idx = 0;
-        }
-        // Fetch the circular buffer "write pointer", where it would write next
-        uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart_->hdmarx->Instance->NDTR;
-        if (new_rcv_idx > UART_RX_BUFFER_SIZE) { // defensive programming
-            continue;
-        }
-
-        // Process bytes in one or two chunks (two in case there was a wrap)
-        if (new_rcv_idx < dma_last_rcv_idx) {
-            uart_stream_input.process_bytes(dma_rx_buffer + dma_last_rcv_idx,
-                    UART_RX_BUFFER_SIZE - dma_last_rcv_idx, nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer + dma_last_rcv_idx,
-                    UART_RX_BUFFER_SIZE - dma_last_rcv_idx, uart_stream_output);
-            dma_last_rcv_idx = 0;
-        }
-        if (new_rcv_idx > dma_last_rcv_idx) {
-            uart_stream_input.process_bytes(dma_rx_buffer + dma_last_rcv_idx,
-                    new_rcv_idx - dma_last_rcv_idx, nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer + dma_last_rcv_idx,
-                    new_rcv_idx - dma_last_rcv_idx, uart_stream_output);
-            dma_last_rcv_idx = new_rcv_idx;
-        }
-
-        // The thread is woken up by the control loop at 8kHz. This should be
-        // enough for most applications.
-        // At 1Mbaud/s that corresponds to at most 12.5 bytes which can arrive
-        // during the sleep period.
-        osThreadSuspend(nullptr);
+        odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_UART, HAL_GetTick());
+        osSignalWait(UART_SIGNAL_RX, wait);
+        wait = uart_server_poll();
     }
 }
 
 // TODO: allow multiple UART server instances
-void start_uart_server() {
+void init_uart_server() {
+    if (Stm32Gpio de_gpio = get_gpio(odrv.config_.uart0_de_gpio_pin)) {
+        de_gpio.config(GPIO_MODE_OUTPUT_PP, GPIO_NOPULL);
+        de_gpio.write(false);
+        uart_stream_output.set_de_gpio(de_gpio);
+    }
+
     // DMA is set up to receive in a circular buffer forever.
-    // We dont use interrupts to fetch the data, instead we periodically read
-    // data out of the circular buffer into a parse buffer, controlled by a state machine
+    // The interrupts only wake up the thread, which reads the data out of the
+    // circular buffer into a parse buffer, controlled by a state machine
     HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
     dma_last_rcv_idx = 0;
+    uart_server_active = true;
+    __HAL_UART_ENABLE_IT(huart_, UART_IT_IDLE);
+}
+
+void start_uart_server(osPriority priority) {
+    init_uart_server();
 
     // Start UART communication thread
-    osThreadDef(uart_server_thread_def, uart_server_thread, osPriorityNormal, 0, stack_size_uart_thread / sizeof(StackType_t) /* the ascii protocol needs considerable stack space */);
+    osThreadStaticDef(uart_server_thread_def, uart_server_thread, priority, 0, stack_size_uart_thread / sizeof(StackType_t) /* the ascii protocol needs considerable stack space */,
+                      uart_thread_stack, &uart_thread_tcb);
     uart_thread = osThreadCreate(osThread(uart_server_thread_def), NULL);
 }
 
-void uart_poll() {
-    if (uart_thread) { // the thread is only started if UART is enabled
-        osThreadResume(uart_thread);
+static void wake_uart_thread() {
+    if (uart_thread) {
+        osSignalSet(uart_thread, UART_SIGNAL_RX);
+    } else if (uart_server_active) {
+        osSemaphoreRelease(sem_usb_rx); // polled by the merged comms thread
     }
 }
 
+// Called from UART4_IRQHandler when the line went idle after a burst
+extern "C" void uart_rx_idle_callback() {
+    wake_uart_thread();
+}
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef* huart) {
+    if (huart == huart_)
+        wake_uart_thread();
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart) {
+    if (huart == huart_)
+        wake_uart_thread();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart) {
+    if (huart == huart_)
+        wake_uart_thread(); // restarts the DMA
+}
+
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart) {
-    osSemaphoreRelease(sem_uart_dma);
+    if (huart == huart_)
+        uart_stream_output.tx_complete();
 }
@@ -13,8 +13,10 @@ extern "C" {
 extern osThreadId uart_thread;
 extern const uint32_t stack_size_uart_thread;
 
-void start_uart_server(void);
-void uart_poll(void);
+void init_uart_server(void);
+void start_uart_server(osPriority priority);
+uint32_t uart_server_poll(void);
+void uart_rx_idle_callback(void);
 
 #ifdef __cplusplus
 }
@@ -15,6 +15,9 @@
 
 osThreadId usb_thread;
 const uint32_t stack_size_usb_thread = 4096; // Bytes
+CCM_RAM static StackType_t usb_thread_stack[stack_size_usb_thread / sizeof(StackType_t)];
+CCM_RAM static StaticTask_t usb_thread_tcb;
+static constexpr uint32_t USB_WATCHDOG_CHECK_IN_INTERVAL_MS = 100; // well within thread_budget_usb
 USBStats_t usb_stats_;
 
 class USBSender : public PacketSink {
@@ -26,8 +29,10 @@ public:
         // cannot send partial packets
         if (length > USB_TX_DATA_SIZE)
             return -1;
-        // wait for USB interface to become ready
-        if (osSemaphoreWait(sem_usb_tx_, PROTOCOL_SERVER_TIMEOUT_MS) != osOK) {
+        // wait for a free TX buffer on this endpoint pair. CDC_Transmit_FS copies the
+        // packet, so the caller can build the next one while this one is in flight.
+        bool have_buffer = osSemaphoreWait(sem_usb_tx_, PROTOCOL_SERVER_TIMEOUT_MS) == osOK;
+        if (!have_buffer) {
             // If the host resets the device it might be that the TX-complete handler is never called
             // and the sem_usb_tx_ semaphore is never released. To handle this we just override the
             // TX buffer if this wait times out. The implication is that the channel is no longer lossless.
@@ -39,7 +44,9 @@ public:
                 const_cast<uint8_t*>(buffer) /* casting this const away is safe because...
                 well... it's not actually. Stupid STM. */, length, endpoint_pair_);
         if (status != USBD_OK) {
-            osSemaphoreRelease(sem_usb_tx_);
+            if (have_buffer)
+                osSemaphoreRelease(sem_usb_tx_);
+            usb_stats_.tx_error_cnt++;
             return -1;
         }
         usb_stats_.tx_cnt++;
@@ -50,9 +57,9 @@ private:
     const osSemaphoreId& sem_usb_tx_;
 };
 
-// Note we could have independent semaphores here to allow concurrent transmission
-USBSender usb_packet_output_cdc(CDC_OUT_EP, sem_usb_tx);
-USBSender usb_packet_output_native(ODRIVE_OUT_EP, sem_usb_tx);
+// Independent semaphores, so the CDC and native interfaces don't wait for each other
+USBSender usb_packet_output_cdc(CDC_OUT_EP, sem_usb_tx_cdc);
+USBSender usb_packet_output_native(ODRIVE_OUT_EP, sem_usb_tx_native);
 
 class TreatPacketSinkAsStreamSink : public StreamSink {
 public:
@@ -78,6 +85,8 @@ private:
 // This is used by the printf feature. Hence the above statics, and below seemingly random ptr (it's externed)
 // TODO: less spaghetti code
 StreamSink* usb_stream_output_ptr = &usb_stream_output;
+// Used by the telemetry stream to push packets on the native interface
+PacketSink* usb_native_packet_output_ptr = &usb_packet_output_native;
 
 #if defined(USB_PROTOCOL_NATIVE)
 BidirectionalPacketBasedChannel usb_channel(usb_packet_output_native);
@@ -87,6 +96,13 @@ BidirectionalPacketBasedChannel usb_channel(usb_packetized_output);
 StreamToPacketSegmenter usb_native_stream_input(usb_channel);
 #endif
 
+#if defined(USB_PROTOCOL_NATIVE) || defined(USB_PROTOCOL_NATIVE_STREAM_BASED)
+ChannelStats_t& usb_channel_stats_ = usb_channel.stats_;
+#else
+static ChannelStats_t no_usb_channel_stats = {};
+ChannelStats_t& usb_channel_stats_ = no_usb_channel_stats;
+#endif
+
 struct USBInterface {
     uint8_t* rx_buf = nullptr;
     uint32_t rx_len = 0;
@@ -115,44 +131,55 @@ static USBInterface ODrive_interface = {
     .usb_sender = usb_packet_output_native,
 };
 
-static void usb_server_thread(void * ctx) {
-    (void) ctx;
-    
-    for (;;) {
-        // const uint32_t usb_check_timeout = 1; // ms
-        osStatus sem_stat = osSemaphoreWait(sem_usb_rx, osWaitForever);
-        if (sem_stat == osOK) {
-            usb_stats_.rx_cnt++;
-
-            // CDC Interface
-            if (CDC_interface.data_pending) {
-                CDC_interface.data_pending = false;
-                if (odrv.config_.enable_ascii_protocol_on_usb) {
-                    ASCII_protocol_parse_stream(CDC_interface.rx_buf,
-                            CDC_interface.rx_len, usb_stream_output);
-                } else {
+// @brief Handles the packets that were received since the last call. Runs on
+// the USB thread or on the merged comms thread.
+// @returns [ms] until the next call is needed at the latest
+uint32_t usb_server_poll() {
+    if (!CDC_interface.data_pending && !ODrive_interface.data_pending)
+        return USB_WATCHDOG_CHECK_IN_INTERVAL_MS;
+    usb_stats_.rx_cnt++;
+
+    // CDC Interface
+    if (CDC_interface.data_pending) {
+        CDC_interface.data_pending = false;
+        usb_stats_.rx_cdc_cnt++;
+        if (odrv.config_.enable_ascii_protocol_on_usb) {
+            ASCII_protocol_parse_stream(CDC_interface.rx_buf,
+                    CDC_interface.rx_len, usb_stream_output);
+        } else {
 #if defined(USB_PROTOCOL_NATIVE)
-                    usb_channel.process_packet(CDC_interface.rx_buf, CDC_interface.rx_len);
+            usb_channel.process_packet(CDC_interface.rx_buf, CDC_interface.rx_len);
 #elif defined(USB_PROTOCOL_NATIVE_STREAM_BASED)
-                    usb_native_stream_input.process_bytes(
-                            CDC_interface.rx_buf, CDC_interface.rx_len, nullptr);
+            usb_native_stream_input.process_bytes(
+                    CDC_interface.rx_buf, CDC_interface.rx_len, nullptr);
 #endif
-                }
-                USBD_CDC_ReceivePacket(&usb_dev_handle, CDC_interface.out_ep);  // Allow next packet
-            }
+        }
+        USBD_CDC_ReceivePacket(&usb_dev_handle, CDC_interface.out_ep);  // Allow next packet
+    }
 
-            // Native Interface
-            if (ODrive_interface.data_pending) {
-                ODrive_interface.data_pending = false;
+    // Native Interface
+    if (ODrive_interface.data_pending) {
+        ODrive_interface.data_pending = false;
+        usb_stats_.rx_native_cnt++;
 #if defined(USB_PROTOCOL_NATIVE)
-                usb_channel.process_packet(ODrive_interface.rx_buf, ODrive_interface.rx_len);
+        usb_channel.process_packet(ODrive_interface.rx_buf, ODrive_interface.rx_len);
 #elif defined(USB_PROTOCOL_NATIVE_STREAM_BASED)
-                usb_native_stream_input.process_bytes(
-                        ODrive_interface.rx_buf, ODrive_interface.rx_len, nullptr);
+        usb_native_stream_input.process_bytes(
+                ODrive_interface.rx_buf, ODrive_interface.rx_len, nullptr);
 #endif
-                USBD_CDC_ReceivePacket(&usb_dev_handle, ODrive_interface.out_ep);  // Allow next packet
-            }
-        }
+        USBD_CDC_ReceivePacket(&usb_dev_handle, ODrive_interface.out_ep);  // Allow next packet
+    }
+    return USB_WATCHDOG_CHECK_IN_INTERVAL_MS;
+}
+
+static void usb_server_thread(void * ctx) {
+    (void) ctx;
+    
+    for (;;) {
+        // Wakes up periodically to check in with the system watchdog
+        odrv.thread_watchdog_.check_in(WATCHDOG_THREAD_USB, HAL_GetTick());
+        if (osSemaphoreWait(sem_usb_rx, USB_WATCHDOG_CHECK_IN_INTERVAL_MS) == osOK)
+            usb_server_poll();
     }
 }
 
@@ -176,8 +203,8 @@ void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair) {
     osSemaphoreRelease(sem_usb_rx);
 }
 
-void start_usb_server() {
+void start_usb_server(osPriority priority) {
     // Start USB communication thread
-    osThreadDef(usb_server_thread_def, usb_server_thread, osPriorityNormal, 0, stack_size_usb_thread / sizeof(StackType_t));
+    osThreadStaticDef(usb_server_thread_def, usb_server_thread, priority, 0, stack_size_usb_thread / sizeof(StackType_t), usb_thread_stack, &usb_thread_tcb);
     usb_thread = osThreadCreate(osThread(usb_server_thread_def), NULL);
 }
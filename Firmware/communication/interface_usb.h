@@ -4,6 +4,8 @@
 #ifdef __cplusplus
 #include "fibre/protocol.hpp"
 extern StreamSink* usb_stream_output_ptr;
+extern PacketSink* usb_native_packet_output_ptr;
+extern ChannelStats_t& usb_channel_stats_;
 
 extern "C" {
 #endif
@@ -16,14 +18,18 @@ extern const uint32_t stack_size_usb_thread;
 
 typedef struct {
     uint32_t rx_cnt;
+    uint32_t rx_cdc_cnt;
+    uint32_t rx_native_cnt;
     uint32_t tx_cnt;
     uint32_t tx_overrun_cnt;
+    uint32_t tx_error_cnt;
 } USBStats_t;
 
 extern USBStats_t usb_stats_;
 
 void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair);
-void start_usb_server(void);
+uint32_t usb_server_poll(void);
+void start_usb_server(osPriority priority);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,257 @@
+#ifndef __UART_BUS_HPP
+#define __UART_BUS_HPP
+
+#include <fibre/protocol.hpp>
+#include <fibre/crc.hpp>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Addressing for several ODrives on one UART bus, e.g. a half-duplex RS-485
+// bus, selected with odrv.config.uart0_node_id != 0. The master polls the
+// nodes one at a time and only the addressed node answers, so the bus stays
+// deterministic. Node ID 0 addresses all nodes (broadcast), which never
+// answer. See docs/ascii-protocol.md.
+//
+// ASCII lines are prefixed with the node ID:
+//     request:  "@<node_id> <command>"
+//     response: "#<node_id> <response>"
+// The checksum of a line covers only the command or response. Lines without
+// the prefix are ignored.
+//
+// Fibre and binary protocol bytes are wrapped in envelopes:
+//     [sync 0xA7] [node_id | 0x80 for responses] [length] [CRC8 of the first 3 bytes] [length bytes]
+// The contents carry their own CRC. The bytes of a fibre packet or binary
+// frame may be split over several envelopes.
+//
+// The nodes ignore responses, so a transceiver that receives its own
+// transmissions doesn't confuse them.
+
+enum : uint8_t {
+    UART_BUS_SYNC = 0xA7,
+    UART_BUS_RESPONSE_FLAG = 0x80,
+    UART_BUS_BROADCAST = 0,
+    UART_BUS_MAX_NODE_ID = 127,
+};
+
+enum UartBusFraming {
+    UART_BUS_FRAMING_ENVELOPE,
+    UART_BUS_FRAMING_ASCII,
+};
+
+// @brief Passes the bytes of the requests addressed to this node or to all
+// nodes on to the protocol parser, without the addressing.
+class UartBusFilter : public StreamSink {
+public:
+    UartBusFilter(UartBusFraming framing, StreamSink& output) : framing_(framing), output_(output) {}
+
+    void set_node_id(uint8_t node_id) { node_id_ = node_id; }
+
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        int result = 0;
+        while (length) {
+            size_t n = framing_ == UART_BUS_FRAMING_ASCII ? process_ascii(buffer, length, &result)
+                                                          : process_envelope(buffer, length, &result);
+            buffer += n;
+            length -= n;
+            if (processed_bytes)
+                *processed_bytes += n;
+        }
+        return result;
+    }
+
+    size_t get_free_space() override { return SIZE_MAX; }
+
+    // @brief True if the last accepted request was addressed to this node
+    // only, which means it gets a response
+    bool unicast() const { return unicast_; }
+
+private:
+    enum State {
+        STATE_IDLE,    // ASCII: start of a line, envelope: waiting for the sync byte
+        STATE_ADDRESS, // ASCII: node ID digits, envelope: one byte each
+        STATE_LENGTH,
+        STATE_CRC,
+        STATE_ACCEPT,  // forward the rest of the line or envelope
+        STATE_DROP,    // skip the rest of the line or envelope
+    };
+
+    static bool is_end_of_line(uint8_t c) { return c == '\r' || c == '\n' || c == '!'; }
+
+    void accept(uint8_t address) {
+        bool match = address == node_id_ || address == UART_BUS_BROADCAST;
+        if (match)
+            unicast_ = address == node_id_;
+        state_ = match ? STATE_ACCEPT : STATE_DROP;
+    }
+
+    // @returns the number of bytes consumed
+    size_t process_ascii(const uint8_t* buffer, size_t length, int* result) {
+        if (state_ == STATE_ACCEPT) {
+            size_t n = 0;
+            while (n < length && !is_end_of_line(buffer[n]))
+                ++n;
+            if (n < length) {
+                ++n; // the parser needs the end of line
+                state_ = STATE_IDLE;
+            }
+            *result |= output_.process_bytes(buffer, n, nullptr);
+            return n;
+        }
+
+        uint8_t c = buffer[0];
+        if (is_end_of_line(c)) {
+            state_ = STATE_IDLE;
+        } else if (state_ == STATE_IDLE) {
+            state_ = c == '@' ? STATE_ADDRESS : STATE_DROP;
+            address_ = 0;
+            num_digits_ = 0;
+        } else if (state_ == STATE_ADDRESS) {
+            if (c >= '0' && c <= '9' && num_digits_ < 3) {
+                address_ = address_ * 10 + (c - '0');
+                ++num_digits_;
+            } else if (c == ' ' && num_digits_ && address_ <= UART_BUS_MAX_NODE_ID) {
+                accept((uint8_t)address_);
+            } else {
+                state_ = STATE_DROP;
+            }
+        }
+        return 1;
+    }
+
+    // @returns the number of bytes consumed
+    size_t process_envelope(const uint8_t* buffer, size_t length, int* result) {
+        if (state_ == STATE_ACCEPT || state_ == STATE_DROP) {
+            size_t n = length < remaining_ ? length : remaining_;
+            if (state_ == STATE_ACCEPT)
+                *result |= output_.process_bytes(buffer, n, nullptr);
+            remaining_ -= n;
+            if (!remaining_)
+                state_ = STATE_IDLE;
+            return n;
+        }
+
+        uint8_t c = buffer[0];
+        switch (state_) {
+            case STATE_IDLE: {
+                if (c == UART_BUS_SYNC) {
+                    header_[0] = c;
+                    state_ = STATE_ADDRESS;
+                }
+            } break;
+            case STATE_ADDRESS: {
+                header_[1] = c;
+                state_ = STATE_LENGTH;
+            } break;
+            case STATE_LENGTH: {
+                header_[2] = c;
+                state_ = STATE_CRC;
+            } break;
+            default: {
+                remaining_ = header_[2];
+                if (calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_, 3) != c) {
+                    state_ = STATE_IDLE; // look for the next sync byte
+                } else if (header_[1] & UART_BUS_RESPONSE_FLAG) {
+                    state_ = STATE_DROP; // response of another node
+                } else {
+                    accept(header_[1]);
+                }
+                if (!remaining_)
+                    state_ = STATE_IDLE;
+            } break;
+        }
+        return 1;
+    }
+
+    UartBusFraming framing_;
+    StreamSink& output_;
+    uint8_t node_id_ = 0;
+    State state_ = STATE_IDLE;
+    bool unicast_ = false;
+    uint8_t header_[3] = {};
+    size_t remaining_ = 0; // [bytes] left in the envelope
+    uint32_t address_ = 0;
+    size_t num_digits_ = 0;
+};
+
+// @brief Collects the response of the protocol parser to a request that
+// UartBusFilter accepted and sends it on flush() with the addressing.
+// Responses to broadcasts are discarded.
+class UartBusResponder : public StreamSink {
+public:
+    static constexpr size_t buffer_size = 255; // one envelope
+
+    UartBusResponder(UartBusFraming framing, const UartBusFilter& requests, StreamSink& output)
+        : framing_(framing), requests_(requests), output_(output) {}
+
+    void set_node_id(uint8_t node_id) { node_id_ = node_id; }
+
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        if (processed_bytes)
+            *processed_bytes += length;
+        if (!requests_.unicast())
+            return 0;
+        int result = 0;
+        for (; length; ++buffer, --length) {
+            if (framing_ == UART_BUS_FRAMING_ASCII && at_line_start_) {
+                char prefix[6] = {'#'};
+                size_t n = 1;
+                if (node_id_ >= 100)
+                    prefix[n++] = (char)('0' + node_id_ / 100);
+                if (node_id_ >= 10)
+                    prefix[n++] = (char)('0' + node_id_ / 10 % 10);
+                prefix[n++] = (char)('0' + node_id_ % 10);
+                prefix[n++] = ' ';
+                if (length_ + n > buffer_size)
+                    result |= send();
+                memcpy(buffer_ + length_, prefix, n);
+                length_ += n;
+                at_line_start_ = false;
+            }
+            if (length_ >= buffer_size)
+                result |= send();
+            buffer_[length_++] = *buffer;
+            if (*buffer == '\n')
+                at_line_start_ = true;
+        }
+        return result;
+    }
+
+    size_t get_free_space() override { return SIZE_MAX; }
+
+    // @brief Sends the collected response, should be called after the bytes
+    // received so far were processed
+    int flush() {
+        int result = send();
+        at_line_start_ = true;
+        return result;
+    }
+
+private:
+    int send() {
+        if (!length_)
+            return 0;
+        int result = 0;
+        if (framing_ == UART_BUS_FRAMING_ASCII) {
+            result = output_.process_bytes(buffer_, length_, nullptr);
+        } else {
+            uint8_t header[4] = {UART_BUS_SYNC, (uint8_t)(node_id_ | UART_BUS_RESPONSE_FLAG), (uint8_t)length_};
+            header[3] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header, 3);
+            result = output_.process_bytes(header, sizeof(header), nullptr)
+                   | output_.process_bytes(buffer_, length_, nullptr);
+        }
+        length_ = 0;
+        return result;
+    }
+
+    UartBusFraming framing_;
+    const UartBusFilter& requests_;
+    StreamSink& output_;
+    uint8_t node_id_ = 0;
+    bool at_line_start_ = true;
+    uint8_t buffer_[buffer_size];
+    size_t length_ = 0;
+};
+
+#endif // __UART_BUS_HPP
@@ -0,0 +1,122 @@
+#ifndef __FIBRE_ASYNC_CALLS_HPP
+#define __FIBRE_ASYNC_CALLS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Work queue of asynchronous function calls. A request queues the call of a
+// function endpoint and gets a handle right away, a worker thread runs the
+// calls in the order they were queued and the host queries the status of the
+// handle until the call is done. The inputs and outputs of the function are
+// its usual property endpoints, so the host sets the inputs before it queues
+// the call and reads the outputs once the call is done.
+//
+// Any number of channel threads may queue and query calls, only one thread
+// may run them. A finished call keeps its status until its slot is taken by
+// a new call, the oldest finished call goes first.
+template<size_t N>
+class AsyncCallQueue {
+public:
+    enum Status : uint8_t {
+        STATUS_UNKNOWN, // the handle was never issued or its slot was reused
+        STATUS_QUEUED,
+        STATUS_RUNNING,
+        STATUS_DONE,
+        STATUS_FAILED,  // the endpoint handler returned false
+    };
+
+    // @brief Queues a call of the endpoint
+    // @returns the handle of the call, 0 if the queue is full
+    uint16_t start(uint16_t endpoint_id) {
+        Slot* slot = claim();
+        if (!slot)
+            return 0;
+        uint16_t handle;
+        do {
+            handle = next_handle_.fetch_add(1, std::memory_order_relaxed);
+        } while (!handle);
+        slot->endpoint_id = endpoint_id;
+        slot->handle = handle;
+        slot->state.store(STATE_QUEUED, std::memory_order_release);
+        return handle;
+    }
+
+    Status status(uint16_t handle) const {
+        if (!handle)
+            return STATUS_UNKNOWN;
+        for (const Slot& slot : slots_) {
+            uint8_t state = slot.state.load(std::memory_order_acquire);
+            if (state == STATE_FREE || state == STATE_CLAIMED || slot.handle != handle)
+                continue;
+            return (Status)state; // the states from here on are the status values
+        }
+        return STATUS_UNKNOWN;
+    }
+
+    // @brief Runs the oldest queued call, on the worker thread
+    // @param run: calls the endpoint, returns false if it failed
+    // @returns false if no call was queued
+    template<typename TFn>
+    bool run_next(TFn run) {
+        Slot* next = nullptr;
+        for (Slot& slot : slots_) {
+            if (slot.state.load(std::memory_order_acquire) == STATE_QUEUED
+                    && (!next || (int16_t)(slot.handle - next->handle) < 0))
+                next = &slot;
+        }
+        if (!next)
+            return false;
+        next->state.store(STATE_RUNNING, std::memory_order_relaxed);
+        bool ok = run(next->endpoint_id);
+        next->state.store(ok ? STATE_DONE : STATE_FAILED, std::memory_order_release);
+        return true;
+    }
+
+private:
+    enum : uint8_t {
+        STATE_FREE = 0x80,
+        STATE_CLAIMED = 0x81, // being filled by start()
+        STATE_QUEUED = STATUS_QUEUED,
+        STATE_RUNNING = STATUS_RUNNING,
+        STATE_DONE = STATUS_DONE,
+        STATE_FAILED = STATUS_FAILED,
+    };
+
+    struct Slot {
+        std::atomic<uint8_t> state{STATE_FREE};
+        uint16_t endpoint_id = 0;
+        uint16_t handle = 0;
+    };
+
+    // @brief Takes a free slot, or else the one of the oldest finished call
+    Slot* claim() {
+        for (;;) {
+            Slot* best = nullptr;
+            uint8_t best_state = STATE_FREE;
+            for (Slot& slot : slots_) {
+                uint8_t state = slot.state.load(std::memory_order_acquire);
+                if (state == STATE_FREE) {
+                    best = &slot;
+                    best_state = state;
+                    break;
+                }
+                if ((state == STATE_DONE || state == STATE_FAILED)
+                        && (!best || (int16_t)(slot.handle - best->handle) < 0)) {
+                    best = &slot;
+                    best_state = state;
+                }
+            }
+            if (!best)
+                return nullptr;
+            // Another thread may have taken the slot meanwhile, look again then
+            if (best->state.compare_exchange_strong(best_state, STATE_CLAIMED, std::memory_order_acquire))
+                return best;
+        }
+    }
+
+    Slot slots_[N];
+    std::atomic<uint16_t> next_handle_{1};
+};
+
+#endif // __FIBRE_ASYNC_CALLS_HPP
@@ -2,28 +2,49 @@
 #define __CRC_HPP
 
 #include <stdint.h>
+#include <stddef.h>
 #include <limits.h>
 
-// Calculates an arbitrary CRC for one byte.
+// Lookup table of an arbitrary CRC, generated at compile time. Entry i is the
+// remainder of the byte i after a modulo-2 division of 8 bits, so a byte is
+// processed with one lookup instead of 8 iterations.
 // Adapted from https://barrgroup.com/Embedded-Systems/How-To/CRC-Calculation-C-Code
 template<typename T, unsigned POLYNOMIAL>
-static T calc_crc(T remainder, uint8_t value) {
-    constexpr T BIT_WIDTH = (CHAR_BIT * sizeof(T));
-    constexpr T TOPBIT = ((T)1 << (BIT_WIDTH - 1));
-    
-    // Bring the next byte into the remainder.
-    remainder ^= (value << (BIT_WIDTH - 8));
-
-    // Perform modulo-2 division, a bit at a time.
-    for (uint8_t bit = 8; bit; --bit) {
-        if (remainder & TOPBIT) {
-            remainder = (remainder << 1) ^ POLYNOMIAL;
-        } else {
-            remainder = (remainder << 1);
+struct CrcTable {
+    static constexpr T BIT_WIDTH = (CHAR_BIT * sizeof(T));
+    static constexpr T TOPBIT = ((T)1 << (BIT_WIDTH - 1));
+
+    constexpr CrcTable() : entries() {
+        for (unsigned i = 0; i < 256; ++i) {
+            T remainder = (T)(i << (BIT_WIDTH - 8));
+            // Perform modulo-2 division, a bit at a time.
+            for (uint8_t bit = 8; bit; --bit) {
+                if (remainder & TOPBIT) {
+                    remainder = (T)((remainder << 1) ^ POLYNOMIAL);
+                } else {
+                    remainder = (T)(remainder << 1);
+                }
+            }
+            entries[i] = remainder;
         }
     }
 
-    return remainder;
+    T entries[256];
+};
+
+// One table per CRC type, in flash
+template<typename T, unsigned POLYNOMIAL>
+inline constexpr CrcTable<T, POLYNOMIAL> crc_table{};
+
+// Calculates an arbitrary CRC for one byte.
+template<typename T, unsigned POLYNOMIAL>
+static T calc_crc(T remainder, uint8_t value) {
+    constexpr T BIT_WIDTH = (CHAR_BIT * sizeof(T));
+    uint8_t index = (uint8_t)(remainder >> (BIT_WIDTH - 8)) ^ value;
+    if constexpr (BIT_WIDTH > 8)
+        return (T)(remainder << 8) ^ crc_table<T, POLYNOMIAL>.entries[index];
+    else
+        return crc_table<T, POLYNOMIAL>.entries[index];
 }
 
 template<typename T, unsigned POLYNOMIAL>
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <cstring>
+#include <type_traits>
 
 #pragma GCC push_options
 #pragma GCC optimize ("s")
@@ -144,10 +145,13 @@ struct StringConvertibleTypeInfo {
 };
 
 struct FloatSettableTypeInfo {
-    //virtual bool get_float(const Introspectable& obj, float* val) const { return false; }
     virtual bool set_float(const Introspectable& obj, float val) const { return false; }
 };
 
+struct FloatGettableTypeInfo {
+    virtual bool get_float(const Introspectable& obj, float* val) const { return false; }
+};
+
 /* Built-in type infos ********************************************************/
 
 template<typename T>
@@ -155,7 +159,7 @@ struct FibrePropertyTypeInfo;
 
 // readonly property
 template<typename T>
-struct FibrePropertyTypeInfo<Property<const T>> : StringConvertibleTypeInfo, TypeInfo {
+struct FibrePropertyTypeInfo<Property<const T>> : FloatGettableTypeInfo, StringConvertibleTypeInfo, TypeInfo {
     using TypeInfo::TypeInfo;
     static const PropertyInfo property_table[];
     static const FibrePropertyTypeInfo<Property<const T>> singleton;
@@ -167,6 +171,10 @@ struct FibrePropertyTypeInfo<Property<const T>> : StringConvertibleTypeInfo, Typ
     bool get_string(const Introspectable& obj, char* buffer, size_t length) const override {
         return to_string(static_cast<maybe_underlying_type_t<T>>(as<const Property<const T>>(obj).read()), buffer, length, 0);
     }
+
+    bool get_float(const Introspectable& obj, float* val) const override {
+        return conversion::get_as_float(static_cast<maybe_underlying_type_t<T>>(as<const Property<const T>>(obj).read()), val);
+    }
 };
 
 template<typename T>
@@ -176,7 +184,7 @@ const FibrePropertyTypeInfo<Property<const T>> FibrePropertyTypeInfo<Property<co
 
 // readwrite property
 template<typename T>
-struct FibrePropertyTypeInfo<Property<T>> : FloatSettableTypeInfo, StringConvertibleTypeInfo, TypeInfo {
+struct FibrePropertyTypeInfo<Property<T>> : FloatSettableTypeInfo, FloatGettableTypeInfo, StringConvertibleTypeInfo, TypeInfo {
     using TypeInfo::TypeInfo;
     static const PropertyInfo property_table[];
     static const FibrePropertyTypeInfo<Property<T>> singleton;
@@ -207,6 +215,9 @@ struct FibrePropertyTypeInfo<Property<T>> : FloatSettableTypeInfo, StringConvert
         as<const Property<T>>(obj).exchange(static_cast<T>(value));
         return true;
     }
+    bool get_float(const Introspectable& obj, float* val) const override {
+        return conversion::get_as_float(static_cast<maybe_underlying_type_t<T>>(as<const Property<T>>(obj).read()), val);
+    }
 };
 
 template<typename T>
@@ -214,6 +225,24 @@ const PropertyInfo FibrePropertyTypeInfo<Property<T>>::property_table[] = {};
 template<typename T>
 const FibrePropertyTypeInfo<Property<T>> FibrePropertyTypeInfo<Property<T>>::singleton{FibrePropertyTypeInfo<Property<T>>::property_table, sizeof(FibrePropertyTypeInfo<Property<T>>::property_table) / sizeof(FibrePropertyTypeInfo<Property<T>>::property_table[0])};
 
+// Float accessors of a property type, resolved at compile time so that the
+// endpoint table doesn't need a dynamic_cast per access.
+template<typename T>
+constexpr const FloatGettableTypeInfo* float_gettable_type_info() {
+    if constexpr (std::is_base_of<FloatGettableTypeInfo, FibrePropertyTypeInfo<T>>::value)
+        return &FibrePropertyTypeInfo<T>::singleton;
+    else
+        return nullptr;
+}
+
+template<typename T>
+constexpr const FloatSettableTypeInfo* float_settable_type_info() {
+    if constexpr (std::is_base_of<FloatSettableTypeInfo, FibrePropertyTypeInfo<T>>::value)
+        return &FibrePropertyTypeInfo<T>::singleton;
+    else
+        return nullptr;
+}
+
 #pragma GCC pop_options
 
 #endif // __FIBRE_INTROSPECTION_HPP
\ No newline at end of file
@@ -70,9 +70,36 @@ struct ReceiverState {
 
 constexpr uint16_t PROTOCOL_VERSION = 1;
 
-// This value must not be larger than USB_TX_DATA_SIZE defined in usbd_cdc_if.h
-constexpr uint16_t TX_BUF_SIZE = 32; // does not work with 64 for some reason
-constexpr uint16_t RX_BUF_SIZE = 128; // larger values than 128 have currently no effect because of protocol limitations
+// This value must not be larger than USB_TX_DATA_SIZE defined in usbd_cdc_if.h.
+// 64 is the full speed max packet size, the host reads whole packets, so a
+// full response needs no zero length packet.
+constexpr uint16_t TX_BUF_SIZE = 64;
+// Longest packet a stream based channel accepts, the stream format allows up
+// to MAX_STREAM_PACKET_SIZE
+constexpr uint16_t RX_BUF_SIZE = 256;
+// Packets from 128 bytes on use the long stream header with a 15 bit length
+constexpr uint16_t MAX_SHORT_STREAM_PACKET_SIZE = 127;
+constexpr uint16_t MAX_STREAM_PACKET_SIZE = 0x7fff;
+
+// Formats of the JSON on endpoint 0, selected by an optional byte after the
+// offset in the request
+constexpr uint8_t JSON_FORMAT_PLAIN = 0;
+constexpr uint8_t JSON_FORMAT_ZLIB = 1;
+
+// Endpoint ID of the batch operation, one request that runs several endpoint
+// operations, see fibre::batch_handler()
+constexpr uint16_t BATCH_ENDPOINT_ID = 0x7fff;
+
+// Endpoint IDs of the asynchronous function calls, see fibre::async_call_handler()
+constexpr uint16_t ASYNC_CALL_ENDPOINT_ID = 0x7ffe;
+constexpr uint16_t ASYNC_STATUS_ENDPOINT_ID = 0x7ffd;
+constexpr size_t ASYNC_CALL_QUEUE_SIZE = 4;
+
+// A datagram that starts with this marker holds several packets, each one
+// prefixed with its 16 bit length, see DatagramChannel. Requests never have
+// bit 15 of the sequence number set, so no single packet starts like this.
+constexpr uint16_t DATAGRAM_BATCH_MARKER = 0xffff;
+constexpr uint16_t MAX_DATAGRAM_SIZE = 256;
 
 // Maximum time we allocate for processing and responding to a request
 constexpr uint32_t PROTOCOL_SERVER_TIMEOUT_MS = 10;
@@ -84,16 +111,30 @@ typedef struct {
 } endpoint_ref_t;
 
 
+class Introspectable;
+struct FloatGettableTypeInfo;
+struct FloatSettableTypeInfo;
+
 namespace fibre {
 // These symbols are defined in the autogenerated endpoints.hpp
 extern const unsigned char embedded_json[];
 extern const size_t embedded_json_length;
+extern const unsigned char embedded_json_zlib[];
+extern const size_t embedded_json_zlib_length;
 extern const uint16_t json_crc_;
 extern const uint32_t json_version_id_;
 bool endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer);
 bool endpoint0_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+bool batch_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+bool async_call_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+bool async_status_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+bool run_next_async_call();
+extern void (*on_async_call_queued)(); // wakes the thread that calls run_next_async_call(), set by the platform
+extern uint32_t (*get_time_us)(); // clock for the processing times in ChannelStats_t, set by the platform
 bool is_endpoint_ref_valid(endpoint_ref_t endpoint_ref);
 bool set_endpoint_from_float(endpoint_ref_t endpoint_ref, float value);
+const FloatGettableTypeInfo* get_float_endpoint(endpoint_ref_t endpoint_ref, Introspectable* property);
+const FloatSettableTypeInfo* get_float_settable_endpoint(endpoint_ref_t endpoint_ref, Introspectable* property);
 }
 
 
@@ -206,8 +247,9 @@ public:
     size_t get_free_space() { return SIZE_MAX; }
 
 private:
-    uint8_t header_buffer_[3] = {0};
+    uint8_t header_buffer_[4] = {0};
     size_t header_index_ = 0;
+    size_t header_length_ = 3; // 4 for the long header
     uint8_t packet_buffer_[RX_BUF_SIZE] = {0};
     size_t packet_index_ = 0;
     size_t packet_length_ = 0;
@@ -413,6 +455,40 @@ template<> struct Codec<endpoint_ref_t> {
 }
 
 
+/* @brief Counters of a BidirectionalPacketBasedChannel, to find out where a
+* slow link loses its time or its packets.
+*/
+struct ChannelStats_t {
+    uint32_t rx_packets; // all packets passed to process_packet()
+    uint32_t rx_invalid; // too short or with a wrong trailer
+    uint32_t endpoint_requests; // properties and functions
+    uint32_t batch_requests;
+    uint32_t async_call_requests;
+    uint32_t async_status_requests;
+    uint32_t truncated_responses; // more bytes were requested than fit into the TX buffer
+    uint32_t dropped_responses; // the output didn't take the response
+    // Time from receiving a request to handing over its response, only
+    // measured if fibre::get_time_us is set
+    uint32_t process_time_under_100us;
+    uint32_t process_time_under_1ms;
+    uint32_t process_time_under_10ms;
+    uint32_t process_time_over_10ms;
+    uint32_t max_process_time; // [us]
+
+    void add_process_time(uint32_t us) {
+        if (us < 100)
+            ++process_time_under_100us;
+        else if (us < 1000)
+            ++process_time_under_1ms;
+        else if (us < 10000)
+            ++process_time_under_10ms;
+        else
+            ++process_time_over_10ms;
+        if (us > max_process_time)
+            max_process_time = us;
+    }
+};
+
 /* @brief Handles the communication protocol on one channel.
 *
 * When instantiated with a list of endpoints and an output packet sink,
@@ -430,12 +506,50 @@ public:
     //    return SIZE_MAX;
     //}
     int process_packet(const uint8_t* buffer, size_t length) override;
+
+    ChannelStats_t stats_ = {};
 private:
     PacketSink& output_;
     uint8_t tx_buf_[TX_BUF_SIZE] = {0};
 };
 
 
+/* @brief Runs a channel over a datagram link, e.g. UDP or a network bridge.
+*
+* A datagram holds either one packet, or after DATAGRAM_BATCH_MARKER several
+* packets with a 16 bit length each. The responses to a batch are collected
+* and sent back as batches of up to MAX_DATAGRAM_SIZE bytes, so a client gets
+* the responses of many requests with one round trip.
+*/
+class DatagramChannel : public PacketSink {
+public:
+    explicit DatagramChannel(PacketSink& output) :
+        output_(output)
+    { }
+
+    // @brief Processes one received datagram
+    int process_packet(const uint8_t* buffer, size_t length) override;
+
+private:
+    // Collects the responses of the channel while a batch is processed
+    class ResponseCollector : public PacketSink {
+    public:
+        explicit ResponseCollector(DatagramChannel& parent) : parent_(parent) {}
+        int process_packet(const uint8_t* buffer, size_t length) override;
+    private:
+        DatagramChannel& parent_;
+    };
+
+    int flush();
+
+    PacketSink& output_;
+    ResponseCollector collector_{*this};
+    BidirectionalPacketBasedChannel channel_{collector_};
+    bool batching_ = false; // while processing a batch
+    uint8_t tx_buf_[MAX_DATAGRAM_SIZE] = {0};
+    size_t tx_length_ = 0;
+};
+
 /* ToString / FromString functions -------------------------------------------*/
 /*
 * These functions are currently not used by Fibre and only here to
@@ -468,7 +582,9 @@ template<> struct format_traits_t<uint32_t> { using type = void;
     static constexpr const char * fmtp = "%lu";
 };
 // TODO: change all overloads to fundamental int type space
-template<> struct format_traits_t<unsigned int> { using type = void;
+// On the host uint32_t is unsigned int, which is covered by the overload above
+struct format_traits_unused_t;
+template<> struct format_traits_t<std::conditional_t<std::is_same<uint32_t, unsigned int>::value, format_traits_unused_t, unsigned int>> { using type = void;
     static constexpr const char * fmt = "%ud";
     static constexpr const char * fmtp = "%ud";
 };
@@ -571,6 +687,18 @@ template<typename T>
 bool set_from_float(float value, T* property) {
     return set_from_float_ex<T>(value, property, 0);
 }
+template<typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+bool get_as_float_ex(T value, float* result, int) {
+    return *result = static_cast<float>(value), true;
+}
+template<typename T>
+bool get_as_float_ex(T value, float* result, ...) {
+    return false;
+}
+template<typename T>
+bool get_as_float(T value, float* result) {
+    return get_as_float_ex<T>(value, result, 0);
+}
 }
 
 
@@ -2,6 +2,7 @@
 #define __FIBRE_SIMPLE_SERDES
 
 //#include "stream.hpp"
+#include <optional>
 
 
 template<typename T, bool BigEndian, typename = void>
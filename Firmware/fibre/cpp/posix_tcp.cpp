@@ -1,6 +1,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -93,6 +94,9 @@ int serve_on_tcp(unsigned int port) {
         socklen_t silen = sizeof(si_other);
         // TODO: Add a limit on accepting connections
         int client_portal_fd = accept(s, reinterpret_cast<sockaddr *>(&si_other), &silen); // blocking call
+        // The packets go out in several small writes, don't hold them back
+        int nodelay = 1;
+        setsockopt(client_portal_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
         serv_pool.push_back(std::async(std::launch::async, serve_client, client_portal_fd));
         // do a little clean up on the pool
         for (std::vector<std::future<int>>::iterator it = serv_pool.end()-1; it >= serv_pool.begin(); --it) {
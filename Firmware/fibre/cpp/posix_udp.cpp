@@ -61,7 +61,7 @@ int serve_on_udp(unsigned int port) {
         //    inet_ntoa(si_other.sin_addr), ntohs(si_other.sin_port), buf);
 
         UDPPacketSender udp_packet_output(s, &si_other);
-        BidirectionalPacketBasedChannel udp_channel(udp_packet_output);
+        DatagramChannel udp_channel(udp_packet_output);
         udp_channel.process_packet(buf, n_received);
     }
 
@@ -6,6 +6,7 @@
 
 #include <fibre/protocol.hpp>
 #include <fibre/crc.hpp>
+#include <fibre/async_calls.hpp>
 
 /* Private defines -----------------------------------------------------------*/
 /* Private macros ------------------------------------------------------------*/
@@ -43,17 +44,21 @@ int StreamToPacketSegmenter::process_bytes(const uint8_t *buffer, size_t length,
     int result = 0;
 
     while (length--) {
-        if (header_index_ < sizeof(header_buffer_)) {
+        if (header_index_ < header_length_) {
             // Process header byte
             header_buffer_[header_index_++] = *buffer;
             if (header_index_ == 1 && header_buffer_[0] != CANONICAL_PREFIX) {
                 header_index_ = 0;
-            } else if (header_index_ == 2 && (header_buffer_[1] & 0x80)) {
-                header_index_ = 0; // TODO: support packets larger than 128 bytes
-            } else if (header_index_ == 3 && calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_buffer_, 3)) {
+            } else if (header_index_ == 2) {
+                header_length_ = (header_buffer_[1] & 0x80) ? 4 : 3;
+            } else if (header_index_ == header_length_ && calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_buffer_, header_length_)) {
                 header_index_ = 0;
-            } else if (header_index_ == 3) {
-                packet_length_ = header_buffer_[1] + 2;
+            } else if (header_index_ == header_length_) {
+                packet_length_ = (header_length_ == 4)
+                        ? ((header_buffer_[1] & 0x7f) << 8 | header_buffer_[2]) + 2
+                        : header_buffer_[1] + 2;
+                if (packet_length_ > sizeof(packet_buffer_))
+                    header_index_ = 0; // doesn't fit, look for the next header
             }
         } else if (packet_index_ < sizeof(packet_buffer_)) {
             // Process payload byte
@@ -61,7 +66,7 @@ int StreamToPacketSegmenter::process_bytes(const uint8_t *buffer, size_t length,
         }
 
         // If both header and packet are fully received, hand it on to the packet processor
-        if (header_index_ == 3 && packet_index_ == packet_length_) {
+        if (header_index_ == header_length_ && packet_index_ == packet_length_) {
             if (calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, packet_buffer_, packet_length_) == 0) {
                 result |= output_.process_packet(packet_buffer_, packet_length_ - 2);
             }
@@ -76,19 +81,23 @@ int StreamToPacketSegmenter::process_bytes(const uint8_t *buffer, size_t length,
 }
 
 int StreamBasedPacketSink::process_packet(const uint8_t *buffer, size_t length) {
-    // TODO: support buffer size >= 128
-    if (length >= 128)
+    if (length > MAX_STREAM_PACKET_SIZE)
         return -1;
 
     LOG_FIBRE("send header\r\n");
-    uint8_t header[] = {
-        CANONICAL_PREFIX,
-        static_cast<uint8_t>(length),
-        0
-    };
-    header[2] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header, 2);
+    uint8_t header[4] = {CANONICAL_PREFIX};
+    size_t header_length;
+    if (length <= MAX_SHORT_STREAM_PACKET_SIZE) {
+        header[1] = static_cast<uint8_t>(length);
+        header_length = 3;
+    } else {
+        header[1] = static_cast<uint8_t>(0x80 | (length >> 8));
+        header[2] = static_cast<uint8_t>(length & 0xff);
+        header_length = 4;
+    }
+    header[header_length - 1] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header, header_length - 1);
 
-    if (output_.process_bytes(header, sizeof(header), nullptr))
+    if (output_.process_bytes(header, header_length, nullptr))
         return -1;
     LOG_FIBRE("send payload:\r\n");
     hexdump(buffer, length);
@@ -112,6 +121,14 @@ int StreamBasedPacketSink::process_packet(const uint8_t *buffer, size_t length)
 bool fibre::endpoint0_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
     // The request must contain a 32 bit integer to specify an offset
     std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    // Older clients don't send the format and get the plain JSON
+    std::optional<uint8_t> format = read_le<uint8_t>(input_buffer);
+    const unsigned char* json = embedded_json;
+    size_t json_length = embedded_json_length;
+    if (format.has_value() && format.value() == JSON_FORMAT_ZLIB) {
+        json = embedded_json_zlib;
+        json_length = embedded_json_zlib_length;
+    }
     
     if (!offset.has_value()) {
         // Didn't receive any offset
@@ -119,23 +136,149 @@ bool fibre::endpoint0_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* o
     } else if (offset.value() == 0xffffffff) {
         // If the offset is special value 0xFFFFFFFF, send back the JSON version ID instead
         return write_le<uint32_t>(json_version_id_, output_buffer);
-    } else if (offset.value() >= embedded_json_length) {
+    } else if (offset.value() >= json_length) {
         // Attempt to read beyond the buffer end - return empty response
         return true;
     } else {
         // Return part of the json file
-        size_t n_copy = std::min(output_buffer->size(), embedded_json_length - (size_t)offset.value());
-        memcpy(output_buffer->begin(), embedded_json + offset.value(), n_copy);
+        size_t n_copy = std::min(output_buffer->size(), json_length - (size_t)offset.value());
+        memcpy(output_buffer->begin(), json + offset.value(), n_copy);
         *output_buffer = output_buffer->skip(n_copy);
         return true;
     }
 }
 
+// The input is a list of operations, each one is the endpoint ID (16 bit), the
+// input length, the expected output length (8 bit each) and the input. The
+// output holds the length and the data of each operation's output, the length
+// is 0xFF if the endpoint rejected the operation. The operations run back to
+// back, no other request can come in between. Processing stops at the first
+// operation whose output doesn't fit, the client sends the rest again.
+bool fibre::batch_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    while (input_buffer->size() >= 4) {
+        const uint8_t* op = input_buffer->begin();
+        uint16_t endpoint_id = op[0] | (op[1] << 8);
+        size_t input_length = op[2];
+        size_t output_length = op[3];
+        if (input_buffer->size() < 4 + input_length)
+            return false; // truncated operation
+        if (output_buffer->size() < 1 + output_length)
+            break;
+
+        fibre::cbufptr_t op_input{op + 4, input_length};
+        fibre::bufptr_t op_output{output_buffer->begin() + 1, output_length};
+        bool ok;
+        if (endpoint_id == ASYNC_CALL_ENDPOINT_ID)
+            ok = fibre::async_call_handler(&op_input, &op_output);
+        else if (endpoint_id == ASYNC_STATUS_ENDPOINT_ID)
+            ok = fibre::async_status_handler(&op_input, &op_output);
+        else
+            ok = endpoint_id != BATCH_ENDPOINT_ID
+                 && fibre::endpoint_handler(endpoint_id, &op_input, &op_output);
+        size_t n_written = output_length - op_output.size();
+        output_buffer->front() = ok ? n_written : 0xff;
+        *output_buffer = output_buffer->skip(1 + (ok ? n_written : 0));
+        *input_buffer = input_buffer->skip(4 + input_length);
+    }
+    return true;
+}
+
+int DatagramChannel::process_packet(const uint8_t* buffer, size_t length) {
+    if (length < 2 || (buffer[0] | (buffer[1] << 8)) != DATAGRAM_BATCH_MARKER) {
+        batching_ = false;
+        return channel_.process_packet(buffer, length);
+    }
+
+    batching_ = true;
+    tx_length_ = 2;
+    int result = 0;
+    for (size_t pos = 2; pos + 2 <= length; ) {
+        size_t packet_length = buffer[pos] | (buffer[pos + 1] << 8);
+        if (pos + 2 + packet_length > length) {
+            result = -1; // truncated
+            break;
+        }
+        result |= channel_.process_packet(buffer + pos + 2, packet_length);
+        pos += 2 + packet_length;
+    }
+    batching_ = false;
+    return flush() | result;
+}
+
+// Sends the collected responses, if any
+int DatagramChannel::flush() {
+    int result = 0;
+    if (tx_length_ > 2) {
+        write_le<uint16_t>(DATAGRAM_BATCH_MARKER, tx_buf_);
+        result = output_.process_packet(tx_buf_, tx_length_);
+    }
+    tx_length_ = 2;
+    return result;
+}
+
+int DatagramChannel::ResponseCollector::process_packet(const uint8_t* buffer, size_t length) {
+    DatagramChannel& p = parent_;
+    if (!p.batching_)
+        return p.output_.process_packet(buffer, length);
+    if (2 + 2 + length > sizeof(p.tx_buf_))
+        return -1; // can't happen with TX_BUF_SIZE responses
+    if (p.tx_length_ + 2 + length > sizeof(p.tx_buf_) && p.flush())
+        return -1;
+    p.tx_length_ += write_le<uint16_t>(length, p.tx_buf_ + p.tx_length_);
+    memcpy(p.tx_buf_ + p.tx_length_, buffer, length);
+    p.tx_length_ += length;
+    return 0;
+}
+
+static AsyncCallQueue<ASYNC_CALL_QUEUE_SIZE> async_calls;
+void (*fibre::on_async_call_queued)() = nullptr;
+uint32_t (*fibre::get_time_us)() = nullptr;
+
+static bool is_special_endpoint(uint16_t endpoint_id) {
+    return endpoint_id == BATCH_ENDPOINT_ID || endpoint_id == ASYNC_CALL_ENDPOINT_ID
+        || endpoint_id == ASYNC_STATUS_ENDPOINT_ID;
+}
+
+// Queues a call of the function endpoint (16 bit ID) in the input and returns
+// its handle (16 bit), 0 if the queue is full. The call runs on the worker
+// thread of the platform, so a long operation doesn't hold up the channel.
+bool fibre::async_call_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint16_t> endpoint_id = read_le<uint16_t>(input_buffer);
+    if (!endpoint_id.has_value() || is_special_endpoint(endpoint_id.value()) || !on_async_call_queued)
+        return false;
+    uint16_t handle = async_calls.start(endpoint_id.value());
+    if (handle)
+        on_async_call_queued();
+    return write_le<uint16_t>(handle, output_buffer);
+}
+
+// Returns the status (8 bit, AsyncCallQueue::Status) of the call with the
+// handle (16 bit) in the input.
+bool fibre::async_status_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    std::optional<uint16_t> handle = read_le<uint16_t>(input_buffer);
+    if (!handle.has_value())
+        return false;
+    return write_le<uint8_t>(async_calls.status(handle.value()), output_buffer);
+}
+
+// Runs the oldest queued asynchronous call. Returns false if there was none.
+bool fibre::run_next_async_call() {
+    return async_calls.run_next([](uint16_t endpoint_id) {
+        fibre::cbufptr_t input_buffer;
+        fibre::bufptr_t output_buffer;
+        return fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+    });
+}
+
 int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_t length) {
     LOG_FIBRE("got packet of length %d: \r\n", length);
     hexdump(buffer, length);
-    if (length < 4)
+    uint32_t start_time = fibre::get_time_us ? fibre::get_time_us() : 0;
+    ++stats_.rx_packets;
+    if (length < 4) {
+        ++stats_.rx_invalid;
         return -1;
+    }
 
     uint16_t seq_no = read_le<uint16_t>(&buffer, &length);
 
@@ -156,6 +299,7 @@ int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_
         uint16_t actual_trailer = buffer[length - 2] | (buffer[length - 1] << 8);
         if (expected_trailer != actual_trailer) {
             LOG_FIBRE("trailer mismatch for endpoint %d: expected %04x, got %04x\r\n", endpoint_id, expected_trailer, actual_trailer);
+            ++stats_.rx_invalid;
             return -1;
         }
         LOG_FIBRE("trailer ok for endpoint %d\r\n", endpoint_id);
@@ -165,12 +309,26 @@ int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_
         uint16_t expected_response_length = read_le<uint16_t>(&buffer, &length);
 
         // Limit response length according to our local TX buffer size
-        if (expected_response_length > sizeof(tx_buf_) - 2)
+        if (expected_response_length > sizeof(tx_buf_) - 2) {
             expected_response_length = sizeof(tx_buf_) - 2;
+            ++stats_.truncated_responses;
+        }
 
         fibre::cbufptr_t input_buffer{buffer, length - 2};
         fibre::bufptr_t output_buffer{tx_buf_ + 2, expected_response_length};
-        fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+        if (endpoint_id == BATCH_ENDPOINT_ID) {
+            ++stats_.batch_requests;
+            fibre::batch_handler(&input_buffer, &output_buffer);
+        } else if (endpoint_id == ASYNC_CALL_ENDPOINT_ID) {
+            ++stats_.async_call_requests;
+            fibre::async_call_handler(&input_buffer, &output_buffer);
+        } else if (endpoint_id == ASYNC_STATUS_ENDPOINT_ID) {
+            ++stats_.async_status_requests;
+            fibre::async_status_handler(&input_buffer, &output_buffer);
+        } else {
+            ++stats_.endpoint_requests;
+            fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+        }
 
         // Send response
         if (expect_response) {
@@ -179,8 +337,11 @@ int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_
 
             LOG_FIBRE("send packet:\r\n");
             hexdump(tx_buf_, actual_response_length);
-            output_.process_packet(tx_buf_, actual_response_length);
+            if (output_.process_packet(tx_buf_, actual_response_length) != 0)
+                ++stats_.dropped_responses;
         }
+        if (fibre::get_time_us)
+            stats_.add_process_time(fibre::get_time_us() - start_time);
     }
 
     return 0;
@@ -0,0 +1,137 @@
+/*
+ * Optional native implementation of the hot paths of fibre.protocol: the
+ * CRCs and the segmentation of a byte stream into packets.
+ * fibre.protocol falls back to its pure Python implementation of the same
+ * functions if this module is not built.
+ *
+ * See protocol.md for the packet format and the CRC algorithm.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+
+#define SYNC_BYTE 0xAA
+#define CRC8_INIT 0x42
+#define CRC16_INIT 0x1337
+#define CRC8_POLYNOMIAL 0x37 /* must match CRC8_DEFAULT in protocol.py */
+#define CRC16_POLYNOMIAL 0x3d65 /* must match CRC16_DEFAULT in protocol.py */
+
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+
+static void init_tables(void) {
+    for (unsigned i = 0; i < 256; ++i) {
+        uint8_t crc8 = (uint8_t)i;
+        uint16_t crc16 = (uint16_t)(i << 8);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc8 = (crc8 & 0x80) ? (uint8_t)((crc8 << 1) ^ CRC8_POLYNOMIAL) : (uint8_t)(crc8 << 1);
+            crc16 = (crc16 & 0x8000) ? (uint16_t)((crc16 << 1) ^ CRC16_POLYNOMIAL) : (uint16_t)(crc16 << 1);
+        }
+        crc8_table[i] = crc8;
+        crc16_table[i] = crc16;
+    }
+}
+
+static uint8_t crc8(uint8_t remainder, const uint8_t* data, Py_ssize_t length) {
+    for (Py_ssize_t i = 0; i < length; ++i)
+        remainder = crc8_table[remainder ^ data[i]];
+    return remainder;
+}
+
+static uint16_t crc16(uint16_t remainder, const uint8_t* data, Py_ssize_t length) {
+    for (Py_ssize_t i = 0; i < length; ++i)
+        remainder = (uint16_t)((remainder << 8) ^ crc16_table[(remainder >> 8) ^ data[i]]);
+    return remainder;
+}
+
+static PyObject* native_calc_crc8(PyObject* self, PyObject* args) {
+    unsigned int remainder;
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "Iy*", &remainder, &data))
+        return NULL;
+    uint8_t result = crc8((uint8_t)remainder, (const uint8_t*)data.buf, data.len);
+    PyBuffer_Release(&data);
+    return PyLong_FromUnsignedLong(result);
+}
+
+static PyObject* native_calc_crc16(PyObject* self, PyObject* args) {
+    unsigned int remainder;
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "Iy*", &remainder, &data))
+        return NULL;
+    uint16_t result = crc16((uint16_t)remainder, (const uint8_t*)data.buf, data.len);
+    PyBuffer_Release(&data);
+    return PyLong_FromUnsignedLong(result);
+}
+
+static PyObject* native_split_packets(PyObject* self, PyObject* args) {
+    Py_buffer buffer;
+    if (!PyArg_ParseTuple(args, "y*", &buffer))
+        return NULL;
+    const uint8_t* data = (const uint8_t*)buffer.buf;
+    Py_ssize_t length = buffer.len;
+
+    PyObject* packets = PyList_New(0);
+    if (!packets) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    Py_ssize_t offset = 0;
+    while (offset < length) {
+        if (data[offset] != SYNC_BYTE) {
+            offset++;
+            continue;
+        }
+        if (offset + 2 > length)
+            break;
+        Py_ssize_t header_length = (data[offset + 1] & 0x80) ? 4 : 3;
+        if (offset + header_length > length)
+            break;
+        if (crc8(CRC8_INIT, data + offset, header_length)) {
+            offset++; /* not a header, resync on the next sync byte */
+            continue;
+        }
+        Py_ssize_t packet_length = (header_length == 4)
+                ? (((Py_ssize_t)(data[offset + 1] & 0x7f) << 8) | data[offset + 2])
+                : data[offset + 1];
+        if (offset + header_length + packet_length + 2 > length)
+            break;
+
+        const uint8_t* packet = data + offset + header_length;
+        if (crc16(CRC16_INIT, packet, packet_length + 2) == 0) {
+            PyObject* item = PyBytes_FromStringAndSize((const char*)packet, packet_length);
+            if (!item || PyList_Append(packets, item)) {
+                Py_XDECREF(item);
+                Py_DECREF(packets);
+                PyBuffer_Release(&buffer);
+                return NULL;
+            }
+            Py_DECREF(item);
+        }
+        offset += header_length + packet_length + 2;
+    }
+
+    PyBuffer_Release(&buffer);
+    return Py_BuildValue("(Nn)", packets, offset);
+}
+
+static PyMethodDef native_methods[] = {
+    {"calc_crc8", native_calc_crc8, METH_VARARGS, "calc_crc8(remainder, data) -> int"},
+    {"calc_crc16", native_calc_crc16, METH_VARARGS, "calc_crc16(remainder, data) -> int"},
+    {"split_packets", native_split_packets, METH_VARARGS,
+        "split_packets(buffer) -> (packets, consumed)\n"
+        "Returns the payloads of the complete packets in the byte stream with a\n"
+        "valid CRC and the number of bytes up to the first incomplete packet."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef native_module = {
+    PyModuleDef_HEAD_INIT, "fibre._native", NULL, -1, native_methods
+};
+
+PyMODINIT_FUNC PyInit__native(void) {
+    init_tables();
+    return PyModule_Create(&native_module);
+}
@@ -0,0 +1,210 @@
+# requires python-can
+#   pip install python-can
+
+import can
+import queue
+import threading
+import time
+import traceback
+import fibre.protocol
+from fibre.utils import TimeoutError, wait_any
+
+# Must match CANFibre in Firmware/communication/can_fibre.hpp
+BASE_ID = 0x1FFFFE00
+MAX_NODE_ID = 0xFF
+TIMEOUT = 1.0 # [s] N_Bs, N_Cr
+
+PCI_SINGLE_FRAME = 0x00
+PCI_FIRST_FRAME = 0x10
+PCI_CONSECUTIVE_FRAME = 0x20
+PCI_FLOW_CONTROL = 0x30
+
+FLOW_CONTINUE = 0
+FLOW_WAIT = 1
+FLOW_OVERFLOW = 2
+
+def get_separation_time(st_min):
+  """Decodes the ISO-TP minimum separation time in seconds"""
+  if st_min <= 0x7f:
+    return st_min / 1000
+  elif 0xf1 <= st_min <= 0xf9:
+    return (st_min - 0xf0) / 10000
+  else:
+    return 0.127 # reserved values mean the maximum
+
+class CanBus():
+  """
+  One python-can bus, shared by the channels to all ODrives on it. The
+  receiver thread passes the frames to the channel they are addressed to.
+  """
+  _buses = {}
+  _buses_lock = threading.Lock()
+
+  @classmethod
+  def get(cls, interface, channel, logger):
+    with cls._buses_lock:
+      if not (interface, channel) in cls._buses:
+        cls._buses[(interface, channel)] = CanBus(interface, channel, logger)
+      return cls._buses[(interface, channel)]
+
+  def __init__(self, interface, channel, logger):
+    self._logger = logger
+    self.bus = can.interface.Bus(bustype=interface, channel=channel)
+    self._send_lock = threading.Lock()
+    self._handlers = {}
+    t = threading.Thread(target=self._receiver_thread)
+    t.daemon = True
+    t.start()
+
+  def add_handler(self, can_id, handler):
+    self._handlers[can_id] = handler
+
+  def send(self, can_id, data):
+    msg = can.Message(arbitration_id=can_id, is_extended_id=True, data=data)
+    try:
+      with self._send_lock:
+        self.bus.send(msg)
+    except can.CanError:
+      raise fibre.protocol.ChannelDamagedException()
+
+  def _receiver_thread(self):
+    while True:
+      msg = self.bus.recv(1.0)
+      if msg is None or not msg.is_extended_id or msg.is_remote_frame:
+        continue
+      handler = self._handlers.get(msg.arbitration_id, None)
+      if handler is None:
+        continue
+      try:
+        handler(msg.data)
+      except Exception:
+        self._logger.debug("error in can_transport.py, receiver thread: " + traceback.format_exc())
+
+class CanTransport(fibre.protocol.PacketSource, fibre.protocol.PacketSink):
+  """
+  Segments the fibre packets to one ODrive like ISO-TP (ISO 15765-2), the
+  frame format is described in can_fibre.hpp.
+  """
+  def __init__(self, bus, node_id, logger):
+    self._logger = logger
+    self._bus = bus
+    self._request_id = BASE_ID + 2 * node_id
+    self._packets = queue.Queue()
+    self._flow_control = queue.Queue()
+    self._rx = None # (data, length, next sequence number) while receiving
+    bus.add_handler(BASE_ID + 2 * node_id + 1, self._handle_frame)
+
+  def process_packet(self, packet):
+    packet = bytes(packet)
+    if len(packet) <= 7:
+      self._bus.send(self._request_id, bytes([PCI_SINGLE_FRAME | len(packet)]) + packet)
+      return
+    if len(packet) > 0xfff:
+      raise Exception("packet larger than 4095 bytes not supported")
+
+    # Drop flow control frames left over from an aborted transfer
+    while not self._flow_control.empty():
+      self._flow_control.get_nowait()
+
+    self._bus.send(self._request_id, bytes([PCI_FIRST_FRAME | (len(packet) >> 8), len(packet) & 0xff]) + packet[:6])
+    offset = 6
+    seq = 1
+    block_size = 0
+    block_count = 0
+    separation_time = 0
+    wait_flow_control = True
+    while offset < len(packet):
+      if wait_flow_control:
+        try:
+          flag, block_size, st_min = self._flow_control.get(timeout=TIMEOUT)
+        except queue.Empty:
+          raise TimeoutError()
+        if flag == FLOW_WAIT:
+          continue
+        elif flag != FLOW_CONTINUE:
+          raise fibre.protocol.ChannelDamagedException()
+        separation_time = get_separation_time(st_min)
+        block_count = 0
+        wait_flow_control = False
+
+      chunk = packet[offset:offset+7]
+      self._bus.send(self._request_id, bytes([PCI_CONSECUTIVE_FRAME | (seq & 0x0f)]) + chunk)
+      offset += len(chunk)
+      seq += 1
+      block_count += 1
+      if block_size and block_count >= block_size:
+        wait_flow_control = True
+      elif offset < len(packet) and separation_time:
+        time.sleep(separation_time)
+
+  def get_packet(self, deadline):
+    try:
+      return self._packets.get(timeout=max(deadline - time.monotonic(), 0))
+    except queue.Empty:
+      raise TimeoutError()
+
+  def _handle_frame(self, data):
+    if len(data) < 1:
+      return
+    pci = data[0] & 0xf0
+    if pci == PCI_SINGLE_FRAME:
+      length = data[0] & 0x0f
+      self._rx = None
+      if 0 < length < len(data):
+        self._packets.put(bytes(data[1:1+length]))
+    elif pci == PCI_FIRST_FRAME and len(data) == 8:
+      length = ((data[0] & 0x0f) << 8) | data[1]
+      self._rx = (bytearray(data[2:]), length, 1)
+      self._bus.send(self._request_id, bytes([PCI_FLOW_CONTROL | FLOW_CONTINUE, 0, 0]))
+    elif pci == PCI_CONSECUTIVE_FRAME and not self._rx is None:
+      buf, length, seq = self._rx
+      if (data[0] & 0x0f) != (seq & 0x0f):
+        self._rx = None # lost a frame
+        return
+      buf += data[1:]
+      if len(buf) >= length:
+        self._rx = None
+        self._packets.put(bytes(buf[:length]))
+      else:
+        self._rx = (buf, length, seq + 1)
+    elif pci == PCI_FLOW_CONTROL and len(data) >= 3:
+      self._flow_control.put((data[0] & 0x0f, data[1], data[2]))
+
+
+def discover_channels(path, serial_number, callback, cancellation_token, channel_termination_token, logger):
+  """
+  Connects to the ODrive with the fibre node ID on the CAN bus given by the
+  path spec, for example "socketcan:can0:1" for node 1 on can0. The node ID
+  defaults to 0. The python-can interface must be configured for the baud rate
+  of the bus, see the python-can documentation.
+  This function blocks until cancellation_token is set.
+  Channels spawned by this function run until channel_termination_token is set.
+  """
+  try:
+    parts = path.split(":")
+    interface = parts[0]
+    channel_name = parts[1]
+    node_id = int(parts[2], 0) if len(parts) > 2 else 0
+    if not 0 <= node_id <= MAX_NODE_ID:
+      raise ValueError()
+  except (ValueError, IndexError):
+    raise Exception('"{}" is not a valid CAN path specification. Expected a string '
+                    'of the format INTERFACE:CHANNEL[:NODE_ID], for example "socketcan:can0:1".'
+                    .format(path))
+
+  while not cancellation_token.is_set():
+    try:
+      bus = CanBus.get(interface, channel_name, logger)
+      can_transport = CanTransport(bus, node_id, logger)
+      channel = fibre.protocol.Channel(
+              "CAN node {} on {}:{}".format(node_id, interface, channel_name),
+              can_transport, can_transport,
+              channel_termination_token, logger,
+              window_size=1) # the ODrive sends one response at a time
+    except:
+      logger.debug("CAN channel init failed. More info: " + traceback.format_exc())
+      pass
+    else:
+      callback(channel)
+      wait_any(None, cancellation_token, channel._channel_broken)
+    time.sleep(1)
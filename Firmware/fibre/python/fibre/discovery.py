@@ -8,6 +8,7 @@ import time
 import threading
 import traceback
 import struct
+import zlib
 import fibre.protocol
 import fibre.utils
 import fibre.remote_object
@@ -44,9 +45,106 @@ try:
 except ImportError:
     pass
 
+try:
+    import fibre.can_transport
+    channel_types['can'] = fibre.can_transport.discover_channels
+except ImportError:
+    pass
+
 def noprint(text):
     pass
 
+# Interface descriptors that were already loaded by this process, indexed by
+# the JSON version tag of the device. Devices that are discovered at the same
+# time and report the same tag share one download.
+_json_cache = {}
+_json_cache_locks = {}
+_json_cache_lock = threading.Lock()
+
+def _load_json(channel, logger):
+    """
+    Returns the interface descriptor of the device on the given channel and
+    its CRC16, either from the cache or from the device itself.
+    """
+    cache_dir = appdirs.user_cache_dir("odrivetool")
+    cache_path = None
+    json_version_tag = None
+
+    # Fetch the json version tag to check cache (only supported on firmware v0.5 or later)
+    try:
+        json_version_tag = channel.remote_endpoint_operation(0, struct.pack("<I", 0xffffffff), True, 4)
+        json_version_tag = struct.unpack("<I", json_version_tag)[0]
+
+        logger.debug("Device reported JSON version ID: {:08d}".format(json_version_tag))
+        cache_path = os.path.join(cache_dir, 'fibre_schema_cache_{:08d}'.format(json_version_tag))
+    except:
+        logger.debug("Failed to get JSON checksum")
+        return _download_json(channel, None, None, logger)
+
+    with _json_cache_lock:
+        if json_version_tag in _json_cache:
+            return _json_cache[json_version_tag]
+        tag_lock = _json_cache_locks.setdefault(json_version_tag, threading.Lock())
+
+    with tag_lock:
+        # Another device with the same tag may have loaded it in the meantime
+        if json_version_tag in _json_cache:
+            return _json_cache[json_version_tag]
+
+        # Check cache
+        result = None
+        try:
+            with open(cache_path, 'rb') as fp:
+                json_bytes = fp.read()
+                result = (json.loads(json_bytes.decode("ascii")),
+                          fibre.protocol.calc_crc16(fibre.protocol.PROTOCOL_VERSION, json_bytes))
+        except:
+            logger.debug("Failed load JSON cache file {}".format(cache_path))
+
+        # Fallback to loading JSON from device
+        if result is None:
+            result = _download_json(channel, cache_dir, cache_path, logger)
+
+        _json_cache[json_version_tag] = result
+        return result
+
+def _download_json(channel, cache_dir, cache_path, logger):
+    # Downloading json data
+    logger.info("Downloading json data from ODrive... (this might take a while)")
+    # Older firmware ignores the format and sends the plain JSON
+    json_bytes = channel.remote_endpoint_read_buffer(0, struct.pack("<B", fibre.protocol.JSON_FORMAT_ZLIB))
+    if json_bytes[:1] != b'[':
+        try:
+            json_bytes = zlib.decompress(json_bytes)
+        except zlib.error:
+            logger.debug("Device responded on endpoint 0 with corrupt compressed JSON")
+            raise
+    try:
+        json_string = json_bytes.decode("ascii")
+    except UnicodeDecodeError:
+        logger.debug("Device responded on endpoint 0 with something that is not ASCII")
+        raise UnicodeDecodeError
+
+    json_crc16 = fibre.protocol.calc_crc16(fibre.protocol.PROTOCOL_VERSION, json_bytes)
+    json_data = json.loads(json_string)
+
+    # Save JSON to cache
+    if not cache_path is None:
+        logger.debug("Creating new JSON cache file {}".format(cache_path))
+        try:
+            os.makedirs(cache_dir, exist_ok=True)
+            # Write to a temporary file first so that other processes never
+            # read a partial file
+            temp_path = "{}.{}.tmp".format(cache_path, os.getpid())
+            with open(temp_path, 'w+') as json_cache:
+                json_cache.write(json_string)
+            os.replace(temp_path, cache_path)
+            logger.debug("Saved JSON to cache file {}".format(cache_path))
+        except Exception as ex:
+            logger.warn("Failed to cache JSON: {}".format(ex))
+
+    return json_data, json_crc16
+
 def find_all(path, serial_number,
          did_discover_object_callback,
          search_cancellation_token,
@@ -55,10 +153,12 @@ def find_all(path, serial_number,
     """
     Starts scanning for Fibre nodes that match the specified path spec and calls
     the callback for each Fibre node that is found.
+    Each discovered device is initialized on a thread of its own, so the
+    callback may be called from several threads at the same time.
     This function is non-blocking.
     """
 
-    def did_discover_channel(channel):
+    def init_object(channel):
         """
         Inits an object from a given channel and then calls did_discover_object_callback
         with the created object
@@ -68,54 +168,7 @@ def find_all(path, serial_number,
         try:
             logger.debug("Connecting to device on " + channel._name)
 
-            cache_dir = appdirs.user_cache_dir("odrivetool")
-            cache_path = None
-
-            # Fetch the json version tag to check cache (only supported on firmware v0.5 or later)
-            try:
-                json_version_tag = channel.remote_endpoint_operation(0, struct.pack("<I", 0xffffffff), True, 4)
-                json_version_tag = struct.unpack("<I", json_version_tag)[0]
-
-                logger.debug("Device reported JSON version ID: {:08d}".format(json_version_tag))
-                cache_path = os.path.join(cache_dir, 'fibre_schema_cache_{:08d}'.format(json_version_tag))
-            except:
-                logger.debug("Failed to get JSON checksum")
-
-            # Check cache
-            json_data = None
-            try:
-                if not cache_path is None:
-                    with open(cache_path, 'rb') as fp:
-                        json_crc16 = fibre.protocol.calc_crc16(fibre.protocol.PROTOCOL_VERSION, fp.read())
-                        fp.seek(0)
-                        json_data = json.load(fp)
-            except:
-                logger.debug("Failed load JSON cache file {}".format(cache_path))
-
-            # Fallback to loading JSON from device
-            if json_data is None:
-                # Downloading json data
-                logger.info("Downloading json data from ODrive... (this might take a while)")
-                json_bytes = channel.remote_endpoint_read_buffer(0)
-                try:
-                    json_string = json_bytes.decode("ascii")
-                except UnicodeDecodeError:
-                    logger.debug("Device responded on endpoint 0 with something that is not ASCII")
-                    raise UnicodeDecodeError
-
-                json_crc16 = fibre.protocol.calc_crc16(fibre.protocol.PROTOCOL_VERSION, json_bytes)
-                json_data = json.loads(json_string)
-
-                # Save JSON to cache
-                if not cache_path is None:
-                    logger.debug("Creating new JSON cache file {}".format(cache_path))
-                    try:
-                        os.makedirs(cache_dir, exist_ok=True)
-                        with open(cache_path, 'w+') as json_cache:
-                            json_cache.write(json_string)
-                        logger.debug("Saved JSON to cache file {}".format(cache_path))
-                    except Exception as ex:
-                        logger.warn("Failed to cache JSON: {}".format(ex))
+            json_data, json_crc16 = _load_json(channel, logger)
 
             channel._interface_definition_crc = json_crc16
 
@@ -138,6 +191,13 @@ def find_all(path, serial_number,
         except Exception:
             logger.debug("Unexpected exception after discovering channel: " + traceback.format_exc())
 
+    def did_discover_channel(channel):
+        # Don't hold up the discovery loop of the transport while this device
+        # is initialized, other devices can be initialized in parallel
+        t = threading.Thread(target=init_object, args=(channel,))
+        t.daemon = True
+        t.start()
+
     # For each connection type, kick off an appropriate discovery loop
     for search_spec in path.split(','):
         prefix = search_spec.split(':')[0]
@@ -158,11 +218,16 @@ def find_any(path="usb", serial_number=None,
     Blocks until the first matching Fibre node is connected and then returns that node
     """
     result = []
+    result_lock = threading.Lock()
     done_signal = Event(search_cancellation_token)
     def did_discover_object(obj):
-        result.append(obj)
+        with result_lock:
+            if done_signal.is_set():
+                return
+            result.append(obj)
+            count = len(result)
         if find_multiple:
-            if len(result) >= int(find_multiple):
+            if count >= int(find_multiple):
                done_signal.set()
         else:
             done_signal.set()
@@ -5,8 +5,9 @@ import struct
 import sys
 import threading
 import traceback
+from concurrent.futures import Future
 #import fibre.utils
-from fibre.utils import Event, wait_any, TimeoutError
+from fibre.utils import Event, TimeoutError
 
 import abc
 if sys.version_info >= (3, 4):
@@ -26,7 +27,27 @@ PROTOCOL_VERSION = 1
 CRC8_DEFAULT = 0x37 # this must match the polynomial in the C++ implementation
 CRC16_DEFAULT = 0x3d65 # this must match the polynomial in the C++ implementation
 
-MAX_PACKET_SIZE = 128
+MAX_SHORT_PACKET_SIZE = 127 # longer packets use the long stream header with a 15 bit length
+MAX_PACKET_SIZE = 0x7fff
+
+TELEMETRY_SEQ_NO = 0x7fff # must match Telemetry::telemetry_seq_no in the firmware
+NOTIFICATION_SEQ_NO = 0x7ffe # must match Subscriptions::notification_seq_no in the firmware
+
+BATCH_ENDPOINT_ID = 0x7fff # must match BATCH_ENDPOINT_ID in protocol.hpp
+MAX_BATCH_INPUT = 127 # limited by remote_endpoint_operation
+MAX_BATCH_OUTPUT = 62 # TX_BUF_SIZE - 2 in the firmware
+
+# Must match ASYNC_CALL_ENDPOINT_ID, ASYNC_STATUS_ENDPOINT_ID and
+# AsyncCallQueue::Status in the firmware
+ASYNC_CALL_ENDPOINT_ID = 0x7ffe
+ASYNC_STATUS_ENDPOINT_ID = 0x7ffd
+ASYNC_STATUS_UNKNOWN = 0
+ASYNC_STATUS_QUEUED = 1
+ASYNC_STATUS_RUNNING = 2
+ASYNC_STATUS_DONE = 3
+ASYNC_STATUS_FAILED = 4
+
+JSON_FORMAT_ZLIB = 1 # must match JSON_FORMAT_ZLIB in protocol.hpp
 
 # For more information on the CRC algorithm refer to protocol.md
 
@@ -43,26 +64,83 @@ def calc_crc(remainder, value, polynomial, bitwidth):
 
     return remainder & ((1 << bitwidth) - 1)
 
-def calc_crc8(remainder, value):
-    if isinstance(value, bytearray) or isinstance(value, bytes) or isinstance(value, list):
-        for byte in value:
-            if not isinstance(byte,int):
-                byte = ord(byte)
-            remainder = calc_crc(remainder, byte, CRC8_DEFAULT, 8)
-    else:
-        remainder = calc_crc(remainder, byte, CRC8_DEFAULT, 8)
+def _make_crc_table(polynomial, bitwidth):
+    return [calc_crc(0, i, polynomial, bitwidth) for i in range(256)]
+
+_CRC8_TABLE = _make_crc_table(CRC8_DEFAULT, 8)
+_CRC16_TABLE = _make_crc_table(CRC16_DEFAULT, 16)
+
+def _py_crc8(remainder, data):
+    table = _CRC8_TABLE
+    for byte in data:
+        remainder = table[remainder ^ byte]
     return remainder
 
-def calc_crc16(remainder, value):
-    if isinstance(value, bytearray) or isinstance(value, bytes) or isinstance(value, list):
-        for byte in value:
-            if not isinstance(byte, int):
-                byte = ord(byte)
-            remainder = calc_crc(remainder, byte, CRC16_DEFAULT, 16)
-    else:
-        remainder = calc_crc(remainder, value, CRC16_DEFAULT, 16)
+def _py_crc16(remainder, data):
+    table = _CRC16_TABLE
+    for byte in data:
+        remainder = ((remainder << 8) & 0xffff) ^ table[(remainder >> 8) ^ byte]
     return remainder
 
+def _py_split_packets(buffer):
+    """
+    Splits a byte stream into packets. Returns the payloads of all complete
+    packets with a valid CRC and the number of bytes that were consumed, which
+    ends at the first incomplete packet.
+    """
+    packets = []
+    offset = 0
+    length = len(buffer)
+    while offset < length:
+        if buffer[offset] != SYNC_BYTE:
+            offset += 1
+            continue
+        if offset + 2 > length:
+            break
+        header_length = 4 if buffer[offset + 1] & 0x80 else 3
+        if offset + header_length > length:
+            break
+        header = buffer[offset:offset + header_length]
+        if _crc8(CRC8_INIT, header):
+            offset += 1 # not a header, resync on the next sync byte
+            continue
+        end = offset + header_length + get_packet_length(header) + 2
+        if end > length:
+            break
+        packet = bytes(buffer[offset + header_length:end])
+        if _crc16(CRC16_INIT, packet) == 0:
+            packets.append(packet[:-2])
+        offset = end
+    return packets, offset
+
+# The native module is optional, it is built along with the package if a C
+# compiler is available.
+try:
+    from fibre._native import calc_crc8 as _crc8, calc_crc16 as _crc16, split_packets
+    NATIVE = True
+except ImportError:
+    _crc8, _crc16, split_packets = _py_crc8, _py_crc16, _py_split_packets
+    NATIVE = False
+
+def _as_bytes(value):
+    if isinstance(value, (bytes, bytearray)):
+        return value
+    if isinstance(value, int):
+        return bytes([value])
+    return bytes(byte if isinstance(byte, int) else ord(byte) for byte in value)
+
+def calc_crc8(remainder, value):
+    return _crc8(remainder, _as_bytes(value))
+
+def calc_crc16(remainder, value):
+    return _crc16(remainder, _as_bytes(value))
+
+
+def get_packet_length(header):
+    """Returns the packet length from a short (3 byte) or long (4 byte) stream header"""
+    if header[1] & 0x80:
+        return ((header[1] & 0x7f) << 8) | header[2]
+    return header[1]
 
 class DeviceInitException(Exception):
     pass
@@ -104,9 +182,7 @@ class PacketSink(ABC):
 
 class StreamToPacketSegmenter(StreamSink):
     def __init__(self, output):
-        self._header = []
-        self._packet = []
-        self._packet_length = 0
+        self._buffer = bytearray()
         self._output = output
 
     def process_bytes(self, bytes):
@@ -116,29 +192,11 @@ class StreamToPacketSegmenter(StreamSink):
         Incomplete packets are buffered between subsequent calls to this function.
         """
 
-        for byte in bytes:
-            if (len(self._header) < 3):
-                # Process header byte
-                self._header.append(byte)
-                if (len(self._header) == 1) and (self._header[0] != SYNC_BYTE):
-                    self._header = []
-                elif (len(self._header) == 2) and (self._header[1] & 0x80):
-                    self._header = [] # TODO: support packets larger than 128 bytes
-                elif (len(self._header) == 3) and calc_crc8(CRC8_INIT, self._header):
-                    self._header = []
-                elif (len(self._header) == 3):
-                    self._packet_length = self._header[1] + 2
-            else:
-                # Process payload byte
-                self._packet.append(byte)
-
-            # If both header and packet are fully received, hand it on to the packet processor
-            if (len(self._header) == 3) and (len(self._packet) == self._packet_length):
-                if calc_crc16(CRC16_INIT, self._packet) == 0:
-                    self._output.process_packet(self._packet[:-2])
-                self._header = []
-                self._packet = []
-                self._packet_length = 0
+        self._buffer += bytes
+        packets, consumed = split_packets(self._buffer)
+        del self._buffer[:consumed]
+        for packet in packets:
+            self._output.process_packet(packet)
 
 
 class StreamBasedPacketSink(PacketSink):
@@ -146,12 +204,16 @@ class StreamBasedPacketSink(PacketSink):
         self._output = output
 
     def process_packet(self, packet):
-        if (len(packet) >= MAX_PACKET_SIZE):
-            raise NotImplementedError("packet larger than 127 currently not supported")
+        if (len(packet) > MAX_PACKET_SIZE):
+            raise NotImplementedError("packet larger than {} not supported".format(MAX_PACKET_SIZE))
 
         header = bytearray()
         header.append(SYNC_BYTE)
-        header.append(len(packet))
+        if len(packet) <= MAX_SHORT_PACKET_SIZE:
+            header.append(len(packet))
+        else:
+            header.append(0x80 | (len(packet) >> 8))
+            header.append(len(packet) & 0xff)
         header.append(calc_crc8(CRC8_INIT, header))
 
         self._output.process_bytes(header)
@@ -182,15 +244,14 @@ class PacketFromStreamConverter(PacketSource):
 
             header = header + self._input.get_bytes_or_fail(1, deadline)
             if (header[1] & 0x80):
-                #print("packet too large")
-                continue # TODO: support packets larger than 128 bytes
+                header = header + self._input.get_bytes_or_fail(1, deadline) # long header
 
             header = header + self._input.get_bytes_or_fail(1, deadline)
             if calc_crc8(CRC8_INIT, header) != 0:
                 #print("crc8 mismatch")
                 continue
 
-            packet_length = header[1] + 2
+            packet_length = get_packet_length(header) + 2
             #print("wait for {} bytes".format(packet_length))
             packet = self._input.get_bytes_or_fail(packet_length, deadline)
             if calc_crc16(CRC16_INIT, packet) != 0:
@@ -199,18 +260,82 @@ class PacketFromStreamConverter(PacketSource):
             return packet[:-2]
 
 
+class Batch():
+    """
+    Collects endpoint operations and runs them with as few requests as
+    possible when the with block is left or flush() is called. Within the
+    with block, property reads and function calls return futures for their
+    result instead of the value.
+    """
+    def __init__(self, channel):
+        self._channel = channel
+        self._operations = []
+        self._futures = []
+        self._outer = None
+
+    def add(self, endpoint_id, input, output_length, decode=None):
+        """
+        Adds an endpoint operation, returns a future for its output, which is
+        passed through decode if given
+        """
+        future = Future()
+        self._operations.append((endpoint_id, input, output_length))
+        self._futures.append((future, decode))
+        return future
+
+    def flush(self):
+        operations, futures = self._operations, self._futures
+        self._operations, self._futures = [], []
+        if not operations:
+            return
+        try:
+            results = self._channel.remote_endpoint_batch(operations)
+        except Exception as ex:
+            for future, decode in futures:
+                future.set_exception(ex)
+            raise
+        for (endpoint_id, input, output_length), (future, decode), result in zip(operations, futures, results):
+            if result is None:
+                future.set_exception(Exception("endpoint {} rejected the operation".format(endpoint_id)))
+            else:
+                future.set_result(decode(result) if decode else result)
+
+    def __enter__(self):
+        self._outer = self._channel.get_batch()
+        self._channel._batch_local.batch = self
+        return self
+
+    def __exit__(self, exc_type, exc_value, tb):
+        self._channel._batch_local.batch = self._outer
+        if exc_type is None:
+            self.flush()
+
+
+class PendingRequest():
+    """A request that waits for its response"""
+    def __init__(self, packet, decode):
+        self.packet = packet
+        self.decode = decode
+        self.future = Future()
+        self.attempt = 0
+        self.deadline = None # [time.monotonic()] of the next resend
+
+
 class Channel(PacketSink):
     # Choose these parameters to be sensible for a specific transport layer
     _resend_timeout = 5.0     # [s]
     _send_attempts = 5
+    window_size = 8           # maximum number of requests waiting for their response
 
-    def __init__(self, name, input, output, cancellation_token, logger):
+    def __init__(self, name, input, output, cancellation_token, logger, window_size=None):
         """
         Params:
         input: A PacketSource where this channel will source packets from on
                demand. Alternatively packets can be provided to this channel
                directly by calling process_packet on this instance.
         output: A PacketSink where this channel will put outgoing packets.
+        window_size: Overrides the maximum number of requests in flight, for
+               transports where the device can't queue incoming requests.
         """
         self._name = name
         self._input = input
@@ -218,11 +343,18 @@ class Channel(PacketSink):
         self._logger = logger
         self._outbound_seq_no = 0
         self._interface_definition_crc = 0
-        self._expected_acks = {}
-        self._responses = {}
+        self._pending = {} # seq_no: PendingRequest
+        self._pending_cond = threading.Condition()
+        if not window_size is None:
+            self.window_size = window_size
         self._my_lock = threading.Lock()
+        self._batch_local = threading.local() # the active Batch of each thread
         self._channel_broken = Event(cancellation_token)
+        self.telemetry_handler = None # called with the payload of telemetry packets
+        self.notification_handler = None # called with the payload of notification packets
+        self._channel_broken.subscribe(self._fail_pending_requests)
         self.start_receiver_thread(Event(self._channel_broken))
+        self.start_resend_thread(Event(self._channel_broken))
 
     def start_receiver_thread(self, cancellation_token):
         """
@@ -258,7 +390,37 @@ class Channel(PacketSink):
         t.daemon = True
         t.start()
 
+    def start_resend_thread(self, cancellation_token):
+        """
+        Starts the thread that resends the requests whose response is overdue.
+        """
+        def resend_thread():
+            while not cancellation_token.is_set():
+                with self._pending_cond:
+                    now = time.monotonic()
+                    overdue = [(seq_no, request) for seq_no, request in self._pending.items() if request.deadline <= now]
+                    if not overdue:
+                        timeout = min([request.deadline for request in self._pending.values()] + [now + 1.0]) - now
+                        self._pending_cond.wait(timeout)
+                        continue
+                for seq_no, request in overdue:
+                    self._send_request(seq_no, request)
+        t = threading.Thread(target=resend_thread)
+        t.daemon = True
+        t.start()
+
     def remote_endpoint_operation(self, endpoint_id, input, expect_ack, output_length):
+        future = self.remote_endpoint_operation_async(endpoint_id, input, expect_ack, output_length)
+        return None if future is None else future.result()
+
+    def remote_endpoint_operation_async(self, endpoint_id, input, expect_ack, output_length, decode=None):
+        """
+        Sends the request without waiting for the response and returns a
+        concurrent.futures.Future for the response payload, which is passed
+        through decode if given. Returns None if expect_ack is False.
+        Blocks while window_size requests are waiting for their response.
+        Use asyncio.wrap_future() to await the result in a coroutine.
+        """
         if input is None:
             input = bytearray(0)
         if (len(input) >= 128):
@@ -285,53 +447,158 @@ class Channel(PacketSink):
         #print("append trailer " + trailer)
         packet = packet + struct.pack('<H', trailer)
 
-        if (expect_ack):
-            ack_event = Event()
-            self._expected_acks[seq_no] = ack_event
-            try:
-                attempt = 0
-                while (attempt < self._send_attempts):
-                    self._my_lock.acquire()
-                    try:
-                        self._output.process_packet(packet)
-                    except ChannelDamagedException:
-                        attempt += 1
-                        continue # resend
-                    except TimeoutError:
-                        attempt += 1
-                        continue # resend
-                    finally:
-                        self._my_lock.release()
-                    # Wait for ACK until the resend timeout is exceeded
-                    try:
-                        if wait_any(self._resend_timeout, ack_event, self._channel_broken) != 0:
-                            raise ChannelBrokenException()
-                    except TimeoutError:
-                        attempt += 1
-                        continue # resend
-                    return self._responses.pop(seq_no)
-                    # TODO: record channel statistics
-                raise ChannelBrokenException() # Too many resend attempts
-            finally:
-                self._expected_acks.pop(seq_no)
-                self._responses.pop(seq_no, None)
-        else:
+        if not expect_ack:
             # fire and forget
             self._output.process_packet(packet)
             return None
-    
-    def remote_endpoint_read_buffer(self, endpoint_id):
+
+        request = PendingRequest(packet, decode)
+        with self._pending_cond:
+            while len(self._pending) >= self.window_size and not self._channel_broken.is_set():
+                self._pending_cond.wait()
+            if self._channel_broken.is_set():
+                raise ChannelBrokenException()
+            request.deadline = time.monotonic() + self._resend_timeout
+            self._pending[seq_no] = request
+            self._pending_cond.notify_all() # wake up the resend thread
+        self._send_request(seq_no, request)
+        return request.future
+
+    def _send_request(self, seq_no, request):
         """
-        Handles reads from long endpoints
+        Sends or resends a request that waits for its response, fails it after
+        too many attempts
+        """
+        while request.attempt < self._send_attempts:
+            request.attempt += 1
+            request.deadline = time.monotonic() + self._resend_timeout
+            self._my_lock.acquire()
+            try:
+                self._output.process_packet(request.packet)
+                return
+            except ChannelDamagedException:
+                continue # resend
+            except TimeoutError:
+                continue # resend
+            finally:
+                self._my_lock.release()
+        # TODO: record channel statistics
+        self._complete_request(seq_no, exception=ChannelBrokenException()) # Too many resend attempts
+
+    def _complete_request(self, seq_no, response=None, exception=None):
+        """
+        Resolves the future of a pending request. Returns False if no request
+        with this sequence number is pending.
+        """
+        with self._pending_cond:
+            request = self._pending.pop(seq_no, None)
+            self._pending_cond.notify_all()
+        if request is None:
+            return False
+        if exception is None:
+            try:
+                request.future.set_result(request.decode(response) if request.decode else response)
+            except Exception as ex:
+                request.future.set_exception(ex)
+        else:
+            request.future.set_exception(exception)
+        return True
+
+    def _fail_pending_requests(self):
+        with self._pending_cond:
+            pending = list(self._pending.values())
+            self._pending.clear()
+            self._pending_cond.notify_all()
+        for request in pending:
+            request.future.set_exception(ChannelBrokenException())
+
+    def remote_endpoint_batch(self, operations):
+        """
+        Runs a list of endpoint operations with as few requests as possible.
+        operations: list of (endpoint_id, input, output_length) tuples
+        Returns the output of each operation, None if the endpoint rejected it.
+        """
+        results = []
+        while len(results) < len(operations):
+            payload = bytes()
+            response_length = 0
+            for endpoint_id, input, output_length in operations[len(results):]:
+                input = bytes(input or b'')
+                if (len(payload) + 4 + len(input) > MAX_BATCH_INPUT) or (response_length + 1 + output_length > MAX_BATCH_OUTPUT):
+                    break
+                payload += struct.pack('<HBB', endpoint_id, len(input), output_length) + input
+                response_length += 1 + output_length
+            if len(payload) == 0:
+                raise Exception("endpoint operation too large for a batch")
+
+            # The device stops at the first operation that doesn't fit, the
+            # rest goes into the next request
+            response = self.remote_endpoint_operation(BATCH_ENDPOINT_ID, payload, True, response_length)
+            n_results = len(results)
+            while len(response) > 0 and len(results) < len(operations):
+                length = response[0]
+                if length == 0xff:
+                    results.append(None)
+                    response = response[1:]
+                else:
+                    results.append(response[1:1+length])
+                    response = response[1+length:]
+            if len(results) == n_results:
+                raise Exception("the device does not support batches (firmware too old?)")
+        return results
+
+    def batch(self):
+        """
+        Returns a context manager that collects the endpoint operations of this
+        thread and runs them with as few requests as possible, see Batch.
+        """
+        return Batch(self)
+
+    def get_batch(self):
+        """Returns the active Batch of this thread or None"""
+        return getattr(self._batch_local, 'batch', None)
+
+    def start_async_call(self, endpoint_id):
+        """
+        Queues a call of the function endpoint on the worker thread of the
+        device and returns its handle, see get_async_call_status()
+        """
+        response = self.remote_endpoint_operation(ASYNC_CALL_ENDPOINT_ID, struct.pack('<H', endpoint_id), True, 2)
+        if len(response) < 2:
+            raise Exception("the device does not support asynchronous calls (firmware too old?)")
+        handle = struct.unpack('<H', response)[0]
+        if handle == 0:
+            raise Exception("the asynchronous call queue of the device is full")
+        return handle
+
+    def get_async_call_status(self, handle):
+        """Returns one of the ASYNC_STATUS_* values"""
+        response = self.remote_endpoint_operation(ASYNC_STATUS_ENDPOINT_ID, struct.pack('<H', handle), True, 1)
+        return response[0] if len(response) else ASYNC_STATUS_UNKNOWN
+
+    def remote_endpoint_read_buffer(self, endpoint_id, suffix=b''):
+        """
+        Handles reads from long endpoints. The request holds the offset and
+        then the suffix. The size of the first chunk is taken as the device's
+        chunk size, the following chunks are requested ahead up to the window
+        size, a shorter chunk ends the buffer.
         """
         # TODO: handle device that could (maliciously) send infinite stream
-        buffer = bytes()
+        chunk_length = 512
+        buffer = self.remote_endpoint_operation(endpoint_id, struct.pack("<I", 0) + suffix, True, chunk_length)
+        device_chunk_length = len(buffer)
+        if device_chunk_length == 0:
+            return buffer
+        requests = []
+        next_offset = device_chunk_length
         while True:
-            chunk_length = 512
-            chunk = self.remote_endpoint_operation(endpoint_id, struct.pack("<I", len(buffer)), True, chunk_length)
-            if (len(chunk) == 0):
-                break
+            while len(requests) < self.window_size:
+                requests.append(self.remote_endpoint_operation_async(endpoint_id, struct.pack("<I", next_offset) + suffix, True, chunk_length))
+                next_offset += device_chunk_length
+            chunk = requests.pop(0).result()
             buffer += chunk
+            if (len(chunk) < device_chunk_length):
+                break
         return buffer
 
     def process_packet(self, packet):
@@ -344,14 +611,18 @@ class Channel(PacketSink):
 
         if (seq_no & 0x8000):
             seq_no &= 0x7fff
-            ack_signal = self._expected_acks.get(seq_no, None)
-            if (ack_signal):
-                self._responses[seq_no] = packet[2:]
-                ack_signal.set()
-                #print("received ack for packet " + str(seq_no))
-            else:
+            if not self._complete_request(seq_no, response=packet[2:]):
                 print("received unexpected ACK: " + str(seq_no))
 
+        elif seq_no == TELEMETRY_SEQ_NO:
+            # pushed by the remote device without a request
+            if self.telemetry_handler:
+                self.telemetry_handler(packet[2:])
+
+        elif seq_no == NOTIFICATION_SEQ_NO:
+            if self.notification_handler:
+                self.notification_handler(packet[2:])
+
         else:
             #if (calc_crc16(CRC16_INIT, struct.pack('<HBB', PROTOCOL_VERSION, packet[-2], packet[-1]))):
             #     raise Exception("CRC16 mismatch")
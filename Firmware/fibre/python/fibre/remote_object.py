@@ -6,8 +6,14 @@ import sys
 import json
 import struct
 import threading
+import time
 import fibre.protocol
 
+try:
+    from collections.abc import Mapping
+except ImportError:
+    from collections import Mapping
+
 class ObjectDefinitionError(Exception):
     pass
 
@@ -18,15 +24,15 @@ class StructCodec():
     Generic serializer/deserializer based on struct pack
     """
     def __init__(self, struct_format, target_type):
-        self._struct_format = struct_format
+        self._struct = struct.Struct(struct_format) # compiled once, not on every access
         self._target_type = target_type
     def get_length(self):
-        return struct.calcsize(self._struct_format)
+        return self._struct.size
     def serialize(self, value):
         value = self._target_type(value)
-        return struct.pack(self._struct_format, value)
+        return self._struct.pack(value)
     def deserialize(self, buffer):
-        value = struct.unpack(self._struct_format, buffer)
+        value = self._struct.unpack(buffer)
         value = value[0] if len(value) == 1 else value
         return self._target_type(value)
 
@@ -69,11 +75,33 @@ class RemoteProperty():
         self._can_write = 'w' in access_mode
 
     def get_value(self):
+        batch = self._parent.__channel__.get_batch()
+        if batch:
+            return batch.add(self._id, None, self._codec.get_length(), self._codec.deserialize)
         buffer = self._parent.__channel__.remote_endpoint_operation(self._id, None, True, self._codec.get_length())
         return self._codec.deserialize(buffer)
 
+    def get_value_async(self):
+        """
+        Reads the value without waiting for the response, returns a
+        concurrent.futures.Future for the value
+        """
+        return self._parent.__channel__.remote_endpoint_operation_async(self._id, None, True, self._codec.get_length(), self._codec.deserialize)
+
+    def set_value_async(self, value):
+        """
+        Writes the value without waiting for the acknowledgement, returns a
+        concurrent.futures.Future that completes with the acknowledgement
+        """
+        buffer = self._codec.serialize(value)
+        return self._parent.__channel__.remote_endpoint_operation_async(self._id, buffer, True, 0)
+
     def set_value(self, value):
         buffer = self._codec.serialize(value)
+        batch = self._parent.__channel__.get_batch()
+        if batch:
+            batch.add(self._id, buffer, 0)
+            return
         # TODO: Currenly we wait for an ack here. Settle on the default guarantee.
         self._parent.__channel__.remote_endpoint_operation(self._id, buffer, True, 0)
 
@@ -159,13 +187,183 @@ class RemoteFunction(object):
             raise TypeError("expected {} arguments but have {}".format(len(self._inputs), len(args)))
         for i in range(len(args)):
             self._inputs[i].set_value(args[i])
-        self._parent.__channel__.remote_endpoint_operation(self._trigger_id, None, True, 0)
+        batch = self._parent.__channel__.get_batch()
+        if batch:
+            batch.add(self._trigger_id, None, 0)
+        else:
+            self._parent.__channel__.remote_endpoint_operation(self._trigger_id, None, True, 0)
         if len(self._outputs) > 0:
             return self._outputs[0].get_value()
 
+    def call_async(self, *args):
+        """
+        Starts the call on the worker thread of the device and returns an
+        AsyncCall right away, so that a long operation doesn't hold up the
+        other requests on the channel.
+        """
+        if (len(self._inputs) != len(args)):
+            raise TypeError("expected {} arguments but have {}".format(len(self._inputs), len(args)))
+        for i in range(len(args)):
+            self._inputs[i].set_value(args[i])
+        handle = self._parent.__channel__.start_async_call(self._trigger_id)
+        return AsyncCall(self, handle)
+
     def _dump(self):
         return "{}({})".format(self._name, ", ".join("{}: {}".format(x._name, x._property_type.__name__) for x in self._inputs))
 
+class AsyncCall(object):
+    """
+    A function call that runs on the worker thread of the device, see
+    RemoteFunction.call_async(). The outputs are read when the call is done.
+    They are shared with all other calls of the same function, so only one
+    call of a function should be in flight at a time.
+    """
+    def __init__(self, function, handle):
+        self._function = function
+        self._handle = handle
+
+    def status(self):
+        """Returns one of the fibre.protocol.ASYNC_STATUS_* values"""
+        return self._function._parent.__channel__.get_async_call_status(self._handle)
+
+    def done(self):
+        return self.status() not in (fibre.protocol.ASYNC_STATUS_QUEUED, fibre.protocol.ASYNC_STATUS_RUNNING)
+
+    def result(self, timeout=None, poll_interval=0.05):
+        """
+        Waits until the call is done and returns its first output, like a
+        synchronous call. Raises TimeoutError after timeout seconds.
+        """
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            status = self.status()
+            if status == fibre.protocol.ASYNC_STATUS_DONE:
+                break
+            if status == fibre.protocol.ASYNC_STATUS_FAILED:
+                raise Exception("the asynchronous call of {} failed".format(self._function._name))
+            if status == fibre.protocol.ASYNC_STATUS_UNKNOWN:
+                raise Exception("the asynchronous call of {} expired".format(self._function._name))
+            if deadline is not None and time.monotonic() > deadline:
+                raise TimeoutError()
+            time.sleep(poll_interval)
+        if len(self._function._outputs) > 0:
+            return self._function._outputs[0].get_value()
+
+class RemoteBuffer(object):
+    """
+    Represents a read-only block of memory on the remote device. Every request
+    returns as many bytes from the requested offset as fit into one response.
+    """
+    def __init__(self, json_data, parent):
+        self._parent = parent
+        id_str = json_data.get("id", None)
+        if id_str is None:
+            raise ObjectDefinitionError("unspecified endpoint ID")
+        self._id = int(id_str)
+
+        self._name = json_data.get("name", None)
+        if self._name is None:
+            self._name = "[anonymous]"
+
+    def __call__(self, offset=0, length=None):
+        """
+        Reads length bytes starting at offset, or up to the end of the buffer
+        if length is None.
+        """
+        buffer = bytes()
+        while length is None or len(buffer) < length:
+            chunk_length = 512 if length is None else min(512, length - len(buffer))
+            chunk = self._parent.__channel__.remote_endpoint_operation(self._id, struct.pack("<I", offset + len(buffer)), True, chunk_length)
+            if (len(chunk) == 0):
+                break
+            buffer += chunk
+        return buffer
+
+    def write(self, data, offset=0, chunk_length=48):
+        """
+        Writes data starting at offset, for endpoints that take the data after
+        the offset in the request and respond with one status byte. The
+        chunks are sent ahead up to the window size of the channel.
+        Returns False if the device rejected any of them.
+        """
+        channel = self._parent.__channel__
+        requests = []
+        for start in range(0, len(data), chunk_length):
+            payload = struct.pack("<I", offset + start) + bytes(data[start:start + chunk_length])
+            requests.append(channel.remote_endpoint_operation_async(self._id, payload, True, 1))
+        return all(request.result() == b'\x01' for request in requests)
+
+    def _dump(self):
+        return "{}(offset, length)".format(self._name)
+
+class RemoteAttributes(Mapping):
+    """
+    The members of a RemoteObject by name. A member is only created from its
+    JSON description when it is first accessed, so that connecting to a
+    device doesn't build the whole object tree up front.
+    """
+    def __init__(self, json_members, parent, channel, logger):
+        self._parent = parent
+        self._channel = channel
+        self._logger = logger
+        self._json = {}
+        self._attributes = {}
+        for member_json in json_members:
+            member_name = member_json.get("name", None)
+            if member_name is None:
+                logger.debug("ignoring unnamed attribute")
+                continue
+            self._json[member_name] = member_json
+
+    def member_names(self):
+        """Returns the names of all members without creating them"""
+        return list(self._json.keys())
+
+    def member_type(self, name):
+        """Returns the type of a member as declared in JSON without creating it"""
+        return self._json[name].get("type", None)
+
+    def get(self, name, default=None):
+        attribute = self._attributes.get(name, None)
+        if attribute is not None:
+            return attribute
+        member_json = self._json.get(name, None)
+        if member_json is None:
+            return default
+
+        try:
+            type_str = member_json.get("type", None)
+            if type_str == "object":
+                attribute = RemoteObject(member_json, self._parent, self._channel, self._logger)
+            elif type_str == "function":
+                attribute = RemoteFunction(member_json, self._parent)
+            elif type_str == "buffer":
+                attribute = RemoteBuffer(member_json, self._parent)
+            elif type_str != None:
+                attribute = RemoteProperty(member_json, self._parent)
+            else:
+                raise ObjectDefinitionError("no type information")
+        except ObjectDefinitionError as ex:
+            self._logger.debug("malformed member {}: {}".format(name, str(ex)))
+            del self._json[name]
+            return default
+
+        self._attributes[name] = attribute
+        return attribute
+
+    def __getitem__(self, name):
+        attribute = self.get(name, None)
+        if attribute is None:
+            raise KeyError(name)
+        return attribute
+
+    def __iter__(self):
+        # Malformed members drop out when they are first accessed
+        return iter([name for name in self.member_names() if self.get(name) is not None])
+
+    def __len__(self):
+        return len(self._json)
+
 class RemoteObject(object):
     """
     Object with functions and properties that map to remote endpoints
@@ -185,29 +383,8 @@ class RemoteObject(object):
         self.__channel__ = channel
         self.__parent__ = parent
 
-        # Build attribute list from JSON
-        for member_json in json_data.get("members", []):
-            member_name = member_json.get("name", None)
-            if member_name is None:
-                logger.debug("ignoring unnamed attribute")
-                continue
-
-            try:
-                type_str = member_json.get("type", None)
-                if type_str == "object":
-                    attribute = RemoteObject(member_json, self, channel, logger)
-                elif type_str == "function":
-                    attribute = RemoteFunction(member_json, self)
-                elif type_str != None:
-                    attribute = RemoteProperty(member_json, self)
-                else:
-                    raise ObjectDefinitionError("no type information")
-            except ObjectDefinitionError as ex:
-                logger.debug("malformed member {}: {}".format(member_name, str(ex)))
-                continue
-
-            self._remote_attributes[member_name] = attribute
-            self.__dict__[member_name] = attribute
+        # Members are created on first access
+        self._remote_attributes = RemoteAttributes(json_data.get("members", []), self, channel, logger)
 
         # Ensure that from here on out assignments to undefined attributes
         # raise an exception
@@ -218,7 +395,14 @@ class RemoteObject(object):
         if depth <= 0:
             return "..."
         lines = []
-        for key, val in self._remote_attributes.items():
+        for key in self._remote_attributes.member_names():
+            if depth == 1 and self._remote_attributes.member_type(key) == "object":
+                # Don't create objects that are not shown anyway
+                lines.append(indent + key + ": ...")
+                continue
+            val = self._remote_attributes.get(key)
+            if val is None:
+                continue
             if isinstance(val, RemoteObject):
                 val_str = indent + key + (": " if depth == 1 else ":\n") + val._dump(indent + "  ", depth - 1)
             else:
@@ -226,6 +410,19 @@ class RemoteObject(object):
             lines.append(val_str)
         return "\n".join(lines)
 
+    def _batch(self):
+        """
+        Returns a context manager that runs the property accesses and function
+        calls on this object's device in as few requests as possible, for
+        example:
+            with odrv0._batch():
+                vbus = odrv0.vbus_voltage
+                odrv0.axis0.controller.input_vel = 1.0
+            print(vbus.result())
+        Within the with block, reads and function calls return futures.
+        """
+        return self.__channel__.batch()
+
     def __str__(self):
         return self._dump("", depth=2)
 
@@ -245,6 +442,9 @@ class RemoteObject(object):
             return object.__getattribute__(self, name)
             #raise AttributeError("Attribute {} not found".format(name))
 
+    def __dir__(self):
+        return list(object.__dir__(self)) + list(object.__getattribute__(self, "_remote_attributes").member_names())
+
     def __setattr__(self, name, value):
         attr = object.__getattribute__(self, "_remote_attributes").get(name, None)
         if isinstance(attr, RemoteProperty):
@@ -259,6 +459,4 @@ class RemoteObject(object):
 
     def _tear_down(self):
         # Clear all remote members
-        for k in self._remote_attributes.keys():
-            self.__dict__.pop(k)
         self._remote_attributes = {}
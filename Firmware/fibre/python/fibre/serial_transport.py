@@ -96,7 +96,8 @@ def discover_channels(path, serial_number, callback, cancellation_token, channel
                 output_stream = fibre.protocol.StreamBasedPacketSink(serial_device)
                 channel = fibre.protocol.Channel(
                         "serial port {}@{}".format(port_name, DEFAULT_BAUDRATE),
-                        input_stream, output_stream, channel_termination_token, logger)
+                        input_stream, output_stream, channel_termination_token, logger,
+                        window_size=1) # a second long request could overrun the UART RX buffer
                 channel.serial_device = serial_device
             except serial.serialutil.SerialException:
                 logger.debug("Serial device init failed. Ignoring this port. More info: " + traceback.format_exc())
@@ -21,6 +21,8 @@ class TCPTransport(fibre.protocol.StreamSource, fibre.protocol.StreamSink):
     self.target = socket.getaddrinfo(dest_addr, dest_port, family)[0][4]
     # TODO: this blocks until a connection is established, or the system cancels it
     self.sock.connect(self.target)
+    # Requests go out in several small writes, don't hold them back
+    self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
 
   def process_bytes(self, buffer):
     self.sock.send(buffer)
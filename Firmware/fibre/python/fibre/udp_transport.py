@@ -1,6 +1,9 @@
 
 import sys
 import socket
+import struct
+import threading
+import queue
 import time
 import traceback
 import fibre.protocol
@@ -9,8 +12,18 @@ from fibre.utils import wait_any
 def noprint(x):
   pass
 
+# Must match DATAGRAM_BATCH_MARKER and MAX_DATAGRAM_SIZE in protocol.hpp
+DATAGRAM_BATCH_MARKER = 0xffff
+MAX_DATAGRAM_SIZE = 256
+BATCH_DELAY = 0.001 # [s] a packet waits for more packets to send with it
+
 class UDPTransport(fibre.protocol.PacketSource, fibre.protocol.PacketSink):
-  def __init__(self, dest_addr, dest_port, logger):
+  """
+  One packet per datagram. With batching, the packets that are sent within
+  BATCH_DELAY go into one datagram, see DatagramChannel in protocol.hpp,
+  and the server returns their responses in one datagram as well.
+  """
+  def __init__(self, dest_addr, dest_port, logger, batch=True):
     # TODO: FIXME: use IPv6
     # Problem: getaddrinfo fails if the resolver returns an
     # IPv4 address, but we are using AF_INET6
@@ -19,14 +32,59 @@ class UDPTransport(fibre.protocol.PacketSource, fibre.protocol.PacketSink):
     self.sock = socket.socket(family, socket.SOCK_DGRAM)
     # TODO: Determine the right address to use from the list
     self.target = socket.getaddrinfo(dest_addr,dest_port, family)[0][4]
+    self._rx_packets = []
+    self._batch = batch
+    if batch:
+      self._tx_queue = queue.Queue()
+      t = threading.Thread(target=self._sender_thread)
+      t.daemon = True
+      t.start()
 
   def process_packet(self, buffer):
-    self.sock.sendto(buffer, self.target)
+    if self._batch:
+      self._tx_queue.put(bytes(buffer))
+    else:
+      self.sock.sendto(buffer, self.target)
+
+  def _sender_thread(self):
+    pending = None
+    while True:
+      packets = [pending or self._tx_queue.get()]
+      pending = None
+      size = 2 + 2 + len(packets[0])
+      deadline = time.monotonic() + BATCH_DELAY
+      while True:
+        try:
+          packet = self._tx_queue.get(timeout=max(deadline - time.monotonic(), 0))
+        except queue.Empty:
+          break
+        if size + 2 + len(packet) > MAX_DATAGRAM_SIZE:
+          pending = packet
+          break
+        packets.append(packet)
+        size += 2 + len(packet)
+      if len(packets) == 1:
+        datagram = packets[0]
+      else:
+        datagram = struct.pack('<H', DATAGRAM_BATCH_MARKER) + b''.join(struct.pack('<H', len(p)) + p for p in packets)
+      try:
+        self.sock.sendto(datagram, self.target)
+      except OSError:
+        pass # lost like any datagram, the channel resends the requests
 
   def get_packet(self, deadline):
     # TODO: implement deadline
-    data, _ = self.sock.recvfrom(1024)
-    return data
+    while not self._rx_packets:
+      data, _ = self.sock.recvfrom(1024)
+      if len(data) >= 2 and struct.unpack_from('<H', data)[0] == DATAGRAM_BATCH_MARKER:
+        pos = 2
+        while pos + 2 <= len(data):
+          length = struct.unpack_from('<H', data, pos)[0]
+          self._rx_packets.append(data[pos + 2:pos + 2 + length])
+          pos += 2 + length
+      else:
+        self._rx_packets.append(data)
+    return self._rx_packets.pop(0)
 
 def discover_channels(path, serial_number, callback, cancellation_token, channel_termination_token, logger):
   """
@@ -88,6 +88,8 @@ class USBBulkTransport(fibre.protocol.PacketSource, fibre.protocol.PacketSink):
     )
     assert self.epr is not None
     self._logger.debug("EndpointAddress for reading {}".format(self.epr.bEndpointAddress))
+    # reused by get_packet() so that pyusb doesn't allocate a new array per read
+    self._read_buffer = usb.util.create_buffer(self.epr.wMaxPacketSize)
 
   def deinit(self):
     if not self.intf is None:
@@ -122,13 +124,12 @@ class USBBulkTransport(fibre.protocol.PacketSource, fibre.protocol.PacketSink):
 
   def get_packet(self, deadline):
     try:
-      bufferLen = self.epr.wMaxPacketSize
       timeout = max(int((deadline - time.monotonic()) * 1000), 0)
-      ret = self.epr.read(bufferLen, timeout)
+      length = self.epr.read(self._read_buffer, timeout)
       if self._was_damaged:
         self._logger.debug("Recovered from USB halt/stall condition")
         self._was_damaged = False
-      return bytearray(ret)
+      return bytearray(memoryview(self._read_buffer)[:length])
     except usb.core.USBError as ex:
       if ex.errno == 19 or ex.errno == 32: # "no such device", "pipe error"
         raise fibre.protocol.ChannelBrokenException()
@@ -163,6 +163,7 @@ class Logger():
     def indent(self, prefix='  '):
         indented_logger = Logger()
         indented_logger._prefix = self._prefix + prefix
+        indented_logger._print_lock = self._print_lock # keep lines of loggers on different threads apart
         return indented_logger
 
     def print_on_second_last_line(self, text, color):
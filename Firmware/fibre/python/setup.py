@@ -32,7 +32,7 @@ to publish packages with the name fibre.
 
 # TODO: add additional y/n prompt to prevent from erroneous upload
 
-from setuptools import setup
+from setuptools import setup, Extension
 import os
 import sys
 
@@ -68,6 +68,9 @@ hotfix = 0
 setup(
   name = 'fibre',
   packages = ['fibre'],
+  # Optional accelerated CRC and packet codec, the pure Python implementation
+  # in fibre/protocol.py is used if this fails to build
+  ext_modules = [Extension('fibre._native', ['fibre/_native.c'], optional=True)],
   #scripts = ['..fibre', 'odrivetool.bat', 'odrive_demo.py'],
   version = '0.0.1dev0',
   description = 'Abstraction layer for painlessly building object oriented distributed systems that just work',
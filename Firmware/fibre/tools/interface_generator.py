@@ -5,6 +5,7 @@ import json
 import jinja2
 import jsonschema
 import re
+import zlib
 import argparse
 import sys
 from collections import OrderedDict
@@ -67,6 +68,7 @@ definitions:
         properties:
           in: {type: object}
           out: {type: object}
+          raw: {type: boolean}
           brief: {type: string}
           doc: {type: string}
           __line__: {type: object}
@@ -447,6 +449,22 @@ def generate_endpoint_table(intf, bindto, idx):
             cnt += inner_cnt
 
     for k, func in intf['functions'].items():
+        if func.get('raw', False):
+            # Raw functions resolve to one single endpoint that gets the
+            # request and response buffers directly, like endpoint 0
+            endpoints.append({
+                'id': idx + cnt,
+                'function': func,
+                'raw_binding': '(' + bindto + ')->' + func['name'],
+            })
+            endpoint_definitions.append({
+                'name': k,
+                'id': idx + cnt,
+                'type': 'buffer',
+                'access': 'r'
+            })
+            cnt += 1
+            continue
         endpoints.append({
             'id': idx + cnt,
             'function': func,
@@ -500,6 +518,8 @@ group.add_argument("--outputs", type=str,
                     help="path pattern for the generated outputs. One output is generated for each interface. Use # as placeholder for the interface name.")
 parser.add_argument("--generate-endpoints", type=str, nargs='?',
                     help="if specified, an endpoint table will be generated and passed to the template for the specified interface")
+parser.add_argument("--share-property-handlers", action="store_true",
+                    help="dispatch all property endpoints of the same type through one handler instead of one handler per endpoint (smaller, slightly slower)")
 args = parser.parse_args()
 
 if args.version:
@@ -586,9 +606,23 @@ if args.generate_endpoints:
     endpoints, embedded_endpoint_definitions, _ = generate_endpoint_table(interfaces[args.generate_endpoints], '&ep_root', 1) # TODO: make user-configurable
     embedded_endpoint_definitions = [{'name': '', 'id': 0, 'type': 'json', 'access': 'r'}] + embedded_endpoint_definitions
     endpoints = [{'id': 0, 'function': {'fullname': 'endpoint0_handler', 'in': {}, 'out': {}}, 'bindings': {}}] + endpoints
+    # Densely indexed by endpoint ID for the dispatch table, gaps are None
+    endpoint_table = [None] * (max(endpoint['id'] for endpoint in endpoints) + 1)
+    for endpoint in endpoints:
+        assert(endpoint_table[endpoint['id']] is None)
+        endpoint_table[endpoint['id']] = endpoint
+    # Property endpoints can share one handler per property type
+    property_functions = OrderedDict()
+    for endpoint in endpoints:
+        endpoint['is_property'] = (endpoint['function'].get('name', None) in ['exchange', 'read']) and list(endpoint.get('in_bindings', {}).keys()) == ['obj']
+        if endpoint['is_property']:
+            property_functions[endpoint['function']['fullname']] = endpoint['function']
+    property_functions = list(property_functions.values())
 else:
     embedded_endpoint_definitions = None
     endpoints = None
+    endpoint_table = None
+    property_functions = None
 
 
 # Render template
@@ -643,6 +677,12 @@ def tokenize(text, interface, interface_transform, value_type_transform, attribu
 
     return re.sub(r'`([A-Za-z\._]+)`', token_transform, text)
 
+def to_c_zlib_array(x):
+    """Returns the compact JSON of x compressed with zlib as a C array initializer"""
+    data = zlib.compress(json.dumps(x, separators=(',', ':')).encode('ascii'), 9)
+    lines = [','.join('0x{:02x}'.format(b) for b in data[i:i+16]) for i in range(0, len(data), 16)]
+    return '{\n' + ',\n'.join(lines) + '\n}'
+
 env.filters['to_pascal_case'] = to_pascal_case
 env.filters['to_camel_case'] = to_camel_case
 env.filters['to_macro_case'] = to_macro_case
@@ -651,6 +691,7 @@ env.filters['to_kebab_case'] = to_kebab_case
 env.filters['first'] = lambda x: next(iter(x))
 env.filters['skip_first'] = lambda x: list(x)[1:]
 env.filters['to_c_string'] = lambda x: '\n'.join(('"' + line.replace('"', '\\"') + '"') for line in json.dumps(x, separators=(',', ':')).replace('{"name"', '\n{"name"').split('\n'))
+env.filters['to_c_zlib_array'] = to_c_zlib_array
 env.filters['tokenize'] = tokenize
 env.filters['diagonalize'] = lambda lst: [lst[:i + 1] for i in range(len(lst))]
 env.filters['debug'] = lambda x: print(x)
@@ -662,6 +703,9 @@ template_args = {
     'value_types': value_types,
     'toplevel_interfaces': toplevel_interfaces,
     'endpoints': endpoints,
+    'endpoint_table': endpoint_table,
+    'property_functions': property_functions,
+    'share_property_handlers': args.share_property_handlers,
     'embedded_endpoint_definitions': embedded_endpoint_definitions
 }
 
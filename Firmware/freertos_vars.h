@@ -8,7 +8,8 @@
 extern osSemaphoreId sem_usb_irq;
 extern osSemaphoreId sem_uart_dma;
 extern osSemaphoreId sem_usb_rx;
-extern osSemaphoreId sem_usb_tx;
+extern osSemaphoreId sem_usb_tx_cdc;
+extern osSemaphoreId sem_usb_tx_native;
 extern osSemaphoreId sem_can;
 
 extern osThreadId defaultTaskHandle;
@@ -16,4 +17,10 @@ extern osThreadId usb_irq_thread;
 extern const uint32_t stack_size_usb_irq_thread;
 extern const uint32_t stack_size_default_task;
 
+// All threads have static stacks and control blocks, mostly in core coupled
+// memory, so the RAM usage is known at link time. The default task's are
+// defined in freertos.c.
+extern StackType_t default_task_stack[];
+extern StaticTask_t default_task_tcb;
+
 #endif /* __FREERTOS_H */
\ No newline at end of file
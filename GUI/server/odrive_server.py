@@ -9,6 +9,10 @@ import json
 import time
 import argparse
 import logging
+import concurrent.futures
+import math
+import struct
+import threading
 
 # interface for odrive GUI to get data from odrivetool
 
@@ -88,24 +92,26 @@ def getODrives(message):
 def enableSampling(message):
     print("sampling enabled")
     session['samplingEnabled'] = True
+    stop_sampler(request.sid)
+    samplers[request.sid] = Sampler(request.sid, session.get('sampledVars', {"paths": []})["paths"])
     emit('samplingEnabled')
 
 @socketio.on('stopSampling')
 def stopSampling(message):
     session['samplingEnabled'] = False
+    stop_sampler(request.sid)
     emit('samplingDisabled')
 
 @socketio.on('sampledVarNames')
 def sampledVarNames(message):
     session['sampledVars'] = message
     print(session['sampledVars'])
-    
-@socketio.on('startSampling')
-def sendSamples(message):
-    print(session['samplingEnabled'])
-    while session['samplingEnabled']:
-        emit('sampledData', json.dumps(getSampledData(session['sampledVars'])))
-        time.sleep(0.02)
+    if request.sid in samplers:
+        samplers[request.sid].set_paths(message["paths"])
+
+@socketio.on('disconnect')
+def client_disconnected():
+    stop_sampler(request.sid)
 
 @socketio.on('message')
 def handle_message(message):
@@ -224,15 +230,189 @@ def getVal(odrives, keyList):
         print("exception in getVal")
         return 0
 
-def getSampledData(vars):
-    #use getVal to populate a dict
-    #return a dict {path:value}
-    samples = {}
-    for path in vars["paths"]:
-        keys = path.split('.')
-        samples[path] = getVal(globals()['odrives'], keys)
+# Sampling engine
+# A thread per GUI client samples the plotted properties at a fixed rate and
+# pushes them in binary frames, so the plots get evenly spaced samples no
+# matter how many of them are open. The properties of each ODrive are
+# streamed by its telemetry feature if the firmware has it, otherwise they
+# are read with one batch request per ODrive and sample.
+#
+# Frame format (little endian):
+#     uint32 layout_id, uint16 num_vars, uint16 num_samples,
+#     then num_samples times {float64 time [s], float32 values[num_vars]}
+# The order of the values is announced by a 'sampledLayout' message with the
+# same layout_id. Values that could not be read are NaN.
+
+SAMPLE_RATE = 100 # [Hz]
+FRAME_INTERVAL = 0.05 # [s] samples are collected into one frame for this long
+CONTROL_LOOP_HZ = 168000000 / (6 * 3500) # rate of the loop_counter in telemetry frames
+MAX_TELEMETRY_CHANNELS = 8 # Telemetry::max_channels in the firmware
+
+samplers = {} # {sid: Sampler}
+
+def stop_sampler(sid):
+    sampler = samplers.pop(sid, None)
+    if sampler:
+        sampler.stop()
+
+def getProperty(odrv, keyList):
+    RO = odrv
+    for key in keyList:
+        RO = RO._remote_attributes[key]
+    if not isinstance(RO, fibre.remote_object.RemoteProperty):
+        raise Exception("not a property")
+    return RO
+
+class PolledSource():
+    """Reads the properties of one ODrive with one batch request per sample"""
+    def __init__(self, odrv, props):
+        self.odrv = odrv
+        self.props = props
+
+    def sample(self):
+        with self.odrv._batch():
+            futures = [prop.get_value() for prop in self.props]
+        return [float(future.result()) for future in futures]
+
+    def stop(self):
+        pass
+
+class TelemetrySource():
+    """Streams the properties of one ODrive, each sample is the newest frame"""
+    def __init__(self, odrv, props):
+        self.odrv = odrv
+        self.props = props
+        self._values = [math.nan] * len(props)
+        channel = odrv.__channel__
+        if len(props) > MAX_TELEMETRY_CHANNELS or getattr(channel, 'telemetry_handler', None) is not None:
+            raise Exception("telemetry not available")
+        for i, prop in enumerate(props):
+            setattr(odrv.telemetry.config, 'channel' + str(i), prop)
+        odrv.telemetry.config.num_channels = len(props)
+        odrv.telemetry.config.decimation = max(int(CONTROL_LOOP_HZ / SAMPLE_RATE), 1)
+        channel.telemetry_handler = self._process_packet
+        if not odrv.telemetry.start():
+            channel.telemetry_handler = None
+            raise Exception("telemetry could not be started")
+
+    def _process_packet(self, payload):
+        num_channels, num_frames = payload[0], payload[1]
+        if num_channels != len(self.props) or num_frames == 0:
+            return
+        frame_format = "<I{}f".format(num_channels)
+        offset = 2 + (num_frames - 1) * struct.calcsize(frame_format)
+        self._values = list(struct.unpack_from(frame_format, payload, offset)[1:])
+
+    def sample(self):
+        return self._values
+
+    def stop(self):
+        self.odrv.__channel__.telemetry_handler = None
+        self.odrv.telemetry.stop()
+
+class Sampler():
+    def __init__(self, sid, paths):
+        self.sid = sid
+        self._lock = threading.Lock()
+        self._layout_id = 0
+        self._paths = []
+        self._sources = {} # {odrive name: (odrv, source, [index into paths])}
+        self._stop = threading.Event()
+        self.set_paths(paths)
+        self._thread = socketio.start_background_task(self._run)
+
+    def set_paths(self, paths):
+        with self._lock:
+            self._stop_sources()
+            self._paths = list(paths)
+            self._layout_id += 1
+            self._sample_struct = struct.Struct("<d{}f".format(len(self._paths)))
+            socketio.emit('sampledLayout', json.dumps({"id": self._layout_id, "paths": self._paths}), room=self.sid)
+
+    def stop(self):
+        self._stop.set()
+        with self._lock:
+            self._stop_sources()
+
+    def _stop_sources(self):
+        for odrv, source, indices in self._sources.values():
+            try:
+                if source:
+                    source.stop()
+            except:
+                pass
+        self._sources = {}
+
+    def _update_sources(self):
+        # (re)creates the sources of ODrives that were (re)connected
+        paths_by_odrive = {}
+        for index, path in enumerate(self._paths):
+            paths_by_odrive.setdefault(path.split('.')[0], []).append(index)
+        for name, indices in paths_by_odrive.items():
+            odrv = globals()['odrives'].get(name, None)
+            if not globals()['odrives_status'].get(name, False):
+                odrv = None
+            if name in self._sources and self._sources[name][0] is odrv:
+                continue
+            source = None
+            if odrv is not None:
+                try:
+                    props = [getProperty(odrv, self._paths[i].split('.')[1:]) for i in indices]
+                except:
+                    print("exception in Sampler: invalid path")
+                    props = None
+                if props is not None:
+                    try:
+                        source = TelemetrySource(odrv, props) if 'telemetry' in odrv._remote_attributes else PolledSource(odrv, props)
+                    except fibre.protocol.ChannelBrokenException:
+                        handle_disconnect(name)
+                    except:
+                        source = PolledSource(odrv, props)
+            self._sources[name] = (odrv, source, indices)
+
+    def _sample(self, values):
+        for name, (odrv, source, indices) in self._sources.items():
+            try:
+                sample = source.sample() if source else None
+            except fibre.protocol.ChannelBrokenException:
+                handle_disconnect(name)
+                sample = None
+            except:
+                sample = None
+            for i, index in enumerate(indices):
+                values[index] = sample[i] if sample else math.nan
+
+    def _run(self):
+        start = time.monotonic()
+        next_sample = start
+        next_frame = start + FRAME_INTERVAL
+        frame = bytearray()
+        num_samples = 0
+        layout_id = None
+        while not self._stop.is_set():
+            with self._lock:
+                if layout_id != self._layout_id:
+                    # discard the samples of the previous layout
+                    layout_id, frame, num_samples = self._layout_id, bytearray(), 0
+                self._update_sources()
+                values = [math.nan] * len(self._paths)
+                sample_time = time.monotonic() - start
+                self._sample(values)
+                frame += self._sample_struct.pack(sample_time, *values)
+                num_samples += 1
+
+            if time.monotonic() >= next_frame:
+                header = struct.pack("<IHH", layout_id, len(values), num_samples)
+                socketio.emit('sampledData', bytes(header + frame), room=self.sid)
+                frame, num_samples = bytearray(), 0
+                next_frame = max(next_frame + FRAME_INTERVAL, time.monotonic())
 
-    return samples
+            # fixed rate, skip samples if we fell behind
+            next_sample += 1.0 / SAMPLE_RATE
+            now = time.monotonic()
+            if next_sample < now:
+                next_sample = now
+            self._stop.wait(next_sample - now)
 
 def callFunc(odrives, keyList):
     try:
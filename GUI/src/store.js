@@ -11,6 +11,34 @@ import {filterBy, deleteBy } from "./lib/utils.js";
 
 Vue.use(Vuex);
 
+// Decodes a binary sampledData frame from the server (see Sampler in
+// odrive_server.py). Returns null if the frame doesn't match the layout.
+function decodeSampleFrame(frame, layout) {
+    // ArrayBuffer in the browser, a Buffer if socket.io runs on node
+    const view = frame instanceof ArrayBuffer ? new DataView(frame)
+        : new DataView(frame.buffer, frame.byteOffset, frame.byteLength);
+    const layoutId = view.getUint32(0, true);
+    const numVars = view.getUint16(4, true);
+    const numSamples = view.getUint16(6, true);
+    if (layoutId != layout.id || numVars != layout.paths.length) {
+        return null;
+    }
+    let samples = { time: [], values: {} };
+    for (const path of layout.paths) {
+        samples.values[path] = [];
+    }
+    let offset = 8;
+    for (let i = 0; i < numSamples; ++i) {
+        samples.time.push(view.getFloat64(offset, true));
+        offset += 8;
+        for (const path of layout.paths) {
+            samples.values[path].push(view.getFloat32(offset, true));
+            offset += 4;
+        }
+    }
+    return samples;
+}
+
 export default new Vuex.Store({
     // state is the data for this app
     state: {
@@ -32,6 +60,8 @@ export default new Vuex.Store({
         timeSampleStart: 0,
         sampledProperties: [], // make this an object where the full path is a key and the value is the sampled var
         propSamples: { time: [] }, // {time: [time values], ...path: [path var values]}
+        sampleLayout: { id: 0, paths: [] }, // order of the values in sampledData frames
+        sampleCount: 0, // incremented for every received frame, plots redraw when it changes
         newData: false,
         sampling: false,
         currentDash: "Start",
@@ -108,6 +138,9 @@ export default new Vuex.Store({
         setServerAddress(state, address) {
             state.odriveServerAddress = address;
         },
+        setSampleLayout(state, layout) {
+            state.sampleLayout = layout;
+        },
         updateOdriveProp(state, payload) {
             // need to use Vue.set!!!
             // payload is {path, value}
@@ -146,17 +179,21 @@ export default new Vuex.Store({
             }
         },
         updateSampledProperty(state, payload) {
-            // payload is object of paths and values
-            for (const path of Object.keys(payload)) {
-                state.propSamples[path].push(payload[path]);
-                if (state.propSamples[path].length > 250) {
-                    state.propSamples[path].splice(0, 1); // emulate circular buffer
+            // payload is {time: [time values], values: {path: [values]}}
+            const maxSamples = 250; // emulate circular buffer
+            const append = (samples, values) => {
+                samples.push(...values);
+                if (samples.length > maxSamples) {
+                    samples.splice(0, samples.length - maxSamples);
+                }
+            };
+            for (const path of Object.keys(payload.values)) {
+                if (path in state.propSamples) {
+                    append(state.propSamples[path], payload.values[path]);
                 }
             }
-            state.propSamples["time"].push((Date.now() - state.timeSampleStart) / 1000);
-            if (state.propSamples["time"].length > 250) {
-                state.propSamples["time"].splice(0, 1);
-            }
+            append(state.propSamples["time"], payload.time);
+            state.sampleCount += 1;
             state.newData = true;
         },
         logServerMessage(state, payload) {
@@ -342,17 +379,18 @@ export default new Vuex.Store({
                 }
             });
             socketio.addEventListener({
-                type: "sampledData",
+                type: "sampledLayout",
                 callback: message => {
-                    context.commit("updateSampledProperty", JSON.parse(message));
+                    context.commit("setSampleLayout", JSON.parse(message));
                 }
             });
             socketio.addEventListener({
-                type: "samplingEnabled",
-                callback: () => {
-                    socketio.sendEvent({
-                        type: "startSampling"
-                    });
+                type: "sampledData",
+                callback: frame => {
+                    const samples = decodeSampleFrame(frame, context.state.sampleLayout);
+                    if (samples) {
+                        context.commit("updateSampledProperty", samples);
+                    }
                 }
             });
             socketio.addEventListener({
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""
+Lists the flash and RAM usage of each module (object file or library) from
+the linker map file of a firmware build, largest first.
+
+Usage: memory_report.py build/ODriveFirmware.map [--top N]
+
+Only sections that survive --gc-sections are counted. Initialized data (with
+a load address) counts towards both flash and RAM. With LTO the linker sees
+the partitions of the link-time optimizer instead of the original object
+files, build with CONFIG_USE_LTO=false for a breakdown by source file.
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+# Input section: " .text.foo  0x08001234  0x40 build/obj/foo.o". Long section
+# names go on their own line and the rest follows on the next line.
+input_section_re = re.compile(r'^ (\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*))?$')
+continuation_re = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+# Output section: ".data  0x20000000  0x9a8 load address 0x0801f3d8"
+output_section_re = re.compile(r'^(\.\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(\s+load address)?)?')
+
+def is_flash(addr):
+    return 0x08000000 <= addr < 0x10000000
+
+def is_ram(addr):
+    return 0x10000000 <= addr < 0x10010000 or 0x20000000 <= addr < 0x30000000 # CCM RAM, SRAM
+
+def module_name(path):
+    """
+    build/obj/MotorControl_axis.cpp.o -> MotorControl_axis.cpp
+    /path/to/libc_nano.a(lib_a-memcpy.o) -> libc_nano.a
+    """
+    path = path.strip()
+    m = re.match(r'^(.*\.a)\(.*\)$', path)
+    if m:
+        return os.path.basename(m.group(1))
+    name = os.path.basename(path)
+    return name[:-2] if name.endswith('.o') else name
+
+def parse_map(lines):
+    """
+    Returns {module: [flash_bytes, ram_bytes]}
+    """
+    usage = collections.defaultdict(lambda: [0, 0])
+    in_memory_map = False
+    has_load_address = False
+    pending_section = None
+
+    def add(addr, size, path):
+        if size == 0 or path.startswith('load address'):
+            return
+        entry = usage[module_name(path)]
+        if is_flash(addr) or has_load_address:
+            entry[0] += size
+        if is_ram(addr):
+            entry[1] += size
+
+    for line in lines:
+        line = line.rstrip('\n')
+        if line.startswith('Linker script and memory map'):
+            in_memory_map = True
+            continue
+        if not in_memory_map:
+            continue
+
+        if pending_section is not None:
+            pending_section = None
+            m = continuation_re.match(line)
+            if m:
+                add(int(m.group(1), 16), int(m.group(2), 16), m.group(3))
+                continue
+
+        m = output_section_re.match(line)
+        if m:
+            has_load_address = bool(m.group(4))
+            continue
+
+        m = input_section_re.match(line)
+        if m and not m.group(1).startswith('*'):
+            if m.group(2) is None:
+                pending_section = m.group(1)
+            else:
+                add(int(m.group(2), 16), int(m.group(3), 16), m.group(4))
+
+    return usage
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('map_file', type=argparse.FileType('r'))
+    parser.add_argument('--top', type=int, default=0, help="only list the N largest modules")
+    args = parser.parse_args()
+
+    usage = parse_map(args.map_file)
+    modules = sorted(usage.items(), key=lambda kv: (-kv[1][0], -kv[1][1], kv[0]))
+    if args.top > 0:
+        modules = modules[:args.top]
+
+    print('{:>8} {:>8}  {}'.format('flash', 'ram', 'module'))
+    for name, (flash, ram) in modules:
+        print('{:>8} {:>8}  {}'.format(flash, ram, name))
+    print('{:>8} {:>8}  {}'.format(sum(u[0] for u in usage.values()), sum(u[1] for u in usage.values()), 'total'))
+
+if __name__ == '__main__':
+    sys.exit(main())
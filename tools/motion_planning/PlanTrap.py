@@ -22,6 +22,9 @@
 # This algorithm is based on:
 # FIR filter-based online jerk-constrained trajectory generation
 # https://www.researchgate.net/profile/Richard_Bearee/publication/304358769_FIR_filter-based_online_jerk-controlled_trajectory_generation/links/5770ccdd08ae10de639c0ff7/FIR-filter-based-online-jerk-controlled-trajectory-generation.pdf
+#
+# This is a model for experiments, the planner that runs on the ODrive is
+# available from Python with odrive_traj.py.
 
 import numpy as np
 import math
@@ -0,0 +1,167 @@
+"""
+Plans and evaluates moves with the trajectory planner of the firmware
+(MotorControl/trapTraj.cpp and scurve_traj.hpp), built as a host library from
+Firmware/Tests/traj/traj_lib.cpp. Unlike PlanTrap.py the profiles are exactly
+the ones the ODrive executes, down to the float rounding and the setpoint of
+each control loop tick.
+
+All functions take numpy arrays (or scalars, which are broadcast) and plan
+one move per element:
+
+    import numpy as np
+    import odrive_traj
+    moves = odrive_traj.plan(Xf=np.linspace(1, 100, 10000), vel_limit=20, accel_limit=50, decel_limit=50, jerk_limit=500)
+    print(moves.duration.max())
+    Y, Yd, Ydd = moves.eval(np.linspace(0, 5, 500)) # shape (10000, 500)
+    Y, Yd, Ydd = moves.ticks(0)                      # setpoints of the first move at 8 kHz
+
+The library is loaded from $ODRIVE_TRAJ_LIB, else from
+Firmware/Tests/libodrive_traj.so, which is built with CONFIG_TRAJ_LIB=true or
+with the C++ compiler of the host if it doesn't exist yet.
+"""
+
+import ctypes
+import os
+import subprocess
+import numpy as np
+
+_firmware_dir = os.path.join(os.path.dirname(os.path.dirname(os.path.dirname(
+                             os.path.realpath(__file__)))), "Firmware")
+_default_lib_path = os.path.join(_firmware_dir, "Tests", "libodrive_traj.so")
+
+# Control loop period of the ODrive v3 (axis.outer_loop_period_ without decimation)
+current_meas_period = 1.0 / 8000
+
+_lib = None
+_f32 = ctypes.POINTER(ctypes.c_float)
+_size = ctypes.c_size_t
+
+def build(lib_path=_default_lib_path):
+    """Compiles the host library, same as the CONFIG_TRAJ_LIB rule in Firmware/Tupfile.lua"""
+    subprocess.check_call([os.environ.get('CXX', 'c++'), '-O2', '-std=c++17', '-shared', '-fPIC',
+                           '-I.', '-I./MotorControl', 'Tests/traj/traj_lib.cpp', 'MotorControl/trapTraj.cpp',
+                           '-o', os.path.abspath(lib_path)], cwd=_firmware_dir)
+
+def _load():
+    global _lib
+    if _lib is None:
+        lib_path = os.environ.get('ODRIVE_TRAJ_LIB', _default_lib_path)
+        if not os.path.exists(lib_path):
+            build(lib_path)
+        lib = ctypes.CDLL(lib_path)
+        lib.odrive_traj_version.restype = ctypes.c_uint32
+        lib.odrive_traj_size.restype = _size
+        lib.odrive_traj_plan.restype = _size
+        lib.odrive_traj_plan.argtypes = [_size] + [_f32] * 7 + [ctypes.c_void_p, ctypes.c_void_p, _f32]
+        lib.odrive_traj_plan_timed.restype = _size
+        lib.odrive_traj_plan_timed.argtypes = [_size] + [_f32] * 5 + [ctypes.c_void_p, ctypes.c_void_p]
+        lib.odrive_traj_min_timed_duration.restype = None
+        lib.odrive_traj_min_timed_duration.argtypes = [_size] + [_f32] * 7
+        lib.odrive_traj_eval.restype = None
+        lib.odrive_traj_eval.argtypes = [_size, ctypes.c_void_p, _size, _f32, _f32, _f32, _f32]
+        lib.odrive_traj_ticks.restype = _size
+        lib.odrive_traj_ticks.argtypes = [ctypes.c_void_p, ctypes.c_float, _size, _f32, _f32, _f32]
+        if lib.odrive_traj_version() != 1:
+            raise Exception("{} doesn't match this script, rebuild it".format(lib_path))
+        _lib = lib
+    return _lib
+
+def _ptr(array):
+    return array.ctypes.data_as(_f32)
+
+def _float_arrays(*args):
+    """Broadcasts the arguments to one shape and returns them as contiguous float32 arrays"""
+    return [np.ascontiguousarray(a, dtype=np.float32) for a in np.broadcast_arrays(*args)]
+
+class Moves():
+    """
+    A batch of planned moves.
+    duration: duration of each move [s], NaN where the plan failed
+    ok: False where the limits were rejected
+    """
+    def __init__(self, shape, buf, ok, duration):
+        self.shape = shape
+        self._buf = buf
+        self.ok = ok
+        self.duration = duration
+
+    def __len__(self):
+        return int(np.prod(self.shape))
+
+    def _traj(self, index):
+        lib = _load()
+        i = np.ravel_multi_index(index if isinstance(index, tuple) else (index,), self.shape) if self.shape else 0
+        return ctypes.addressof(self._buf) + int(i) * lib.odrive_traj_size()
+
+    def eval(self, t):
+        """
+        Evaluates all moves at the times t [s] after their start, the way
+        TrapezoidalTrajectory::eval() does.
+        Returns the position, velocity and acceleration with the shape
+        moves.shape + t.shape.
+        """
+        lib = _load()
+        t = np.ascontiguousarray(t, dtype=np.float32)
+        out = [np.empty(self.shape + t.shape, dtype=np.float32) for _ in range(3)]
+        lib.odrive_traj_eval(len(self), ctypes.addressof(self._buf), t.size, _ptr(t), *[_ptr(a) for a in out])
+        return tuple(out)
+
+    def ticks(self, index, dt=current_meas_period):
+        """
+        Returns the position, velocity and acceleration setpoints of one move
+        for each control loop tick of the period dt, as the controller gets
+        them with INPUT_MODE_TRAP_TRAJ or INPUT_MODE_SCURVE_TRAJ.
+        """
+        lib = _load()
+        traj = self._traj(index)
+        n = lib.odrive_traj_ticks(traj, dt, 0, None, None, None)
+        out = [np.empty(n, dtype=np.float32) for _ in range(3)]
+        lib.odrive_traj_ticks(traj, dt, n, *[_ptr(a) for a in out])
+        return tuple(out)
+
+def plan(Xf, Xi=0.0, Vi=0.0, vel_limit=2.0, accel_limit=0.5, decel_limit=0.5, jerk_limit=None):
+    """
+    Plans moves from the position Xi and velocity Vi to rest at Xf like
+    controller.move_to_pos(). The defaults are those of axis.trap_traj.config.
+    With a jerk_limit the moves are S-curves (INPUT_MODE_SCURVE_TRAJ),
+    else trapezoidal (INPUT_MODE_TRAP_TRAJ). A jerk_limit of 0 or less
+    plans a trapezoidal move too, so both kinds can be mixed in one batch.
+    """
+    lib = _load()
+    args = _float_arrays(Xf, Xi, Vi, vel_limit, accel_limit, decel_limit,
+                         0.0 if jerk_limit is None else jerk_limit)
+    shape = args[0].shape
+    n = args[0].size
+    buf = ctypes.create_string_buffer(max(n, 1) * lib.odrive_traj_size())
+    ok = np.empty(shape, dtype=np.uint8)
+    duration = np.empty(shape, dtype=np.float32)
+    lib.odrive_traj_plan(n, *[_ptr(a) for a in args], ctypes.addressof(buf), ok.ctypes.data, _ptr(duration))
+    return Moves(shape, buf, ok.astype(bool), duration)
+
+def plan_timed(Xf, Xi, T, Ta, Td):
+    """
+    Plans rest to rest moves of the duration T with the accel and decel
+    times Ta and Td like controller.stage_move(). Moves with the same T, Ta
+    and Td on different axes follow a straight line.
+    """
+    lib = _load()
+    args = _float_arrays(Xf, Xi, T, Ta, Td)
+    shape = args[0].shape
+    n = args[0].size
+    buf = ctypes.create_string_buffer(max(n, 1) * lib.odrive_traj_size())
+    ok = np.empty(shape, dtype=np.uint8)
+    lib.odrive_traj_plan_timed(n, *[_ptr(a) for a in args], ctypes.addressof(buf), ok.ctypes.data)
+    ok = ok.astype(bool)
+    return Moves(shape, buf, ok, np.where(ok, args[2], np.nan).astype(np.float32))
+
+def min_timed_duration(dX, vel_limit, accel_limit, decel_limit, Ta, Td):
+    """
+    The shortest duration T of plan_timed() moves over dX that stay within
+    the limits, like controller.get_min_move_time(). For a coordinated move
+    of several axes take the maximum over the axes.
+    """
+    lib = _load()
+    args = _float_arrays(dX, vel_limit, accel_limit, decel_limit, Ta, Td)
+    T = np.empty(args[0].shape, dtype=np.float32)
+    lib.odrive_traj_min_timed_duration(args[0].size, *[_ptr(a) for a in args], _ptr(T))
+    return T
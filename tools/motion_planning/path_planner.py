@@ -0,0 +1,348 @@
+#!/usr/bin/env python3
+"""
+Plans time optimal, jerk limited moves of several axes through a list of
+points and streams them to INPUT_MODE_SPLINE.
+
+This is the optimization of analysis/numeric_path_opt as a tool: each axis
+is a discrete time model whose jerk is constant over each period Ts, and the
+jerks are the variables of a linear program with the velocity, acceleration,
+jerk and torque limits of the axis as constraints. The axes start at rest at
+the first point, pass the intermediate points without stopping and come to
+rest at the last point. All axes pass each point at the same time, the
+number of periods between two points is searched for the shortest that is
+feasible on all axes. Of the feasible moves the one with the least absolute
+acceleration (i.e. current) is taken, like the least copper losses in the
+prototype.
+
+With a constant jerk over each period the position between two samples is a
+cubic polynomial given by the positions and velocities at both ends, which
+is exactly the cubic Hermite segment that INPUT_MODE_SPLINE interpolates.
+The samples are therefore streamed as waypoints with push_waypoint(pos, vel,
+Ts) and the ODrive follows the planned move without approximation.
+
+Usage:
+    path_planner.py path.yaml -o waypoints.csv [--plot] [--compare]
+    path_planner.py path.yaml --stream
+
+path.yaml:
+    period: 0.01   # [s] time between two waypoints
+    axes:          # limits of each axis, the torque limit is optional
+      - {vel_limit: 10, accel_limit: 40, jerk_limit: 800, torque_limit: 0.4, inertia: 0.008, damping: 0.0}
+      - {vel_limit: 10, accel_limit: 40, jerk_limit: 800}
+    points:        # [turn] one position per axis
+      - [0, 0]
+      - [4, 1]
+      - [4, 6]
+      - [0, 0]
+
+The torque of an axis is inertia * acceleration + damping * velocity, in the
+units of controller.config.inertia [Nm/(turn/s^2)] and [Nm/(turn/s)].
+"""
+
+import argparse
+import math
+import time
+import numpy as np
+import scipy.optimize
+
+waypoint_buffer_size = 32 # see Controller::waypoints_
+
+class AxisLimits():
+    def __init__(self, vel_limit, accel_limit, jerk_limit, torque_limit=math.inf, inertia=0.0, damping=0.0):
+        self.vel_limit = vel_limit       # [turn/s]
+        self.accel_limit = accel_limit   # [turn/s^2]
+        self.jerk_limit = jerk_limit     # [turn/s^3]
+        self.torque_limit = torque_limit # [Nm]
+        self.inertia = inertia           # [Nm/(turn/s^2)]
+        self.damping = damping           # [Nm/(turn/s)]
+
+    def has_torque_limit(self):
+        return math.isfinite(self.torque_limit) and (self.inertia > 0.0 or self.damping > 0.0)
+
+    def move_time(self, distance):
+        """
+        Upper bound of the duration of a rest to rest move over the distance,
+        from an S-curve that reaches all limits. With a torque limit the
+        velocity and acceleration are reduced so that they fit in it
+        together.
+        """
+        v = self.vel_limit
+        a = self.accel_limit
+        if self.has_torque_limit():
+            if self.damping > 0.0:
+                v = min(v, 0.5 * self.torque_limit / self.damping)
+            if self.inertia > 0.0:
+                a = min(a, (self.torque_limit - self.damping * v) / self.inertia)
+        return abs(distance) / v + v / a + a / self.jerk_limit
+
+class Path():
+    """
+    A planned move, sampled every period. pos, vel, acc and jerk have one
+    row per sample and one column per axis, jerk holds the jerk from each
+    sample to the next. point_samples are the sample indices of the points.
+    """
+    def __init__(self, period, pos, vel, acc, jerk, point_samples):
+        self.period = period
+        self.pos = pos
+        self.vel = vel
+        self.acc = acc
+        self.jerk = jerk
+        self.point_samples = point_samples
+
+    @property
+    def duration(self):
+        return (len(self.pos) - 1) * self.period
+
+    def waypoints(self):
+        """
+        One row per waypoint: dt, then position and velocity of each axis.
+        The first sample is where the axes are at the start, so it is not a
+        waypoint.
+        """
+        rows = np.empty((len(self.pos) - 1, 1 + 2 * self.pos.shape[1]))
+        rows[:, 0] = self.period
+        rows[:, 1::2] = self.pos[1:]
+        rows[:, 2::2] = self.vel[1:]
+        return rows
+
+    def save(self, file):
+        num_axes = self.pos.shape[1]
+        header = ','.join(['dt'] + ['pos{0},vel{0}'.format(i) for i in range(num_axes)])
+        np.savetxt(file, self.waypoints(), delimiter=',', header=header, comments='', fmt='%.7g')
+
+def load_waypoints(file):
+    """Loads the waypoints saved with Path.save()"""
+    return np.loadtxt(file, delimiter=',', skiprows=1, ndmin=2)
+
+def _prediction_matrices(num_samples, Ts):
+    """
+    Maps the jerks u[j] of the periods 0..num_samples-1 to the acceleration,
+    velocity and position at the samples 1..num_samples relative to a start
+    at rest (see predictionmatrices.m). The jerk u[j] contributes to sample
+    k > j over m = k - j periods.
+    """
+    k = np.arange(1, num_samples + 1)[:, np.newaxis]
+    j = np.arange(num_samples)[np.newaxis, :]
+    m = (k - j).astype(float)
+    active = m >= 1
+    Ga = np.where(active, Ts, 0.0)
+    Gv = np.where(active, Ts**2 * (m - 0.5), 0.0)
+    Gp = np.where(active, Ts**3 / 6.0 * (3 * m**2 - 3 * m + 1), 0.0)
+    return Ga, Gv, Gp
+
+def _solve_axis(limits, Ts, positions, point_samples, least_accel):
+    """
+    Solves the linear program of one axis.
+    positions: the position at each point, starting with the start position
+    point_samples: the sample index of each point, starting with 0
+    least_accel: False to only check feasibility, which is faster
+    Returns the jerks of all periods, or None if the move isn't feasible.
+    """
+    N = point_samples[-1]
+    Ga, Gv, Gp = _prediction_matrices(N, Ts)
+
+    A_ub = [Gv, -Gv, Ga, -Ga]
+    b_ub = [limits.vel_limit] * 2 + [limits.accel_limit] * 2
+    if limits.has_torque_limit():
+        Gt = limits.inertia * Ga + limits.damping * Gv
+        A_ub += [Gt, -Gt]
+        b_ub += [limits.torque_limit] * 2
+    b_ub = np.concatenate([np.full(N, b) for b in b_ub])
+
+    # Pass each point, come to rest at the last one
+    A_eq = [Gp[k - 1] for k in point_samples[1:]] + [Gv[N - 1], Ga[N - 1]]
+    b_eq = [p - positions[0] for p in positions[1:]] + [0.0, 0.0]
+    A_eq = np.array(A_eq)
+    b_eq = np.array(b_eq)
+
+    bounds = [(-limits.jerk_limit, limits.jerk_limit)] * N
+    if least_accel:
+        # minimize sum(s) with -s <= a <= s
+        A_ub = np.block([[np.vstack(A_ub), np.zeros((len(b_ub), N))],
+                         [Ga, -np.eye(N)],
+                         [-Ga, -np.eye(N)]])
+        b_ub = np.concatenate([b_ub, np.zeros(2 * N)])
+        A_eq = np.hstack([A_eq, np.zeros((len(b_eq), N))])
+        bounds += [(0.0, None)] * N
+        c = np.concatenate([np.zeros(N), np.ones(N)])
+    else:
+        A_ub = np.vstack(A_ub)
+        c = np.zeros(N)
+
+    result = scipy.optimize.linprog(c, A_ub=A_ub, b_ub=b_ub, A_eq=A_eq, b_eq=b_eq,
+                                    bounds=bounds, method='highs')
+    return result.x[:N] if result.status == 0 else None
+
+def plan_path(points, limits, period=0.01, logger=None):
+    """
+    Plans the shortest move through points (one row per point, one column per
+    axis) within the limits (one AxisLimits per axis).
+    The search for the number of periods between two points first scales all
+    segments together and then shortens one segment at a time. It finds the
+    shortest move for the order of points, but as a search over integers
+    not necessarily the global optimum.
+    """
+    points = np.array(points, dtype=float)
+    if points.ndim != 2 or len(points) < 2 or points.shape[1] != len(limits):
+        raise ValueError("need at least two points with one position per axis")
+    num_axes = len(limits)
+
+    def to_samples(segments):
+        return np.concatenate([[0], np.cumsum(segments)]).astype(int)
+
+    def feasible(segments):
+        samples = to_samples(segments)
+        return all(_solve_axis(limits[i], period, points[:, i], samples, False) is not None
+                   for i in range(num_axes))
+
+    # Stopping at every point is always possible, the margin covers the
+    # rounding of the switching times to whole periods
+    segments = np.array([max(1, math.ceil(max(limits[i].move_time(points[s + 1, i] - points[s, i])
+                                               for i in range(num_axes)) / period) + 8)
+                         for s in range(len(points) - 1)])
+    for _ in range(4):
+        if feasible(segments):
+            break
+        segments *= 2
+    else:
+        raise ValueError("no feasible move found, check the limits")
+
+    # Scale all segments together
+    lo, hi = 0.0, 1.0
+    initial = segments.copy()
+    for _ in range(10):
+        mid = 0.5 * (lo + hi)
+        candidate = np.maximum(1, np.round(initial * mid)).astype(int)
+        if feasible(candidate):
+            hi = mid
+            segments = candidate
+        else:
+            lo = mid
+
+    # Shorten each segment on its own
+    for s in range(len(segments)):
+        lo, hi = 0, segments[s] # lo is infeasible, hi feasible
+        while hi - lo > 1:
+            mid = (lo + hi) // 2
+            candidate = segments.copy()
+            candidate[s] = mid
+            if feasible(candidate):
+                hi = mid
+            else:
+                lo = mid
+        segments[s] = hi
+        if logger:
+            logger("segment {}: {:.3f}s".format(s, hi * period))
+
+    samples = to_samples(segments)
+    N = samples[-1]
+    Ga, Gv, Gp = _prediction_matrices(N, period)
+    jerk = np.zeros((N, num_axes))
+    pos = np.empty((N + 1, num_axes))
+    vel = np.zeros((N + 1, num_axes))
+    acc = np.zeros((N + 1, num_axes))
+    for i in range(num_axes):
+        u = _solve_axis(limits[i], period, points[:, i], samples, True)
+        if u is None:
+            raise ValueError("axis {}: the final solution failed".format(i))
+        jerk[:, i] = u
+        pos[0, i] = points[0, i]
+        pos[1:, i] = points[0, i] + Gp @ u
+        vel[1:, i] = Gv @ u
+        acc[1:, i] = Ga @ u
+    # the end is exactly at rest on the last point, not just within the solver tolerance
+    pos[-1], vel[-1], acc[-1] = points[-1], 0.0, 0.0
+    return Path(period, pos, vel, acc, jerk, samples)
+
+def stream(axes, waypoints, poll_interval=None):
+    """
+    Streams the waypoints (see Path.waypoints()) to the axes, one odrivetool
+    axis object per axis of the path. The axes must be in closed loop control
+    with their setpoint at the start of the path. The buffers are filled
+    before all axes switch to INPUT_MODE_SPLINE, so they start at nearly the
+    same time, and then kept filled until the end of the path.
+    """
+    from odrive.enums import INPUT_MODE_SPLINE
+    if poll_interval is None:
+        poll_interval = waypoints[0, 0] * 4
+
+    def push(rows):
+        for row in rows:
+            for i, axis in enumerate(axes):
+                if not axis.controller.push_waypoint(float(row[1 + 2 * i]), float(row[2 + 2 * i]), float(row[0])):
+                    raise Exception("axis {} rejected a waypoint".format(i))
+
+    for axis in axes:
+        axis.controller.clear_waypoints()
+    # waypoint_buffer_depth only updates in INPUT_MODE_SPLINE
+    next_row = min(len(waypoints), waypoint_buffer_size - 1)
+    push(waypoints[:next_row])
+    for axis in axes:
+        axis.controller.config.input_mode = INPUT_MODE_SPLINE
+
+    while next_row < len(waypoints):
+        # one waypoint of margin for a depth from the previous control loop tick
+        free = waypoint_buffer_size - 1 - max(axis.controller.waypoint_buffer_depth for axis in axes)
+        if free > 0:
+            push(waypoints[next_row:next_row + free])
+            next_row += free
+        time.sleep(poll_interval)
+    while any(axis.controller.waypoint_buffer_depth for axis in axes):
+        time.sleep(poll_interval)
+
+def independent_moves_duration(points, limits):
+    """
+    Duration of the same path as S-curve moves of the firmware planner that
+    stop at each point, each segment taking as long as its slowest axis
+    """
+    import odrive_traj
+    points = np.array(points, dtype=float)
+    total = 0.0
+    for s in range(len(points) - 1):
+        moves = odrive_traj.plan(points[s + 1], points[s], 0.0,
+                                 [l.vel_limit for l in limits], [l.accel_limit for l in limits],
+                                 [l.accel_limit for l in limits], [l.jerk_limit for l in limits])
+        total += float(np.max(moves.duration))
+    return total
+
+def main():
+    import yaml
+    parser = argparse.ArgumentParser(description='Plans time optimal jerk limited moves of several axes through a list of points')
+    parser.add_argument('path', metavar='PATH_YAML', help='limits and points, see the top of this file')
+    parser.add_argument('-o', '--output', metavar='CSV', help='save the waypoints to this file')
+    parser.add_argument('--plot', action='store_true', help='plot the planned move')
+    parser.add_argument('--compare', action='store_true', help='print the duration of S-curve moves that stop at each point')
+    parser.add_argument('--stream', action='store_true', help='stream the move to the axes of the first ODrive found')
+    args = parser.parse_args()
+
+    with open(args.path) as fp:
+        spec = yaml.safe_load(fp)
+    limits = [AxisLimits(**axis_yaml) for axis_yaml in spec['axes']]
+    path = plan_path(spec['points'], limits, spec.get('period', 0.01), logger=print)
+    print("duration: {:.3f}s in {} waypoints".format(path.duration, len(path.pos) - 1))
+    if args.compare:
+        print("S-curve moves that stop at each point: {:.3f}s".format(independent_moves_duration(spec['points'], limits)))
+
+    if args.output:
+        path.save(args.output)
+
+    if args.plot:
+        import matplotlib.pyplot as plt
+        t = np.arange(len(path.pos)) * path.period
+        fig, ax = plt.subplots(4, sharex=True)
+        for i, (name, values) in enumerate([('pos [turn]', path.pos), ('vel [turn/s]', path.vel),
+                                            ('acc [turn/s^2]', path.acc)]):
+            ax[i].plot(t, values)
+            ax[i].set_ylabel(name)
+        ax[3].step(t[:-1], path.jerk, where='post')
+        ax[3].set_ylabel('jerk [turn/s^3]')
+        ax[3].set_xlabel('t [s]')
+        plt.show()
+
+    if args.stream:
+        import odrive
+        odrv = odrive.find_any()
+        stream([getattr(odrv, 'axis{}'.format(i)) for i in range(len(limits))], path.waypoints())
+
+if __name__ == '__main__':
+    main()
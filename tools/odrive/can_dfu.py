@@ -0,0 +1,193 @@
+"""
+Firmware update over CAN, see "Firmware update over CAN" in docs/can-protocol.md
+"""
+
+from __future__ import print_function
+import struct
+import sys
+import threading
+import time
+from fibre.can_transport import CanBus
+from odrive.utils import OperationAbortedException
+
+try:
+    from intelhex import IntelHex
+except:
+    print("You need intelhex for this (pip install IntelHex)", file=sys.stderr)
+    sys.exit(1)
+
+# Must match CANUpdate in Firmware/communication/can_update.hpp
+BASE_ID = 0x1FFFF800
+MULTICAST_OFFSET = 0x400
+MAX_BLOCK_FRAMES = 64
+FLASH_BASE = 0x08000000
+MAX_IMAGE_SIZE = 0x60000
+
+CMD_START = 0x01
+CMD_BLOCK = 0x02
+CMD_FINISH = 0x03
+CMD_APPLY = 0x04
+CMD_STATUS = 0x05
+CMD_ABORT = 0x06
+
+STATE_IDLE = 0
+STATE_RECEIVING = 1
+STATE_VERIFIED = 2
+STATE_FAILED = 3
+
+ERROR_NAMES = ["none", "a motor is armed", "image too large", "erase failed",
+               "program failed", "CRC mismatch", "invalid state", "invalid command"]
+
+ERASE_TIMEOUT = 10.0 # [s] the staging area is up to three 128kB sectors
+STATUS_TIMEOUT = 1.0 # [s]
+
+def crc32_mpeg2(data):
+    """
+    CRC-32/MPEG-2 over little endian 32-bit words, as the CRC unit of the
+    STM32 computes it. len(data) must be a multiple of 4.
+    """
+    crc = 0xffffffff
+    for (word,) in struct.iter_unpack('<I', data):
+        crc ^= word
+        for _ in range(32):
+            crc = ((crc << 1) ^ 0x04c11db7) & 0xffffffff if crc & 0x80000000 else (crc << 1) & 0xffffffff
+    return crc
+
+def load_image(path):
+    """Returns the application image of the hex file, padded with 0xff to whole words"""
+    hexfile = IntelHex(path)
+    start, end = hexfile.minaddr(), hexfile.maxaddr() + 1
+    if start != FLASH_BASE:
+        raise Exception("the image must start at 0x{:08X}".format(FLASH_BASE))
+    end = (end + 3) & ~3
+    data = bytes(hexfile.tobinarray(start=start, end=end - 1))
+    if len(data) > MAX_IMAGE_SIZE:
+        raise Exception("the image is {} bytes, at most {} bytes can be updated over CAN".format(len(data), MAX_IMAGE_SIZE))
+    return data
+
+class Node():
+    """Status of one ODrive, updated by the status frames"""
+    def __init__(self, bus, node_id):
+        self.node_id = node_id
+        self.state = None
+        self.error = 0
+        self.received = 0
+        self.updated = threading.Event()
+        bus.add_handler(BASE_ID + 4 * node_id + 2, self._on_status)
+
+    def _on_status(self, data):
+        if len(data) < 6:
+            return
+        self.state, self.error, self.received = struct.unpack('<BBI', bytes(data[:6]))
+        self.updated.set()
+
+    def __str__(self):
+        return "node {}".format(self.node_id)
+
+class CanUpdater():
+    def __init__(self, bus, node_ids, logger):
+        self._bus = bus
+        self._logger = logger
+        self.nodes = [Node(bus, node_id) for node_id in node_ids]
+        # One node is addressed directly, several at once by multicast
+        if len(node_ids) == 1:
+            self._command_id = BASE_ID + 4 * node_ids[0]
+        else:
+            self._command_id = BASE_ID + MULTICAST_OFFSET
+        self._data_id = self._command_id + 1
+
+    def _send(self, can_id, data):
+        # The TX queue of the host interface may run full, retry for a while
+        for _ in range(100):
+            try:
+                self._bus.send(can_id, data)
+                return
+            except Exception:
+                time.sleep(0.001)
+        raise Exception("CAN bus not writable")
+
+    def _wait_status(self, timeout, cancellation_token):
+        """Waits for a status frame from all nodes, queries the ones that stay silent once"""
+        deadline = time.monotonic() + timeout
+        for queried in (False, True):
+            for node in self.nodes:
+                while not node.updated.wait(0.01):
+                    if cancellation_token.is_set():
+                        raise OperationAbortedException()
+                    if time.monotonic() > deadline:
+                        break
+            missing = [node for node in self.nodes if not node.updated.is_set()]
+            if not missing:
+                return
+            if queried:
+                raise Exception("no response from " + ", ".join(str(node) for node in missing))
+            for node in missing:
+                self._send(BASE_ID + 4 * node.node_id, [CMD_STATUS])
+            deadline = time.monotonic() + STATUS_TIMEOUT
+
+    def _command(self, data, timeout, cancellation_token):
+        for node in self.nodes:
+            node.updated.clear()
+        self._send(self._command_id, data)
+        self._wait_status(timeout, cancellation_token)
+
+    def _check(self, state, what):
+        failed = [node for node in self.nodes if node.state != state]
+        for node in failed:
+            self._logger.error("{} {}: {}".format(node, what, ERROR_NAMES[node.error] if node.error < len(ERROR_NAMES) else node.error))
+        if failed:
+            raise Exception(what)
+
+    def update(self, image, cancellation_token):
+        crc = crc32_mpeg2(image)
+        print("Erasing... ", end='')
+        self._command(struct.pack('<BI', CMD_START, len(image))[:4] + struct.pack('<I', crc), ERASE_TIMEOUT, cancellation_token)
+        self._check(STATE_RECEIVING, "erase failed")
+        print("done")
+
+        # Go-back transfer: each block starts at the lowest offset any node
+        # has, the nodes that are ahead skip it
+        block_size = MAX_BLOCK_FRAMES * 8
+        while True:
+            offset = min(node.received for node in self.nodes)
+            if offset >= len(image):
+                break
+            self._check(STATE_RECEIVING, "transfer failed")
+            chunk = image[offset:offset + block_size]
+            chunk += b'\xff' * (-len(chunk) % 8)
+            for node in self.nodes:
+                node.updated.clear()
+            self._send(self._command_id, struct.pack('<BIB', CMD_BLOCK, offset, len(chunk) // 8))
+            for i in range(0, len(chunk), 8):
+                self._send(self._data_id, chunk[i:i + 8])
+            self._wait_status(STATUS_TIMEOUT, cancellation_token)
+            print("Writing... {:3}%".format(min(offset + block_size, len(image)) * 100 // len(image)), end='\r')
+        print("Writing... done")
+
+        print("Verifying... ", end='')
+        self._command([CMD_FINISH], STATUS_TIMEOUT, cancellation_token)
+        self._check(STATE_VERIFIED, "verification failed")
+        print("done")
+
+        print("Installing...")
+        self._command([CMD_APPLY], STATUS_TIMEOUT, cancellation_token)
+        self._check(STATE_VERIFIED, "install failed")
+
+    def abort(self):
+        self._send(self._command_id, [CMD_ABORT])
+
+def launch_can_dfu(args, logger, cancellation_token):
+    """
+    Updates the firmware of the ODrives args.nodes on a python-can bus
+    """
+    image = load_image(args.file)
+    bus = CanBus.get(args.interface, args.channel, logger)
+    updater = CanUpdater(bus, args.nodes, logger)
+    print("Updating {} with {} bytes".format(", ".join(str(node) for node in updater.nodes), len(image)))
+    try:
+        updater.update(image, cancellation_token)
+    except:
+        updater.abort()
+        raise
+    print("The ODrives are installing the new firmware and reboot, this takes about 10 seconds.")
+    print("Do not remove the power before they are back, recovering needs a USB DFU update.")
@@ -0,0 +1,308 @@
+"""
+Host side CAN Simple master for several ODrive axes on one bus, see
+docs/can-protocol.md.
+
+Every cycle the master sends the setpoints of all nodes, then the sync
+message (if configured) and then the RTR requests that are due. The decoded
+responses and cyclic messages of the axes are kept in numpy arrays with one
+entry per node, in the order of `node_ids`.
+
+Example with python-can:
+
+    import can
+    from odrive.can_master import CanMaster
+    bus = can.interface.Bus(bustype='socketcan', channel='can0', bitrate=250000)
+    master = CanMaster(bus, node_ids=[0, 1, 2, 3], sync_msg_id=0x080)
+    master.request('get_iq', every=10)
+    master.start()
+    master.set_input_vel([1.0, -1.0, 2.0, -2.0])
+    master.run(period=0.005, duration=10.0)
+    print(master.data['get_encoder_estimates']['pos_estimate'])
+"""
+
+from __future__ import print_function
+import struct
+import threading
+import time
+import numpy as np
+
+# Must match CANSimple in Firmware/communication/can_simple.hpp
+NUM_CMD_ID_BITS = 5
+
+# name: (cmd_id, [(field, struct format, factor)]), all little endian.
+# The fields are value = raw * factor.
+MESSAGES = {
+    'heartbeat': (0x001, [('axis_error', 'I', 1), ('axis_state', 'I', 1)]),
+    'estop': (0x002, []),
+    'get_motor_error': (0x003, [('motor_error', 'I', 1)]),
+    'get_encoder_error': (0x004, [('encoder_error', 'I', 1)]),
+    'get_sensorless_error': (0x005, [('sensorless_error', 'I', 1)]),
+    'set_axis_node_id': (0x006, [('node_id', 'I', 1)]),
+    'set_axis_requested_state': (0x007, [('requested_state', 'I', 1)]),
+    'set_config_profile': (0x008, [('profile', 'B', 1)]),
+    'get_encoder_estimates': (0x009, [('pos_estimate', 'f', 1), ('vel_estimate', 'f', 1)]),
+    'get_encoder_count': (0x00A, [('shadow_count', 'i', 1), ('count_in_cpr', 'i', 1)]),
+    'set_controller_modes': (0x00B, [('control_mode', 'i', 1), ('input_mode', 'i', 1)]),
+    'set_input_pos': (0x00C, [('input_pos', 'f', 1), ('vel_ff', 'h', 0.001), ('torque_ff', 'h', 0.001)]),
+    'set_input_vel': (0x00D, [('input_vel', 'f', 1), ('torque_ff', 'f', 1)]),
+    'set_input_torque': (0x00E, [('input_torque', 'f', 1)]),
+    'set_vel_limit': (0x00F, [('vel_limit', 'f', 1)]),
+    'start_anticogging': (0x010, []),
+    'set_traj_vel_limit': (0x011, [('traj_vel_limit', 'f', 1)]),
+    'set_traj_accel_limits': (0x012, [('traj_accel_limit', 'f', 1), ('traj_decel_limit', 'f', 1)]),
+    'set_traj_inertia': (0x013, [('traj_inertia', 'f', 1)]),
+    'get_iq': (0x014, [('iq_setpoint', 'f', 1), ('iq_measured', 'f', 1)]),
+    'get_sensorless_estimates': (0x015, [('pos_estimate', 'f', 1), ('vel_estimate', 'f', 1)]),
+    'reboot': (0x016, []),
+    'get_vbus_voltage': (0x017, [('vbus_voltage', 'f', 1)]),
+    'clear_errors': (0x018, []),
+    'set_linear_count': (0x019, [('position', 'i', 1)]),
+    'queue_move': (0x01A, [('goal_pos', 'f', 1), ('vel_limit', 'H', 0.01), ('accel_limit', 'H', 0.01)]),
+    'get_move_queue_status': (0x01B, [('queue_depth', 'I', 1), ('underruns', 'I', 1)]),
+    'push_waypoint': (0x01C, [('pos', 'f', 1), ('vel', 'h', 0.001), ('dt', 'H', 0.0001)]),
+    'get_waypoint_status': (0x01D, [('buffer_depth', 'I', 1), ('underruns', 'I', 1)]),
+    'stage_move': (0x01E, [('goal_pos', 'f', 1), ('duration', 'H', 0.001), ('accel_fraction', 'B', 1 / 256), ('decel_fraction', 'B', 1 / 256)]),
+    'get_feedback': (0x01F, None), # configured signals, see CanMaster.feedback_signals
+}
+
+# Messages that the axes send, on RTR or cyclic
+AXIS_MESSAGES = ['heartbeat', 'get_motor_error', 'get_encoder_error', 'get_sensorless_error',
+                 'get_encoder_estimates', 'get_encoder_count', 'get_iq', 'get_sensorless_estimates',
+                 'get_vbus_voltage', 'get_move_queue_status', 'get_waypoint_status', 'get_feedback']
+
+_CMD_NAMES = {cmd_id: name for name, (cmd_id, fields) in MESSAGES.items()}
+_INT_RANGES = {'b': (-2**7, 2**7 - 1), 'B': (0, 2**8 - 1), 'h': (-2**15, 2**15 - 1), 'H': (0, 2**16 - 1),
+               'i': (-2**31, 2**31 - 1), 'I': (0, 2**32 - 1)}
+
+def encode(name, **values):
+    """
+    Returns the payload of a message. Integer fields are rounded and
+    saturated to their range, missing fields are 0.
+    """
+    cmd_id, fields = MESSAGES[name]
+    raw = []
+    for field, fmt, factor in fields:
+        value = values.get(field, 0) / factor
+        if fmt in _INT_RANGES:
+            lo, hi = _INT_RANGES[fmt]
+            value = int(min(max(round(value), lo), hi))
+        raw.append(value)
+    return struct.pack('<' + ''.join(fmt for _, fmt, _ in fields), *raw)
+
+def decode(name, data, feedback_signals=None):
+    """
+    Returns the fields of a message as a dict, or None if the payload is too
+    short. Get Feedback is decoded with feedback_signals.
+    """
+    cmd_id, fields = MESSAGES[name]
+    if fields is None:
+        return decode_feedback(data, feedback_signals or [])
+    fmt = '<' + ''.join(fmt for _, fmt, _ in fields)
+    if len(data) < struct.calcsize(fmt):
+        return None
+    raw = struct.unpack(fmt, bytes(data[:struct.calcsize(fmt)]))
+    return {field: r * factor for (field, fmt, factor), r in zip(fields, raw)}
+
+def decode_feedback(data, signals):
+    """
+    Unpacks the Get Feedback message. `signals` lists the enabled
+    feedback_signal configs of the axis in order, as tuples
+    (name, length, factor, offset, is_signed).
+    """
+    bits = int.from_bytes(bytes(data), 'little')
+    result = {}
+    bit = 0
+    for name, length, factor, offset, is_signed in signals:
+        if bit + length > 8 * len(data):
+            break
+        raw = (bits >> bit) & ((1 << length) - 1)
+        if is_signed and raw & (1 << (length - 1)):
+            raw -= 1 << length
+        result[name] = raw * factor + offset
+        bit += length
+    return result
+
+def frame_bits(dlc, is_extended=False):
+    """Worst case length of a data or remote frame on the bus, including bit stuffing and interframe space"""
+    # SOF, ID, RTR/SRR/IDE, control, data, CRC are stuffed, then CRC delimiter, ACK, EOF and IFS
+    stuffed = (39 if is_extended else 19) + 15 + 8 * dlc
+    return stuffed + (stuffed - 1) // 4 + 13
+
+class CanMaster():
+    """
+    Schedules the cyclic setpoints and feedback requests of several axes.
+    `bus` is a python-can bus, `node_ids` the axis.config.can.node_id of
+    each axis. With `sync_msg_id` (odrv.can.config.sync_msg_id) the sync
+    message follows the setpoints of each cycle; with axis.config.can.sync_mode
+    the axes then apply them together and answer with their encoder
+    estimates, so no encoder estimates are requested.
+    """
+    def __init__(self, bus, node_ids, is_extended=False, sync_msg_id=None, feedback_signals=None):
+        self.bus = bus
+        self.node_ids = list(node_ids)
+        self.is_extended = is_extended
+        self.sync_msg_id = sync_msg_id
+        self.feedback_signals = feedback_signals or []
+        self.cycle = 0
+        n = len(self.node_ids)
+        self._index = {node_id: i for i, node_id in enumerate(self.node_ids)}
+        self._setpoint = None # name of the set_input message sent every cycle
+        self._setpoints = {}
+        self._requests = {} # name: every n cycles
+        self._running = False
+        self._thread = None
+        self.lock = threading.Lock()
+
+        # Latest values of the messages of the axes
+        self.data = {}
+        for name in AXIS_MESSAGES:
+            fields = MESSAGES[name][1]
+            names = [f for f, _, _ in fields] if fields is not None else [s[0] for s in self.feedback_signals]
+            self.data[name] = {field: np.full(n, np.nan) for field in names}
+        self.timestamps = {name: np.full(n, np.nan) for name in AXIS_MESSAGES}
+        self.counts = {name: np.zeros(n, dtype=np.int64) for name in AXIS_MESSAGES}
+
+    def arbitration_id(self, node_id, name):
+        return (node_id << NUM_CMD_ID_BITS) | MESSAGES[name][0]
+
+    def _set(self, name, values):
+        n = len(self.node_ids)
+        with self.lock:
+            self._setpoint = name
+            self._setpoints = {k: np.broadcast_to(np.asarray(v, dtype=float), (n,)).copy() for k, v in values.items()}
+
+    def set_input_pos(self, input_pos, vel_ff=0.0, torque_ff=0.0):
+        """Sends Set Input Pos to all nodes every cycle, scalars apply to all nodes"""
+        self._set('set_input_pos', {'input_pos': input_pos, 'vel_ff': vel_ff, 'torque_ff': torque_ff})
+
+    def set_input_vel(self, input_vel, torque_ff=0.0):
+        """Sends Set Input Vel to all nodes every cycle, scalars apply to all nodes"""
+        self._set('set_input_vel', {'input_vel': input_vel, 'torque_ff': torque_ff})
+
+    def set_input_torque(self, input_torque):
+        """Sends Set Input Torque to all nodes every cycle, scalars apply to all nodes"""
+        self._set('set_input_torque', {'input_torque': input_torque})
+
+    def stop_setpoints(self):
+        with self.lock:
+            self._setpoint = None
+
+    def request(self, name, every=1):
+        """
+        Requests a message of each node with RTR every `every` cycles. The
+        requests of the nodes are spread over the cycles, so the bus load is
+        the same in each cycle. every=0 stops the requests.
+        """
+        if not name in AXIS_MESSAGES or name == 'heartbeat':
+            raise Exception("{} can't be requested".format(name))
+        with self.lock:
+            if every:
+                self._requests[name] = every
+            else:
+                self._requests.pop(name, None)
+
+    def cycle_frames(self, cycle):
+        """
+        Returns the frames of a cycle in the order they are sent, as tuples
+        (arbitration_id, data, is_remote). The setpoints go first so that
+        the sync message applies them, then the requests, lowest ID first.
+        """
+        frames = []
+        with self.lock:
+            if self._setpoint:
+                for i, node_id in enumerate(self.node_ids):
+                    values = {k: v[i] for k, v in self._setpoints.items()}
+                    frames.append((self.arbitration_id(node_id, self._setpoint), encode(self._setpoint, **values), False))
+            if self.sync_msg_id is not None:
+                frames.append((self.sync_msg_id, b'', False))
+            requests = []
+            for name, every in self._requests.items():
+                if name == 'get_encoder_estimates' and self.sync_msg_id is not None:
+                    continue # sent by the axes after the sync message
+                for i, node_id in enumerate(self.node_ids):
+                    if (cycle + i) % every == 0:
+                        requests.append((self.arbitration_id(node_id, name), b'', True))
+            frames += sorted(requests)
+        return frames
+
+    def cycle_bits(self, cycle):
+        """Returns the worst case bus time of a cycle in bits, including the responses to the requests"""
+        bits = 0
+        for _, data, is_remote in self.cycle_frames(cycle):
+            bits += frame_bits(0 if is_remote else len(data), self.is_extended)
+            if is_remote:
+                bits += frame_bits(8, self.is_extended)
+        return bits
+
+    def bus_load(self, period, baud_rate):
+        """Returns the worst case average bus load of the schedule at a cycle period [s]"""
+        cycles = int(np.lcm.reduce([1] + list(self._requests.values())))
+        bits = sum(self.cycle_bits(c) for c in range(cycles)) / cycles
+        return bits / (period * baud_rate)
+
+    def step(self):
+        """Sends the frames of the next cycle"""
+        import can
+        for arbitration_id, data, is_remote in self.cycle_frames(self.cycle):
+            is_extended = self.is_extended and arbitration_id != self.sync_msg_id
+            self.bus.send(can.Message(arbitration_id=arbitration_id, is_extended_id=is_extended,
+                                      data=data, is_remote_frame=is_remote, dlc=8 if is_remote else len(data)))
+        self.cycle += 1
+
+    def run(self, period, duration=None, on_cycle=None):
+        """
+        Sends a cycle every `period` [s] for `duration` [s] or forever. Keeps
+        the period on average without catching up on missed cycles.
+        `on_cycle(master)` is called before each cycle, e.g. to update the
+        setpoints.
+        """
+        start = next_time = time.monotonic()
+        while duration is None or time.monotonic() - start < duration:
+            if on_cycle:
+                on_cycle(self)
+            self.step()
+            next_time += period
+            delay = next_time - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            else:
+                next_time = time.monotonic()
+
+    def handle_message(self, msg):
+        """Decodes a message of an axis into self.data, returns the message name or None"""
+        if msg.is_remote_frame or msg.is_extended_id != self.is_extended:
+            return None
+        i = self._index.get(msg.arbitration_id >> NUM_CMD_ID_BITS, None)
+        name = _CMD_NAMES.get(msg.arbitration_id & ((1 << NUM_CMD_ID_BITS) - 1), None)
+        if i is None or not name in self.data:
+            return None
+        values = decode(name, msg.data, self.feedback_signals)
+        if values is None:
+            return None
+        with self.lock:
+            for field, value in values.items():
+                self.data[name][field][i] = value
+            self.timestamps[name][i] = msg.timestamp if msg.timestamp else time.monotonic()
+            self.counts[name][i] += 1
+        return name
+
+    def start(self):
+        """Starts a thread that receives and decodes the messages of the axes"""
+        if self._thread:
+            return
+        self._running = True
+        self._thread = threading.Thread(target=self._receiver_thread)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def stop(self):
+        self._running = False
+        if self._thread:
+            self._thread.join()
+            self._thread = None
+
+    def _receiver_thread(self):
+        while self._running:
+            msg = self.bus.recv(0.1)
+            if msg is not None:
+                self.handle_message(msg)
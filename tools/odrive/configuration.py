@@ -1,4 +1,5 @@
 
+import base64
 import json
 import os
 import tempfile
@@ -38,11 +39,14 @@ def get_temp_config_filename(device):
     safe_serial_number = ''.join(filter(str.isalnum, serial_number))
     return os.path.join(tempfile.gettempdir(), 'odrive-config-{}.json'.format(safe_serial_number))
 
-def backup_config(device, filename, logger):
+def backup_config(device, filename, logger, use_image=True):
     """
     Exports the configuration of an ODrive to a JSON file.
     If no file name is provided, the file is placed into a
     temporary directory.
+    With use_image, firmware that supports it sends the configuration as one
+    image, which is much faster than reading each property but can only be
+    restored to a firmware with the same configuration format.
     """
 
     if filename is None:
@@ -54,7 +58,14 @@ def backup_config(device, filename, logger):
         if not yes_no_prompt("The file {} already exists. Do you want to override it?".format(filename), True):
             raise OperationAbortedException()
 
-    data = get_dict(device, False)
+    if use_image and hasattr(device, 'read_configuration_image'):
+        # The records the ODrive stores in NVM, in one bulk read
+        image = device.read_configuration_image()
+        if len(image) == 0:
+            raise Exception("the ODrive could not provide a configuration image")
+        data = {'configuration_image': base64.b64encode(image).decode('ascii')}
+    else:
+        data = get_dict(device, False)
     with open(filename, 'w') as file:
         json.dump(data, file)
     logger.info("Configuration saved.")
@@ -71,7 +82,19 @@ def restore_config(device, filename, logger):
         data = json.load(file)
 
     logger.info("Restoring configuration from {}...".format(filename))
-    errors = set_dict(device, "", data)
+    if 'configuration_image' in data:
+        if not hasattr(device, 'start_configuration_restore'):
+            raise Exception("the firmware on this ODrive can't restore a configuration image")
+        image = base64.b64decode(data['configuration_image'])
+        if not (device.start_configuration_restore(len(image))
+                and device.write_configuration_image.write(image)
+                and device.finish_configuration_restore()):
+            raise Exception("the ODrive rejected the configuration image. It must be from "
+                            "a firmware with the same configuration format and all motors "
+                            "must be idle.")
+        errors = []
+    else:
+        errors = set_dict(device, "", data)
 
     for error in errors:
         logger.info(error)
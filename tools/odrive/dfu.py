@@ -83,6 +83,22 @@ def get_first_mismatch_index(array1, array2):
             return pos
     return None
 
+def get_changed_sectors(dfudev, touched_sectors):
+    """
+    Reads back the touched sectors from the device and returns only those
+    whose content differs from the data in the hex file.
+    """
+    changed_sectors = []
+    try:
+        for i, (sector, data) in enumerate(touched_sectors):
+            print("Comparing... (sector {}/{})  \r".format(i, len(touched_sectors)), end='', flush=True)
+            if bytes(dfudev.read_sector(sector)) != bytes(data):
+                changed_sectors.append((sector, data))
+        print('Comparing... done            \r', end='', flush=True)
+    finally:
+        print('', flush=True)
+    return changed_sectors
+
 def dump_otp(dfudev):
     """
     Dumps the contents of the one-time-programmable
@@ -254,7 +270,7 @@ def find_device_in_dfu_mode(serial_number, cancellation_token):
         time.sleep(1)
     return None
 
-def update_device(device, firmware, logger, cancellation_token):
+def update_device(device, firmware, logger, cancellation_token, differential=False):
     """
     Updates the specified device with the specified firmware.
     The device passed to this function can either be in
@@ -262,6 +278,8 @@ def update_device(device, firmware, logger, cancellation_token):
     The firmware should be an instance of Firmware or None.
     If firmware is None, the newest firmware for the device is
     downloaded from GitHub releases.
+    If differential is True, the sectors are read back first and only
+    those that differ from the firmware are erased and written.
     """
 
     if isinstance(device, usb.core.Device):
@@ -351,7 +369,8 @@ def update_device(device, firmware, logger, cancellation_token):
     if dfudev is None:
         do_backup_config = device.user_config_loaded if hasattr(device, 'user_config_loaded') else False
         if do_backup_config:
-            odrive.configuration.backup_config(device, None, logger)
+            # The new firmware may store the configuration in another format
+            odrive.configuration.backup_config(device, None, logger, use_image=False)
     elif not odrive.utils.yes_no_prompt("The configuration cannot be backed up because the device is already in DFU mode. The configuration may be lost after updating. Do you want to continue anyway?", True):
         raise OperationAbortedException()
 
@@ -373,6 +392,11 @@ def update_device(device, firmware, logger, cancellation_token):
     # fill sectors with data
     touched_sectors = list(populate_sectors(dfudev.sectors, hexfile))
 
+    if differential:
+        num_touched = len(touched_sectors)
+        touched_sectors = get_changed_sectors(dfudev, touched_sectors)
+        print("{} of {} sectors changed".format(len(touched_sectors), num_touched))
+
     logger.debug("The following sectors will be flashed: ")
     for sector,_ in touched_sectors:
         logger.debug(" {:08X} to {:08X}".format(sector['addr'], sector['addr'] + sector['len'] - 1))
@@ -462,7 +486,7 @@ def launch_dfu(args, logger, cancellation_token):
     device = devices[0] or devices[1]
     firmware = FirmwareFromFile(args.file) if args.file else None
 
-    update_device(device, firmware, logger, cancellation_token)
+    update_device(device, firmware, logger, cancellation_token, differential=args.differential)
 
 
 
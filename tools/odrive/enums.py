@@ -19,9 +19,32 @@ GPIO_MODE_ENC0                           = 11
 GPIO_MODE_ENC1                           = 12
 GPIO_MODE_ENC2                           = 13
 GPIO_MODE_MECH_BRAKE                     = 14
+GPIO_MODE_POSITION_COMPARE               = 15
+
+# ODrive.BenchmarkKernel
+BENCHMARK_KERNEL_SVM                     = 0
+BENCHMARK_KERNEL_MINMAX_SVM              = 1
+BENCHMARK_KERNEL_FAST_ATAN2              = 2
+BENCHMARK_KERNEL_SIN                     = 3
+BENCHMARK_KERNEL_SINCOS                  = 4
+BENCHMARK_KERNEL_CRC16                   = 5
+BENCHMARK_KERNEL_TRAP_TRAJ_EVAL          = 6
+
+# ODrive.StreamProtocol
+STREAM_PROTOCOL_FIBRE                    = 0
+STREAM_PROTOCOL_ASCII                    = 1
+STREAM_PROTOCOL_ASCII_AND_FIBRE          = 2
+STREAM_PROTOCOL_BINARY                   = 3
+
+# ODrive.ThreadPriority
+THREAD_PRIORITY_LOW                      = 0
+THREAD_PRIORITY_BELOW_NORMAL             = 1
+THREAD_PRIORITY_NORMAL                   = 2
+THREAD_PRIORITY_ABOVE_NORMAL             = 3
 
 # ODrive.Can.Protocol
 PROTOCOL_SIMPLE                          = 0
+PROTOCOL_CANOPEN                         = 1
 
 # ODrive.Axis.AxisState
 AXIS_STATE_UNDEFINED                     = 0
@@ -36,6 +59,14 @@ AXIS_STATE_CLOSED_LOOP_CONTROL           = 8
 AXIS_STATE_LOCKIN_SPIN                   = 9
 AXIS_STATE_ENCODER_DIR_FIND              = 10
 AXIS_STATE_HOMING                        = 11
+AXIS_STATE_ENCODER_ERROR_CALIBRATION     = 12
+AXIS_STATE_AUTOTUNE                      = 13
+AXIS_STATE_USER_SEQUENCE                 = 14
+
+# ODrive.Encoder.VelEstimatorMode
+VEL_ESTIMATOR_MODE_PLL                   = 0
+VEL_ESTIMATOR_MODE_TRACKING_OBSERVER     = 1
+VEL_ESTIMATOR_MODE_LOW_SPEED             = 2
 
 # ODrive.Encoder.Mode
 ENCODER_MODE_INCREMENTAL                 = 0
@@ -45,6 +76,7 @@ ENCODER_MODE_SPI_ABS_CUI                 = 256
 ENCODER_MODE_SPI_ABS_AMS                 = 257
 ENCODER_MODE_SPI_ABS_AEAT                = 258
 ENCODER_MODE_SPI_ABS_RLS                 = 259
+ENCODER_MODE_SPI_ABS_GENERIC             = 260
 
 # ODrive.Controller.ControlMode
 CONTROL_MODE_VOLTAGE_CONTROL             = 0
@@ -61,12 +93,78 @@ INPUT_MODE_MIX_CHANNELS                  = 4
 INPUT_MODE_TRAP_TRAJ                     = 5
 INPUT_MODE_TORQUE_RAMP                   = 6
 INPUT_MODE_MIRROR                        = 7
+INPUT_MODE_SCURVE_TRAJ                   = 8
+INPUT_MODE_SPLINE                        = 9
+INPUT_MODE_ELECTRONIC_GEAR               = 10
+
+# ODrive.Controller.AntiWindupMode
+ANTI_WINDUP_MODE_DECAY                   = 0
+ANTI_WINDUP_MODE_BACK_CALCULATION        = 1
+ANTI_WINDUP_MODE_CONDITIONAL             = 2
+
+# ODrive.Controller.InputShaperType
+INPUT_SHAPER_TYPE_ZV                     = 0
+INPUT_SHAPER_TYPE_ZVD                    = 1
+INPUT_SHAPER_TYPE_EI                     = 2
+
+# ODrive.Controller.FrequencyResponseInjection
+FREQUENCY_RESPONSE_INJECTION_TORQUE      = 0
+FREQUENCY_RESPONSE_INJECTION_VELOCITY    = 1
+FREQUENCY_RESPONSE_INJECTION_POSITION    = 2
+
+# ODrive.Controller.GearMasterSource
+GEAR_MASTER_SOURCE_ENCODER               = 0
+GEAR_MASTER_SOURCE_SETPOINT              = 1
+GEAR_MASTER_SOURCE_CAN                   = 2
 
 # ODrive.Motor.MotorType
 MOTOR_TYPE_HIGH_CURRENT                  = 0
 MOTOR_TYPE_GIMBAL                        = 2
 MOTOR_TYPE_ACIM                          = 3
 
+# ODrive.Motor.ModulationMode
+MODULATION_MODE_SVM                      = 0
+MODULATION_MODE_MIN_MAX                  = 1
+
+# ODrive.Oscilloscope.TriggerMode
+TRIGGER_MODE_IMMEDIATE                   = 0
+TRIGGER_MODE_RISING_EDGE                 = 1
+TRIGGER_MODE_FALLING_EDGE                = 2
+TRIGGER_MODE_ANY_EDGE                    = 3
+
+# ODrive.Oscilloscope.CaptureState
+CAPTURE_STATE_IDLE                       = 0
+CAPTURE_STATE_ARMED                      = 1
+CAPTURE_STATE_CAPTURING                  = 2
+CAPTURE_STATE_DONE                       = 3
+
+# ODrive.EventTrace.EventType
+EVENT_TYPE_NONE                          = 0
+EVENT_TYPE_STATE_CHANGE                  = 1
+EVENT_TYPE_AXIS_ERROR                    = 2
+EVENT_TYPE_MOTOR_ERROR                   = 3
+EVENT_TYPE_ENCODER_ERROR                 = 4
+EVENT_TYPE_CONTROLLER_ERROR              = 5
+EVENT_TYPE_SENSORLESS_ESTIMATOR_ERROR    = 6
+EVENT_TYPE_MOTOR_ARMED                   = 7
+EVENT_TYPE_MOTOR_DISARMED                = 8
+EVENT_TYPE_BRAKE_SATURATED               = 9
+EVENT_TYPE_CAN_BUS_OFF                   = 10
+EVENT_TYPE_DRV_FAULT                     = 11
+
+# ODrive.DataLogger.RecordType
+RECORD_TYPE_BOOT                         = 0
+RECORD_TYPE_SAMPLE                       = 1
+RECORD_TYPE_EVENTS                       = 2
+RECORD_TYPE_BURST                        = 3
+
+# ODrive.CrashSnapshot.Cause
+CAUSE_NONE                               = 0
+CAUSE_LOW_LEVEL_FAULT                    = 1
+CAUSE_HARD_FAULT                         = 2
+CAUSE_WATCHDOG_EXPIRED                   = 3
+CAUSE_THREAD_STALLED                     = 4
+
 # ODrive.Can.Error
 CAN_ERROR_NONE                           = 0x00000000
 CAN_ERROR_DUPLICATE_CAN_IDS              = 0x00000001
@@ -90,6 +188,7 @@ AXIS_ERROR_MAX_ENDSTOP_PRESSED           = 0x00002000
 AXIS_ERROR_ESTOP_REQUESTED               = 0x00004000
 AXIS_ERROR_HOMING_WITHOUT_ENDSTOP        = 0x00020000
 AXIS_ERROR_OVER_TEMP                     = 0x00040000
+AXIS_ERROR_HOMING_INDEX_NOT_FOUND        = 0x00080000
 
 # ODrive.Axis.LockinState
 LOCKIN_STATE_INACTIVE                    = 0
@@ -117,6 +216,9 @@ MOTOR_ERROR_DC_BUS_OVER_CURRENT          = 0x00008000
 MOTOR_ERROR_MODULATION_IS_NAN            = 0x00010000
 MOTOR_ERROR_MOTOR_THERMISTOR_OVER_TEMP   = 0x00020000
 MOTOR_ERROR_FET_THERMISTOR_OVER_TEMP     = 0x00040000
+MOTOR_ERROR_TORQUE_CONSTANT_OUT_OF_RANGE = 0x00080000
+MOTOR_ERROR_DC_BUS_OVER_VOLTAGE          = 0x00100000
+MOTOR_ERROR_CURRENT_SENSE_GAIN_OUT_OF_RANGE = 0x00200000
 
 # ODrive.Motor.ArmedState
 ARMED_STATE_DISARMED                     = 0
@@ -132,6 +234,9 @@ CONTROLLER_ERROR_UNSTABLE_GAIN           = 0x00000004
 CONTROLLER_ERROR_INVALID_MIRROR_AXIS     = 0x00000008
 CONTROLLER_ERROR_INVALID_LOAD_ENCODER    = 0x00000010
 CONTROLLER_ERROR_INVALID_ESTIMATE        = 0x00000020
+CONTROLLER_ERROR_AUTOTUNE_FAILED         = 0x00000040
+CONTROLLER_ERROR_GEAR_MASTER_LOST        = 0x00000080
+CONTROLLER_ERROR_SOFT_LIMIT_VIOLATION    = 0x00000100
 
 # ODrive.Encoder.Error
 ENCODER_ERROR_NONE                       = 0x00000000
@@ -144,6 +249,8 @@ ENCODER_ERROR_INDEX_NOT_FOUND_YET        = 0x00000020
 ENCODER_ERROR_ABS_SPI_TIMEOUT            = 0x00000040
 ENCODER_ERROR_ABS_SPI_COM_FAIL           = 0x00000080
 ENCODER_ERROR_ABS_SPI_NOT_READY          = 0x00000100
+ENCODER_ERROR_ERROR_MAP_INCOMPLETE       = 0x00000200
+ENCODER_ERROR_CALIB_RESIDUAL_TOO_LARGE   = 0x00000400
 
 # ODrive.SensorlessEstimator.Error
 SENSORLESS_ESTIMATOR_ERROR_NONE          = 0x00000000
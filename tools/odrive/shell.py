@@ -85,9 +85,12 @@ def launch_shell(args, logger, app_shutdown_token):
         'start_liveplotter': start_liveplotter,
         'dump_errors': dump_errors,
         'oscilloscope_dump': oscilloscope_dump,
+        'read_oscilloscope': read_oscilloscope,
         'dump_interrupts': dump_interrupts,
         'dump_dma': dump_dma,
         'BulkCapture': BulkCapture,
+        'TelemetryCapture': TelemetryCapture,
+        'Subscription': Subscription,
         'step_and_plot': step_and_plot,
         'calculate_thermistor_coeffs': calculate_thermistor_coeffs,
         'set_motor_thermistor_coeffs': set_motor_thermistor_coeffs
@@ -21,7 +21,7 @@ command_set = {
     'get_sensorless_error': (0x005, [('sensorless_error', 'I', 1)]), # untested
     'set_node_id': (0x006, [('node_id', 'I', 1)]), # tested
     'set_requested_state': (0x007, [('requested_state', 'I', 1)]), # tested
-    # 0x008 not yet implemented
+    'set_config_profile': (0x008, [('profile', 'B', 1)]), # untested
     'get_encoder_estimates': (0x009, [('encoder_pos_estimate', 'f', 1), ('encoder_vel_estimate', 'f', 1)]), # partially tested
     'get_encoder_count': (0x00a, [('encoder_shadow_count', 'i', 1), ('encoder_count', 'i', 1)]), # partially tested
     'set_controller_modes': (0x00b, [('control_mode', 'i', 1), ('input_mode', 'i', 1)]), # tested
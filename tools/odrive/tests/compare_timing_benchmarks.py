@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""
+Compares two result files of timing_benchmark_test.py, e.g. of the last
+release and of a new firmware build, and lists the timings that got worse.
+
+Usage: compare_timing_benchmarks.py baseline.json new.json [--threshold PERCENT]
+Exits with status 1 if any timing got worse by more than the threshold.
+"""
+
+import argparse
+import json
+import sys
+
+def get_metrics(result):
+    """
+    Flattens a benchmark result into {name: (value, higher_is_worse)}
+    """
+    metrics = {}
+    for key in sorted(result):
+        if not key.startswith('axis'):
+            continue
+        for name, stats in result[key]['task_times'].items():
+            metrics['{}.task_times.{}.mean'.format(key, name)] = (stats['mean'], True)
+            metrics['{}.task_times.{}.peak'.format(key, name)] = (stats['peak'], True)
+        deadline = result[key]['deadline']
+        if deadline['slack']['min'] is not None:
+            metrics['{}.deadline.slack.min'.format(key)] = (deadline['slack']['min'], False)
+        metrics['{}.deadline.near_misses'.format(key)] = (deadline['near_misses'], True)
+        metrics['{}.deadline.deadline_misses'.format(key)] = (deadline['deadline_misses'], True)
+    for name in ('p50', 'p99', 'max'):
+        metrics['fibre_round_trip_us.' + name] = (result['fibre_round_trip_us'][name], True)
+    for name, load in result['threads'].items():
+        metrics['threads.{}.cpu_load'.format(name)] = (load, True)
+    return metrics
+
+parser = argparse.ArgumentParser(description='Compares two timing benchmark results.')
+parser.add_argument('baseline', type=argparse.FileType('r'))
+parser.add_argument('new', type=argparse.FileType('r'))
+parser.add_argument('--threshold', type=float, default=10.0,
+                    help='change in percent above which a timing counts as regression (default 10)')
+args = parser.parse_args()
+
+baseline = json.load(args.baseline)
+new = json.load(args.new)
+print('baseline: firmware {}, {}'.format(baseline['fw_version'], baseline['timestamp']))
+print('new:      firmware {}, {}'.format(new['fw_version'], new['timestamp']))
+
+baseline_metrics = get_metrics(baseline)
+new_metrics = get_metrics(new)
+regressions = 0
+for name, (new_value, higher_is_worse) in new_metrics.items():
+    if not name in baseline_metrics:
+        continue
+    old_value = baseline_metrics[name][0]
+    if old_value == new_value:
+        continue
+    change = 100.0 * (new_value - old_value) / abs(old_value) if old_value else float('inf')
+    worse = change > args.threshold if higher_is_worse else change < -args.threshold
+    regressions += worse
+    if worse or abs(change) > args.threshold:
+        print('{} {:<50} {:>12.1f} -> {:>12.1f} ({:+.1f}%)'.format('!' if worse else ' ', name, old_value, new_value, change))
+
+print('{} regression(s) above {}%'.format(regressions, args.threshold))
+sys.exit(1 if regressions else 0)
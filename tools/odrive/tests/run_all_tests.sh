@@ -10,7 +10,9 @@ declare -a tests=('analog_input_test.py'
                   'integration_test.py'
                   'nvm_test.py'
                   'pwm_input_test.py'
+                  'sensorless_test.py'
                   'step_dir_test.py'
+                  'timing_benchmark_test.py'
                   'uart_ascii_test.py'
                   )
 summary=""
@@ -0,0 +1,39 @@
+
+import test_runner
+
+import time
+import os
+
+from fibre.utils import Logger
+from odrive.enums import *
+from test_runner import *
+
+
+class TestSensorlessEstimatorTiming():
+    """
+    Benchmarks the sensorless estimator update.
+
+    The estimator runs every control period on both axes, regardless of the
+    control mode, so its cost is measured with the task timers while the
+    axes are idle. The task timers count in CPU clock cycles.
+    """
+
+    def get_test_cases(self, testrig: TestRig):
+        for odrive in testrig.get_components(ODriveComponent):
+            yield (odrive,)
+
+    def run_test(self, odrive: ODriveComponent, logger: Logger):
+        max_cycles = 1000 # a few percent of the control period
+
+        odrive.handle.task_timers_armed = True
+        time.sleep(0.1)
+
+        for axis in odrive.handle.axes:
+            samples = record_log(lambda: [axis.task_times.sensorless_update.length], duration=1.0)
+            max_length = axis.task_times.sensorless_update.maxLength
+            logger.debug("sensorless update: mean {:.0f} cycles, max {} cycles".format(samples[:,1].mean(), max_length))
+            test_assert_within(max_length, 1, max_cycles)
+
+
+if __name__ == '__main__':
+    test_runner.run(TestSensorlessEstimatorTiming())
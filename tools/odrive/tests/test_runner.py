@@ -14,6 +14,7 @@ import yaml
 from inspect import signature
 import itertools
 import time
+import threading
 import tempfile
 import io
 from typing import Union, Tuple
@@ -205,6 +206,7 @@ class Component(object):
 class ODriveComponent(Component):
     def __init__(self, yaml: dict):
         self.handle = None
+        self.prepare_lock = threading.Lock() # axes of the same ODrive may be prepared by parallel tests
         self.yaml = yaml
         #self.axes = [ODriveAxisComponent(None), ODriveAxisComponent(None)]
         self.encoders = [ODriveEncoderComponent(self, 0, yaml['encoder0']), ODriveEncoderComponent(self, 1, yaml['encoder1'])]
@@ -232,9 +234,11 @@ class ODriveComponent(Component):
         """
         Connects to the ODrive
         """
-        if not self.handle is None:
-            return
+        with self.prepare_lock:
+            if self.handle is None:
+                self._connect(logger)
 
+    def _connect(self, logger: Logger):
         logger.debug('waiting for {} ({})'.format(self.yaml['name'], self.yaml['serial-number']))
         self.handle = odrive.find_any(
             path="usb", serial_number=self.yaml['serial-number'], timeout=60)#, printer=print)
@@ -242,10 +246,10 @@ class ODriveComponent(Component):
         #for axis_idx, axis_ctx in enumerate(self.axes):
         #    axis_ctx.handle = self.handle.__dict__['axis{}'.format(axis_idx)]
         for encoder_idx, encoder_ctx in enumerate(self.encoders):
-            encoder_ctx.handle = self.handle.__dict__['axis{}'.format(encoder_idx)].encoder
+            encoder_ctx.handle = getattr(self.handle, 'axis{}'.format(encoder_idx)).encoder
         # TODO: distinguish between axis and motor context
         for axis_idx, axis_ctx in enumerate(self.axes):
-            axis_ctx.handle = self.handle.__dict__['axis{}'.format(axis_idx)]
+            axis_ctx.handle = getattr(self.handle, 'axis{}'.format(axis_idx))
 
     def disable_mappings(self):
         self.handle.config.gpio1_pwm_mapping.endpoint = None # here
@@ -523,7 +527,7 @@ class TestRig():
         self.connections = []
         for connection_yaml in yaml['connections']:
             self.connections.append(set(self.components_by_name[name] for name in connection_yaml))
-        self.connections = list(disjoint_sets(self.connections))
+        self.connections = [frozenset(s) for s in disjoint_sets(self.connections)]
 
         # Dict for fast lookup of the connection sets for each port
         self.net_by_component = {}
@@ -531,6 +535,15 @@ class TestRig():
             for port in s:
                 self.net_by_component[port] = s
 
+        # Groups of components that depend on a common resource which is not
+        # modelled as a connection, e.g. two encoders on one power supply.
+        # Only one test at a time may use the components of a group.
+        self.shared_resources_by_component = {}
+        for group_yaml in yaml.get('shared-resources', None) or []:
+            group = frozenset(self.components_by_name[name] for name in group_yaml)
+            for component in group:
+                self.shared_resources_by_component.setdefault(component, set()).add(group)
+
     def get_components(self, t: type):
         """Returns a tuple (name, component) for all components that are of the specified type"""
         return (comp for comp in self.names_by_component.keys() if isinstance(comp, t))
@@ -541,6 +554,21 @@ class TestRig():
         else:
             return self.names_by_component[component]
 
+    def get_all_subcomponents(self, component: Component):
+        """Returns all subcomponents of the specified component, recursively"""
+        name = self.names_by_component[component]
+        return [c for n, c in self.components_by_name.items() if n.startswith(name + '.')]
+
+    def get_nets(self, component: Component):
+        """
+        Returns the connection set and the shared resource groups of the
+        specified component, if any.
+        """
+        nets = set(self.shared_resources_by_component.get(component, set()))
+        if component in self.net_by_component:
+            nets.add(self.net_by_component[component])
+        return nets
+
     def get_directly_connected_components(self, component: Union[str, Component]):
         """
         Returns all components that are directly connected to the specified
@@ -681,10 +709,131 @@ def select_params(param_options):
 
     return None
 
+class TestCase():
+    """
+    One test with the components that it runs on, and its result once it ran
+    """
+    def __init__(self, test, params):
+        self.test = test
+        self.params = params
+        self.name = type(test).__name__
+        self.param_names = [(testrig.get_component_name(p) if isinstance(p, Component) else str(p)) for p in (params or [])]
+        self.claims, self.nets = get_resources(test, params or [])
+        self.status = 'skipped' if params is None else 'not run'
+        self.error = None
+        self.start_time = None
+        self.duration = None
+
+    def conflicts_with(self, other):
+        if self.nets & other.nets:
+            return True
+        return any(is_part_of(a, b) or is_part_of(b, a) for a in self.claims for b in other.claims)
+
+    def to_json(self):
+        return {
+            'test': self.name,
+            'components': self.param_names,
+            'status': self.status,
+            'start': self.start_time,
+            'duration': self.duration,
+            'error': self.error,
+        }
+
+def is_part_of(component, other):
+    """Returns True if the component is the other component or one of its subcomponents"""
+    while not component is None:
+        if component is other:
+            return True
+        component = getattr(component, 'parent', None)
+    return False
+
+def get_resources(test, params):
+    """
+    Returns the components that a test case uses exclusively and the nets
+    that it uses. Two test cases can run at the same time if none of their
+    exclusive components is part of the other's and they share no net.
+
+    Besides the components given to the test, the test case also takes the
+    ODrive they belong to, because most tests reset or reboot it. A test
+    class whose tests only use their own axis can set `shares_odrive = True`
+    so that the axes of an ODrive are tested in parallel.
+    Routing through a Teensy takes the whole Teensy since it is reprogrammed
+    for every test.
+    """
+    claims = []
+    used = [] # the components whose nets the test uses
+    for param in params:
+        if isinstance(param, ProxiedComponent):
+            for teensy, gpio_in, gpio_out, gpio_noise_enable in param.gpio_tuples:
+                claims.append(teensy)
+                used += [gpio_in, gpio_out]
+            param = param.impl
+        if not isinstance(param, Component):
+            continue
+        claims.append(param)
+        used.append(param)
+        if not isinstance(param, TeensyComponent):
+            used += testrig.get_all_subcomponents(param)
+        odrive = param
+        while not odrive is None and not isinstance(odrive, ODriveComponent):
+            odrive = getattr(odrive, 'parent', None)
+        if odrive and not getattr(test, 'shares_odrive', False):
+            claims.append(odrive)
+    nets = set()
+    for component in used:
+        nets.update(testrig.get_nets(component))
+    return claims, nets
+
+def run_test_case(test_case: TestCase, logger: Logger):
+    test, params = test_case.test, list(test_case.params)
+    logger.notify('* preparing {} with {}...'.format(test_case.name, test_case.param_names))
+
+    teensies = set()
+    for param in params:
+        if isinstance(param, ProxiedComponent):
+            param.prepare()
+            for teensy, _, _, _ in param.gpio_tuples:
+                teensies.add(teensy)
+
+    for teensy in teensies:
+        teensy.commit_routing_config(logger)
+
+    # prepare all components
+    for param in params:
+        if isinstance(param, ProxiedComponent):
+            continue
+        if hasattr(param, 'prepare'):
+            param.prepare(logger)
+
+    logger.notify('* running {} on {}...'.format(test_case.name, test_case.param_names))
+
+    # Resolve routed components
+    for i, param in enumerate(params):
+        if isinstance(param, ProxiedComponent):
+            params[i] = param.impl
+
+    test.run_test(*params, logger)
+
+def write_results(test_cases, start_time):
+    """Writes the results of all test cases as JSON to the file given by --results"""
+    import json
+    results = {
+        'start': start_time,
+        'duration': time.time() - start_time,
+        'jobs': args.jobs,
+        'test_cases': [test_case.to_json() for test_case in test_cases],
+    }
+    for status in ['passed', 'failed', 'skipped', 'not run']:
+        results[status.replace(' ', '_')] = len([tc for tc in test_cases if tc.status == status])
+    with open(args.results, 'w') as fp:
+        json.dump(results, fp, indent=2)
+    logger.debug('results saved to {}'.format(args.results))
+
 def run(tests):
     if not isinstance(tests, list):
         tests = [tests]
 
+    test_cases = []
     for test in tests:
         # The result of get_test_cases can be described in ABNF grammar:
         #   test-case-list    = *arglist
@@ -702,49 +851,72 @@ def run(tests):
         # a warning is reported. A warning is also reported if for a particular
         # test case no component combination can be resolved.
 
-        test_cases = list(test.get_test_cases(testrig))
+        cases = list(test.get_test_cases(testrig))
 
-        if len(test_cases) == 0:
+        if len(cases) == 0:
             logger.warn('no test cases are available to conduct the test {}'.format(type(test).__name__))
             continue
         
-        for test_case in test_cases:
+        for test_case in cases:
             params = select_params(test_case)
             if params is None:
                 logger.warn('no resources are available to conduct the test {}'.format(type(test).__name__))
+            test_cases.append(TestCase(test, params))
+
+    # A test case starts as soon as a job is free and it doesn't conflict
+    # with any running test case or any test case before it in the list.
+    # Thus the test cases on the same components run in the order in which
+    # the tests were given, like on a single job.
+    start_time = time.time()
+    pending = [tc for tc in test_cases if tc.status == 'not run']
+    running = []
+    failures = []
+    cond = threading.Condition()
+
+    def job(test_case):
+        test_logger = logger if args.jobs == 1 else logger.indent('[{}] '.format(test_case.name))
+        test_case.start_time = time.time() - start_time
+        try:
+            run_test_case(test_case, test_logger)
+            test_case.status = 'passed'
+        except Exception as ex:
+            test_case.status = 'failed'
+            test_case.error = '{}: {}'.format(type(ex).__name__, ex)
+            test_logger.error('{} on {} failed: {}'.format(test_case.name, test_case.param_names, test_case.error))
+            failures.append(ex)
+        finally:
+            test_case.duration = time.time() - start_time - test_case.start_time
+            with cond:
+                running.remove(test_case)
+                cond.notify_all()
+
+    with cond:
+        while len(pending) and (args.keep_going or not failures):
+            next_case = None
+            if args.jobs == 0 or len(running) < args.jobs:
+                for i, test_case in enumerate(pending):
+                    if not any(test_case.conflicts_with(other) for other in running + pending[:i]):
+                        next_case = test_case
+                        break
+            if next_case is None:
+                cond.wait()
                 continue
-
-            logger.notify('* preparing {} with {}...'.format(type(test).__name__,
-                    [(testrig.get_component_name(p) if isinstance(p, Component) else str(p)) for p in params]))
-            
-            teensies = set()
-            for param in params:
-                if isinstance(param, ProxiedComponent):
-                    param.prepare()
-                    for teensy, _, _, _ in param.gpio_tuples:
-                        teensies.add(teensy)
-
-            for teensy in teensies:
-                teensy.commit_routing_config(logger)
-
-            # prepare all components
-            teensies = set()
-            for param in params:
-                if isinstance(param, ProxiedComponent):
-                    continue
-                if hasattr(param, 'prepare'):
-                    param.prepare(logger)
-
-            logger.notify('* running {} on {}...'.format(type(test).__name__,
-                    [(testrig.get_component_name(p) if isinstance(p, Component) else str(p)) for p in params]))
-
-            # Resolve routed components
-            for i, param in enumerate(params):
-                if isinstance(param, ProxiedComponent):
-                    params[i] = param.impl
-
-            test.run_test(*params, logger)
-
+            pending.remove(next_case)
+            running.append(next_case)
+            t = threading.Thread(target=job, args=(next_case,))
+            t.daemon = True
+            t.start()
+        while len(running):
+            cond.wait()
+
+    if args.results:
+        write_results(test_cases, start_time)
+
+    for test_case in test_cases:
+        logger.debug('{} {} on {}{}'.format(test_case.status, test_case.name, test_case.param_names,
+                '' if test_case.duration is None else ' in {:.1f}s'.format(test_case.duration)))
+    if failures:
+        raise failures[0]
 
     logger.success('All tests passed!')
 
@@ -760,6 +932,12 @@ parser.add_argument("--test-rig-yaml", type=argparse.FileType('r'), required=Tru
                     help="test rig YAML file")
 parser.add_argument("--setup-host", action='store_true', default=False,
                     help="configure operating system functions such as GPIOs (requires root)")
+parser.add_argument("--jobs", type=int, default=0,
+                    help="number of test cases to run at the same time on different components, 0 for no limit, 1 to run one after the other")
+parser.add_argument("--keep-going", action='store_true', default=False,
+                    help="start the remaining test cases after a test case failed")
+parser.add_argument("--results", metavar='FILE', default=os.environ.get('ODRIVE_TEST_RESULTS', None),
+                    help="write the results and durations of all test cases to this JSON file (default: $ODRIVE_TEST_RESULTS)")
 parser.set_defaults(ignore=[])
 
 args = parser.parse_args()
@@ -0,0 +1,207 @@
+
+import test_runner
+
+import json
+import os
+import threading
+import time
+
+from fibre.utils import Logger
+from odrive.enums import *
+from test_runner import *
+from can_test import command
+
+
+def get_task_timer_stats(timer):
+    return {
+        'count': timer.count,
+        'mean': timer.get_mean(),
+        'min': timer.minLength if timer.count else None,
+        'peak': timer.peakLength,
+        'histogram': [timer.get_histogram(i) for i in range(18)],
+    }
+
+def get_children(obj, attr):
+    """
+    Returns the names of the sub-objects of obj that have the attribute attr
+    (e.g. all task timers of an axis), so new ones are picked up without
+    touching this test.
+    """
+    return [name for name in dir(obj) if not name.startswith('_') and hasattr(getattr(obj, name), attr)]
+
+def get_round_trip_stats(samples):
+    samples = sorted(samples)
+    percentile = lambda p: samples[min(len(samples) - 1, int(p * len(samples)))]
+    return {
+        'count': len(samples),
+        'mean': sum(samples) / len(samples),
+        'min': samples[0],
+        'p50': percentile(0.5),
+        'p99': percentile(0.99),
+        'max': samples[-1],
+    }
+
+
+class TestTimingBenchmark():
+    """
+    Runs both axes in closed loop velocity control while CAN commands and
+    USB requests load the ODrive, then records the statistics of all task
+    timers, the PWM deadline margin, the thread loads and the fibre round
+    trip times into a JSON file.
+    Compare the files of two firmware builds with compare_timing_benchmarks.py.
+    For example, to measure CONFIG_HOT_CODE_IN_RAM, run this once with and once
+    without the option and compare the current_control and encoder task times.
+    The output file can be set with the environment variable
+    ODRIVE_BENCHMARK_OUTPUT.
+    """
+
+    duration = 10.0 # [s]
+    can_rate = 500 # [commands/s] per axis
+    vel = 1.0 # [turn/s]
+
+    def get_test_cases(self, testrig: TestRig):
+        for odrive in testrig.get_components(ODriveComponent):
+            axes = []
+            for num in range(2):
+                encoders = testrig.get_connected_components({
+                    'a': (odrive.encoders[num].a, False),
+                    'b': (odrive.encoders[num].b, False)
+                }, EncoderComponent)
+                motors = testrig.get_connected_components(odrive.axes[num], MotorComponent)
+                axes.append([(motor, encoder) for motor, encoder in itertools.product(motors, encoders)
+                             if encoder.impl in testrig.get_connected_components(motor)])
+            # the benchmark also runs without CAN interface, just without the CAN load
+            can_interfaces = list(testrig.get_connected_components(odrive.can, CanInterfaceComponent)) or [None]
+            yield (odrive, axes[0], axes[1], can_interfaces) # flattened to odrive, motor0, enc0, motor1, enc1, canbus
+
+    def prepare(self, odrive: ODriveComponent, motors, canbus, logger: Logger):
+        logger.debug('Setting up clean configuration...')
+        odrive.erase_config_and_reboot()
+        odrive.disable_mappings()
+        if canbus is not None:
+            odrive.handle.config.gpio15_mode = GPIO_MODE_CAN0
+            odrive.handle.config.gpio16_mode = GPIO_MODE_CAN0
+            odrive.handle.config.enable_can0 = True
+            odrive.save_config_and_reboot()
+
+        for axis_ctx, motor_ctx in zip(odrive.axes, motors):
+            axis_ctx.handle.motor.config.phase_resistance = float(motor_ctx.yaml['phase-resistance'])
+            axis_ctx.handle.motor.config.phase_inductance = float(motor_ctx.yaml['phase-inductance'])
+            axis_ctx.handle.motor.config.pre_calibrated = True
+            axis_ctx.handle.motor.config.direction = 0
+            axis_ctx.handle.encoder.config.use_index = False
+            axis_ctx.handle.encoder.config.calib_scan_omega = 12.566 # 2 electrical revolutions per second
+            axis_ctx.handle.encoder.config.calib_scan_distance = 50.265 # 8 revolutions
+            axis_ctx.handle.encoder.config.bandwidth = 1000
+            axis_ctx.handle.config.enable_watchdog = False
+            axis_ctx.handle.clear_errors()
+
+        logger.debug('Calibrating encoder offsets...')
+        for axis_ctx in odrive.axes:
+            request_state(axis_ctx, AXIS_STATE_ENCODER_OFFSET_CALIBRATION)
+        time.sleep(9) # actual calibration takes 8 seconds
+        for axis_ctx in odrive.axes:
+            test_assert_eq(axis_ctx.handle.current_state, AXIS_STATE_IDLE)
+            test_assert_no_error(axis_ctx)
+
+        # Return a context that can be used in a with-statement.
+        class safe_terminator():
+            def __enter__(self):
+                pass
+            def __exit__(self, exc_type, exc_val, exc_tb):
+                logger.debug('clearing config...')
+                for axis_ctx in odrive.axes:
+                    axis_ctx.handle.requested_state = AXIS_STATE_IDLE
+                time.sleep(0.005)
+                odrive.erase_config_and_reboot()
+        return safe_terminator()
+
+    def run_test(self, odrive: ODriveComponent, motor0: MotorComponent, enc0: EncoderComponent,
+                 motor1: MotorComponent, enc1: EncoderComponent, canbus: CanInterfaceComponent, logger: Logger):
+        with self.prepare(odrive, [motor0, motor1], canbus, logger):
+            odrv = odrive.handle
+            for axis_ctx in odrive.axes:
+                axis_ctx.handle.controller.config.control_mode = CONTROL_MODE_VELOCITY_CONTROL
+                axis_ctx.handle.controller.config.input_mode = INPUT_MODE_PASSTHROUGH
+                axis_ctx.handle.controller.input_vel = 0
+                request_state(axis_ctx, AXIS_STATE_CLOSED_LOOP_CONTROL)
+                axis_ctx.handle.controller.input_vel = self.vel
+
+            # Start the statistics from zero under load
+            odrv.task_timer_stats_enabled = False
+            for axis_ctx in odrive.axes:
+                axis = axis_ctx.handle
+                for name in get_children(axis.task_times, 'reset_stats'):
+                    getattr(axis.task_times, name).reset_stats()
+                axis.motor.deadline_monitor.slack.reset_stats()
+                axis.motor.deadline_monitor.near_misses = 0
+                axis.motor.deadline_monitor.deadline_misses = 0
+                axis.motor.deadline_monitor.current_meas_timeouts = 0
+
+            # The CAN thread must not use fibre, the main thread keeps USB busy
+            node_ids = [axis_ctx.handle.config.can.node_id for axis_ctx in odrive.axes]
+            stop = threading.Event()
+            def can_load():
+                while not stop.is_set():
+                    for node_id in node_ids:
+                        command(canbus.handle, node_id, False, 'set_input_vel', input_vel=self.vel, torque_ff=0.0)
+                    time.sleep(1.0 / self.can_rate)
+            can_thread = threading.Thread(target=can_load, daemon=True) if canbus is not None else None
+
+            logger.debug('Recording under load for {} s...'.format(self.duration))
+            odrv.task_timer_stats_enabled = True
+            if can_thread:
+                can_thread.start()
+            round_trips = []
+            start = time.monotonic()
+            while time.monotonic() - start < self.duration:
+                t0 = time.perf_counter()
+                odrv.vbus_voltage
+                round_trips.append((time.perf_counter() - t0) * 1e6)
+            odrv.task_timer_stats_enabled = False
+            stop.set()
+            if can_thread:
+                can_thread.join()
+
+            for axis_ctx in odrive.axes:
+                test_assert_no_error(axis_ctx)
+                test_assert_eq(axis_ctx.handle.current_state, AXIS_STATE_CLOSED_LOOP_CONTROL)
+
+            logger.debug('Reading statistics...')
+            result = {
+                'serial_number': odrive.yaml['serial-number'],
+                'hw_version': '{}.{}-{}V'.format(odrv.hw_version_major, odrv.hw_version_minor, odrv.hw_version_variant),
+                'fw_version': '{}.{}.{}{}'.format(odrv.fw_version_major, odrv.fw_version_minor, odrv.fw_version_revision, '-dev' if odrv.fw_version_unreleased else ''),
+                'timestamp': time.strftime('%Y-%m-%dT%H:%M:%S'),
+                'load': {'duration': self.duration, 'vel': self.vel, 'can_rate': self.can_rate if canbus else 0},
+                'fibre_round_trip_us': get_round_trip_stats(round_trips),
+                'threads': {name: getattr(odrv.system_stats.threads, name).cpu_load
+                            for name in get_children(odrv.system_stats.threads, 'cpu_load')},
+            }
+            for axis_ctx in odrive.axes:
+                axis = axis_ctx.handle
+                monitor = axis.motor.deadline_monitor
+                result['axis{}'.format(axis_ctx.num)] = {
+                    'task_times': {name: get_task_timer_stats(getattr(axis.task_times, name))
+                                   for name in get_children(axis.task_times, 'reset_stats')},
+                    'deadline': {
+                        'slack': get_task_timer_stats(monitor.slack),
+                        'near_misses': monitor.near_misses,
+                        'deadline_misses': monitor.deadline_misses,
+                        'current_meas_timeouts': monitor.current_meas_timeouts,
+                    },
+                }
+
+            for axis_ctx in odrive.axes:
+                request_state(axis_ctx, AXIS_STATE_IDLE)
+
+            filename = os.environ.get('ODRIVE_BENCHMARK_OUTPUT', 'timing_benchmark_{}.json'.format(odrive.yaml['serial-number']))
+            with open(filename, 'w') as fp:
+                json.dump(result, fp, indent=2)
+            logger.debug('Results written to {}'.format(filename))
+
+
+if __name__ == '__main__':
+    test_runner.run([
+        TestTimingBenchmark()
+    ])
@@ -1,6 +1,7 @@
 from __future__ import print_function
 
 import sys
+import struct
 import time
 import threading
 import platform
@@ -101,48 +102,125 @@ def dump_errors(odrv, clear=False):
             else:
                 print(prefix + _VT100Colors['green'] + "no error" + _VT100Colors['default'])
 
+def read_oscilloscope_values(odrv, start, count):
+    """
+    Reads count floats from the oscilloscope buffer of odrv, starting at
+    index start.
+    """
+    if not hasattr(odrv, 'read_oscilloscope_buffer'):
+        # firmware without bulk readout
+        return [odrv.get_oscilloscope_val(i) for i in range(start, start + count)]
+    data = odrv.read_oscilloscope_buffer(4 * start, 4 * count)
+    return list(struct.unpack("<{}f".format(len(data) // 4), data[:len(data) // 4 * 4]))
+
+def read_oscilloscope(odrv):
+    """
+    Returns the frames of the last completed capture of odrv.oscilloscope
+    in chronological order, as a list with one list of values per channel.
+    """
+    scope = odrv.oscilloscope
+    if scope.state != CAPTURE_STATE_DONE:
+        raise Exception("no completed capture")
+    num_channels = max(1, min(scope.config.num_channels, 4))
+    num_frames = scope.num_frames
+    first_frame = scope.first_frame
+    values = read_oscilloscope_values(odrv, 0, num_frames * num_channels)
+    channels = [[] for _ in range(num_channels)]
+    for i in range(num_frames):
+        frame = (first_frame + i) % num_frames
+        for ch in range(num_channels):
+            channels[ch].append(values[frame * num_channels + ch])
+    return channels
+
 def oscilloscope_dump(odrv, num_vals, filename='oscilloscope.csv'):
+    values = read_oscilloscope_values(odrv, 0, num_vals)
     with open(filename, 'w') as f:
-        for x in range(num_vals):
-            f.write(str(odrv.get_oscilloscope_val(x)))
+        for val in values:
+            f.write(str(val))
             f.write('\n')
 
 data_rate = 100
 plot_rate = 10
 num_samples = 1000
-def start_liveplotter(get_var_callback):
+
+class RingBuffer:
+    """
+    Keeps the last `capacity` rows of samples in a preallocated numpy array,
+    so appending takes constant time and memory however long it runs.
+    """
+    def __init__(self, capacity, width):
+        self._data = np.full((capacity, width), np.nan)
+        self._next = 0
+        self._count = 0
+        self._lock = threading.Lock()
+
+    def append(self, row):
+        with self._lock:
+            self._data[self._next] = row
+            self._next = (self._next + 1) % len(self._data)
+            self._count = min(self._count + 1, len(self._data))
+
+    def snapshot(self):
+        """Returns a copy of the rows in the buffer, oldest first"""
+        with self._lock:
+            if self._count < len(self._data):
+                return self._data[:self._count].copy()
+            return np.roll(self._data, -self._next, axis=0)
+
+def start_liveplotter(get_var_callback, data_rate=data_rate, plot_rate=plot_rate,
+                      num_samples=num_samples, log_file=None):
     """
     Starts a liveplotter.
     The variable that is plotted is retrieved from get_var_callback.
     This function returns immediately and the liveplotter quits when
     the user closes it.
+
+    The values are acquired at data_rate on a thread of their own and kept
+    in a ring buffer of num_samples rows. The plot is redrawn from that
+    buffer at plot_rate, so a slow redraw doesn't slow down the acquisition.
+    If log_file is given, every sample is also written to it, one line of
+    comma separated values starting with the time in seconds. A file name
+    ending in .bin is written in binary instead, as little endian float64
+    rows of the same values.
     """
 
     import matplotlib.pyplot as plt
 
     cancellation_token = Event()
+    buffer = [None] # created with the width of the first sample
 
-    global vals
-    vals = []
     def fetch_data():
-        global vals
-        while not cancellation_token.is_set():
-            try:
-                data = get_var_callback()
-            except Exception as ex:
-                print(str(ex))
-                time.sleep(1)
-                continue
-            vals.append(data)
-            if len(vals) > num_samples:
-                vals = vals[-num_samples:]
-            time.sleep(1/data_rate)
+        binary = log_file is not None and log_file.endswith('.bin')
+        log = open(log_file, 'wb' if binary else 'w') if log_file else None
+        try:
+            start_time = time.monotonic()
+            next_time = start_time
+            while not cancellation_token.is_set():
+                try:
+                    data = get_var_callback()
+                except Exception as ex:
+                    print(str(ex))
+                    time.sleep(1)
+                    next_time = time.monotonic()
+                    continue
+                now = time.monotonic()
+                row = [now - start_time] + list(data)
+                if buffer[0] is None:
+                    buffer[0] = RingBuffer(num_samples, len(row))
+                buffer[0].append(row)
+                if binary:
+                    log.write(struct.pack("<{}d".format(len(row)), *row))
+                elif log:
+                    log.write(",".join(str(val) for val in row) + "\n")
+
+                # fixed rate, skip samples if we fell behind
+                next_time = max(next_time + 1 / data_rate, now)
+                time.sleep(max(next_time - time.monotonic(), 0))
+        finally:
+            if log:
+                log.close()
 
-    # TODO: use animation for better UI performance, see:
-    # https://matplotlib.org/examples/animation/simple_anim.html
     def plot_data():
-        global vals
-
         plt.ion()
 
         # Make sure the script terminates when the user closes the plotter
@@ -150,12 +228,22 @@ def start_liveplotter(get_var_callback):
             cancellation_token.set()
         fig = plt.figure()
         fig.canvas.mpl_connect('close_event', did_close)
+        ax = fig.add_subplot(1, 1, 1)
+        lines = []
 
         while not cancellation_token.is_set():
-            plt.clf()
-            plt.plot(vals)
-            plt.legend(list(range(len(vals))))
-            fig.canvas.draw()
+            vals = buffer[0].snapshot() if buffer[0] else None
+            if vals is not None and len(vals):
+                if not lines:
+                    # create the lines once and only update their data afterwards
+                    lines = ax.plot(vals[:, 0], vals[:, 1:])
+                    ax.legend(list(range(vals.shape[1] - 1)))
+                else:
+                    for i, line in enumerate(lines):
+                        line.set_data(vals[:, 0], vals[:, i + 1])
+                ax.relim()
+                ax.autoscale_view()
+                fig.canvas.draw_idle()
             fig.canvas.start_event_loop(1/plot_rate)
 
     fetch_t = threading.Thread(target=fetch_data)
@@ -232,6 +320,99 @@ class BulkCapture:
         plt.legend(range(self.data.shape[1]-1))
         plt.show()
 
+class TelemetryCapture:
+    '''
+    Records the telemetry stream of an ODrive. Unlike BulkCapture the values
+    are sampled by the control loop and pushed by the ODrive, so the rate is
+    not limited by the round trip time of a request.
+
+    properties: list of up to 8 remote properties to record
+    decimation: number of control loop iterations per sample
+
+    Example Usage:
+        capture = TelemetryCapture(odrv0, [odrv0.axis0.encoder._remote_attributes['vel_estimate'],
+                                           odrv0.axis0.motor.current_control._remote_attributes['Iq_measured']])
+        # Do stuff while capturing
+        capture.stop()
+        print(capture.data) # one row per sample: loop_counter, values...
+    '''
+
+    def __init__(self, odrv, properties, decimation=1):
+        self.odrv = odrv
+        self._frames = []
+        for i, prop in enumerate(properties):
+            setattr(odrv.telemetry.config, 'channel' + str(i), prop)
+        odrv.telemetry.config.num_channels = len(properties)
+        odrv.telemetry.config.decimation = decimation
+        odrv.__channel__.telemetry_handler = self._process_packet
+        if not odrv.telemetry.start():
+            odrv.__channel__.telemetry_handler = None
+            raise Exception("telemetry could not be started")
+
+    def _process_packet(self, payload):
+        num_channels, num_frames = payload[0], payload[1]
+        frame_format = "<I{}f".format(num_channels)
+        frame_size = struct.calcsize(frame_format)
+        for i in range(num_frames):
+            self._frames.append(struct.unpack_from(frame_format, payload, 2 + i * frame_size))
+
+    def stop(self):
+        self.odrv.telemetry.stop()
+        self.odrv.__channel__.telemetry_handler = None
+        self.data = np.array(self._frames)
+        dropped = self.odrv.telemetry.dropped_frames
+        if dropped:
+            print("{} frames were dropped, consider a higher decimation".format(dropped))
+        return self.data
+
+class Subscription:
+    '''
+    Subscribes to changes of up to 8 properties of an ODrive, instead of
+    polling them. The ODrive checks the properties every interval_ms and
+    pushes the ones that changed by at least their deadband.
+
+    properties: list of (remote property, deadband) tuples, a deadband of 0
+        notifies on any change
+    callback: called on the receiver thread with a dict {index: value} of
+        the changed properties and the board time [us]
+
+    Example Usage:
+        def on_change(values, board_time):
+            print(values)
+        sub = Subscription(odrv0, [(odrv0.axis0._remote_attributes['current_state'], 0),
+                                   (odrv0.axis0.encoder._remote_attributes['pos_estimate'], 0.01)], on_change)
+        # ...
+        sub.stop()
+    '''
+
+    def __init__(self, odrv, properties, callback, interval_ms=10):
+        self.odrv = odrv
+        self._callback = callback
+        self.values = [None] * len(properties) # latest value of each property
+        for i, (prop, deadband) in enumerate(properties):
+            setattr(odrv.subscriptions.config, 'endpoint' + str(i), prop)
+            setattr(odrv.subscriptions.config, 'deadband' + str(i), deadband)
+        odrv.subscriptions.config.num_subscriptions = len(properties)
+        odrv.subscriptions.config.interval_ms = interval_ms
+        odrv.__channel__.notification_handler = self._process_packet
+        if not odrv.subscriptions.start():
+            odrv.__channel__.notification_handler = None
+            raise Exception("subscriptions could not be started")
+
+    def _process_packet(self, payload):
+        board_time, mask = struct.unpack_from('<IB', payload, 0)
+        changes = {}
+        offset = 5
+        for i in range(len(self.values)):
+            if mask & (1 << i):
+                changes[i] = self.values[i] = struct.unpack_from('<f', payload, offset)[0]
+                offset += 4
+        self._callback(changes, board_time)
+
+    def stop(self):
+        self.odrv.subscriptions.stop()
+        self.odrv.__channel__.notification_handler = None
+
 
 def step_and_plot(  axis,
                     step_size=100.0,
@@ -291,10 +472,8 @@ def print_drv_regs(name, motor):
     print("Control Reg 2: " + str(ctrl_reg_2) + " (" + format(ctrl_reg_2, '#09b') + ")")
 
 def show_oscilloscope(odrv):
-    size = 18000
-    values = []
-    for i in range(size):
-        values.append(odrv.get_oscilloscope_val(i))
+    size = 4096
+    values = read_oscilloscope_values(odrv, 0, size)
 
     import matplotlib.pyplot as plt
     plt.plot(values)
@@ -519,3 +698,323 @@ def dump_dma(odrv):
                      "*" if (status & 0x80000000) else " "))
 
 
+
+def dump_task_times(axis, percentiles=(50, 99, 99.9)):
+    """
+    Prints the statistics of all task timers of an axis in CPU clocks.
+    The percentiles are the upper bounds of the log2 histogram bins, so they
+    are accurate to a factor of 2.
+    """
+    print("| Task               |    Count |   Mean |    Min |    Max | " + " | ".join(("P" + str(p)).rjust(6) for p in percentiles) + " |")
+    print("|--------------------|----------|--------|--------|--------|" + "|".join("--------" for p in percentiles) + "|")
+    for name in dir(axis.task_times):
+        timer = getattr(axis.task_times, name)
+        if name.startswith('_') or not hasattr(timer, 'get_histogram'):
+            continue
+        count = timer.count
+        if count == 0:
+            continue
+        histogram = [timer.get_histogram(i) for i in range(18)]
+        bounds = []
+        for p in percentiles:
+            cumulative = 0
+            for i, n in enumerate(histogram):
+                cumulative += n
+                if cumulative >= count * p / 100:
+                    bounds.append((1 << i) - 1)
+                    break
+            else:
+                bounds.append(timer.peakLength)
+        print("| {} | {} | {} | {} | {} | {} |".format(
+                name.ljust(18), str(count).rjust(8), str(int(timer.get_mean())).rjust(6),
+                str(timer.minLength).rjust(6), str(timer.peakLength).rjust(6),
+                " | ".join(str(b).rjust(6) for b in bounds)))
+
+def dump_threads(odrv):
+    """
+    Prints the CPU load and the minimum remaining stack space of all threads.
+    """
+    threads = odrv.system_stats.threads
+    print("| Thread             | CPU load | Min stack space |")
+    print("|--------------------|----------|-----------------|")
+    for name in dir(threads):
+        thread = getattr(threads, name)
+        if name.startswith('_') or not hasattr(thread, 'cpu_load'):
+            continue
+        print("| {} | {} | {} |".format(name.ljust(18), "{:.1f}%".format(thread.cpu_load).rjust(8),
+                                       (str(thread.min_stack_space) + " B").rjust(15)))
+
+def dump_kernel_benchmarks(odrv):
+    """
+    Prints the CPU clocks per call of the hot path kernels that
+    odrv.benchmark_kernel() can time. The stateful parts of the control loop
+    are timed live, see dump_task_times().
+    """
+    print("| Kernel             | Clocks |")
+    print("|--------------------|--------|")
+    for name in sorted(k for k in dir(odrive.enums) if k.startswith("BENCHMARK_KERNEL_")):
+        cycles = odrv.benchmark_kernel(getattr(odrive.enums, name))
+        print("| {} | {} |".format(name[len("BENCHMARK_KERNEL_"):].lower().ljust(18), str(cycles).rjust(6)))
+
+_link_stats_fields = [
+    ('usb', ['rx_cnt', 'rx_cdc_cnt', 'rx_native_cnt', 'tx_cnt', 'tx_overrun_cnt', 'tx_error_cnt']),
+    ('usb_channel', ['rx_packets', 'rx_invalid', 'endpoint_requests', 'batch_requests',
+                     'async_call_requests', 'async_status_requests', 'truncated_responses',
+                     'dropped_responses', 'process_time_under_100us', 'process_time_under_1ms',
+                     'process_time_under_10ms', 'process_time_over_10ms']),
+]
+
+def _read_link_stats(odrv):
+    return {(group, name): getattr(getattr(odrv.system_stats, group), name)
+            for group, names in _link_stats_fields for name in names}
+
+def usb_link_report(odrv, num_requests=1000, duration=2.0, request_length=0, response_length=62):
+    """
+    Measures the round trip latency and the throughput of the link to odrv
+    with odrv.loopback() and prints them, together with the link counters
+    that changed meanwhile. The latency is measured one request at a time,
+    the throughput with as many requests in flight as the channel allows.
+    The response of the channel holds at most 62 bytes.
+    """
+    channel = odrv.__channel__
+    endpoint_id = odrv.loopback._id
+    request = bytes(i & 0xff for i in range(request_length))
+    expected = (request + bytes(i & 0xff for i in range(len(request), response_length)))[:response_length]
+    corrupted = 0
+    before = _read_link_stats(odrv)
+
+    latencies = []
+    for _ in range(num_requests):
+        start = time.monotonic()
+        response = channel.remote_endpoint_operation(endpoint_id, request, True, response_length)
+        latencies.append(time.monotonic() - start)
+        corrupted += bytes(response) != expected
+    latencies.sort()
+
+    pending = []
+    start = time.monotonic()
+    while time.monotonic() - start < duration:
+        pending.append(channel.remote_endpoint_operation_async(endpoint_id, request, True, response_length))
+    responses = [bytes(future.result()) for future in pending]
+    elapsed = time.monotonic() - start
+    corrupted += sum(response != expected for response in responses)
+    after = _read_link_stats(odrv)
+
+    def percentile(p):
+        return latencies[min(len(latencies) - 1, int(len(latencies) * p / 100))] * 1e3
+    print("Round trip latency of {} requests ({} B request, {} B response):".format(num_requests, request_length, response_length))
+    print("  min {:.3f} ms, median {:.3f} ms, P99 {:.3f} ms, max {:.3f} ms".format(
+            latencies[0] * 1e3, percentile(50), percentile(99), latencies[-1] * 1e3))
+    print("Throughput: {:.0f} requests/s, {:.1f} kB/s of responses".format(
+            len(responses) / elapsed, len(responses) * response_length / elapsed / 1e3))
+    if corrupted:
+        print(_VT100Colors['red'] + "{} corrupted responses".format(corrupted) + _VT100Colors['default'])
+    print("Link counters that changed (the report's own property reads included):")
+    for (group, name), value in after.items():
+        if value != before[(group, name)]:
+            print("  {}.{}: +{}".format(group, name, value - before[(group, name)]))
+    print("  usb_channel.max_process_time: {} us".format(odrv.system_stats.usb_channel.max_process_time))
+
+_axis_snapshot_fields = [
+    'loop_counter', 'current_state', 'error', 'motor_error', 'encoder_error', 'controller_error',
+    'pos_estimate', 'vel_estimate', 'torque_setpoint', 'Iq_setpoint', 'Iq_measured', 'Id_measured',
+    'vbus_voltage', 'ibus', 'fet_temperature', 'motor_temperature'
+]
+
+def read_axis_snapshot(axis):
+    """
+    Returns the state of the axis at one control loop iteration as a dict,
+    see axis.read_snapshot(). Returns None if the snapshot timed out.
+    """
+    data = axis.read_snapshot()
+    if len(data) < 64:
+        return None
+    return dict(zip(_axis_snapshot_fields, struct.unpack_from("<6I10f", data)))
+
+def read_frequency_response(axis):
+    """
+    Returns the completed rows of the frequency response measurement of
+    axis.controller as a list of (freq, gain, phase, torque_gain,
+    torque_phase) tuples, see controller.start_frequency_response().
+    """
+    data = axis.controller.read_frequency_response()
+    return [struct.unpack_from("<5f", data, offset) for offset in range(0, len(data) - 19, 20)]
+
+def measure_frequency_response(axis):
+    """
+    Runs controller.start_frequency_response() on an axis in closed loop
+    control with the parameters of controller.config.frequency_response and
+    returns the rows of read_frequency_response().
+    """
+    if not axis.controller.start_frequency_response():
+        raise Exception("the frequency response measurement didn't start, check the control mode and the parameters")
+    while axis.controller.frequency_response_active:
+        time.sleep(0.1)
+    return read_frequency_response(axis)
+
+def read_event_trace(odrv):
+    """
+    Returns the events in odrv.event_trace in chronological order, as a list
+    of (timestamp, type, source, arg, value) tuples.
+    """
+    trace = odrv.event_trace
+    count_before = trace.count
+    data = trace.read_buffer()
+    count_after = trace.count
+    size = len(data) // 12
+    # events recorded during the readout may have overwritten the oldest ones
+    first = max(0, count_after - size)
+    return [struct.unpack_from("<IBBHI", data, (n % size) * 12) for n in range(first, count_before)]
+
+def _enum_name(prefix, value):
+    names = [k for k in dir(odrive.enums) if k.startswith(prefix) and getattr(odrive.enums, k) == value]
+    return names[0][len(prefix):] if names else str(value)
+
+def _print_events(events):
+    for timestamp, event_type, source, arg, value in events:
+        source_name = "board" if source == 255 else "axis{}".format(source)
+        if event_type == EVENT_TYPE_STATE_CHANGE:
+            details = "{} -> {}".format(_enum_name("AXIS_STATE_", value), _enum_name("AXIS_STATE_", arg))
+        elif event_type in (EVENT_TYPE_AXIS_ERROR, EVENT_TYPE_MOTOR_ERROR, EVENT_TYPE_ENCODER_ERROR,
+                            EVENT_TYPE_CONTROLLER_ERROR, EVENT_TYPE_SENSORLESS_ESTIMATOR_ERROR, EVENT_TYPE_CAN_BUS_OFF):
+            details = "0x{:08x}".format(value)
+        elif event_type == EVENT_TYPE_DRV_FAULT:
+            details = "status 1: 0x{:03x}, status 2: 0x{:03x}".format(value, arg)
+        else:
+            details = ""
+        print("{:>10} {:<6} {:<26} {}".format(timestamp, source_name, _enum_name("EVENT_TYPE_", event_type), details))
+
+def dump_event_trace(odrv):
+    """
+    Prints the events in odrv.event_trace in chronological order.
+    """
+    _print_events(read_event_trace(odrv))
+
+_data_log_sector_size = 4096 # LogStorage::sector_size in the firmware
+_data_log_sample_fields = [
+    'vbus_voltage', 'ibus', 'Iq_setpoint', 'Iq_measured', 'pos_estimate', 'vel_estimate',
+    'fet_temperature', 'motor_temperature', 'axis_error', 'motor_error', 'encoder_error',
+    'controller_error', 'current_state'
+]
+_data_log_burst_fields = ['pos_estimate', 'vel_estimate', 'Iq_setpoint', 'Iq_measured', 'vbus_voltage']
+
+def _decode_data_log_record(record_type, payload):
+    if record_type == RECORD_TYPE_BOOT:
+        major, minor, revision, unreleased, reset_flags = struct.unpack_from("<BBBBI", payload)
+        return {'fw_version': (major, minor, revision, unreleased), 'reset_flags': reset_flags}
+    elif record_type == RECORD_TYPE_SAMPLE:
+        return dict(zip(_data_log_sample_fields, struct.unpack_from("<8f5I", payload)))
+    elif record_type == RECORD_TYPE_EVENTS:
+        return [struct.unpack_from("<IBBHI", payload, offset) for offset in range(0, len(payload) - 11, 12)]
+    elif record_type == RECORD_TYPE_BURST:
+        num_frames, trigger_frame, dt = struct.unpack_from("<HHf", payload)
+        values = struct.unpack_from("<{}f".format(5 * num_frames), payload, 8)
+        burst = {name: list(values[i::5]) for i, name in enumerate(_data_log_burst_fields)}
+        burst.update({'trigger_frame': trigger_frame, 'dt': dt})
+        return burst
+    return payload
+
+def read_data_log(odrv):
+    """
+    Returns the records in odrv.data_logger in chronological order, as a list
+    of (timestamp, type, source, data) tuples. data is a dict for samples,
+    bursts and boot records and a list of events in the format of
+    read_event_trace() for event records. Records with a bad CRC are skipped.
+    """
+    from fibre.protocol import calc_crc16
+    data = odrv.data_logger.read_buffer()
+    records = []
+    for sector in range(0, len(data), _data_log_sector_size):
+        end = min(len(data), sector + _data_log_sector_size)
+        offset = sector + 8
+        while offset + 12 <= end:
+            length, crc16, timestamp, record_type, source = struct.unpack_from("<HHIBB", data, offset)
+            if length == 0xffff:
+                break
+            payload = bytes(data[offset + 12:offset + 12 + length])
+            if offset + 12 + length <= end and calc_crc16(0x1337, bytes(data[offset + 4:offset + 12]) + payload) == crc16:
+                records.append((timestamp, record_type, source, _decode_data_log_record(record_type, payload)))
+            offset += (12 + length + 3) & ~3
+    return records
+
+def dump_data_log(odrv):
+    """
+    Prints the records in odrv.data_logger in chronological order.
+    """
+    for timestamp, record_type, source, data in read_data_log(odrv):
+        source_name = "board" if source == 255 else "axis{}".format(source)
+        if record_type == RECORD_TYPE_EVENTS:
+            _print_events(data)
+            continue
+        if record_type == RECORD_TYPE_SAMPLE:
+            details = ", ".join("{}: {:.3f}".format(k, data[k]) for k in _data_log_sample_fields[:8])
+            details += ", state: {}".format(_enum_name("AXIS_STATE_", data['current_state']))
+            if data['axis_error']:
+                details += ", error: 0x{:08x}".format(data['axis_error'])
+        elif record_type == RECORD_TYPE_BURST:
+            details = "{} frames at {:.1f} us, error at frame {}".format(len(data['pos_estimate']), data['dt'] * 1e6, data['trigger_frame'])
+        elif record_type == RECORD_TYPE_BOOT:
+            details = "firmware v{}.{}.{}{}, reset flags: 0x{:08x}".format(*data['fw_version'][:3], "-dev" if data['fw_version'][3] else "", data['reset_flags'])
+        else:
+            details = ""
+        print("{:>10} ms {:<6} {:<10} {}".format(timestamp, source_name, _enum_name("RECORD_TYPE_", record_type), details))
+
+# in the order of Axis::TaskTimes_t in the firmware
+_crash_snapshot_task_timers = [
+    'thermistor_update', 'encoder_update', 'sensorless_update', 'min_endstop_update',
+    'max_endstop_update', 'axis_update', 'axis_error_check', 'controller_update',
+    'motor_update', 'update_handler', 'brake_update', 'adc_cb', 'control_loop',
+    'total', 'FOC_Current'
+]
+
+def read_crash_snapshot(odrv):
+    """
+    Returns the bulk data of odrv.crash_snapshot as a dict with the events in
+    chronological order, the oscilloscope values as one list per channel and
+    the task timings per axis, or None if no snapshot is held.
+    """
+    snapshot = odrv.crash_snapshot
+    if not snapshot.valid:
+        return None
+    data = snapshot.read_buffer()
+    event_slots, scope_size = 128, 256
+    events = [struct.unpack_from("<IBBHI", data, (n % event_slots) * 12)
+              for n in range(max(0, snapshot.event_count - event_slots), snapshot.event_count)]
+    offset = event_slots * 12
+    values = struct.unpack_from("<{}f".format(snapshot.num_scope_values), data, offset)
+    num_channels = max(1, snapshot.scope_num_channels)
+    scope = [list(values[ch::num_channels]) for ch in range(num_channels)]
+    offset += scope_size * 4
+    task_timings = []
+    while offset + 8 * len(_crash_snapshot_task_timers) <= len(data):
+        timings = {}
+        for name in _crash_snapshot_task_timers:
+            timings[name] = struct.unpack_from("<II", data, offset)
+            offset += 8
+        task_timings.append(timings)
+    return {'events': events, 'scope': scope, 'task_timings': task_timings}
+
+def dump_crash_snapshot(odrv):
+    """
+    Prints the post-mortem snapshot held in odrv.crash_snapshot.
+    """
+    snapshot = odrv.crash_snapshot
+    print("reset flags: 0x{:08x}".format(snapshot.reset_flags))
+    bulk = read_crash_snapshot(odrv)
+    if bulk is None:
+        print("no snapshot")
+        return
+    print("cause: {} (0x{:08x}) after {} ms".format(_enum_name("CAUSE_", snapshot.cause), snapshot.fault_arg, snapshot.uptime))
+    if snapshot.cause == CAUSE_HARD_FAULT:
+        print("pc: 0x{:08x}, lr: 0x{:08x}, cfsr: 0x{:08x}".format(snapshot.pc, snapshot.lr, snapshot.cfsr))
+    for i, timings in enumerate(bulk['task_timings']):
+        axis = getattr(snapshot, 'axis' + str(i))
+        print("axis{}: {} at loop {}".format(i, _enum_name("AXIS_STATE_", axis.current_state), axis.loop_counter))
+        for name, prefix in [('error', 'AXIS_ERROR_'), ('motor_error', 'MOTOR_ERROR_'), ('encoder_error', 'ENCODER_ERROR_'),
+                             ('controller_error', 'CONTROLLER_ERROR_'), ('sensorless_estimator_error', 'SENSORLESS_ESTIMATOR_ERROR_')]:
+            value = getattr(axis, name)
+            if value:
+                bits = [k[len(prefix):] for k in dir(odrive.enums) if k.startswith(prefix) and getattr(odrive.enums, k) & value]
+                print("  {}: {}".format(name, ", ".join(bits)))
+        print("  control_loop: {} clocks (max {})".format(*timings['control_loop']))
+    _print_events(bulk['events'])
@@ -44,7 +44,7 @@ bump_rev = not is_post_release and not is_release
 
 # TODO: add additional y/n prompt to prevent from erroneous upload
 
-from setuptools import setup
+from setuptools import setup, Extension
 import os
 import sys
 
@@ -101,6 +101,8 @@ try:
     name = 'odrive',
     packages = ['odrive', 'odrive.dfuse', 'fibre'],
     scripts = ['odrivetool', 'odrivetool.bat', 'odrive_demo.py'],
+    # Optional, fibre falls back to pure Python if this fails to build
+    ext_modules = [Extension('fibre._native', ['fibre/_native.c'], optional=True)],
     version = version,
     description = 'Control utilities for the ODrive high performance motor controller',
     author = 'Oskar Weigl',
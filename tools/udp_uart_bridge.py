@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""
+Reference UDP bridge for ODrives without a network interface of their own.
+Runs on a co-processor (e.g. a Raspberry Pi) that is connected to the UART of
+each ODrive, with `odrv0.config.uart0_protocol = STREAM_PROTOCOL_FIBRE`.
+Each UDP port serves one ODrive: every datagram goes out on the UART as one
+stream packet and every packet from the UART goes back as one datagram, so
+batched datagrams pass through unchanged (see DatagramChannel in
+Firmware/fibre/cpp/include/fibre/protocol.hpp).
+
+Usage:
+    udp_uart_bridge.py 9910:/dev/ttyAMA0 9911:/dev/ttyUSB0 --baud 921600
+    odrivetool --path udp:bridge-host:9910
+"""
+
+import argparse
+import os
+import socket
+import sys
+import threading
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.dirname(
+                    os.path.realpath(__file__))),
+                    "Firmware", "fibre", "python"))
+import fibre.protocol
+from fibre.serial_transport import SerialStreamTransport
+from fibre.utils import TimeoutError
+
+def bridge(port, serial_port, baud):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', port))
+    uart = SerialStreamTransport(serial_port, baud)
+    uart_output = fibre.protocol.StreamBasedPacketSink(uart)
+    uart_input = fibre.protocol.PacketFromStreamConverter(uart)
+    peer = [None] # the responses go to the last host that sent a datagram
+
+    def uart_to_udp():
+        while True:
+            try:
+                packet = uart_input.get_packet(None)
+            except TimeoutError:
+                continue
+            if peer[0] is not None:
+                sock.sendto(packet, peer[0])
+
+    t = threading.Thread(target=uart_to_udp)
+    t.daemon = True
+    t.start()
+
+    while True:
+        datagram, peer[0] = sock.recvfrom(1024)
+        uart_output.process_packet(datagram)
+
+def main():
+    parser = argparse.ArgumentParser(description='Bridges UDP ports to the fibre UART of ODrives')
+    parser.add_argument('bridges', metavar='PORT:SERIAL', nargs='+', help='UDP port and serial port of one ODrive')
+    parser.add_argument('--baud', type=int, default=115200, help='baud rate of the UARTs, see odrv0.config.uart0_baudrate')
+    args = parser.parse_args()
+
+    threads = []
+    for spec in args.bridges:
+        port, serial_port = spec.split(':', 1)
+        t = threading.Thread(target=bridge, args=(int(port), serial_port, args.baud))
+        t.daemon = True
+        t.start()
+        threads.append(t)
+    for t in threads:
+        t.join()
+
+if __name__ == '__main__':
+    main()